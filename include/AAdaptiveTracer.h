@@ -0,0 +1,84 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_ADAPTIVE_TRACER_H
+#define A_ADAPTIVE_TRACER_H
+
+#include <vector>
+
+#include "TObject.h"
+
+#include "ARayGenerator.h"
+
+class AOpticsManager;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AAdaptiveTracer
+//
+// Driver tracing configurations in rounds until their observables converge
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class AAdaptiveTracer : public TObject {
+ public:
+  enum { kContainmentRadius, kFocusedFraction, kTimeSpread };
+
+ private:
+  struct Observable {
+    Int_t fType;
+    Double_t fPrecision;  // target relative error
+    Double_t fFraction;   // containment fraction of kContainmentRadius
+  };
+  struct Configuration {
+    ARayGenerator fGenerator;  // rays of each round
+    Int_t fNrays;              // number of rays traced
+    Bool_t fConverged;
+    std::vector<Double_t> fX, fY, fT, fW;  // focused hits
+    std::vector<std::size_t> fRoundEnd;    // number of hits after each round
+    std::vector<Double_t> fValue, fError;  // of each observable
+    std::vector<std::vector<Double_t>> fRoundValue;  // of each round
+  };
+
+  AOpticsManager* fManager;  // (not owned)
+  std::vector<Observable> fObservables;
+  std::vector<Configuration> fConfigurations;
+  Int_t fMinRounds;  // rounds traced before the errors are trusted
+  Int_t fMaxRays;    // number of rays of a configuration to give up at
+
+  Double_t Evaluate(const Configuration& conf, const Observable& obs,
+                    std::size_t first, std::size_t last, Int_t nrays) const;
+  void Update(Configuration& conf) const;
+
+ public:
+  AAdaptiveTracer(AOpticsManager* manager = 0);
+  virtual ~AAdaptiveTracer() {}
+
+  Int_t AddConfiguration(const ARayGenerator& generator);
+  Int_t AddObservable(Int_t type, Double_t precision, Double_t fraction = 0.8);
+  Double_t GetError(Int_t conf, Int_t obs) const {
+    return fConfigurations[conf].fError[obs];
+  }
+  Int_t GetNconfigurations() const { return Int_t(fConfigurations.size()); }
+  Int_t GetNrays(Int_t conf) const { return fConfigurations[conf].fNrays; }
+  Int_t GetNrounds(Int_t conf) const {
+    return Int_t(fConfigurations[conf].fRoundEnd.size());
+  }
+  Double_t GetValue(Int_t conf, Int_t obs) const {
+    return fConfigurations[conf].fValue[obs];
+  }
+  Bool_t IsConverged(Int_t conf) const {
+    return fConfigurations[conf].fConverged;
+  }
+  void Reset();
+  Int_t Run();
+  void SetMaxRays(Int_t n) { fMaxRays = n; }
+  void SetMinRounds(Int_t n) { fMinRounds = n < 2 ? 2 : n; }
+
+  ClassDef(AAdaptiveTracer, 0)
+};
+
+#endif  // A_ADAPTIVE_TRACER_H
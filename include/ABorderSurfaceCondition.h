@@ -29,10 +29,17 @@ class ABorderSurfaceCondition : public TObject {
   Bool_t fLambertian;
 
  public:
+  ABorderSurfaceCondition();
   ABorderSurfaceCondition(AOpticalComponent* component1,
                           AOpticalComponent* component2);
   virtual ~ABorderSurfaceCondition();
 
+  void CountMemory(AMemoryUtil::Counter& counter) const {
+    // this condition and its multilayer, which may be shared
+    if (counter.Add(this, AMemoryUtil::SizeOf(this)) and fMultilayer) {
+      fMultilayer->CountMemory(counter);
+    }
+  }
   const AOpticalComponent* GetComponent1() const { return fComponent[0]; }
   const AOpticalComponent* GetComponent2() const { return fComponent[1]; }
   Double_t GetGaussianRoughness() const { return fSigma; }
@@ -44,7 +51,7 @@ class ABorderSurfaceCondition : public TObject {
   Bool_t IsLambertian() const {return fLambertian;}
   void EnableLambertian(Bool_t enable) {fLambertian = enable;}
 
-  ClassDef(ABorderSurfaceCondition, 1)
+  ClassDef(ABorderSurfaceCondition, 2)
 };
 
 #endif  // A_BORDER_SURFACE_CONDITION_H
@@ -0,0 +1,94 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_CAMERA_MAP_H
+#define A_CAMERA_MAP_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "TGeoMatrix.h"
+#include "TObject.h"
+
+class AFocalPlaneMonitor;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ACameraMap
+//
+// Pixel map of a focal-plane camera giving the pixel IDs of hits
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ACameraMap : public TObject {
+  friend class AFocalPlaneMonitor;
+
+ public:
+  enum { kNone, kSquare, kHexagonal, kPolygon };
+
+ private:
+  Int_t fType;
+  Int_t fNx, fNy;       // number of pixels (square) or index cells (polygon)
+  Int_t fNrings;        // number of rings around the central hexagon
+  Double_t fPitch;      // distance between the centers of adjacent pixels
+  Double_t fSize;       // sensitive size (flat to flat) of each pixel
+  TGeoHMatrix fMatrix;  // local frame of the camera
+  std::vector<Double_t> fCenterX, fCenterY;  // pixel centers
+  std::vector<Int_t> fHexIndex;  // pixel IDs of the axial coordinates
+
+  std::vector<std::vector<Double_t>> fPolygonX, fPolygonY;  // polygon pixels
+  Double_t fXmin, fXmax, fYmin, fYmax;  // range of the grid index
+  Double_t fInvDx, fInvDy;              // inverse sizes of the cells
+  std::vector<std::vector<Int_t>> fCells;  //! polygons overlapping the cells
+  mutable std::atomic<Bool_t> fIndexReady;  //!
+  mutable std::mutex fIndexMutex;           //!
+
+  std::vector<ULong64_t> fEntries;  // number of hits of each pixel
+  std::vector<Double_t> fSumW;      // sum of the weights
+  std::vector<Double_t> fSumWT;     // sum of the weighted arrival times
+  std::vector<Double_t> fFirstTime;  // earliest arrival time
+  std::mutex fMutex;                 //! guards the accumulators
+
+  void AddHit(Int_t id, Double_t t, Double_t weight);
+  void BuildIndex() const;
+  Int_t FindHexagon(Double_t x, Double_t y) const;
+  Int_t FindPolygon(Double_t x, Double_t y) const;
+  Int_t FindSquare(Double_t x, Double_t y) const;
+  void Init(Int_t type, Double_t pitch, Double_t size);
+  void ResizeAccumulators();
+
+ public:
+  ACameraMap();
+  ACameraMap(const ACameraMap&) = delete;
+  ACameraMap& operator=(const ACameraMap&) = delete;
+  virtual ~ACameraMap() {}
+
+  Int_t AddPolygon(Int_t n, const Double_t* x, const Double_t* y);
+  void Fill(Int_t id, Double_t t, Double_t weight = 1.);
+  Int_t FindPixel(Double_t x, Double_t y) const;
+  Int_t FindPixelOfPoint(const Double_t* point) const;
+  ULong64_t GetEntries(Int_t id) const { return fEntries[id]; }
+  Double_t GetFirstTime(Int_t id) const { return fFirstTime[id]; }
+  Double_t GetMeanTime(Int_t id) const {
+    return fSumW[id] > 0 ? fSumWT[id] / fSumW[id] : 0.;
+  }
+  Int_t GetNpixels() const { return Int_t(fCenterX.size()); }
+  void GetPixelCenter(Int_t id, Double_t& x, Double_t& y) const {
+    x = fCenterX[id];
+    y = fCenterY[id];
+  }
+  Double_t GetSumOfWeights(Int_t id) const { return fSumW[id]; }
+  Int_t GetType() const { return fType; }
+  void Reset();
+  void SetHexagonalLattice(Double_t pitch, Int_t nrings, Double_t size = 0);
+  void SetMatrix(const TGeoMatrix& matrix) { fMatrix = matrix; }
+  void SetSquareLattice(Double_t pitch, Int_t nx, Int_t ny, Double_t size = 0);
+
+  ClassDef(ACameraMap, 0)
+};
+
+#endif  // A_CAMERA_MAP_H
@@ -28,6 +28,8 @@ class ACauchyFormula : public ARefractiveIndex {
   ACauchyFormula(const Double_t* p);
 
   virtual Double_t GetRefractiveIndex(Double_t lambda /* (m) */) const;
+  virtual void GetRefractiveIndex(const Double_t* lambda, Double_t* n,
+                                  std::size_t count) const;
 
   ClassDef(ACauchyFormula, 1)
 };
@@ -0,0 +1,80 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_CORSIKA_IACT_DRIVER_H
+#define A_CORSIKA_IACT_DRIVER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "TObject.h"
+#include "TString.h"
+
+class ACorsikaIACTFile;
+class AOpticsManager;
+class ARaySink;
+class TH1;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ACorsikaIACTDriver
+//
+// Driver tracing CORSIKA IACT files with many processes (ranks).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+class ACorsikaIACTDriver : public TObject {
+ private:
+  AOpticsManager* fManager;   // geometry shared by all the telescopes
+  Double_t fZOffset;          // starting position of photons (see GetRayArray)
+  Double_t fRefractiveIndex;  // refractive index of air at the observation
+  Int_t fArrayNumber;         // CORSIKA array (core location) to be traced
+  Int_t fRank;                // rank of this process
+  Int_t fNranks;              // total number of processes
+  Bool_t fBunchTracing;       // trace bunches as weighted rays
+  Double_t fCheckpointInterval;  // seconds between checkpoints (< 0 = never)
+  std::vector<std::string> fFiles;
+  std::vector<Int_t> fTelescopes;  // empty = all the telescopes
+  std::map<Int_t, AOpticsManager*> fManagers;  // geometries of telescopes
+  std::vector<TH1*> fAccumulators;  // saved with checkpoints (not owned)
+
+ public:
+  ACorsikaIACTDriver(AOpticsManager* manager = 0, Double_t zoffset = 0,
+                     Double_t refractiveIndex = 1.);
+  virtual ~ACorsikaIACTDriver();
+
+  void AddAccumulator(TH1* hist) { fAccumulators.push_back(hist); }
+  void AddFile(const char* fname) { fFiles.push_back(fname); }
+  void AddTelescope(Int_t telNo) { fTelescopes.push_back(telNo); }
+  AOpticsManager* GetManager(Int_t telNo) const;
+  Int_t GetNranks() const { return fNranks; }
+  Int_t GetRank() const { return fRank; }
+  static TString GetRankFileName(const char* output, Int_t rank);
+  Bool_t IsAssigned(ULong64_t unit) const {
+    return Int_t(unit % fNranks) == fRank;
+  }
+  static Bool_t Merge(const char* output, Int_t nranks,
+                      Bool_t removeInputs = kFALSE);
+  Long64_t Run(const char* output, Bool_t resume = kFALSE,
+               Int_t maxEvents = -1);
+  void SetArrayNumber(Int_t arrayNo) { fArrayNumber = arrayNo; }
+  void SetBunchTracing(Bool_t enable) { fBunchTracing = enable; }
+  void SetCheckpointInterval(Double_t seconds) {
+    fCheckpointInterval = seconds;
+  }
+  void SetManager(Int_t telNo, AOpticsManager* manager) {
+    fManagers[telNo] = manager;
+  }
+  void SetRank(Int_t rank, Int_t nranks);
+  Bool_t SetRankFromEnvironment();
+  Int_t TraceEvent(ACorsikaIACTFile& corsika,
+                   const std::map<Int_t, ARaySink*>& sinks);
+
+  ClassDef(ACorsikaIACTDriver, 0)
+};
+
+#endif  // A_CORSIKA_IACT_DRIVER_H
@@ -18,6 +18,16 @@
 
 #include "TTree.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "ACorsikaIACTEventHeader.h"
 #include "ACorsikaIACTRunHeader.h"
 #include "ARayArray.h"
@@ -28,50 +38,153 @@
 //
 // Wrapper class for I/O functions of CORSIKA IACT files.
 //
+// ReadEvent decodes the photon blocks of an event straight into one bunch
+// buffer. GetBunchSpans hands out views of it for each telescope, and
+// GetRayArray converts them into rays. The TTree of the bunches is made only
+// when GetBunches is called.
+//
+// GetRayArray can also make one weighted ray per bunch instead of one ray per
+// photon. The bunches are then traced with AOpticsManager::
+// EnableWeightedTracing(kTRUE), and SamplePhotonCount converts the weights of
+// the focused rays into numbers of photons.
+//
+// BuildEventIndex scans a file once for the positions of its events and
+// saves them in a sidecar file (<file name>.idx), which Open reads if it is
+// up to date. ReadEvent then jumps to any event, including earlier ones, so
+// that a file can be split among jobs by event ranges.
+//
+// With SetReadAhead(n), a background thread decompresses and decodes the
+// next n events while the current one is being traced. ReadEvent then takes
+// the decoded events from the queue.
+//
+// The I/O buffer (initially bufferLength bytes at most) and the bunch buffers
+// grow to fit the largest block and event, and are reused afterwards.
+// GetBufferHighWaterMark and GetBunchHighWaterMark report the peak sizes.
+//
 ////////////////////////////////////////////////////////////////////////////////
 
 class ACorsikaIACTFile : public TObject {
+ public:
+  // View of the contiguous bunches of a photon block
+  struct BunchSpan {
+    const struct bunch* fBegin;
+    const struct bunch* fEnd;
+
+    const struct bunch* begin() const { return fBegin; }
+    const struct bunch* end() const { return fEnd; }
+    std::size_t size() const { return fEnd - fBegin; }
+  };
+
  private:
   static const Int_t kMaxArrays;
   static const Int_t kMaxTelescopes;
 
+  // ranges (first, count) in fBunchData of each (array, telescope)
+  typedef std::vector<std::pair<Long64_t, Long64_t> > EntryRanges;
+
+  // position of an event header in the file
+  struct EventPosition {
+    Int_t fNumber;     // CORSIKA event number
+    Long64_t fBlock;   // number of top-level blocks before it
+    Long64_t fOffset;  // byte offset (-1 if the file is not seekable)
+  };
+
+  // decoded data of one event
+  struct EventData {
+    ACorsikaIACTEventHeader* fHeader;
+    Double_t fMaxWavelength;
+    Double_t fMinWavelength;
+    struct bunch* fBunchData;  // decoded bunches of all the telescopes
+    Long64_t fBunchDataSize;
+    Long64_t fBunchDataCapacity;
+    std::map<std::pair<Int_t, Int_t>, EntryRanges> fBunchIndex;
+
+    EventData();
+    EventData(const EventData&) = delete;
+    EventData& operator=(const EventData&) = delete;
+    ~EventData();
+    void Clear();
+  };
+
   IO_ITEM_HEADER fBlockHeader;
-  TTree* fBunches;
+  mutable TTree* fBunches;  // made from the current event on demand
   struct linked_string fCorsikaInputs;
-  ACorsikaIACTEventHeader* fEventHeader;
+  EventData* fEvent;  //! current event
   TString fFileName;
   IO_BUFFER* fIOBuffer;
-  Int_t fMaxPhotonBunches;
+  Long64_t fMaxBufferLength;  // limit of the I/O buffer size (0 = none)
+  std::atomic<Long64_t> fBufferHighWaterMark;  //! largest block read
+  std::atomic<Long64_t> fBunchHighWaterMark;   //! most bunches in an event
+  Int_t fMaxPhotonBunches;  // limit of bunches in a photon block (0 = none)
   Int_t fNumberOfTelescopes;
   ACorsikaIACTRunHeader* fRunHeader;
   Double_t* fTelescopePosition[4];  //
-  Double_t fMaxWavelength;
-  Double_t fMinWavelength;
+  Int_t fRayPoolBlockSize;  // block size of ray pools (0 = not pooled)
+  Long64_t fBlockCount;     // number of top-level blocks read so far
+  std::vector<EventPosition> fEventIndex;  //! sorted by event number
+
+  // read-ahead of the next events, see SetReadAhead
+  Int_t fReadAhead;                         // number of events (0 = off)
+  std::thread fReader;                      //! decodes the next events
+  std::mutex fQueueMutex;                   //!
+  std::condition_variable fQueueCondition;  //!
+  std::deque<EventData*> fQueue;            //! decoded events
+  std::vector<EventData*> fFreeEvents;      //! buffers to be decoded into
+  Bool_t fStopReader;                       //!
+  Bool_t fReaderDone;                       //! reader thread has finished
+  Bool_t fReaderEOF;                        //! reader reached the end
 
+  void ClearBunches();
+  Int_t DecodeEvent(Int_t num, EventData& event, Bool_t& eof);
+  void FitIOBuffer();
+  TString GetIndexFileName() const;
+  Bool_t LoadEventIndex();
+  void ReadAhead();
   Int_t ReadNextBlock();
+  Bool_t SaveEventIndex() const;
+  Bool_t SeekEvent(Int_t num);
+  void StartReadAhead();
+  void StopReadAhead(Bool_t discard = kFALSE);
 
  public:
   ACorsikaIACTFile(Int_t bufferLenght = 20000000);
+  ACorsikaIACTFile(const ACorsikaIACTFile&) = delete;
+  ACorsikaIACTFile& operator=(const ACorsikaIACTFile&) = delete;
   virtual ~ACorsikaIACTFile();
 
+  Bool_t BuildEventIndex(Bool_t save = kTRUE);
   void Close();
-  TTree* GetBunches() const { return fBunches; }
+  Long64_t GetBufferHighWaterMark() const { return fBufferHighWaterMark; }
+  TTree* GetBunches() const;
+  Long64_t GetBunchHighWaterMark() const { return fBunchHighWaterMark; }
+  std::vector<BunchSpan> GetBunchSpans(Int_t telNo, Int_t arrayNo) const;
+  Long64_t GetNumberOfBunches(Int_t telNo, Int_t arrayNo) const;
   const Char_t* GetFileName() const { return fFileName.Data(); }
+  Int_t GetReadAhead() const { return fReadAhead; }
+  Int_t GetIndexedEventNumber(Int_t i) const {
+    return fEventIndex.at(i).fNumber;
+  }
+  Int_t GetNumberOfIndexedEvents() const { return fEventIndex.size(); }
   Int_t GetNumberOfTelescopes() const { return fNumberOfTelescopes; }
   ARayArray* GetRayArray(Int_t telNo, Int_t arrayNo, Double_t zoffset,
-                         Double_t refractiveIndex);
+                         Double_t refractiveIndex, Bool_t bunched = kFALSE);
   Double_t GetTelescopeR(Int_t i) const;
   Double_t GetTelescopeX(Int_t i) const;
   Double_t GetTelescopeY(Int_t i) const;
   Double_t GetTelescopeZ(Int_t i) const;
+  Bool_t HasEventIndex() const { return not fEventIndex.empty(); }
   Bool_t IsAllocated();
   Bool_t IsOpen();
   void Open(const Char_t* fname);
   void PrintInputCard() const;
   Int_t ReadEvent(Int_t num);
+  static Int_t SamplePhotonCount(Double_t weight);
+  void SetMaxBufferLength(Long64_t max) { fMaxBufferLength = max; }
   void SetMaxPhotonBunches(UInt_t max) { fMaxPhotonBunches = max; }
+  void SetRayPoolBlockSize(Int_t n) { fRayPoolBlockSize = n; }
+  void SetReadAhead(Int_t nevents);
 
-  ACorsikaIACTEventHeader* GetEventHeader() const { return fEventHeader; }
+  ACorsikaIACTEventHeader* GetEventHeader() const { return fEvent->fHeader; }
   ACorsikaIACTRunHeader* GetRunHeader() const { return fRunHeader; }
 
   ClassDef(ACorsikaIACTFile, 0)
@@ -0,0 +1,98 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_COUNTER_RANDOM_H
+#define A_COUNTER_RANDOM_H
+
+#include "TMath.h"
+#include "TObject.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ACounterRandom
+//
+// Counter-based random number generator (Philox4x32-10). Each ray traced by
+// AOpticsManager has its own stream identified by a key and a stream number,
+// so that the random numbers a ray gets do not depend on which thread traces
+// it, or in which order. It is small and cheap to construct, and has no
+// shared state between threads.
+//
+// J. K. Salmon et al., "Parallel random numbers: as easy as 1, 2, 3,"
+// Proc. SC11 (2011)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ACounterRandom {
+ private:
+  UInt_t fKey[2];
+  UInt_t fCounter[4];  // [0] and [1] are incremented, [2] and [3] are stream
+  UInt_t fBuffer[4];   // output of the last block
+  Int_t fIndex;        // next unused word in fBuffer
+
+  static void MulHiLo(UInt_t a, UInt_t b, UInt_t& hi, UInt_t& lo) {
+    ULong64_t product = ULong64_t(a) * ULong64_t(b);
+    hi = UInt_t(product >> 32);
+    lo = UInt_t(product);
+  }
+
+  void Generate() {
+    UInt_t c[4] = {fCounter[0], fCounter[1], fCounter[2], fCounter[3]};
+    UInt_t k[2] = {fKey[0], fKey[1]};
+    for (Int_t r = 0; r < 10; r++) {
+      UInt_t hi0, lo0, hi1, lo1;
+      MulHiLo(0xD2511F53u, c[0], hi0, lo0);
+      MulHiLo(0xCD9E8D57u, c[2], hi1, lo1);
+      c[0] = hi1 ^ c[1] ^ k[0];
+      c[1] = lo1;
+      c[2] = hi0 ^ c[3] ^ k[1];
+      c[3] = lo0;
+      k[0] += 0x9E3779B9u;
+      k[1] += 0xBB67AE85u;
+    }
+    for (Int_t i = 0; i < 4; i++) fBuffer[i] = c[i];
+    if (++fCounter[0] == 0) ++fCounter[1];
+    fIndex = 0;
+  }
+
+ public:
+  ACounterRandom(ULong64_t key, ULong64_t stream) : fIndex(4) {
+    fKey[0] = UInt_t(key);
+    fKey[1] = UInt_t(key >> 32);
+    fCounter[0] = fCounter[1] = 0;
+    fCounter[2] = UInt_t(stream);
+    fCounter[3] = UInt_t(stream >> 32);
+  }
+
+  static ULong64_t Hash(ULong64_t x) {
+    // SplitMix64 finalizer, used to derive well-separated keys
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+  }
+
+  UInt_t Integer32() {
+    if (fIndex >= 4) Generate();
+    return fBuffer[fIndex++];
+  }
+  Double_t Rndm() {
+    // Uniform random number in (0, 1] with 53-bit resolution
+    ULong64_t a = Integer32() >> 5;  // 27 bits
+    ULong64_t b = Integer32() >> 6;  // 26 bits
+    return (a * 67108864. + b + 1.) / 9007199254740992.;
+  }
+  Double_t Uniform(Double_t x1 = 1) { return x1 * Rndm(); }
+  Double_t Uniform(Double_t x1, Double_t x2) {
+    return x1 + (x2 - x1) * Rndm();
+  }
+  Double_t Exp(Double_t tau) { return -tau * TMath::Log(Rndm()); }
+  Double_t Gaus(Double_t mean = 0, Double_t sigma = 1) {
+    Double_t r = TMath::Sqrt(-2. * TMath::Log(Rndm()));
+    return mean + sigma * r * TMath::Cos(TMath::TwoPi() * Rndm());
+  }
+};
+
+#endif  // A_COUNTER_RANDOM_H
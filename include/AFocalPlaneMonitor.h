@@ -0,0 +1,86 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_FOCAL_PLANE_MONITOR_H
+#define A_FOCAL_PLANE_MONITOR_H
+
+#include <mutex>
+#include <vector>
+
+#include "TObject.h"
+
+class ACameraMap;
+class TH1;
+class TH2;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AFocalPlaneMonitor
+//
+// Accumulator of the photons detected by focal surfaces during tracing
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class AFocalPlaneMonitor : public TObject {
+ private:
+  struct Hit {
+    Double_t fX, fY, fT, fLambda, fWeight;
+    Int_t fPixel;  // -1 if out of the pixels
+  };
+  static const std::size_t kBufferSize = 1024;  // hits kept before a flush
+
+  TH2* fHits;            // histogram of the hit positions (not owned)
+  TH1* fTime;            // histogram of the arrival times (not owned)
+  TH1* fLambda;          // histogram of the wavelengths (not owned)
+  ACameraMap* fCamera;   // pixels of the hits (not owned)
+  Double_t fUnit;        // unit of the axes of fHits (e.g. mm)
+  Double_t fTimeUnit;    // unit of the axis of fTime (e.g. ns)
+  Double_t fLambdaUnit;  // unit of the axis of fLambda (e.g. nm)
+  ULong64_t fEntries;    // number of hits
+  Double_t fSumW, fSumWX, fSumWY, fSumWX2, fSumWY2;  // moments of the hits
+  std::mutex fMutex;  //! guards the histograms and the moments
+
+  void Add(const std::vector<Hit>& hits);
+  static std::vector<std::pair<AFocalPlaneMonitor*, std::vector<Hit>>>&
+  GetThreadBuffers();
+
+ public:
+  AFocalPlaneMonitor(TH2* hits = 0, Double_t unit = 1.);
+  AFocalPlaneMonitor(const AFocalPlaneMonitor&) = delete;
+  AFocalPlaneMonitor& operator=(const AFocalPlaneMonitor&) = delete;
+  virtual ~AFocalPlaneMonitor() {}
+
+  void Fill(const Double_t* point, Double_t lambda, Double_t weight);
+  static void FlushThreadBuffers();
+  ACameraMap* GetCameraMap() const { return fCamera; }
+  ULong64_t GetEntries() const { return fEntries; }
+  TH2* GetHitHistogram() const { return fHits; }
+  TH1* GetLambdaHistogram() const { return fLambda; }
+  Double_t GetMeanX() const { return fSumW > 0 ? fSumWX / fSumW : 0.; }
+  Double_t GetMeanY() const { return fSumW > 0 ? fSumWY / fSumW : 0.; }
+  Double_t GetRMSX() const;
+  Double_t GetRMSY() const;
+  Double_t GetSumOfWeights() const { return fSumW; }
+  TH1* GetTimeHistogram() const { return fTime; }
+  void Reset();
+  void SetCameraMap(ACameraMap* camera) { fCamera = camera; }
+  void SetHitHistogram(TH2* hits, Double_t unit = 1.) {
+    fHits = hits;
+    fUnit = unit;
+  }
+  void SetLambdaHistogram(TH1* lambda, Double_t unit = 1.) {
+    fLambda = lambda;
+    fLambdaUnit = unit;
+  }
+  void SetTimeHistogram(TH1* time, Double_t unit = 1.) {
+    fTime = time;
+    fTimeUnit = unit;
+  }
+
+  ClassDef(AFocalPlaneMonitor, 0)
+};
+
+#endif  // A_FOCAL_PLANE_MONITOR_H
@@ -9,8 +9,11 @@
 
 #include "TGraph.h"
 
+#include "ALookupTable.h"
 #include "AOpticalComponent.h"
 
+class AFocalPlaneMonitor;
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // AFocalSurface
@@ -23,19 +26,32 @@ class AFocalSurface : public AOpticalComponent {
  private:
   TGraph* fQuantumEfficiencyLambda;  // Quantum efficiency (QE vs lambda)
   TGraph* fQuantumEfficiencyAngle;   // Quantum efficiency (QE vs angle)
+  ALookupTable fTableLambda;         // baked QE vs lambda
+  ALookupTable fTableAngle;          // baked QE vs angle
+  AFocalPlaneMonitor* fMonitor;      //! accumulator of hits (not owned)
 
  public:
   AFocalSurface();
   AFocalSurface(const char* name, const TGeoShape* shape,
                 const TGeoMedium* med = 0);
 
+  Bool_t BakeQuantumEfficiency(Double_t tolerance = 1e-4);
+  virtual void CountMemory(AMemoryUtil::Counter& counter) const;
+  AFocalPlaneMonitor* GetMonitor() const { return fMonitor; }
   Bool_t HasQEAngle() const { return fQuantumEfficiencyAngle ? kTRUE : kFALSE; }
-  void SetQuantumEfficiency(TGraph* qe) { fQuantumEfficiencyLambda = qe; }
-  void SetQuantumEfficiencyAngle(TGraph* qe) { fQuantumEfficiencyAngle = qe; }
+  void SetMonitor(AFocalPlaneMonitor* monitor) { fMonitor = monitor; }
+  void SetQuantumEfficiency(TGraph* qe) {
+    fQuantumEfficiencyLambda = qe;
+    fTableLambda.Clear();
+  }
+  void SetQuantumEfficiencyAngle(TGraph* qe) {
+    fQuantumEfficiencyAngle = qe;
+    fTableAngle.Clear();
+  }
   Double_t GetQuantumEfficiency(Double_t lambda) const;
   Double_t GetQuantumEfficiency(Double_t lambda, Double_t angle) const;
 
-  ClassDef(AFocalSurface, 1)
+  ClassDef(AFocalSurface, 2)
 };
 
 #endif  // A_FOCAL_SURFACE_H
@@ -8,6 +8,7 @@
 #define A_GEO_ASPHERIC_DISK_H
 
 #include "TGeoBBox.h"
+#include "TMath.h"
 
 #if ROOT_VERSION_CODE >= ROOT_VERSION(5, 34, 10)
 #define CONST53410 const
@@ -43,7 +44,18 @@ class AGeoAsphericDisk : public TGeoBBox {
   Int_t fSteps;   // steps of approximate calculation
   Int_t fRepeat;  // repeat times of approximate calculation
 
+  Double_t fEdgeSag[2][2];  //! sags of surfaces 1/2 at fRmin/fRmax
+  Double_t fRdomain[2];     //! radii within which surfaces 1/2 are defined
+
+  static const Int_t kSolverSamples = 16;     // samples to bracket a crossing
+  static const Int_t kSolverIterations = 64;  // max Newton/bisection steps
+
   void DeleteArrays();
+  Double_t SagOrDefault(Int_t i, Double_t r, Double_t fallback) const {
+    Double_t z;
+    return EvalSag(i, r, z) ? z : fallback;
+  }
+  void UpdateEdgeSags();
 
  public:
   AGeoAsphericDisk();
@@ -58,6 +70,8 @@ class AGeoAsphericDisk : public TGeoBBox {
   virtual Double_t CalcdF2dr(Double_t r) const noexcept(false);
   virtual Double_t CalcF1(Double_t r) const noexcept(false);
   virtual Double_t CalcF2(Double_t r) const noexcept(false);
+  virtual void CalcSag(Int_t i, Int_t n, const Double_t* r, Double_t* z,
+                       Double_t* dzdr = 0) const noexcept(false);
   virtual void ComputeBBox();
   virtual void ComputeNormal(CONST53410 Double_t* point,
                              CONST53410 Double_t* dir, Double_t* norm);
@@ -80,6 +94,10 @@ class AGeoAsphericDisk : public TGeoBBox {
   virtual TGeoVolume* Divide(TGeoVolume* voldiv, const char* divname,
                              Int_t iaxis, Int_t ndiv, Double_t start,
                              Double_t step);
+  static void EnableSolverStatistics(Bool_t enable = kTRUE);
+  Bool_t EvalSag(Int_t i, Double_t r, Double_t& z, Double_t* dzdr = 0) const;
+  static void EvalPolynomial(Int_t n, const Double_t* k, Double_t h2,
+                             Double_t& p, Double_t& dpdh2);
   virtual void GetBoundingCylinder(Double_t* param) const;
   virtual const TBuffer3D& GetBuffer3D(Int_t reqSections,
                                        Bool_t localFrame) const;
@@ -98,12 +116,15 @@ class AGeoAsphericDisk : public TGeoBBox {
   Double_t GetNPol1() const { return fNPol1; }
   Double_t GetNPol2() const { return fNPol2; }
   Double_t GetRmax() const { return fRmax; }
+  static void GetSolverStatistics(ULong64_t& calls, ULong64_t& iterations,
+                                  ULong64_t& misses);
   Double_t GetRmin() const { return fRmin; }
   Double_t GetZ1() const { return fZ1; }
   Double_t GetZ2() const { return fZ2; }
   virtual void InspectShape() const;
   virtual Bool_t IsCylType() const { return kTRUE; }
   virtual TBuffer3D* MakeBuffer3D() const;
+  static void ResetSolverStatistics();
   virtual void SavePrimitive(std::ostream& out, Option_t* option = "");
   virtual Double_t Safety(CONST53410 Double_t* point, Bool_t in = kTRUE) const;
   virtual void SetAsphDimensions(Double_t x1, Double_t curve1, Double_t x2,
@@ -135,4 +156,30 @@ inline void AGeoAsphericDisk::DeleteArrays() {
   }
 }
 
+//______________________________________________________________________________
+inline Bool_t AGeoAsphericDisk::EvalSag(Int_t i, Double_t r, Double_t& z,
+                                        Double_t* dzdr) const {
+  // Calculate z value (and dz/dr if dzdr is given) of surface i (1 or 2) at
+  // given r. Unlike CalcF1 and so on, returns kFALSE instead of throwing an
+  // exception outside the domain of the conic, leaving z and dzdr untouched.
+  // This is the version used by the navigation methods.
+  Double_t curve = i == 1 ? fCurve1 : fCurve2;
+  Double_t r2 = r * r;
+  Double_t s = 1 - r2 * curve * curve * (i == 1 ? fKappa1 : fKappa2);
+  if (s < 0 or (dzdr and s == 0)) return kFALSE;
+
+  Double_t poly, dpoly;
+  if (i == 1) {
+    EvalPolynomial(fNPol1, fK1, r2, poly, dpoly);
+  } else {
+    EvalPolynomial(fNPol2, fK2, r2, poly, dpoly);
+  }
+
+  Double_t l = TMath::Sqrt(s);
+  z = (i == 1 ? fZ1 : fZ2) + r2 * curve / (1 + l) + poly;
+  if (dzdr) *dzdr = r * curve / l + 2 * r * dpoly;
+
+  return kTRUE;
+}
+
 #endif  // A_GEO_ASPHERIC_DISK_H
@@ -27,6 +27,8 @@ class AGeoBezierPgon : public TGeoPgon {
   TVector2 fP1;      // Relative coordinates of the control point 1
   TVector2 fP2;      // Relative coordinates of the control point 2
   Int_t fNcontrol;   // Number of control points (0, 1, or 2)
+  Double_t fMaxDeviation;  // max radial deviation of adaptive sections
+  Int_t fMaxSections;      // max number of adaptive sections
 
  public:
   AGeoBezierPgon();
@@ -40,9 +42,11 @@ class AGeoBezierPgon : public TGeoPgon {
   virtual void SetControlPoints(Double_t r1, Double_t z1);
   virtual void SetControlPoints(Double_t r1, Double_t z1, Double_t r2,
                                 Double_t z2);
+  void SetMaxDeviation(Double_t dr) { fMaxDeviation = dr; }
+  void SetMaxSections(Int_t n) { fMaxSections = n; }
   virtual void SetSections();
 
-  ClassDef(AGeoBezierPgon, 1)
+  ClassDef(AGeoBezierPgon, 2)
 };
 
 #endif  // A_GEO_BEZIER_PGON_H
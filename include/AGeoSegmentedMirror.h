@@ -0,0 +1,131 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_GEO_SEGMENTED_MIRROR_H
+#define A_GEO_SEGMENTED_MIRROR_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "TGeoBBox.h"
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(5, 34, 10)
+#define CONST53410 const
+#else
+#define CONST53410
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AGeoSegmentedMirror
+//
+// Geometry class for segmented mirrors made of many spherical facets
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class AGeoSegmentedMirror : public TGeoBBox {
+ protected:
+  Double_t fThickness;  // thickness of the facets
+  Int_t fOutlineN;      // number of sides of the facet outlines (0 = circle)
+  std::vector<Double_t> fCenter;  // (x, y, z) of the centers of the facets
+  std::vector<Double_t> fNormal;  // axes toward the centers of curvature
+  std::vector<Double_t> fAxisU;   // first transverse axes of the facets
+  std::vector<Double_t> fCurvatureRadius;  // radii of curvature
+  std::vector<Double_t> fSize;             // inscribed radii of the outlines
+
+  // 2D grid over the XY plane, cell (ix, iy) has the facets fCellFacets
+  // [fCellStart[ix + iy*fNx], fCellStart[ix + iy*fNx + 1])
+  mutable std::mutex fGridMutex;          //!
+  mutable std::atomic<Bool_t> fGridReady;  //!
+  mutable std::vector<Int_t> fCellStart;   //!
+  mutable std::vector<Int_t> fCellFacets;  //!
+  mutable std::vector<Double_t> fBoundingRadius;  //! facet bounding spheres
+  mutable std::vector<Double_t> fSideCos;  //! normals of the outline sides
+  mutable std::vector<Double_t> fSideSin;  //!
+  mutable Double_t fGridX0;                //!
+  mutable Double_t fGridY0;                //!
+  mutable Double_t fCellSize;              //!
+  mutable Int_t fNx;                       //!
+  mutable Int_t fNy;                       //!
+
+  void BuildGrid() const;
+  Double_t CalcBoundingRadius(Int_t i) const;
+  Int_t CellIndex(Double_t x, Double_t y) const;
+  Double_t DistToFacet(Int_t i, const Double_t* point,
+                       const Double_t* dir) const;
+  Double_t FacetMargin(Int_t i, const Double_t* local) const;
+  Int_t FindFacet(const Double_t* point, Double_t& margin) const;
+  void GetAxisV(Int_t i, Double_t* v) const;
+  void PrepareGrid() const {
+    if (not fGridReady.load(std::memory_order_acquire)) BuildGrid();
+  }
+  void StoreFacet(Int_t i, Double_t x, Double_t y, Double_t z, Double_t nx,
+                  Double_t ny, Double_t nz, Double_t radius, Double_t size,
+                  Double_t rotation);
+  void ToLocal(Int_t i, const Double_t* point, Double_t* local) const;
+  void ToLocalDir(Int_t i, const Double_t* dir, Double_t* local) const;
+
+ public:
+  AGeoSegmentedMirror();
+  AGeoSegmentedMirror(Double_t thickness, Int_t outlineN = 6);
+  AGeoSegmentedMirror(const char* name, Double_t thickness,
+                      Int_t outlineN = 6);
+  virtual ~AGeoSegmentedMirror();
+
+  Int_t AddFacet(Double_t x, Double_t y, Double_t z, Double_t nx, Double_t ny,
+                 Double_t nz, Double_t radius, Double_t size,
+                 Double_t rotation = 0);
+  virtual Double_t Capacity() const;
+  virtual void ComputeBBox();
+  virtual void ComputeNormal(CONST53410 Double_t* point,
+                             CONST53410 Double_t* dir, Double_t* norm);
+  virtual Bool_t Contains(CONST53410 Double_t* point) const;
+  virtual Int_t DistancetoPrimitive(Int_t px, Int_t py);
+  virtual Double_t DistFromInside(CONST53410 Double_t* point,
+                                  CONST53410 Double_t* dir, Int_t iact = 1,
+                                  Double_t step = TGeoShape::Big(),
+                                  Double_t* safe = 0) const;
+  virtual Double_t DistFromOutside(CONST53410 Double_t* point,
+                                   CONST53410 Double_t* dir, Int_t iact = 1,
+                                   Double_t step = TGeoShape::Big(),
+                                   Double_t* safe = 0) const;
+  virtual TGeoVolume* Divide(TGeoVolume* voldiv, const char* divname,
+                             Int_t iaxis, Int_t ndiv, Double_t start,
+                             Double_t step);
+  Int_t FindFacet(const Double_t* point) const;
+  Double_t FindHit(const Double_t* point, const Double_t* dir, Int_t& facet,
+                   Double_t* norm = 0) const;
+  virtual void GetBoundingCylinder(Double_t* param) const;
+  virtual const TBuffer3D& GetBuffer3D(Int_t reqSections,
+                                       Bool_t localFrame) const;
+  void GetFacetCenter(Int_t i, Double_t* center) const;
+  void GetFacetNormal(Int_t i, const Double_t* point, Double_t* norm) const;
+  virtual TGeoShape* GetMakeRuntimeShape(TGeoShape*, TGeoMatrix*) const {
+    return 0;
+  }
+  virtual void GetMeshNumbers(Int_t& nvert, Int_t& nsegs, Int_t& npols) const;
+  Int_t GetNfacets() const { return fSize.size(); }
+  virtual Int_t GetNmeshVertices() const;
+  Int_t GetOutlineN() const { return fOutlineN; }
+  Double_t GetThickness() const { return fThickness; }
+  virtual void InspectShape() const;
+  virtual Bool_t IsCylType() const { return kFALSE; }
+  virtual TBuffer3D* MakeBuffer3D() const;
+  virtual Double_t Safety(CONST53410 Double_t* point, Bool_t in = kTRUE) const;
+  virtual void SavePrimitive(std::ostream& out, Option_t* option = "");
+  Bool_t SetFacet(Int_t i, Double_t x, Double_t y, Double_t z, Double_t nx,
+                  Double_t ny, Double_t nz, Double_t radius, Double_t size,
+                  Double_t rotation = 0);
+  virtual void SetPoints(Double_t* points) const;
+  virtual void SetPoints(Float_t* points) const;
+  virtual void SetSegsAndPols(TBuffer3D& buff) const;
+  virtual void Sizeof3D() const;
+
+  ClassDef(AGeoSegmentedMirror, 1)
+};
+
+#endif  // A_GEO_SEGMENTED_MIRROR_H
@@ -0,0 +1,125 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_GEO_SHAPE_PROFILER_H
+#define A_GEO_SHAPE_PROFILER_H
+
+#include <atomic>
+
+#include "TGeoBBox.h"
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(5, 34, 10)
+#define CONST53410 const
+#else
+#define CONST53410
+#endif
+
+class TGeoManager;
+class TGeoVolume;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AGeoShapeProfiler
+//
+// Shape wrapper counting and timing the navigation calls of another shape
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class AGeoShapeProfiler : public TGeoBBox {
+ public:
+  enum {
+    kContains = 0,
+    kDistFromInside = 1,
+    kDistFromOutside = 2,
+    kSafety = 3,
+    kComputeNormal = 4,
+    kNmethods = 5
+  };
+
+ private:
+  TGeoShape* fShape;  // profiled shape (owned by TGeoManager)
+  mutable std::atomic<ULong64_t> fCalls[kNmethods];       //!
+  mutable std::atomic<ULong64_t> fNanoseconds[kNmethods];  //!
+  mutable std::atomic<ULong64_t> fIterations[kNmethods];   //!
+
+  void Record(Int_t method, ULong64_t t0, ULong64_t i0) const;
+  static ULong64_t GetClock();
+
+ public:
+  AGeoShapeProfiler();
+  AGeoShapeProfiler(TGeoShape* shape);
+  virtual ~AGeoShapeProfiler();
+
+  static void AddIterations(ULong64_t n);
+  static AGeoShapeProfiler* Attach(TGeoVolume* volume);
+  static Int_t Attach(TGeoManager* manager, Bool_t customOnly = kTRUE);
+  virtual Double_t Capacity() const { return fShape->Capacity(); }
+  virtual void ComputeBBox();
+  virtual void ComputeNormal(CONST53410 Double_t* point,
+                             CONST53410 Double_t* dir, Double_t* norm);
+  virtual Bool_t Contains(CONST53410 Double_t* point) const;
+  static Bool_t Detach(TGeoVolume* volume);
+  static Int_t Detach(TGeoManager* manager);
+  virtual Int_t DistancetoPrimitive(Int_t px, Int_t py) {
+    return fShape->DistancetoPrimitive(px, py);
+  }
+  virtual Double_t DistFromInside(CONST53410 Double_t* point,
+                                  CONST53410 Double_t* dir, Int_t iact = 1,
+                                  Double_t step = TGeoShape::Big(),
+                                  Double_t* safe = 0) const;
+  virtual Double_t DistFromOutside(CONST53410 Double_t* point,
+                                   CONST53410 Double_t* dir, Int_t iact = 1,
+                                   Double_t step = TGeoShape::Big(),
+                                   Double_t* safe = 0) const;
+  virtual TGeoVolume* Divide(TGeoVolume* voldiv, const char* divname,
+                             Int_t iaxis, Int_t ndiv, Double_t start,
+                             Double_t step) {
+    return fShape->Divide(voldiv, divname, iaxis, ndiv, start, step);
+  }
+  virtual void GetBoundingCylinder(Double_t* param) const {
+    fShape->GetBoundingCylinder(param);
+  }
+  virtual const TBuffer3D& GetBuffer3D(Int_t reqSections,
+                                       Bool_t localFrame) const {
+    return fShape->GetBuffer3D(reqSections, localFrame);
+  }
+  virtual Int_t GetByteCount() const { return fShape->GetByteCount(); }
+  ULong64_t GetCalls(Int_t method) const;
+  static AGeoShapeProfiler* GetProfiler(TGeoShape* shape);
+  ULong64_t GetIterations(Int_t method) const;
+  virtual TGeoShape* GetMakeRuntimeShape(TGeoShape* mother,
+                                         TGeoMatrix* mat) const {
+    return fShape->GetMakeRuntimeShape(mother, mat);
+  }
+  virtual void GetMeshNumbers(Int_t& nvert, Int_t& nsegs, Int_t& npols) const {
+    fShape->GetMeshNumbers(nvert, nsegs, npols);
+  }
+  static const char* GetMethodName(Int_t method);
+  virtual Int_t GetNmeshVertices() const { return fShape->GetNmeshVertices(); }
+  TGeoShape* GetShape() const { return fShape; }
+  Double_t GetTime(Int_t method) const;
+  Double_t GetTotalTime() const;
+  virtual void InspectShape() const;
+  virtual Bool_t IsCylType() const { return fShape->IsCylType(); }
+  static Bool_t IsEnabled();
+  virtual TBuffer3D* MakeBuffer3D() const { return fShape->MakeBuffer3D(); }
+  virtual void Print(Option_t* option = "") const;
+  static void PrintReport(TGeoManager* manager, Int_t nshapes = 20);
+  void Reset();
+  virtual Double_t Safety(CONST53410 Double_t* point, Bool_t in = kTRUE) const;
+  virtual void SavePrimitive(std::ostream& out, Option_t* option = "") {
+    fShape->SavePrimitive(out, option);
+  }
+  virtual void SetPoints(Double_t* points) const { fShape->SetPoints(points); }
+  virtual void SetPoints(Float_t* points) const { fShape->SetPoints(points); }
+  virtual void SetSegsAndPols(TBuffer3D& buff) const;
+  virtual void Sizeof3D() const { fShape->Sizeof3D(); }
+  static TGeoShape* Unwrap(TGeoShape* shape);
+
+  ClassDef(AGeoShapeProfiler, 1)
+};
+
+#endif  // A_GEO_SHAPE_PROFILER_H
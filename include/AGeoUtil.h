@@ -7,16 +7,20 @@
 #ifndef A_GEO_UTIL_H
 #define A_GEO_UTIL_H
 
+#include <functional>
 #include <vector>
 
 #include "TGeoArb8.h"
 #include "TGeoBBox.h"
 #include "TGeoMatrix.h"
+#include "TGeoNode.h"
 #include "TGeoTube.h"
 #include "TGeoXtru.h"
 #include "TH2.h"
 #include "TVector3.h"
 
+class TGeoVolume;
+
 ////////////////////////////////////////////////////////////////////////////////
 //                                                                            //
 // AGeoUtil                                                                   //
@@ -43,6 +47,17 @@ void MakePointToPointTube(const char* name, const TVector3& v1,
                           TGeoTube** tube, TGeoCombiTrans** combi);
 void ContainmentRadius(TH2* h2, Double_t fraction, Double_t& r, Double_t& x,
                        Double_t& y);
+void ContainmentRadius(Int_t n, const Double_t* xs, const Double_t* ys,
+                       Double_t fraction, Double_t& r, Double_t& x,
+                       Double_t& y, const Double_t* weights = 0);
+Bool_t FindGlobalMatrix(TGeoNode* top, const TGeoNode* node,
+                        TGeoHMatrix& matrix, TGeoNode** mother = 0);
+void AdaptiveSections(
+    const std::function<void(Double_t, Double_t&, Double_t&)>& curve,
+    Double_t tolerance, Int_t nmax, std::vector<Double_t>& t);
+Int_t MakeAssemblies(
+    TGeoVolume* mother, Int_t nmax = 16, const char* prefix = "assembly",
+    const std::function<Bool_t(const TGeoNode*)>& select = nullptr);
 
 }  // namespace AGeoUtil
 
@@ -32,6 +32,11 @@ class AGeoWinstonCone2D : public TGeoBBox {
   Double_t fTheta;  // Cutoff angle
   Double_t fF;      // Focal length
 
+  Double_t DistToFacet(CONST53410 Double_t* point, CONST53410 Double_t* dir,
+                       Double_t cosphi, Double_t sinphi, Double_t cosopen,
+                       Double_t sinopen) const;
+  Double_t SafetyToWall(Double_t z, Double_t h) const;
+
  public:
   AGeoWinstonCone2D();
   AGeoWinstonCone2D(Double_t r1, Double_t r2, Double_t y);
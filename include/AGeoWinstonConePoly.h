@@ -41,6 +41,8 @@ class AGeoWinstonConePoly : public AGeoWinstonCone2D {
                                    CONST53410 Double_t* dir, Int_t iact = 1,
                                    Double_t step = TGeoShape::Big(),
                                    Double_t* safe = 0) const;
+  Int_t FindFacets(CONST53410 Double_t* point, CONST53410 Double_t* dir,
+                   Double_t tmin, Double_t tmax, Int_t* facets) const;
   virtual void GetBoundingCylinder(Double_t* param) const;
   virtual const TBuffer3D& GetBuffer3D(Int_t reqSections,
                                        Bool_t localFrame) const;
@@ -49,6 +51,7 @@ class AGeoWinstonConePoly : public AGeoWinstonCone2D {
   virtual Bool_t InsidePolygon(Double_t x, Double_t y, Double_t r) const;
   virtual void InspectShape() const;
   virtual TBuffer3D* MakeBuffer3D() const;
+  virtual Double_t Safety(CONST53410 Double_t* point, Bool_t in = kTRUE) const;
   virtual void SavePrimitive(std::ostream& out, Option_t* option = "");
   virtual void SetWinstonDimensions(Double_t r1, Double_t r2, Int_t n);
   virtual void SetDimensions(Double_t* param);
@@ -9,6 +9,8 @@
 
 #include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "ACauchyFormula.h"
 #include "ASchottFormula.h"
@@ -25,14 +27,31 @@
 
 class AGlassCatalog : public TObject {
  private:
+  struct GlassData {
+    Int_t fFormula;                    // dispersion formula (2 = Sellmeier)
+    Int_t fNcoefficients;              // number of the values in the CD line
+    Double_t fCoefficients[8];         // CD line
+    std::vector<Double_t> fWavelength;  // IT lines
+    std::vector<Double_t> fExtinction;
+  };
+
+  std::string fCatalogFile;
+  std::map<std::string, GlassData> fGlassMap;  //! parsed, built on demand
   std::map<std::string, std::shared_ptr<ARefractiveIndex>> fIndexMap;
 
+  Bool_t LoadCache();
+  Bool_t ReadAGF();
+
  public:
   AGlassCatalog();
-  AGlassCatalog(const std::string& catalog_file);
+  AGlassCatalog(const std::string& catalog_file, Bool_t writeCache = kFALSE);
   virtual ~AGlassCatalog();
 
+  std::string GetCacheFileName() const { return fCatalogFile + ".cache"; }
+  std::vector<std::string> GetGlassNames() const;
+  ULong64_t GetMemoryUsage() const;
   std::shared_ptr<ARefractiveIndex> GetRefractiveIndex(const std::string& name);
+  Bool_t SaveCache() const;
 
   ClassDef(AGlassCatalog, 0)
 };
@@ -29,6 +29,7 @@ class ALens : public AOpticalComponent {
   ALens(const char* name, const TGeoShape* shape, const TGeoMedium* med = 0);
   virtual ~ALens(){};
 
+  virtual void CountMemory(AMemoryUtil::Counter& counter) const;
   virtual Double_t GetAbsorptionLength(Double_t lambda) const;
   virtual Double_t GetExtinctionCoefficient(Double_t lambda) const;
   virtual Double_t GetRefractiveIndex(Double_t lambda) const;
@@ -36,7 +37,7 @@ class ALens : public AOpticalComponent {
     fIndex = index;
   }
 
-  ClassDef(ALens, 1)
+  ClassDef(ALens, 2)
 };
 
 #endif  // A_LENS_H
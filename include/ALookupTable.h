@@ -0,0 +1,96 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_LOOKUP_TABLE_H
+#define A_LOOKUP_TABLE_H
+
+#include <functional>
+#include <vector>
+
+#include "TObject.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ALookupTable
+//
+// 1D/2D table on a uniform grid with linear interpolation
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ALookupTable {
+ private:
+  Int_t fNx;  // number of cells along X (0 = empty table)
+  Int_t fNy;  // number of cells along Y (0 = 1D table)
+  Double_t fXmin, fXmax, fInvDx;
+  Double_t fYmin, fYmax, fInvDy;
+  Double_t fMaxDeviation;        // max deviation found at the check points
+  std::vector<Double_t> fValue;  // (fNx + 1)*(fNy + 1) values, X runs faster
+
+ public:
+  typedef std::function<void(std::size_t, const Double_t*, const Double_t*,
+                             Double_t*)>
+      BatchFunction2D;
+  static const Int_t kMaxCells1D = 1 << 16;
+  static const Int_t kMaxCells2D = 1 << 10;
+
+  ALookupTable();
+
+  Bool_t Bake(const std::function<Double_t(Double_t)>& f, Double_t xmin,
+              Double_t xmax, Double_t tolerance,
+              const std::vector<Double_t>& knots = std::vector<Double_t>(),
+              Int_t maxCells = kMaxCells1D);
+  Bool_t Bake(const std::function<Double_t(Double_t, Double_t)>& f,
+              Double_t xmin, Double_t xmax, Double_t ymin, Double_t ymax,
+              Double_t tolerance, Int_t maxCells = kMaxCells2D,
+              Bool_t discard = kTRUE);
+  Bool_t BakeBatch(const BatchFunction2D& f, Double_t xmin, Double_t xmax,
+                   Double_t ymin, Double_t ymax, Double_t tolerance,
+                   Int_t maxCells = kMaxCells2D, Bool_t discard = kTRUE);
+  void Clear();
+  Bool_t Contains(Double_t x) const {
+    return fNx > 0 and fXmin <= x and x <= fXmax;
+  }
+  Bool_t Contains(Double_t x, Double_t y) const {
+    return fNy > 0 and fXmin <= x and x <= fXmax and fYmin <= y and y <= fYmax;
+  }
+  Double_t Eval(Double_t x) const {
+    // x must be within the range
+    Double_t u = (x - fXmin) * fInvDx;
+    Int_t i = Int_t(u);
+    if (i >= fNx) i = fNx - 1;
+    Double_t a = u - i;
+    return fValue[i] + a * (fValue[i + 1] - fValue[i]);
+  }
+  Double_t Eval(Double_t x, Double_t y) const {
+    // (x, y) must be within the range
+    Double_t u = (x - fXmin) * fInvDx;
+    Double_t v = (y - fYmin) * fInvDy;
+    Int_t i = Int_t(u);
+    Int_t j = Int_t(v);
+    if (i >= fNx) i = fNx - 1;
+    if (j >= fNy) j = fNy - 1;
+    Double_t a = u - i;
+    Double_t b = v - j;
+    const Double_t* p = &fValue[i + j * (fNx + 1)];
+    Double_t z0 = p[0] + a * (p[1] - p[0]);
+    Double_t z1 = p[fNx + 1] + a * (p[fNx + 2] - p[fNx + 1]);
+    return z0 + b * (z1 - z0);
+  }
+  Double_t GetMaxDeviation() const { return fMaxDeviation; }
+  ULong64_t GetMemoryUsage() const {
+    // heap memory of the values, excluding the table object itself
+    return fValue.capacity() * sizeof(Double_t);
+  }
+  Int_t GetNx() const { return fNx; }
+  Int_t GetNy() const { return fNy; }
+  Double_t GetXmax() const { return fXmax; }
+  Double_t GetXmin() const { return fXmin; }
+  Double_t GetYmax() const { return fYmax; }
+  Double_t GetYmin() const { return fYmin; }
+  Bool_t IsEmpty() const { return fNx == 0; }
+};
+
+#endif  // A_LOOKUP_TABLE_H
@@ -0,0 +1,109 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_MEMORY_UTIL_H
+#define A_MEMORY_UTIL_H
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "TClass.h"
+#include "TGeoNode.h"
+#include "TGeoVolume.h"
+#include "TGraph.h"
+#include "TGraph2D.h"
+#include "TH1.h"
+#include "TObjArray.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AMemoryUtil
+//
+// Estimates of the memory (bytes) used by the ROOT and STL objects held by
+// ROBAST classes, used by their GetMemoryUsage methods. The allocated
+// capacities are counted instead of the used sizes, but the bookkeeping of
+// the heap allocator is not.
+//
+// Objects shared through std::shared_ptr (refractive indices, multilayers,
+// reflectance data) are added to a Counter by their addresses, so that an
+// object shared by many components is counted only once.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+namespace AMemoryUtil {
+
+class Counter {
+ private:
+  std::unordered_set<const void*> fCounted;
+  ULong64_t fBytes;
+
+ public:
+  Counter() : fBytes(0) {}
+
+  Bool_t Add(const void* ptr, ULong64_t bytes) {
+    // Add bytes unless ptr is null or has already been counted. Returns
+    // kTRUE if added, so that the caller can go on with the members of ptr.
+    if (!ptr or not fCounted.insert(ptr).second) return kFALSE;
+    fBytes += bytes;
+    return kTRUE;
+  }
+  void AddBytes(ULong64_t bytes) { fBytes += bytes; }
+  ULong64_t GetBytes() const { return fBytes; }
+};
+
+template <typename T>
+inline ULong64_t Capacity(const std::vector<T>& v) {
+  // Heap memory of the elements of v
+  return v.capacity() * sizeof(T);
+}
+
+inline ULong64_t Capacity(const std::string& s) {
+  // Heap memory of s, which is 0 for short strings stored in place
+  return s.capacity() > 15 ? s.capacity() + 1 : 0;
+}
+
+inline ULong64_t SizeOf(const TObject* obj) {
+  // Size of the dynamic class of obj without the memory it points to
+  return obj ? obj->IsA()->Size() : 0;
+}
+
+inline ULong64_t SizeOf(const TGraph* graph) {
+  if (!graph) return 0;
+  return SizeOf(static_cast<const TObject*>(graph)) +
+         2 * graph->GetMaxSize() * sizeof(Double_t);
+}
+
+inline ULong64_t SizeOf(const TGraph2D* graph) {
+  if (!graph) return 0;
+  return SizeOf(static_cast<const TObject*>(graph)) +
+         3 * graph->GetN() * sizeof(Double_t);
+}
+
+inline ULong64_t SizeOf(const TH1* hist) {
+  // The bin contents are assumed to be Double_t (TH1D, TH2D and so on)
+  if (!hist) return 0;
+  return SizeOf(static_cast<const TObject*>(hist)) +
+         (hist->GetNcells() + hist->GetSumw2N()) * sizeof(Double_t);
+}
+
+inline ULong64_t SizeOf(const TGeoVolume* volume) {
+  // The volume and its daughter nodes, but not the shape nor the matrices,
+  // which are listed separately in TGeoManager
+  if (!volume) return 0;
+  ULong64_t bytes = SizeOf(static_cast<const TObject*>(volume));
+  TObjArray* nodes = const_cast<TGeoVolume*>(volume)->GetNodes();
+  if (nodes) bytes += SizeOf(nodes) + nodes->GetSize() * sizeof(TObject*);
+  for (Int_t i = 0; i < volume->GetNdaughters(); i++) {
+    bytes += SizeOf(static_cast<const TObject*>(volume->GetNode(i)));
+  }
+
+  return bytes;
+}
+
+}  // namespace AMemoryUtil
+
+#endif  // A_MEMORY_UTIL_H
@@ -7,10 +7,14 @@
 #ifndef A_MIRROR_H
 #define A_MIRROR_H
 
+#include <atomic>
+#include <mutex>
+
 #include "TGraph.h"
 #include "TGraph2D.h"
 #include "TH2.h"
 
+#include "ALookupTable.h"
 #include "AOpticalComponent.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -30,19 +34,43 @@ class AMirror : public AOpticalComponent {
       fReflectance2D;  // Reflectance data (ref v.s. angle v.s. wavelength)
   std::shared_ptr<TH2>
       fReflectanceTH2;  // Reflectance data (ref v.s. angle v.s. wavelength)
+  ALookupTable fReflectanceTable;  // baked reflectance vs wavelength
+
+  // Immutable (lambda, angle) grid converted from fReflectance2D or
+  // fReflectanceTH2, shared among mirrors using the same data
+  mutable std::shared_ptr<const ALookupTable> fReflectanceGrid;  //!
+  mutable std::atomic<Bool_t> fGridReady;                         //!
+  mutable std::mutex fGridMutex;                                  //!
+
+  void MakeReflectanceGrid(Double_t tolerance) const;
+  void PrepareReflectanceGrid() const {
+    if (not fGridReady.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(fGridMutex);
+      if (not fGridReady.load(std::memory_order_relaxed)) {
+        MakeReflectanceGrid(kGridTolerance);
+      }
+    }
+  }
 
  public:
+  static constexpr Double_t kGridTolerance = 1e-4;
+
   AMirror();
   AMirror(const char* name, const TGeoShape* shape, const TGeoMedium* med = 0);
   virtual ~AMirror();
 
-  Double_t GetReflectance(Double_t lambda, Double_t angle /* (rad) */);
+  Bool_t BakeReflectance(Double_t tolerance = 1e-4);
+  virtual void CountMemory(AMemoryUtil::Counter& counter) const;
+  Double_t GetReflectance(Double_t lambda, Double_t angle /* (rad) */) const;
   void SetReflectance(Double_t ref) { fReflectance = ref; }
-  void SetReflectance(std::shared_ptr<const TGraph> ref) { fReflectance1D = ref; }
-  void SetReflectance(std::shared_ptr<TH2> ref) { fReflectanceTH2 = ref; }
-  void SetReflectance(std::shared_ptr<TGraph2D> ref) { fReflectance2D = ref; }
+  void SetReflectance(std::shared_ptr<const TGraph> ref) {
+    fReflectance1D = ref;
+    fReflectanceTable.Clear();
+  }
+  void SetReflectance(std::shared_ptr<TH2> ref);
+  void SetReflectance(std::shared_ptr<TGraph2D> ref);
 
-  ClassDef(AMirror, 1)
+  ClassDef(AMirror, 2)
 };
 
 #endif  // A_MIRROR_H
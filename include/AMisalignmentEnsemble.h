@@ -0,0 +1,58 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_MISALIGNMENT_ENSEMBLE_H
+#define A_MISALIGNMENT_ENSEMBLE_H
+
+#include <vector>
+
+#include "TObject.h"
+
+class TGeoHMatrix;
+class TGeoNode;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AMisalignmentEnsemble
+//
+// Realisations of small rotations and offsets of nodes (e.g. mirror facets)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class AMisalignmentEnsemble : public TObject {
+ public:
+  enum { kNparameters = 6 };  // rotation vector (rad) and offset (cm)
+
+ private:
+  Int_t fN;                        // number of realisations
+  std::vector<TGeoNode*> fNodes;   // misaligned nodes (not owned)
+  std::vector<Double_t> fParameters;  // [realisation][node][kNparameters]
+
+  Double_t* GetParameters(Int_t realisation, Int_t node) {
+    return &fParameters[(realisation * fNodes.size() + node) * kNparameters];
+  }
+  const Double_t* GetParameters(Int_t realisation, Int_t node) const {
+    return &fParameters[(realisation * fNodes.size() + node) * kNparameters];
+  }
+
+ public:
+  AMisalignmentEnsemble(Int_t n = 1);
+  virtual ~AMisalignmentEnsemble() {}
+
+  Int_t AddNode(TGeoNode* node);
+  void GetMatrix(Int_t realisation, Int_t node, TGeoHMatrix& delta) const;
+  Int_t GetN() const { return fN; }
+  TGeoNode* GetNode(Int_t i) const { return fNodes[i]; }
+  Int_t GetNnodes() const { return Int_t(fNodes.size()); }
+  void Randomize(Double_t tilt, Double_t offset, ULong64_t seed,
+                 Double_t spin = 0, Double_t defocus = -1);
+  void SetMisalignment(Int_t realisation, Int_t node, Double_t rx, Double_t ry,
+                       Double_t rz, Double_t dx, Double_t dy, Double_t dz);
+
+  ClassDef(AMisalignmentEnsemble, 0)
+};
+
+#endif  // A_MISALIGNMENT_ENSEMBLE_H
@@ -28,11 +28,14 @@ class AMixedRefractiveIndex : public ARefractiveIndex {
   void SetRefractiveIndex(std::shared_ptr<TGraph>){};
 
  public:
+  AMixedRefractiveIndex();
   AMixedRefractiveIndex(std::shared_ptr<ARefractiveIndex> materialA,
                         std::shared_ptr<ARefractiveIndex> materialB,
                         Double_t fractionA, Double_t fractionB);
   virtual ~AMixedRefractiveIndex() {}
 
+  virtual Bool_t CountMemory(AMemoryUtil::Counter& counter) const;
+
   virtual Double_t GetRefractiveIndex(Double_t lambda) const {
     Double_t nA = fMaterialA->GetRefractiveIndex(lambda);
     Double_t nB = fMaterialB->GetRefractiveIndex(lambda);
@@ -43,12 +46,16 @@ class AMixedRefractiveIndex : public ARefractiveIndex {
     Double_t kB = fMaterialB->GetExtinctionCoefficient(lambda);
     return kA * fFractionA + kB * fFractionB;
   }
+  virtual void GetExtinctionCoefficient(const Double_t* lambda, Double_t* k,
+                                        std::size_t count) const;
+  virtual void GetRefractiveIndex(const Double_t* lambda, Double_t* n,
+                                  std::size_t count) const;
   void SetFraction(Double_t fractionA, Double_t fractionB) {
     fFractionA = fractionA / (fractionA + fractionB);
     fFractionB = fractionB / (fractionA + fractionB);
   }
 
-  ClassDef(AMixedRefractiveIndex, 1)
+  ClassDef(AMixedRefractiveIndex, 2)
 };
 
 #endif  // A_MIXED_REFRACTIVE_INDEX_H
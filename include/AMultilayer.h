@@ -7,13 +7,18 @@
 #ifndef A_MULTILAYER_H
 #define A_MULTILAYER_H
 
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 #include <TH2.h>
 
+#include "ALookupTable.h"
 #include "ARefractiveIndex.h"
 
+class AThreadPool;
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // AMultilayer
@@ -24,160 +29,93 @@ class AMultilayer : public TObject {
  public:
   enum EPolarization { kS, kP };
 
+  // Intermediate lists of CoherentTMM, which can be reused among calls so
+  // that no memory is allocated per photon
+  struct Workspace {
+    std::vector<std::complex<Double_t>> fN;         // refractive indices
+    std::vector<std::complex<Double_t>> fTheta;     // angles in the layers
+    std::vector<std::complex<Double_t>> fKz;        // z-components of k
+    std::vector<std::complex<Double_t>> fCosTheta;  // cos(theta)
+    std::vector<std::complex<Double_t>> fDelta;     // phases in the layers
+    std::vector<std::complex<Double_t>> fT;  // transmission amplitudes
+    std::vector<std::complex<Double_t>> fR;  // reflection amplitudes
+
+    void Resize(std::size_t n) {
+      // the capacities never shrink
+      fN.resize(n);
+      fTheta.resize(n);
+      fKz.resize(n);
+      fCosTheta.resize(n);
+      fDelta.resize(n);
+      fT.resize(n);
+      fR.resize(n);
+    }
+  };
+
  private:
   std::vector<std::shared_ptr<ARefractiveIndex>> fRefractiveIndexList;
   std::vector<Double_t> fThicknessList;
   std::size_t fNthreads;
+  mutable AThreadPool* fPool;     //! persistent threads for the vector APIs
+  mutable std::mutex fPoolMutex;  //!
   std::shared_ptr<TH2D> fPreCalculatedReflectanceMixed;
   std::shared_ptr<TH2D> fPreCalculatedTransmittanceMixed;
-
+  ALookupTable fReflectanceTable;    // unpolarized R vs (lambda, angle)
+  ALookupTable fTransmittanceTable;  // unpolarized T vs (lambda, angle)
+
+  void ComputeLayers(std::complex<Double_t> th_0, Double_t lam_vac,
+                     Workspace& ws) const;
+  void ForEachChunk(
+      std::size_t n,
+      const std::function<void(std::size_t, std::size_t)>& func) const;
   Bool_t IsForwardAngle(std::complex<Double_t> n,
                         std::complex<Double_t> theta) const;
   void ListSnell(std::complex<Double_t> th_0,
                  const std::vector<std::complex<Double_t>>& n_list,
                  std::vector<std::complex<Double_t>>& th_list) const;
-  void CoherentTMMMixedMultiAngle(
-      std::vector<std::complex<Double_t>>::const_iterator th_0_cbegin,
-      std::vector<std::complex<Double_t>>::const_iterator th_0_cend,
-      Double_t lam_vac, std::vector<Double_t>::iterator reflectance_it,
-      std::vector<Double_t>::iterator transmittance_it) {
-    for (auto cit = th_0_cbegin; cit != th_0_cend; ++cit) {
-      Double_t r, t;
-      CoherentTMMMixed(*cit, lam_vac, r, t);
-      *reflectance_it = r;
-      *transmittance_it = t;
-      ++reflectance_it;
-      ++transmittance_it;
-    }
-  }
-  void CoherentTMMMixedMultiWavelength(
-      std::complex<Double_t> th_0,
-      std::vector<Double_t>::const_iterator lam_vac_cbegin,
-      std::vector<Double_t>::const_iterator lam_vac_cend,
-      std::vector<Double_t>::iterator reflectance_it,
-      std::vector<Double_t>::iterator transmittance_it) {
-    for (auto cit = lam_vac_cbegin; cit != lam_vac_cend; ++cit) {
-      Double_t r, t;
-      CoherentTMMMixed(th_0, *cit, r, t);
-      *reflectance_it = r;
-      *transmittance_it = t;
-      ++reflectance_it;
-      ++transmittance_it;
-    }
-  }
 
  public:
+  AMultilayer();
   AMultilayer(std::shared_ptr<ARefractiveIndex> top,
               std::shared_ptr<ARefractiveIndex> bottom);
+  AMultilayer(const AMultilayer& other);
   virtual ~AMultilayer();
+  AMultilayer& operator=(const AMultilayer& other);
 
   void InsertLayer(std::shared_ptr<ARefractiveIndex> idx, Double_t thickness);
+  void ClearTables() {
+    fReflectanceTable.Clear();
+    fTransmittanceTable.Clear();
+  }
   void ChangeThickness(std::size_t i, Double_t thickness) {
     if (i < 1 || i > fThicknessList.size() - 2) {
       Error("ChangeThickness", "Cannot change the thickness of the %luth layer",
             i);
     } else {
       fThicknessList[i] = thickness;
+      ClearTables();  // made for the old thickness
     }
   }
 
+  Bool_t CountMemory(AMemoryUtil::Counter& counter) const;
   void CoherentTMM(EPolarization polarization, std::complex<Double_t> th_0,
                    Double_t lam_vac, Double_t& reflectance,
                    Double_t& transmittance) const;
+  void CoherentTMM(EPolarization polarization, std::complex<Double_t> th_0,
+                   Double_t lam_vac, Double_t& reflectance,
+                   Double_t& transmittance, Workspace& ws) const;
   void CoherentTMMMixed(std::complex<Double_t> th_0, Double_t lam_vac,
-                        Double_t& reflectance, Double_t& transmittance) const {
-    if(fPreCalculatedReflectanceMixed and fPreCalculatedTransmittanceMixed) {
-      reflectance = fPreCalculatedReflectanceMixed->Interpolate(lam_vac, th_0.real());
-      transmittance = fPreCalculatedTransmittanceMixed->Interpolate(lam_vac, th_0.real());
-      return;
-    }
-    Double_t r = 0;
-    Double_t t = 0;
-    CoherentTMMP(th_0, lam_vac, reflectance, transmittance);
-    r += reflectance;
-    t += transmittance;
-    CoherentTMMS(th_0, lam_vac, reflectance, transmittance);
-    r += reflectance;
-    t += transmittance;
-
-    reflectance = r / 2.;
-    transmittance = t / 2.;
-  }
+                        Double_t& reflectance, Double_t& transmittance) const;
+  void CoherentTMMMixed(std::complex<Double_t> th_0, Double_t lam_vac,
+                        Double_t& reflectance, Double_t& transmittance,
+                        Workspace& ws) const;
   void CoherentTMMMixed(std::vector<std::complex<Double_t>>& th_0,
                         Double_t lam_vac, std::vector<Double_t>& reflectance,
-                        std::vector<Double_t>& transmittance) const {
-    auto n = th_0.size();
-    reflectance.resize(n);
-    transmittance.resize(n);
-    if(fPreCalculatedReflectanceMixed and fPreCalculatedTransmittanceMixed) {
-      for(std::size_t i = 0; i < n; ++i){
-        auto th = th_0[i].real();
-        reflectance[i] =  fPreCalculatedReflectanceMixed->Interpolate(lam_vac, th);
-        transmittance[i] = fPreCalculatedTransmittanceMixed->Interpolate(lam_vac, th);
-      }
-      return;
-    }
-
-    std::vector<std::thread> threads(fNthreads);
-
-    auto th_0_cbegin = th_0.cbegin();
-    auto th_0_cend = th_0.end();
-    auto reflectance_begin = reflectance.begin();
-    auto transmittance_begin = transmittance.begin();
-
-    auto step = n / fNthreads;
-
-    for (std::size_t i = 0; i < fNthreads; ++i) {
-      if (i == fNthreads - 1) {
-        threads[i] =
-            std::thread(&AMultilayer::CoherentTMMMixedMultiAngle, *this,
-                        th_0_cbegin, th_0_cbegin + step, lam_vac,
-                        reflectance_begin, transmittance_begin);
-        th_0_cbegin += step;
-      } else {
-        threads[i] = std::thread(&AMultilayer::CoherentTMMMixedMultiAngle,
-                                 *this, th_0_cbegin, th_0_cend, lam_vac,
-                                 reflectance_begin, transmittance_begin);
-      }
-    }
-    for (std::size_t i = 0; i < fNthreads; ++i) {
-      threads[i].join();
-    }
-  }
+                        std::vector<Double_t>& transmittance) const;
   void CoherentTMMMixed(std::complex<Double_t> th_0,
                         std::vector<Double_t>& lam_vac,
                         std::vector<Double_t>& reflectance,
-                        std::vector<Double_t>& transmittance) const {
-    auto n = lam_vac.size();
-    reflectance.resize(n);
-    transmittance.resize(n);
-
-    std::vector<std::thread> threads(fNthreads);
-
-    auto lam_vac_cbegin = lam_vac.cbegin();
-    auto lam_vac_cend = lam_vac.end();
-    auto reflectance_begin = reflectance.begin();
-    auto transmittance_begin = transmittance.begin();
-
-    auto step = n / fNthreads;
-
-    for (std::size_t i = 0; i < fNthreads; ++i) {
-      if (i == fNthreads - 1) {
-        threads[i] =
-            std::thread(&AMultilayer::CoherentTMMMixedMultiWavelength, *this,
-                        th_0, lam_vac_cbegin, lam_vac_cbegin + step,
-                        reflectance_begin, transmittance_begin);
-        lam_vac_cbegin += step;
-      } else {
-        threads[i] = std::thread(&AMultilayer::CoherentTMMMixedMultiWavelength,
-                                 *this, th_0, lam_vac_cbegin, lam_vac_cend,
-                                 reflectance_begin, transmittance_begin);
-      }
-    }
-    for (std::size_t i = 0; i < fNthreads; ++i) {
-      threads[i].join();
-    }
-  }
+                        std::vector<Double_t>& transmittance) const;
   void CoherentTMMP(std::complex<Double_t> th_0, Double_t lam_vac,
                     Double_t& reflectance, Double_t& transmittance) const {
     CoherentTMM(kP, th_0, lam_vac, reflectance, transmittance);
@@ -187,24 +125,22 @@ class AMultilayer : public TObject {
     CoherentTMM(kS, th_0, lam_vac, reflectance, transmittance);
   }
   void PreCalculateTMM(Int_t lam_nbins, Double_t lam_min, Double_t lam_max,
-                       Int_t th_nbins, Double_t th_min, Double_t th_max) {
-    // make temporary objects because CoherentTMMMixed checks if fPreCalculstedXXX are
-    // null or not
-    auto preReflectanceMixed = std::make_shared<TH2D>("", "", lam_nbins, lam_min, lam_max, th_nbins, th_min, th_max);
-    auto preTransmittanceMixed = std::make_shared<TH2D>("", "", lam_nbins, lam_min, lam_max, th_nbins, th_min, th_max);
-    for (Int_t j = 1; j <= th_nbins; ++j) {
-      Double_t th = preReflectanceMixed->GetYaxis()->GetBinCenter(j);
-      for (Int_t i = 1; i <= lam_nbins; ++i) {
-        Double_t lam = preReflectanceMixed->GetXaxis()->GetBinCenter(i);
-        Double_t reflectance, transmittance;
-        CoherentTMMMixed(th, lam, reflectance, transmittance);
-        preReflectanceMixed->SetBinContent(i, j, reflectance);
-        preTransmittanceMixed->SetBinContent(i, j, transmittance);
-      }
-    }
-
-    fPreCalculatedReflectanceMixed = preReflectanceMixed;
-    fPreCalculatedTransmittanceMixed = preTransmittanceMixed;
+                       Int_t th_nbins, Double_t th_min, Double_t th_max);
+  Bool_t PrecomputeTables(Double_t lam_min, Double_t lam_max, Double_t th_min,
+                          Double_t th_max, Double_t tolerance = 1e-4);
+  ULong64_t GetMemoryUsage() const {
+    AMemoryUtil::Counter counter;
+    CountMemory(counter);
+    return counter.GetBytes();
+  }
+  const ALookupTable& GetReflectanceTable() const { return fReflectanceTable; }
+  const ALookupTable& GetTransmittanceTable() const {
+    return fTransmittanceTable;
+  }
+  void SetTables(const ALookupTable& reflectance,
+                 const ALookupTable& transmittance) {
+    fReflectanceTable = reflectance;
+    fTransmittanceTable = transmittance;
   }
   const std::shared_ptr<const TH2D> GetPrecalculatedReflectanceMixed() const {
     return fPreCalculatedReflectanceMixed;
@@ -215,7 +151,7 @@ class AMultilayer : public TObject {
   void PrintLayers(Double_t lambda) const;
   void SetNthreads(std::size_t n);
 
-  ClassDef(AMultilayer, 1)
+  ClassDef(AMultilayer, 3)
 };
 
 #endif  // A_MULTILAYER_H
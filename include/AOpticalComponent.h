@@ -7,6 +7,8 @@
 #ifndef A_OPTICAL_COMPONENT_H
 #define A_OPTICAL_COMPONENT_H
 
+#include <unordered_map>
+
 #include "ABorderSurfaceCondition.h"
 #include "TGeoVolume.h"
 #include "TObjArray.h"
@@ -22,6 +24,8 @@
 class AOpticalComponent : public TGeoVolume {
  private:
   TObjArray* fBorderSurfaceConditionArray;
+  std::unordered_map<const AOpticalComponent*, ABorderSurfaceCondition*>
+      fBorderSurfaceConditionMap;  //! Conditions indexed by component2
 
  public:
   AOpticalComponent();
@@ -30,12 +34,18 @@ class AOpticalComponent : public TGeoVolume {
   virtual ~AOpticalComponent();
 
   void AddBorderSurfaceCondition(ABorderSurfaceCondition* condition);
+  virtual void CountMemory(AMemoryUtil::Counter& counter) const;
   ABorderSurfaceCondition* FindBorderSurfaceCondition(
       AOpticalComponent* component2);
+  ULong64_t GetMemoryUsage() const;
   TGeoMaterial* GetOpaqueVacuumMaterial() const;
+  Bool_t HasBorderSurfaceCondition() const {
+    return fBorderSurfaceConditionArray ? kTRUE : kFALSE;
+  }
   TGeoMaterial* GetTransparentVacuumMaterial() const;
   TGeoMedium* GetOpaqueVacuumMedium() const;
   TGeoMedium* GetTransparentVacuumMedium() const;
+  void RebuildBorderSurfaceConditionMap();
 
   ClassDef(AOpticalComponent, 1)
 };
@@ -7,6 +7,13 @@
 #ifndef A_OPTICS_MANAGER_H
 #define A_OPTICS_MANAGER_H
 
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "TGeoManager.h"
 #include "TMath.h"
 
@@ -15,7 +22,17 @@
 #include "AMirror.h"
 #include "AObscuration.h"
 #include "AOpticalComponent.h"
+#include "APhotonBuffer.h"
 #include "ARayArray.h"
+#include "ATraceFuture.h"
+
+class ACounterRandom;
+class AMisalignmentEnsemble;
+class ARayGenerator;
+class ARaySink;
+class ARayWriter;
+class AThreadPool;
+class ATraceStatistics;
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -27,19 +44,121 @@
 
 class AOpticsManager : public TGeoManager {
  private:
+  struct FlatGeometry;
+  class FlatNavigator;
+  struct MaterialCache;
+  struct RayPacket;
+  struct SequentialTrain;
+  struct StartCache;
+  class SurfaceNavigator;
+
   Int_t fLimit;                      // Maximum number of crossing calculations
   Bool_t fDisableFresnelReflection;  // disable Fresnel reflection
-  TClass* fClassList[5];
+  Bool_t fWeightedTracing;  // multiply ray weights instead of killing rays
+  Bool_t fAttenuationWeighting;  // weight rays by the absorption in lenses
+  Bool_t fFlatNavigation;   // navigate with the flat surface table
+  Bool_t fCompactHistory;   // record node IDs instead of node pointers
+  Bool_t fCoherentOrdering;  // trace rays in the order of their start points
+  Int_t fPacketSize;  // rays tested at once in flat navigation (0 = off)
+  Bool_t fPacketFloat;  // test the ray packets in single precision
+  Int_t fHistoryPolicy;     // points kept by ARay (see SetHistoryPolicy)
+  Int_t fHistorySampling;   // 1 in fHistorySampling rays keep all points
+  std::function<Bool_t(const ARay&)>
+      fHistorySelector;  //! rays keeping all points in kHistorySelected
+  Double_t fRouletteThreshold;  // Weight below which Russian roulette is played
+  Double_t fRouletteSurvival;   // Survival probability in Russian roulette
+  std::shared_ptr<const TGraph>
+      fMirrorBound;        //! upper bound of the mirror reflectance
+  Int_t fNmirrorBounds;    //! reflections over which fMirrorBound is applied
+  std::shared_ptr<const TGraph> fFocalBound;    //! upper bound of the QE
+  std::shared_ptr<const TGraph> fTransmission;  //! survival before the optics
+  Int_t fChunkSize;  // Number of rays a thread takes from the queue at once
+  ULong64_t fRandomSeed;  // Seed of the random number streams (0 = gRandom)
+  ULong64_t fNcalls;      //! Number of tracing calls since the seed was set
+  TClass* fClassList[5];  //! Classes of the optical components
+  AThreadPool* fWorkerPool;  //! Persistent tracing threads
+  Bool_t fRecordNavigators;  //! Record the navigators of new threads
+  std::vector<TGeoNavigator*>
+      fRecordedNavigators;     //! Navigators deleted by ReleaseNavigators
+  std::mutex fNavigatorMutex;  //! Lock of fRecordedNavigators
+  ATraceStatistics* fStatistics;  //! Instrumentation (0 if disabled)
+  ARayWriter* fWriter;            //! Output of finished rays (not owned)
+  FlatGeometry* fFlatGeometry;    //! Surface table (0 if not compiled)
+  std::vector<Int_t> fVolumeType;  //! Component types indexed by volume ID
+  std::vector<AOpticalComponent*>
+      fVolumeComponent;  //! Optical components indexed by volume ID
+  std::vector<std::string> fNodeNames;  //! Node names sorted (index = ID)
+  std::unordered_map<const TGeoNode*, Int_t> fNodeIDs;  //! Node to ID map
 
-  static void* Thread(void* args);
 
-  void DoFresnel(Double_t n1, Double_t n2, Double_t k2, ARay& ray,
-                 TGeoNavigator* nav, TGeoNode* currentNode, TGeoNode* nextNode);
-  void DoReflection(Double_t n1, ARay& ray, TGeoNavigator* nav,
-                    TGeoNode* currentNode, TGeoNode* nextNode,
-                    TVector3* normal = 0);
-  TVector3 GetFacetNormal(TGeoNavigator* nav, TGeoNode* currentNode,
-                          TGeoNode* nextNode);
+  template <typename T>
+  void ApplySurvivalBound(T& ray, MaterialCache& cache,
+                          ACounterRandom& rng) const;
+  template <typename T, typename N>
+  Int_t DoFresnel(Double_t n1, Double_t n2, Double_t k2, T& ray, N* nav,
+                  TGeoNode* currentNode, TGeoNode* nextNode,
+                  ABorderSurfaceCondition* condition, ACounterRandom& rng);
+  template <typename T, typename N>
+  void DoInteraction(T& ray, N* nav, TGeoNode* currentNode,
+                     TGeoNode* nextNode, MaterialCache& cache,
+                     ACounterRandom& rng, ATraceStatistics* stats);
+  template <typename T, typename N>
+  Int_t DoReflection(Double_t n1, T& ray, N* nav, TGeoNode* currentNode,
+                     TGeoNode* nextNode, ABorderSurfaceCondition* condition,
+                     ACounterRandom& rng, const Double_t* normal = 0,
+                     Double_t bound = 1);
+  ABorderSurfaceCondition* FindBorderSurfaceCondition(
+      TGeoNode* currentNode, TGeoNode* nextNode) const;
+  template <typename N>
+  void GetFacetNormal(N* nav, ABorderSurfaceCondition* condition,
+                      ACounterRandom& rng, Double_t* facet);
+  void BeginHistory(ARay& ray) const;
+  void BuildFlatGeometry();
+  Int_t ClassifyVolume(const TGeoVolume* volume) const;
+  void CompileIfNeeded();
+  void EndHistory(ARay& ray) const;
+  Int_t GetNodeType(const TGeoNode* node) const {
+    if (!node) return kNull;
+    Int_t id = node->GetVolume()->GetNumber();
+    return id >= 0 and id < Int_t(fVolumeType.size())
+               ? fVolumeType[id]
+               : ClassifyVolume(node->GetVolume());
+  }
+  Int_t GetNodeID(const TGeoNode* node) const {
+    if (!node) return -1;
+    auto it = fNodeIDs.find(node);
+    return it != fNodeIDs.end() ? it->second : -1;
+  }
+  TGeoNavigator* GetThreadNavigator();
+  AThreadPool* GetWorkerPool(Int_t nthreads);
+  FlatGeometry* MakeFlatGeometry(TGeoNode** nested = 0) const;
+  void TraceInChunks(Int_t n, const std::function<void(Int_t, Int_t)>& trace);
+  ULong64_t NextRandomKey();
+  void TraceRange(TObjArray* array, Int_t first, Int_t last, ULong64_t key,
+                  const SequentialTrain* train = 0, Char_t* status = 0,
+                  const Int_t* order = 0, const FlatGeometry* flat = 0);
+  void TraceRunning(const std::vector<ARayArray*>& arrays,
+                    const SequentialTrain* train);
+  void MergeStatistics(const ATraceStatistics& stats);
+  void ReleaseNavigators();
+  void VoxelizeMothers(TGeoVolume* volume);
+  template <typename T>
+  void RecordNode(T& ray, TGeoNode* node) const {
+    if (fCompactHistory) {
+      ray.AddNodeID(GetNodeID(node));
+    } else {
+      ray.AddNode(node);
+    }
+    ray.ThinHistory();
+  }
+  template <typename T, typename N>
+  void TraceRay(T& ray, N* nav, MaterialCache& cache, StartCache& location,
+                ACounterRandom& rng, ATraceStatistics* stats);
+  template <typename T>
+  void TraceSequentialRay(T& ray, const SequentialTrain& train,
+                          TGeoNavigator* nav, MaterialCache& cache,
+                          StartCache& location, ACounterRandom& rng,
+                          ATraceStatistics* stats);
 
  public:
   enum {
@@ -51,6 +170,13 @@ class AOpticsManager : public TGeoManager {
     kOther = 5,
     kNull = 6
   };
+  enum {
+    kHistoryFull,
+    kHistoryNone,
+    kHistoryEndpoints,
+    kHistorySampled,
+    kHistorySelected
+  };
 
   AOpticsManager();
   AOpticsManager(const char* name, const char* title);
@@ -70,9 +196,43 @@ class AOpticsManager : public TGeoManager {
   static Double_t deg() { return TMath::DegToRad(); };
   static Double_t rad() { return 1.; }
 
+  void CloseGeometry(Option_t* option = "d");
+  void Compile();
   void DisableFresnelReflection(Bool_t disable) {
     fDisableFresnelReflection = disable;
   }
+  void EnableAttenuationWeighting(Bool_t enable);
+  void EnableCoherentOrdering(Bool_t enable);
+  void EnableCompactHistory(Bool_t enable);
+  void EnableFlatNavigation(Bool_t enable);
+  void EnableInstrumentation(Bool_t enable);
+  void EnableRayPackets(Int_t size, Bool_t single = kFALSE);
+  void EnableShapeProfiling(Bool_t enable, Bool_t customOnly = kTRUE);
+  void EnableWeightedTracing(Bool_t enable) { fWeightedTracing = enable; }
+  Int_t GetChunkSize() const { return fChunkSize; }
+  ULong64_t GetMemoryUsage(ULong64_t* geometry = 0,
+                           ULong64_t* optics = 0) const;
+  Int_t GetNodeID(const char* name) const;
+  Bool_t GetNodeIDRangeStartWith(const char* name, Int_t& first,
+                                 Int_t& last) const;
+  const char* GetNodeName(Int_t id) const {
+    return id >= 0 and id < Int_t(fNodeNames.size()) ? fNodeNames[id].c_str()
+                                                     : 0;
+  }
+  Int_t GetHistoryPolicy() const { return fHistoryPolicy; }
+  ULong64_t GetNcalls() const { return fNcalls; }
+  Int_t GetPacketSize() const { return fPacketSize; }
+  ULong64_t GetRandomSeed() const { return fRandomSeed; }
+  ATraceStatistics* GetStatistics() const { return fStatistics; }
+  Double_t GetSurvivalBound(Double_t lambda) const;
+  ARayWriter* GetWriter() const { return fWriter; }
+  Bool_t HasSurvivalBound() const {
+    return fMirrorBound or fFocalBound or fTransmission;
+  }
+  Bool_t IsAttenuationWeighting() const { return fAttenuationWeighting; }
+  Bool_t IsCoherentOrdering() const { return fCoherentOrdering; }
+  Bool_t IsCompactHistory() const { return fCompactHistory; }
+  Bool_t IsFlatNavigation() const { return fFlatGeometry != 0; }
   Bool_t IsFocalSurface(TGeoNode* node) const {
     return node ? node->GetVolume()->IsA() == fClassList[kFocus] : kFALSE;
   };
@@ -88,7 +248,27 @@ class AOpticsManager : public TGeoManager {
   Bool_t IsOpticalComponent(TGeoNode* node) const {
     return node ? node->GetVolume()->IsA() == fClassList[kOpt] : kFALSE;
   };
+  Bool_t IsInstrumented() const { return fStatistics != 0; }
+  Bool_t IsWeightedTracing() const { return fWeightedTracing; }
+  static AOpticsManager* LoadSnapshot(const char* fname);
+  Bool_t SaveSnapshot(const char* fname);
+  void SetChunkSize(Int_t n);
+  void SetHistoryPolicy(Int_t policy, Int_t sampling = 1);
+  void SetHistorySelector(std::function<Bool_t(const ARay&)> selector);
   void SetLimit(Int_t n);
+  void SetNodeMatrix(TGeoNode* node, const TGeoMatrix& matrix);
+  void SetRandomSeed(ULong64_t seed, ULong64_t ncalls = 0);
+  void SetRussianRoulette(Double_t threshold, Double_t survival);
+  void SetSurvivalBound(const TGraph* mirror, Int_t nmirrors,
+                        const TGraph* focal, const TGraph* transmission = 0);
+  void SetWriter(ARayWriter* writer) { fWriter = writer; }
+  void StopWorkers();
+  ATraceFuture TraceAsync(ARayArray& array);
+  ATraceFuture TraceAsync(const std::vector<ARayArray*>& arrays);
+  static void TraceBatch(const std::vector<AOpticsManager*>& managers,
+                         const std::vector<ARayArray*>& arrays);
+  void TraceEnsemble(const AMisalignmentEnsemble& ensemble,
+                     const std::vector<ARayArray*>& arrays);
   void TraceNonSequential(ARay& ray);
   void TraceNonSequential(ARay* ray) {
     if (ray) TraceNonSequential(*ray);
@@ -98,8 +278,20 @@ class AOpticsManager : public TGeoManager {
     if (array) TraceNonSequential(*array);
   }
   void TraceNonSequential(TObjArray* array);
+  void TraceNonSequential(const std::vector<ARayArray*>& arrays);
+  void TraceNonSequential(APhotonBuffer& buffer);
+  void TraceNonSequential(APhotonBuffer* buffer) {
+    if (buffer) TraceNonSequential(*buffer);
+  }
+  void TraceNonSequential(const ARayGenerator& generator, ARaySink* sink = 0);
+  Int_t TracePackets(APhotonBuffer& buffer, const std::vector<Double_t>& lambda,
+                     std::vector<Double_t>& weight);
+  void TraceSequential(ARayArray& array, const std::vector<TGeoNode*>& order,
+                       Bool_t fallback = kTRUE);
+  void TraceSuspended(ARayArray& array, Int_t nrounds = 100, Int_t keep = 1);
+  void UpdateShape(TGeoShape* shape);
 
-  ClassDef(AOpticsManager, 1)
+  ClassDef(AOpticsManager, 11)
 };
 
 #endif  // A_OPTICS_MANAGER_H
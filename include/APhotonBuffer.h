@@ -0,0 +1,162 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_PHOTON_BUFFER_H
+#define A_PHOTON_BUFFER_H
+
+#include <vector>
+
+#include "TMath.h"
+#include "TObject.h"
+
+class ARay;
+class TGeoNode;
+class TObjArray;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// APhotonBuffer
+//
+// Struct-of-arrays photon buffer for history-free tracing
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class APhotonBuffer : public TObject {
+  friend class APhoton;
+
+ public:
+  enum { kRun, kStop, kExit, kFocus, kSuspend, kAbsorb };
+
+ private:
+  std::vector<Double_t> fX;       // Current x
+  std::vector<Double_t> fY;       // Current y
+  std::vector<Double_t> fZ;       // Current z
+  std::vector<Double_t> fT;       // Current time
+  std::vector<Double_t> fDx;      // Current direction x
+  std::vector<Double_t> fDy;      // Current direction y
+  std::vector<Double_t> fDz;      // Current direction z
+  std::vector<Double_t> fLambda;  // Wavelength
+  std::vector<Int_t> fStatus;     // Status of photons
+  std::vector<Int_t> fNpoints;    // Number of points that ARay would have
+  std::vector<Double_t> fWeight;  // Statistical weight
+
+ public:
+  APhotonBuffer();
+  virtual ~APhotonBuffer();
+
+  void Add(Double_t lambda, Double_t x, Double_t y, Double_t z, Double_t t,
+           Double_t dx, Double_t dy, Double_t dz);
+  void Add(const ARay& ray);
+  Int_t AddResults(const TObjArray& rays);
+  virtual void Clear(Option_t* option = "");
+  Int_t GetN() const { return Int_t(fStatus.size()); }
+  Double_t GetDx(Int_t i) const { return fDx[i]; }
+  Double_t GetDy(Int_t i) const { return fDy[i]; }
+  Double_t GetDz(Int_t i) const { return fDz[i]; }
+  Double_t GetLambda(Int_t i) const { return fLambda[i]; }
+  ULong64_t GetMemoryUsage() const;
+  Int_t GetNpoints(Int_t i) const { return fNpoints[i]; }
+  Int_t GetStatus(Int_t i) const { return fStatus[i]; }
+  Double_t GetT(Int_t i) const { return fT[i]; }
+  Double_t GetWeight(Int_t i) const { return fWeight[i]; }
+  Double_t GetX(Int_t i) const { return fX[i]; }
+  Double_t GetY(Int_t i) const { return fY[i]; }
+  Double_t GetZ(Int_t i) const { return fZ[i]; }
+
+  // Contiguous columns of GetN() elements, e.g. to be wrapped by
+  // numpy.frombuffer without copying. They are invalidated by Add and Clear.
+  const Double_t* GetDxArray() const { return fDx.data(); }
+  const Double_t* GetDyArray() const { return fDy.data(); }
+  const Double_t* GetDzArray() const { return fDz.data(); }
+  const Double_t* GetLambdaArray() const { return fLambda.data(); }
+  const Int_t* GetNpointsArray() const { return fNpoints.data(); }
+  const Int_t* GetStatusArray() const { return fStatus.data(); }
+  const Double_t* GetTArray() const { return fT.data(); }
+  const Double_t* GetWeightArray() const { return fWeight.data(); }
+  const Double_t* GetXArray() const { return fX.data(); }
+  const Double_t* GetYArray() const { return fY.data(); }
+  const Double_t* GetZArray() const { return fZ.data(); }
+  Bool_t IsAbsorbed(Int_t i) const { return fStatus[i] == kAbsorb; }
+  Bool_t IsExited(Int_t i) const { return fStatus[i] == kExit; }
+  Bool_t IsFocused(Int_t i) const { return fStatus[i] == kFocus; }
+  Bool_t IsRunning(Int_t i) const { return fStatus[i] == kRun; }
+  Bool_t IsStopped(Int_t i) const { return fStatus[i] == kStop; }
+  Bool_t IsSuspended(Int_t i) const { return fStatus[i] == kSuspend; }
+  void Reserve(Int_t n);
+
+  ClassDef(APhotonBuffer, 2)
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// APhoton
+//
+// Light-weight handle to a photon stored in APhotonBuffer. This provides the
+// subset of the ARay interface used by AOpticsManager, but only the latest
+// point is kept and the node history is discarded.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class APhoton {
+ private:
+  APhotonBuffer* fBuffer;
+  Int_t fIndex;
+
+ public:
+  APhoton(APhotonBuffer* buffer, Int_t i) : fBuffer(buffer), fIndex(i) {}
+
+  void Absorb() { fBuffer->fStatus[fIndex] = APhotonBuffer::kAbsorb; }
+  void AddNode(TGeoNode*) {}
+  void AddNodeID(Int_t) {}
+  void AddPoint(Double_t x, Double_t y, Double_t z, Double_t t) {
+    fBuffer->fX[fIndex] = x;
+    fBuffer->fY[fIndex] = y;
+    fBuffer->fZ[fIndex] = z;
+    fBuffer->fT[fIndex] = t;
+    ++fBuffer->fNpoints[fIndex];
+  }
+  void Exit() { fBuffer->fStatus[fIndex] = APhotonBuffer::kExit; }
+  void Focus() { fBuffer->fStatus[fIndex] = APhotonBuffer::kFocus; }
+  void GetDirection(Double_t* d) const {
+    d[0] = fBuffer->fDx[fIndex];
+    d[1] = fBuffer->fDy[fIndex];
+    d[2] = fBuffer->fDz[fIndex];
+  }
+  Double_t GetLambda() const { return fBuffer->fLambda[fIndex]; }
+  void GetLastPoint(Double_t* x) const {
+    x[0] = fBuffer->fX[fIndex];
+    x[1] = fBuffer->fY[fIndex];
+    x[2] = fBuffer->fZ[fIndex];
+    x[3] = fBuffer->fT[fIndex];
+  }
+  Int_t GetNpoints() const { return fBuffer->fNpoints[fIndex]; }
+  Int_t GetNpointsAdded() const { return GetNpoints(); }
+  Bool_t GetPendingBounds(Double_t& mirror, Int_t& nmirrors,
+                          Double_t& focal) const {
+    // photons are not resumed, so only untraced ones get the survival bound
+    mirror = 1;
+    nmirrors = 0;
+    focal = 1;
+    return GetNpoints() != 1;
+  }
+  Double_t GetWeight() const { return fBuffer->fWeight[fIndex]; }
+  Bool_t IsRunning() const { return fBuffer->IsRunning(fIndex); }
+  void SetDirection(Double_t* d) {
+    Double_t mag = TMath::Sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    if (mag > 0) {
+      fBuffer->fDx[fIndex] = d[0] / mag;
+      fBuffer->fDy[fIndex] = d[1] / mag;
+      fBuffer->fDz[fIndex] = d[2] / mag;
+    }
+  }
+  void SetPendingBounds(Double_t, Int_t, Double_t) {}
+  void SetWeight(Double_t weight) { fBuffer->fWeight[fIndex] = weight; }
+  void Stop() { fBuffer->fStatus[fIndex] = APhotonBuffer::kStop; }
+  void Suspend() { fBuffer->fStatus[fIndex] = APhotonBuffer::kSuspend; }
+  void ThinHistory() {}
+};
+
+#endif  // A_PHOTON_BUFFER_H
@@ -7,6 +7,8 @@
 #ifndef A_RAY_H
 #define A_RAY_H
 
+#include <vector>
+
 #include "TColor.h"
 #include "TGeoNode.h"
 #include "TGeoTrack.h"
@@ -22,12 +24,27 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 class ARay : public TGeoTrack {
+ public:
+  enum { kRun, kStop, kExit, kFocus, kSuspend, kAbsorb, kNstatus };
+  enum { kFullHistory, kEndpointHistory, kLastPointHistory };
+
  private:
-  enum { kRun, kStop, kExit, kFocus, kSuspend, kAbsorb };
   Double_t fLambda;        // Wavelength
   TVector3 fDirection;     // Current direction vector
   Int_t fStatus;           // status of ray
+  Double_t fWeight;        // Statistical weight for weighted tracing
   TObjArray fNodeHisotry;  // History of nodes on which the photon has hi
+  std::vector<Int_t> fNodeIDHistory;  // Compact history of node IDs
+  Int_t fHistoryMode;  //! Points kept while being traced
+  Int_t fNdropped;     //! Points dropped by the history mode
+  ULong64_t fAccounted;  //! Bytes added to the live memory counter
+  Bool_t fBoundsDrawn;     //! Survival bound already applied to the ray
+  Double_t fMirrorBound;   //! Mirror part of the bound not divided out yet
+  Int_t fNmirrorBounds;    //! Reflections left to divide fMirrorBound out
+  Double_t fFocalBound;    //! Focal part of the bound not divided out yet
+
+  void Account();
+  void RemovePoints(Int_t first, Int_t n);
 
  public:
   ARay();
@@ -41,8 +58,37 @@ class ARay : public TGeoTrack {
   void GetDirection(Double_t* d) const;
   const TObjArray* GetNodeHistory() const { return &fNodeHisotry; }
   Double_t GetLambda() const { return fLambda; }
+  Int_t GetHistoryMode() const { return fHistoryMode; }
+  static ULong64_t GetLiveMemory();
+  ULong64_t GetMemoryUsage() const {
+    return sizeof(ARay) + GetPointsMemory() + GetNodeHistoryMemory();
+  }
+  ULong64_t GetNodeHistoryMemory() const;
+  Int_t GetNpointsAdded() const { return GetNpoints() + fNdropped; }
+  Bool_t GetPendingBounds(Double_t& mirror, Int_t& nmirrors,
+                          Double_t& focal) const;
+  ULong64_t GetPointsMemory() const { return fPointsSize * sizeof(Double_t); }
+  static void GetSpectralColor(Double_t lambda, Float_t& r, Float_t& g,
+                               Float_t& b);
+  Int_t GetStatus() const { return fStatus; }
+  Double_t GetWeight() const { return fWeight; }
   void GetLastPoint(Double_t* x) const;
-  void AddNode(TGeoNode* node) { fNodeHisotry.Add(node); }
+  void AddNode(TGeoNode* node) {
+    Int_t size = fNodeHisotry.GetSize();
+    fNodeHisotry.Add(node);
+    if (fNodeHisotry.GetSize() != size) Account();
+  }
+  void AddNodeID(Int_t id) {
+    std::size_t size = fNodeIDHistory.capacity();
+    fNodeIDHistory.push_back(id);
+    if (fNodeIDHistory.capacity() != size) Account();
+  }
+  virtual TVirtualGeoTrack* AddPoint(Double_t x, Double_t y, Double_t z,
+                                     Double_t t);
+  Int_t FindNodeID(Int_t id) const;
+  Int_t FindNodeIDInRange(Int_t first, Int_t last) const;
+  const std::vector<Int_t>& GetNodeIDHistory() const { return fNodeIDHistory; }
+  Bool_t HasNodeID(Int_t id) const { return FindNodeID(id) >= 0; }
   TGeoNode* FindNode(const char* name) const {
     return (TGeoNode*)fNodeHisotry.FindObject(name);
   }
@@ -60,11 +106,19 @@ class ARay : public TGeoTrack {
   TPolyLine3D* MakePolyLine3D() const;
   void SetDirection(Double_t dx, Double_t dy, Double_t dz);
   void SetDirection(Double_t* d);
+  void Resume() {
+    if (fStatus == kSuspend) fStatus = kRun;
+  }
+  void SetHistoryMode(Int_t mode) { fHistoryMode = mode; }
   void SetLambda(Double_t lambda) { fLambda = lambda; }
+  void SetPendingBounds(Double_t mirror, Int_t nmirrors, Double_t focal);
+  void SetWeight(Double_t weight) { fWeight = weight; }
   void Stop() { fStatus = kStop; }
   void Suspend() { fStatus = kSuspend; }
+  void ThinHistory();
+  void TrimHistory(Int_t keep = 1);
 
-  ClassDef(ARay, 1)
+  ClassDef(ARay, 3)
 };
 
 #endif  // A_RAY_H
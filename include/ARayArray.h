@@ -7,10 +7,15 @@
 #ifndef A_RAY_ARRAY_H
 #define A_RAY_ARRAY_H
 
+#include <vector>
+
 #include "TObjArray.h"
 
 #include "ARay.h"
 
+class ARayPool;
+class ARaySink;
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // ARayArray
@@ -27,21 +32,40 @@ class ARayArray : public TObject {
   TObjArray fRunning;    // Array of running rays
   TObjArray fStopped;    // Array of stopped rays
   TObjArray fSuspended;  // Array of suspended rays
+  ARaySink* fSink;       //! Receiver of finished rays (not owned)
+  ARayPool* fPool;       //! Block storage of rays (0 if disabled)
+
+  void Append(TObjArray& array, TObjArray& rays);
+  void ClearArray(TObjArray& array);
+  void DeleteRay(ARay* ray);
 
  public:
   ARayArray();
   virtual ~ARayArray();
 
   virtual void Add(ARay* ray);
+  virtual void Add(const TObjArray& rays,
+                   const std::vector<Char_t>* status = 0);
+  virtual void Clear(Option_t* option = "");
+  void EnablePool(Int_t blockSize = 4096);
   virtual TObjArray* GetAbsorbed() { return &fAbsorbed; };
+  TObjArray* GetArray(Int_t status);
   virtual TObjArray* GetExited() { return &fExited; };
   virtual TObjArray* GetFocused() { return &fFocused; };
+  ULong64_t GetMemoryUsage(ULong64_t* points = 0, ULong64_t* nodes = 0,
+                           ULong64_t* objects = 0) const;
   virtual TObjArray* GetRunning() { return &fRunning; };
+  ARaySink* GetSink() const { return fSink; }
   virtual TObjArray* GetStopped() { return &fStopped; };
   virtual TObjArray* GetSuspended() { return &fSuspended; };
+  Bool_t IsPooled() const { return fPool != 0; }
   virtual void Merge(ARayArray* array);
+  ARay* NewRay(Int_t id, Double_t lambda, Double_t x, Double_t y, Double_t z,
+               Double_t t, Double_t dx, Double_t dy, Double_t dz);
+  virtual Int_t Resume(Int_t keep = 1);
+  void SetSink(ARaySink* sink) { fSink = sink; }
 
-  ClassDef(ARayArray, 1)
+  ClassDef(ARayArray, 3)
 };
 
 #endif  // A_RAY_ARRAY_H
@@ -0,0 +1,68 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_RAY_DISPLAY_H
+#define A_RAY_DISPLAY_H
+
+#include <map>
+#include <vector>
+
+#include "TAttLine.h"
+
+#include "ARay.h"
+#include "ARaySink.h"
+
+class TObjArray;
+class TPolyLine3D;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARayDisplay
+//
+// Single drawable object of the paths of many rays
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ARayDisplay : public ARaySink, public TAttLine {
+ public:
+  enum { kColorLine, kColorStatus, kColorWavelength };
+
+ private:
+  Int_t fColorMode;  // kColorLine, kColorStatus or kColorWavelength
+  Int_t fEvery;      // 1 in fEvery added rays is kept
+  Int_t fMaxRays;    // maximum number of kept rays (0 = no limit)
+  Long64_t fNadded;  // number of rays added so far
+  Color_t fStatusColor[ARay::kNstatus];  // colors in kColorStatus
+  std::vector<Float_t> fPoints;  // (x, y, z) of the points of all the rays
+  std::vector<Int_t> fOffsets;   // first point of each ray, and the end
+  std::vector<Float_t> fLambda;  // wavelength of each ray
+  std::vector<Char_t> fStatus;   // status of each ray
+  std::map<Int_t, Color_t> fPalette;  //! colors of 1-nm wavelength bins
+  TPolyLine3D* fLine;  //! line through which each ray is painted (owned)
+
+  Color_t GetRayColor(Int_t i);
+
+ public:
+  ARayDisplay(Int_t mode = kColorStatus);
+  virtual ~ARayDisplay();
+
+  void Add(const ARay& ray);
+  void Add(const TObjArray* rays);
+  virtual void Clear(Option_t* option = "");
+  virtual void Fill(const ARay& ray) { Add(ray); }
+  Int_t GetColorMode() const { return fColorMode; }
+  Int_t GetN() const { return Int_t(fStatus.size()); }
+  Long64_t GetNadded() const { return fNadded; }
+  Int_t GetNpoints() const { return Int_t(fPoints.size() / 3); }
+  virtual void Paint(Option_t* option = "");
+  void SetColorMode(Int_t mode);
+  void SetDecimation(Int_t every, Int_t maxRays = 0);
+  void SetStatusColor(Int_t status, Color_t color);
+
+  ClassDef(ARayDisplay, 1)
+};
+
+#endif  // A_RAY_DISPLAY_H
@@ -0,0 +1,99 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_RAY_GENERATOR_H
+#define A_RAY_GENERATOR_H
+
+#include "TGeoMatrix.h"
+#include "TObject.h"
+#include "TVector3.h"
+
+#include "ACounterRandom.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARayGenerator
+//
+// Lazy version of ARayShooter generating rays one by one on demand
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ARayGenerator : public TObject {
+ public:
+  enum {
+    kNone,
+    kCircle,
+    kRandomCircle,
+    kRandomCone,
+    kRandomRectangle,
+    kRandomSector,
+    kRandomSphere,
+    kRandomSphericalCone,
+    kRectangle
+  };
+
+ private:
+  Int_t fType;
+  Int_t fN;                  // number of rays
+  Int_t fNa, fNb;            // (nr, nphi) of Circle or (nx, ny) of Rectangle
+  Double_t fLambda;          // wavelength
+  Double_t fA, fB;           // sizes of the distribution
+  Double_t fRotation[9];     // rotation matrix given as rot
+  Double_t fTranslation[3];  // translation given as tr
+  Double_t fDirection[3];    // direction of rays before the rotation
+
+  ARayGenerator(Int_t type, Double_t lambda, TGeoRotation* rot,
+                TGeoTranslation* tr, TVector3* v);
+  void Rotate(const Double_t* local, Double_t* master) const;
+  void ToMaster(const Double_t* local, Double_t* master) const;
+
+ public:
+  ARayGenerator();
+  virtual ~ARayGenerator() {}
+
+  Double_t GetLambda() const { return fLambda; }
+  Int_t GetN() const { return fN; }
+  void GetRay(Int_t i, ACounterRandom& rng, Double_t* x, Double_t* d) const;
+  Int_t GetType() const { return fType; }
+
+  static ARayGenerator Circle(Double_t lambda, Double_t rmax, Int_t nr,
+                              Int_t nphi, TGeoRotation* rot = 0,
+                              TGeoTranslation* tr = 0, TVector3* v = 0);
+  static ARayGenerator RandomCircle(Double_t lambda, Double_t rmax, Int_t n,
+                                    TGeoRotation* rot = 0,
+                                    TGeoTranslation* tr = 0, TVector3* v = 0);
+  static ARayGenerator RandomCone(Double_t lambda, Double_t r, Double_t d,
+                                  Int_t n, TGeoRotation* rot = 0,
+                                  TGeoTranslation* tr = 0);
+  static ARayGenerator RandomRectangle(Double_t lambda, Double_t dx,
+                                       Double_t dy, Int_t n,
+                                       TGeoRotation* rot = 0,
+                                       TGeoTranslation* tr = 0,
+                                       TVector3* v = 0);
+  static ARayGenerator RandomSector(Double_t lambda, Double_t rmax,
+                                    Int_t order, Int_t n,
+                                    TGeoRotation* rot = 0,
+                                    TGeoTranslation* tr = 0, TVector3* v = 0);
+  static ARayGenerator RandomSphere(Double_t lambda, Int_t n,
+                                    TGeoTranslation* tr = 0);
+  static ARayGenerator RandomSphericalCone(Double_t lambda, Int_t n,
+                                           Double_t theta,
+                                           TGeoRotation* rot = 0,
+                                           TGeoTranslation* tr = 0);
+  static ARayGenerator RandomSquare(Double_t lambda, Double_t d, Int_t n,
+                                    TGeoRotation* rot = 0,
+                                    TGeoTranslation* tr = 0, TVector3* v = 0);
+  static ARayGenerator Rectangle(Double_t lambda, Double_t dx, Double_t dy,
+                                 Int_t nx, Int_t ny, TGeoRotation* rot = 0,
+                                 TGeoTranslation* tr = 0, TVector3* v = 0);
+  static ARayGenerator Square(Double_t lambda, Double_t d, Int_t n,
+                              TGeoRotation* rot = 0, TGeoTranslation* tr = 0,
+                              TVector3* v = 0);
+
+  ClassDef(ARayGenerator, 0)
+};
+
+#endif  // A_RAY_GENERATOR_H
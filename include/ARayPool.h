@@ -0,0 +1,53 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_RAY_POOL_H
+#define A_RAY_POOL_H
+
+#include <type_traits>
+#include <vector>
+
+#include "ARay.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARayPool
+//
+// Storage of ARay objects allocated in blocks
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ARayPool {
+ private:
+  typedef std::aligned_storage<sizeof(ARay), alignof(ARay)>::type Slot;
+
+  struct Block {
+    Slot* fSlots;
+    std::size_t fSize;
+  };
+
+  std::size_t fBlockSize;      // number of rays in a new block
+  std::vector<Block> fBlocks;  // blocks in use first, then the spare ones
+  std::size_t fCurrent;        // index of the block being filled
+  std::size_t fNused;          // number of used slots in the current block
+
+  ARayPool(const ARayPool&);
+  ARayPool& operator=(const ARayPool&);
+
+ public:
+  ARayPool(std::size_t blockSize = 4096);
+  ~ARayPool();
+
+  void* Allocate();
+  void Adopt(ARayPool& other);
+  std::size_t GetBlockSize() const { return fBlockSize; }
+  ULong64_t GetMemoryUsage() const;
+  std::size_t GetNblocks() const { return fBlocks.size(); }
+  Bool_t Owns(const ARay* ray) const;
+  void Reset();
+};
+
+#endif  // A_RAY_POOL_H
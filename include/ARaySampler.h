@@ -0,0 +1,55 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_RAY_SAMPLER_H
+#define A_RAY_SAMPLER_H
+
+#include "TObject.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARaySampler
+//
+// Sampling policy of the random shooters of ARayShooter (pseudo-random,
+// scrambled Halton or scrambled Sobol)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ARaySampler : public TObject {
+ public:
+  enum { kPseudoRandom, kHalton, kSobol };
+  static const Int_t kDimensions = 3;  // 2D aperture/angle + wavelength
+
+ private:
+  Int_t fType;
+  ULong64_t fSeed;
+  Long64_t fIndex;                 // index of the next sample
+  UInt_t fShift[kDimensions];      // random digital shifts of Sobol
+  UChar_t fPermutation[kDimensions][5];  // digit permutations of Halton
+  Double_t fLambdaMin, fLambdaMax;  // wavelength range (ignored if empty)
+
+  Double_t Halton(Long64_t i, Int_t dim) const;
+  Double_t Sobol(Long64_t i, Int_t dim) const;
+
+ public:
+  ARaySampler(Int_t type = kSobol, ULong64_t seed = 0);
+  virtual ~ARaySampler() {}
+
+  void Get(Long64_t i, Double_t* u) const;
+  Long64_t GetIndex() const { return fIndex; }
+  Double_t GetLambda(Double_t lambda, const Double_t* u) const;
+  ULong64_t GetSeed() const { return fSeed; }
+  Int_t GetType() const { return fType; }
+  Bool_t HasWavelengthRange() const { return fLambdaMin < fLambdaMax; }
+  void Next(Double_t* u);
+  void Reset(Long64_t index = 0) { fIndex = index; }
+  void SetSeed(ULong64_t seed);
+  void SetWavelengthRange(Double_t min, Double_t max);
+
+  ClassDef(ARaySampler, 1)
+};
+
+#endif  // A_RAY_SAMPLER_H
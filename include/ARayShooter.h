@@ -7,12 +7,17 @@
 #ifndef A_RAY_SHOOTER_H
 #define A_RAY_SHOOTER_H
 
+#include <vector>
+
 #include "TGeoMatrix.h"
 #include "TMath.h"
 #include "TVector3.h"
 
 #include "ARayArray.h"
 
+class ARaySampler;
+class TGeoNode;
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // ARayShooter
@@ -30,11 +35,17 @@ class ARayShooter : public TObject {
   static ARayArray* Circle(Double_t lambda, Double_t rmax, Int_t nr, Int_t nphi,
                            TGeoRotation* rot = 0, TGeoTranslation* tr = 0,
                            TVector3* v = 0);
+  static ARaySampler* GetSampler();
   static ARayArray* RandomCircle(Double_t lambda, Double_t rmax, Int_t n,
                                  TGeoRotation* rot = 0, TGeoTranslation* tr = 0,
                                  TVector3* v = 0);
   static ARayArray* RandomCone(Double_t lambda, Double_t r, Double_t d, Int_t n,
                                TGeoRotation* rot = 0, TGeoTranslation* tr = 0);
+  static ARayArray* RandomFootprint(Double_t lambda,
+                                    const std::vector<TGeoNode*>& targets,
+                                    Int_t n, Double_t& area,
+                                    TGeoRotation* rot = 0,
+                                    TGeoTranslation* tr = 0, TVector3* v = 0);
   static ARayArray* RandomRectangle(Double_t lambda, Double_t dx, Double_t dy,
                                     Int_t n, TGeoRotation* rot = 0,
                                     TGeoTranslation* tr = 0, TVector3* v = 0);
@@ -49,6 +60,7 @@ class ARayShooter : public TObject {
   static ARayArray* Rectangle(Double_t lambda, Double_t dx, Double_t dy,
                               Int_t nx, Int_t ny, TGeoRotation* rot = 0,
                               TGeoTranslation* tr = 0, TVector3* v = 0);
+  static void SetSampler(ARaySampler* sampler);
   static ARayArray* Square(Double_t lambda, Double_t d, Int_t n,
                            TGeoRotation* rot = 0, TGeoTranslation* tr = 0,
                            TVector3* v = 0);
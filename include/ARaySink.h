@@ -0,0 +1,107 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_RAY_SINK_H
+#define A_RAY_SINK_H
+
+#include <functional>
+#include <vector>
+
+#include "TObject.h"
+
+class ARay;
+class TGeoRotation;
+class TGeoTranslation;
+class TH2;
+class TTree;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARaySink
+//
+// Receiver of finished rays (see ARayArray::SetSink)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ARaySink : public TObject {
+ public:
+  ARaySink() {}
+  virtual ~ARaySink() {}
+
+  virtual void Fill(const ARay& ray) = 0;
+
+  ClassDef(ARaySink, 0)
+};
+
+class ARayFunctionSink : public ARaySink {
+ private:
+  std::function<void(const ARay&)> fFunction;  //!
+
+ public:
+  ARayFunctionSink() {}
+  ARayFunctionSink(std::function<void(const ARay&)> f) : fFunction(f) {}
+  virtual ~ARayFunctionSink() {}
+
+  virtual void Fill(const ARay& ray) {
+    if (fFunction) fFunction(ray);
+  }
+
+  ClassDef(ARayFunctionSink, 0)
+};
+
+class ARayHistogramSink : public ARaySink {
+ private:
+  TH2* fHist;      // histogram of the focal-plane hits (not owned)
+  Double_t fUnit;  // unit of the histogram axes (e.g. AOpticsManager::mm())
+
+ public:
+  ARayHistogramSink(TH2* hist = 0, Double_t unit = 1.)
+      : fHist(hist), fUnit(unit) {}
+  virtual ~ARayHistogramSink() {}
+
+  virtual void Fill(const ARay& ray);
+
+  ClassDef(ARayHistogramSink, 0)
+};
+
+class ARaySymmetrySink : public ARaySink {
+ private:
+  ARaySink* fSink;               // sink of the unfolded rays (not owned)
+  Int_t fOrder;                  // order of the rotational symmetry
+  Double_t fTranslation[3];      // point on the symmetry axis
+  std::vector<Double_t> fImage;  // 3x3 rotation matrices of the images
+
+ public:
+  ARaySymmetrySink(ARaySink* sink = 0, Int_t order = 1,
+                   TGeoRotation* rot = 0, TGeoTranslation* tr = 0);
+  virtual ~ARaySymmetrySink() {}
+
+  virtual void Fill(const ARay& ray);
+  Int_t GetOrder() const { return fOrder; }
+
+  ClassDef(ARaySymmetrySink, 0)
+};
+
+class ARayTreeSink : public ARaySink {
+ private:
+  TTree* fTree;         // output tree (not owned)
+  Bool_t fFocusedOnly;  // skip the rays not focused
+  Bool_t fFocused;      // branch buffers below
+  Double_t fPoint[4];
+  Double_t fDirection[3];
+  Double_t fLambda;
+  Double_t fWeight;
+
+ public:
+  ARayTreeSink(TTree* tree = 0, Bool_t focusedOnly = kTRUE);
+  virtual ~ARayTreeSink() {}
+
+  virtual void Fill(const ARay& ray);
+
+  ClassDef(ARayTreeSink, 0)
+};
+
+#endif  // A_RAY_SINK_H
@@ -0,0 +1,66 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_RAY_WRITER_H
+#define A_RAY_WRITER_H
+
+#include <mutex>
+#include <vector>
+
+#include "TObject.h"
+
+class APhotonBuffer;
+class ARay;
+class TTree;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARayWriter
+//
+// Columnar writer of the final states of traced photons to a TTree
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ARayWriter : public TObject {
+ private:
+  struct Block {
+    std::vector<Double_t> fX, fY, fZ, fT, fDx, fDy, fDz, fLambda, fWeight;
+    std::vector<Int_t> fStatus, fNpoints, fNnodes, fNodes;
+
+    void Clear();
+    Int_t GetN() const { return Int_t(fStatus.size()); }
+  };
+
+  TTree* fTree;          // output tree (not owned)
+  Bool_t fFocusedOnly;   // skip the photons not focused
+  Bool_t fHistory;       // write the compact node histories
+  Int_t fBlockSize;      // photons per entry of the tree
+  Int_t fN;              // branch buffers of the block sizes
+  Int_t fNhistory;       //
+  ULong64_t fNwritten;   // number of photons written
+  std::mutex fMutex;     //! guards the tree
+
+  Block& GetBlock();
+  static std::vector<std::pair<ARayWriter*, Block>>& GetThreadBuffers();
+  void Write(Block& block);
+
+ public:
+  ARayWriter(TTree* tree = 0, Bool_t focusedOnly = kTRUE,
+             Bool_t history = kFALSE, Int_t blockSize = 4096);
+  ARayWriter(const ARayWriter&) = delete;
+  ARayWriter& operator=(const ARayWriter&) = delete;
+  virtual ~ARayWriter() {}
+
+  void Fill(const ARay& ray);
+  void Fill(const APhotonBuffer& buffer, Int_t i);
+  static void FlushThreadBuffers();
+  ULong64_t GetNwritten() const { return fNwritten; }
+  TTree* GetTree() const { return fTree; }
+
+  ClassDef(ARayWriter, 0)
+};
+
+#endif  // A_RAY_WRITER_H
@@ -10,9 +10,14 @@
 #include "TGraph.h"
 #include "TMath.h"
 
+#include "ALookupTable.h"
+#include "AMemoryUtil.h"
+
 #include <complex>
+#include <cstddef>
 #include <limits>
 #include <memory>
+#include <string>
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -26,19 +31,37 @@ class ARefractiveIndex : public TObject {
  protected:
   std::shared_ptr<TGraph> fRefractiveIndex;
   std::shared_ptr<TGraph> fExtinctionCoefficient;
+  ALookupTable fTableN;  // baked refractive index
+  ALookupTable fTableK;  // baked extinction coefficient
+
+  // Fill n and k (if any) from the whole text of a data file
+  typedef Bool_t (*TableParser)(const std::string& text, TGraph& n, TGraph& k);
+  Bool_t LoadSharedTables(const char* fname, TableParser parser);
 
  public:
   ARefractiveIndex(){};
   ARefractiveIndex(Double_t n, Double_t k = 0.);
   virtual ~ARefractiveIndex(){};
 
+  Bool_t BakeTable(Double_t lambdaMin, Double_t lambdaMax,
+                   Double_t tolerance = 1e-6);
+  void ClearTable() {
+    fTableN.Clear();
+    fTableK.Clear();
+  }
+  static void ClearSharedTables();
+  virtual Bool_t CountMemory(AMemoryUtil::Counter& counter) const;
   virtual Double_t GetAbbeNumber() const;
   virtual Double_t GetRefractiveIndex(Double_t lambda) const {
     return fRefractiveIndex ? fRefractiveIndex->Eval(lambda) : 1.;
   }
+  virtual void GetRefractiveIndex(const Double_t* lambda, Double_t* n,
+                                  std::size_t count) const;
   virtual Double_t GetExtinctionCoefficient(Double_t lambda) const {
     return fExtinctionCoefficient ? fExtinctionCoefficient->Eval(lambda) : 0.;
   }
+  virtual void GetExtinctionCoefficient(const Double_t* lambda, Double_t* k,
+                                        std::size_t count) const;
   virtual Double_t GetAbsorptionLength(Double_t lambda) const {
     static const Double_t inf = std::numeric_limits<Double_t>::infinity();
     Double_t k = GetExtinctionCoefficient(lambda);
@@ -49,11 +72,33 @@ class ARefractiveIndex : public TObject {
     return std::complex<Double_t>(GetRefractiveIndex(lambda),
                                   GetExtinctionCoefficient(lambda));
   }
+  Double_t GetTabulatedAbsorptionLength(Double_t lambda) const {
+    if (not fTableK.Contains(lambda)) return GetAbsorptionLength(lambda);
+    static const Double_t inf = std::numeric_limits<Double_t>::infinity();
+    Double_t k = fTableK.Eval(lambda);
+    return k <= 0. ? inf : ExtinctionCoefficientToAbsorptionLength(k, lambda);
+  }
+  Double_t GetTabulatedExtinctionCoefficient(Double_t lambda) const {
+    return fTableK.Contains(lambda) ? fTableK.Eval(lambda)
+                                    : GetExtinctionCoefficient(lambda);
+  }
+  Double_t GetTabulatedRefractiveIndex(Double_t lambda) const {
+    return fTableN.Contains(lambda) ? fTableN.Eval(lambda)
+                                    : GetRefractiveIndex(lambda);
+  }
+  ULong64_t GetMemoryUsage() const {
+    AMemoryUtil::Counter counter;
+    CountMemory(counter);
+    return counter.GetBytes();
+  }
+  Bool_t IsBaked() const { return not fTableN.IsEmpty(); }
   virtual void SetExtinctionCoefficient(std::shared_ptr<TGraph> graph) {
     fExtinctionCoefficient = graph;
+    ClearTable();
   }
   virtual void SetRefractiveIndex(std::shared_ptr<TGraph> graph) {
     fRefractiveIndex = graph;
+    ClearTable();
   }
   static Double_t AbsorptionLengthToExtinctionCoefficient(Double_t a,
                                                           Double_t lambda) {
@@ -64,7 +109,7 @@ class ARefractiveIndex : public TObject {
     return lambda / (4 * TMath::Pi() * k);
   }
 
-  ClassDef(ARefractiveIndex, 1)
+  ClassDef(ARefractiveIndex, 2)
 };
 
 #endif  // A_REFRACTIVE_INDEX_H
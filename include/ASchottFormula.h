@@ -29,6 +29,8 @@ class ASchottFormula : public ARefractiveIndex {
   ASchottFormula(const Double_t* p);
 
   virtual Double_t GetRefractiveIndex(Double_t lambda) const;
+  virtual void GetRefractiveIndex(const Double_t* lambda, Double_t* n,
+                                  std::size_t count) const;
 
   ClassDef(ASchottFormula, 1)
 };
@@ -32,6 +32,8 @@ class ASellmeierFormula : public ARefractiveIndex {
   ASellmeierFormula(const Double_t* p);
 
   virtual Double_t GetRefractiveIndex(Double_t lambda) const;
+  virtual void GetRefractiveIndex(const Double_t* lambda, Double_t* n,
+                                  std::size_t count) const;
   virtual TF1* FitData(TGraph* graph, const char* tf1name,
                        Option_t* option = "");
   virtual TF1* MakeGraph(const char* tf1name, Double_t xmin, Double_t xmax);
@@ -0,0 +1,62 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_STREAMER_UTIL_H
+#define A_STREAMER_UTIL_H
+
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+
+#include "TBuffer.h"
+#include "TClass.h"
+
+class ALookupTable;
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// AStreamerUtil                                                              //
+//                                                                            //
+// Helpers of the custom streamers for std::shared_ptr members and tables     //
+////////////////////////////////////////////////////////////////////////////////
+
+namespace AStreamerUtil {
+
+std::shared_ptr<void> FindShared(const void* ptr);
+void RegisterShared(const std::shared_ptr<void>& ptr);
+void StreamTable(TBuffer& b, ALookupTable& table);
+
+template <typename T>
+void ReadShared(TBuffer& b, std::shared_ptr<T>& ptr) {
+  // Read an object written by WriteShared. An object referred to by several
+  // std::shared_ptr is stored once in a buffer, and owned by a single control
+  // block again after reading.
+  typedef typename std::remove_const<T>::type U;
+  U* raw = (U*)b.ReadObjectAny(TClass::GetClass(typeid(U)));
+  if (!raw) {
+    ptr.reset();
+    return;
+  }
+
+  std::shared_ptr<void> shared = FindShared(raw);
+  if (shared) {
+    ptr = std::static_pointer_cast<U>(shared);
+  } else {
+    std::shared_ptr<U> owner(raw);
+    RegisterShared(owner);
+    ptr = owner;
+  }
+}
+
+template <typename T>
+void WriteShared(TBuffer& b, const std::shared_ptr<T>& ptr) {
+  typedef typename std::remove_const<T>::type U;
+  b.WriteObjectAny(const_cast<U*>(ptr.get()), TClass::GetClass(typeid(U)));
+}
+
+}  // namespace AStreamerUtil
+
+#endif  // A_STREAMER_UTIL_H
@@ -0,0 +1,130 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_SURFACE_KERNELS_H
+#define A_SURFACE_KERNELS_H
+
+#include <cmath>
+#include <limits>
+
+#include "Rtypes.h"
+#include "TMath.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ASurfaceKernels
+//
+// Inline kernels of the surface interactions used by AOpticsManager. They
+// work on plain arrays and local orthonormal bases, so that no ROOT objects
+// (TVector3, TGeoRotation) are created at each reflection.
+//
+// Directions are unit vectors. The normal n goes along the incident ray,
+// i.e., into the surface, as returned by TGeoNavigator::FindNormal.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+namespace ASurfaceKernels {
+
+inline void MakeBasis(const Double_t* n, Double_t* t1, Double_t* t2) {
+  // Make t1 and t2 so that (t1, t2, n) is a right-handed orthonormal basis.
+  // No branch is needed for n close to the Z axis.
+  // T. Duff et al., "Building an Orthonormal Basis, Revisited," JCGT 6 (2017)
+  Double_t sign = std::copysign(1., n[2]);
+  Double_t a = -1. / (sign + n[2]);
+  Double_t b = n[0] * n[1] * a;
+  t1[0] = 1. + sign * n[0] * n[0] * a;
+  t1[1] = sign * b;
+  t1[2] = -sign * n[0];
+  t2[0] = b;
+  t2[1] = sign + n[1] * n[1] * a;
+  t2[2] = -n[1];
+}
+
+inline void Reflect(const Double_t* d, const Double_t* n, Double_t cosine,
+                    Double_t* out) {
+  // Specular reflection of d, where cosine = d*n
+  for (Int_t i = 0; i < 3; i++) {  // out = d - 2n*(d*n)
+    out[i] = d[i] - 2 * n[i] * cosine;
+  }
+}
+
+template <typename R>
+inline void SampleLambertian(const Double_t* n, R& rng, Double_t* out) {
+  // Diffuse reflection of a ray going along n. The theta distribution must
+  // be weighted by sin(theta) * cos(theta)
+  // y (\theta) = \int _0 ^\theta \sin\theta' \cos\theta' d\theta'
+  //            = \frac{1}{2} \sin^2 \theta
+  // i.e., sin^2(theta) is uniform in [0, 1]
+  Double_t sin2 = rng.Uniform(1);
+  Double_t phi = rng.Uniform(TMath::TwoPi());
+  Double_t sint = std::sqrt(sin2);
+  Double_t cost = std::sqrt(1 - sin2);
+  Double_t x = sint * std::cos(phi);
+  Double_t y = sint * std::sin(phi);
+
+  Double_t t1[3], t2[3];
+  MakeBasis(n, t1, t2);
+  for (Int_t i = 0; i < 3; i++) {
+    out[i] = x * t1[i] + y * t2[i] - cost * n[i];  // back to the incident side
+  }
+}
+
+template <typename R>
+inline void SampleFacetNormal(const Double_t* n, const Double_t* d,
+                              Double_t sigma, R& rng, Double_t* out) {
+  // Normal of a micro facet of a surface with Gaussian-like roughness sigma
+  // (rad), which faces the ray going along d. The sampling is the same as in
+  // G4OpBoundaryProcess::GetFacetNormal in Geant4 optics.
+  Double_t t1[3], t2[3];
+  MakeBasis(n, t1, t2);
+  Double_t f_max = TMath::Min(1., 4. * sigma);
+
+  do {
+    Double_t alpha, sina;
+    do {
+      alpha = rng.Gaus(0, sigma);
+      sina = std::sin(alpha);
+    } while (rng.Uniform(f_max) > sina or alpha >= TMath::PiOver2());
+
+    Double_t phi = rng.Uniform(TMath::TwoPi());
+    Double_t cosa = std::sqrt(1 - sina * sina);  // alpha is in (0, pi/2)
+    Double_t x = sina * std::cos(phi);
+    Double_t y = sina * std::sin(phi);
+    for (Int_t i = 0; i < 3; i++) {
+      out[i] = x * t1[i] + y * t2[i] + cosa * n[i];
+    }
+  } while (d[0] * out[0] + d[1] * out[1] + d[2] * out[2] <= 0.);
+}
+
+template <typename T>
+inline void HitBoundingSphere(Int_t n, const T* const* ray, const T* center,
+                              T radius2, UChar_t* hit) {
+  // Flag the rays of a packet whose forward path may cross the sphere of
+  // center and radius2. ray[0..2] and ray[3..5] are the lanes of the start
+  // points and directions (structure of arrays), given relative to a common
+  // origin near the packet. The loop has no branch so that it can be
+  // vectorized with T = Float_t or Double_t. The tolerance covers the
+  // rounding errors of T, so that no sphere accepted by the same test in
+  // double precision is rejected.
+  const T tol = 64 * std::numeric_limits<T>::epsilon();
+  const T *x = ray[0], *y = ray[1], *z = ray[2];
+  const T *dx = ray[3], *dy = ray[4], *dz = ray[5];
+  for (Int_t i = 0; i < n; i++) {
+    T ox = center[0] - x[i];
+    T oy = center[1] - y[i];
+    T oz = center[2] - z[i];
+    T oc2 = ox * ox + oy * oy + oz * oz;
+    T tca = ox * dx[i] + oy * dy[i] + oz * dz[i];
+    T d2 = oc2 - tca * tca;  // squared distance between the line and center
+    T e = tol * (oc2 + radius2 + x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+    hit[i] = (d2 <= radius2 + e) &
+             ((oc2 <= radius2 + e) | (tca >= 0) | (tca * tca <= e));
+  }
+}
+
+}  // namespace ASurfaceKernels
+
+#endif  // A_SURFACE_KERNELS_H
@@ -0,0 +1,72 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_THREAD_POOL_H
+#define A_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TObject.h"
+
+namespace ROOT {
+namespace Experimental {
+class TTaskGroup;
+}
+}  // namespace ROOT
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AThreadPool
+//
+// Fixed number of worker threads processing a queue of tasks, or a group of
+// tasks in the thread pool of ROOT when implicit multithreading is enabled
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class AThreadPool {
+ private:
+  std::vector<std::thread> fThreads;
+  std::deque<std::function<void()>> fTasks;
+  std::mutex fMutex;
+  std::condition_variable fTaskCondition;  // notified when a task is queued
+  std::condition_variable fIdleCondition;  // notified when a task is done
+  std::size_t fNbusy;                      // number of running tasks
+  Bool_t fStop;
+  std::exception_ptr fException;  // first exception thrown by a task
+  std::function<void()> fInit;    // called before each task in fGroup
+  std::shared_ptr<ROOT::Experimental::TTaskGroup> fGroup;  // tasks of IMT
+
+  static Bool_t fgUseImplicitMT;
+
+  void Run(const std::function<void()>& task);
+  void Work(std::function<void()> init, std::function<void()> fini);
+
+ public:
+  AThreadPool(std::size_t nthreads, std::function<void()> init = nullptr,
+              std::function<void()> fini = nullptr);
+  AThreadPool(const AThreadPool&) = delete;
+  AThreadPool& operator=(const AThreadPool&) = delete;
+  ~AThreadPool();
+
+  static std::size_t GetImplicitMTPoolSize();
+  std::size_t GetNthreads() const {
+    return fGroup ? GetImplicitMTPoolSize() : fThreads.size();
+  }
+  static Bool_t IsImplicitMTEnabled();
+  void Push(std::function<void()> task);
+  static void SetUseImplicitMT(Bool_t use) { fgUseImplicitMT = use; }
+  Bool_t UsesImplicitMT() const { return fGroup != nullptr; }
+  void Wait();
+};
+
+#endif  // A_THREAD_POOL_H
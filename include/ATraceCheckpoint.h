@@ -0,0 +1,68 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_TRACE_CHECKPOINT_H
+#define A_TRACE_CHECKPOINT_H
+
+#include <vector>
+
+#include "TObjArray.h"
+#include "TObject.h"
+
+class AOpticsManager;
+class TH1;
+class TRandom;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ATraceCheckpoint
+//
+// Progress of a tracing campaign written to a file to restart it later
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ATraceCheckpoint : public TObject {
+ private:
+  Int_t fFile;        // index of the input file being traced
+  Int_t fEvent;       // last event finished in that file
+  ULong64_t fUnit;    // number of work units processed so far
+  Long64_t fNtraced;  // number of work units traced so far
+  Long64_t fEntries;  // number of entries written to the output
+  std::vector<Int_t> fKeys;        // keys of the managers (e.g. telescopes)
+  std::vector<ULong64_t> fSeeds;   // AOpticsManager::GetRandomSeed
+  std::vector<ULong64_t> fNcalls;  // AOpticsManager::GetNcalls
+  TRandom* fRandom;                // copy of gRandom
+  TObjArray fAccumulators;         // copies of histograms
+
+ public:
+  ATraceCheckpoint();
+  ATraceCheckpoint(const ATraceCheckpoint&) = delete;
+  ATraceCheckpoint& operator=(const ATraceCheckpoint&) = delete;
+  virtual ~ATraceCheckpoint();
+
+  void AddAccumulator(const TH1& hist);
+  Long64_t GetEntries() const { return fEntries; }
+  Int_t GetEvent() const { return fEvent; }
+  Int_t GetFile() const { return fFile; }
+  Long64_t GetNtraced() const { return fNtraced; }
+  ULong64_t GetUnit() const { return fUnit; }
+  Bool_t RestoreAccumulator(TH1& hist) const;
+  Bool_t RestoreGlobalRandom() const;
+  Bool_t RestoreRandom(Int_t key, AOpticsManager& manager) const;
+  void SaveGlobalRandom();
+  void SaveRandom(Int_t key, const AOpticsManager& manager);
+  void SetEntries(Long64_t n) { fEntries = n; }
+  void SetNtraced(Long64_t n) { fNtraced = n; }
+  void SetPosition(Int_t file, Int_t event, ULong64_t unit) {
+    fFile = file;
+    fEvent = event;
+    fUnit = unit;
+  }
+
+  ClassDef(ATraceCheckpoint, 1)
+};
+
+#endif  // A_TRACE_CHECKPOINT_H
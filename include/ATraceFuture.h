@@ -0,0 +1,77 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_TRACE_FUTURE_H
+#define A_TRACE_FUTURE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "TObjArray.h"
+#include "TObject.h"
+
+class ARayArray;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ATraceFuture
+//
+// Handle of rays traced in the background by AOpticsManager::TraceAsync
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ATraceFuture : public TObject {
+ public:
+  struct State;
+
+ private:
+  std::shared_ptr<State> fState;  //! shared with the tracing threads
+
+ public:
+  ATraceFuture() {}
+  explicit ATraceFuture(const std::shared_ptr<State>& state) : fState(state) {}
+  virtual ~ATraceFuture() {}
+
+  Int_t GetNrays() const;
+  Int_t GetNtraced() const;
+  Double_t GetProgress() const;
+  Bool_t IsDone() const;
+  Bool_t IsValid() const { return fState != nullptr; }
+  Bool_t Wait(Double_t timeout = -1);
+
+  ClassDef(ATraceFuture, 0)
+};
+
+// Running rays of one tracing call taken out of their arrays, shared by the
+// caller and the tracing tasks
+struct ATraceFuture::State {
+  std::vector<ARayArray*> fArrays;  // (not owned)
+  std::vector<Int_t> fOffset;       // rays of fArrays[i] start at fOffset[i]
+  TObjArray fRays;                  // rays being traced
+  std::vector<Char_t> fStatus;      // final status of each ray
+  std::vector<Int_t> fOrder;        // tracing order (empty for the index order)
+  std::atomic<Int_t> fNext;         // first ray of the next chunk
+  std::atomic<Int_t> fNtraced;      // number of rays finished
+  Int_t fNtasks;                    // tasks still running
+  Bool_t fReturned;                 // rays have been given back to fArrays
+  std::exception_ptr fException;    // first exception thrown by a task
+  std::mutex fMutex;                // guards fNtasks and fException
+  std::condition_variable fDone;    // notified when fNtasks becomes 0
+
+  State();
+  ~State();
+
+  void Finish(std::exception_ptr exception = nullptr);
+  Int_t GetNrays() const { return fRays.GetLast() + 1; }
+  void Return();
+  void Take(const std::vector<ARayArray*>& arrays);
+};
+
+#endif  // A_TRACE_FUTURE_H
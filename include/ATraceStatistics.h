@@ -0,0 +1,92 @@
+// Author: Akira Okumura <mailto:oxon@mac.com>
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+#ifndef A_TRACE_STATISTICS_H
+#define A_TRACE_STATISTICS_H
+
+#include <chrono>
+#include <unordered_map>
+
+#include "TObject.h"
+
+class TGeoNode;
+class TH1D;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ATraceStatistics
+//
+// Counters and timers of ray tracing
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class ATraceStatistics : public TObject {
+ public:
+  enum {
+    kStep = 0,        // navigation steps
+    kCrossing = 1,    // boundary crossings without refraction or reflection
+    kReflection = 2,  // reflections (mirror, Fresnel, TIR, multilayer)
+    kRefraction = 3,  // refractions
+    kAbsorption = 4,  // absorptions (mirror, multilayer, bulk, roulette)
+    kSuspension = 5,  // rays suspended by the limit
+    kExit = 6,        // rays exited the world
+    kStop = 7,        // rays stopped by obscurations, mirrors or QE
+    kFocus = 8,       // rays detected by focal surfaces
+    kNcounters = 9
+  };
+  enum {
+    kNavigation = 0,   // search of the next boundary
+    kInteraction = 1,  // Fresnel, reflection and QE calculation
+    kMultilayer = 2,   // interaction at boundaries with multilayers (TMM)
+    kNphases = 3
+  };
+  static const Int_t kNtypes = 7;  // number of AOpticsManager node types
+
+ private:
+  struct Record {
+    ULong64_t fCount[kNcounters];
+    Double_t fTime[kNphases];
+    Record() {
+      for (Int_t i = 0; i < kNcounters; i++) fCount[i] = 0;
+      for (Int_t i = 0; i < kNphases; i++) fTime[i] = 0;
+    }
+  };
+
+  std::unordered_map<const TGeoNode*, Record> fNodeRecord;  //! per node
+  Record fTypeRecord[kNtypes];                               //! per node type
+
+ public:
+  ATraceStatistics();
+  virtual ~ATraceStatistics();
+
+  void Add(const ATraceStatistics& other);
+  void AddTime(const TGeoNode* node, Int_t type, Int_t phase, Double_t sec) {
+    fNodeRecord[node].fTime[phase] += sec;
+    fTypeRecord[type].fTime[phase] += sec;
+  }
+  virtual void Clear(Option_t* option = "");
+  void Count(const TGeoNode* node, Int_t type, Int_t counter) {
+    ++fNodeRecord[node].fCount[counter];
+    ++fTypeRecord[type].fCount[counter];
+  }
+  ULong64_t GetCount(Int_t counter) const;
+  ULong64_t GetNodeCount(const TGeoNode* node, Int_t counter) const;
+  Double_t GetNodeTime(const TGeoNode* node, Int_t phase) const;
+  Double_t GetTime(Int_t phase) const;
+  ULong64_t GetTypeCount(Int_t type, Int_t counter) const;
+  Double_t GetTypeTime(Int_t type, Int_t phase) const;
+  TH1D* MakeNodeHistogram(Int_t counter) const;
+  static Double_t Now() {
+    return std::chrono::duration<Double_t>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+  virtual void Print(Option_t* option = "") const;
+
+  ClassDef(ATraceStatistics, 1)
+};
+
+#endif  // A_TRACE_STATISTICS_H
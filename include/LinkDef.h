@@ -12,33 +12,54 @@
 #pragma link C++ namespace AGeoUtil;
 
 #pragma link C++ class A2x2ComplexMatrix;
-#pragma link C++ class ABorderSurfaceCondition;
+#pragma link C++ class AAdaptiveTracer;
+#pragma link C++ class ABorderSurfaceCondition-;
+#pragma link C++ class ACameraMap;
 #pragma link C++ class ACauchyFormula;
+#pragma link C++ class ACorsikaIACTDriver;
 #pragma link C++ class ACorsikaIACTEventHeader;
 #pragma link C++ class ACorsikaIACTFile;
 #pragma link C++ class ACorsikaIACTRunHeader;
 #pragma link C++ class AFilmetrixDotCom;
+#pragma link C++ class AFocalPlaneMonitor;
 #pragma link C++ class AFocalSurface;
-#pragma link C++ class AGeoAsphericDisk;
+#pragma link C++ class AGeoAsphericDisk-;
 #pragma link C++ class AGeoBezierPcon;
 #pragma link C++ class AGeoBezierPgon;
+#pragma link C++ class AGeoSegmentedMirror;
+#pragma link C++ class AGeoShapeProfiler;
 #pragma link C++ class AGeoWinstonCone2D;
 #pragma link C++ class AGeoWinstonConePoly;
 #pragma link C++ class AGlassCatalog;
-#pragma link C++ class ALens;
-#pragma link C++ class AMirror;
-#pragma link C++ class AMixedRefractiveIndex;
-#pragma link C++ class AMultilayer;
+#pragma link C++ class ALens-;
+#pragma link C++ class ALookupTable;
+#pragma link C++ class AMirror-;
+#pragma link C++ class AMisalignmentEnsemble;
+#pragma link C++ class AMixedRefractiveIndex-;
+#pragma link C++ class AMultilayer-;
 #pragma link C++ class AObscuration;
 #pragma link C++ class AOpticalComponent;
 #pragma link C++ class AOpticsManager;
+#pragma link C++ class APhotonBuffer;
 #pragma link C++ class ARay;
 #pragma link C++ class ARayArray;
+#pragma link C++ class ARayDisplay;
+#pragma link C++ class ARayFunctionSink;
+#pragma link C++ class ARayGenerator;
+#pragma link C++ class ARayHistogramSink;
+#pragma link C++ class ARaySampler;
 #pragma link C++ class ARayShooter;
-#pragma link C++ class ARefractiveIndex;
+#pragma link C++ class ARaySink;
+#pragma link C++ class ARaySymmetrySink;
+#pragma link C++ class ARayTreeSink;
+#pragma link C++ class ARayWriter;
+#pragma link C++ class ARefractiveIndex-;
 #pragma link C++ class ARefractiveIndexDotInfo;
 #pragma link C++ class ASchottFormula;
 #pragma link C++ class ASellmeierFormula;
+#pragma link C++ class ATraceCheckpoint;
+#pragma link C++ class ATraceFuture;
+#pragma link C++ class ATraceStatistics;
 
 // for automatic loading
 #ifdef MAKE_MAPS
@@ -0,0 +1,234 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AAdaptiveTracer
+//
+// Driver of convergence-controlled tracing. Instead of guessing a fixed
+// number of rays for each field angle and wavelength, each configuration
+// (an ARayGenerator giving the rays of one round) is traced round after round
+// until the statistical errors of all the observables reach their target
+// precisions. Configurations which have converged are not traced any more, so
+// that the rays are spent on the noisy ones.
+//
+//   AAdaptiveTracer tracer(manager);
+//   tracer.AddObservable(AAdaptiveTracer::kContainmentRadius, 0.01, 0.8);
+//   tracer.AddObservable(AAdaptiveTracer::kFocusedFraction, 0.005);
+//   for (Int_t i = 0; i < 5; i++) {
+//     TGeoRotation rot("", 90, i * deg, 0);  // field angle
+//     tracer.AddConfiguration(
+//         ARayGenerator::RandomCircle(400 * nm, 1 * m, 10000, &rot, &tr));
+//   }
+//   tracer.SetMaxRays(10000000);
+//   tracer.Run();
+//   // tracer.GetValue(i, 0) is the 80% containment radius of field angle i
+//
+// The observables are
+//   kContainmentRadius : radius containing a fraction of the focused weights
+//                        (AGeoUtil::ContainmentRadius, e.g. D80 / 2)
+//   kFocusedFraction   : focused weights per generated ray, i.e., the
+//                        effective area divided by the area of the generator
+//   kTimeSpread        : weighted RMS of the arrival times
+// and are computed from the focal-plane hits of all the rounds. Their errors
+// are estimated by the batch-means method, i.e., from the scatter of the
+// values of the individual rounds divided by sqrt(number of rounds), which
+// works for the containment radius as well as for the moments. At least
+// SetMinRounds (4 by default) rounds are traced before the errors are used.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TMath.h"
+
+#include "AAdaptiveTracer.h"
+#include "AGeoUtil.h"
+#include "AOpticsManager.h"
+#include "ARay.h"
+#include "ARaySink.h"
+
+ClassImp(AAdaptiveTracer);
+
+//_____________________________________________________________________________
+AAdaptiveTracer::AAdaptiveTracer(AOpticsManager* manager)
+    : fManager(manager), fMinRounds(4), fMaxRays(100000000) {}
+
+//_____________________________________________________________________________
+Int_t AAdaptiveTracer::AddConfiguration(const ARayGenerator& generator) {
+  // Add a configuration traced by generator in each round, and return its
+  // index. The number of rays of the generator is that of a round.
+  Configuration conf;
+  conf.fGenerator = generator;
+  conf.fNrays = 0;
+  conf.fConverged = kFALSE;
+  fConfigurations.push_back(conf);
+
+  return GetNconfigurations() - 1;
+}
+
+//_____________________________________________________________________________
+Int_t AAdaptiveTracer::AddObservable(Int_t type, Double_t precision,
+                                     Double_t fraction) {
+  // Add an observable whose relative error must be smaller than precision,
+  // and return its index. fraction is the containment fraction used by
+  // kContainmentRadius.
+  if (type < kContainmentRadius or type > kTimeSpread or precision <= 0) {
+    Error("AddObservable", "Invalid observable: %d, %g", type, precision);
+    return -1;
+  }
+  Observable obs = {type, precision, fraction};
+  fObservables.push_back(obs);
+
+  return Int_t(fObservables.size()) - 1;
+}
+
+//_____________________________________________________________________________
+Double_t AAdaptiveTracer::Evaluate(const Configuration& conf,
+                                   const Observable& obs, std::size_t first,
+                                   std::size_t last, Int_t nrays) const {
+  // Value of obs computed from the hits [first, last) of nrays rays
+  Int_t n = Int_t(last - first);
+  Double_t sw = 0, st = 0, stt = 0;
+  for (std::size_t i = first; i < last; i++) {
+    sw += conf.fW[i];
+    st += conf.fW[i] * conf.fT[i];
+    stt += conf.fW[i] * conf.fT[i] * conf.fT[i];
+  }
+
+  switch (obs.fType) {
+    case kContainmentRadius: {
+      if (n == 0) return 0;
+      Double_t r, x, y;
+      AGeoUtil::ContainmentRadius(n, &conf.fX[first], &conf.fY[first],
+                                  obs.fFraction, r, x, y, &conf.fW[first]);
+      return r;
+    }
+    case kFocusedFraction:
+      return nrays > 0 ? sw / nrays : 0;
+    case kTimeSpread: {
+      if (sw <= 0) return 0;
+      Double_t mean = st / sw;
+      return TMath::Sqrt(TMath::Max(stt / sw - mean * mean, 0.));
+    }
+    default:
+      return 0;
+  }
+}
+
+//_____________________________________________________________________________
+void AAdaptiveTracer::Reset() {
+  // Clear the hits and the results of all the configurations
+  for (std::size_t i = 0; i < fConfigurations.size(); i++) {
+    Configuration& conf = fConfigurations[i];
+    conf.fNrays = 0;
+    conf.fConverged = kFALSE;
+    conf.fX.clear();
+    conf.fY.clear();
+    conf.fT.clear();
+    conf.fW.clear();
+    conf.fRoundEnd.clear();
+    conf.fValue.clear();
+    conf.fError.clear();
+    conf.fRoundValue.clear();
+  }
+}
+
+//_____________________________________________________________________________
+Int_t AAdaptiveTracer::Run() {
+  // Trace all the configurations which have not converged, one round each,
+  // until they converge or reach SetMaxRays. The hits of previous calls are
+  // kept, so Run can be called again after tightening the precisions.
+  // Returns the number of the converged configurations.
+  if (!fManager) {
+    Error("Run", "No AOpticsManager is given");
+    return 0;
+  }
+  if (fObservables.empty()) {
+    Error("Run", "No observable is given");
+    return 0;
+  }
+
+  Configuration* current = 0;
+  ARayFunctionSink sink([&current](const ARay& ray) {
+    // calls are serialized by AOpticsManager
+    if (not ray.IsFocused()) return;
+    Double_t p[4];
+    ray.GetLastPoint(p);
+    current->fX.push_back(p[0]);
+    current->fY.push_back(p[1]);
+    current->fT.push_back(p[3]);
+    current->fW.push_back(ray.GetWeight());
+  });
+
+  for (std::size_t i = 0; i < fConfigurations.size(); i++) {
+    Update(fConfigurations[i]);  // observables may have been added
+  }
+
+  while (kTRUE) {
+    Bool_t traced = kFALSE;
+    for (std::size_t i = 0; i < fConfigurations.size(); i++) {
+      Configuration& conf = fConfigurations[i];
+      Int_t n = conf.fGenerator.GetN();
+      if (conf.fConverged or n <= 0 or conf.fNrays + n > fMaxRays) continue;
+
+      current = &conf;
+      fManager->TraceNonSequential(conf.fGenerator, &sink);
+      conf.fNrays += n;
+      conf.fRoundEnd.push_back(conf.fX.size());
+      Update(conf);
+      traced = kTRUE;
+    }
+    if (not traced) break;
+  }
+
+  Int_t nconverged = 0;
+  for (std::size_t i = 0; i < fConfigurations.size(); i++) {
+    if (fConfigurations[i].fConverged) nconverged++;
+  }
+
+  return nconverged;
+}
+
+//_____________________________________________________________________________
+void AAdaptiveTracer::Update(Configuration& conf) const {
+  // Compute the values and the errors of the observables, and check if their
+  // relative errors are within the target precisions
+  std::size_t nobs = fObservables.size();
+  std::size_t nrounds = conf.fRoundEnd.size();
+  conf.fValue.assign(nobs, 0.);
+  conf.fError.assign(nobs, 0.);
+  if (nrounds == 0) {
+    conf.fConverged = kFALSE;
+    return;
+  }
+
+  Int_t n = conf.fGenerator.GetN();
+  Bool_t converged = Int_t(nrounds) >= fMinRounds;
+  conf.fRoundValue.resize(nobs);
+  for (std::size_t j = 0; j < nobs; j++) {
+    const Observable& obs = fObservables[j];
+    conf.fValue[j] = Evaluate(conf, obs, 0, conf.fX.size(), conf.fNrays);
+
+    // batch means of the rounds, each of which is evaluated only once
+    std::vector<Double_t>& values = conf.fRoundValue[j];
+    for (std::size_t k = values.size(); k < nrounds; k++) {
+      std::size_t first = k == 0 ? 0 : conf.fRoundEnd[k - 1];
+      values.push_back(Evaluate(conf, obs, first, conf.fRoundEnd[k], n));
+    }
+    if (nrounds > 1) {
+      Double_t s = 0, ss = 0;
+      for (std::size_t k = 0; k < nrounds; k++) {
+        s += values[k];
+        ss += values[k] * values[k];
+      }
+      Double_t mean = s / nrounds;
+      Double_t var = TMath::Max(ss - nrounds * mean * mean, 0.) / (nrounds - 1);
+      conf.fError[j] = TMath::Sqrt(var / nrounds);
+    }
+    if (conf.fError[j] > obs.fPrecision * TMath::Abs(conf.fValue[j])) {
+      converged = kFALSE;
+    }
+  }
+  conf.fConverged = converged;
+}
@@ -14,9 +14,18 @@
 
 #include "ABorderSurfaceCondition.h"
 #include "AOpticalComponent.h"
+#include "AStreamerUtil.h"
 
 ClassImp(ABorderSurfaceCondition);
 
+ABorderSurfaceCondition::ABorderSurfaceCondition()
+    : fSigma(0), fMultilayer(0), fLambertian(false) {
+  // Default constructor for ROOT I/O
+  fComponent[0] = 0;
+  fComponent[1] = 0;
+}
+
+//______________________________________________________________________________
 ABorderSurfaceCondition::ABorderSurfaceCondition(AOpticalComponent* component1,
                                                  AOpticalComponent* component2)
   : fSigma(0), fMultilayer(0), fLambertian(false) {
@@ -39,3 +48,33 @@ void ABorderSurfaceCondition::SetGaussianRoughness(Double_t sigma /* (rad) */) {
   // Geant4 optics.
   fSigma = TMath::Abs(sigma);
 }
+
+//______________________________________________________________________________
+void ABorderSurfaceCondition::Streamer(TBuffer& R__b) {
+  // The multilayer may be shared with other conditions
+  if (R__b.IsReading()) {
+    UInt_t R__s, R__c;
+    Version_t R__v = R__b.ReadVersion(&R__s, &R__c);
+    if (R__v < 2) {
+      R__b.ReadClassBuffer(ABorderSurfaceCondition::Class(), this, R__v, R__s,
+                           R__c);
+      return;
+    }
+    TObject::Streamer(R__b);
+    R__b >> fComponent[0];
+    R__b >> fComponent[1];
+    R__b >> fSigma;
+    AStreamerUtil::ReadShared(R__b, fMultilayer);
+    R__b >> fLambertian;
+    R__b.CheckByteCount(R__s, R__c, ABorderSurfaceCondition::IsA());
+  } else {
+    UInt_t R__c = R__b.WriteVersion(ABorderSurfaceCondition::IsA(), kTRUE);
+    TObject::Streamer(R__b);
+    R__b << fComponent[0];
+    R__b << fComponent[1];
+    R__b << fSigma;
+    AStreamerUtil::WriteShared(R__b, fMultilayer);
+    R__b << fLambertian;
+    R__b.SetByteCount(R__c, kTRUE);
+  }
+}
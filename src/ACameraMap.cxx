@@ -0,0 +1,369 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ACameraMap
+//
+// Pixel map of a focal-plane camera. The pixels are either a square lattice,
+// a hexagonal lattice (e.g. HexWinstonCone.C), or arbitrary polygons added
+// one by one. FindPixel returns the pixel ID of a point in constant time:
+// the lattice indices are computed directly, and the polygons are looked up
+// through a uniform grid index, so that no node history has to be searched
+// and no pixel has to be tested one by one.
+//
+// When a map is attached to AFocalPlaneMonitor by SetCameraMap, the pixel ID
+// of every focused ray is found while it is being traced, and the number of
+// hits, the sum of the weights and the mean and earliest arrival times of each
+// pixel are accumulated.
+//
+//   ACameraMap camera;
+//   camera.SetHexagonalLattice(6 * mm, 10);  // 331 pixels of 6 mm pitch
+//   AFocalPlaneMonitor monitor;
+//   monitor.SetCameraMap(&camera);
+//   focalSurface->SetMonitor(&monitor);
+//   manager->TraceNonSequential(array);
+//   // camera.GetSumOfWeights(id) etc. are ready
+//
+// The pixels are defined in the XY plane of the local frame of the camera,
+// which is the global frame unless SetMatrix gives the local-to-global
+// matrix. The hexagons have flat sides parallel to the X axis, and their IDs
+// are numbered ring by ring from the center. The pixels of a square lattice
+// are numbered along X first.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <limits>
+
+#include "TMath.h"
+
+#include "ACameraMap.h"
+
+ClassImp(ACameraMap);
+
+namespace {
+
+// axial directions of the neighbors of a hexagon
+const Int_t kHexDirection[6][2] = {{1, 0},  {1, -1}, {0, -1},
+                                   {-1, 0}, {-1, 1}, {0, 1}};
+
+}  // namespace
+
+//_____________________________________________________________________________
+ACameraMap::ACameraMap()
+    : fType(kNone),
+      fNx(0),
+      fNy(0),
+      fNrings(0),
+      fPitch(0),
+      fSize(0),
+      fXmin(0),
+      fXmax(0),
+      fYmin(0),
+      fYmax(0),
+      fInvDx(0),
+      fInvDy(0),
+      fIndexReady(kFALSE) {}
+
+//_____________________________________________________________________________
+void ACameraMap::AddHit(Int_t id, Double_t t, Double_t weight) {
+  // fMutex must be locked by the caller
+  fEntries[id]++;
+  fSumW[id] += weight;
+  fSumWT[id] += weight * t;
+  if (t < fFirstTime[id]) fFirstTime[id] = t;
+}
+
+//_____________________________________________________________________________
+Int_t ACameraMap::AddPolygon(Int_t n, const Double_t* x, const Double_t* y) {
+  // Add a polygon pixel of n vertices in the local frame, and return its ID.
+  // All the pixels of a map must be polygons if this is used.
+  if (fType != kPolygon) Init(kPolygon, 0, 0);
+  if (n < 3) {
+    Error("AddPolygon", "A polygon needs at least 3 vertices");
+    return -1;
+  }
+
+  fPolygonX.push_back(std::vector<Double_t>(x, x + n));
+  fPolygonY.push_back(std::vector<Double_t>(y, y + n));
+  Double_t cx = 0, cy = 0;
+  for (Int_t i = 0; i < n; i++) {
+    cx += x[i] / n;
+    cy += y[i] / n;
+  }
+  fCenterX.push_back(cx);
+  fCenterY.push_back(cy);
+  fIndexReady.store(kFALSE, std::memory_order_release);
+  ResizeAccumulators();
+
+  return GetNpixels() - 1;
+}
+
+//_____________________________________________________________________________
+void ACameraMap::BuildIndex() const {
+  // Build the uniform grid index of the polygons. About two cells per pixel
+  // are made along each axis, and each cell keeps the polygons whose
+  // bounding boxes overlap it. fIndexMutex must be locked by the caller.
+  ACameraMap* self = const_cast<ACameraMap*>(this);
+  Int_t npix = GetNpixels();
+  self->fCells.clear();
+  if (npix == 0) {
+    fIndexReady.store(kTRUE, std::memory_order_release);
+    return;
+  }
+
+  Double_t inf = std::numeric_limits<Double_t>::infinity();
+  std::vector<Double_t> xmin(npix, inf), xmax(npix, -inf);
+  std::vector<Double_t> ymin(npix, inf), ymax(npix, -inf);
+  self->fXmin = self->fYmin = inf;
+  self->fXmax = self->fYmax = -inf;
+  for (Int_t i = 0; i < npix; i++) {
+    for (std::size_t j = 0; j < fPolygonX[i].size(); j++) {
+      xmin[i] = TMath::Min(xmin[i], fPolygonX[i][j]);
+      xmax[i] = TMath::Max(xmax[i], fPolygonX[i][j]);
+      ymin[i] = TMath::Min(ymin[i], fPolygonY[i][j]);
+      ymax[i] = TMath::Max(ymax[i], fPolygonY[i][j]);
+    }
+    self->fXmin = TMath::Min(fXmin, xmin[i]);
+    self->fXmax = TMath::Max(fXmax, xmax[i]);
+    self->fYmin = TMath::Min(fYmin, ymin[i]);
+    self->fYmax = TMath::Max(fYmax, ymax[i]);
+  }
+
+  Int_t n = TMath::Max(1, Int_t(2 * TMath::Sqrt(Double_t(npix))));
+  self->fNx = self->fNy = n;
+  self->fInvDx = fXmax > fXmin ? n / (fXmax - fXmin) : 0;
+  self->fInvDy = fYmax > fYmin ? n / (fYmax - fYmin) : 0;
+  self->fCells.resize(n * n);
+  for (Int_t i = 0; i < npix; i++) {
+    Int_t ix1 = TMath::Min(n - 1, Int_t((xmin[i] - fXmin) * fInvDx));
+    Int_t ix2 = TMath::Min(n - 1, Int_t((xmax[i] - fXmin) * fInvDx));
+    Int_t iy1 = TMath::Min(n - 1, Int_t((ymin[i] - fYmin) * fInvDy));
+    Int_t iy2 = TMath::Min(n - 1, Int_t((ymax[i] - fYmin) * fInvDy));
+    for (Int_t iy = iy1; iy <= iy2; iy++) {
+      for (Int_t ix = ix1; ix <= ix2; ix++) {
+        self->fCells[iy * n + ix].push_back(i);
+      }
+    }
+  }
+
+  fIndexReady.store(kTRUE, std::memory_order_release);
+}
+
+//_____________________________________________________________________________
+void ACameraMap::Fill(Int_t id, Double_t t, Double_t weight) {
+  // Add a hit at time t to pixel id. Hits out of the pixels (id < 0) are
+  // ignored.
+  if (id < 0 or id >= GetNpixels()) return;
+
+  std::lock_guard<std::mutex> lock(fMutex);
+  AddHit(id, t, weight);
+}
+
+//_____________________________________________________________________________
+Int_t ACameraMap::FindHexagon(Double_t x, Double_t y) const {
+  // Round the fractional axial coordinates to the nearest hexagon
+  Double_t r = fPitch / TMath::Sqrt(3.);  // circumradius
+  Double_t fq = 2. / 3. * x / r;
+  Double_t fr = (-x / 3. + y / TMath::Sqrt(3.)) / r;
+  Double_t fs = -fq - fr;
+  Double_t q = std::round(fq), rr = std::round(fr), s = std::round(fs);
+  Double_t dq = std::fabs(q - fq), dr = std::fabs(rr - fr),
+           ds = std::fabs(s - fs);
+  if (dq > dr and dq > ds) {
+    q = -rr - s;
+  } else if (dr > ds) {
+    rr = -q - s;
+  }
+
+  Int_t iq = Int_t(q), ir = Int_t(rr);
+  Int_t n = fNrings;
+  if (TMath::Abs(iq) > n or TMath::Abs(ir) > n or TMath::Abs(iq + ir) > n) {
+    return -1;
+  }
+  Int_t id = fHexIndex[(iq + n) * (2 * n + 1) + ir + n];
+
+  if (fSize < fPitch) {
+    // distances from the three pairs of flat sides
+    Double_t dx = x - fCenterX[id];
+    Double_t dy = y - fCenterY[id];
+    Double_t a = fSize / 2.;
+    Double_t c = TMath::Sqrt(3.) / 2.;
+    if (std::fabs(dy) > a or std::fabs(c * dx + dy / 2.) > a or
+        std::fabs(c * dx - dy / 2.) > a) {
+      return -1;
+    }
+  }
+
+  return id;
+}
+
+//_____________________________________________________________________________
+Int_t ACameraMap::FindPixel(Double_t x, Double_t y) const {
+  // Return the ID of the pixel at (x, y) of the local frame, or -1 if the
+  // point is not in any pixel
+  switch (fType) {
+    case kSquare:
+      return FindSquare(x, y);
+    case kHexagonal:
+      return FindHexagon(x, y);
+    case kPolygon:
+      return FindPolygon(x, y);
+    default:
+      return -1;
+  }
+}
+
+//_____________________________________________________________________________
+Int_t ACameraMap::FindPixelOfPoint(const Double_t* point) const {
+  // Return the ID of the pixel at point (x, y, z) of the global frame
+  Double_t local[3];
+  fMatrix.MasterToLocal(point, local);
+
+  return FindPixel(local[0], local[1]);
+}
+
+//_____________________________________________________________________________
+Int_t ACameraMap::FindPolygon(Double_t x, Double_t y) const {
+  if (not fIndexReady.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(fIndexMutex);
+    if (not fIndexReady.load(std::memory_order_relaxed)) BuildIndex();
+  }
+  if (fCells.empty() or x < fXmin or x > fXmax or y < fYmin or y > fYmax) {
+    return -1;
+  }
+
+  Int_t ix = TMath::Min(fNx - 1, Int_t((x - fXmin) * fInvDx));
+  Int_t iy = TMath::Min(fNy - 1, Int_t((y - fYmin) * fInvDy));
+  const std::vector<Int_t>& cell = fCells[iy * fNx + ix];
+  for (std::size_t k = 0; k < cell.size(); k++) {
+    // crossing number test
+    const std::vector<Double_t>& px = fPolygonX[cell[k]];
+    const std::vector<Double_t>& py = fPolygonY[cell[k]];
+    Bool_t inside = kFALSE;
+    for (std::size_t i = 0, j = px.size() - 1; i < px.size(); j = i++) {
+      if ((py[i] > y) != (py[j] > y) and
+          x < (px[j] - px[i]) * (y - py[i]) / (py[j] - py[i]) + px[i]) {
+        inside = not inside;
+      }
+    }
+    if (inside) return cell[k];
+  }
+
+  return -1;
+}
+
+//_____________________________________________________________________________
+Int_t ACameraMap::FindSquare(Double_t x, Double_t y) const {
+  Double_t fx = x / fPitch + fNx / 2.;
+  Double_t fy = y / fPitch + fNy / 2.;
+  if (fx < 0 or fy < 0 or fx >= fNx or fy >= fNy) return -1;
+
+  Int_t ix = Int_t(fx), iy = Int_t(fy);
+  if (fSize < fPitch) {
+    Double_t a = fSize / fPitch / 2.;
+    if (std::fabs(fx - ix - 0.5) > a or std::fabs(fy - iy - 0.5) > a) {
+      return -1;
+    }
+  }
+
+  return iy * fNx + ix;
+}
+
+//_____________________________________________________________________________
+void ACameraMap::Init(Int_t type, Double_t pitch, Double_t size) {
+  fType = type;
+  fPitch = pitch;
+  fSize = size > 0 and size < pitch ? size : pitch;
+  fNx = fNy = fNrings = 0;
+  fCenterX.clear();
+  fCenterY.clear();
+  fHexIndex.clear();
+  fPolygonX.clear();
+  fPolygonY.clear();
+  fCells.clear();
+  fIndexReady.store(kFALSE, std::memory_order_release);
+}
+
+//_____________________________________________________________________________
+void ACameraMap::Reset() {
+  // Clear the accumulated hits of all the pixels
+  std::lock_guard<std::mutex> lock(fMutex);
+  Int_t n = GetNpixels();
+  fEntries.assign(n, 0);
+  fSumW.assign(n, 0.);
+  fSumWT.assign(n, 0.);
+  fFirstTime.assign(n, std::numeric_limits<Double_t>::infinity());
+}
+
+//_____________________________________________________________________________
+void ACameraMap::ResizeAccumulators() {
+  std::lock_guard<std::mutex> lock(fMutex);
+  Int_t n = GetNpixels();
+  fEntries.resize(n, 0);
+  fSumW.resize(n, 0.);
+  fSumWT.resize(n, 0.);
+  fFirstTime.resize(n, std::numeric_limits<Double_t>::infinity());
+}
+
+//_____________________________________________________________________________
+void ACameraMap::SetHexagonalLattice(Double_t pitch, Int_t nrings,
+                                     Double_t size) {
+  // Make 1 + 3 * nrings * (nrings + 1) hexagonal pixels whose centers are
+  // pitch apart. The sensitive area of each pixel is a hexagon of the flat-to-
+  // flat size (pitch if size is 0), and the gaps between them are dead.
+  if (pitch <= 0 or nrings < 0) {
+    Error("SetHexagonalLattice", "Invalid parameters: %g, %d", pitch, nrings);
+    return;
+  }
+  Init(kHexagonal, pitch, size);
+  fNrings = nrings;
+
+  Int_t n = nrings;
+  fHexIndex.assign((2 * n + 1) * (2 * n + 1), -1);
+  Double_t r = pitch / TMath::Sqrt(3.);  // circumradius
+  auto add = [this, n, r](Int_t q, Int_t s) {
+    fHexIndex[(q + n) * (2 * n + 1) + s + n] = GetNpixels();
+    fCenterX.push_back(r * 1.5 * q);
+    fCenterY.push_back(r * TMath::Sqrt(3.) * (s + q / 2.));
+  };
+  add(0, 0);
+  for (Int_t k = 1; k <= n; k++) {
+    Int_t q = kHexDirection[4][0] * k, s = kHexDirection[4][1] * k;
+    for (Int_t i = 0; i < 6; i++) {
+      for (Int_t j = 0; j < k; j++) {
+        add(q, s);
+        q += kHexDirection[i][0];
+        s += kHexDirection[i][1];
+      }
+    }
+  }
+
+  Reset();
+}
+
+//_____________________________________________________________________________
+void ACameraMap::SetSquareLattice(Double_t pitch, Int_t nx, Int_t ny,
+                                  Double_t size) {
+  // Make nx * ny square pixels whose centers are pitch apart and centered at
+  // the origin. The sensitive area of each pixel is a square of side size
+  // (pitch if size is 0), and the gaps between them are dead.
+  if (pitch <= 0 or nx < 1 or ny < 1) {
+    Error("SetSquareLattice", "Invalid parameters: %g, %d, %d", pitch, nx, ny);
+    return;
+  }
+  Init(kSquare, pitch, size);
+  fNx = nx;
+  fNy = ny;
+  for (Int_t iy = 0; iy < ny; iy++) {
+    for (Int_t ix = 0; ix < nx; ix++) {
+      fCenterX.push_back((ix + 0.5 - nx / 2.) * pitch);
+      fCenterY.push_back((iy + 0.5 - ny / 2.) * pitch);
+    }
+  }
+
+  Reset();
+}
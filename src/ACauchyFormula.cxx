@@ -41,6 +41,19 @@ Double_t ACauchyFormula::GetRefractiveIndex(Double_t lambda) const {
   // Calculate the refractive index at wavelength = lambda (m)
   // Use AOpticsManager::m() to get the unit length in (m)
   lambda /= AOpticsManager::um();  // Convert (m) to (um)
-  return fPar[0] + fPar[1] * TMath::Power(lambda, -2) +
-         fPar[2] * TMath::Power(lambda, -4);
+  Double_t y = 1. / (lambda * lambda);
+  return fPar[0] + y * (fPar[1] + y * fPar[2]);
+}
+
+//_____________________________________________________________________________
+void ACauchyFormula::GetRefractiveIndex(const Double_t* lambda, Double_t* n,
+                                        std::size_t count) const {
+  // Calculate the refractive indices at count wavelengths
+  const Double_t um = AOpticsManager::um();
+  const Double_t A = fPar[0], B = fPar[1], C = fPar[2];
+  for (std::size_t i = 0; i < count; i++) {
+    Double_t l = lambda[i] / um;
+    Double_t y = 1. / (l * l);
+    n[i] = A + y * (B + y * C);
+  }
 }
@@ -0,0 +1,434 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ACorsikaIACTDriver
+//
+// Driver to share the ray tracing of CORSIKA IACT files among many processes,
+// typically the tasks of a batch job or of mpirun. Each pair of (event,
+// telescope) in the input files is a work unit, and the units are assigned to
+// the ranks in a round-robin manner, so that no communication is needed
+// between the processes. Each rank builds its geometry once, traces only its
+// own units and writes the focused photons to its own file, which are then
+// merged into one output.
+//
+//   // in each process
+//   ACorsikaIACTDriver driver(manager, 30 * m);
+//   driver.AddFile("run000001.corsika.gz");
+//   driver.AddFile("run000002.corsika.gz");
+//   driver.SetRankFromEnvironment();  // or SetRank(rank, nranks)
+//   driver.Run("output.root");        // writes output.rank<N>.root
+//
+//   // after all the processes finished
+//   ACorsikaIACTDriver::Merge("output.root", nranks);
+//
+// The output tree "photons" has one entry per focused photon with the
+// branches event, telescope, x, y, z, t (ns), dx, dy, dz and lambda (nm).
+// The positions are in the telescope frame in units of AOpticsManager::cm().
+//
+// With SetBunchTracing(kTRUE), each photon bunch is traced once as a
+// weighted ray (see ACorsikaIACTFile::GetRayArray), and a focused bunch is
+// written as many times as the number of photons sampled from its weight.
+//
+// The telescopes of an event are traced together in one pass over the worker
+// threads of AOpticsManager (see TraceEvent), which keeps the threads busy
+// even when each telescope receives only a few photons. Telescopes of
+// different designs can be given their own geometries by SetManager.
+// Telescopes sharing a geometry are traced concurrently, while different
+// geometries are traced in turn. AOpticsManager::TraceBatch could trace them
+// at once, but it gives the same random number streams to all the arrays,
+// which would correlate the telescopes, and the weighted tracing of bunches
+// is switched per manager.
+//
+// Long runs on preemptible nodes can be checkpointed. With
+// SetCheckpointInterval, the photons written so far, the position in the
+// input files, the states of the random number streams and the histograms
+// given by AddAccumulator (e.g. those of AFocalPlaneMonitor) are saved as an
+// ATraceCheckpoint in the rank file after the first event finished in each
+// interval. A killed job then continues from the last checkpoint.
+//
+//   driver.SetCheckpointInterval(600);  // every 10 minutes
+//   driver.Run("output.root", kTRUE);   // resume if a checkpoint exists
+//
+// The photons written after the last checkpoint are discarded on restart and
+// traced again with the same random numbers if AOpticsManager::SetRandomSeed
+// is used. The checkpoint is removed when the run is complete.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdlib>
+#include <memory>
+
+#include "TFile.h"
+#include "TFileMerger.h"
+#include "TStopwatch.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+#include "ACorsikaIACTDriver.h"
+#include "ACorsikaIACTFile.h"
+#include "AOpticsManager.h"
+#include "ARaySink.h"
+#include "ATraceCheckpoint.h"
+
+ClassImp(ACorsikaIACTDriver);
+
+//_____________________________________________________________________________
+ACorsikaIACTDriver::ACorsikaIACTDriver(AOpticsManager* manager,
+                                       Double_t zoffset,
+                                       Double_t refractiveIndex)
+    : fManager(manager),
+      fZOffset(zoffset),
+      fRefractiveIndex(refractiveIndex),
+      fArrayNumber(0),
+      fRank(0),
+      fNranks(1),
+      fBunchTracing(kFALSE),
+      fCheckpointInterval(-1) {}
+
+//_____________________________________________________________________________
+ACorsikaIACTDriver::~ACorsikaIACTDriver() {}
+
+//_____________________________________________________________________________
+AOpticsManager* ACorsikaIACTDriver::GetManager(Int_t telNo) const {
+  // Return the geometry of a telescope given by SetManager, or the shared one
+  // given to the constructor by default
+  std::map<Int_t, AOpticsManager*>::const_iterator it = fManagers.find(telNo);
+
+  return it != fManagers.end() ? it->second : fManager;
+}
+
+//_____________________________________________________________________________
+TString ACorsikaIACTDriver::GetRankFileName(const char* output, Int_t rank) {
+  // Return the name of the file written by a rank, e.g. "out.rank3.root" for
+  // "out.root"
+  TString name(output);
+  if (name.EndsWith(".root")) name.Remove(name.Length() - 5);
+
+  return TString::Format("%s.rank%d.root", name.Data(), rank);
+}
+
+//_____________________________________________________________________________
+Bool_t ACorsikaIACTDriver::Merge(const char* output, Int_t nranks,
+                                 Bool_t removeInputs) {
+  // Merge the files written by ranks 0 to nranks - 1 into output. The rank
+  // files are deleted after the merge if removeInputs is kTRUE.
+  TFileMerger merger(kFALSE);
+  merger.SetNotrees(kFALSE);
+  if (not merger.OutputFile(output, "RECREATE")) {
+    ::Error("ACorsikaIACTDriver::Merge", "Cannot create %s", output);
+    return kFALSE;
+  }
+
+  for (Int_t i = 0; i < nranks; i++) {
+    TString name = GetRankFileName(output, i);
+    if (not merger.AddFile(name, kFALSE)) {
+      ::Error("ACorsikaIACTDriver::Merge", "Cannot open %s", name.Data());
+      return kFALSE;
+    }
+  }
+
+  if (not merger.Merge()) {
+    ::Error("ACorsikaIACTDriver::Merge", "Failed to merge into %s", output);
+    return kFALSE;
+  }
+
+  if (removeInputs) {
+    for (Int_t i = 0; i < nranks; i++) {
+      gSystem->Unlink(GetRankFileName(output, i));
+    }
+  }
+
+  return kTRUE;
+}
+
+//_____________________________________________________________________________
+Long64_t ACorsikaIACTDriver::Run(const char* output, Bool_t resume,
+                                 Int_t maxEvents) {
+  // Trace the work units assigned to this rank and write the focused photons
+  // to GetRankFileName(output, rank). Every rank reads all the input files
+  // because CORSIKA IACT files can only be read sequentially, but the photon
+  // bunches of only its own units are traced. Returns the number of traced
+  // units including those before the checkpoint, or -1 on failure.
+  //
+  // If resume is kTRUE and the rank file has a checkpoint, the run continues
+  // from it (see the class description). Otherwise the rank file is
+  // recreated. Tracing stops after maxEvents events (all events if < 0),
+  // leaving a checkpoint from which a later call can resume.
+  if (!fManager and fManagers.empty()) {
+    Error("Run", "No AOpticsManager is given");
+    return -1;
+  }
+
+  TString name = GetRankFileName(output, fRank);
+  TString backup = name + ".old";
+  std::unique_ptr<TFile> previous;
+  std::unique_ptr<ATraceCheckpoint> checkpoint;
+  if (resume) {
+    // The backup is left by a restart interrupted before its first checkpoint
+    // (AccessPathName returns kTRUE if the file does NOT exist)
+    if (gSystem->AccessPathName(backup) and not gSystem->AccessPathName(name) and
+        gSystem->Rename(name, backup) != 0) {
+      Error("Run", "Cannot rename %s to %s", name.Data(), backup.Data());
+      return -1;
+    }
+    if (not gSystem->AccessPathName(backup)) {
+      previous.reset(TFile::Open(backup));
+      if (previous and not previous->IsZombie()) {
+        checkpoint.reset(
+            dynamic_cast<ATraceCheckpoint*>(previous->Get("checkpoint")));
+      }
+    }
+    if (!checkpoint) {
+      Warning("Run", "No checkpoint is found for %s. Starting from scratch.",
+              name.Data());
+    }
+  }
+
+  TFile file(name, "RECREATE");
+  if (file.IsZombie()) {
+    Error("Run", "Cannot create %s", name.Data());
+    return -1;
+  }
+
+  Int_t event, telescope;
+  Double_t x, y, z, t, dx, dy, dz, lambda;
+  const char* kNames[] = {"x", "y", "z", "t", "dx", "dy", "dz", "lambda"};
+  Double_t* values[] = {&x, &y, &z, &t, &dx, &dy, &dz, &lambda};
+  TTree* tree = 0;
+  if (checkpoint) {
+    // Copy the entries written before the checkpoint. The entries after it
+    // will be written again.
+    TTree* old = dynamic_cast<TTree*>(previous->Get("photons"));
+    if (!old or old->GetEntries() < checkpoint->GetEntries()) {
+      Error("Run", "The checkpoint does not match the photons in %s",
+            backup.Data());
+      return -1;
+    }
+    file.cd();
+    tree = old->CloneTree(checkpoint->GetEntries());
+    tree->SetBranchAddress("event", &event);
+    tree->SetBranchAddress("telescope", &telescope);
+    for (Int_t i = 0; i < 8; i++) tree->SetBranchAddress(kNames[i], values[i]);
+  } else {
+    tree = new TTree("photons", "Focused photons");
+    tree->Branch("event", &event, "event/I");
+    tree->Branch("telescope", &telescope, "telescope/I");
+    for (Int_t i = 0; i < 8; i++) {
+      tree->Branch(kNames[i], values[i], TString(kNames[i]) + "/D");
+    }
+  }
+
+  // Sinks are called in this thread after the tracing of each event
+  auto fill = [&](Int_t telNo, const ARay& ray) {
+    if (not ray.IsFocused()) return;
+    Double_t p[4], d[3];
+    ray.GetLastPoint(p);
+    ray.GetDirection(d);
+    telescope = telNo;
+    x = p[0];
+    y = p[1];
+    z = p[2];
+    t = p[3] / AOpticsManager::ns();
+    dx = d[0];
+    dy = d[1];
+    dz = d[2];
+    lambda = ray.GetLambda() / AOpticsManager::nm();
+    Int_t n = fBunchTracing
+                  ? ACorsikaIACTFile::SamplePhotonCount(ray.GetWeight())
+                  : 1;
+    for (Int_t l = 0; l < n; l++) tree->Fill();
+  };
+
+  Long64_t ntraced = 0;
+  ULong64_t unit = 0;  // serial number of (event, telescope) over all files
+  std::size_t firstFile = 0;
+  Int_t firstEvent = 1;
+
+  if (checkpoint) {
+    firstFile = checkpoint->GetFile();
+    firstEvent = checkpoint->GetEvent() + 1;
+    unit = checkpoint->GetUnit();
+    ntraced = checkpoint->GetNtraced();
+    if (fManager) checkpoint->RestoreRandom(-1, *fManager);
+    for (auto it = fManagers.begin(); it != fManagers.end(); ++it) {
+      checkpoint->RestoreRandom(it->first, *it->second);
+    }
+    checkpoint->RestoreGlobalRandom();
+    for (std::size_t i = 0; i < fAccumulators.size(); i++) {
+      if (not checkpoint->RestoreAccumulator(*fAccumulators[i])) {
+        Warning("Run", "%s is not found in the checkpoint",
+                fAccumulators[i]->GetName());
+      }
+    }
+  }
+
+  // Write the tree first, so that the entries on disk are never fewer than
+  // those recorded in the checkpoint
+  auto save = [&](std::size_t fileIndex, Int_t lastEvent) {
+    tree->AutoSave("SaveSelf");
+    ATraceCheckpoint current;
+    current.SetPosition(fileIndex, lastEvent, unit);
+    current.SetNtraced(ntraced);
+    current.SetEntries(tree->GetEntries());
+    if (fManager) current.SaveRandom(-1, *fManager);
+    for (auto it = fManagers.begin(); it != fManagers.end(); ++it) {
+      current.SaveRandom(it->first, *it->second);
+    }
+    current.SaveGlobalRandom();
+    for (std::size_t i = 0; i < fAccumulators.size(); i++) {
+      current.AddAccumulator(*fAccumulators[i]);
+    }
+    file.WriteTObject(&current, "checkpoint", "WriteDelete");
+    file.SaveSelf(kTRUE);
+    file.Flush();
+  };
+
+  if (previous) {
+    // The copied entries are safe once the first checkpoint is written
+    save(firstFile, firstEvent - 1);
+    previous.reset();
+    gSystem->Unlink(backup);
+  }
+
+  TStopwatch watch;
+  Int_t nevents = 0;  // events read in this call
+  Bool_t stopped = kFALSE;
+
+  for (std::size_t i = firstFile; i < fFiles.size() and not stopped; i++) {
+    ACorsikaIACTFile corsika;
+    corsika.SetRayPoolBlockSize(4096);  // arrays are deleted soon
+    corsika.SetReadAhead(2);  // decode the next events during the tracing
+    corsika.Open(fFiles[i].c_str());
+    if (not corsika.IsOpen()) {
+      Error("Run", "Cannot open %s", fFiles[i].c_str());
+      return -1;
+    }
+
+    std::vector<Int_t> telescopes = fTelescopes;
+    if (telescopes.empty()) {
+      for (Int_t j = 0; j < corsika.GetNumberOfTelescopes(); j++) {
+        telescopes.push_back(j);
+      }
+    }
+    ULong64_t ntel = telescopes.size();
+
+    std::vector<std::unique_ptr<ARaySink>> sinks;
+    for (ULong64_t j = 0; j < ntel; j++) {
+      Int_t telNo = telescopes[j];
+      sinks.emplace_back(new ARayFunctionSink(
+          [&fill, telNo](const ARay& ray) { fill(telNo, ray); }));
+    }
+
+    for (event = (i == firstFile) ? firstEvent : 1; ntel > 0; event++) {
+      if (maxEvents >= 0 and nevents >= maxEvents) {
+        save(i, event - 1);
+        stopped = kTRUE;
+        break;
+      }
+      if (corsika.ReadEvent(event) != event) break;
+
+      std::map<Int_t, ARaySink*> assigned;
+      for (ULong64_t j = 0; j < ntel; j++) {
+        if (IsAssigned(unit + j)) assigned[telescopes[j]] = sinks[j].get();
+      }
+      ntraced += TraceEvent(corsika, assigned);
+
+      unit += ntel;
+      nevents++;
+
+      if (fCheckpointInterval >= 0 and
+          watch.RealTime() >= fCheckpointInterval) {
+        save(i, event);
+        watch.Start(kTRUE);
+      } else {
+        watch.Continue();  // RealTime stops the watch
+      }
+    }
+  }
+
+  file.cd();
+  tree->Write();
+  if (not stopped) file.Delete("checkpoint;*");  // the run is complete
+  file.Close();
+
+  return ntraced;
+}
+
+//_____________________________________________________________________________
+void ACorsikaIACTDriver::SetRank(Int_t rank, Int_t nranks) {
+  if (nranks < 1 or rank < 0 or rank >= nranks) {
+    Error("SetRank", "Invalid rank %d of %d", rank, nranks);
+    return;
+  }
+  fRank = rank;
+  fNranks = nranks;
+}
+
+//_____________________________________________________________________________
+Bool_t ACorsikaIACTDriver::SetRankFromEnvironment() {
+  // Read the rank and the number of processes set by mpirun (Open MPI, MPICH
+  // and Intel MPI) or by Slurm. Returns kFALSE if none of them is found.
+  const char* kVariables[][2] = {
+      {"OMPI_COMM_WORLD_RANK", "OMPI_COMM_WORLD_SIZE"},
+      {"PMI_RANK", "PMI_SIZE"},
+      {"SLURM_PROCID", "SLURM_NTASKS"}};
+
+  for (Int_t i = 0; i < 3; i++) {
+    const char* rank = gSystem->Getenv(kVariables[i][0]);
+    const char* size = gSystem->Getenv(kVariables[i][1]);
+    if (rank and size) {
+      SetRank(atoi(rank), atoi(size));
+      return kTRUE;
+    }
+  }
+
+  return kFALSE;
+}
+
+//_____________________________________________________________________________
+Int_t ACorsikaIACTDriver::TraceEvent(ACorsikaIACTFile& corsika,
+                                     const std::map<Int_t, ARaySink*>& sinks) {
+  // Trace the photons of the current event of corsika for the telescopes
+  // given as the keys of sinks. The finished rays of each telescope are given
+  // to its sink. All the telescopes sharing a geometry are traced in one call
+  // of AOpticsManager::TraceNonSequential, so that their rays are distributed
+  // over the worker threads together. Returns the number of traced
+  // telescopes.
+  std::map<AOpticsManager*, std::vector<ARayArray*>> groups;
+  Int_t ntraced = 0;
+  for (std::map<Int_t, ARaySink*>::const_iterator it = sinks.begin();
+       it != sinks.end(); ++it) {
+    AOpticsManager* manager = GetManager(it->first);
+    if (!manager) {
+      Error("TraceEvent", "No AOpticsManager is given for telescope %d",
+            it->first);
+      continue;
+    }
+    ARayArray* array = corsika.GetRayArray(it->first, fArrayNumber, fZOffset,
+                                           fRefractiveIndex, fBunchTracing);
+    if (!array) continue;
+    array->SetSink(it->second);
+    groups[manager].push_back(array);
+    ntraced++;
+  }
+
+  for (std::map<AOpticsManager*, std::vector<ARayArray*>>::iterator it =
+           groups.begin();
+       it != groups.end(); ++it) {
+    AOpticsManager* manager = it->first;
+    Bool_t weighted = manager->IsWeightedTracing();
+    if (fBunchTracing) manager->EnableWeightedTracing(kTRUE);
+    manager->TraceNonSequential(it->second);
+    manager->EnableWeightedTracing(weighted);
+
+    for (std::size_t i = 0; i < it->second.size(); i++) {
+      delete it->second[i];
+    }
+  }
+
+  return ntraced;
+}
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <utility>
+
 #include "TDirectory.h"
 #include "TRandom.h"
 #include "TSystem.h"
@@ -10,11 +13,45 @@ ClassImp(ACorsikaIACTFile);
 const Int_t ACorsikaIACTFile::kMaxArrays = 100;
 const Int_t ACorsikaIACTFile::kMaxTelescopes = 1000;
 
+//_____________________________________________________________________________
+ACorsikaIACTFile::EventData::EventData()
+    : fHeader(0),
+      fMaxWavelength(0),
+      fMinWavelength(0),
+      fBunchData(0),
+      fBunchDataSize(0),
+      fBunchDataCapacity(0) {}
+
+//_____________________________________________________________________________
+ACorsikaIACTFile::EventData::~EventData() {
+  SafeDelete(fHeader);
+  free(fBunchData);
+}
+
+//_____________________________________________________________________________
+void ACorsikaIACTFile::EventData::Clear() {
+  // Forget the event. The bunch buffer is kept for the next event.
+  SafeDelete(fHeader);
+  fBunchDataSize = 0;
+  fBunchIndex.clear();
+}
+
+//_____________________________________________________________________________
 ACorsikaIACTFile::ACorsikaIACTFile(Int_t bufferLength)
-    : fBunches(0), fEventHeader(0), fRunHeader(0) {
+    : fBunches(0), fRunHeader(0) {
   fIOBuffer = allocate_io_buffer(0);
   fIOBuffer->max_length = bufferLength;
-  fMaxPhotonBunches = 100000;
+  fMaxBufferLength = 0;
+  fBufferHighWaterMark = 0;
+  fBunchHighWaterMark = 0;
+  fMaxPhotonBunches = 0;
+  fRayPoolBlockSize = 0;
+  fBlockCount = 0;
+  fEvent = new EventData;
+  fReadAhead = 0;
+  fStopReader = kFALSE;
+  fReaderDone = kFALSE;
+  fReaderEOF = kFALSE;
   for (Int_t i = 0; i < 4; i++) {
     fTelescopePosition[i] = new Double_t[kMaxTelescopes];
   }
@@ -25,19 +62,97 @@ ACorsikaIACTFile::ACorsikaIACTFile(Int_t bufferLength)
 //_____________________________________________________________________________
 ACorsikaIACTFile::~ACorsikaIACTFile() {
   Close();
+  StopReadAhead(kTRUE);
   for (Int_t i = 0; i < 4; i++) {
     delete[] fTelescopePosition[i];
     fTelescopePosition[i] = 0;
   }
+  for (auto event : fFreeEvents) {
+    delete event;
+  }
+  SafeDelete(fBunches);
+  delete fEvent;
   free_io_buffer(fIOBuffer);
 }
 
+//_____________________________________________________________________________
+Bool_t ACorsikaIACTFile::BuildEventIndex(Bool_t save) {
+  // Scan the whole file for the event headers and record their positions.
+  // Only the event headers are decoded, the other blocks are skipped. The
+  // file is read through a second I/O buffer, so the current event is kept.
+  // The index is written to the sidecar file if save is kTRUE.
+  if (not IsOpen()) {
+    fprintf(stderr, "File is not open.\n");
+    return kFALSE;
+  }
+
+  IO_BUFFER* iobuf = allocate_io_buffer(0);
+  if (iobuf == 0) {
+    return kFALSE;
+  }
+  iobuf->max_length = fIOBuffer->max_length;
+
+  TString path = fFileName;
+  gSystem->ExpandPathName(path);
+  if ((iobuf->input_file = fileopen(path, "r")) == 0) {
+    fprintf(stderr, "Cannot open the file.\n");
+    free_io_buffer(iobuf);
+    return kFALSE;
+  }
+
+  std::vector<EventPosition> index;
+  IO_ITEM_HEADER header;
+  for (Long64_t block = 0;; block++) {
+    // -1 if the file is read through a pipe (e.g. gzip)
+    Long64_t offset = ftello(iobuf->input_file);
+    if (find_io_block(iobuf, &header) != 0) {
+      break;
+    }
+    if (header.type == IO_TYPE_MC_EVTH) {
+      if (read_io_block(iobuf, &header) != 0) {
+        break;
+      }
+      Float_t evth[273];
+      read_tel_block(iobuf, IO_TYPE_MC_EVTH, evth, 273);
+      EventPosition position = {Int_t(evth[1]), block, offset};
+      index.push_back(position);
+    } else if (skip_io_block(iobuf, &header) != 0) {
+      break;
+    }
+  }
+
+  fileclose(iobuf->input_file);
+  iobuf->input_file = 0;
+  free_io_buffer(iobuf);
+
+  std::stable_sort(index.begin(), index.end(),
+                   [](const EventPosition& a, const EventPosition& b) {
+                     return a.fNumber < b.fNumber;
+                   });
+  fEventIndex.swap(index);
+
+  if (save) {
+    SaveEventIndex();
+  }
+
+  return kTRUE;
+}
+
+//_____________________________________________________________________________
+void ACorsikaIACTFile::ClearBunches() {
+  // Forget the current event. The buffer is kept for the next event.
+  SafeDelete(fBunches);
+  fEvent->Clear();
+}
+
 //_____________________________________________________________________________
 void ACorsikaIACTFile::Close() {
   if (not IsOpen()) {
     return;
   }
 
+  StopReadAhead(kTRUE);
+
   // Reset all variables
   fclose(fIOBuffer->input_file);
   fIOBuffer->input_file = 0;
@@ -60,20 +175,349 @@ void ACorsikaIACTFile::Close() {
     }
   }
 
-  SafeDelete(fBunches);
-  SafeDelete(fEventHeader);
+  ClearBunches();
   SafeDelete(fRunHeader);
+  fEventIndex.clear();
+  fBlockCount = 0;
 
   fFileName = "";
 }
 
+#define SET_FLAG(flag, key) \
+  (flag |= (ULong64_t(0x1) << (key - IO_TYPE_MC_BASE)))
+#define HAS_FLAG(flag, key) \
+  Bool_t(flag&(ULong64_t(0x1) << (key - IO_TYPE_MC_BASE)))
+
+//_____________________________________________________________________________
+Int_t ACorsikaIACTFile::DecodeEvent(Int_t num, EventData& event, Bool_t& eof) {
+  // Read the blocks of event num (or of the next event if num <= 0) into
+  // event. Returns the event number, or -1 if it is not found. eof is set if
+  // the end of the file is reached.
+  eof = kFALSE;
+  ULong64_t flag = 0x0;  // flag indicating what blocks we have read
+
+  while (1) {
+    Int_t numberOfArrays;          // ICERML of CSCAT option
+    Double_t timeOffset;           // Time offset from the first interaction
+    Double_t xOffset[kMaxArrays];  // X offset of core locations from (0, 0)
+    Double_t yOffset[kMaxArrays];  // Y offset of core locations from (0, 0)
+
+    Int_t telNo, arrayNo;
+    Double_t totalPhotons;
+
+    Int_t headerType = ReadNextBlock();
+    if (headerType == -1) {
+      eof = kTRUE;
+      break;
+    }
+    switch (headerType) {
+      case IO_TYPE_MC_EVTH:
+        // fprintf(stderr, "IO_TYPE_MC_EVTH\n");
+        flag = 0x0;  // initialize when we read the event header
+        Float_t evth[273];
+        read_tel_block(fIOBuffer, IO_TYPE_MC_EVTH, evth, 273);
+        // Data blocks were OK, but event number != num. So skip.
+        if (num > 0 and evth[1] != num) {
+          break;
+        }
+
+        event.Clear();
+        event.fMaxWavelength = evth[96];
+        event.fMinWavelength = evth[95];
+        event.fHeader = new ACorsikaIACTEventHeader(evth);
+        SET_FLAG(flag, IO_TYPE_MC_EVTH);
+
+        break;
+
+      case IO_TYPE_MC_TELOFF:
+        // fprintf(stderr, "IO_TYPE_MC_TELOFF\n");
+        if (HAS_FLAG(flag, IO_TYPE_MC_EVTH)) {
+          read_tel_offset(fIOBuffer, kMaxArrays, &numberOfArrays, &timeOffset,
+                          xOffset, yOffset);
+          if (event.fHeader) {
+            event.fHeader->SetMultipleUseHeader(numberOfArrays, timeOffset,
+                                               xOffset, yOffset);
+          }
+          SET_FLAG(flag, IO_TYPE_MC_TELOFF);
+        }
+        break;
+
+      case IO_TYPE_MC_EXTRA_PARAM:
+        // fprintf(stderr, "IO_TYPE_MC_EXTRA_PARAM\n");
+        // not implemented yet
+        break;
+
+      case IO_TYPE_MC_LONGI:
+        // fprintf(stderr, "IO_TYPE_MC_LONGI\n");
+        // not implemented yet
+        break;
+
+      case IO_TYPE_MC_TELARRAY:
+      case IO_TYPE_MC_TELARRAY_HEAD: {
+        // IO_TYPE_MC_TELARRAY will appear ICERML times in an event
+        if (headerType == IO_TYPE_MC_TELARRAY) {
+          // fprintf(stderr, "IO_TYPE_MC_TELARRAY\n");
+        } else {
+          // fprintf(stderr, "IO_TYPE_MC_TELARRAY_HEAD\n");
+        }
+        if (not(HAS_FLAG(flag, IO_TYPE_MC_EVTH) and
+                HAS_FLAG(flag, IO_TYPE_MC_TELOFF))) {
+          break;
+        }
+
+        Int_t instanceNumberOfArrays;
+        IO_ITEM_HEADER itemHeader;
+
+        Bool_t telIndividual;
+        if (headerType == IO_TYPE_MC_TELARRAY) {
+          telIndividual = false;
+          begin_read_tel_array(fIOBuffer, &itemHeader, &instanceNumberOfArrays);
+          SET_FLAG(flag, IO_TYPE_MC_TELARRAY);
+        } else {
+          telIndividual = true;
+          read_tel_array_head(fIOBuffer, &itemHeader, &instanceNumberOfArrays);
+          SET_FLAG(flag, IO_TYPE_MC_TELARRAY_HEAD);
+        }
+
+        for (Int_t i = 0; i < fNumberOfTelescopes; i++) {
+          if (not telIndividual) {
+            IO_ITEM_HEADER subItemHeader;
+            subItemHeader.type = IO_TYPE_MC_PHOTONS;
+            if (search_sub_item(fIOBuffer, &itemHeader, &subItemHeader) < 0) {
+              break;
+            }
+          } else {
+            if (find_io_block(fIOBuffer, &fBlockHeader) != 0) {
+              break;
+            }
+            fBlockCount++;
+            FitIOBuffer();
+            if (read_io_block(fIOBuffer, &fBlockHeader) != 0) {
+              break;
+            }
+            if (fBlockHeader.type == IO_TYPE_MC_TELARRAY_END) {
+              telIndividual = false;
+              break;
+            }
+            if (fBlockHeader.type != IO_TYPE_MC_PHOTONS) {
+              telIndividual = false;
+              break;
+            }
+          }
+
+          // Ask the number of bunches first (read_tel_photons returns -10
+          // without bunches), then decode them at the end of the buffer of
+          // this event, which grows as needed and is kept for later events
+          Int_t nbunches;
+          if (read_tel_photons(fIOBuffer, 0, &arrayNo, &telNo, &totalPhotons,
+                               0, &nbunches) != -10) {
+            continue;
+          }
+          Int_t maxBunches = fMaxPhotonBunches > 0
+                                 ? std::min(nbunches, fMaxPhotonBunches)
+                                 : nbunches;
+          Long64_t size = event.fBunchDataSize;
+          if (size + maxBunches > event.fBunchDataCapacity) {
+            Long64_t capacity =
+                std::max(2 * event.fBunchDataCapacity, size + maxBunches);
+            struct bunch* data = (struct bunch*)realloc(
+                event.fBunchData, capacity * sizeof(struct bunch));
+            if (data == 0) {
+              // fprintf(stderr, "Error in allocating memory for photon bunch
+              // array.\n");
+              return -1;
+            }
+            event.fBunchData = data;
+            event.fBunchDataCapacity = capacity;
+          }
+
+          if (read_tel_photons(fIOBuffer, maxBunches, &arrayNo, &telNo,
+                               &totalPhotons, event.fBunchData + size,
+                               &nbunches) < 0) {
+            // fprintf(stderr,"Error reading %d photon bunches\n",nbunches);
+            continue;
+          }
+
+          if (arrayNo != instanceNumberOfArrays) {
+            // do nothing for now
+          }
+          if (i >= kMaxTelescopes or telNo < 0) {
+            // fprintf(stderr, "Cannot process data for telescope #%d because
+            // only %d are configured.\n", i + 1, kMaxTelescopes);
+            continue;
+          }
+
+          if (nbunches > 0) {
+            event.fBunchIndex[std::make_pair(arrayNo, telNo)].push_back(
+                std::make_pair(event.fBunchDataSize, Long64_t(nbunches)));
+            event.fBunchDataSize += nbunches;
+          }
+        }
+
+        if (fBlockHeader.type == IO_TYPE_MC_TELARRAY) {
+          end_read_tel_array(fIOBuffer, &itemHeader);
+        }
+
+        break;
+      }
+      case IO_TYPE_MC_EVTE:
+        SET_FLAG(flag, IO_TYPE_MC_EVTE);
+        // fprintf(stderr, "IO_TYPE_MC_EVTE\n");
+        break;
+
+      case IO_TYPE_MC_RUNE:
+        SET_FLAG(flag, IO_TYPE_MC_RUNE);
+        // fprintf(stderr, "IO_TYPE_MC_RUNE\n");
+        break;
+
+      default:
+        fprintf(stderr, "Unknown type\n");
+        break;
+    }
+
+    if (HAS_FLAG(flag, IO_TYPE_MC_EVTH) and
+        HAS_FLAG(flag, IO_TYPE_MC_TELOFF) and
+        (HAS_FLAG(flag, IO_TYPE_MC_TELARRAY) or
+         HAS_FLAG(flag, IO_TYPE_MC_TELARRAY_HEAD)) and
+        HAS_FLAG(flag, IO_TYPE_MC_EVTE)) {
+      if (event.fBunchDataSize > fBunchHighWaterMark) {
+        fBunchHighWaterMark = event.fBunchDataSize;
+      }
+      return event.fHeader->GetEventNumber();
+    }
+  }
+
+  return -1;
+}
+
+//_____________________________________________________________________________
+void ACorsikaIACTFile::FitIOBuffer() {
+  // Raise the size limit of the I/O buffer for the block just found, so that
+  // eventio extends the buffer instead of skipping the block. The margin
+  // covers the rounding of the increments in extend_io_buffer.
+  Long64_t length = fIOBuffer->item_length[0] + 20;
+  Long64_t limit = length + fIOBuffer->buflen / 8 + 1048576;
+  if (length > fIOBuffer->max_length and
+      (fMaxBufferLength <= 0 or limit <= fMaxBufferLength)) {
+    fIOBuffer->max_length = limit;
+  }
+  if (length > fBufferHighWaterMark) {
+    fBufferHighWaterMark = length;
+  }
+}
+
+//_____________________________________________________________________________
+TTree* ACorsikaIACTFile::GetBunches() const {
+  // Return the photon bunches of the current event as a TTree. It is made
+  // from the decoded bunches at the first call after ReadEvent, grouped by
+  // (array, telescope). GetBunchSpans gives the same data without copying.
+  if (fBunches or not fEvent->fHeader) {
+    return fBunches;
+  }
+
+  Int_t telNo, arrayNo;
+  Float_t x, y, zem, time, cx, cy, cz, lambda, photons;
+  fBunches = new TTree("tree", "Photon tree of CORSIKA IACT output.");
+
+  fBunches->Branch("telNo", &telNo, "telNo/I");
+  fBunches->Branch("arrayNo", &arrayNo, "arrayNo/I");
+  fBunches->Branch("x", &x, "x/F");
+  fBunches->Branch("y", &y, "y/F");
+  fBunches->Branch("zem", &zem, "zem/F");
+  fBunches->Branch("time", &time, "time/F");
+  fBunches->Branch("cx", &cx, "cx/F");
+  fBunches->Branch("cy", &cy, "cy/F");
+  fBunches->Branch("cz", &cz, "cz/F");
+  fBunches->Branch("lambda", &lambda, "lambda/F");
+  fBunches->Branch("photons", &photons, "photons/F");
+
+  for (const auto& entry : fEvent->fBunchIndex) {
+    arrayNo = entry.first.first;
+    telNo = entry.first.second;
+    for (const auto& span : GetBunchSpans(telNo, arrayNo)) {
+      for (const struct bunch& b : span) {
+        x = b.x;
+        y = b.y;
+        zem = b.zem;
+        time = b.ctime;
+        cx = b.cx;
+        cy = b.cy;
+        cz = -1. * sqrt(1. - cx * cx - cy * cy);
+        lambda = b.lambda;
+        photons = b.photons;
+        fBunches->Fill();
+      }
+    }
+  }
+  fBunches->ResetBranchAddresses();
+
+  return fBunches;
+}
+
+//_____________________________________________________________________________
+std::vector<ACorsikaIACTFile::BunchSpan> ACorsikaIACTFile::GetBunchSpans(
+    Int_t telNo, Int_t arrayNo) const {
+  // Return views of the photon bunches of a telescope in the current event.
+  // They point into the decode buffer and are valid until the next call of
+  // ReadEvent or Close. Note that struct bunch has no cz; it is
+  // -sqrt(1 - cx^2 - cy^2).
+  std::vector<BunchSpan> spans;
+  auto it = fEvent->fBunchIndex.find(std::make_pair(arrayNo, telNo));
+  if (it == fEvent->fBunchIndex.end()) {
+    return spans;
+  }
+
+  for (const auto& range : it->second) {
+    BunchSpan span;
+    span.fBegin = fEvent->fBunchData + range.first;
+    span.fEnd = span.fBegin + range.second;
+    spans.push_back(span);
+  }
+
+  return spans;
+}
+
+//_____________________________________________________________________________
+TString ACorsikaIACTFile::GetIndexFileName() const {
+  TString path = fFileName;
+  gSystem->ExpandPathName(path);
+
+  return path + ".idx";
+}
+
+//_____________________________________________________________________________
+Long64_t ACorsikaIACTFile::GetNumberOfBunches(Int_t telNo,
+                                              Int_t arrayNo) const {
+  // Number of photon bunches of a telescope in the current event
+  auto it = fEvent->fBunchIndex.find(std::make_pair(arrayNo, telNo));
+  if (it == fEvent->fBunchIndex.end()) {
+    return 0;
+  }
+
+  Long64_t n = 0;
+  for (const auto& range : it->second) {
+    n += range.second;
+  }
+
+  return n;
+}
+
 //_____________________________________________________________________________
 ARayArray* ACorsikaIACTFile::GetRayArray(Int_t telNo, Int_t arrayNo, Double_t z,
-                                         Double_t refractiveIndex) {
+                                         Double_t refractiveIndex,
+                                         Bool_t bunched) {
   // z is the starting position of photons relative to the CORSIKA observation
-  // level
-
-  if (!fBunches) {
+  // level. The rays are allocated in blocks if SetRayPoolBlockSize has been
+  // called with a positive size (see ARayArray::EnablePool).
+  //
+  // If bunched is kTRUE, each bunch becomes one ray whose weight is the
+  // (fractional) number of photons in it, and the cost of the tracing scales
+  // with the number of bunches. The photons of a bunch share the position
+  // and the direction anyway. Only their wavelengths differ if CORSIKA did
+  // not determine them, and a bunch then has one randomized wavelength. This
+  // is exact for achromatic optics and unbiased on average otherwise.
+
+  if (not fEvent->fHeader) {
     return 0;
   }
 
@@ -83,49 +527,51 @@ ARayArray* ACorsikaIACTFile::GetRayArray(Int_t telNo, Int_t arrayNo, Double_t z,
   }
 
   ARayArray* array = new ARayArray;
-
-  Int_t telNo_, arrayNo_;
-  Float_t x, y, zem, time, cx, cy, cz, lambda, photons;
-  fBunches->SetBranchAddress("telNo", &telNo_);
-  fBunches->SetBranchAddress("arrayNo", &arrayNo_);
-  fBunches->SetBranchAddress("x", &x);
-  fBunches->SetBranchAddress("y", &y);
-  fBunches->SetBranchAddress("zem", &zem);
-  fBunches->SetBranchAddress("time", &time);
-  fBunches->SetBranchAddress("cx", &cx);
-  fBunches->SetBranchAddress("cy", &cy);
-  fBunches->SetBranchAddress("cz", &cz);
-  fBunches->SetBranchAddress("lambda", &lambda);
-  fBunches->SetBranchAddress("photons", &photons);
+  if (fRayPoolBlockSize > 0) array->EnablePool(fRayPoolBlockSize);
 
   Double_t m = AOpticsManager::m();
   Double_t cm = AOpticsManager::cm();
   Double_t nm = AOpticsManager::nm();
   Double_t ns = AOpticsManager::ns();
+  Double_t lambdaMin = fEvent->fMinWavelength;
+  Double_t lambdaMax = fEvent->fMaxWavelength;
+
+  for (const auto& span : GetBunchSpans(telNo, arrayNo)) {
+    for (const struct bunch& b : span) {
+      Float_t cx = b.cx;
+      Float_t cy = b.cy;
+      Float_t cz = -1. * sqrt(1. - cx * cx - cy * cy);
+      Float_t lambda = b.lambda;
+
+      Double_t airmass = -1. / cz;
+      Double_t tel_dist = (z - GetTelescopeZ(telNo) * cm) * airmass;
+      Double_t speed = TMath::C() * m / refractiveIndex;
+      Double_t px = b.x * cm - tel_dist * cx;
+      Double_t py = b.y * cm - tel_dist * cy;
+      Double_t pt = b.ctime * ns - tel_dist / speed;
+
+      if (bunched) {
+        Double_t random_lambda =
+            lambda == 0 ? 1. / (1. / lambdaMin -
+                                gRandom->Uniform() * (1. / lambdaMin -
+                                                      1. / lambdaMax))
+                        : lambda;
+        ARay* ray =
+            array->NewRay(0, random_lambda * nm, px, py, z, pt, cx, cy, cz);
+        ray->SetWeight(b.photons);
+        continue;
+      }
 
-  for (Int_t i = 0; i < fBunches->GetEntries(); i++) {
-    fBunches->GetEntry(i);
-    if (telNo != telNo_ or arrayNo != arrayNo_) {
-      continue;
-    }
-
-    Double_t airmass = -1. / cz;
-    Double_t tel_dist = (z - GetTelescopeZ(telNo) * cm) * airmass;
-    Double_t speed = TMath::C() * m / refractiveIndex;
-    Double_t px = x * cm - tel_dist * cx;
-    Double_t py = y * cm - tel_dist * cy;
-    Double_t pt = time * ns - tel_dist / speed;
-
-    for (Int_t j = 0; j < photons; j++) {
-      // if the wavelength is not determined in CORSIKA (i.e. lambda == 0), we
-      // randomize it now
-      Double_t random_lambda =
-          lambda == 0 ? 1. / (1. / fMinWavelength -
-                              gRandom->Uniform() * (1. / fMinWavelength -
-                                                    1. / fMaxPhotonBunches))
-                      : lambda;
-      ARay* ray = new ARay(0, random_lambda * nm, px, py, z, pt, cx, cy, cz);
-      array->Add(ray);
+      for (Int_t j = 0; j < b.photons; j++) {
+        // if the wavelength is not determined in CORSIKA (i.e. lambda == 0), we
+        // randomize it now
+        Double_t random_lambda =
+            lambda == 0 ? 1. / (1. / lambdaMin -
+                                gRandom->Uniform() * (1. / lambdaMin -
+                                                      1. / lambdaMax))
+                        : lambda;
+        array->NewRay(0, random_lambda * nm, px, py, z, pt, cx, cy, cz);
+      }
     }
   }
 
@@ -188,6 +634,46 @@ Bool_t ACorsikaIACTFile::IsOpen() {
   return kFALSE;
 }
 
+//_____________________________________________________________________________
+Bool_t ACorsikaIACTFile::LoadEventIndex() {
+  // Read the sidecar file written by BuildEventIndex. It is ignored if the
+  // size or the modification time of the data file has changed since then.
+  fEventIndex.clear();
+
+  TString path = fFileName;
+  gSystem->ExpandPathName(path);
+  FileStat_t st;
+  if (gSystem->GetPathInfo(path, st) != 0) {
+    return kFALSE;
+  }
+
+  FILE* file = fopen(GetIndexFileName(), "r");
+  if (file == 0) {
+    return kFALSE;
+  }
+
+  long long size, mtime, n;
+  Bool_t ok = fscanf(file, "# ROBAST CORSIKA event index %lld %lld %lld",
+                     &size, &mtime, &n) == 3 and
+              size == st.fSize and mtime == st.fMtime and n >= 0;
+
+  std::vector<EventPosition> index;
+  for (long long i = 0; ok and i < n; i++) {
+    Int_t number;
+    long long block, offset;
+    ok = fscanf(file, "%d %lld %lld", &number, &block, &offset) == 3;
+    EventPosition position = {number, block, offset};
+    index.push_back(position);
+  }
+  fclose(file);
+
+  if (ok) {
+    fEventIndex.swap(index);
+  }
+
+  return ok;
+}
+
 //_____________________________________________________________________________
 void ACorsikaIACTFile::Open(const Char_t* fname) {
   if (IsOpen()) {
@@ -248,6 +734,10 @@ void ACorsikaIACTFile::Open(const Char_t* fname) {
     Close();
     return;
   }
+
+  // Use the event index if BuildEventIndex was done before
+  LoadEventIndex();
+  StartReadAhead();
 }
 
 //_____________________________________________________________________________
@@ -264,10 +754,39 @@ void ACorsikaIACTFile::PrintInputCard() const {
   }
 }
 
-#define SET_FLAG(flag, key) \
-  (flag |= (ULong64_t(0x1) << (key - IO_TYPE_MC_BASE)))
-#define HAS_FLAG(flag, key) \
-  Bool_t(flag&(ULong64_t(0x1) << (key - IO_TYPE_MC_BASE)))
+//_____________________________________________________________________________
+void ACorsikaIACTFile::ReadAhead() {
+  // Body of the reader thread. Decode the next events into free buffers until
+  // the end of the file or StopReadAhead.
+  while (true) {
+    EventData* event;
+    {
+      std::unique_lock<std::mutex> lock(fQueueMutex);
+      fQueueCondition.wait(
+          lock, [this] { return fStopReader or not fFreeEvents.empty(); });
+      if (fStopReader) {
+        return;
+      }
+      event = fFreeEvents.back();
+      fFreeEvents.pop_back();
+    }
+
+    Bool_t eof;
+    Int_t number = DecodeEvent(0, *event, eof);
+
+    std::lock_guard<std::mutex> lock(fQueueMutex);
+    if (number < 0) {
+      event->Clear();
+      fFreeEvents.push_back(event);
+      fReaderDone = kTRUE;
+      fReaderEOF = eof;
+      fQueueCondition.notify_all();
+      return;
+    }
+    fQueue.push_back(event);
+    fQueueCondition.notify_all();
+  }
+}
 
 //_____________________________________________________________________________
 Int_t ACorsikaIACTFile::ReadEvent(Int_t num) {
@@ -277,232 +796,248 @@ Int_t ACorsikaIACTFile::ReadEvent(Int_t num) {
     return -1;
   }
 
-  if (fEventHeader) {
-    if (fEventHeader->GetEventNumber() == num) {
+  ACorsikaIACTEventHeader* header = fEvent->fHeader;
+  if (header) {
+    if (header->GetEventNumber() == num) {
       // Event is already read. Do nothing.
       return num;
-    } else if (fEventHeader->GetEventNumber() > num) {
-      // Cannot access previous data block in this version.
+    } else if (header->GetEventNumber() > num and not HasEventIndex()) {
+      // Cannot access previous data block without the event index.
       // eventio.c does not have such a function.
       return -1;
     }
   }
 
-  ULong64_t flag = 0x0;  // flag indicating what blocks we have read
-
-  while (1) {
-    Int_t numberOfArrays;          // ICERML of CSCAT option
-    Double_t timeOffset;           // Time offset from the first interaction
-    Double_t xOffset[kMaxArrays];  // X offset of core locations from (0, 0)
-    Double_t yOffset[kMaxArrays];  // Y offset of core locations from (0, 0)
-
-    Int_t telNo, arrayNo;
-    Float_t x, y, zem, time, cx, cy, cz, lambda, photons;
-    Double_t totalPhotons;
-
-    Int_t headerType = ReadNextBlock();
-    if (headerType == -1) {
-      break;
+  if (HasEventIndex()) {
+    auto less = [](const EventPosition& position, Int_t number) {
+      return position.fNumber < number;
+    };
+    auto target =
+        std::lower_bound(fEventIndex.begin(), fEventIndex.end(), num, less);
+    if (target == fEventIndex.end() or target->fNumber != num) {
+      // No such event in this file
+      return -1;
     }
-    switch (headerType) {
-      case IO_TYPE_MC_EVTH:
-        // fprintf(stderr, "IO_TYPE_MC_EVTH\n");
-        flag = 0x0;  // initialize when we read the event header
-        Float_t evth[273];
-        read_tel_block(fIOBuffer, IO_TYPE_MC_EVTH, evth, 273);
-        // Data blocks were OK, but event number != num. So skip.
-        if (evth[1] != num) {
-          break;
-        }
 
-        fMaxWavelength = evth[96];
-        fMinWavelength = evth[95];
+    // Seek unless the event is among the next ones being read ahead
+    Long64_t current =
+        header ? std::lower_bound(fEventIndex.begin(), fEventIndex.end(),
+                                  header->GetEventNumber(), less) -
+                     fEventIndex.begin()
+               : -1;
+    Long64_t distance = (target - fEventIndex.begin()) - current;
+    if (not fReader.joinable() or distance <= 0 or distance > fReadAhead + 1) {
+      if (not SeekEvent(num)) {
+        return -1;
+      }
+      StartReadAhead();
+    }
+  }
 
-        SafeDelete(fEventHeader);
-        fEventHeader = new ACorsikaIACTEventHeader(evth);
-        SET_FLAG(flag, IO_TYPE_MC_EVTH);
+  // Take the event from the queue if it is being read ahead
+  std::unique_lock<std::mutex> lock(fQueueMutex);
+  while (fReader.joinable() or not fQueue.empty()) {
+    fQueueCondition.wait(lock, [this] {
+      return not fQueue.empty() or fReaderDone or not fReader.joinable();
+    });
+    if (fQueue.empty()) {
+      if (not fReader.joinable()) {
+        break;  // read-ahead was stopped
+      }
+      lock.unlock();
+      if (fReaderEOF) {
+        Close();
+      }
+      return -1;
+    }
 
-        // Reset bunches
-        SafeDelete(fBunches);
-        fBunches = new TTree("tree", "Photon tree of CORSIKA IACT output.");
-
-        fBunches->Branch("telNo", &telNo, "telNo/I");
-        fBunches->Branch("arrayNo", &arrayNo, "arrayNo/I");
-        fBunches->Branch("x", &x, "x/F");
-        fBunches->Branch("y", &y, "y/F");
-        fBunches->Branch("zem", &zem, "zem/F");
-        fBunches->Branch("time", &time, "time/F");
-        fBunches->Branch("cx", &cx, "cx/F");
-        fBunches->Branch("cy", &cy, "cy/F");
-        fBunches->Branch("cz", &cz, "cz/F");
-        fBunches->Branch("lambda", &lambda, "lambda/F");
-        fBunches->Branch("photons", &photons, "photons/F");
+    EventData* event = fQueue.front();
+    Int_t number = event->fHeader->GetEventNumber();
+    if (number > num) {
+      // No such event in this file
+      return -1;
+    }
 
-        break;
+    fQueue.pop_front();
+    if (number == num) {
+      SafeDelete(fBunches);
+      std::swap(fEvent, event);
+    }
+    event->Clear();
+    fFreeEvents.push_back(event);
+    fQueueCondition.notify_all();
 
-      case IO_TYPE_MC_TELOFF:
-        // fprintf(stderr, "IO_TYPE_MC_TELOFF\n");
-        if (HAS_FLAG(flag, IO_TYPE_MC_EVTH)) {
-          read_tel_offset(fIOBuffer, kMaxArrays, &numberOfArrays, &timeOffset,
-                          xOffset, yOffset);
-          if (fEventHeader) {
-            fEventHeader->SetMultipleUseHeader(numberOfArrays, timeOffset,
-                                               xOffset, yOffset);
-          }
-          SET_FLAG(flag, IO_TYPE_MC_TELOFF);
-        }
-        break;
+    if (number == num) {
+      return num;
+    }
+  }
+  lock.unlock();
 
-      case IO_TYPE_MC_EXTRA_PARAM:
-        // fprintf(stderr, "IO_TYPE_MC_EXTRA_PARAM\n");
-        // not implemented yet
-        break;
+  SafeDelete(fBunches);
+  Bool_t eof;
+  Int_t number = DecodeEvent(num, *fEvent, eof);
+  if (eof) {
+    Close();
+  }
 
-      case IO_TYPE_MC_LONGI:
-        // fprintf(stderr, "IO_TYPE_MC_LONGI\n");
-        // not implemented yet
-        break;
+  return number;
+}
 
-      case IO_TYPE_MC_TELARRAY:
-      case IO_TYPE_MC_TELARRAY_HEAD: {
-        // IO_TYPE_MC_TELARRAY will appear ICERML times in an event
-        if (headerType == IO_TYPE_MC_TELARRAY) {
-          // fprintf(stderr, "IO_TYPE_MC_TELARRAY\n");
-        } else {
-          // fprintf(stderr, "IO_TYPE_MC_TELARRAY_HEAD\n");
-        }
-        if (not(HAS_FLAG(flag, IO_TYPE_MC_EVTH) and
-                HAS_FLAG(flag, IO_TYPE_MC_TELOFF))) {
-          break;
-        }
+//_____________________________________________________________________________
+Int_t ACorsikaIACTFile::ReadNextBlock() {
+  if (IsOpen()) {
+    if (find_io_block(fIOBuffer, &fBlockHeader) != 0) {
+      return -1;
+    }
+    fBlockCount++;
 
-        Int_t instanceNumberOfArrays;
-        IO_ITEM_HEADER itemHeader;
+    FitIOBuffer();
+    if (read_io_block(fIOBuffer, &fBlockHeader) != 0) {
+      return -1;
+    }
+  } else {
+    return -1;
+  }
 
-        Bool_t telIndividual;
-        if (headerType == IO_TYPE_MC_TELARRAY) {
-          telIndividual = false;
-          begin_read_tel_array(fIOBuffer, &itemHeader, &instanceNumberOfArrays);
-          SET_FLAG(flag, IO_TYPE_MC_TELARRAY);
-        } else {
-          telIndividual = true;
-          read_tel_array_head(fIOBuffer, &itemHeader, &instanceNumberOfArrays);
-          SET_FLAG(flag, IO_TYPE_MC_TELARRAY_HEAD);
-        }
+  return fBlockHeader.type;
+}
 
-        struct bunch* bunches =
-            (struct bunch*)malloc(fMaxPhotonBunches * sizeof(struct bunch));
+//_____________________________________________________________________________
+Int_t ACorsikaIACTFile::SamplePhotonCount(Double_t weight) {
+  // Sample the number of photons detected from a focused bunch, given its
+  // final weight in the bunched mode of GetRayArray (i.e. the number of
+  // photons times the survival probability). This is a Poisson distribution,
+  // which the binomial distribution of a bunch approaches because the
+  // survival probabilities of Cherenkov photons are small.
+  return weight > 0 ? Int_t(gRandom->Poisson(weight)) : 0;
+}
 
-        if (bunches == 0) {
-          // fprintf(stderr, "Error in allocating memory for photon bunch
-          // array.\n");
-          return -1;
-        }
+//_____________________________________________________________________________
+Bool_t ACorsikaIACTFile::SaveEventIndex() const {
+  // Write the event index to the sidecar file
+  TString path = fFileName;
+  gSystem->ExpandPathName(path);
+  FileStat_t st;
+  if (gSystem->GetPathInfo(path, st) != 0) {
+    return kFALSE;
+  }
 
-        for (Int_t i = 0; i < fNumberOfTelescopes; i++) {
-          if (not telIndividual) {
-            IO_ITEM_HEADER subItemHeader;
-            subItemHeader.type = IO_TYPE_MC_PHOTONS;
-            if (search_sub_item(fIOBuffer, &itemHeader, &subItemHeader) < 0) {
-              break;
-            }
-          } else {
-            if (find_io_block(fIOBuffer, &fBlockHeader) != 0) {
-              break;
-            }
-            if (read_io_block(fIOBuffer, &fBlockHeader) != 0) {
-              break;
-            }
-            if (fBlockHeader.type == IO_TYPE_MC_TELARRAY_END) {
-              telIndividual = false;
-              break;
-            }
-            if (fBlockHeader.type != IO_TYPE_MC_PHOTONS) {
-              telIndividual = false;
-              break;
-            }
-          }
+  FILE* file = fopen(GetIndexFileName(), "w");
+  if (file == 0) {
+    fprintf(stderr, "Cannot write the event index to %s.\n",
+            GetIndexFileName().Data());
+    return kFALSE;
+  }
 
-          Int_t nbunches;
-          if (read_tel_photons(fIOBuffer, fMaxPhotonBunches, &arrayNo, &telNo,
-                               &totalPhotons, bunches, &nbunches) < 0) {
-            // fprintf(stderr,"Error reading %d photon bunches\n",nbunches);
-            continue;
-          }
+  fprintf(file, "# ROBAST CORSIKA event index %lld %lld %lld\n",
+          (long long)st.fSize, (long long)st.fMtime,
+          (long long)fEventIndex.size());
+  for (const auto& position : fEventIndex) {
+    fprintf(file, "%d %lld %lld\n", position.fNumber,
+            (long long)position.fBlock, (long long)position.fOffset);
+  }
 
-          if (arrayNo != instanceNumberOfArrays) {
-            // do nothing for now
-          }
-          if (i >= kMaxTelescopes or telNo < 0) {
-            // fprintf(stderr, "Cannot process data for telescope #%d because
-            // only %d are configured.\n", i + 1, kMaxTelescopes);
-            continue;
-          }
+  return fclose(file) == 0;
+}
 
-          for (Int_t j = 0; j < nbunches; j++) {
-            x = bunches[j].x;
-            y = bunches[j].y;
-            zem = bunches[j].zem;
-            time = bunches[j].ctime;
-            cx = bunches[j].cx;
-            cy = bunches[j].cy;
-            cz = -1. * sqrt(1. - cx * cx - cy * cy);
-            lambda = bunches[j].lambda;
-            photons = bunches[j].photons;
-            fBunches->Fill();
-          }
-        }
+//_____________________________________________________________________________
+Bool_t ACorsikaIACTFile::SeekEvent(Int_t num) {
+  // Move to the header of event num by the event index. Regular files are
+  // seeked directly. Compressed files are read through a pipe, so the blocks
+  // before the event are skipped without being decoded, after opening the
+  // file again if the event is behind the current position.
+  auto it =
+      std::lower_bound(fEventIndex.begin(), fEventIndex.end(), num,
+                       [](const EventPosition& position, Int_t number) {
+                         return position.fNumber < number;
+                       });
+  if (it == fEventIndex.end() or it->fNumber != num) {
+    return kFALSE;
+  }
 
-        free(bunches);
+  // The events read ahead are no longer next to the file position
+  StopReadAhead(kTRUE);
 
-        if (fBlockHeader.type == IO_TYPE_MC_TELARRAY) {
-          end_read_tel_array(fIOBuffer, &itemHeader);
-        }
+  if (it->fOffset >= 0) {
+    if (fseeko(fIOBuffer->input_file, it->fOffset, SEEK_SET) != 0) {
+      return kFALSE;
+    }
+  } else {
+    if (it->fBlock < fBlockCount) {
+      TString path = fFileName;
+      gSystem->ExpandPathName(path);
+      fileclose(fIOBuffer->input_file);
+      if ((fIOBuffer->input_file = fileopen(path, "r")) == 0) {
+        fprintf(stderr, "Cannot open the file.\n");
+        return kFALSE;
+      }
+      fBlockCount = 0;
+    }
 
-        break;
+    IO_ITEM_HEADER header;
+    while (fBlockCount < it->fBlock) {
+      if (find_io_block(fIOBuffer, &header) != 0 or
+          skip_io_block(fIOBuffer, &header) != 0) {
+        return kFALSE;
       }
-      case IO_TYPE_MC_EVTE:
-        SET_FLAG(flag, IO_TYPE_MC_EVTE);
-        // fprintf(stderr, "IO_TYPE_MC_EVTE\n");
-        break;
+      fBlockCount++;
+    }
+  }
+  fBlockCount = it->fBlock;
 
-      case IO_TYPE_MC_RUNE:
-        SET_FLAG(flag, IO_TYPE_MC_RUNE);
-        // fprintf(stderr, "IO_TYPE_MC_RUNE\n");
-        break;
+  ClearBunches();
 
-      default:
-        fprintf(stderr, "Unknown type\n");
-        break;
-    }
+  return kTRUE;
+}
 
-    if (HAS_FLAG(flag, IO_TYPE_MC_EVTH) and
-        HAS_FLAG(flag, IO_TYPE_MC_TELOFF) and
-        (HAS_FLAG(flag, IO_TYPE_MC_TELARRAY) or
-         HAS_FLAG(flag, IO_TYPE_MC_TELARRAY_HEAD)) and
-        HAS_FLAG(flag, IO_TYPE_MC_EVTE)) {
-      return num;
-    }
+//_____________________________________________________________________________
+void ACorsikaIACTFile::SetReadAhead(Int_t nevents) {
+  // Decode the next nevents events in a background thread, which overlaps
+  // the decompression and the decoding of a file with the ray tracing of the
+  // current event. The read-ahead is disabled if nevents is 0 (default).
+  // Each event in the queue holds its own bunch buffer.
+  StopReadAhead();
+  fReadAhead = nevents > 0 ? nevents : 0;
+  StartReadAhead();
+}
+
+//_____________________________________________________________________________
+void ACorsikaIACTFile::StartReadAhead() {
+  if (fReadAhead <= 0 or fReader.joinable() or not IsOpen()) {
+    return;
   }
 
-  return -1;
+  std::lock_guard<std::mutex> lock(fQueueMutex);
+  for (std::size_t i = fFreeEvents.size() + fQueue.size();
+       i < std::size_t(fReadAhead); i++) {
+    fFreeEvents.push_back(new EventData);
+  }
+  fStopReader = kFALSE;
+  fReaderDone = kFALSE;
+  fReaderEOF = kFALSE;
+  fReader = std::thread(&ACorsikaIACTFile::ReadAhead, this);
 }
 
 //_____________________________________________________________________________
-Int_t ACorsikaIACTFile::ReadNextBlock() {
-  if (IsOpen()) {
-    if (find_io_block(fIOBuffer, &fBlockHeader) != 0) {
-      Close();
-      return -1;
+void ACorsikaIACTFile::StopReadAhead(Bool_t discard) {
+  // Stop the reader thread after the event being decoded. The decoded events
+  // are kept for ReadEvent unless discard is kTRUE.
+  if (fReader.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(fQueueMutex);
+      fStopReader = kTRUE;
     }
+    fQueueCondition.notify_all();
+    fReader.join();
+  }
 
-    if (read_io_block(fIOBuffer, &fBlockHeader) != 0) {
-      Close();
-      return -1;
+  if (discard) {
+    std::lock_guard<std::mutex> lock(fQueueMutex);
+    for (auto event : fQueue) {
+      event->Clear();
+      fFreeEvents.push_back(event);
     }
-  } else {
-    return -1;
+    fQueue.clear();
+    fReaderEOF = kFALSE;
   }
-
-  return fBlockHeader.type;
 }
@@ -11,52 +11,58 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
-#include <fstream>
-#include <iostream>
-
-#include "TSystem.h"
+#include <cstdlib>
+#include <cstring>
 
 #include "AFilmetrixDotCom.h"
 #include "AOpticsManager.h"
 
 ClassImp(AFilmetrixDotCom);
 
-AFilmetrixDotCom::AFilmetrixDotCom(const char* fname) : ARefractiveIndex() {
-  std::ifstream fin;
-  fin.open(gSystem->ExpandPathName(fname));
-
-  if (!fin.is_open()) {
-    Error("AFilmetrixDotCom", "Cannot open %s", fname);
-    return;
-  }
+namespace {
 
-  char buf[100];
-  fin.getline(buf, 100);
+Bool_t ParseFilmetrix(const std::string& text, TGraph& n, TGraph& k) {
+  // Read the columns of wavelength (nm), n and k after the header line
+  const char* p = text.c_str();
+  const char* eol = strchr(p, '\n');
+  std::string header(p, eol ? eol : p + text.size());
 
   // Check header with possible UTF-8 BOM and CR
   // clang-format off
-  if (strcmp(buf, "\xef\xbb\xbfWavelength(nm)\tn\tk\r") != 0 &&
-      strcmp(buf, "\xef\xbb\xbfWavelength(nm)\tn\tk"  ) != 0 &&
-      strcmp(buf,             "Wavelength(nm)\tn\tk\r") != 0 &&
-      strcmp(buf,             "Wavelength(nm)\tn\tk")   != 0 ) {
+  if (header != "\xef\xbb\xbfWavelength(nm)\tn\tk\r" &&
+      header != "\xef\xbb\xbfWavelength(nm)\tn\tk"   &&
+      header !=             "Wavelength(nm)\tn\tk\r" &&
+      header !=             "Wavelength(nm)\tn\tk") {
     // clang-format on
-    Error("AFilmetrixDotCom", "Invalid data format");
-    return;
+    return kFALSE;
   }
+  if (!eol) return kTRUE;
 
-  fRefractiveIndex = std::make_shared<TGraph>();
-  fExtinctionCoefficient = std::make_shared<TGraph>();
-
+  p = eol + 1;
   while (1) {
-    double wl, n, k;
-    fin >> wl >> n >> k;
-    if (fin.good()) {
-      wl *= AOpticsManager::nm();
-      fRefractiveIndex->SetPoint(fRefractiveIndex->GetN(), wl, n);
-      fExtinctionCoefficient->SetPoint(fExtinctionCoefficient->GetN(), wl, k);
-    } else {
-      fin.close();
-      break;
-    }
+    char* endptr;
+    Double_t wl = strtod(p, &endptr);
+    if (endptr == p) break;
+    p = endptr;
+    Double_t nv = strtod(p, &endptr);
+    if (endptr == p) break;
+    p = endptr;
+    Double_t kv = strtod(p, &endptr);
+    if (endptr == p) break;
+    p = endptr;
+
+    wl *= AOpticsManager::nm();
+    n.SetPoint(n.GetN(), wl, nv);
+    k.SetPoint(k.GetN(), wl, kv);
   }
+
+  return kTRUE;
+}
+
+}  // namespace
+
+AFilmetrixDotCom::AFilmetrixDotCom(const char* fname) : ARefractiveIndex() {
+  // The file is parsed once per process, and the tables are shared by all the
+  // materials made from it (see ARefractiveIndex::LoadSharedTables)
+  LoadSharedTables(fname, ParseFilmetrix);
 }
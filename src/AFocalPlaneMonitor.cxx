@@ -0,0 +1,168 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AFocalPlaneMonitor
+//
+// Accumulator of the photons detected by focal surfaces. When a monitor is
+// attached to AFocalSurface by SetMonitor, every ray focused on the surface
+// is counted while it is being traced, so that the PSF is available right
+// after TraceNonSequential without keeping the focused rays or looping over
+// them again.
+//
+// The monitor fills the hit positions (X and Y of the global frame) into a
+// TH2, the arrival times and the wavelengths into TH1s, and keeps the
+// weighted moments (centroid and RMS) of all the hits including those out of
+// the histogram ranges. The histograms are optional and are not owned.
+//
+// The pixel IDs of the hits are found during tracing if an ACameraMap is given
+// by SetCameraMap, and the counts and arrival times of the pixels are
+// accumulated in the map together with the other hits.
+//
+// Tracing threads do not lock the monitor for each hit. The hits are kept in
+// a buffer of the thread, which is added to the monitor when it is full and
+// at the end of each tracing task.
+//
+//   TH2D* h = new TH2D("h", ";X (mm);Y (mm)", 100, -50, 50, 100, -50, 50);
+//   AFocalPlaneMonitor monitor(h, AOpticsManager::mm());
+//   focalSurface->SetMonitor(&monitor);
+//   manager->TraceNonSequential(array);
+//   // h is filled here, and monitor.GetRMSX() etc. are ready
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TH1.h"
+#include "TH2.h"
+#include "TMath.h"
+
+#include "ACameraMap.h"
+#include "AFocalPlaneMonitor.h"
+
+ClassImp(AFocalPlaneMonitor);
+
+//_____________________________________________________________________________
+AFocalPlaneMonitor::AFocalPlaneMonitor(TH2* hits, Double_t unit)
+    : fHits(hits),
+      fTime(0),
+      fLambda(0),
+      fCamera(0),
+      fUnit(unit),
+      fTimeUnit(1.),
+      fLambdaUnit(1.),
+      fEntries(0),
+      fSumW(0),
+      fSumWX(0),
+      fSumWY(0),
+      fSumWX2(0),
+      fSumWY2(0) {}
+
+//_____________________________________________________________________________
+void AFocalPlaneMonitor::Add(const std::vector<Hit>& hits) {
+  std::lock_guard<std::mutex> lock(fMutex);
+  for (std::size_t i = 0; i < hits.size(); i++) {
+    const Hit& hit = hits[i];
+    Double_t w = hit.fWeight;
+    fEntries++;
+    fSumW += w;
+    fSumWX += w * hit.fX;
+    fSumWY += w * hit.fY;
+    fSumWX2 += w * hit.fX * hit.fX;
+    fSumWY2 += w * hit.fY * hit.fY;
+    if (fHits) fHits->Fill(hit.fX / fUnit, hit.fY / fUnit, w);
+    if (fTime) fTime->Fill(hit.fT / fTimeUnit, w);
+    if (fLambda) fLambda->Fill(hit.fLambda / fLambdaUnit, w);
+  }
+
+  if (fCamera) {
+    std::lock_guard<std::mutex> camlock(fCamera->fMutex);
+    for (std::size_t i = 0; i < hits.size(); i++) {
+      if (hits[i].fPixel >= 0) {
+        fCamera->AddHit(hits[i].fPixel, hits[i].fT, hits[i].fWeight);
+      }
+    }
+  }
+}
+
+//_____________________________________________________________________________
+void AFocalPlaneMonitor::Fill(const Double_t* point, Double_t lambda,
+                              Double_t weight) {
+  // Add a hit at point (x, y, z, t) to the buffer of the calling thread
+  std::vector<std::pair<AFocalPlaneMonitor*, std::vector<Hit>>>& buffers =
+      GetThreadBuffers();
+
+  std::vector<Hit>* buffer = 0;
+  for (std::size_t i = 0; i < buffers.size(); i++) {
+    if (buffers[i].first == this) {
+      buffer = &buffers[i].second;
+      break;
+    }
+  }
+  if (!buffer) {
+    buffers.push_back(std::make_pair(this, std::vector<Hit>()));
+    buffer = &buffers.back().second;
+    buffer->reserve(kBufferSize);
+  }
+
+  Int_t pixel = fCamera ? fCamera->FindPixelOfPoint(point) : -1;
+  Hit hit = {point[0], point[1], point[3], lambda, weight, pixel};
+  buffer->push_back(hit);
+  if (buffer->size() >= kBufferSize) {
+    Add(*buffer);
+    buffer->clear();
+  }
+}
+
+//_____________________________________________________________________________
+void AFocalPlaneMonitor::FlushThreadBuffers() {
+  // Add the hits buffered by the calling thread to their monitors. This is
+  // called by AOpticsManager at the end of each tracing task.
+  std::vector<std::pair<AFocalPlaneMonitor*, std::vector<Hit>>>& buffers =
+      GetThreadBuffers();
+  for (std::size_t i = 0; i < buffers.size(); i++) {
+    if (not buffers[i].second.empty()) buffers[i].first->Add(buffers[i].second);
+  }
+  buffers.clear();
+}
+
+//_____________________________________________________________________________
+Double_t AFocalPlaneMonitor::GetRMSX() const {
+  if (fSumW <= 0) return 0.;
+  Double_t mean = fSumWX / fSumW;
+
+  return TMath::Sqrt(TMath::Max(fSumWX2 / fSumW - mean * mean, 0.));
+}
+
+//_____________________________________________________________________________
+Double_t AFocalPlaneMonitor::GetRMSY() const {
+  if (fSumW <= 0) return 0.;
+  Double_t mean = fSumWY / fSumW;
+
+  return TMath::Sqrt(TMath::Max(fSumWY2 / fSumW - mean * mean, 0.));
+}
+
+//_____________________________________________________________________________
+std::vector<std::pair<AFocalPlaneMonitor*,
+                      std::vector<AFocalPlaneMonitor::Hit>>>&
+AFocalPlaneMonitor::GetThreadBuffers() {
+  // Buffers are empty between tracing calls, so that no buffer refers to a
+  // deleted monitor
+  thread_local std::vector<std::pair<AFocalPlaneMonitor*, std::vector<Hit>>>
+      buffers;
+
+  return buffers;
+}
+
+//_____________________________________________________________________________
+void AFocalPlaneMonitor::Reset() {
+  // Clear the moments, the histograms and the pixels of the camera map
+  std::lock_guard<std::mutex> lock(fMutex);
+  fEntries = 0;
+  fSumW = fSumWX = fSumWY = fSumWX2 = fSumWY2 = 0.;
+  if (fHits) fHits->Reset();
+  if (fTime) fTime->Reset();
+  if (fLambda) fLambda->Reset();
+  if (fCamera) fCamera->Reset();
+}
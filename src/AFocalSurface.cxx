@@ -9,14 +9,39 @@
 //
 // Focal surface
 //
+// The quantum efficiency curves can be baked into tables on uniform grids by
+// BakeQuantumEfficiency, which are then used within the ranges of the curves.
+//
+// An AFocalPlaneMonitor can be attached by SetMonitor to accumulate the hits
+// during tracing.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "AFocalSurface.h"
+#include "TMath.h"
+
+namespace {
+
+Bool_t BakeGraph(ALookupTable& table, const TGraph* graph,
+                 Double_t tolerance) {
+  if (not graph or graph->GetN() < 2) {
+    table.Clear();
+    return kTRUE;  // nothing to be baked
+  }
+
+  Int_t n = graph->GetN();
+  std::vector<Double_t> knots(graph->GetX(), graph->GetX() + n);
+  return table.Bake([graph](Double_t x) { return graph->Eval(x); },
+                    TMath::MinElement(n, graph->GetX()),
+                    TMath::MaxElement(n, graph->GetX()), tolerance, knots);
+}
+
+}  // namespace
 
 ClassImp(AFocalSurface);
 
 AFocalSurface::AFocalSurface()
-    : fQuantumEfficiencyLambda(0), fQuantumEfficiencyAngle(0) {
+    : fQuantumEfficiencyLambda(0), fQuantumEfficiencyAngle(0), fMonitor(0) {
   // Default constructor
   SetLineColor(2);
 }
@@ -26,14 +51,44 @@ AFocalSurface::AFocalSurface(const char* name, const TGeoShape* shape,
                              const TGeoMedium* med)
     : AOpticalComponent(name, shape, med),
       fQuantumEfficiencyLambda(0),
-      fQuantumEfficiencyAngle(0) {
+      fQuantumEfficiencyAngle(0),
+      fMonitor(0) {
   // Constructor
   SetLineColor(2);
 }
 
+//_____________________________________________________________________________
+void AFocalSurface::CountMemory(AMemoryUtil::Counter& counter) const {
+  // The QE graphs are not owned, and may be shared by many focal surfaces
+  AOpticalComponent::CountMemory(counter);
+  counter.AddBytes(fTableLambda.GetMemoryUsage() +
+                   fTableAngle.GetMemoryUsage());
+  counter.Add(fQuantumEfficiencyLambda,
+              AMemoryUtil::SizeOf(fQuantumEfficiencyLambda));
+  counter.Add(fQuantumEfficiencyAngle,
+              AMemoryUtil::SizeOf(fQuantumEfficiencyAngle));
+}
+
+//_____________________________________________________________________________
+Bool_t AFocalSurface::BakeQuantumEfficiency(Double_t tolerance) {
+  // Resample the QE curves within their ranges until the deviation from the
+  // original curves becomes smaller than tolerance. A table is discarded if
+  // it fails. Bake them again if the curves are modified.
+  Bool_t ok = BakeGraph(fTableLambda, fQuantumEfficiencyLambda, tolerance);
+  ok = BakeGraph(fTableAngle, fQuantumEfficiencyAngle, tolerance) and ok;
+  if (not ok) {
+    Warning("BakeQuantumEfficiency", "Failed to reach the tolerance (%g)",
+            tolerance);
+  }
+
+  return ok;
+}
+
 //_____________________________________________________________________________
 Double_t AFocalSurface::GetQuantumEfficiency(Double_t lambda) const {
-  if (fQuantumEfficiencyLambda) {
+  if (fTableLambda.Contains(lambda)) {
+    return fTableLambda.Eval(lambda);
+  } else if (fQuantumEfficiencyLambda) {
     return fQuantumEfficiencyLambda->Eval(lambda);
   } else {
     return 1.;
@@ -45,7 +100,8 @@ Double_t AFocalSurface::GetQuantumEfficiency(Double_t lambda,
                                              Double_t angle) const {
   Double_t qe = GetQuantumEfficiency(lambda);
   if (HasQEAngle()) {
-    qe *= fQuantumEfficiencyAngle->Eval(angle);
+    qe *= fTableAngle.Contains(angle) ? fTableAngle.Eval(angle)
+                                      : fQuantumEfficiencyAngle->Eval(angle);
   }
 
   return qe;
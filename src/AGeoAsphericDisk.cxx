@@ -9,11 +9,22 @@
 //
 // Geometry class for tubes which have two aspheric surface
 //
+// The sags at the inner and outer edges are cached whenever the parameters
+// are changed. The navigation methods (Contains, Safety, ComputeNormal and
+// the DistFrom* family) evaluate the surfaces with EvalSag, which returns
+// kFALSE outside the domain of the conic, so that no exception is thrown in
+// tracing loops. CalcF1, CalcF2 and so on still throw std::exception there.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "AGeoAsphericDisk.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
 #include "Riostream.h"
+#include "TBuffer.h"
 #include "TBuffer3D.h"
 #include "TBuffer3DTypes.h"
 #include "TGeoCone.h"
@@ -25,8 +36,38 @@
 #include "TVirtualGeoPainter.h"
 #include "TVirtualPad.h"
 
+#include "AGeoShapeProfiler.h"
+
 ClassImp(AGeoAsphericDisk);
 
+namespace {
+
+template <Int_t N>
+inline void EvalPolynomialN(const Double_t* k, Double_t h2, Double_t& p,
+                            Double_t& dpdh2) {
+  // Horner form of p = sum k[j] h2^(j+1) and its derivative. The loop is
+  // unrolled by compilers as N is a constant.
+  Double_t q = 0, dq = 0;
+  for (Int_t j = N - 1; j >= 0; j--) {
+    dq = dq * h2 + q;
+    q = q * h2 + k[j];
+  }
+  p = q * h2;
+  dpdh2 = q + h2 * dq;
+}
+
+std::atomic<Bool_t> gSolverStatistics(kFALSE);
+std::atomic<ULong64_t> gSolverCalls(0);
+std::atomic<ULong64_t> gSolverIterations(0);
+std::atomic<ULong64_t> gSolverMisses(0);
+
+inline Double_t SolverMiss(Bool_t count) {
+  if (count) gSolverMisses.fetch_add(1, std::memory_order_relaxed);
+  return TGeoShape::Big();
+}
+
+}  // namespace
+
 //_____________________________________________________________________________
 AGeoAsphericDisk::AGeoAsphericDisk()
     : fConic1(0),
@@ -42,7 +83,6 @@ AGeoAsphericDisk::AGeoAsphericDisk()
   // Default constructor
   SetShapeBit(TGeoShape::kGeoBox);
   SetAsphDimensions(0, 0, 0, 0, 0, 0);
-  ComputeBBox();
 }
 
 //_____________________________________________________________________________
@@ -62,7 +102,6 @@ AGeoAsphericDisk::AGeoAsphericDisk(Double_t z1, Double_t curve1, Double_t z2,
       fRepeat(4) {
   SetShapeBit(TGeoShape::kGeoBox);
   SetAsphDimensions(z1, curve1, z2, curve2, rmax, rmin);
-  ComputeBBox();
 }
 
 //_____________________________________________________________________________
@@ -83,7 +122,6 @@ AGeoAsphericDisk::AGeoAsphericDisk(const char* name, Double_t z1,
       fRepeat(4) {
   SetShapeBit(TGeoShape::kGeoBox);
   SetAsphDimensions(z1, curve1, z2, curve2, rmax, rmin);
-  ComputeBBox();
 }
 
 //_____________________________________________________________________________
@@ -94,62 +132,55 @@ AGeoAsphericDisk::~AGeoAsphericDisk() {
 
 //_____________________________________________________________________________
 Double_t AGeoAsphericDisk::CalcdF1dr(Double_t r) const noexcept(false) {
-  // Calculate dF1/dr
-  Double_t p = r * r * fCurve1 * fCurve1 * fKappa1;
-  if (1 - p <= 0) throw std::exception();
+  // Calculate dF1/dr. Throws std::exception outside the domain of the conic
+  // (see EvalSag for the non-throwing version).
+  Double_t f, dfdr;
+  if (not EvalSag(1, r, f, &dfdr)) throw std::exception();
 
-  Double_t ret = r * fCurve1 / sqrt(1 - p);
-
-  for (Int_t i = 0; i < fNPol1; i++) {
-    ret += 2 * (i + 1) * fK1[i] * TMath::Power(r, 2 * (i + 1) - 1);
-  }
-
-  return ret;
+  return dfdr;
 }
 
 //_____________________________________________________________________________
 Double_t AGeoAsphericDisk::CalcdF2dr(Double_t r) const noexcept(false) {
   // Calculate dF2/dr
-  Double_t p = r * r * fCurve2 * fCurve2 * fKappa2;
-  if (1 - p <= 0) throw std::exception();
-
-  Double_t ret = r * fCurve2 / sqrt(1 - p);
-
-  for (Int_t i = 0; i < fNPol2; i++) {
-    ret += 2 * (i + 1) * fK2[i] * pow(r, 2 * (i + 1) - 1);
-  }
+  Double_t f, dfdr;
+  if (not EvalSag(2, r, f, &dfdr)) throw std::exception();
 
-  return ret;
+  return dfdr;
 }
 
 //_____________________________________________________________________________
 Double_t AGeoAsphericDisk::CalcF1(Double_t r) const noexcept(false) {
   // Calculate z value of surface 1 at given r
-  Double_t p = r * r * fCurve1 * fCurve1 * fKappa1;
-  if (1 - p < 0) throw std::exception();
+  Double_t f;
+  if (not EvalSag(1, r, f)) throw std::exception();
 
-  Double_t ret = fZ1 + r * r * fCurve1 / (1 + sqrt(1 - p));
-
-  for (Int_t i = 0; i < fNPol1; i++) {
-    ret += fK1[i] * pow(r, 2 * (i + 1));
-  }
-
-  return ret;
+  return f;
 }
 
 //_____________________________________________________________________________
 Double_t AGeoAsphericDisk::CalcF2(Double_t r) const noexcept(false) {
-  // Calculate z value of surface 1 at given r
-  Double_t p = r * r * fCurve2 * fCurve2 * fKappa2;
-  if (1 - p < 0) throw std::exception();
+  // Calculate z value of surface 2 at given r
+  Double_t f;
+  if (not EvalSag(2, r, f)) throw std::exception();
 
-  Double_t ret = fZ2 + r * r * fCurve2 / (1 + sqrt(1 - p));
+  return f;
+}
 
-  for (Int_t i = 0; i < fNPol2; i++) {
-    ret += fK2[i] * pow(r, 2 * (i + 1));
+//_____________________________________________________________________________
+void AGeoAsphericDisk::CalcSag(Int_t i, Int_t n, const Double_t* r,
+                               Double_t* z, Double_t* dzdr) const
+    noexcept(false) {
+  // Calculate z values (and dz/dr if dzdr is given) of surface i (1 or 2) at
+  // n radii r[0] to r[n - 1] at once. The sag and its derivative share one
+  // Horner evaluation of the polynomial.
+  if (i != 1 and i != 2) return;
+
+  for (Int_t j = 0; j < n; j++) {
+    if (not EvalSag(i, r[j], z[j], dzdr ? &dzdr[j] : 0)) {
+      throw std::exception();
+    }
   }
-
-  return ret;
 }
 
 //_____________________________________________________________________________
@@ -163,17 +194,11 @@ Double_t AGeoAsphericDisk::Capacity() const {
 //_____________________________________________________________________________
 void AGeoAsphericDisk::ComputeBBox() {
   // Compute bounding box of the shape
+  UpdateEdgeSags();
+
   Double_t zmax = -TGeoShape::Big();
   if (fNPol2 == 0) {
-    Double_t f1, f2;
-    try {
-      f1 = CalcF2(fRmin);
-      f2 = CalcF2(fRmax);
-    } catch (...) {
-      f1 = TGeoShape::Big();
-      f2 = TGeoShape::Big();
-    }
-    zmax = f1 > f2 ? f1 : f2;
+    zmax = TMath::Max(fEdgeSag[1][0], fEdgeSag[1][1]);
   } else {
     Double_t r1 = fRmin;
     Double_t r2 = fRmax;
@@ -182,12 +207,7 @@ void AGeoAsphericDisk::ComputeBBox() {
       Double_t r_ = r1;
       for (Int_t j = 0; j <= fSteps + 1; j++) {
         Double_t r = r1 + j * step;
-        Double_t f;
-        try {
-          f = CalcF2(r);
-        } catch (...) {
-          f = -TGeoShape::Big();
-        }
+        Double_t f = SagOrDefault(2, r, -TGeoShape::Big());
         if (f > zmax) {
           zmax = f;
           r_ = r;
@@ -200,15 +220,7 @@ void AGeoAsphericDisk::ComputeBBox() {
 
   Double_t zmin = TGeoShape::Big();
   if (fNPol1 == 0) {
-    Double_t f1, f2;
-    try {
-      f1 = CalcF1(fRmin);
-      f2 = CalcF1(fRmax);
-    } catch (...) {
-      f1 = -TGeoShape::Big();
-      f2 = -TGeoShape::Big();
-    }
-    zmin = f1 < f2 ? f1 : f2;
+    zmin = TMath::Min(fEdgeSag[0][0], fEdgeSag[0][1]);
   } else {
     Double_t r1 = fRmin;
     Double_t r2 = fRmax;
@@ -217,12 +229,7 @@ void AGeoAsphericDisk::ComputeBBox() {
       Double_t r_ = r1;
       for (Int_t j = 0; j <= fSteps + 1; j++) {
         Double_t r = r1 + j * step;
-        Double_t f;
-        try {
-          f = CalcF1(r);
-        } catch (...) {
-          f = TGeoShape::Big();
-        }
+        Double_t f = SagOrDefault(1, r, TGeoShape::Big());
         if (f < zmin) {
           zmin = f;
           r_ = r;
@@ -259,36 +266,16 @@ void AGeoAsphericDisk::ComputeNormal(CONST53410 Double_t* point,
   Double_t f1, f2;
   // any numbers is OK, just to remove warning
   Double_t df1(TGeoShape::Big()), df2(TGeoShape::Big());
-  try {
-    f1 = CalcF1(r);
-  } catch (...) {
-    f1 = -TGeoShape::Big();
-  }
-  if (f1 == -TGeoShape::Big()) {
-    saf[2] = TGeoShape::Big();
+  if (EvalSag(1, r, f1, &df1)) {
+    saf[2] = TMath::Abs(f1 - point[2]) / sqrt(1 + df1 * df1);
   } else {
-    try {
-      df1 = CalcdF1dr(r);
-      saf[2] = TMath::Abs(f1 - point[2]) / sqrt(1 + df1 * df1);
-    } catch (...) {
-      saf[2] = TGeoShape::Big();
-    }
+    saf[2] = TGeoShape::Big();
   }
 
-  try {
-    f2 = CalcF2(r);
-  } catch (...) {
-    f2 = TGeoShape::Big();
-  }
-  if (f2 == TGeoShape::Big()) {
-    saf[3] = TGeoShape::Big();
+  if (EvalSag(2, r, f2, &df2)) {
+    saf[3] = TMath::Abs(f2 - point[2]) / sqrt(1 + df2 * df2);
   } else {
-    try {
-      df2 = CalcdF2dr(r);
-      saf[3] = TMath::Abs(f2 - point[2]) / sqrt(1 + df2 * df2);
-    } catch (...) {
-      saf[3] = TGeoShape::Big();
-    }
+    saf[3] = TGeoShape::Big();
   }
 
   Int_t i = TMath::LocMin(4, saf);  // find minimum
@@ -334,12 +321,7 @@ Bool_t AGeoAsphericDisk::Contains(CONST53410 Double_t* point) const {
   if (r > fRmax or r < fRmin) return kFALSE;
 
   Double_t f1, f2;
-  try {
-    f1 = CalcF1(r);
-    f2 = CalcF2(r);
-  } catch (...) {
-    return kFALSE;
-  }
+  if (not EvalSag(1, r, f1) or not EvalSag(2, r, f2)) return kFALSE;
 
   if (point[2] < f1 or f2 < point[2]) return kFALSE;
 
@@ -414,115 +396,151 @@ Double_t AGeoAsphericDisk::DistFromOutside(CONST53410 Double_t* point,
 //_____________________________________________________________________________
 Double_t AGeoAsphericDisk::DistToAsphere(Int_t n, CONST53410 Double_t* point,
                                          CONST53410 Double_t* dir) const {
+  // Compute the distance to surface n (1 or 2) along dir. The part of the ray
+  // inside the bounding cylinder (and inside the slab of the bounding box) is
+  // sampled at kSolverSamples points to bracket the first crossing, which is
+  // then refined by Newton's method falling back on bisection whenever a step
+  // leaves the bracket. A ray grazing the surface may enter and leave it
+  // between two samples; such a pair is bracketed by the extremum of the
+  // height above the surface when its slope changes the sign there. Pairs
+  // closer than the tolerance (tangent rays) and intervals with more than one
+  // extremum, which need samples finer than the aspheric terms vary, are
+  // still missed.
   if (n != 1 and n != 2) return TGeoShape::Big();
 
-  // following calculations are based on Y.Matsui's text book pp 42-45
-  // Matsui (x, y, z) -> in this function (z, x, y)
-  // !WARNING! this method cannot handle with large incident angles nor
-  // complicated surfaces which have many extremums. I strongly recommend you
-  // to check 3D view of rays. In most cases using Ashra optics, this will not
-  // limit your application.
-  Double_t H2 = point[0] * point[0] + point[1] * point[1];
-  Double_t d = n == 1 ? fZ1 : fZ2;
-  Double_t p =
-      -((point[2] - d) * dir[2] + point[0] * dir[0] + point[1] * dir[1]);
-  Double_t M = p * dir[2] + point[2] - d;
-  Double_t M2 = (point[2] - d) * (point[2] - d) + H2 - p * p;
-
-  Double_t check = n == 1
-                       ? 1 - (M2 * fCurve1 - 2 * M) * fCurve1 / dir[2] / dir[2]
-                       : 1 - (M2 * fCurve2 - 2 * M) * fCurve2 / dir[2] / dir[2];
-
-  if (check < 0) {
-    // Actually, the ray still has a chance to cross the surface. But this is
-    // the limitation of this function.
-    return TGeoShape::Big();
+  const Double_t z0 = n == 1 ? fZ1 : fZ2;
+  const Double_t curve = n == 1 ? fCurve1 : fCurve2;
+  const Double_t c2k = curve * curve * (n == 1 ? fKappa1 : fKappa2);
+  const Int_t npol = n == 1 ? fNPol1 : fNPol2;
+  const Double_t* k = n == 1 ? fK1 : fK2;
+  const Bool_t count = gSolverStatistics.load(std::memory_order_relaxed);
+  if (count) gSolverCalls.fetch_add(1, std::memory_order_relaxed);
+  const Bool_t profile = AGeoShapeProfiler::IsEnabled();
+
+  // the conic part is defined only for r^2 <= 1/(kappa c^2)
+  Double_t rmax = fRdomain[n - 1];
+
+  // range of t in which the ray is inside the cylinder of rmax
+  Double_t t0 = 0, t1 = TGeoShape::Big();
+  Double_t a = dir[0] * dir[0] + dir[1] * dir[1];
+  Double_t b = point[0] * dir[0] + point[1] * dir[1];
+  Double_t c = point[0] * point[0] + point[1] * point[1] - rmax * rmax;
+  if (a > 0) {
+    Double_t disc = b * b - a * c;
+    if (disc < 0) return SolverMiss(count);
+    disc = TMath::Sqrt(disc);
+    t0 = TMath::Max(t0, (-b - disc) / a);
+    t1 = TMath::Min(t1, (-b + disc) / a);
+  } else if (c > 0) {
+    return SolverMiss(count);
   }
 
-  Double_t q =
-      n == 1 ? p + (M2 * fCurve1 - 2 * M) / (dir[2] * (1 + TMath::Sqrt(check)))
-             : p + (M2 * fCurve2 - 2 * M) / (dir[2] * (1 + TMath::Sqrt(check)));
-
-  Double_t npoint[3] = {point[0] + q * dir[0], point[1] + q * dir[1],
-                        point[2] + q * dir[2] - d};
-
-  for (Int_t i = 0;; i++) {
-    if (i > 100) {
-      return TGeoShape::Big();
-    }
-    H2 = npoint[0] * npoint[0] + npoint[1] * npoint[1];
-    check = n == 1 ? (1 - fKappa1 * H2 * fCurve1 * fCurve1)
-                   : (1 - fKappa2 * H2 * fCurve2 * fCurve2);
-    if (check < 0) {
-      // This is a limitation too
-      return TGeoShape::Big();
-    }
-
-    Double_t l = sqrt(check);
-
-    Double_t x = 0;
-    if (n == 1) {
-      if (fCurve1 != 0) x += (1 - l) / fCurve1 / fKappa1;
-      for (Int_t j = 0; j < fNPol1; j++) {
-        x += fK1[j] * TMath::Power(H2, j + 1);
+  // and in the slab of the bounding box
+  const Double_t margin = 1e-6;
+  Double_t zlo = fOrigin[2] - fDZ - margin;
+  Double_t zhi = fOrigin[2] + fDZ + margin;
+  if (dir[2] != 0) {
+    Double_t tz0 = (zlo - point[2]) / dir[2];
+    Double_t tz1 = (zhi - point[2]) / dir[2];
+    if (tz0 > tz1) std::swap(tz0, tz1);
+    t0 = TMath::Max(t0, tz0);
+    t1 = TMath::Min(t1, tz1);
+  } else if (point[2] < zlo or zhi < point[2]) {
+    return SolverMiss(count);
+  }
+  if (t0 >= t1) return SolverMiss(count);
+
+  // g(t) = z(t) - F(r(t)) and dg/dt
+  auto eval = [&](Double_t t, Double_t& g, Double_t& dg) {
+    Double_t x = point[0] + t * dir[0];
+    Double_t y = point[1] + t * dir[1];
+    Double_t r2 = x * x + y * y;
+    Double_t l = TMath::Sqrt(TMath::Max(1 - c2k * r2, 0.));
+    Double_t poly, dpoly;
+    EvalPolynomial(npol, k, r2, poly, dpoly);
+    g = point[2] + t * dir[2] - (z0 + r2 * curve / (1 + l) + poly);
+    Double_t dfdr2 = (curve != 0 ? curve / (2 * l) : 0) + dpoly;
+    dg = dir[2] - dfdr2 * 2 * (x * dir[0] + y * dir[1]);
+  };
+
+  const Double_t tolerance = 1e-10;
+
+  // safeguarded Newton iteration for the crossing in [lo, hi], where g
+  // changes its sign. Returns -1 for the crossing at the starting point and
+  // those in the hole.
+  auto refine = [&](Double_t lo, Double_t hi, Double_t glo, Double_t ghi) {
+    Double_t t = glo == ghi ? lo : lo - glo * (hi - lo) / (ghi - glo);
+    for (Int_t j = 0; j < kSolverIterations; j++) {
+      if (count) gSolverIterations.fetch_add(1, std::memory_order_relaxed);
+      if (profile) AGeoShapeProfiler::AddIterations(1);
+      Double_t g, dg;
+      eval(t, g, dg);
+      if (g == 0) break;
+      if ((g < 0) == (glo < 0)) {
+        lo = t;
+        glo = g;
+      } else {
+        hi = t;
       }
-    } else {
-      if (fCurve2 != 0) x += (1 - l) / fCurve2 / fKappa2;
-      for (int j = 0; j < fNPol2; j++) {
-        x += fK2[j] * TMath::Power(H2, j + 1);
+      Double_t next = dg != 0 and std::isfinite(dg) ? t - g / dg : lo;
+      if (not std::isfinite(next) or next <= lo or next >= hi) {
+        next = (lo + hi) / 2;
       }
+      Double_t step = next - t;
+      t = next;
+      if (TMath::Abs(step) < tolerance or hi - lo < tolerance) break;
     }
 
-    Double_t v = 0;
-    if (n == 1) {
-      for (int j = 0; j < fNPol1; j++) {
-        v += 2 * (j + 1) * fK1[j] * TMath::Power(H2, j);
+    Double_t x = point[0] + t * dir[0];
+    Double_t y = point[1] + t * dir[1];
+    return t > tolerance and x * x + y * y >= fRmin * fRmin ? t : -1.;
+  };
+
+  Double_t ta = t0, ga, dga;
+  eval(ta, ga, dga);
+  if (TMath::Abs(ga) < tolerance) {
+    ga = dga;  // the side the ray goes to when it starts on the surface
+  }
+  for (Int_t i = 1; i <= kSolverSamples; i++) {
+    Double_t tb = t0 + (t1 - t0) * i / kSolverSamples, gb, dgb;
+    eval(tb, gb, dgb);
+
+    Double_t t = -1;
+    if ((ga < 0 and gb < 0) or (ga > 0 and gb > 0)) {
+      if ((dga < 0) != (dgb < 0)) {
+        // g has an extremum in between, which is located by bisection on dg
+        // and splits the interval into two brackets if g changes its sign
+        Double_t lo = ta, hi = tb, dglo = dga, tm = ta, gm = ga, dgm;
+        for (Int_t j = 0; j < kSolverIterations; j++) {
+          if (count) gSolverIterations.fetch_add(1, std::memory_order_relaxed);
+          if (profile) AGeoShapeProfiler::AddIterations(1);
+          tm = (lo + hi) / 2;
+          eval(tm, gm, dgm);
+          if (gm != 0 and (gm < 0) != (ga < 0)) break;
+          if ((dgm < 0) == (dglo < 0)) {
+            lo = tm;
+            dglo = dgm;
+          } else {
+            hi = tm;
+          }
+          if (hi - lo < tolerance) break;
+        }
+        if (gm != 0 and (gm < 0) != (ga < 0)) {
+          t = refine(ta, tm, ga, gm);
+          if (t < 0) t = refine(tm, tb, gm, gb);
+        }
       }
-      v = fCurve1 * fKappa1 + l * v;
     } else {
-      for (Int_t j = 0; j < fNPol2; j++) {
-        v += 2 * (j + 1) * fK2[j] * TMath::Power(H2, j);
-      }
-      v = fCurve2 * fKappa2 + l * v;
-    }
-
-    Double_t m = -npoint[0] * v;
-    Double_t n = -npoint[1] * v;
-    Double_t norm = TMath::Sqrt(l * l + m * m + n * n);
-    l /= norm;
-    m /= norm;
-    n /= norm;
-
-    check = dir[2] * l + dir[0] * m + dir[1] * n;
-    if (check == 0) {
-      return TGeoShape::Big();
+      t = refine(ta, tb, ga, gb);
     }
+    if (t >= 0) return t;
 
-    Double_t e = l * (x - npoint[2]) / check;
-
-    for (Int_t j = 0; j < 3; j++) {
-      npoint[j] += e * dir[j];
-    }
-
-    if (TMath::Abs(e) < 1e-10) break;
-  }
-
-  npoint[2] += d;
-  check = dir[0] * (npoint[0] - point[0]) + dir[1] * (npoint[1] - point[1]) +
-          dir[2] * (npoint[2] - point[2]);
-  if (check < 0) {
-    return TGeoShape::Big();
-  }
-
-  Double_t dist_to_zaxis =
-      TMath::Power(npoint[0] * npoint[0] + npoint[1] * npoint[1], 0.5);
-  if (dist_to_zaxis < fRmin or dist_to_zaxis > fRmax) {
-    return TGeoShape::Big();
+    ta = tb;
+    ga = gb;
+    dga = dgb;
   }
 
-  return TMath::Sqrt(TMath::Power(npoint[0] - point[0], 2) +
-                     TMath::Power(npoint[1] - point[1], 2) +
-                     TMath::Power(npoint[2] - point[2], 2));
+  return SolverMiss(count);
 }
 
 //_____________________________________________________________________________
@@ -553,8 +571,8 @@ Double_t AGeoAsphericDisk::DistToInner(CONST53410 Double_t* point,
     return TGeoShape::Big();
   }
 
-  Double_t zmin = CalcF1(fRmin);
-  Double_t zmax = CalcF2(fRmin);
+  Double_t zmin = fEdgeSag[0][0];
+  Double_t zmax = fEdgeSag[1][0];
 
   if (t2 > 0) {
     if (t1 > 0) {
@@ -630,8 +648,8 @@ Double_t AGeoAsphericDisk::DistToOuter(CONST53410 Double_t* point,
     return TGeoShape::Big();
   }
 
-  Double_t zmin = CalcF1(fRmax);
-  Double_t zmax = CalcF2(fRmax);
+  Double_t zmin = fEdgeSag[0][1];
+  Double_t zmax = fEdgeSag[1][1];
 
   if (t2 > 0) {
     if (t1 > 0) {
@@ -690,6 +708,56 @@ TGeoVolume* AGeoAsphericDisk::Divide(TGeoVolume*, const char*, Int_t, Int_t,
   return 0;
 }
 
+//_____________________________________________________________________________
+void AGeoAsphericDisk::EnableSolverStatistics(Bool_t enable) {
+  // Count the calls, Newton iterations and misses of DistToAsphere of all
+  // the aspheric disks and all the threads
+  gSolverStatistics.store(enable);
+}
+
+//_____________________________________________________________________________
+void AGeoAsphericDisk::EvalPolynomial(Int_t n, const Double_t* k, Double_t h2,
+                                      Double_t& p, Double_t& dpdh2) {
+  // Evaluate the polynomial part of the sag p = sum k[j] h2^(j+1) and its
+  // derivative dp/dh2, where h2 = r^2, in Horner form. Polynomials up to the
+  // 20th order of r, which cover the usual correctors, run an unrolled loop.
+  switch (n) {
+    case 0:
+      p = dpdh2 = 0;
+      return;
+    case 1:
+      return EvalPolynomialN<1>(k, h2, p, dpdh2);
+    case 2:
+      return EvalPolynomialN<2>(k, h2, p, dpdh2);
+    case 3:
+      return EvalPolynomialN<3>(k, h2, p, dpdh2);
+    case 4:
+      return EvalPolynomialN<4>(k, h2, p, dpdh2);
+    case 5:
+      return EvalPolynomialN<5>(k, h2, p, dpdh2);
+    case 6:
+      return EvalPolynomialN<6>(k, h2, p, dpdh2);
+    case 7:
+      return EvalPolynomialN<7>(k, h2, p, dpdh2);
+    case 8:
+      return EvalPolynomialN<8>(k, h2, p, dpdh2);
+    case 9:
+      return EvalPolynomialN<9>(k, h2, p, dpdh2);
+    case 10:
+      return EvalPolynomialN<10>(k, h2, p, dpdh2);
+    default:
+      break;
+  }
+
+  Double_t q = 0, dq = 0;
+  for (Int_t j = n - 1; j >= 0; j--) {
+    dq = dq * h2 + q;
+    q = q * h2 + k[j];
+  }
+  p = q * h2;
+  dpdh2 = q + h2 * dq;
+}
+
 //_____________________________________________________________________________
 void AGeoAsphericDisk::GetBoundingCylinder(Double_t* param) const {
   //--- Fill vector param[4] with the bounding cylinder parameters. The order
@@ -767,6 +835,16 @@ Int_t AGeoAsphericDisk::GetNmeshVertices() const {
   return nbPnts;
 }
 
+//_____________________________________________________________________________
+void AGeoAsphericDisk::GetSolverStatistics(ULong64_t& calls,
+                                           ULong64_t& iterations,
+                                           ULong64_t& misses) {
+  // Return the counters enabled by EnableSolverStatistics
+  calls = gSolverCalls.load();
+  iterations = gSolverIterations.load();
+  misses = gSolverMisses.load();
+}
+
 //_____________________________________________________________________________
 void AGeoAsphericDisk::InspectShape() const {
   // print shape parameters
@@ -815,6 +893,13 @@ TBuffer3D* AGeoAsphericDisk::MakeBuffer3D() const {
   return buff;
 }
 
+//_____________________________________________________________________________
+void AGeoAsphericDisk::ResetSolverStatistics() {
+  gSolverCalls.store(0);
+  gSolverIterations.store(0);
+  gSolverMisses.store(0);
+}
+
 //_____________________________________________________________________________
 Double_t AGeoAsphericDisk::Safety(CONST53410 Double_t* point, Bool_t in) const {
   Double_t safe;
@@ -825,27 +910,9 @@ Double_t AGeoAsphericDisk::Safety(CONST53410 Double_t* point, Bool_t in) const {
   Double_t dist[4];
 
   if (!in) {
-    Double_t f1rmax, f1rmin, f2rmax, f2rmin;
-    try {
-      f1rmax = CalcF1(fRmax);
-    } catch (...) {
-      f1rmax = -TGeoShape::Big();
-    }
-    try {
-      f1rmin = CalcF1(fRmin);
-    } catch (...) {
-      f1rmin = -TGeoShape::Big();
-    }
-    try {
-      f2rmax = CalcF2(fRmax);
-    } catch (...) {
-      f2rmax = TGeoShape::Big();
-    }
-    try {
-      f2rmin = CalcF2(fRmin);
-    } catch (...) {
-      f2rmin = TGeoShape::Big();
-    }
+    // the edge sags are cached by UpdateEdgeSags
+    Double_t f1rmin = fEdgeSag[0][0], f1rmax = fEdgeSag[0][1];
+    Double_t f2rmin = fEdgeSag[1][0], f2rmax = fEdgeSag[1][1];
 
     if (rad < fRmin and (f1rmin < point[2] or point[2] < f2rmin)) {
       return fRmin - rad;
@@ -863,12 +930,7 @@ Double_t AGeoAsphericDisk::Safety(CONST53410 Double_t* point, Bool_t in) const {
     Double_t r_ = r1;
     for (Int_t j = 0; j <= fSteps + 1; j++) {
       Double_t r = r1 + j * step;
-      Double_t f;
-      try {
-        f = CalcF1(r);
-      } catch (...) {
-        f = -TGeoShape::Big();
-      }
+      Double_t f = SagOrDefault(1, r, -TGeoShape::Big());
       Double_t d2 = (f - point[2]) * (f - point[2]) + (r - rad) * (r - rad);
       if (d2 < dist[0]) {
         dist[0] = d2;
@@ -889,12 +951,7 @@ Double_t AGeoAsphericDisk::Safety(CONST53410 Double_t* point, Bool_t in) const {
     Double_t r_ = r1;
     for (Int_t j = 0; j <= fSteps + 1; j++) {
       Double_t r = r1 + j * step;
-      Double_t f;
-      try {
-        f = CalcF2(r);
-      } catch (...) {
-        f = TGeoShape::Big();
-      }
+      Double_t f = SagOrDefault(2, r, TGeoShape::Big());
       Double_t d2 = (f - point[2]) * (f - point[2]) + (r - rad) * (r - rad);
       if (d2 < dist[1]) {
         dist[1] = d2;
@@ -971,6 +1028,9 @@ void AGeoAsphericDisk::SavePrimitive(std::ostream& out, Option_t*) {
 void AGeoAsphericDisk::SetAsphDimensions(Double_t z1, Double_t curve1,
                                          Double_t z2, Double_t curve2,
                                          Double_t rmax, Double_t rmin) {
+  // Set the dimensions, which can be changed after the geometry is closed
+  // (see AOpticsManager::UpdateShape). The conic constants are kept, while
+  // the polynomial coefficients are cleared and must be set again.
   if (z1 < z2) {
     fZ1 = z1;
     fZ2 = z2;
@@ -996,11 +1056,14 @@ void AGeoAsphericDisk::SetAsphDimensions(Double_t z1, Double_t curve1,
 
   if (fRmin > 0) {
     SetShapeBit(kGeoRSeg);
+  } else {
+    ResetShapeBit(kGeoRSeg);
   }
+  DeleteArrays();
   fNPol1 = 0;
   fNPol2 = 0;
-  fK1 = 0;
-  fK2 = 0;
+
+  ComputeBBox();
 }
 
 //_____________________________________________________________________________
@@ -1041,19 +1104,11 @@ void AGeoAsphericDisk::SetPoints(Double_t* points) const {
           Int_t index = 3 * (i * n + j);  // lower
           points[index] = r * cos(phi);
           points[index + 1] = r * sin(phi);
-          try {
-            points[index + 2] = CalcF1(r);
-          } catch (...) {
-            points[index + 2] = -TGeoShape::Big();
-          }
+          points[index + 2] = SagOrDefault(1, r, -TGeoShape::Big());
           Int_t index2 = index + 3 * n * (n + 1);  // upper
           points[index2] = points[index];
           points[index2 + 1] = points[index + 1];
-          try {
-            points[index2 + 2] = CalcF2(r);
-          } catch (...) {
-            points[index2 + 2] = TGeoShape::Big();
-          }
+          points[index2 + 2] = SagOrDefault(2, r, TGeoShape::Big());
         }
       }
     } else {
@@ -1067,19 +1122,11 @@ void AGeoAsphericDisk::SetPoints(Double_t* points) const {
           Int_t index = 3 * (i * n + j);  // lower
           points[index] = r * cos(phi);
           points[index + 1] = r * sin(phi);
-          try {
-            points[index + 2] = CalcF1(r);
-          } catch (...) {
-            points[index + 2] = -TGeoShape::Big();
-          }
+          points[index + 2] = SagOrDefault(1, r, -TGeoShape::Big());
           Int_t index2 = index + 3 * n * n;  // upper
           points[index2] = points[index];
           points[index2 + 1] = points[index + 1];
-          try {
-            points[index2 + 2] = CalcF2(r);
-          } catch (...) {
-            points[index2 + 2] = TGeoShape::Big();
-          }
+          points[index2 + 2] = SagOrDefault(2, r, TGeoShape::Big());
         }
       }
       // lower center 2*n*n
@@ -1087,18 +1134,10 @@ void AGeoAsphericDisk::SetPoints(Double_t* points) const {
       Int_t index = 3 * 2 * n * n;
       points[index] = 0;
       points[index + 1] = 0;
-      try {
-        points[index + 2] = CalcF1(0);
-      } catch (...) {
-        points[index + 2] = -TGeoShape::Big();
-      }
+      points[index + 2] = SagOrDefault(1, 0, -TGeoShape::Big());
       points[index + 3] = 0;
       points[index + 4] = 0;
-      try {
-        points[index + 5] = CalcF2(0);
-      } catch (...) {
-        points[index + 5] = -TGeoShape::Big();
-      }
+      points[index + 5] = SagOrDefault(2, 0, -TGeoShape::Big());
     }
   }
 }
@@ -1121,19 +1160,11 @@ void AGeoAsphericDisk::SetPoints(Float_t* points) const {
           Int_t index = 3 * (i * n + j);  // lower
           points[index] = r * cos(phi);
           points[index + 1] = r * sin(phi);
-          try {
-            points[index + 2] = CalcF1(r);
-          } catch (...) {
-            points[index + 2] = -TGeoShape::Big();
-          }
+          points[index + 2] = SagOrDefault(1, r, -TGeoShape::Big());
           Int_t index2 = index + 3 * n * (n + 1);  // upper
           points[index2] = points[index];
           points[index2 + 1] = points[index + 1];
-          try {
-            points[index2 + 2] = CalcF2(r);
-          } catch (...) {
-            points[index2 + 2] = TGeoShape::Big();
-          }
+          points[index2 + 2] = SagOrDefault(2, r, TGeoShape::Big());
         }
       }
     } else {
@@ -1147,19 +1178,11 @@ void AGeoAsphericDisk::SetPoints(Float_t* points) const {
           Int_t index = 3 * (i * n + j);  // lower
           points[index] = r * cos(phi);
           points[index + 1] = r * sin(phi);
-          try {
-            points[index + 2] = CalcF1(r);
-          } catch (...) {
-            points[index + 2] = -TGeoShape::Big();
-          }
+          points[index + 2] = SagOrDefault(1, r, -TGeoShape::Big());
           Int_t index2 = index + 3 * n * n;  // upper
           points[index2] = points[index];
           points[index2 + 1] = points[index + 1];
-          try {
-            points[index2 + 2] = CalcF2(r);
-          } catch (...) {
-            points[index2 + 2] = TGeoShape::Big();
-          }
+          points[index2 + 2] = SagOrDefault(2, r, TGeoShape::Big());
         }
       }
       // lower center 2*n*n
@@ -1167,18 +1190,10 @@ void AGeoAsphericDisk::SetPoints(Float_t* points) const {
       Int_t index = 3 * 2 * n * n;
       points[index] = 0;
       points[index + 1] = 0;
-      try {
-        points[index + 2] = CalcF1(0);
-      } catch (...) {
-        points[index + 2] = -TGeoShape::Big();
-      }
+      points[index + 2] = SagOrDefault(1, 0, -TGeoShape::Big());
       points[index + 3] = 0;
       points[index + 4] = 0;
-      try {
-        points[index + 5] = CalcF2(0);
-      } catch (...) {
-        points[index + 5] = -TGeoShape::Big();
-      }
+      points[index + 5] = SagOrDefault(2, 0, -TGeoShape::Big());
     }
   }
 }
@@ -1395,3 +1410,33 @@ void AGeoAsphericDisk::SetSegsAndPols(TBuffer3D& buff) const {
 void AGeoAsphericDisk::Sizeof3D() const {
   ///// obsolete - to be removed
 }
+
+//_____________________________________________________________________________
+void AGeoAsphericDisk::Streamer(TBuffer& R__b) {
+  // The cached edge sags are not written, but updated after reading
+  if (R__b.IsReading()) {
+    R__b.ReadClassBuffer(AGeoAsphericDisk::Class(), this);
+    UpdateEdgeSags();
+  } else {
+    R__b.WriteClassBuffer(AGeoAsphericDisk::Class(), this);
+  }
+}
+
+//_____________________________________________________________________________
+void AGeoAsphericDisk::UpdateEdgeSags() {
+  // Cache the sags at fRmin and fRmax and the radii within which the conics
+  // are defined, which are used by Safety, DistToInner/Outer and DistToAsphere
+  // on every call. This is called by ComputeBBox whenever the parameters are
+  // changed. A sag outside the domain is -Big (surface 1) or +Big (surface 2).
+  const Double_t radius[2] = {fRmin, fRmax};
+  for (Int_t i = 0; i < 2; i++) {
+    Double_t outside = i == 0 ? -TGeoShape::Big() : TGeoShape::Big();
+    for (Int_t j = 0; j < 2; j++) {
+      fEdgeSag[i][j] = SagOrDefault(i + 1, radius[j], outside);
+    }
+
+    Double_t curve = i == 0 ? fCurve1 : fCurve2;
+    Double_t c2k = curve * curve * (i == 0 ? fKappa1 : fKappa2);
+    fRdomain[i] = c2k > 0 ? TMath::Min(fRmax, 1 / TMath::Sqrt(c2k)) : fRmax;
+  }
+}
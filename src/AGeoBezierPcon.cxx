@@ -12,12 +12,16 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <vector>
+
 #include "AGeoBezierPcon.h"
+#include "AGeoUtil.h"
 
 ClassImp(AGeoBezierPcon);
 
 //_____________________________________________________________________________
-AGeoBezierPcon::AGeoBezierPcon() : TGeoPcon() {
+AGeoBezierPcon::AGeoBezierPcon()
+    : TGeoPcon(), fNcontrol(0), fMaxDeviation(0), fMaxSections(0) {
   // Default constructor
 }
 
@@ -26,6 +30,8 @@ AGeoBezierPcon::AGeoBezierPcon(Double_t phi, Double_t dphi, Int_t nz,
                                Double_t r1, Double_t r2, Double_t dz)
     : TGeoPcon(phi, dphi, nz), fLength(dz * 2), fR1(r1), fR2(r2) {
   fNcontrol = 0;
+  fMaxDeviation = 0;
+  fMaxSections = nz;
 }
 
 //_____________________________________________________________________________
@@ -33,6 +39,8 @@ AGeoBezierPcon::AGeoBezierPcon(const char* name, Double_t phi, Double_t dphi,
                                Int_t nz, Double_t r1, Double_t r2, Double_t dz)
     : TGeoPcon(name, phi, dphi, nz), fLength(dz * 2), fR1(r1), fR2(r2) {
   fNcontrol = 0;
+  fMaxDeviation = 0;
+  fMaxSections = nz;
 }
 
 //_____________________________________________________________________________
@@ -94,10 +102,40 @@ void AGeoBezierPcon::SetControlPoints(Double_t r1, Double_t z1, Double_t r2,
 
 //_____________________________________________________________________________
 void AGeoBezierPcon::SetSections() {
-  for (Int_t i = 0; i < fNz; i++) {
-    Double_t t = Double_t(i) / (fNz - 1);
+  // Define the sections approximating the Bezier curve. By default, nz
+  // sections given to the constructor are placed at uniform steps of t. If
+  // SetMaxDeviation has been called with a positive radial deviation, the
+  // sections are instead placed adaptively by AGeoUtil::AdaptiveSections,
+  // i.e., densely where the curve is strongly bent and sparsely where it is
+  // nearly straight, up to SetMaxSections (nz by default). The number of
+  // sections then changes, and fewer sections make the navigation faster.
+  if (fMaxDeviation <= 0) {
+    for (Int_t i = 0; i < fNz; i++) {
+      Double_t t = Double_t(i) / (fNz - 1);
+      Double_t r, z;
+      Bezier(t, r, z);
+      DefineSection(i, z, 0, r);
+    }
+    return;
+  }
+
+  std::vector<Double_t> t;
+  AGeoUtil::AdaptiveSections(
+      [this](Double_t ti, Double_t& r, Double_t& z) { Bezier(ti, r, z); },
+      fMaxDeviation, fMaxSections, t);
+
+  // SetDimensions reallocates the arrays of the sections
+  Int_t n = Int_t(t.size());
+  std::vector<Double_t> param(3 + 3 * n);
+  param[0] = fPhi1;
+  param[1] = fDphi;
+  param[2] = n;
+  for (Int_t i = 0; i < n; i++) {
     Double_t r, z;
-    Bezier(t, r, z);
-    DefineSection(i, z, 0, r);
+    Bezier(t[i], r, z);
+    param[3 + 3 * i] = z;
+    param[3 + 3 * i + 1] = 0;
+    param[3 + 3 * i + 2] = r;
   }
+  SetDimensions(&param[0]);
 }
@@ -0,0 +1,984 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AGeoSegmentedMirror
+//
+// Geometry class for segmented mirrors, e.g., Davies-Cotton dishes, made of
+// many spherical facets in a single shape. Each facet is a spherical shell of
+// a common thickness, whose outline projected along its axis is a regular
+// polygon or a circle. A facet is defined by the center of its reflective
+// surface, its axis directed to its center of curvature, its radius of
+// curvature and the inscribed radius of its outline.
+//
+// The facets are stored in flat arrays and registered in a uniform 2D grid
+// over the XY plane, which is traversed along rays. A single node of AMirror
+// thus replaces hundreds of mirror nodes and the voxelization over them.
+// FindHit returns the distance, the facet ID and the normal of a hit at once.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "AGeoSegmentedMirror.h"
+
+#include <algorithm>
+
+#include "Riostream.h"
+#include "TBuffer3D.h"
+#include "TBuffer3DTypes.h"
+#include "TGeoManager.h"
+#include "TMath.h"
+
+ClassImp(AGeoSegmentedMirror);
+
+namespace {
+
+const Double_t kTolerance = 1e-9;  // tolerance of boundary crossings
+const Int_t kMaxCells = 2048;      // max number of grid cells along X/Y
+
+void DefaultAxisU(const Double_t* n, Double_t* u) {
+  // Project the X axis (or the Y axis) onto the plane perpendicular to n
+  Double_t ref[3] = {1, 0, 0};
+  if (TMath::Abs(n[0]) > 0.9) {
+    ref[0] = 0;
+    ref[1] = 1;
+  }
+  Double_t dot = ref[0] * n[0] + ref[1] * n[1] + ref[2] * n[2];
+  Double_t norm = 0;
+  for (Int_t j = 0; j < 3; j++) {
+    u[j] = ref[j] - dot * n[j];
+    norm += u[j] * u[j];
+  }
+  norm = TMath::Sqrt(norm);
+  for (Int_t j = 0; j < 3; j++) u[j] /= norm;
+}
+
+void Cross(const Double_t* a, const Double_t* b, Double_t* c) {
+  c[0] = a[1] * b[2] - a[2] * b[1];
+  c[1] = a[2] * b[0] - a[0] * b[2];
+  c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+}  // namespace
+
+//_____________________________________________________________________________
+AGeoSegmentedMirror::AGeoSegmentedMirror()
+    : TGeoBBox(0, 0, 0),
+      fThickness(0),
+      fOutlineN(6),
+      fGridReady(kFALSE),
+      fGridX0(0),
+      fGridY0(0),
+      fCellSize(0),
+      fNx(0),
+      fNy(0) {
+  // Default constructor
+  SetShapeBit(TGeoShape::kGeoBox);
+}
+
+//_____________________________________________________________________________
+AGeoSegmentedMirror::AGeoSegmentedMirror(Double_t thickness, Int_t outlineN)
+    : TGeoBBox(0, 0, 0),
+      fThickness(TMath::Abs(thickness)),
+      fOutlineN(outlineN >= 3 ? outlineN : 0),
+      fGridReady(kFALSE),
+      fGridX0(0),
+      fGridY0(0),
+      fCellSize(0),
+      fNx(0),
+      fNy(0) {
+  SetShapeBit(TGeoShape::kGeoBox);
+  ComputeBBox();
+}
+
+//_____________________________________________________________________________
+AGeoSegmentedMirror::AGeoSegmentedMirror(const char* name, Double_t thickness,
+                                         Int_t outlineN)
+    : TGeoBBox(name, 0, 0, 0),
+      fThickness(TMath::Abs(thickness)),
+      fOutlineN(outlineN >= 3 ? outlineN : 0),
+      fGridReady(kFALSE),
+      fGridX0(0),
+      fGridY0(0),
+      fCellSize(0),
+      fNx(0),
+      fNy(0) {
+  SetShapeBit(TGeoShape::kGeoBox);
+  ComputeBBox();
+}
+
+//_____________________________________________________________________________
+AGeoSegmentedMirror::~AGeoSegmentedMirror() {
+  // Destructor
+}
+
+//_____________________________________________________________________________
+Int_t AGeoSegmentedMirror::AddFacet(Double_t x, Double_t y, Double_t z,
+                                    Double_t nx, Double_t ny, Double_t nz,
+                                    Double_t radius, Double_t size,
+                                    Double_t rotation) {
+  // Add a facet whose reflective surface is centered at (x, y, z). The axis
+  // (nx, ny, nz) must be directed to the center of curvature, i.e., toward
+  // the focal plane. The outline is rotated by rotation around the axis.
+  // Return the ID of the facet, or -1 if the parameters are invalid.
+  if (nx * nx + ny * ny + nz * nz == 0 or radius <= 0 or size <= 0) {
+    Error("AddFacet", "Invalid facet (radius = %f, size = %f)", radius, size);
+    return -1;
+  }
+
+  Int_t i = GetNfacets();
+  fCenter.resize(3 * (i + 1));
+  fNormal.resize(3 * (i + 1));
+  fAxisU.resize(3 * (i + 1));
+  fCurvatureRadius.resize(i + 1);
+  fSize.resize(i + 1);
+  StoreFacet(i, x, y, z, nx, ny, nz, radius, size, rotation);
+
+  ComputeBBox();
+
+  return i;
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::BuildGrid() const {
+  // Register the facets in the cells of the grid which overlap with the XY
+  // projections of the bounding spheres of the facets
+  std::lock_guard<std::mutex> lock(fGridMutex);
+  if (fGridReady.load(std::memory_order_relaxed)) return;
+
+  Int_t n = GetNfacets();
+  fBoundingRadius.resize(n);
+  Double_t mean = 0;
+  for (Int_t i = 0; i < n; i++) {
+    fBoundingRadius[i] = CalcBoundingRadius(i);
+    mean += fBoundingRadius[i] / n;
+  }
+
+  fSideCos.resize(fOutlineN);
+  fSideSin.resize(fOutlineN);
+  for (Int_t j = 0; j < fOutlineN; j++) {
+    fSideCos[j] = TMath::Cos(TMath::TwoPi() * j / fOutlineN);
+    fSideSin[j] = TMath::Sin(TMath::TwoPi() * j / fOutlineN);
+  }
+
+  // cells as large as a facet
+  fGridX0 = fOrigin[0] - fDX;
+  fGridY0 = fOrigin[1] - fDY;
+  fCellSize = TMath::Max(2 * mean, 2 * TMath::Max(fDX, fDY) / kMaxCells);
+  if (fCellSize <= 0) fCellSize = 1;
+  fNx = TMath::Max(1, Int_t(TMath::Ceil(2 * fDX / fCellSize)));
+  fNy = TMath::Max(1, Int_t(TMath::Ceil(2 * fDY / fCellSize)));
+
+  std::vector<Int_t> count(fNx * fNy + 1, 0);
+  for (Int_t pass = 0; pass < 2; pass++) {
+    for (Int_t i = 0; i < n; i++) {
+      Double_t r = fBoundingRadius[i];
+      Double_t x = fCenter[3 * i], y = fCenter[3 * i + 1];
+      Int_t ix0 = TMath::Max(0, Int_t((x - r - fGridX0) / fCellSize));
+      Int_t ix1 = TMath::Min(fNx - 1, Int_t((x + r - fGridX0) / fCellSize));
+      Int_t iy0 = TMath::Max(0, Int_t((y - r - fGridY0) / fCellSize));
+      Int_t iy1 = TMath::Min(fNy - 1, Int_t((y + r - fGridY0) / fCellSize));
+      for (Int_t iy = iy0; iy <= iy1; iy++) {
+        for (Int_t ix = ix0; ix <= ix1; ix++) {
+          Int_t cell = ix + iy * fNx;
+          if (pass == 0) {
+            count[cell + 1]++;
+          } else {
+            fCellFacets[count[cell]++] = i;
+          }
+        }
+      }
+    }
+
+    if (pass == 0) {
+      for (Int_t cell = 0; cell < fNx * fNy; cell++) {
+        count[cell + 1] += count[cell];
+      }
+      fCellStart = count;
+      fCellFacets.resize(count[fNx * fNy]);
+    }
+  }
+
+  fGridReady.store(kTRUE, std::memory_order_release);
+}
+
+//_____________________________________________________________________________
+Double_t AGeoSegmentedMirror::CalcBoundingRadius(Int_t i) const {
+  // Return the radius of the sphere around the facet center which contains
+  // the whole facet
+  Double_t R = fCurvatureRadius[i];
+  Double_t d =
+      fOutlineN > 0 ? fSize[i] / TMath::Cos(TMath::Pi() / fOutlineN) : fSize[i];
+  Double_t sag = R - TMath::Sqrt(TMath::Max(R * R - d * d, 0.));
+  Double_t h = TMath::Max(sag, fThickness);
+
+  return TMath::Sqrt(d * d + h * h) + kTolerance;
+}
+
+//_____________________________________________________________________________
+Double_t AGeoSegmentedMirror::Capacity() const {
+  // Compute capacity of the shape in [length^3]
+  Double_t area = 0;
+  for (Int_t i = 0; i < GetNfacets(); i++) {
+    Double_t a = fSize[i];
+    area += fOutlineN > 0
+                ? fOutlineN * a * a * TMath::Tan(TMath::Pi() / fOutlineN)
+                : TMath::Pi() * a * a;
+  }
+
+  return area * fThickness;
+}
+
+//_____________________________________________________________________________
+Int_t AGeoSegmentedMirror::CellIndex(Double_t x, Double_t y) const {
+  // Return the index of the grid cell at (x, y), or -1 if out of the grid
+  Double_t fx = (x - fGridX0) / fCellSize;
+  Double_t fy = (y - fGridY0) / fCellSize;
+  if (fx < 0 or fy < 0 or fx >= fNx or fy >= fNy) return -1;
+
+  return Int_t(fx) + Int_t(fy) * fNx;
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::ComputeBBox() {
+  // Compute bounding box of the shape
+  fGridReady.store(kFALSE);
+
+  Int_t n = GetNfacets();
+  if (n == 0) {
+    fDX = fDY = fDZ = 0;
+    fOrigin[0] = fOrigin[1] = fOrigin[2] = 0;
+    return;
+  }
+
+  Double_t lo[3], hi[3];
+  for (Int_t j = 0; j < 3; j++) {
+    lo[j] = TGeoShape::Big();
+    hi[j] = -TGeoShape::Big();
+  }
+  for (Int_t i = 0; i < n; i++) {
+    Double_t r = CalcBoundingRadius(i);
+    for (Int_t j = 0; j < 3; j++) {
+      lo[j] = TMath::Min(lo[j], fCenter[3 * i + j] - r);
+      hi[j] = TMath::Max(hi[j], fCenter[3 * i + j] + r);
+    }
+  }
+
+  fDX = (hi[0] - lo[0]) / 2;
+  fDY = (hi[1] - lo[1]) / 2;
+  fDZ = (hi[2] - lo[2]) / 2;
+  for (Int_t j = 0; j < 3; j++) fOrigin[j] = (hi[j] + lo[j]) / 2;
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::ComputeNormal(CONST53410 Double_t* point,
+                                        CONST53410 Double_t* dir,
+                                        Double_t* norm) {
+  // Compute normal to closest surface from POINT.
+  Int_t i = FindFacet(point);
+  if (i < 0) {
+    TGeoBBox::ComputeNormal(point, dir, norm);
+    return;
+  }
+
+  GetFacetNormal(i, point, norm);
+
+  if (norm[0] * dir[0] + norm[1] * dir[1] + norm[2] * dir[2] < 0) {
+    norm[0] = -norm[0];
+    norm[1] = -norm[1];
+    norm[2] = -norm[2];
+  }
+}
+
+//_____________________________________________________________________________
+Bool_t AGeoSegmentedMirror::Contains(CONST53410 Double_t* point) const {
+  // Test if point is in this shape
+  Double_t margin;
+
+  return FindFacet(point, margin) >= 0 and margin >= 0;
+}
+
+//_____________________________________________________________________________
+Int_t AGeoSegmentedMirror::DistancetoPrimitive(Int_t px, Int_t py) {
+  // compute closest distance from point px,py to each corner
+  return ShapeDistancetoPrimitive(GetNmeshVertices(), px, py);
+}
+
+//_____________________________________________________________________________
+Double_t AGeoSegmentedMirror::DistFromInside(CONST53410 Double_t* point,
+                                             CONST53410 Double_t* dir,
+                                             Int_t iact, Double_t step,
+                                             Double_t* safe) const {
+  // compute distance from inside point to surface of the facet
+
+  // compute safe distance
+  if (iact < 3 and safe) {
+    *safe = Safety(point, kTRUE);
+    if (iact == 0) return TGeoShape::Big();
+    if (iact == 1 && step < *safe) return TGeoShape::Big();
+  }
+
+  // calculate distance
+  Int_t i = FindFacet(point);
+  if (i < 0) return 0;
+
+  return DistToFacet(i, point, dir);
+}
+
+//_____________________________________________________________________________
+Double_t AGeoSegmentedMirror::DistFromOutside(CONST53410 Double_t* point,
+                                              CONST53410 Double_t* dir,
+                                              Int_t iact, Double_t step,
+                                              Double_t* safe) const {
+  // compute distance from outside point to surface of the facets
+
+  // compute safe distance
+  if (iact < 3 and safe) {
+    *safe = Safety(point, kFALSE);
+    if (iact == 0) return TGeoShape::Big();
+    if (iact == 1 && step < *safe) return TGeoShape::Big();
+  }
+
+  // calculate distance
+  Int_t facet;
+
+  return FindHit(point, dir, facet);
+}
+
+//_____________________________________________________________________________
+Double_t AGeoSegmentedMirror::DistToFacet(Int_t i, const Double_t* point,
+                                          const Double_t* dir) const {
+  // Compute the distance to the first boundary crossing of facet i. All the
+  // crossings with the two spheres and the sides of the outline are tested
+  // whether they are on the boundary of the facet.
+  Double_t r = fBoundingRadius[i];
+  Double_t e[3] = {point[0] - fCenter[3 * i], point[1] - fCenter[3 * i + 1],
+                   point[2] - fCenter[3 * i + 2]};
+  Double_t b = e[0] * dir[0] + e[1] * dir[1] + e[2] * dir[2];
+  Double_t c = e[0] * e[0] + e[1] * e[1] + e[2] * e[2] - r * r;
+  if (c > 0 and (b > 0 or b * b < c)) {
+    return TGeoShape::Big();  // the ray misses the bounding sphere
+  }
+
+  Double_t lp[3], ld[3];
+  ToLocal(i, point, lp);
+  ToLocalDir(i, dir, ld);
+
+  Double_t best = TGeoShape::Big();
+  auto test = [&](Double_t t) {
+    if (t <= kTolerance or t >= best) return;
+    Double_t q[3] = {lp[0] + t * ld[0], lp[1] + t * ld[1], lp[2] + t * ld[2]};
+    if (FacetMargin(i, q) >= -kTolerance) best = t;
+  };
+
+  // the reflective surface and the back surface
+  Double_t R = fCurvatureRadius[i];
+  Double_t ec[3] = {lp[0], lp[1], lp[2] - R};
+  Double_t bc = ec[0] * ld[0] + ec[1] * ld[1] + ec[2] * ld[2];
+  Double_t e2 = ec[0] * ec[0] + ec[1] * ec[1] + ec[2] * ec[2];
+  for (Int_t k = 0; k < 2; k++) {
+    Double_t rho = k == 0 ? R : R + fThickness;
+    Double_t disc = bc * bc - (e2 - rho * rho);
+    if (disc < 0) continue;
+    disc = TMath::Sqrt(disc);
+    test(-bc - disc);
+    test(-bc + disc);
+  }
+
+  // the sides of the outline
+  Double_t a = fSize[i];
+  if (fOutlineN > 0) {
+    for (Int_t j = 0; j < fOutlineN; j++) {
+      Double_t den = ld[0] * fSideCos[j] + ld[1] * fSideSin[j];
+      if (den == 0) continue;
+      test((a - lp[0] * fSideCos[j] - lp[1] * fSideSin[j]) / den);
+    }
+  } else {
+    Double_t A = ld[0] * ld[0] + ld[1] * ld[1];
+    Double_t B = lp[0] * ld[0] + lp[1] * ld[1];
+    Double_t C = lp[0] * lp[0] + lp[1] * lp[1] - a * a;
+    Double_t disc = B * B - A * C;
+    if (A > 0 and disc >= 0) {
+      disc = TMath::Sqrt(disc);
+      test((-B - disc) / A);
+      test((-B + disc) / A);
+    }
+  }
+
+  return best;
+}
+
+//_____________________________________________________________________________
+TGeoVolume* AGeoSegmentedMirror::Divide(TGeoVolume*, const char*, Int_t, Int_t,
+                                        Double_t, Double_t) {
+  Error("Divide", "Division of a segmented mirror is not implemented");
+  return 0;
+}
+
+//_____________________________________________________________________________
+Double_t AGeoSegmentedMirror::FacetMargin(Int_t i,
+                                          const Double_t* local) const {
+  // Return the signed distance from a point in the local frame of facet i to
+  // the closest surface among those bounding the facet. This is positive
+  // inside the facet, and a lower limit of the distance to its boundary.
+  Double_t R = fCurvatureRadius[i];
+  Double_t dz = local[2] - R;
+  Double_t d =
+      TMath::Sqrt(local[0] * local[0] + local[1] * local[1] + dz * dz);
+  Double_t margin = TMath::Min(d - R, R + fThickness - d);
+  margin = TMath::Min(margin, -dz);  // the half close to the facet center
+
+  Double_t a = fSize[i];
+  if (fOutlineN > 0) {
+    for (Int_t j = 0; j < fOutlineN; j++) {
+      margin = TMath::Min(
+          margin, a - local[0] * fSideCos[j] - local[1] * fSideSin[j]);
+    }
+  } else {
+    margin = TMath::Min(
+        margin, a - TMath::Sqrt(local[0] * local[0] + local[1] * local[1]));
+  }
+
+  return margin;
+}
+
+//_____________________________________________________________________________
+Int_t AGeoSegmentedMirror::FindFacet(const Double_t* point) const {
+  // Return the ID of the facet which contains point or is the closest to it
+  // among those registered in the grid cell of point, or -1 if none
+  Double_t margin;
+
+  return FindFacet(point, margin);
+}
+
+//_____________________________________________________________________________
+Int_t AGeoSegmentedMirror::FindFacet(const Double_t* point,
+                                     Double_t& margin) const {
+  PrepareGrid();
+  margin = -TGeoShape::Big();
+
+  Int_t cell = CellIndex(point[0], point[1]);
+  if (cell < 0) return -1;
+
+  Int_t found = -1;
+  for (Int_t k = fCellStart[cell]; k < fCellStart[cell + 1]; k++) {
+    Int_t i = fCellFacets[k];
+    Double_t local[3];
+    ToLocal(i, point, local);
+    Double_t m = FacetMargin(i, local);
+    if (m > margin) {
+      margin = m;
+      found = i;
+    }
+  }
+
+  return found;
+}
+
+//_____________________________________________________________________________
+Double_t AGeoSegmentedMirror::FindHit(const Double_t* point,
+                                      const Double_t* dir, Int_t& facet,
+                                      Double_t* norm) const {
+  // Compute the distance from an outside point to the facets along dir. The
+  // ID of the facet hit is returned in facet (-1 if none), and its outward
+  // normal at the hit point in norm if given. The grid cells are traversed
+  // in the order of the ray, and the traversal stops when the closest hit so
+  // far is within the current cell.
+  PrepareGrid();
+  facet = -1;
+  if (GetNfacets() == 0) return TGeoShape::Big();
+
+  // range of the ray inside the bounding box
+  Double_t t0 = 0, t1 = TGeoShape::Big();
+  Double_t half[3] = {fDX, fDY, fDZ};
+  for (Int_t j = 0; j < 3; j++) {
+    Double_t lo = fOrigin[j] - half[j] - kTolerance;
+    Double_t hi = fOrigin[j] + half[j] + kTolerance;
+    if (dir[j] != 0) {
+      Double_t ta = (lo - point[j]) / dir[j];
+      Double_t tb = (hi - point[j]) / dir[j];
+      if (ta > tb) std::swap(ta, tb);
+      t0 = TMath::Max(t0, ta);
+      t1 = TMath::Min(t1, tb);
+    } else if (point[j] < lo or hi < point[j]) {
+      return TGeoShape::Big();
+    }
+  }
+  if (t0 > t1) return TGeoShape::Big();
+
+  Double_t x = point[0] + t0 * dir[0];
+  Double_t y = point[1] + t0 * dir[1];
+  Int_t ix = TMath::Max(0, TMath::Min(fNx - 1, Int_t(TMath::Floor(
+                                                   (x - fGridX0) / fCellSize))));
+  Int_t iy = TMath::Max(0, TMath::Min(fNy - 1, Int_t(TMath::Floor(
+                                                   (y - fGridY0) / fCellSize))));
+
+  Int_t stepx = dir[0] > 0 ? 1 : -1;
+  Int_t stepy = dir[1] > 0 ? 1 : -1;
+  Double_t tmaxx = TGeoShape::Big(), tdeltax = TGeoShape::Big();
+  Double_t tmaxy = TGeoShape::Big(), tdeltay = TGeoShape::Big();
+  if (dir[0] != 0) {
+    Double_t edge = fGridX0 + (ix + (stepx > 0 ? 1 : 0)) * fCellSize;
+    tmaxx = t0 + (edge - x) / dir[0];
+    tdeltax = fCellSize / TMath::Abs(dir[0]);
+  }
+  if (dir[1] != 0) {
+    Double_t edge = fGridY0 + (iy + (stepy > 0 ? 1 : 0)) * fCellSize;
+    tmaxy = t0 + (edge - y) / dir[1];
+    tdeltay = fCellSize / TMath::Abs(dir[1]);
+  }
+
+  Double_t best = TGeoShape::Big();
+  while (true) {
+    Int_t cell = ix + iy * fNx;
+    for (Int_t k = fCellStart[cell]; k < fCellStart[cell + 1]; k++) {
+      Int_t i = fCellFacets[k];
+      Double_t t = DistToFacet(i, point, dir);
+      if (t < best) {
+        best = t;
+        facet = i;
+      }
+    }
+
+    Double_t tcell = TMath::Min(TMath::Min(tmaxx, tmaxy), t1);
+    if (best <= tcell or tcell >= t1) break;
+
+    if (tmaxx < tmaxy) {
+      ix += stepx;
+      if (ix < 0 or ix >= fNx) break;
+      tmaxx += tdeltax;
+    } else {
+      iy += stepy;
+      if (iy < 0 or iy >= fNy) break;
+      tmaxy += tdeltay;
+    }
+  }
+
+  if (norm and facet >= 0) {
+    Double_t q[3] = {point[0] + best * dir[0], point[1] + best * dir[1],
+                     point[2] + best * dir[2]};
+    GetFacetNormal(facet, q, norm);
+  }
+
+  return best;
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::GetAxisV(Int_t i, Double_t* v) const {
+  // Return the second transverse axis (= N x U) of facet i
+  Cross(&fNormal[3 * i], &fAxisU[3 * i], v);
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::GetBoundingCylinder(Double_t* param) const {
+  //--- Fill vector param[4] with the bounding cylinder parameters. The order
+  // is the following : Rmin, Rmax, Phi1, Phi2
+  param[0] = 0;
+  param[1] = fDX * fDX + fDY * fDY;
+  param[2] = 0;
+  param[3] = 360;
+}
+
+//_____________________________________________________________________________
+const TBuffer3D& AGeoSegmentedMirror::GetBuffer3D(Int_t reqSections,
+                                                  Bool_t localFrame) const {
+  // Fills a static 3D buffer and returns a reference
+  static TBuffer3D buffer(TBuffer3DTypes::kGeneric);
+
+  TGeoBBox::FillBuffer3D(buffer, reqSections, localFrame);
+
+  if (reqSections & TBuffer3D::kRawSizes) {
+    Int_t nbPnts, nbSegs, nbPols;
+    GetMeshNumbers(nbPnts, nbSegs, nbPols);
+    Int_t m = nbSegs / 3 / TMath::Max(GetNfacets(), 1);
+    Int_t nbPolsSize = GetNfacets() * (2 * (m + 2) + 6 * m);
+
+    if (buffer.SetRawSizes(nbPnts, 3 * nbPnts, nbSegs, 3 * nbSegs, nbPols,
+                           nbPolsSize)) {
+      buffer.SetSectionsValid(TBuffer3D::kRawSizes);
+    }
+  }
+
+  if ((reqSections & TBuffer3D::kRaw) &&
+      buffer.SectionsValid(TBuffer3D::kRawSizes)) {
+    SetPoints(buffer.fPnts);
+    if (!buffer.fLocalFrame) {
+      TransformPoints(buffer.fPnts, buffer.NbPnts());
+    }
+    SetSegsAndPols(buffer);
+    buffer.SetSectionsValid(TBuffer3D::kRaw);
+  }
+
+  return buffer;
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::GetFacetCenter(Int_t i, Double_t* center) const {
+  for (Int_t j = 0; j < 3; j++) center[j] = fCenter[3 * i + j];
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::GetFacetNormal(Int_t i, const Double_t* point,
+                                         Double_t* norm) const {
+  // Return the outward normal of the surface of facet i closest to point
+  PrepareGrid();
+  Double_t l[3];
+  ToLocal(i, point, l);
+
+  Double_t R = fCurvatureRadius[i];
+  Double_t e[3] = {l[0], l[1], l[2] - R};
+  Double_t d = TMath::Sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+
+  // the reflective surface faces the center of curvature
+  Double_t nl[3] = {-e[0] / d, -e[1] / d, -e[2] / d};
+  Double_t closest = TMath::Abs(d - R);
+  if (TMath::Abs(R + fThickness - d) < closest) {
+    closest = TMath::Abs(R + fThickness - d);
+    for (Int_t j = 0; j < 3; j++) nl[j] = e[j] / d;
+  }
+
+  Double_t a = fSize[i];
+  if (fOutlineN > 0) {
+    for (Int_t j = 0; j < fOutlineN; j++) {
+      Double_t s = TMath::Abs(a - l[0] * fSideCos[j] - l[1] * fSideSin[j]);
+      if (s < closest) {
+        closest = s;
+        nl[0] = fSideCos[j];
+        nl[1] = fSideSin[j];
+        nl[2] = 0;
+      }
+    }
+  } else {
+    Double_t r = TMath::Sqrt(l[0] * l[0] + l[1] * l[1]);
+    if (r > 0 and TMath::Abs(a - r) < closest) {
+      nl[0] = l[0] / r;
+      nl[1] = l[1] / r;
+      nl[2] = 0;
+    }
+  }
+
+  const Double_t* u = &fAxisU[3 * i];
+  const Double_t* n = &fNormal[3 * i];
+  Double_t v[3];
+  GetAxisV(i, v);
+  for (Int_t j = 0; j < 3; j++) {
+    norm[j] = nl[0] * u[j] + nl[1] * v[j] + nl[2] * n[j];
+  }
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::GetMeshNumbers(Int_t& nvert, Int_t& nsegs,
+                                         Int_t& npols) const {
+  Int_t m = fOutlineN > 0 ? fOutlineN : gGeoManager->GetNsegments();
+  Int_t n = GetNfacets();
+
+  nvert = 2 * m * n;
+  nsegs = 3 * m * n;
+  npols = (m + 2) * n;
+}
+
+//_____________________________________________________________________________
+Int_t AGeoSegmentedMirror::GetNmeshVertices() const {
+  // Return number of vertices of the mesh representation
+  Int_t nvert, nsegs, npols;
+  GetMeshNumbers(nvert, nsegs, npols);
+
+  return nvert;
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::InspectShape() const {
+  // print shape parameters
+  printf("*** Shape %s: AGeoSegmentedMirror ***\n", GetName());
+  printf("    Thickness = %11.5f\n", fThickness);
+  printf("    OutlineN  = %d\n", fOutlineN);
+  printf("    Nfacets   = %d\n", GetNfacets());
+  for (Int_t i = 0; i < GetNfacets(); i++) {
+    printf("    %d: (%11.5f, %11.5f, %11.5f) R = %11.5f size = %11.5f\n", i,
+           fCenter[3 * i], fCenter[3 * i + 1], fCenter[3 * i + 2],
+           fCurvatureRadius[i], fSize[i]);
+  }
+  printf(" Bounding box:\n");
+  TGeoBBox::InspectShape();
+}
+
+//_____________________________________________________________________________
+TBuffer3D* AGeoSegmentedMirror::MakeBuffer3D() const {
+  Int_t nbPnts, nbSegs, nbPols;
+  GetMeshNumbers(nbPnts, nbSegs, nbPols);
+  Int_t m = fOutlineN > 0 ? fOutlineN : gGeoManager->GetNsegments();
+  Int_t nbPolsSize = GetNfacets() * (2 * (m + 2) + 6 * m);
+
+  TBuffer3D* buff =
+      new TBuffer3D(TBuffer3DTypes::kGeneric, nbPnts, 3 * nbPnts, nbSegs,
+                    3 * nbSegs, nbPols, nbPolsSize);
+
+  if (buff) {
+    SetPoints(buff->fPnts);
+    SetSegsAndPols(*buff);
+  }
+
+  return buff;
+}
+
+//_____________________________________________________________________________
+Double_t AGeoSegmentedMirror::Safety(CONST53410 Double_t* point,
+                                     Bool_t in) const {
+  // Compute the safe distance from point to the surfaces of the facets
+  if (in) {
+    Double_t margin;
+    FindFacet(point, margin);
+    return TMath::Max(0., margin);
+  }
+
+  Double_t half[3] = {fDX, fDY, fDZ};
+  for (Int_t j = 0; j < 3; j++) {
+    if (TMath::Abs(point[j] - fOrigin[j]) > half[j]) {
+      return TGeoBBox::Safety(point, kFALSE);
+    }
+  }
+
+  // Facets not registered in the 3x3 cells around point are farther than
+  // the edges of the cells
+  PrepareGrid();
+  Int_t ix = Int_t((point[0] - fGridX0) / fCellSize);
+  Int_t iy = Int_t((point[1] - fGridY0) / fCellSize);
+  ix = TMath::Max(0, TMath::Min(fNx - 1, ix));
+  iy = TMath::Max(0, TMath::Min(fNy - 1, iy));
+
+  Double_t safe = TGeoShape::Big();
+  if (ix > 0) safe = point[0] - (fGridX0 + (ix - 1) * fCellSize);
+  if (ix < fNx - 1) {
+    safe = TMath::Min(safe, fGridX0 + (ix + 2) * fCellSize - point[0]);
+  }
+  if (iy > 0) safe = TMath::Min(safe, point[1] - (fGridY0 + (iy - 1) * fCellSize));
+  if (iy < fNy - 1) {
+    safe = TMath::Min(safe, fGridY0 + (iy + 2) * fCellSize - point[1]);
+  }
+
+  for (Int_t jy = TMath::Max(0, iy - 1); jy <= TMath::Min(fNy - 1, iy + 1);
+       jy++) {
+    for (Int_t jx = TMath::Max(0, ix - 1); jx <= TMath::Min(fNx - 1, ix + 1);
+         jx++) {
+      Int_t cell = jx + jy * fNx;
+      for (Int_t k = fCellStart[cell]; k < fCellStart[cell + 1]; k++) {
+        Int_t i = fCellFacets[k];
+        Double_t dx = point[0] - fCenter[3 * i];
+        Double_t dy = point[1] - fCenter[3 * i + 1];
+        Double_t dz = point[2] - fCenter[3 * i + 2];
+        Double_t d = TMath::Sqrt(dx * dx + dy * dy + dz * dz);
+        safe = TMath::Min(safe, TMath::Max(0., d - fBoundingRadius[i]));
+      }
+    }
+  }
+
+  return safe;
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::SavePrimitive(std::ostream& out, Option_t*) {
+  // Save a primitive as a C++ statement(s) on output stream "out".
+  if (TObject::TestBit(kGeoSavePrimitive)) return;
+
+  out << "   // Shape: " << GetName() << " type: " << ClassName() << std::endl;
+  out << "   AGeoSegmentedMirror* mirror = new AGeoSegmentedMirror(\""
+      << GetName() << "\", " << fThickness << ", " << fOutlineN << ");"
+      << std::endl;
+  for (Int_t i = 0; i < GetNfacets(); i++) {
+    // rotation of the outline from the default transverse axis
+    Double_t u0[3], v0[3];
+    DefaultAxisU(&fNormal[3 * i], u0);
+    Cross(&fNormal[3 * i], u0, v0);
+    const Double_t* u = &fAxisU[3 * i];
+    Double_t rotation =
+        TMath::ATan2(u[0] * v0[0] + u[1] * v0[1] + u[2] * v0[2],
+                     u[0] * u0[0] + u[1] * u0[1] + u[2] * u0[2]);
+    out << "   mirror->AddFacet(" << fCenter[3 * i] << ", "
+        << fCenter[3 * i + 1] << ", " << fCenter[3 * i + 2] << ", "
+        << fNormal[3 * i] << ", " << fNormal[3 * i + 1] << ", "
+        << fNormal[3 * i + 2] << ", " << fCurvatureRadius[i] << ", "
+        << fSize[i] << ", " << rotation << ");" << std::endl;
+  }
+
+  out << "   TGeoShape* " << GetPointerName() << " = mirror;" << std::endl;
+  TObject::SetBit(TGeoShape::kGeoSavePrimitive);
+}
+
+//_____________________________________________________________________________
+Bool_t AGeoSegmentedMirror::SetFacet(Int_t i, Double_t x, Double_t y,
+                                     Double_t z, Double_t nx, Double_t ny,
+                                     Double_t nz, Double_t radius,
+                                     Double_t size, Double_t rotation) {
+  // Replace the parameters of the i-th facet (see AddFacet), e.g. to tilt it
+  // after the geometry is closed. Call AOpticsManager::UpdateShape afterward
+  // to rebuild the voxels of the mother volume. Return kFALSE if the
+  // parameters are invalid.
+  if (i < 0 or i >= GetNfacets()) {
+    Error("SetFacet", "No facet %d", i);
+    return kFALSE;
+  }
+  if (nx * nx + ny * ny + nz * nz == 0 or radius <= 0 or size <= 0) {
+    Error("SetFacet", "Invalid facet (radius = %f, size = %f)", radius, size);
+    return kFALSE;
+  }
+
+  StoreFacet(i, x, y, z, nx, ny, nz, radius, size, rotation);
+  ComputeBBox();
+
+  return kTRUE;
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::SetPoints(Double_t* points) const {
+  // create mesh points, the vertices of the outline on the reflective surface
+  // and on the back surface of each facet
+  if (!points) {
+    return;
+  }
+
+  Int_t m = fOutlineN > 0 ? fOutlineN : gGeoManager->GetNsegments();
+
+  Int_t index = 0;
+  for (Int_t i = 0; i < GetNfacets(); i++) {
+    const Double_t* c = &fCenter[3 * i];
+    const Double_t* u = &fAxisU[3 * i];
+    const Double_t* n = &fNormal[3 * i];
+    Double_t v[3];
+    GetAxisV(i, v);
+
+    Double_t R = fCurvatureRadius[i];
+    Double_t rho = fOutlineN > 0 ? fSize[i] / TMath::Cos(TMath::Pi() / m)
+                                 : fSize[i];
+    Double_t z[2] = {
+        R - TMath::Sqrt(TMath::Max(R * R - rho * rho, 0.)),
+        R - TMath::Sqrt(TMath::Max((R + fThickness) * (R + fThickness) -
+                                       rho * rho,
+                                   0.))};
+
+    for (Int_t k = 0; k < 2; k++) {
+      for (Int_t j = 0; j < m; j++) {
+        Double_t phi = TMath::TwoPi() * (fOutlineN > 0 ? j + 0.5 : j) / m;
+        Double_t x = rho * TMath::Cos(phi);
+        Double_t y = rho * TMath::Sin(phi);
+        for (Int_t l = 0; l < 3; l++) {
+          points[index++] = c[l] + x * u[l] + y * v[l] + z[k] * n[l];
+        }
+      }
+    }
+  }
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::SetPoints(Float_t* points) const {
+  // create mesh points
+  if (!points) {
+    return;
+  }
+
+  std::vector<Double_t> tmp(3 * GetNmeshVertices());
+  SetPoints(tmp.data());
+  for (std::size_t i = 0; i < tmp.size(); i++) points[i] = tmp[i];
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::SetSegsAndPols(TBuffer3D& buff) const {
+  // Fill TBuffer3D structure for segments and polygons.
+  Int_t m = fOutlineN > 0 ? fOutlineN : gGeoManager->GetNsegments();
+  Int_t c = GetBasicColor();
+
+  Int_t index = 0;
+  for (Int_t i = 0; i < GetNfacets(); i++) {
+    Int_t p = 2 * m * i;  // first point of this facet
+    // outlines on the reflective/back surfaces
+    for (Int_t k = 0; k < 2; k++) {
+      for (Int_t j = 0; j < m; j++) {
+        buff.fSegs[index++] = c;
+        buff.fSegs[index++] = p + k * m + j;
+        buff.fSegs[index++] = p + k * m + (j + 1) % m;
+      }
+    }
+    // edges of the sides
+    for (Int_t j = 0; j < m; j++) {
+      buff.fSegs[index++] = c;
+      buff.fSegs[index++] = p + j;
+      buff.fSegs[index++] = p + m + j;
+    }
+  }
+
+  index = 0;
+  for (Int_t i = 0; i < GetNfacets(); i++) {
+    Int_t s = 3 * m * i;  // first segment of this facet
+    buff.fPols[index++] = c;
+    buff.fPols[index++] = m;
+    for (Int_t j = 0; j < m; j++) buff.fPols[index++] = s + j;
+
+    buff.fPols[index++] = c;
+    buff.fPols[index++] = m;
+    for (Int_t j = m - 1; j >= 0; j--) buff.fPols[index++] = s + m + j;
+
+    for (Int_t j = 0; j < m; j++) {
+      buff.fPols[index++] = c;
+      buff.fPols[index++] = 4;
+      buff.fPols[index++] = s + j;
+      buff.fPols[index++] = s + 2 * m + (j + 1) % m;
+      buff.fPols[index++] = s + m + j;
+      buff.fPols[index++] = s + 2 * m + j;
+    }
+  }
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::Sizeof3D() const {
+  ///// obsolete - to be removed
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::StoreFacet(Int_t i, Double_t x, Double_t y,
+                                     Double_t z, Double_t nx, Double_t ny,
+                                     Double_t nz, Double_t radius,
+                                     Double_t size, Double_t rotation) {
+  // Fill the i-th elements of the facet arrays with validated parameters
+  Double_t n[3] = {nx, ny, nz};
+  Double_t mag = TMath::Sqrt(nx * nx + ny * ny + nz * nz);
+  for (Int_t j = 0; j < 3; j++) n[j] /= mag;
+
+  Double_t u0[3], v0[3];
+  DefaultAxisU(n, u0);
+  Cross(n, u0, v0);
+  Double_t cosr = TMath::Cos(rotation);
+  Double_t sinr = TMath::Sin(rotation);
+
+  fCenter[3 * i] = x;
+  fCenter[3 * i + 1] = y;
+  fCenter[3 * i + 2] = z;
+  for (Int_t j = 0; j < 3; j++) {
+    fNormal[3 * i + j] = n[j];
+    fAxisU[3 * i + j] = cosr * u0[j] + sinr * v0[j];
+  }
+  fCurvatureRadius[i] = radius;
+  fSize[i] = size;
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::ToLocal(Int_t i, const Double_t* point,
+                                  Double_t* local) const {
+  // Convert point to the frame of facet i, whose origin is the facet center
+  // and whose Z axis is the facet axis
+  Double_t d[3] = {point[0] - fCenter[3 * i], point[1] - fCenter[3 * i + 1],
+                   point[2] - fCenter[3 * i + 2]};
+  ToLocalDir(i, d, local);
+}
+
+//_____________________________________________________________________________
+void AGeoSegmentedMirror::ToLocalDir(Int_t i, const Double_t* dir,
+                                     Double_t* local) const {
+  const Double_t* u = &fAxisU[3 * i];
+  const Double_t* n = &fNormal[3 * i];
+  Double_t v[3];
+  GetAxisV(i, v);
+  local[0] = dir[0] * u[0] + dir[1] * u[1] + dir[2] * u[2];
+  local[1] = dir[0] * v[0] + dir[1] * v[1] + dir[2] * v[2];
+  local[2] = dir[0] * n[0] + dir[1] * n[1] + dir[2] * n[2];
+}
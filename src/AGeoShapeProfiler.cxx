@@ -0,0 +1,364 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AGeoShapeProfiler
+//
+// Shape wrapper measuring which shapes slow the navigation. It forwards every
+// call to the profiled shape, and counts and times the calls of Contains,
+// DistFromInside, DistFromOutside, Safety and ComputeNormal, together with
+// the iterations of the internal solvers of the shapes (the Newton steps of
+// AGeoAsphericDisk and the facet tests of AGeoWinstonCone2D and
+// AGeoWinstonConePoly) done during these calls. The counters are atomic and
+// shared by all the threads.
+//
+// The profiler replaces the shape of a volume and has the same name and
+// bounding box. Attach(manager) wraps the custom shapes of ROBAST (or all the
+// shapes) of a geometry, and PrintReport(manager) ranks them by the total
+// time. The timers themselves cost some tens of nanoseconds per call, which
+// is included in the reported times.
+//
+//   AGeoShapeProfiler::Attach(gGeoManager);
+//   manager->TraceNonSequential(array);
+//   AGeoShapeProfiler::PrintReport(gGeoManager);
+//   AGeoShapeProfiler::Detach(gGeoManager);
+//
+// AOpticsManager::EnableShapeProfiling does the same for a closed geometry.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "AGeoShapeProfiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <vector>
+
+#include "TGeoManager.h"
+#include "TGeoVolume.h"
+#include "TObjArray.h"
+#include "TString.h"
+
+ClassImp(AGeoShapeProfiler);
+
+namespace {
+
+const char* kMethodName[AGeoShapeProfiler::kNmethods] = {
+    "Contains", "DistFromInside", "DistFromOutside", "Safety",
+    "ComputeNormal"};
+
+thread_local ULong64_t gThreadIterations = 0;  // solver iterations so far
+std::atomic<Int_t> gNattached(0);  // number of volumes with profilers
+
+Bool_t IsCustomShape(const TGeoShape* shape) {
+  return TString(shape->ClassName()).BeginsWith("AGeo");
+}
+
+}  // namespace
+
+//_____________________________________________________________________________
+AGeoShapeProfiler::AGeoShapeProfiler() : TGeoBBox(0, 0, 0), fShape(0) {
+  Reset();
+}
+
+//_____________________________________________________________________________
+AGeoShapeProfiler::AGeoShapeProfiler(TGeoShape* shape)
+    : TGeoBBox(shape->GetName(), 0, 0, 0), fShape(shape) {
+  // The bounding box of shape is copied, and must be up to date
+  TGeoBBox* box = (TGeoBBox*)fShape;
+  SetBoxDimensions(box->GetDX(), box->GetDY(), box->GetDZ(),
+                   (Double_t*)box->GetOrigin());
+  Reset();
+}
+
+//_____________________________________________________________________________
+AGeoShapeProfiler::~AGeoShapeProfiler() {}
+
+//_____________________________________________________________________________
+void AGeoShapeProfiler::AddIterations(ULong64_t n) {
+  // Called by the solvers of the shapes if IsEnabled() is kTRUE
+  gThreadIterations += n;
+}
+
+//_____________________________________________________________________________
+AGeoShapeProfiler* AGeoShapeProfiler::Attach(TGeoVolume* volume) {
+  // Replace the shape of volume with a new profiler, or return the profiler
+  // already attached. Assemblies are not profiled.
+  if (!volume or volume->IsAssembly() or !volume->GetShape()) return 0;
+
+  AGeoShapeProfiler* profiler = GetProfiler(volume->GetShape());
+  if (profiler) return profiler;
+
+  // the profiler is registered to and deleted by TGeoManager
+  profiler = new AGeoShapeProfiler(volume->GetShape());
+  volume->SetShape(profiler);
+  gNattached.fetch_add(1);
+  return profiler;
+}
+
+//_____________________________________________________________________________
+Int_t AGeoShapeProfiler::Attach(TGeoManager* manager, Bool_t customOnly) {
+  // Attach profilers to the volumes of manager made of ROBAST shapes (AGeo*),
+  // or of any shape if customOnly is kFALSE. Volumes sharing a shape share
+  // a profiler. Return the number of volumes newly profiled.
+  TObjArray* volumes = manager ? manager->GetListOfVolumes() : 0;
+  Int_t n = volumes ? volumes->GetEntriesFast() : 0;
+
+  std::map<TGeoShape*, AGeoShapeProfiler*> profilers;
+  Int_t nattached = 0;
+  for (Int_t i = 0; i < n; i++) {
+    TGeoVolume* volume = (TGeoVolume*)volumes->UncheckedAt(i);
+    if (!volume or volume->IsAssembly()) continue;
+    TGeoShape* shape = volume->GetShape();
+    if (!shape or GetProfiler(shape)) continue;
+    if (customOnly and not IsCustomShape(shape)) continue;
+
+    AGeoShapeProfiler*& profiler = profilers[shape];
+    if (!profiler) profiler = new AGeoShapeProfiler(shape);
+    volume->SetShape(profiler);
+    gNattached.fetch_add(1);
+    nattached++;
+  }
+
+  return nattached;
+}
+
+//_____________________________________________________________________________
+void AGeoShapeProfiler::ComputeBBox() {
+  // Recompute the bounding box of the profiled shape and copy it
+  fShape->ComputeBBox();
+  TGeoBBox* box = (TGeoBBox*)fShape;
+  SetBoxDimensions(box->GetDX(), box->GetDY(), box->GetDZ(),
+                   (Double_t*)box->GetOrigin());
+}
+
+//_____________________________________________________________________________
+void AGeoShapeProfiler::ComputeNormal(CONST53410 Double_t* point,
+                                      CONST53410 Double_t* dir,
+                                      Double_t* norm) {
+  ULong64_t i0 = gThreadIterations, t0 = GetClock();
+  fShape->ComputeNormal(point, dir, norm);
+  Record(kComputeNormal, t0, i0);
+}
+
+//_____________________________________________________________________________
+Bool_t AGeoShapeProfiler::Contains(CONST53410 Double_t* point) const {
+  ULong64_t i0 = gThreadIterations, t0 = GetClock();
+  Bool_t inside = fShape->Contains(point);
+  Record(kContains, t0, i0);
+  return inside;
+}
+
+//_____________________________________________________________________________
+Bool_t AGeoShapeProfiler::Detach(TGeoVolume* volume) {
+  // Give back the profiled shape to volume. The profiler is left in the list
+  // of shapes of TGeoManager, which deletes it.
+  AGeoShapeProfiler* profiler = volume ? GetProfiler(volume->GetShape()) : 0;
+  if (!profiler) return kFALSE;
+
+  volume->SetShape(profiler->GetShape());
+  gNattached.fetch_sub(1);
+  return kTRUE;
+}
+
+//_____________________________________________________________________________
+Int_t AGeoShapeProfiler::Detach(TGeoManager* manager) {
+  // Detach the profilers from all the volumes of manager
+  TObjArray* volumes = manager ? manager->GetListOfVolumes() : 0;
+  Int_t n = volumes ? volumes->GetEntriesFast() : 0;
+  Int_t ndetached = 0;
+  for (Int_t i = 0; i < n; i++) {
+    if (Detach((TGeoVolume*)volumes->UncheckedAt(i))) ndetached++;
+  }
+
+  return ndetached;
+}
+
+//_____________________________________________________________________________
+Double_t AGeoShapeProfiler::DistFromInside(CONST53410 Double_t* point,
+                                           CONST53410 Double_t* dir, Int_t iact,
+                                           Double_t step,
+                                           Double_t* safe) const {
+  ULong64_t i0 = gThreadIterations, t0 = GetClock();
+  Double_t dist = fShape->DistFromInside(point, dir, iact, step, safe);
+  Record(kDistFromInside, t0, i0);
+  return dist;
+}
+
+//_____________________________________________________________________________
+Double_t AGeoShapeProfiler::DistFromOutside(CONST53410 Double_t* point,
+                                            CONST53410 Double_t* dir,
+                                            Int_t iact, Double_t step,
+                                            Double_t* safe) const {
+  ULong64_t i0 = gThreadIterations, t0 = GetClock();
+  Double_t dist = fShape->DistFromOutside(point, dir, iact, step, safe);
+  Record(kDistFromOutside, t0, i0);
+  return dist;
+}
+
+//_____________________________________________________________________________
+ULong64_t AGeoShapeProfiler::GetCalls(Int_t method) const {
+  return method >= 0 and method < kNmethods ? fCalls[method].load() : 0;
+}
+
+//_____________________________________________________________________________
+ULong64_t AGeoShapeProfiler::GetClock() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+//_____________________________________________________________________________
+ULong64_t AGeoShapeProfiler::GetIterations(Int_t method) const {
+  // Return the solver iterations done during the calls of method
+  return method >= 0 and method < kNmethods ? fIterations[method].load() : 0;
+}
+
+//_____________________________________________________________________________
+const char* AGeoShapeProfiler::GetMethodName(Int_t method) {
+  return method >= 0 and method < kNmethods ? kMethodName[method] : "";
+}
+
+//_____________________________________________________________________________
+AGeoShapeProfiler* AGeoShapeProfiler::GetProfiler(TGeoShape* shape) {
+  // Return shape as a profiler, or 0 if it is not one
+  return dynamic_cast<AGeoShapeProfiler*>(shape);
+}
+
+//_____________________________________________________________________________
+Double_t AGeoShapeProfiler::GetTime(Int_t method) const {
+  // Return the time (s) spent in the calls of method
+  return method >= 0 and method < kNmethods
+             ? fNanoseconds[method].load() * 1e-9
+             : 0;
+}
+
+//_____________________________________________________________________________
+Double_t AGeoShapeProfiler::GetTotalTime() const {
+  Double_t total = 0;
+  for (Int_t i = 0; i < kNmethods; i++) total += GetTime(i);
+  return total;
+}
+
+//_____________________________________________________________________________
+void AGeoShapeProfiler::InspectShape() const {
+  printf("*** Shape %s: AGeoShapeProfiler ***\n", GetName());
+  fShape->InspectShape();
+}
+
+//_____________________________________________________________________________
+Bool_t AGeoShapeProfiler::IsEnabled() {
+  // Return kTRUE if any volume is profiled, so that the shapes count the
+  // iterations of their solvers
+  return gNattached.load(std::memory_order_relaxed) > 0;
+}
+
+//_____________________________________________________________________________
+void AGeoShapeProfiler::Print(Option_t*) const {
+  // Print the counters of each method
+  printf("%s (%s): %.3e s in total\n", GetName(), fShape->ClassName(),
+         GetTotalTime());
+  printf("  %-16s %12s %12s %12s %12s\n", "Method", "Calls", "Time (s)",
+         "ns/call", "Iterations");
+  for (Int_t i = 0; i < kNmethods; i++) {
+    ULong64_t calls = GetCalls(i);
+    printf("  %-16s %12llu %12.3e %12.1f %12llu\n", kMethodName[i],
+           (unsigned long long)calls, GetTime(i),
+           calls > 0 ? GetTime(i) * 1e9 / calls : 0.,
+           (unsigned long long)GetIterations(i));
+  }
+}
+
+//_____________________________________________________________________________
+void AGeoShapeProfiler::PrintReport(TGeoManager* manager, Int_t nshapes) {
+  // Print the nshapes profiled shapes of manager which took the longest
+  // total time, with the number of calls and the time of each method
+  TObjArray* shapes = manager ? manager->GetListOfShapes() : 0;
+  Int_t n = shapes ? shapes->GetEntriesFast() : 0;
+
+  std::vector<const AGeoShapeProfiler*> profilers;
+  for (Int_t i = 0; i < n; i++) {
+    AGeoShapeProfiler* profiler =
+        GetProfiler((TGeoShape*)shapes->UncheckedAt(i));
+    if (profiler) profilers.push_back(profiler);
+  }
+  std::stable_sort(
+      profilers.begin(), profilers.end(),
+      [](const AGeoShapeProfiler* a, const AGeoShapeProfiler* b) {
+        return a->GetTotalTime() > b->GetTotalTime();
+      });
+
+  Double_t total = 0;
+  for (std::size_t i = 0; i < profilers.size(); i++) {
+    total += profilers[i]->GetTotalTime();
+  }
+
+  printf("%-4s %-24s %-20s %11s %6s %12s %12s\n", "Rank", "Shape", "Class",
+         "Time (s)", "%", "Calls", "Iterations");
+  for (std::size_t i = 0; i < profilers.size() and Int_t(i) < nshapes; i++) {
+    const AGeoShapeProfiler* profiler = profilers[i];
+    ULong64_t calls = 0, iterations = 0;
+    for (Int_t j = 0; j < kNmethods; j++) {
+      calls += profiler->GetCalls(j);
+      iterations += profiler->GetIterations(j);
+    }
+    Double_t time = profiler->GetTotalTime();
+    printf("%-4d %-24s %-20s %11.3e %6.1f %12llu %12llu\n", Int_t(i + 1),
+           profiler->GetName(), profiler->GetShape()->ClassName(), time,
+           total > 0 ? 100 * time / total : 0., (unsigned long long)calls,
+           (unsigned long long)iterations);
+    for (Int_t j = 0; j < kNmethods; j++) {
+      if (profiler->GetCalls(j) == 0) continue;
+      printf("     %-45s %11.3e %6.1f %12llu %12llu\n", kMethodName[j],
+             profiler->GetTime(j),
+             time > 0 ? 100 * profiler->GetTime(j) / time : 0.,
+             (unsigned long long)profiler->GetCalls(j),
+             (unsigned long long)profiler->GetIterations(j));
+    }
+  }
+}
+
+//_____________________________________________________________________________
+void AGeoShapeProfiler::Record(Int_t method, ULong64_t t0, ULong64_t i0) const {
+  ULong64_t t1 = GetClock();
+  fCalls[method].fetch_add(1, std::memory_order_relaxed);
+  fNanoseconds[method].fetch_add(t1 - t0, std::memory_order_relaxed);
+  if (gThreadIterations != i0) {
+    fIterations[method].fetch_add(gThreadIterations - i0,
+                                  std::memory_order_relaxed);
+  }
+}
+
+//_____________________________________________________________________________
+void AGeoShapeProfiler::Reset() {
+  // Clear the counters
+  for (Int_t i = 0; i < kNmethods; i++) {
+    fCalls[i].store(0);
+    fNanoseconds[i].store(0);
+    fIterations[i].store(0);
+  }
+}
+
+//_____________________________________________________________________________
+Double_t AGeoShapeProfiler::Safety(CONST53410 Double_t* point,
+                                   Bool_t in) const {
+  ULong64_t i0 = gThreadIterations, t0 = GetClock();
+  Double_t safe = fShape->Safety(point, in);
+  Record(kSafety, t0, i0);
+  return safe;
+}
+
+//_____________________________________________________________________________
+void AGeoShapeProfiler::SetSegsAndPols(TBuffer3D& buff) const {
+  ((TGeoBBox*)fShape)->SetSegsAndPols(buff);
+}
+
+//_____________________________________________________________________________
+TGeoShape* AGeoShapeProfiler::Unwrap(TGeoShape* shape) {
+  // Return the profiled shape if shape is a profiler, otherwise shape itself
+  AGeoShapeProfiler* profiler = GetProfiler(shape);
+  return profiler ? profiler->GetShape() : shape;
+}
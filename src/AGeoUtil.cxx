@@ -5,8 +5,12 @@
 // Utility functions to build complex geometries easily                       //
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include "TGeoManager.h"
 #include "TGeoTube.h"
+#include "TGeoVolume.h"
 #include "TMath.h"
 
 #include "AGeoUtil.h"
@@ -15,32 +19,313 @@
 NamespaceImp(AGeoUtil)
 #endif
 
-    static Double_t SumInRadius(TH2* h2, double x, double y, double r) {
-  Double_t r2 = r * r;
-  TAxis* xax = h2->GetXaxis();
-  TAxis* yax = h2->GetYaxis();
-  Int_t nbinsx = xax->GetNbins();
-  Int_t nbinsy = yax->GetNbins();
-
-  Double_t total = 0.;
-
-  for (Int_t ix = 1; ix <= nbinsx; ++ix) {
-    Double_t cx = xax->GetBinCenter(ix);
-    for (Int_t iy = 1; iy <= nbinsy; ++iy) {
-      Double_t cy = yax->GetBinCenter(iy);
-      Double_t c = h2->GetBinContent(ix, iy);
-      if (c <= 0) {
+namespace {
+
+class HistogramCircleSum {
+  // Sum of the positive bins of a TH2 whose centers are within a circle, as
+  // the brute-force loop over all the bins did. The prefix sums of each row
+  // are made once, and then each row in the circle costs O(1) after a binary
+  // search for the range of its bins.
+ private:
+  std::vector<Double_t> fCx;      // bin centers
+  std::vector<Double_t> fCy;
+  std::vector<Double_t> fPrefix;  // (nx + 1) prefix sums of each row
+
+ public:
+  HistogramCircleSum(TH2* h2) {
+    TAxis* xax = h2->GetXaxis();
+    TAxis* yax = h2->GetYaxis();
+    Int_t nx = xax->GetNbins();
+    Int_t ny = yax->GetNbins();
+    for (Int_t ix = 1; ix <= nx; ++ix) fCx.push_back(xax->GetBinCenter(ix));
+    for (Int_t iy = 1; iy <= ny; ++iy) fCy.push_back(yax->GetBinCenter(iy));
+
+    fPrefix.resize((nx + 1) * ny);
+    for (Int_t iy = 0; iy < ny; ++iy) {
+      Double_t* p = &fPrefix[iy * (nx + 1)];
+      p[0] = 0.;
+      for (Int_t ix = 0; ix < nx; ++ix) {
+        Double_t c = h2->GetBinContent(ix + 1, iy + 1);
+        p[ix + 1] = p[ix] + (c > 0 ? c : 0.);
+      }
+    }
+  }
+
+  Double_t operator()(Double_t x, Double_t y, Double_t r) const {
+    Double_t r2 = r * r;
+    std::size_t nx = fCx.size();
+    std::size_t ny = fCy.size();
+
+    // one more row on each side in case of rounding
+    std::size_t iy0 = std::lower_bound(fCy.begin(), fCy.end(), y - r) -
+                      fCy.begin();
+    std::size_t iy1 = std::upper_bound(fCy.begin(), fCy.end(), y + r) -
+                      fCy.begin();
+    if (iy0 > 0) iy0--;
+    if (iy1 < ny) iy1++;
+
+    Double_t total = 0.;
+    for (std::size_t iy = iy0; iy < iy1; ++iy) {
+      Double_t dy2 = (fCy[iy] - y) * (fCy[iy] - y);
+      if (dy2 > r2) continue;
+
+      auto in = [this, x, dy2, r2](std::size_t ix) {
+        return (fCx[ix] - x) * (fCx[ix] - x) + dy2 <= r2;
+      };
+      Double_t h = TMath::Sqrt(r2 - dy2);
+      std::size_t lo = std::lower_bound(fCx.begin(), fCx.end(), x - h) -
+                       fCx.begin();
+      std::size_t hi = std::upper_bound(fCx.begin(), fCx.end(), x + h) -
+                       fCx.begin();
+      // the same condition as the brute-force loop at the edges
+      while (lo > 0 and in(lo - 1)) lo--;
+      while (hi < nx and in(hi)) hi++;
+      while (lo < hi and not in(lo)) lo++;
+      while (hi > lo and not in(hi - 1)) hi--;
+
+      const Double_t* p = &fPrefix[iy * (nx + 1)];
+      total += p[hi] - p[lo];
+    }
+
+    return total;
+  }
+};
+
+class PointCircleSum {
+  // Sum of the weights of points within a circle. The points are sorted in X
+  // so that only those in the band of the circle are checked.
+ private:
+  std::vector<Double_t> fX;
+  std::vector<Double_t> fY;
+  std::vector<Double_t> fW;
+
+ public:
+  PointCircleSum(Int_t n, const Double_t* x, const Double_t* y,
+                 const Double_t* w) {
+    std::vector<Int_t> order(n > 0 ? n : 0);
+    for (Int_t i = 0; i < n; i++) order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [x](Int_t i, Int_t j) { return x[i] < x[j]; });
+    for (std::size_t i = 0; i < order.size(); i++) {
+      fX.push_back(x[order[i]]);
+      fY.push_back(y[order[i]]);
+      fW.push_back(w ? w[order[i]] : 1.);
+    }
+  }
+
+  Double_t operator()(Double_t x, Double_t y, Double_t r) const {
+    Double_t r2 = r * r;
+    std::size_t i0 = std::lower_bound(fX.begin(), fX.end(), x - r) -
+                     fX.begin();
+    std::size_t i1 = std::upper_bound(fX.begin(), fX.end(), x + r) -
+                     fX.begin();
+    if (i0 > 0) i0--;
+    if (i1 < fX.size()) i1++;
+
+    Double_t total = 0.;
+    for (std::size_t i = i0; i < i1; ++i) {
+      Double_t d2 = (fX[i] - x) * (fX[i] - x) + (fY[i] - y) * (fY[i] - y);
+      if (d2 <= r2) total += fW[i];
+    }
+
+    return total;
+  }
+};
+
+template <typename Sum>
+void ClimbContainment(const Sum& SumInRadius, Double_t sum_goal, Double_t& r,
+                      Double_t& x, Double_t& y) {
+  // Find the smallest circle containing sum_goal by moving its center and
+  // changing its radius, starting from (x, y) and r
+  Int_t no_shift = 0;
+  Int_t no_stable = 0;
+
+  Double_t dr = 0.1 * r;
+
+  for (Int_t i = 0; i < 100 && no_shift < 30; i++) {
+    Bool_t stable_r = false, stable_x = true, stable_y = true;
+    Double_t sum0 = SumInRadius(x, y, r);
+    Double_t next_r = r;
+    if (sum0 < sum_goal) {
+      Double_t sum1 = SumInRadius(x, y, r + dr);
+      if (sum1 == sum0) {
+        dr *= 2.;
         continue;
       }
-      Double_t d2 = (cx - x) * (cx - x) + (cy - y) * (cy - y);
-      if (d2 <= r2) {
-        total += c;
+      next_r = r + dr * (sum_goal - sum0) / (sum1 - sum0);
+    } else if (sum0 != sum_goal) {
+      Double_t sum1 = SumInRadius(x, y, r - dr);
+      if (sum1 == sum0) {
+        dr *= 2.;
+        continue;
+      }
+      next_r = r - dr * (sum0 - sum_goal) / (sum0 - sum1);
+    }
+    if (next_r < 0.) next_r = 0.5 * r;
+    if (next_r < 0.5 * r) next_r = 0.5 * r;
+    if (next_r > 2. * r) next_r = 2. * r;
+
+    stable_r = fabs(next_r - r) < 0.0001 * r;
+
+    r = next_r;
+
+    {
+      Double_t sum1 = SumInRadius(x, y, r);
+
+      dr *=
+          sum0 != sum_goal ? fabs((sum1 - sum_goal) / (sum0 - sum_goal)) : 0.5;
+
+      if (dr > 0.5 * r) {
+        dr = 0.5 * r;
+      }
+      if (dr < 0.0005 * r) {
+        dr = 0.0005 * r;
+      }
+
+      no_shift++;
+
+      for (Double_t dx = 0.25 * r; dx > 0.1 * dr; dx *= 0.25) {
+        Double_t sum_x1 = SumInRadius(x + dx, y, r);
+        Double_t sum_x2 = SumInRadius(x - dx, y, r);
+        while (sum_x1 > sum1) {
+          no_shift = 0;
+          x += dx;
+          sum_x2 = sum1;
+          sum1 = sum_x1;
+          sum_x1 = SumInRadius(x + dx, y, r);
+          stable_x = false;
+        }
+        while (sum_x2 > sum1) {
+          no_shift = 0;
+          x -= dx;
+          sum_x1 = sum1;
+          sum1 = sum_x2;
+          sum_x2 = SumInRadius(x - dx, y, r);
+          stable_x = false;
+        }
+      }
+    }
+
+    for (Double_t dy = 0.1 * r; dy > 0.1 * dr; dy *= 0.25) {
+      Double_t sum1 = SumInRadius(x, y, r);
+      Double_t sum_y1 = SumInRadius(x, y + dy, r);
+      Double_t sum_y2 = SumInRadius(x, y - dy, r);
+      while (sum_y1 > sum1) {
+        no_shift = 0;
+        y += dy;
+        sum_y2 = sum1;
+        sum1 = sum_y1;
+        sum_y1 = SumInRadius(x, y + dy, r);
+        stable_y = false;
       }
+      while (sum_y2 > sum1) {
+        no_shift = 0;
+        y -= dy;
+        sum_y1 = sum1;
+        sum1 = sum_y2;
+        sum_y2 = SumInRadius(x, y - dy, r);
+        stable_y = false;
+      }
+    }
+
+    if (stable_r && stable_x && stable_y) {
+      no_stable++;
+    } else {
+      no_stable = 0;
     }
+    // Enough rounds without any change in radius and position?
+    if (no_stable >= 4) {
+      break;
+    }
+  }
+}
+
+struct AssemblyItem {
+  TGeoNode* fNode;
+  Double_t fCenter[3];  // center of the bounding box in the mother frame
+};
+
+void PartitionItems(std::vector<AssemblyItem>& items, std::size_t begin,
+                    std::size_t end, Int_t parts,
+                    std::vector<std::size_t>& bounds) {
+  // Split items[begin, end) into parts clusters of nearly equal sizes by
+  // median cuts across the longest extent, as in a k-d tree, and append the
+  // end of each cluster to bounds
+  if (parts <= 1 or end - begin <= 1) {
+    bounds.push_back(end);
+    return;
   }
-  return total;
+
+  Double_t lo[3], hi[3];
+  for (Int_t k = 0; k < 3; k++) {
+    lo[k] = hi[k] = items[begin].fCenter[k];
+  }
+  for (std::size_t i = begin + 1; i < end; i++) {
+    for (Int_t k = 0; k < 3; k++) {
+      lo[k] = std::min(lo[k], items[i].fCenter[k]);
+      hi[k] = std::max(hi[k], items[i].fCenter[k]);
+    }
+  }
+  Int_t axis = 0;
+  for (Int_t k = 1; k < 3; k++) {
+    if (hi[k] - lo[k] > hi[axis] - lo[axis]) axis = k;
+  }
+
+  Int_t left = parts / 2;
+  std::size_t mid = begin + (end - begin) * left / parts;
+  std::nth_element(items.begin() + begin, items.begin() + mid,
+                   items.begin() + end,
+                   [axis](const AssemblyItem& a, const AssemblyItem& b) {
+                     return a.fCenter[axis] < b.fCenter[axis];
+                   });
+  PartitionItems(items, begin, mid, left, bounds);
+  PartitionItems(items, mid, end, parts - left, bounds);
 }
 
+void PlaceItems(TGeoVolume* volume, std::vector<AssemblyItem>& items,
+                std::size_t begin, std::size_t end, Int_t nmax, Int_t nfree,
+                const char* prefix, Int_t& nassemblies) {
+  // Place the nodes of items[begin, end) in volume, which can take nfree more
+  // daughters, or in at most nfree assemblies of spatial clusters if there
+  // are more nodes. The number of levels is the smallest one with which no
+  // assembly has more than nmax daughters, and the clusters of each level
+  // have similar sizes.
+  std::size_t n = end - begin;
+  nfree = std::max(nfree, 2);
+  if (n <= std::size_t(nfree)) {
+    for (std::size_t i = begin; i < end; i++) {
+      TGeoNode* node = items[i].fNode;
+      if (node->IsOverlapping()) {
+        volume->AddNodeOverlap(node->GetVolume(), node->GetNumber(),
+                               node->GetMatrix());
+      } else {
+        volume->AddNode(node->GetVolume(), node->GetNumber(),
+                        node->GetMatrix());
+      }
+    }
+    return;
+  }
+
+  Int_t levels = 1;
+  for (Double_t capacity = nfree; capacity < n; capacity *= nmax) levels++;
+  Int_t parts = Int_t(std::ceil(std::pow(Double_t(n), 1. / levels) - 1e-9));
+  parts = std::min(std::max(parts, 2), nfree);
+
+  std::vector<std::size_t> bounds;
+  PartitionItems(items, begin, end, parts, bounds);
+  std::size_t first = begin;
+  for (std::size_t j = 0; j < bounds.size(); j++) {
+    TGeoVolumeAssembly* assembly =
+        new TGeoVolumeAssembly(Form("%s_%d", prefix, nassemblies++));
+    PlaceItems(assembly, items, first, bounds[j], nmax, nmax, prefix,
+               nassemblies);
+    volume->AddNode(assembly, Int_t(j));
+    first = bounds[j];
+  }
+}
+
+}  // namespace
+
 namespace AGeoUtil {
 
 //______________________________________________________________________________
@@ -198,113 +483,217 @@ void MakePointToPointTube(const char* name, const TVector3& v1,
 void ContainmentRadius(TH2* h2, Double_t fraction, Double_t& r, Double_t& x,
                        Double_t& y) {
   // compute the radius of containment from a 2D histogram.
-  Int_t no_shift = 0;
-  Int_t no_stable = 0;
-
   x = h2->GetMean(1);  // Initial x
   y = h2->GetMean(2);  // Initial y
   r = TMath::Sqrt(h2->GetStdDev(1) * h2->GetStdDev(1) +
                   h2->GetStdDev(2) * h2->GetStdDev(2)) *
       1.5;
-  Double_t dr = 0.1 * r;
-  Double_t sum_goal = h2->Integral() * fraction;
 
-  for (Int_t i = 0; i < 100 && no_shift < 30; i++) {
-    Bool_t stable_r = false, stable_x = true, stable_y = true;
-    Double_t sum0 = SumInRadius(h2, x, y, r);
-    Double_t next_r = r;
-    if (sum0 < sum_goal) {
-      Double_t sum1 = SumInRadius(h2, x, y, r + dr);
-      if (sum1 == sum0) {
-        dr *= 2.;
-        continue;
-      }
-      next_r = r + dr * (sum_goal - sum0) / (sum1 - sum0);
-    } else if (sum0 != sum_goal) {
-      Double_t sum1 = SumInRadius(h2, x, y, r - dr);
-      if (sum1 == sum0) {
-        dr *= 2.;
-        continue;
-      }
-      next_r = r - dr * (sum0 - sum_goal) / (sum0 - sum1);
-    }
-    if (next_r < 0.) next_r = 0.5 * r;
-    if (next_r < 0.5 * r) next_r = 0.5 * r;
-    if (next_r > 2. * r) next_r = 2. * r;
+  // The histogram is scanned only once to make the table of prefix sums
+  HistogramCircleSum sum(h2);
+  ClimbContainment(sum, h2->Integral() * fraction, r, x, y);
+}
 
-    stable_r = fabs(next_r - r) < 0.0001 * r;
+//______________________________________________________________________________
+void ContainmentRadius(Int_t n, const Double_t* xs, const Double_t* ys,
+                       Double_t fraction, Double_t& r, Double_t& x,
+                       Double_t& y, const Double_t* weights) {
+  // compute the radius of containment from n points (e.g. the focal-plane
+  // hits of the focused rays) without binning them. Each point has the
+  // weight weights[i], or 1 if weights is not given.
+  Double_t sw = 0., sx = 0., sy = 0., sxx = 0., syy = 0.;
+  for (Int_t i = 0; i < n; i++) {
+    Double_t w = weights ? weights[i] : 1.;
+    sw += w;
+    sx += w * xs[i];
+    sy += w * ys[i];
+    sxx += w * xs[i] * xs[i];
+    syy += w * ys[i] * ys[i];
+  }
+  if (sw <= 0.) {
+    r = x = y = 0.;
+    return;
+  }
 
-    r = next_r;
+  x = sx / sw;  // Initial x
+  y = sy / sw;  // Initial y
+  Double_t vx = TMath::Max(sxx / sw - x * x, 0.);
+  Double_t vy = TMath::Max(syy / sw - y * y, 0.);
+  r = TMath::Sqrt(vx + vy) * 1.5;
 
-    {
-      Double_t sum1 = SumInRadius(h2, x, y, r);
+  PointCircleSum sum(n, xs, ys, weights);
+  ClimbContainment(sum, sw * fraction, r, x, y);
+}
 
-      dr *=
-          sum0 != sum_goal ? fabs((sum1 - sum_goal) / (sum0 - sum_goal)) : 0.5;
+//______________________________________________________________________________
+Bool_t FindGlobalMatrix(TGeoNode* top, const TGeoNode* node,
+                        TGeoHMatrix& matrix, TGeoNode** mother) {
+  // Search the daughters of top recursively for node, and multiply matrix
+  // (the global matrix of top, e.g. identity for the top node) by the
+  // matrices down to node. mother is set to the node in which node is placed
+  // if given. Returns kFALSE if node is not found. If a volume is placed more
+  // than once, the first placement found is used.
+  if (!top or !node) return kFALSE;
+
+  TGeoHMatrix parent = matrix;
+  for (Int_t i = 0; i < top->GetNdaughters(); i++) {
+    TGeoNode* daughter = top->GetDaughter(i);
+    matrix = parent;
+    matrix.Multiply(daughter->GetMatrix());
+    if (daughter == node) {
+      if (mother) *mother = top;
+      return kTRUE;
+    }
+    if (FindGlobalMatrix(daughter, node, matrix, mother)) return kTRUE;
+  }
 
-      if (dr > 0.5 * r) {
-        dr = 0.5 * r;
-      }
-      if (dr < 0.0005 * r) {
-        dr = 0.0005 * r;
-      }
+  matrix = parent;
+  return kFALSE;
+}
 
-      no_shift++;
+//______________________________________________________________________________
+void AdaptiveSections(
+    const std::function<void(Double_t, Double_t&, Double_t&)>& curve,
+    Double_t tolerance, Int_t nmax, std::vector<Double_t>& t) {
+  // Choose the parameters t (from 0 to 1) of the sections of a polycone
+  // approximating a profile curve(t, r, z), so that the radial deviation of
+  // the polycone from the curve is smaller than tolerance with as few
+  // sections as possible, but not more than nmax (>= 2). z must increase
+  // with t.
+  //
+  // The deviation of a chord of length h in z is |d2r/dz2| h^2 / 8, so the
+  // sections are distributed with a density proportional to the square root
+  // of the curvature, i.e., densely where the profile is strongly bent and
+  // sparsely where it is nearly straight. The deviations are then checked
+  // on the dense samples of the curve, and the sections are increased until
+  // all of them are within tolerance.
+  const Int_t kSamples = 1000;  // intervals of the dense samples
+
+  std::vector<Double_t> ts(kSamples + 1), rs(kSamples + 1), zs(kSamples + 1);
+  for (Int_t i = 0; i <= kSamples; i++) {
+    ts[i] = Double_t(i) / kSamples;
+    curve(ts[i], rs[i], zs[i]);
+  }
 
-      for (Double_t dx = 0.25 * r; dx > 0.1 * dr; dx *= 0.25) {
-        Double_t sum_x1 = SumInRadius(h2, x + dx, y, r);
-        Double_t sum_x2 = SumInRadius(h2, x - dx, y, r);
-        while (sum_x1 > sum1) {
-          no_shift = 0;
-          x += dx;
-          sum_x2 = sum1;
-          sum1 = sum_x1;
-          sum_x1 = SumInRadius(h2, x + dx, y, r);
-          stable_x = false;
-        }
-        while (sum_x2 > sum1) {
-          no_shift = 0;
-          x -= dx;
-          sum_x1 = sum1;
-          sum1 = sum_x2;
-          sum_x2 = SumInRadius(h2, x - dx, y, r);
-          stable_x = false;
-        }
-      }
+  // cumulative sqrt(|d2r/dz2| / 8) dz of the samples
+  std::vector<Double_t> w(kSamples + 1, 0.);
+  for (Int_t i = 1; i <= kSamples; i++) {
+    Double_t d2r = 0;
+    Int_t k = std::min(i, kSamples - 1);  // center of 3 samples
+    Double_t dz0 = zs[k] - zs[k - 1], dz1 = zs[k + 1] - zs[k];
+    if (dz0 > 0 and dz1 > 0) {
+      d2r = 2 * ((rs[k + 1] - rs[k]) / dz1 - (rs[k] - rs[k - 1]) / dz0) /
+            (dz0 + dz1);
     }
+    w[i] = w[i - 1] + std::sqrt(std::fabs(d2r) / 8) * (zs[i] - zs[i - 1]);
+  }
 
-    for (Double_t dy = 0.1 * r; dy > 0.1 * dr; dy *= 0.25) {
-      Double_t sum1 = SumInRadius(h2, x, y, r);
-      Double_t sum_y1 = SumInRadius(h2, x, y + dy, r);
-      Double_t sum_y2 = SumInRadius(h2, x, y - dy, r);
-      while (sum_y1 > sum1) {
-        no_shift = 0;
-        y += dy;
-        sum_y2 = sum1;
-        sum1 = sum_y1;
-        sum_y1 = SumInRadius(h2, x, y + dy, r);
-        stable_y = false;
-      }
-      while (sum_y2 > sum1) {
-        no_shift = 0;
-        y -= dy;
-        sum_y1 = sum1;
-        sum1 = sum_y2;
-        sum_y2 = SumInRadius(h2, x, y - dy, r);
-        stable_y = false;
+  nmax = std::max(nmax, 2);
+  Int_t nseg = tolerance > 0 ? Int_t(std::ceil(w[kSamples] /
+                                               std::sqrt(tolerance)))
+                             : nmax - 1;
+  nseg = std::min(std::max(nseg, 1), nmax - 1);
+
+  while (kTRUE) {
+    // place nseg + 1 sections at equal steps of w
+    t.assign(1, 0.);
+    for (Int_t j = 1, i = 1; j < nseg; j++) {
+      Double_t target = w[kSamples] * j / nseg;
+      while (i < kSamples and w[i] < target) i++;
+      Double_t dw = w[i] - w[i - 1];
+      Double_t f = dw > 0 ? (target - w[i - 1]) / dw : 0;
+      Double_t tj = ts[i - 1] + f * (ts[i] - ts[i - 1]);
+      if (tj > t.back()) t.push_back(tj);
+    }
+    t.push_back(1.);
+
+    // check the deviations at the samples
+    Double_t dev = 0;
+    Double_t r0 = rs[0], z0 = zs[0], r1 = r0, z1 = z0;
+    for (Int_t i = 1, j = 0; i < kSamples; i++) {
+      while (ts[i] > t[j] and j + 1 < Int_t(t.size())) {
+        r0 = r1;
+        z0 = z1;
+        j++;
+        curve(t[j], r1, z1);
       }
+      Double_t rlin =
+          z1 > z0 ? r0 + (r1 - r0) * (zs[i] - z0) / (z1 - z0) : r0;
+      dev = std::max(dev, std::fabs(rs[i] - rlin));
     }
 
-    if (stable_r && stable_x && stable_y) {
-      no_stable++;
-    } else {
-      no_stable = 0;
-    }
-    // Enough rounds without any change in radius and position?
-    if (no_stable >= 4) {
-      break;
-    }
+    if (dev <= tolerance or nseg >= nmax - 1) break;
+    nseg = std::min(nmax - 1, std::max(nseg + 1, Int_t(nseg * 1.1)));
+  }
+}
+
+//______________________________________________________________________________
+Int_t MakeAssemblies(TGeoVolume* mother, Int_t nmax, const char* prefix,
+                     const std::function<Bool_t(const TGeoNode*)>& select) {
+  // Regroup the daughters of mother into a tree of TGeoVolumeAssembly in
+  // which no volume has more than nmax (>= 2) daughters, counting those left
+  // in mother. Only if mother keeps nmax - 1 or more daughters which are not
+  // moved does it get two assemblies in addition to them. Cameras and
+  // segmented dishes often place thousands of pixels or facets directly in
+  // one volume, so that CloseGeometry builds the voxels of a huge list and
+  // each navigation step sorts out many candidates. The daughters are
+  // clustered by the centers of their bounding boxes with median cuts across
+  // the longest extent, and each assembly thus covers a compact region with
+  // a similar number of daughters.
+  //
+  //   AGeoUtil::MakeAssemblies(
+  //       manager->GetTopVolume(), 16, "facets", [](const TGeoNode* node) {
+  //         return TString(node->GetName()).BeginsWith("mirror");
+  //       });
+  //   manager->CloseGeometry();
+  //
+  // Only the daughters placed with matrices and accepted by select (all of
+  // them if not given) are moved. They are replaced by new nodes with the
+  // same volumes, copy numbers (thus names) and matrices, so the optical
+  // model is unchanged, but the old TGeoNode pointers are invalid afterward.
+  // The assemblies are named prefix_0, prefix_1, ... and are transparent to
+  // the rays, also in flat navigation (see
+  // AOpticsManager::EnableFlatNavigation). This must be called before the
+  // geometry is closed. Returns the number of the assemblies made.
+  if (!mother or nmax < 2) {
+    ::Error("AGeoUtil::MakeAssemblies", "Invalid mother or nmax (%d)", nmax);
+    return 0;
   }
+  TGeoManager* manager = mother->GetGeoManager();
+  if (manager and manager->IsClosed()) {
+    ::Error("AGeoUtil::MakeAssemblies", "The geometry is already closed");
+    return 0;
+  }
+
+  TObjArray* nodes = mother->GetNodes();
+  if (!nodes) return 0;
+
+  std::vector<AssemblyItem> items;
+  std::vector<Int_t> index;  // indices of the moved daughters in mother
+  for (Int_t i = 0; i <= nodes->GetLast(); i++) {
+    TGeoNode* node = (TGeoNode*)nodes->At(i);
+    if (!dynamic_cast<TGeoNodeMatrix*>(node)) continue;
+    if (select and not select(node)) continue;
+
+    AssemblyItem item;
+    item.fNode = node;
+    TGeoBBox* box = (TGeoBBox*)node->GetVolume()->GetShape();
+    node->GetMatrix()->LocalToMaster(box->GetOrigin(), item.fCenter);
+    items.push_back(item);
+    index.push_back(i);
+  }
+  Int_t nfree = nmax - (mother->GetNdaughters() - Int_t(items.size()));
+  if (items.size() <= std::size_t(std::max(nfree, 2))) return 0;
+
+  for (std::size_t i = 0; i < index.size(); i++) nodes->RemoveAt(index[i]);
+  nodes->Compress();
+
+  Int_t nassemblies = 0;
+  PlaceItems(mother, items, 0, items.size(), nmax, nfree, prefix,
+             nassemblies);
+  for (std::size_t i = 0; i < items.size(); i++) delete items[i].fNode;
+
+  return nassemblies;
 }
 
 }  // namespace AGeoUtil
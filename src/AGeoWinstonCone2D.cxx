@@ -13,6 +13,8 @@
 
 #include "AGeoWinstonCone2D.h"
 
+#include "AGeoShapeProfiler.h"
+
 #include "Riostream.h"
 #include "TBuffer3D.h"
 #include "TBuffer3DTypes.h"
@@ -208,7 +210,7 @@ Double_t AGeoWinstonCone2D::DistFromInside(CONST53410 Double_t* point,
 
   // compute safe distance
   if (iact < 3 and safe) {
-    *safe = Safety(point, kFALSE);
+    *safe = Safety(point, kTRUE);
     if (iact == 0) return TGeoShape::Big();
     if (iact == 1 && step < *safe) return TGeoShape::Big();
   }
@@ -231,8 +233,8 @@ Double_t AGeoWinstonCone2D::DistFromInside(CONST53410 Double_t* point,
   Double_t d[4];
   d[0] = dz;
   d[1] = dy;
-  d[2] = DistToParabola(point, dir, 0., TMath::Pi());
-  d[3] = DistToParabola(point, dir, TMath::Pi(), TMath::Pi());
+  d[2] = DistToFacet(point, dir, 1, 0, 0, 1);
+  d[3] = DistToFacet(point, dir, -1, 0, 0, 1);
 
   return d[TMath::LocMin(4, d)];
 }
@@ -302,7 +304,7 @@ Double_t AGeoWinstonCone2D::DistFromOutside(CONST53410 Double_t* point,
   }
 
   Double_t d[2];
-  Double_t snxt = DistToParabola(point, dir, 0., TMath::Pi());
+  Double_t snxt = DistToFacet(point, dir, 1, 0, 0, 1);
   Double_t ynew = point[1] + snxt * dir[1];
   if (TMath::Abs(ynew) <= fDY) {
     d[0] = snxt;
@@ -310,7 +312,7 @@ Double_t AGeoWinstonCone2D::DistFromOutside(CONST53410 Double_t* point,
     d[0] = TGeoShape::Big();
   }
 
-  snxt = DistToParabola(point, dir, TMath::Pi(), TMath::Pi());
+  snxt = DistToFacet(point, dir, -1, 0, 0, 1);
   ynew = point[1] + snxt * dir[1];
   if (TMath::Abs(ynew) <= fDY) {
     d[1] = snxt;
@@ -322,29 +324,40 @@ Double_t AGeoWinstonCone2D::DistFromOutside(CONST53410 Double_t* point,
 }
 
 //_____________________________________________________________________________
-Double_t AGeoWinstonCone2D::DistToParabola(CONST53410 Double_t* point,
-                                           CONST53410 Double_t* dir,
-                                           Double_t phi, Double_t open) const {
-  Double_t x = TMath::Cos(phi) * point[0] + TMath::Sin(phi) * point[1];
-  Double_t y = -TMath::Sin(phi) * point[0] + TMath::Cos(phi) * point[1];
+Double_t AGeoWinstonCone2D::DistToFacet(CONST53410 Double_t* point,
+                                        CONST53410 Double_t* dir,
+                                        Double_t cosphi, Double_t sinphi,
+                                        Double_t cosopen,
+                                        Double_t sinopen) const {
+  // Compute the distance to the parabolic facet whose normal is rotated by
+  // phi around the Z axis. Crossings are accepted within +/-open/2 around
+  // the facet. cos/sin of phi and open/2 are given by the caller, and no
+  // other trigonometric function is called.
+  if (AGeoShapeProfiler::IsEnabled()) AGeoShapeProfiler::AddIterations(1);
+
+  Double_t x = cosphi * point[0] + sinphi * point[1];
+  Double_t y = -sinphi * point[0] + cosphi * point[1];
   Double_t z = point[2];
-  Double_t px = TMath::Cos(phi) * dir[0] + TMath::Sin(phi) * dir[1];
-  Double_t py = -TMath::Sin(phi) * dir[0] + TMath::Cos(phi) * dir[1];
+  Double_t px = cosphi * dir[0] + sinphi * dir[1];
+  Double_t py = -sinphi * dir[0] + cosphi * dir[1];
   Double_t pz = dir[2];
 
   if (px == 0 and pz == 0) {
     return TGeoShape::Big();
   }
 
-  Double_t cost = TMath::Cos(fTheta);
-  Double_t sint = TMath::Sin(fTheta);
+  Double_t sint = fR2 / fR1;  // fTheta = asin(fR2/fR1)
+  Double_t cost = TMath::Sqrt((1 - sint) * (1 + sint));
   // coordinates in the parabola frame inside the 1st quadrant
   // The focal point is at (X, Z) = (0, f)
   Double_t X = cost * (x + fR2) + (z + fDZ) * sint;
   Double_t Z = -sint * (x + fR2) + (z + fDZ) * cost + fF;
-  Double_t alpha = TMath::ATan2(pz, px);  // inclination in the x-z plane
-  Double_t ALPHA = alpha - fTheta;        // inclination in the X-Z plane
-  Double_t tanA = TMath::Tan(ALPHA);
+  // tangent of the inclination in the X-Z plane, i.e., tan(alpha - fTheta)
+  // where alpha is the inclination in the x-z plane
+  Double_t num = pz * cost - px * sint;
+  Double_t den = px * cost + pz * sint;
+  Double_t tanA =
+      den != 0 ? num / den : (num < 0 ? -TGeoShape::Big() : TGeoShape::Big());
 
   Double_t dist[2];
 
@@ -401,7 +414,7 @@ Double_t AGeoWinstonCone2D::DistToParabola(CONST53410 Double_t* point,
         fDZ < z_cross_p or dx * px + dz * pz < 0) {
       dist[0] = TGeoShape::Big();
     } else {
-      if (TMath::Abs(TMath::ATan2(y_cross_p, x_cross_p)) <= open / 2.) {
+      if (x_cross_p * sinopen - TMath::Abs(y_cross_p) * cosopen >= 0) {
         dist[0] = TMath::Sqrt(dx * dx + dy * dy + dz * dz);
       } else {
         dist[0] = TGeoShape::Big();
@@ -416,7 +429,7 @@ Double_t AGeoWinstonCone2D::DistToParabola(CONST53410 Double_t* point,
         fDZ < z_cross_m or dx * px + dz * pz < 0) {
       dist[1] = TGeoShape::Big();
     } else {
-      if (TMath::Abs(TMath::ATan2(y_cross_m, x_cross_m)) <= open / 2.) {
+      if (x_cross_m * sinopen - TMath::Abs(y_cross_m) * cosopen >= 0) {
         dist[1] = TMath::Sqrt(dx * dx + dy * dy + dz * dz);
       } else {
         dist[1] = TGeoShape::Big();
@@ -427,6 +440,14 @@ Double_t AGeoWinstonCone2D::DistToParabola(CONST53410 Double_t* point,
   return TMath::Min(dist[0], dist[1]);
 }
 
+//_____________________________________________________________________________
+Double_t AGeoWinstonCone2D::DistToParabola(CONST53410 Double_t* point,
+                                           CONST53410 Double_t* dir,
+                                           Double_t phi, Double_t open) const {
+  return DistToFacet(point, dir, TMath::Cos(phi), TMath::Sin(phi),
+                     TMath::Cos(open / 2), TMath::Sin(open / 2));
+}
+
 //_____________________________________________________________________________
 TGeoVolume* AGeoWinstonCone2D::Divide(TGeoVolume*, const char*, Int_t, Int_t,
                                       Double_t, Double_t) {
@@ -526,9 +547,36 @@ TBuffer3D* AGeoWinstonCone2D::MakeBuffer3D() const {
 }
 
 //_____________________________________________________________________________
-Double_t AGeoWinstonCone2D::Safety(CONST53410 Double_t*, Bool_t) const {
-  // Not implemented yet. But keep this as is.
-  return TGeoShape::Big();
+Double_t AGeoWinstonCone2D::Safety(CONST53410 Double_t* point,
+                                   Bool_t in) const {
+  // Compute the safe distance from point to the surfaces of the shape
+  Double_t dy = fDY - TMath::Abs(point[1]);
+  Double_t dz = fDZ - TMath::Abs(point[2]);
+  Double_t z = TMath::Max(-fDZ, TMath::Min(fDZ, point[2]));
+  Double_t dx = CalcR(z) - TMath::Abs(point[0]);
+
+  if (in) {
+    return TMath::Max(0., TMath::Min(TMath::Min(dy, dz), SafetyToWall(z, dx)));
+  }
+
+  return TMath::Max(TMath::Max(-dy, -dz), SafetyToWall(z, -dx));
+}
+
+//_____________________________________________________________________________
+Double_t AGeoWinstonCone2D::SafetyToWall(Double_t z, Double_t h) const {
+  // Return a lower limit of the distance to the parabolic wall from a point
+  // at z which is apart from the wall by h in the transverse direction. Any
+  // point on the wall closer than h is within |dz| < h, where the radius
+  // changes by |dR/dz| < s at most, and thus the distance is h/sqrt(1 + s^2).
+  // dR/dz of a parabola is monotonic, so s is taken at the ends of the range.
+  if (h <= 0) return 0;
+
+  Double_t zlo = TMath::Max(-fDZ, z - h);
+  Double_t zhi = TMath::Min(fDZ, z + h);
+  Double_t s = TMath::Max(TMath::Abs(CalcdRdZ(zlo)), TMath::Abs(CalcdRdZ(zhi)));
+  if (not TMath::Finite(s)) return 0;
+
+  return h / TMath::Sqrt(1 + s * s);
 }
 
 //_____________________________________________________________________________
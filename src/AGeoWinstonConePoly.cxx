@@ -155,26 +155,30 @@ Double_t AGeoWinstonConePoly::DistFromInside(CONST53410 Double_t* point,
 
   // compute safe distance
   if (iact < 3 and safe) {
-    *safe = Safety(point, kFALSE);
+    *safe = Safety(point, kTRUE);
     if (iact == 0) return TGeoShape::Big();
     if (iact == 1 && step < *safe) return TGeoShape::Big();
   }
 
   // calculate distance
-  Double_t d[1 + fPolyN];
-  d[0] = TGeoShape::Big();
+  Double_t dist = TGeoShape::Big();
   if (dir[2] < 0) {
-    d[0] = (-point[2] - fDZ) / dir[2];
+    dist = (-point[2] - fDZ) / dir[2];
   } else if (dir[2] > 0) {
-    d[0] = (fDZ - point[2]) / dir[2];
+    dist = (fDZ - point[2]) / dir[2];
   }
 
-  for (Int_t i = 0; i < fPolyN; i++) {
-    d[1 + i] =
-        DistToParabola(point, dir, i * TMath::TwoPi() / fPolyN, TMath::Pi());
+  // only the facets swept by the ray before it reaches the end planes
+  Int_t facets[fPolyN];
+  Int_t n = FindFacets(point, dir, 0, dist, facets);
+  Double_t sector = TMath::TwoPi() / fPolyN;
+  for (Int_t i = 0; i < n; i++) {
+    Double_t phi = facets[i] * sector;
+    dist = TMath::Min(dist, DistToFacet(point, dir, TMath::Cos(phi),
+                                        TMath::Sin(phi), 0, 1));
   }
 
-  return d[TMath::LocMin(1 + fPolyN, d)];
+  return dist;
 }
 
 //_____________________________________________________________________________
@@ -216,13 +220,84 @@ Double_t AGeoWinstonConePoly::DistFromOutside(CONST53410 Double_t* point,
     }
   }
 
-  Double_t d[fPolyN];
-  for (Int_t i = 0; i < fPolyN; i++) {
-    d[i] = DistToParabola(point, dir, i * TMath::TwoPi() / fPolyN,
-                          TMath::TwoPi() / fPolyN);
+  // only the facets swept by the ray between the end planes
+  Double_t tmin = 0, tmax = TGeoShape::Big();
+  if (dir[2] != 0) {
+    Double_t t1 = (-fDZ - point[2]) / dir[2];
+    Double_t t2 = (fDZ - point[2]) / dir[2];
+    tmin = TMath::Max(tmin, TMath::Min(t1, t2));
+    tmax = TMath::Max(t1, t2);
+    if (tmax < 0) return TGeoShape::Big();
+  } else if (TMath::Abs(point[2]) > fDZ) {
+    return TGeoShape::Big();
+  }
+
+  Int_t facets[fPolyN];
+  Int_t n = FindFacets(point, dir, tmin, tmax, facets);
+  Double_t sector = TMath::TwoPi() / fPolyN;
+  Double_t coshalf = TMath::Cos(sector / 2);
+  Double_t sinhalf = TMath::Sin(sector / 2);
+  Double_t dist = TGeoShape::Big();
+  for (Int_t i = 0; i < n; i++) {
+    Double_t phi = facets[i] * sector;
+    dist = TMath::Min(dist, DistToFacet(point, dir, TMath::Cos(phi),
+                                        TMath::Sin(phi), coshalf, sinhalf));
+  }
+
+  return dist;
+}
+
+//_____________________________________________________________________________
+Int_t AGeoWinstonConePoly::FindFacets(CONST53410 Double_t* point,
+                                      CONST53410 Double_t* dir, Double_t tmin,
+                                      Double_t tmax, Int_t* facets) const {
+  // Fill facets with the indices of the facets which the ray can cross
+  // between tmin and tmax, and return the number of them. The azimuth of a
+  // ray changes monotonically, and a crossing with a facet is always found
+  // within the sector of the facet. Thus only the sectors swept by the ray
+  // between tmin and tmax (usually one or two) can be crossed.
+  const Double_t kEpsilon = 1e-9;  // margin at the sector boundaries
+  Double_t sector = TMath::TwoPi() / fPolyN;
+
+  Double_t x0 = point[0] + tmin * dir[0];
+  Double_t y0 = point[1] + tmin * dir[1];
+  Double_t phi0 = TMath::ATan2(y0, x0);
+  Double_t sweep = 0;
+  Int_t sign = 1;
+
+  Double_t dxy = TMath::Sqrt(dir[0] * dir[0] + dir[1] * dir[1]);
+  if (dxy > kEpsilon) {
+    // distance between the axis and the ray projected on the XY plane
+    Double_t cross = point[0] * dir[1] - point[1] * dir[0];
+    if (TMath::Abs(cross) <= kEpsilon * dxy) {
+      sweep = TMath::TwoPi();  // the ray may pass through the axis
+    } else {
+      sign = cross > 0 ? 1 : -1;
+      Double_t phi1 = TMath::ATan2(point[1] + tmax * dir[1],
+                                   point[0] + tmax * dir[0]);
+      sweep = sign * (phi1 - phi0);
+      if (sweep < 0) sweep += TMath::TwoPi();
+    }
+  } else if (x0 * x0 + y0 * y0 <= kEpsilon * kEpsilon) {
+    sweep = TMath::TwoPi();  // the ray runs along the axis
+  }
+
+  Double_t begin = phi0 - sign * kEpsilon;
+  Double_t end = begin + sign * (sweep + 2 * kEpsilon);
+  Int_t kbegin = Int_t(TMath::Floor(begin / sector + 0.5));
+  Int_t kend = Int_t(TMath::Floor(end / sector + 0.5));
+
+  Int_t n = TMath::Abs(kend - kbegin) + 1;
+  if (n >= fPolyN) {
+    for (Int_t i = 0; i < fPolyN; i++) facets[i] = i;
+    return fPolyN;
+  }
+
+  for (Int_t i = 0; i < n; i++) {
+    facets[i] = ((kbegin + sign * i) % fPolyN + fPolyN) % fPolyN;
   }
 
-  return d[TMath::LocMin(fPolyN, d)];
+  return n;
 }
 
 //_____________________________________________________________________________
@@ -336,6 +411,27 @@ TBuffer3D* AGeoWinstonConePoly::MakeBuffer3D() const {
   return buff;
 }
 
+//_____________________________________________________________________________
+Double_t AGeoWinstonConePoly::Safety(CONST53410 Double_t* point,
+                                     Bool_t in) const {
+  // Compute the safe distance from point to the surfaces of the shape. Only
+  // the facet of the sector in which the point is found can be the closest.
+  Double_t dz = fDZ - TMath::Abs(point[2]);
+  Double_t z = TMath::Max(-fDZ, TMath::Min(fDZ, point[2]));
+
+  Double_t sector = TMath::TwoPi() / fPolyN;
+  Double_t phi = TMath::ATan2(point[1], point[0]);
+  phi -= sector * TMath::Floor(phi / sector + 0.5);
+  Double_t rho = TMath::Sqrt(point[0] * point[0] + point[1] * point[1]);
+  Double_t dr = CalcR(z) - rho * TMath::Cos(phi);
+
+  if (in) {
+    return TMath::Max(0., TMath::Min(dz, SafetyToWall(z, dr)));
+  }
+
+  return TMath::Max(-dz, SafetyToWall(z, -dr));
+}
+
 //_____________________________________________________________________________
 void AGeoWinstonConePoly::SavePrimitive(std::ostream& out, Option_t*) {
   // Save a primitive as a C++ statement(s) on output stream "out".
@@ -9,8 +9,15 @@
 //
 // Glass catalog
 //
+// The glasses of a ZEMAX AGF file are parsed into compact records, and their
+// ARefractiveIndex objects are built on the first call of GetRefractiveIndex.
+// The parsed records can be written to a binary cache file next to the
+// catalog (see SaveCache), which is read instead of the AGF file as long as
+// the size and the modification time of the AGF file are unchanged.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <cstring>
 #include <fstream>
 
 #include "TSystem.h"
@@ -20,34 +27,189 @@
 
 ClassImp(AGlassCatalog);
 
+namespace {
+
+const char kCacheMagic[] = "ROBAST-AGF-1";
+
+template <typename T>
+void WriteValue(std::ofstream& fout, const T& value) {
+  fout.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+Bool_t ReadValue(std::ifstream& fin, T& value) {
+  fin.read(reinterpret_cast<char*>(&value), sizeof(T));
+  return fin.good();
+}
+
+}  // namespace
+
 //_____________________________________________________________________________
 AGlassCatalog::AGlassCatalog() {}
 
 //_____________________________________________________________________________
-AGlassCatalog::AGlassCatalog(const std::string& catalog_file) {
+AGlassCatalog::AGlassCatalog(const std::string& catalog_file,
+                             Bool_t writeCache) {
+  // Read the catalog from its cache if it is up to date, or parse the AGF
+  // file otherwise. The cache is (re)written in the latter case if writeCache
+  // is kTRUE.
+  TString path = catalog_file.c_str();
+  gSystem->ExpandPathName(path);
+  fCatalogFile = path.Data();
+
+  if (LoadCache()) {
+    return;
+  }
+
+  if (ReadAGF() and writeCache) {
+    SaveCache();
+  }
+}
+
+//_____________________________________________________________________________
+AGlassCatalog::~AGlassCatalog() {}
+
+//_____________________________________________________________________________
+std::vector<std::string> AGlassCatalog::GetGlassNames() const {
+  std::vector<std::string> names;
+  for (auto it = fGlassMap.begin(); it != fGlassMap.end(); ++it) {
+    names.push_back(it->first);
+  }
+
+  return names;
+}
+
+//_____________________________________________________________________________
+ULong64_t AGlassCatalog::GetMemoryUsage() const {
+  // Bytes of the parsed records and of the refractive indices built so far.
+  // Each map node is assumed to cost 4 pointers besides its key and value.
+  static const ULong64_t kNodeOverhead = 4 * sizeof(void*);
+
+  ULong64_t bytes = sizeof(*this) + AMemoryUtil::Capacity(fCatalogFile);
+  for (auto it = fGlassMap.begin(); it != fGlassMap.end(); ++it) {
+    bytes += kNodeOverhead + sizeof(*it) + AMemoryUtil::Capacity(it->first) +
+             AMemoryUtil::Capacity(it->second.fWavelength) +
+             AMemoryUtil::Capacity(it->second.fExtinction);
+  }
+
+  AMemoryUtil::Counter counter;
+  for (auto it = fIndexMap.begin(); it != fIndexMap.end(); ++it) {
+    bytes += kNodeOverhead + sizeof(*it) + AMemoryUtil::Capacity(it->first);
+    if (it->second) it->second->CountMemory(counter);
+  }
+
+  return bytes + counter.GetBytes();
+}
+
+//_____________________________________________________________________________
+std::shared_ptr<ARefractiveIndex> AGlassCatalog::GetRefractiveIndex(
+    const std::string& name) {
+  auto it = fIndexMap.find(name);
+  if (it != fIndexMap.end()) {
+    return it->second;
+  }
+
+  auto data = fGlassMap.find(name);
+  if (data == fGlassMap.end()) {
+    return 0;
+  }
+
+  // Only the Sellmeier formula is supported for now
+  std::shared_ptr<ARefractiveIndex> index;
+  const GlassData& glass = data->second;
+  if (glass.fFormula == 2 and glass.fNcoefficients >= 6) {
+    const Double_t* cd = glass.fCoefficients;
+    index = std::make_shared<ASellmeierFormula>(cd[0], cd[2], cd[4], cd[1],
+                                                cd[3], cd[5]);
+    auto graph = std::make_shared<TGraph>();
+    for (std::size_t i = 0; i < glass.fWavelength.size(); i++) {
+      graph->SetPoint(i, glass.fWavelength[i], glass.fExtinction[i]);
+    }
+    index->SetExtinctionCoefficient(graph);
+  }
+  fIndexMap.insert(std::make_pair(name, index));
+
+  return index;
+}
+
+//_____________________________________________________________________________
+Bool_t AGlassCatalog::LoadCache() {
+  // Read the parsed glasses from the cache file written by SaveCache. It is
+  // ignored if the size or the modification time of the catalog file has
+  // changed since then.
+  FileStat_t st;
+  if (gSystem->GetPathInfo(fCatalogFile.c_str(), st) != 0) {
+    return kFALSE;
+  }
+
+  std::ifstream fin(GetCacheFileName().c_str(), std::ios::binary);
+  if (!fin.is_open()) {
+    return kFALSE;
+  }
+
+  char magic[sizeof(kCacheMagic)];
+  fin.read(magic, sizeof(magic));
+  Long64_t size, mtime;
+  UInt_t n;
+  if (not fin.good() or memcmp(magic, kCacheMagic, sizeof(magic)) != 0 or
+      not ReadValue(fin, size) or not ReadValue(fin, mtime) or
+      not ReadValue(fin, n) or size != st.fSize or mtime != st.fMtime) {
+    return kFALSE;
+  }
+
+  std::map<std::string, GlassData> glasses;
+  for (UInt_t i = 0; i < n; i++) {
+    UInt_t length, npoints;
+    if (not ReadValue(fin, length) or length > 1024) return kFALSE;
+    std::string name(length, ' ');
+    fin.read(&name[0], length);
+
+    GlassData glass;
+    if (not ReadValue(fin, glass.fFormula) or
+        not ReadValue(fin, glass.fNcoefficients) or
+        not ReadValue(fin, glass.fCoefficients) or
+        not ReadValue(fin, npoints) or npoints > 100000) {
+      return kFALSE;
+    }
+    glass.fWavelength.resize(npoints);
+    glass.fExtinction.resize(npoints);
+    fin.read(reinterpret_cast<char*>(glass.fWavelength.data()),
+             npoints * sizeof(Double_t));
+    fin.read(reinterpret_cast<char*>(glass.fExtinction.data()),
+             npoints * sizeof(Double_t));
+    if (not fin.good()) {
+      return kFALSE;
+    }
+    glasses[name] = glass;
+  }
+
+  fGlassMap.swap(glasses);
+  fIndexMap.clear();
+
+  return kTRUE;
+}
+
+//_____________________________________________________________________________
+Bool_t AGlassCatalog::ReadAGF() {
+  // Parse the ZEMAX AGF file into fGlassMap
   std::ifstream fin;
-  fin.open(gSystem->ExpandPathName(catalog_file.c_str()));
+  fin.open(fCatalogFile.c_str());
 
   if (!fin.is_open()) {
-    Error("AGlassCatalog", "Cannot open %s", catalog_file.c_str());
-    return;
+    Error("AGlassCatalog", "Cannot open %s", fCatalogFile.c_str());
+    return kFALSE;
   }
 
   // ASCII glass format catalog file (AGF)
-  if (catalog_file.size() - catalog_file.find(".agf") != 4 &&
-      catalog_file.size() - catalog_file.find(".AGF") != 4) {
+  if (fCatalogFile.size() - fCatalogFile.find(".agf") != 4 &&
+      fCatalogFile.size() - fCatalogFile.find(".AGF") != 4) {
     Error("AGlassCatalog", "Cannot read a non-ZEMAX file");
-    return;
+    return kFALSE;
   }
 
   const std::size_t bufsize = 200;
   char buf[bufsize], glass_name[bufsize];
-  std::string glass_name_s;
-  Double_t nd;
-  Int_t formula;
-  std::shared_ptr<TGraph> graph;
-  const std::size_t ncd = 8;
-  Double_t cd[ncd];
+  GlassData* glass = 0;
 
   while (fin.good()) {
     fin.getline(buf, bufsize);
@@ -64,29 +226,27 @@ AGlassCatalog::AGlassCatalog(const std::string& catalog_file) {
       // exclude substitution: 1
       // meta material? : ?
       char product_number[bufsize];
-      Double_t vd;
+      Int_t formula = 0;
+      Double_t nd, vd;
       if (sscanf(buf, "NM %s %d %s %lf %lf", glass_name, &formula,
                  product_number, &nd, &vd) != 5) {
         Warning("AGlassCatalog", "Bad format line found: %s", buf);
       }
 
-      glass_name_s = std::string(glass_name);
-      graph = std::make_shared<TGraph>();
-
-      fIndexMap.insert(
-          std::make_pair(glass_name_s, std::shared_ptr<ARefractiveIndex>(0)));
-    } else if (strncmp(buf, "CD ", 3) == 0) {
+      auto it = fGlassMap.insert(std::make_pair(std::string(glass_name),
+                                                GlassData())).first;
+      glass = &it->second;
+      glass->fFormula = formula;
+      glass->fNcoefficients = 0;
+      memset(glass->fCoefficients, 0, sizeof(glass->fCoefficients));
+      glass->fWavelength.clear();
+      glass->fExtinction.clear();
+    } else if (strncmp(buf, "CD ", 3) == 0 and glass) {
+      Double_t* cd = glass->fCoefficients;
       int ret = sscanf(buf, "CD %lf %lf %lf %lf %lf %lf %lf %lf", &cd[0],
                        &cd[1], &cd[2], &cd[3], &cd[4], &cd[5], &cd[6], &cd[7]);
-      if (formula == 2 && ret >= 6) {
-        auto it = fIndexMap.find(glass_name_s);
-        if (it != fIndexMap.end()) {
-          it->second = std::make_shared<ASellmeierFormula>(cd[0], cd[2], cd[4],
-                                                           cd[1], cd[3], cd[5]);
-          it->second->SetExtinctionCoefficient(graph);
-        }
-      }
-    } else if (strncmp(buf, "IT ", 3) == 0) {
+      glass->fNcoefficients = ret > 0 ? ret : 0;
+    } else if (strncmp(buf, "IT ", 3) == 0 and glass) {
       Double_t wl, T, d;  // lambda (um), transmittance, thickness (mm)
       int ret = sscanf(buf, "IT %lf %lf %lf", &wl, &T, &d);
       if (ret == 3) {
@@ -95,7 +255,8 @@ AGlassCatalog::AGlassCatalog(const std::string& catalog_file) {
         Double_t absl = -d / TMath::Log(T);
         Double_t k =
             ARefractiveIndex::AbsorptionLengthToExtinctionCoefficient(absl, wl);
-        graph->SetPoint(graph->GetN(), wl, k);
+        glass->fWavelength.push_back(wl);
+        glass->fExtinction.push_back(k);
       } else if (ret == 2) {
         // Some glass materials such as N-LASF9 has incomplete lines
         // Just ignore
@@ -104,18 +265,44 @@ AGlassCatalog::AGlassCatalog(const std::string& catalog_file) {
       }
     }
   }
+
+  return kTRUE;
 }
 
 //_____________________________________________________________________________
-AGlassCatalog::~AGlassCatalog() {}
+Bool_t AGlassCatalog::SaveCache() const {
+  // Write the parsed glasses to GetCacheFileName() in a binary format of this
+  // machine
+  FileStat_t st;
+  if (gSystem->GetPathInfo(fCatalogFile.c_str(), st) != 0) {
+    return kFALSE;
+  }
 
-//_____________________________________________________________________________
-std::shared_ptr<ARefractiveIndex> AGlassCatalog::GetRefractiveIndex(
-    const std::string& name) {
-  auto it = fIndexMap.find(name);
-  if (it == fIndexMap.end()) {
-    return 0;
-  } else {
-    return it->second;
+  std::ofstream fout(GetCacheFileName().c_str(), std::ios::binary);
+  if (!fout.is_open()) {
+    Error("SaveCache", "Cannot write %s", GetCacheFileName().c_str());
+    return kFALSE;
+  }
+
+  fout.write(kCacheMagic, sizeof(kCacheMagic));
+  WriteValue(fout, Long64_t(st.fSize));
+  WriteValue(fout, Long64_t(st.fMtime));
+  WriteValue(fout, UInt_t(fGlassMap.size()));
+  for (auto it = fGlassMap.begin(); it != fGlassMap.end(); ++it) {
+    const GlassData& glass = it->second;
+    UInt_t npoints = glass.fWavelength.size();
+    WriteValue(fout, UInt_t(it->first.size()));
+    fout.write(it->first.data(), it->first.size());
+    WriteValue(fout, glass.fFormula);
+    WriteValue(fout, glass.fNcoefficients);
+    WriteValue(fout, glass.fCoefficients);
+    WriteValue(fout, npoints);
+    fout.write(reinterpret_cast<const char*>(glass.fWavelength.data()),
+               npoints * sizeof(Double_t));
+    fout.write(reinterpret_cast<const char*>(glass.fExtinction.data()),
+               npoints * sizeof(Double_t));
   }
+  fout.close();
+
+  return not fout.fail();
 }
@@ -12,6 +12,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "ALens.h"
+#include "AStreamerUtil.h"
 
 ClassImp(ALens);
 
@@ -32,13 +33,19 @@ ALens::ALens(const char* name, const TGeoShape* shape, const TGeoMedium* med)
 #endif
 }
 
+//_____________________________________________________________________________
+void ALens::CountMemory(AMemoryUtil::Counter& counter) const {
+  AOpticalComponent::CountMemory(counter);
+  if (fIndex) fIndex->CountMemory(counter);
+}
+
 //_____________________________________________________________________________
 Double_t ALens::GetAbsorptionLength(Double_t lambda) const {
   if (!fIndex) {
     return std::numeric_limits<Double_t>::infinity();
   }
 
-  Double_t abs = fIndex->GetAbsorptionLength(lambda);
+  Double_t abs = fIndex->GetTabulatedAbsorptionLength(lambda);
 
   return abs;
 }
@@ -49,12 +56,33 @@ Double_t ALens::GetExtinctionCoefficient(Double_t lambda) const {
     return 0;
   }
 
-  Double_t ex = fIndex->GetExtinctionCoefficient(lambda);
+  Double_t ex = fIndex->GetTabulatedExtinctionCoefficient(lambda);
 
   return ex;
 }
 
 //_____________________________________________________________________________
 Double_t ALens::GetRefractiveIndex(Double_t lambda) const {
-  return fIndex ? fIndex->GetRefractiveIndex(lambda) : 1.;
+  return fIndex ? fIndex->GetTabulatedRefractiveIndex(lambda) : 1.;
+}
+
+//_____________________________________________________________________________
+void ALens::Streamer(TBuffer& R__b) {
+  // The refractive index may be shared with other lenses
+  if (R__b.IsReading()) {
+    UInt_t R__s, R__c;
+    Version_t R__v = R__b.ReadVersion(&R__s, &R__c);
+    if (R__v < 2) {
+      R__b.ReadClassBuffer(ALens::Class(), this, R__v, R__s, R__c);
+      return;
+    }
+    AOpticalComponent::Streamer(R__b);
+    AStreamerUtil::ReadShared(R__b, fIndex);
+    R__b.CheckByteCount(R__s, R__c, ALens::IsA());
+  } else {
+    UInt_t R__c = R__b.WriteVersion(ALens::IsA(), kTRUE);
+    AOpticalComponent::Streamer(R__b);
+    AStreamerUtil::WriteShared(R__b, fIndex);
+    R__b.SetByteCount(R__c, kTRUE);
+  }
 }
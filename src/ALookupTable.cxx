@@ -0,0 +1,210 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ALookupTable
+//
+// Table of a 1D or 2D function resampled on a uniform grid. Evaluation is an
+// O(1) linear (bilinear) interpolation between the grid points, without the
+// binary search of TGraph::Eval or the triangle search of
+// TGraph2D::Interpolate. The grid is refined by halving its spacing until the
+// deviation from the original function at the midpoints of the cells (and at
+// given knots, e.g., the data points of a TGraph) falls below a tolerance.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+
+#include "ALookupTable.h"
+
+//_____________________________________________________________________________
+ALookupTable::ALookupTable()
+    : fNx(0),
+      fNy(0),
+      fXmin(0),
+      fXmax(0),
+      fInvDx(0),
+      fYmin(0),
+      fYmax(0),
+      fInvDy(0),
+      fMaxDeviation(0) {}
+
+//_____________________________________________________________________________
+Bool_t ALookupTable::Bake(const std::function<Double_t(Double_t)>& f,
+                          Double_t xmin, Double_t xmax, Double_t tolerance,
+                          const std::vector<Double_t>& knots,
+                          Int_t maxCells) {
+  // Resample f over [xmin, xmax]. Return kFALSE and leave the table empty if
+  // the deviation does not fall below tolerance with maxCells cells.
+  Clear();
+  if (not(xmin < xmax) or not(tolerance > 0)) return kFALSE;
+
+  Int_t n = 16;
+  Double_t dx = (xmax - xmin) / n;
+  std::vector<Double_t> value(n + 1);
+  for (Int_t i = 0; i <= n; i++) value[i] = f(i < n ? xmin + i * dx : xmax);
+
+  std::vector<Double_t> mid;
+  while (true) {
+    // the midpoints are the new grid points of the next refinement
+    Double_t dev = 0;
+    mid.resize(n);
+    for (Int_t i = 0; i < n; i++) {
+      mid[i] = f(xmin + (i + 0.5) * dx);
+      dev = std::max(dev, std::abs(mid[i] - (value[i] + value[i + 1]) / 2));
+    }
+    for (std::size_t k = 0; k < knots.size(); k++) {
+      Double_t x = knots[k];
+      if (x < xmin or xmax < x) continue;
+      Double_t u = (x - xmin) / dx;
+      Int_t i = std::min(Int_t(u), n - 1);
+      Double_t y = value[i] + (u - i) * (value[i + 1] - value[i]);
+      dev = std::max(dev, std::abs(f(x) - y));
+    }
+
+    if (dev <= tolerance) {
+      fNx = n;
+      fXmin = xmin;
+      fXmax = xmax;
+      fInvDx = 1. / dx;
+      fMaxDeviation = dev;
+      fValue.swap(value);
+      return kTRUE;
+    } else if (2 * n > maxCells or std::isnan(dev)) {
+      fMaxDeviation = dev;
+      return kFALSE;
+    }
+
+    std::vector<Double_t> refined(2 * n + 1);
+    for (Int_t i = 0; i < n; i++) {
+      refined[2 * i] = value[i];
+      refined[2 * i + 1] = mid[i];
+    }
+    refined[2 * n] = value[n];
+    value.swap(refined);
+    n *= 2;
+    dx /= 2;
+  }
+}
+
+//_____________________________________________________________________________
+Bool_t ALookupTable::Bake(const std::function<Double_t(Double_t, Double_t)>& f,
+                          Double_t xmin, Double_t xmax, Double_t ymin,
+                          Double_t ymax, Double_t tolerance, Int_t maxCells,
+                          Bool_t discard) {
+  // Resample f over [xmin, xmax]x[ymin, ymax] (see BakeBatch)
+  return BakeBatch(
+      [&f](std::size_t n, const Double_t* x, const Double_t* y, Double_t* z) {
+        for (std::size_t i = 0; i < n; i++) z[i] = f(x[i], y[i]);
+      },
+      xmin, xmax, ymin, ymax, tolerance, maxCells, discard);
+}
+
+//_____________________________________________________________________________
+Bool_t ALookupTable::BakeBatch(const BatchFunction2D& f, Double_t xmin,
+                               Double_t xmax, Double_t ymin, Double_t ymax,
+                               Double_t tolerance, Int_t maxCells,
+                               Bool_t discard) {
+  // Resample f over [xmin, xmax]x[ymin, ymax]. Each axis is refined
+  // separately depending on the deviations at the midpoints of the cell
+  // edges along it. If discard is kFALSE, the finest table is kept even when
+  // the tolerance is not reached.
+  //
+  // f(n, x, y, z) must fill z[i] = f(x[i], y[i]) for i < n. All the points of
+  // a refinement step are given at once, so that f can evaluate them in
+  // parallel.
+  Clear();
+  if (not(xmin < xmax) or not(ymin < ymax) or not(tolerance > 0)) {
+    return kFALSE;
+  }
+
+  Int_t nx = 16, ny = 16;
+  std::vector<Double_t> px, py, pz;
+  while (true) {
+    Double_t dx = (xmax - xmin) / nx;
+    Double_t dy = (ymax - ymin) / ny;
+
+    // grid points, then the midpoints of the edges along X and Y, then the
+    // centers of the cells
+    px.clear();
+    py.clear();
+    for (Int_t k = 0; k < 4; k++) {
+      Double_t sx = (k == 1 or k == 3) ? 0.5 : 0;
+      Double_t sy = (k == 2 or k == 3) ? 0.5 : 0;
+      Int_t mx = sx > 0 ? nx - 1 : nx;
+      Int_t my = sy > 0 ? ny - 1 : ny;
+      for (Int_t j = 0; j <= my; j++) {
+        Double_t y = (j < ny or sy > 0) ? ymin + (j + sy) * dy : ymax;
+        for (Int_t i = 0; i <= mx; i++) {
+          px.push_back((i < nx or sx > 0) ? xmin + (i + sx) * dx : xmax);
+          py.push_back(y);
+        }
+      }
+    }
+    pz.resize(px.size());
+    f(px.size(), px.data(), py.data(), pz.data());
+
+    const Double_t* value = pz.data();
+    const Double_t* midx = value + (nx + 1) * (ny + 1);
+    const Double_t* midy = midx + nx * (ny + 1);
+    const Double_t* center = midy + (nx + 1) * ny;
+
+    Double_t devx = 0, devy = 0, devc = 0;
+    for (Int_t j = 0; j <= ny; j++) {
+      for (Int_t i = 0; i <= nx; i++) {
+        const Double_t* p = &value[i + j * (nx + 1)];
+        if (i < nx) {
+          Double_t z = (p[0] + p[1]) / 2;
+          devx = std::max(devx, std::abs(midx[i + j * nx] - z));
+        }
+        if (j < ny) {
+          Double_t z = (p[0] + p[nx + 1]) / 2;
+          devy = std::max(devy, std::abs(midy[i + j * (nx + 1)] - z));
+        }
+        if (i < nx and j < ny) {
+          Double_t z = (p[0] + p[1] + p[nx + 1] + p[nx + 2]) / 4;
+          devc = std::max(devc, std::abs(center[i + j * nx] - z));
+        }
+      }
+    }
+
+    Double_t dev = std::max(std::max(devx, devy), devc);
+    Bool_t refinex = devx > tolerance or (devc > tolerance and devx >= devy);
+    Bool_t refiney = devy > tolerance or (devc > tolerance and devy >= devx);
+    Bool_t ok = dev <= tolerance;
+    Bool_t last = std::isnan(dev) or (refinex and 2 * nx > maxCells) or
+                  (refiney and 2 * ny > maxCells);
+    if (ok or (last and not discard and not std::isnan(dev))) {
+      fNx = nx;
+      fNy = ny;
+      fXmin = xmin;
+      fXmax = xmax;
+      fInvDx = 1. / dx;
+      fYmin = ymin;
+      fYmax = ymax;
+      fInvDy = 1. / dy;
+      fMaxDeviation = dev;
+      fValue.assign(value, midx);
+      return ok;
+    } else if (last) {
+      fMaxDeviation = dev;
+      return kFALSE;
+    }
+
+    if (refinex) nx *= 2;
+    if (refiney) ny *= 2;
+  }
+}
+
+//_____________________________________________________________________________
+void ALookupTable::Clear() {
+  fNx = fNy = 0;
+  fXmin = fXmax = fInvDx = 0;
+  fYmin = fYmax = fInvDy = 0;
+  fMaxDeviation = 0;
+  std::vector<Double_t>().swap(fValue);
+}
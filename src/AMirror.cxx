@@ -9,16 +9,48 @@
 //
 // Mirror class
 //
+// Angle-dependent reflectance data (TGraph2D or TH2) are converted into an
+// immutable regular (lambda, angle) grid when they are set, so that
+// GetReflectance is a const, lock-free and O(1) lookup which can be called
+// from multiple tracing threads. TGraph2D::Interpolate (a Delaunay search)
+// and TH2::Interpolate are not called during ray tracing. Mirrors sharing the
+// same data also share the grid. Outside the range of the data, the values at
+// the edges of the grid are used.
+//
+// The reflectance curve vs wavelength can be baked into a table on a uniform
+// grid by BakeReflectance, which is then used in ray tracing instead of
+// TGraph::Eval within the range of the curve.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <map>
+
 #include "AMirror.h"
+#include "AStreamerUtil.h"
+#include "TAxis.h"
 #include "TGraph.h"
 #include "TGraph2D.h"
+#include "TMath.h"
 
 ClassImp(AMirror);
 
+constexpr Double_t AMirror::kGridTolerance;
+
+namespace {
+
+// Grids already made from the reflectance data, keyed by the data and the
+// tolerance. The data are alive as long as the mirrors refer to them.
+struct SharedGrid {
+  std::weak_ptr<const void> fSource;
+  std::weak_ptr<const ALookupTable> fGrid;
+};
+std::mutex gSharedGridMutex;
+std::map<std::pair<const void*, Double_t>, SharedGrid> gSharedGrid;
+
+}  // namespace
+
 //_____________________________________________________________________________
-AMirror::AMirror() {
+AMirror::AMirror() : fGridReady(kFALSE) {
   // Default constructor
   fReflectance = 1.0;
   SetLineColor(16);
@@ -27,7 +59,7 @@ AMirror::AMirror() {
 //_____________________________________________________________________________
 AMirror::AMirror(const char* name, const TGeoShape* shape,
                  const TGeoMedium* med)
-    : AOpticalComponent(name, shape, med) {
+    : AOpticalComponent(name, shape, med), fGridReady(kFALSE) {
   fReflectance = 1.0;
   SetLineColor(16);
 }
@@ -36,17 +68,75 @@ AMirror::AMirror(const char* name, const TGeoShape* shape,
 AMirror::~AMirror() {}
 
 //_____________________________________________________________________________
-Double_t AMirror::GetReflectance(Double_t lambda, Double_t angle) {
+Bool_t AMirror::BakeReflectance(Double_t tolerance) {
+  // Resample the reflectance data in its range until the deviation from the
+  // original values becomes smaller than tolerance. The 1D table is discarded
+  // if it fails, while the (lambda, angle) grid is kept at its finest. Bake it
+  // again if the data are modified.
+  Bool_t ok = kFALSE;
+  if (fReflectance2D or fReflectanceTH2) {
+    std::lock_guard<std::mutex> lock(fGridMutex);
+    MakeReflectanceGrid(tolerance);
+    return fReflectanceGrid and
+           fReflectanceGrid->GetMaxDeviation() <= tolerance;
+  } else if (fReflectance1D and fReflectance1D->GetN() > 1) {
+    std::shared_ptr<const TGraph> g = fReflectance1D;
+    Int_t n = g->GetN();
+    std::vector<Double_t> knots(g->GetX(), g->GetX() + n);
+    ok = fReflectanceTable.Bake([g](Double_t x) { return g->Eval(x); },
+                                TMath::MinElement(n, g->GetX()),
+                                TMath::MaxElement(n, g->GetX()), tolerance,
+                                knots);
+  } else {
+    fReflectanceTable.Clear();
+    return kFALSE;  // nothing to be baked
+  }
+
+  if (not ok) {
+    Warning("BakeReflectance", "Failed to reach the tolerance (%g)",
+            tolerance);
+  }
+
+  return ok;
+}
+
+//_____________________________________________________________________________
+void AMirror::CountMemory(AMemoryUtil::Counter& counter) const {
+  // The reflectance data and the grid are counted once even if shared
+  AOpticalComponent::CountMemory(counter);
+  counter.AddBytes(fReflectanceTable.GetMemoryUsage());
+  counter.Add(fReflectance1D.get(), AMemoryUtil::SizeOf(fReflectance1D.get()));
+  counter.Add(fReflectance2D.get(), AMemoryUtil::SizeOf(fReflectance2D.get()));
+  counter.Add(fReflectanceTH2.get(),
+              AMemoryUtil::SizeOf(fReflectanceTH2.get()));
+
+  if (fGridReady.load(std::memory_order_acquire) and fReflectanceGrid) {
+    counter.Add(fReflectanceGrid.get(), sizeof(ALookupTable) +
+                                            fReflectanceGrid->GetMemoryUsage());
+  }
+}
+
+//_____________________________________________________________________________
+Double_t AMirror::GetReflectance(Double_t lambda, Double_t angle) const {
   // Return mirror reflectance for a photon whose wavelength is lambda, and
   // whose incident angle is "angle" (rad)
-  // This method should be const but TGraph2D::Interpolate and TH2::Interpolate
-  // are non-const methods.
   Double_t ret;
 
-  if (fReflectance2D) {
-    ret = fReflectance2D->Interpolate(lambda, angle); // non-const as of 6.18
-  } else if (fReflectanceTH2) {
-    ret = fReflectanceTH2->Interpolate(lambda, angle); // const since ROOT 6.19
+  if (fReflectance2D or fReflectanceTH2) {
+    PrepareReflectanceGrid();  // only when read from a file
+    const ALookupTable* grid = fReflectanceGrid.get();
+    if (grid) {
+      lambda = TMath::Min(TMath::Max(lambda, grid->GetXmin()), grid->GetXmax());
+      angle = TMath::Min(TMath::Max(angle, grid->GetYmin()), grid->GetYmax());
+      ret = grid->Eval(lambda, angle);
+    } else {
+      // degenerate data which cannot be gridded, e.g., a single wavelength
+      std::lock_guard<std::mutex> lock(fGridMutex);
+      ret = fReflectance2D ? fReflectance2D->Interpolate(lambda, angle)
+                           : fReflectanceTH2->Interpolate(lambda, angle);
+    }
+  } else if (fReflectanceTable.Contains(lambda)) {
+    ret = fReflectanceTable.Eval(lambda);
   } else if (fReflectance1D) {
     ret = fReflectance1D->Eval(lambda); // const
   } else {
@@ -58,3 +148,115 @@ Double_t AMirror::GetReflectance(Double_t lambda, Double_t angle) {
 
   return ret;
 }
+
+//_____________________________________________________________________________
+void AMirror::MakeReflectanceGrid(Double_t tolerance) const {
+  // Convert the 2D reflectance data into a grid, or reuse the one made for
+  // the same data. fGridMutex must be locked by the caller.
+  fReflectanceGrid.reset();
+  std::shared_ptr<const void> source;
+  if (fReflectance2D) {
+    source = fReflectance2D;
+  } else if (fReflectanceTH2) {
+    source = fReflectanceTH2;
+  }
+
+  if (source) {
+    std::lock_guard<std::mutex> lock(gSharedGridMutex);
+    SharedGrid& shared = gSharedGrid[std::make_pair(source.get(), tolerance)];
+    if (shared.fSource.lock() == source) {
+      fReflectanceGrid = shared.fGrid.lock();
+    }
+
+    if (not fReflectanceGrid) {
+      std::shared_ptr<ALookupTable> grid = std::make_shared<ALookupTable>();
+      if (fReflectance2D) {
+        std::shared_ptr<TGraph2D> g = fReflectance2D;
+        grid->Bake([g](Double_t x, Double_t y) { return g->Interpolate(x, y); },
+                   g->GetXmin(), g->GetXmax(), g->GetYmin(), g->GetYmax(),
+                   tolerance, ALookupTable::kMaxCells2D, kFALSE);
+      } else {
+        std::shared_ptr<TH2> h = fReflectanceTH2;
+        const TAxis* xaxis = h->GetXaxis();
+        const TAxis* yaxis = h->GetYaxis();
+        grid->Bake([h](Double_t x, Double_t y) { return h->Interpolate(x, y); },
+                   xaxis->GetBinCenter(1),
+                   xaxis->GetBinCenter(xaxis->GetNbins()),
+                   yaxis->GetBinCenter(1),
+                   yaxis->GetBinCenter(yaxis->GetNbins()), tolerance,
+                   ALookupTable::kMaxCells2D, kFALSE);
+      }
+
+      if (grid->IsEmpty()) {
+        Warning("MakeReflectanceGrid",
+                "Cannot convert the reflectance data into a grid");
+      } else {
+        if (grid->GetMaxDeviation() > tolerance) {
+          Warning("MakeReflectanceGrid",
+                  "Max deviation from the reflectance data is %g",
+                  grid->GetMaxDeviation());
+        }
+        fReflectanceGrid = grid;
+        shared.fSource = source;
+        shared.fGrid = fReflectanceGrid;
+      }
+    }
+  }
+
+  fGridReady.store(kTRUE, std::memory_order_release);
+}
+
+//_____________________________________________________________________________
+void AMirror::SetReflectance(std::shared_ptr<TH2> ref) {
+  // Set the reflectance data (ref v.s. angle v.s. wavelength), which are
+  // converted into a grid immediately
+  std::lock_guard<std::mutex> lock(fGridMutex);
+  fReflectanceTH2 = ref;
+  MakeReflectanceGrid(kGridTolerance);
+}
+
+//_____________________________________________________________________________
+void AMirror::SetReflectance(std::shared_ptr<TGraph2D> ref) {
+  // Set the reflectance data (ref v.s. angle v.s. wavelength), which are
+  // converted into a grid immediately
+  std::lock_guard<std::mutex> lock(fGridMutex);
+  fReflectance2D = ref;
+  MakeReflectanceGrid(kGridTolerance);
+}
+
+//_____________________________________________________________________________
+void AMirror::Streamer(TBuffer& R__b) {
+  // The reflectance data and the baked tables are written once even if they
+  // are shared with other mirrors
+  if (R__b.IsReading()) {
+    UInt_t R__s, R__c;
+    Version_t R__v = R__b.ReadVersion(&R__s, &R__c);
+    if (R__v < 2) {
+      R__b.ReadClassBuffer(AMirror::Class(), this, R__v, R__s, R__c);
+      return;
+    }
+    AOpticalComponent::Streamer(R__b);
+    R__b >> fReflectance;
+    AStreamerUtil::ReadShared(R__b, fReflectance1D);
+    AStreamerUtil::ReadShared(R__b, fReflectance2D);
+    AStreamerUtil::ReadShared(R__b, fReflectanceTH2);
+    AStreamerUtil::StreamTable(R__b, fReflectanceTable);
+    Bool_t ready;
+    R__b >> ready;
+    AStreamerUtil::ReadShared(R__b, fReflectanceGrid);
+    fGridReady.store(ready, std::memory_order_release);
+    R__b.CheckByteCount(R__s, R__c, AMirror::IsA());
+  } else {
+    UInt_t R__c = R__b.WriteVersion(AMirror::IsA(), kTRUE);
+    AOpticalComponent::Streamer(R__b);
+    R__b << fReflectance;
+    AStreamerUtil::WriteShared(R__b, fReflectance1D);
+    AStreamerUtil::WriteShared(R__b, fReflectance2D);
+    AStreamerUtil::WriteShared(R__b, fReflectanceTH2);
+    AStreamerUtil::StreamTable(R__b, fReflectanceTable);
+    std::lock_guard<std::mutex> lock(fGridMutex);
+    R__b << fGridReady.load(std::memory_order_acquire);
+    AStreamerUtil::WriteShared(R__b, fReflectanceGrid);
+    R__b.SetByteCount(R__c, kTRUE);
+  }
+}
@@ -0,0 +1,147 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AMisalignmentEnsemble
+//
+// Set of N realisations of the misalignment of some nodes, typically the
+// mirror facets of a dish, used to study alignment tolerances without
+// building the geometry N times. Each node has, in each realisation, a small
+// rotation (rotation vector rx, ry, rz in rad) about the origin of its local
+// frame followed by an offset (dx, dy, dz) along the local axes, i.e., the
+// local-to-master matrix M of the node becomes M * delta.
+//
+//   AMisalignmentEnsemble ensemble(300);
+//   for (Int_t i = 0; i < top->GetNdaughters(); i++) {
+//     TGeoNode* node = top->GetNode(i);
+//     if (manager->IsMirror(node)) ensemble.AddNode(node);
+//   }
+//   ensemble.Randomize(1e-4, 1 * mm, 1);  // sigmas of tilt (rad) and offset
+//
+//   std::vector<ARayArray*> arrays;  // the same rays in each realisation
+//   for (Int_t i = 0; i < ensemble.GetN(); i++) {
+//     arrays.push_back(ARayShooter::Circle(400 * nm, 6 * m, 50, 64, 0, 0));
+//   }
+//   manager->TraceEnsemble(ensemble, arrays);
+//   // arrays[i] holds the rays traced in realisation i
+//
+// The misalignments are applied by AOpticsManager::TraceEnsemble at the
+// intersection time only, and the geometry itself is left untouched. Note
+// that a spherical facet made of a TGeoSphere has its local origin at its
+// center of curvature.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TGeoMatrix.h"
+#include "TMath.h"
+
+#include "ACounterRandom.h"
+#include "AMisalignmentEnsemble.h"
+
+ClassImp(AMisalignmentEnsemble);
+
+//_____________________________________________________________________________
+AMisalignmentEnsemble::AMisalignmentEnsemble(Int_t n) : fN(n < 1 ? 1 : n) {}
+
+//_____________________________________________________________________________
+Int_t AMisalignmentEnsemble::AddNode(TGeoNode* node) {
+  // Add a node to be misaligned, and return its index. It must be placed in
+  // the top volume, directly or through assemblies. Its misalignment is zero
+  // in all the realisations until SetMisalignment or Randomize is called.
+  if (!node) {
+    Error("AddNode", "Null node");
+    return -1;
+  }
+
+  std::size_t nnodes = fNodes.size();
+  std::vector<Double_t> parameters(fN * (nnodes + 1) * kNparameters, 0.);
+  for (Int_t i = 0; i < fN; i++) {
+    for (std::size_t j = 0; j < nnodes * kNparameters; j++) {
+      parameters[(i * (nnodes + 1)) * kNparameters + j] =
+          fParameters[i * nnodes * kNparameters + j];
+    }
+  }
+  fParameters.swap(parameters);
+  fNodes.push_back(node);
+
+  return Int_t(nnodes);
+}
+
+//_____________________________________________________________________________
+void AMisalignmentEnsemble::GetMatrix(Int_t realisation, Int_t node,
+                                      TGeoHMatrix& delta) const {
+  // Give the local misalignment matrix of node in realisation
+  const Double_t* p = GetParameters(realisation, node);
+
+  // Rodrigues' rotation formula of the rotation vector (p[0], p[1], p[2])
+  Double_t angle = TMath::Sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+  Double_t rot[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+  if (angle > 0) {
+    Double_t k[3] = {p[0] / angle, p[1] / angle, p[2] / angle};
+    Double_t s = TMath::Sin(angle);
+    Double_t c = 1 - TMath::Cos(angle);
+    Double_t K[9] = {0, -k[2], k[1], k[2], 0, -k[0], -k[1], k[0], 0};
+    for (Int_t i = 0; i < 3; i++) {
+      for (Int_t j = 0; j < 3; j++) {
+        Double_t K2 = 0;
+        for (Int_t l = 0; l < 3; l++) K2 += K[i * 3 + l] * K[l * 3 + j];
+        rot[i * 3 + j] += s * K[i * 3 + j] + c * K2;
+      }
+    }
+  }
+
+  delta = TGeoHMatrix();
+  delta.SetRotation(rot);
+  delta.SetTranslation(p + 3);
+}
+
+//_____________________________________________________________________________
+void AMisalignmentEnsemble::Randomize(Double_t tilt, Double_t offset,
+                                      ULong64_t seed, Double_t spin,
+                                      Double_t defocus) {
+  // Give all the nodes in all the realisations Gaussian misalignments. tilt
+  // is the sigma of the rotations about the local X and Y axes, spin that
+  // about the local Z axis, offset the sigma of the offsets along X and Y,
+  // and defocus that along Z (the same as offset if negative). Realisation i
+  // of node j depends only on (seed, i, j), so that adding realisations or
+  // nodes does not change the existing ones.
+  if (defocus < 0) defocus = offset;
+
+  for (Int_t i = 0; i < fN; i++) {
+    for (Int_t j = 0; j < GetNnodes(); j++) {
+      ACounterRandom rng(seed, (ULong64_t(i) << 32) | UInt_t(j));
+      Double_t* p = GetParameters(i, j);
+      p[0] = rng.Gaus(0, tilt);
+      p[1] = rng.Gaus(0, tilt);
+      p[2] = spin > 0 ? rng.Gaus(0, spin) : 0;
+      p[3] = rng.Gaus(0, offset);
+      p[4] = rng.Gaus(0, offset);
+      p[5] = rng.Gaus(0, defocus);
+    }
+  }
+}
+
+//_____________________________________________________________________________
+void AMisalignmentEnsemble::SetMisalignment(Int_t realisation, Int_t node,
+                                            Double_t rx, Double_t ry,
+                                            Double_t rz, Double_t dx,
+                                            Double_t dy, Double_t dz) {
+  // Set the rotation vector (rad) and the offset of node in realisation
+  if (realisation < 0 or realisation >= fN or node < 0 or
+      node >= GetNnodes()) {
+    Error("SetMisalignment", "Invalid realisation (%d) or node (%d)",
+          realisation, node);
+    return;
+  }
+
+  Double_t* p = GetParameters(realisation, node);
+  p[0] = rx;
+  p[1] = ry;
+  p[2] = rz;
+  p[3] = dx;
+  p[4] = dy;
+  p[5] = dz;
+}
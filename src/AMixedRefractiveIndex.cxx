@@ -12,9 +12,19 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "AMixedRefractiveIndex.h"
+#include "AStreamerUtil.h"
+
+#include <vector>
 
 ClassImp(AMixedRefractiveIndex);
 
+//_____________________________________________________________________________
+AMixedRefractiveIndex::AMixedRefractiveIndex()
+    : ARefractiveIndex(), fFractionA(1), fFractionB(0) {
+  // Default constructor for ROOT I/O
+}
+
+//_____________________________________________________________________________
 AMixedRefractiveIndex::AMixedRefractiveIndex(
     std::shared_ptr<ARefractiveIndex> materialA,
     std::shared_ptr<ARefractiveIndex> materialB, Double_t fractionA,
@@ -23,3 +33,72 @@ AMixedRefractiveIndex::AMixedRefractiveIndex(
   fFractionA = fractionA / (fractionA + fractionB);
   fFractionB = fractionB / (fractionA + fractionB);
 }
+
+//_____________________________________________________________________________
+Bool_t AMixedRefractiveIndex::CountMemory(AMemoryUtil::Counter& counter) const {
+  // The two materials are counted too, unless already counted elsewhere
+  if (not ARefractiveIndex::CountMemory(counter)) return kFALSE;
+
+  if (fMaterialA) fMaterialA->CountMemory(counter);
+  if (fMaterialB) fMaterialB->CountMemory(counter);
+
+  return kTRUE;
+}
+
+//_____________________________________________________________________________
+void AMixedRefractiveIndex::GetExtinctionCoefficient(const Double_t* lambda,
+                                                     Double_t* k,
+                                                     std::size_t count) const {
+  // Calculate the extinction coefficients at count wavelengths with the batch
+  // APIs of the two materials
+  std::vector<Double_t> kB(count);
+  fMaterialA->GetExtinctionCoefficient(lambda, k, count);
+  fMaterialB->GetExtinctionCoefficient(lambda, kB.data(), count);
+  const Double_t fA = fFractionA, fB = fFractionB;
+  for (std::size_t i = 0; i < count; i++) {
+    k[i] = k[i] * fA + kB[i] * fB;
+  }
+}
+
+//_____________________________________________________________________________
+void AMixedRefractiveIndex::GetRefractiveIndex(const Double_t* lambda,
+                                               Double_t* n,
+                                               std::size_t count) const {
+  // Calculate the refractive indices at count wavelengths with the batch APIs
+  // of the two materials
+  std::vector<Double_t> nB(count);
+  fMaterialA->GetRefractiveIndex(lambda, n, count);
+  fMaterialB->GetRefractiveIndex(lambda, nB.data(), count);
+  const Double_t fA = fFractionA, fB = fFractionB;
+  for (std::size_t i = 0; i < count; i++) {
+    n[i] = n[i] * fA + nB[i] * fB;
+  }
+}
+
+//_____________________________________________________________________________
+void AMixedRefractiveIndex::Streamer(TBuffer& R__b) {
+  // The two materials may be shared with other components
+  if (R__b.IsReading()) {
+    UInt_t R__s, R__c;
+    Version_t R__v = R__b.ReadVersion(&R__s, &R__c);
+    if (R__v < 2) {
+      R__b.ReadClassBuffer(AMixedRefractiveIndex::Class(), this, R__v, R__s,
+                           R__c);
+      return;
+    }
+    ARefractiveIndex::Streamer(R__b);
+    AStreamerUtil::ReadShared(R__b, fMaterialA);
+    AStreamerUtil::ReadShared(R__b, fMaterialB);
+    R__b >> fFractionA;
+    R__b >> fFractionB;
+    R__b.CheckByteCount(R__s, R__c, AMixedRefractiveIndex::IsA());
+  } else {
+    UInt_t R__c = R__b.WriteVersion(AMixedRefractiveIndex::IsA(), kTRUE);
+    ARefractiveIndex::Streamer(R__b);
+    AStreamerUtil::WriteShared(R__b, fMaterialA);
+    AStreamerUtil::WriteShared(R__b, fMaterialB);
+    R__b << fFractionA;
+    R__b << fFractionB;
+    R__b.SetByteCount(R__c, kTRUE);
+  }
+}
@@ -12,7 +12,11 @@
 #include "AMultilayer.h"
 #include "A2x2ComplexMatrix.h"
 #include "AOpticsManager.h"
+#include "AStreamerUtil.h"
+#include "AThreadPool.h"
 
+#include <algorithm>
+#include <atomic>
 #include <complex>
 #include <iostream>
 
@@ -23,14 +27,89 @@ ClassImp(AMultilayer);
 
 AMultilayer::AMultilayer(std::shared_ptr<ARefractiveIndex> top,
                          std::shared_ptr<ARefractiveIndex> bottom)
-    : fNthreads(1) {
+    : fNthreads(1), fPool(0) {
   fRefractiveIndexList.push_back(bottom);
   fThicknessList.push_back(inf);
   InsertLayer(top, inf);
 }
 
 //______________________________________________________________________________
-AMultilayer::~AMultilayer() {}
+AMultilayer::AMultilayer() : fNthreads(1), fPool(0) {
+  // Default constructor for ROOT I/O
+}
+
+//______________________________________________________________________________
+AMultilayer::AMultilayer(const AMultilayer& other)
+    : TObject(other),
+      fRefractiveIndexList(other.fRefractiveIndexList),
+      fThicknessList(other.fThicknessList),
+      fNthreads(other.fNthreads),
+      fPool(0),
+      fPreCalculatedReflectanceMixed(other.fPreCalculatedReflectanceMixed),
+      fPreCalculatedTransmittanceMixed(other.fPreCalculatedTransmittanceMixed),
+      fReflectanceTable(other.fReflectanceTable),
+      fTransmittanceTable(other.fTransmittanceTable) {
+  // Copy constructor. The threads are not shared with other.
+}
+
+//______________________________________________________________________________
+AMultilayer::~AMultilayer() { delete fPool; }
+
+//______________________________________________________________________________
+AMultilayer& AMultilayer::operator=(const AMultilayer& other) {
+  if (this != &other) {
+    TObject::operator=(other);
+    fRefractiveIndexList = other.fRefractiveIndexList;
+    fThicknessList = other.fThicknessList;
+    fPreCalculatedReflectanceMixed = other.fPreCalculatedReflectanceMixed;
+    fPreCalculatedTransmittanceMixed = other.fPreCalculatedTransmittanceMixed;
+    fReflectanceTable = other.fReflectanceTable;
+    fTransmittanceTable = other.fTransmittanceTable;
+    SetNthreads(other.fNthreads);
+  }
+
+  return *this;
+}
+
+//______________________________________________________________________________
+void AMultilayer::ForEachChunk(
+    std::size_t n,
+    const std::function<void(std::size_t, std::size_t)>& func) const {
+  // Call func(first, last) for the chunks [first, last) of [0, n). The
+  // threads are started at the first call and reused afterward. Each of them
+  // takes the next chunk from a shared counter when it finishes one, so that
+  // *this is shared by reference among them instead of being copied.
+  //
+  // If ROOT::EnableImplicitMT has been called, the chunks are processed as
+  // tasks in the thread pool of ROOT instead, and at most fNthreads of them
+  // run at the same time.
+  if (n == 0) return;
+  if (fNthreads < 2 or n < 2) {
+    func(0, n);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(fPoolMutex);
+  if (fPool and fPool->UsesImplicitMT() != AThreadPool::IsImplicitMTEnabled()) {
+    delete fPool;
+    fPool = 0;
+  }
+  if (not fPool) fPool = new AThreadPool(fNthreads);
+
+  std::atomic<std::size_t> next(0);
+  std::size_t chunk = std::max<std::size_t>(1, n / (8 * fNthreads));
+  std::size_t ntasks = std::min(fNthreads, (n - 1) / chunk + 1);
+  for (std::size_t i = 0; i < ntasks; ++i) {
+    fPool->Push([&func, &next, chunk, n]() {
+      while (kTRUE) {
+        std::size_t first = next.fetch_add(chunk);
+        if (first >= n) break;
+        func(first, std::min(first + chunk, n));
+      }
+    });
+  }
+  fPool->Wait();
+}
 
 //______________________________________________________________________________
 Bool_t AMultilayer::IsForwardAngle(std::complex<Double_t> n,
@@ -67,25 +146,22 @@ Bool_t AMultilayer::IsForwardAngle(std::complex<Double_t> n,
     answer = ncostheta.real() > 0;
   }
   // double-check the answer ... can't be too careful!
-  std::string error_string(
-      Form("It's not clear which beam is incoming vs outgoing. Weird"
-           " index maybe?\n"
-           "n: %.3e + %.3ei   angle: %.3e + %.3ei",
-           n.real(), n.imag(), theta.real(), theta.imag()));
+  // (the message is formatted only when needed not to allocate memory)
+  auto error = [&]() {
+    Error("IsForwardAngle",
+          "It's not clear which beam is incoming vs outgoing. Weird"
+          " index maybe?\n"
+          "n: %.3e + %.3ei   angle: %.3e + %.3ei",
+          n.real(), n.imag(), theta.real(), theta.imag());
+  };
   if (answer == true) {
-    if (ncostheta.imag() <= -100 * EPSILON)
-      Error("IsForwardAngle", "%s", error_string.c_str());
-    if (ncostheta.real() <= -100 * EPSILON)
-      Error("IsForwardAngle", "%s", error_string.c_str());
-    if ((n * std::cos(std::conj(theta))).real() <= -100 * EPSILON)
-      Error("IsForwardAngle", "%s", error_string.c_str());
+    if (ncostheta.imag() <= -100 * EPSILON) error();
+    if (ncostheta.real() <= -100 * EPSILON) error();
+    if ((n * std::cos(std::conj(theta))).real() <= -100 * EPSILON) error();
   } else {
-    if (ncostheta.imag() >= 100 * EPSILON)
-      Error("IsForwardAngle", "%s", error_string.c_str());
-    if (ncostheta.real() >= 100 * EPSILON)
-      Error("IsForwardAngle", "%s", error_string.c_str());
-    if ((n * std::cos(std::conj(theta))).real() < 100 * EPSILON)
-      Error("IsForwardAngle", "%s", error_string.c_str());
+    if (ncostheta.imag() >= 100 * EPSILON) error();
+    if (ncostheta.real() >= 100 * EPSILON) error();
+    if ((n * std::cos(std::conj(theta))).real() < 100 * EPSILON) error();
   }
   return answer;
 }
@@ -124,6 +200,29 @@ void AMultilayer::ListSnell(
   }
 }
 
+//______________________________________________________________________________
+Bool_t AMultilayer::CountMemory(AMemoryUtil::Counter& counter) const {
+  // Add the bytes of this object, its tables, pre-calculated histograms and
+  // layer materials to counter. Returns kFALSE if this has already been
+  // counted. Materials shared by several layers are counted only once.
+  ULong64_t bytes = AMemoryUtil::SizeOf(this) +
+                    AMemoryUtil::Capacity(fRefractiveIndexList) +
+                    AMemoryUtil::Capacity(fThicknessList) +
+                    fReflectanceTable.GetMemoryUsage() +
+                    fTransmittanceTable.GetMemoryUsage();
+  if (not counter.Add(this, bytes)) return kFALSE;
+
+  for (std::size_t i = 0; i < fRefractiveIndexList.size(); i++) {
+    if (fRefractiveIndexList[i]) fRefractiveIndexList[i]->CountMemory(counter);
+  }
+  counter.Add(fPreCalculatedReflectanceMixed.get(),
+              AMemoryUtil::SizeOf(fPreCalculatedReflectanceMixed.get()));
+  counter.Add(fPreCalculatedTransmittanceMixed.get(),
+              AMemoryUtil::SizeOf(fPreCalculatedTransmittanceMixed.get()));
+
+  return kTRUE;
+}
+
 //______________________________________________________________________________
 void AMultilayer::InsertLayer(std::shared_ptr<ARefractiveIndex> idx,
                               Double_t thickness) {
@@ -135,6 +234,7 @@ void AMultilayer::InsertLayer(std::shared_ptr<ARefractiveIndex> idx,
   // ----------------- Bottom layer
   fRefractiveIndexList.insert(fRefractiveIndexList.end() - 1, idx);
   fThicknessList.insert(fThicknessList.end() - 1, thickness);
+  ClearTables();  // made for the old layers
 }
 
 //______________________________________________________________________________
@@ -142,6 +242,18 @@ void AMultilayer::CoherentTMM(EPolarization polarization,
                               std::complex<Double_t> th_0, Double_t lam_vac,
                               Double_t& reflectance,
                               Double_t& transmittance) const {
+  // Same as below but in a workspace owned by each thread, which grows only
+  // when a multilayer with more layers comes. No memory is allocated per call
+  // once the workspace has grown.
+  static thread_local Workspace ws;
+  CoherentTMM(polarization, th_0, lam_vac, reflectance, transmittance, ws);
+}
+
+//______________________________________________________________________________
+void AMultilayer::CoherentTMM(EPolarization polarization,
+                              std::complex<Double_t> th_0, Double_t lam_vac,
+                              Double_t& reflectance, Double_t& transmittance,
+                              Workspace& ws) const {
   // Copied from tmm.ch_tmm
 
   // Main "coherent transfer matrix method" calc. Given parameters of a stack,
@@ -166,95 +278,22 @@ void AMultilayer::CoherentTMM(EPolarization polarization,
   // "inf".
   //
   // lam_vac is vacuum wavelength of the light.
+  //
+  // All the intermediate lists are kept in ws, which can be reused among
+  // calls.
 
+  ComputeLayers(th_0, lam_vac, ws);
   auto num_layers = fRefractiveIndexList.size();
-  std::vector<std::complex<Double_t>> n_list(num_layers);
-
-  {
-    auto n_i = n_list.begin();
-    auto ref_i = fRefractiveIndexList.cbegin();
-    for (std::size_t i = 0; i < num_layers; ++i) {
-      *n_i = (*ref_i)->GetComplexRefractiveIndex(lam_vac);
-      ++n_i;
-      ++ref_i;
-    }
-  }
-
-  // Input tests
-  if (std::abs((n_list[0] * std::sin(th_0)).imag()) >= 100 * EPSILON ||
-      !IsForwardAngle(n_list[0], th_0)) {
-    Error("CoherentTMM", "Error in n0 or th0!");
-  }
-
-  // th_list is a list with, for each layer, the angle that the light travels
-  // through the layer. Computed with Snell's law. Note that the "angles" may be
-  // complex!
-  std::vector<std::complex<Double_t>> th_list;
-  ListSnell(th_0, n_list, th_list);
-
-  // kz is the z-component of (complex) angular wavevector for forward-moving
-  // wave. Positive imaginary part means decaying.
-  std::vector<std::complex<Double_t>> kz_list(num_layers);
-  std::vector<std::complex<Double_t>> cos_th_list(num_layers);
-  {
-    auto kz_i = kz_list.begin();
-    auto n_i = n_list.cbegin();
-    auto th_i = th_list.cbegin();
-    auto cos_th_i = cos_th_list.begin();
-    for (std::size_t i = 0; i < num_layers; ++i) {
-      *cos_th_i = std::cos(*th_i);
-      *kz_i = TMath::TwoPi() * (*n_i) * (*cos_th_i) / lam_vac;
-      ++kz_i;
-      ++n_i;
-      ++th_i;
-      ++cos_th_i;
-    }
-  }
-
-  // delta is the total phase accrued by traveling through a given layer.
-  std::vector<std::complex<Double_t>> delta(num_layers);
-  {
-    auto delta_i = delta.begin();
-    auto kz_i = kz_list.cbegin();
-    auto thickness_i = fThicknessList.cbegin();
-    for (std::size_t i = 0; i < num_layers; ++i) {
-      *delta_i = (*kz_i) * (*thickness_i);
-      ++delta_i;
-      ++kz_i;
-      ++thickness_i;
-    }
-  }
-
-  // For a very opaque layer, reset delta to avoid divide-by-0 and similar
-  // errors. The criterion imag(delta) > 35 corresponds to single-pass
-  // transmission < 1e-30 --- small enough that the exact value doesn't
-  // matter.
-  static Bool_t opacity_warning = kFALSE;
-  {
-    auto delta_i = delta.begin();
-    ++delta_i;  // start from i = 1
-    for (std::size_t i = 1; i < num_layers - 1; ++i) {
-      if ((*delta_i).imag() > 35) {
-        *delta_i = (*delta_i).real() + std::complex<Double_t>(0, 35);
-        if (opacity_warning == kFALSE) {
-          opacity_warning = kTRUE;
-          Error("CoherentTMM",
-                "Warning: Layers that are almost perfectly opaque "
-                "are modified to be slightly transmissive, "
-                "allowing 1 photon in 10^30 to pass through. It's "
-                "for numerical stability. This warning will not "
-                "be shown again.");
-        }
-      }
-      ++delta_i;
-    }
-  }
+  const auto& n_list = ws.fN;
+  const auto& th_list = ws.fTheta;
+  const auto& cos_th_list = ws.fCosTheta;
+  const auto& delta = ws.fDelta;
 
   // t_list[i,j] and r_list[i,j] are transmission and reflection amplitudes,
   // respectively, coming from i, going to j. Only need to calculate this when
   // j=i+1. (2D array is overkill but helps avoid confusion.)
-  std::vector<std::complex<Double_t>> t_list(num_layers);
-  std::vector<std::complex<Double_t>> r_list(num_layers);
+  auto& t_list = ws.fT;
+  auto& r_list = ws.fR;
 
   {
     auto t_i = t_list.begin();
@@ -298,41 +337,29 @@ void AMultilayer::CoherentTMM(EPolarization polarization,
   // M_list[n]. M_0 and M_{num_layers-1} are not defined.
   // My M is a bit different than Sernelius's, but Mtilde is the same.
 
-  // M_list[0] and M_list[-1] are filled with (0, 0, 0, 0) by default
-  std::vector<A2x2ComplexMatrix> M_list(num_layers);
+  // M_list is not stored because only the product of M_i is used below.
+  A2x2ComplexMatrix Mtilde(1, 0, 0, 1);
   {
     const std::complex<Double_t> j(0, 1);
-    auto M_i = M_list.begin();
-    ++M_i;  // start i from 1
     auto t_i = t_list.cbegin();
-    ++t_i;
+    ++t_i;  // start i from 1
     auto r_i = r_list.cbegin();
     ++r_i;
     auto delta_i = delta.cbegin();
     ++delta_i;
     for (std::size_t i = 1; i < num_layers - 1; ++i) {
       auto j_delta_i = j * (*delta_i);
-      *M_i =
+      A2x2ComplexMatrix M_i =
           1. / (*t_i) *
           A2x2ComplexMatrix(std::exp(-j_delta_i), 0, 0, std::exp(j_delta_i)) *
           A2x2ComplexMatrix(1, *r_i, *r_i, 1);
-      ++M_i;
+      Mtilde = Mtilde * M_i;
       ++t_i;
       ++r_i;
       ++delta_i;
     }
   }
 
-  A2x2ComplexMatrix Mtilde(1, 0, 0, 1);
-  {
-    auto M_i = M_list.cbegin();
-    ++M_i;  // start i from 1
-    for (std::size_t i = 1; i < num_layers - 1; ++i) {
-      Mtilde = Mtilde * (*M_i);
-      ++M_i;
-    }
-  }
-
   Mtilde = A2x2ComplexMatrix(1, r_list[0], r_list[0], 1) / t_list[0] * Mtilde;
 
   // Net complex transmission and reflection amplitudes
@@ -375,6 +402,310 @@ void AMultilayer::CoherentTMM(EPolarization polarization,
   }
 }
 
+//______________________________________________________________________________
+void AMultilayer::CoherentTMMMixed(std::complex<Double_t> th_0,
+                                   Double_t lam_vac, Double_t& reflectance,
+                                   Double_t& transmittance) const {
+  // Calculate the reflectance and transmittance of unpolarized light, the
+  // mean of the s- and p-polarizations. The tables made by PrecomputeTables
+  // or the precalculated histograms are used if available.
+  if (fReflectanceTable.Contains(lam_vac, th_0.real()) and
+      fTransmittanceTable.Contains(lam_vac, th_0.real())) {
+    reflectance = fReflectanceTable.Eval(lam_vac, th_0.real());
+    transmittance = fTransmittanceTable.Eval(lam_vac, th_0.real());
+    return;
+  } else if (fPreCalculatedReflectanceMixed and
+             fPreCalculatedTransmittanceMixed) {
+    reflectance =
+        fPreCalculatedReflectanceMixed->Interpolate(lam_vac, th_0.real());
+    transmittance =
+        fPreCalculatedTransmittanceMixed->Interpolate(lam_vac, th_0.real());
+    return;
+  }
+
+  static thread_local Workspace ws;
+  CoherentTMMMixed(th_0, lam_vac, reflectance, transmittance, ws);
+}
+
+//______________________________________________________________________________
+void AMultilayer::CoherentTMMMixed(std::complex<Double_t> th_0,
+                                   Double_t lam_vac, Double_t& reflectance,
+                                   Double_t& transmittance,
+                                   Workspace& ws) const {
+  // Same as CoherentTMMP and CoherentTMMS averaged, but the layer properties
+  // independent of the polarization are calculated only once, and the
+  // transfer matrices of both polarizations are multiplied in the same loop.
+  // Neither the tables nor the precalculated histograms are used.
+  ComputeLayers(th_0, lam_vac, ws);
+  auto num_layers = fRefractiveIndexList.size();
+  const auto& n_list = ws.fN;
+  const auto& cos_th_list = ws.fCosTheta;
+  const auto& delta = ws.fDelta;
+
+  // Fresnel amplitudes at the interface between the i-th and (i+1)-th layers
+  auto fresnel = [&](std::size_t i, std::complex<Double_t>& t_s,
+                     std::complex<Double_t>& r_s, std::complex<Double_t>& t_p,
+                     std::complex<Double_t>& r_p) {
+    auto ii = n_list[i] * cos_th_list[i];
+    auto ff = n_list[i + 1] * cos_th_list[i + 1];
+    auto fi = n_list[i + 1] * cos_th_list[i];
+    auto if_ = n_list[i] * cos_th_list[i + 1];
+    t_s = 2. * ii / (ii + ff);
+    r_s = (ii - ff) / (ii + ff);
+    t_p = 2. * ii / (fi + if_);
+    r_p = (fi - if_) / (fi + if_);
+  };
+
+  std::complex<Double_t> t_s, r_s, t_p, r_p;
+  fresnel(0, t_s, r_s, t_p, r_p);
+  A2x2ComplexMatrix Mtilde_s = A2x2ComplexMatrix(1, r_s, r_s, 1) / t_s;
+  A2x2ComplexMatrix Mtilde_p = A2x2ComplexMatrix(1, r_p, r_p, 1) / t_p;
+
+  const std::complex<Double_t> j(0, 1);
+  for (std::size_t i = 1; i < num_layers - 1; ++i) {
+    fresnel(i, t_s, r_s, t_p, r_p);
+    auto j_delta_i = j * delta[i];
+    auto em = std::exp(-j_delta_i);
+    auto ep = std::exp(j_delta_i);
+    // M_i = 1/t_i * diag(em, ep) * [[1, r_i], [r_i, 1]]
+    Mtilde_s = Mtilde_s *
+               A2x2ComplexMatrix(em / t_s, em * r_s / t_s, ep * r_s / t_s,
+                                 ep / t_s);
+    Mtilde_p = Mtilde_p *
+               A2x2ComplexMatrix(em / t_p, em * r_p / t_p, ep * r_p / t_p,
+                                 ep / t_p);
+  }
+
+  auto rs = Mtilde_s.Get10() / Mtilde_s.Get00();
+  auto ts = 1. / Mtilde_s.Get00();
+  auto rp = Mtilde_p.Get10() / Mtilde_p.Get00();
+  auto tp = 1. / Mtilde_p.Get00();
+
+  auto n_i = n_list[0];
+  auto n_f = n_list.back();
+  auto cos_i = std::cos(th_0);
+  auto cos_f = cos_th_list.back();
+  Double_t Ts =
+      std::abs(ts * ts) * ((n_f * cos_f).real() / (n_i * cos_i).real());
+  Double_t Tp = std::abs(tp * tp) * ((n_f * std::conj(cos_f)).real() /
+                                     (n_i * std::conj(cos_i)).real());
+
+  reflectance = (std::norm(rs) + std::norm(rp)) / 2.;
+  transmittance = (Ts + Tp) / 2.;
+}
+
+//______________________________________________________________________________
+void AMultilayer::CoherentTMMMixed(std::vector<std::complex<Double_t>>& th_0,
+                                   Double_t lam_vac,
+                                   std::vector<Double_t>& reflectance,
+                                   std::vector<Double_t>& transmittance) const {
+  // Calculate for multiple angles. The angles are processed in chunks by the
+  // persistent threads if SetNthreads is given two or more.
+  auto n = th_0.size();
+  reflectance.resize(n);
+  transmittance.resize(n);
+
+  ForEachChunk(n, [&](std::size_t first, std::size_t last) {
+    for (std::size_t i = first; i < last; ++i) {
+      CoherentTMMMixed(th_0[i], lam_vac, reflectance[i], transmittance[i]);
+    }
+  });
+}
+
+//______________________________________________________________________________
+void AMultilayer::CoherentTMMMixed(std::complex<Double_t> th_0,
+                                   std::vector<Double_t>& lam_vac,
+                                   std::vector<Double_t>& reflectance,
+                                   std::vector<Double_t>& transmittance) const {
+  // Calculate for multiple wavelengths. The wavelengths are processed in
+  // chunks by the persistent threads if SetNthreads is given two or more.
+  auto n = lam_vac.size();
+  reflectance.resize(n);
+  transmittance.resize(n);
+
+  ForEachChunk(n, [&](std::size_t first, std::size_t last) {
+    for (std::size_t i = first; i < last; ++i) {
+      CoherentTMMMixed(th_0, lam_vac[i], reflectance[i], transmittance[i]);
+    }
+  });
+}
+
+//______________________________________________________________________________
+void AMultilayer::ComputeLayers(std::complex<Double_t> th_0, Double_t lam_vac,
+                                Workspace& ws) const {
+  // Fill the refractive indices, angles, cosines, wavevectors and phases of
+  // all the layers in ws, which do not depend on the polarization. This is
+  // the first half of tmm.coh_tmm.
+  auto num_layers = fRefractiveIndexList.size();
+  ws.Resize(num_layers);
+  auto& n_list = ws.fN;
+
+  {
+    auto n_i = n_list.begin();
+    auto ref_i = fRefractiveIndexList.cbegin();
+    for (std::size_t i = 0; i < num_layers; ++i) {
+      *n_i = (*ref_i)->GetComplexRefractiveIndex(lam_vac);
+      ++n_i;
+      ++ref_i;
+    }
+  }
+
+  // Input tests
+  if (std::abs((n_list[0] * std::sin(th_0)).imag()) >= 100 * EPSILON ||
+      !IsForwardAngle(n_list[0], th_0)) {
+    Error("ComputeLayers", "Error in n0 or th0!");
+  }
+
+  // th_list is a list with, for each layer, the angle that the light travels
+  // through the layer. Computed with Snell's law. Note that the "angles" may be
+  // complex!
+  auto& th_list = ws.fTheta;
+  ListSnell(th_0, n_list, th_list);
+
+  // kz is the z-component of (complex) angular wavevector for forward-moving
+  // wave. Positive imaginary part means decaying.
+  auto& kz_list = ws.fKz;
+  auto& cos_th_list = ws.fCosTheta;
+  {
+    auto kz_i = kz_list.begin();
+    auto n_i = n_list.cbegin();
+    auto th_i = th_list.cbegin();
+    auto cos_th_i = cos_th_list.begin();
+    for (std::size_t i = 0; i < num_layers; ++i) {
+      *cos_th_i = std::cos(*th_i);
+      *kz_i = TMath::TwoPi() * (*n_i) * (*cos_th_i) / lam_vac;
+      ++kz_i;
+      ++n_i;
+      ++th_i;
+      ++cos_th_i;
+    }
+  }
+
+  // delta is the total phase accrued by traveling through a given layer.
+  auto& delta = ws.fDelta;
+  {
+    auto delta_i = delta.begin();
+    auto kz_i = kz_list.cbegin();
+    auto thickness_i = fThicknessList.cbegin();
+    for (std::size_t i = 0; i < num_layers; ++i) {
+      *delta_i = (*kz_i) * (*thickness_i);
+      ++delta_i;
+      ++kz_i;
+      ++thickness_i;
+    }
+  }
+
+  // For a very opaque layer, reset delta to avoid divide-by-0 and similar
+  // errors. The criterion imag(delta) > 35 corresponds to single-pass
+  // transmission < 1e-30 --- small enough that the exact value doesn't
+  // matter.
+  static std::atomic<Bool_t> opacity_warning(kFALSE);
+  {
+    auto delta_i = delta.begin();
+    ++delta_i;  // start from i = 1
+    for (std::size_t i = 1; i < num_layers - 1; ++i) {
+      if ((*delta_i).imag() > 35) {
+        *delta_i = (*delta_i).real() + std::complex<Double_t>(0, 35);
+        if (not opacity_warning.exchange(kTRUE)) {
+          Error("ComputeLayers",
+                "Warning: Layers that are almost perfectly opaque "
+                "are modified to be slightly transmissive, "
+                "allowing 1 photon in 10^30 to pass through. It's "
+                "for numerical stability. This warning will not "
+                "be shown again.");
+        }
+      }
+      ++delta_i;
+    }
+  }
+}
+
+//__________________________________________________________________________________
+void AMultilayer::PreCalculateTMM(Int_t lam_nbins, Double_t lam_min,
+                                  Double_t lam_max, Int_t th_nbins,
+                                  Double_t th_min, Double_t th_max) {
+  // Calculate the reflectance and transmittance at the bin centers of the
+  // (wavelength, angle) histograms, which are then used by CoherentTMMMixed.
+  // The bins are calculated in parallel if SetNthreads is given two or more.
+  // The TMM is calculated directly, not resampled from the tables of
+  // PrecomputeTables or from the previous histograms.
+  auto preReflectanceMixed = std::make_shared<TH2D>(
+      "", "", lam_nbins, lam_min, lam_max, th_nbins, th_min, th_max);
+  auto preTransmittanceMixed = std::make_shared<TH2D>(
+      "", "", lam_nbins, lam_min, lam_max, th_nbins, th_min, th_max);
+
+  std::size_t n = std::size_t(lam_nbins) * th_nbins;
+  std::vector<Double_t> reflectance(n), transmittance(n);
+  const TAxis* xaxis = preReflectanceMixed->GetXaxis();
+  const TAxis* yaxis = preReflectanceMixed->GetYaxis();
+  ForEachChunk(n, [&](std::size_t first, std::size_t last) {
+    Workspace ws;
+    for (std::size_t k = first; k < last; ++k) {
+      Double_t lam = xaxis->GetBinCenter(k % lam_nbins + 1);
+      Double_t th = yaxis->GetBinCenter(k / lam_nbins + 1);
+      CoherentTMMMixed(th, lam, reflectance[k], transmittance[k], ws);
+    }
+  });
+
+  // TH2D is filled by this thread only
+  for (std::size_t k = 0; k < n; ++k) {
+    Int_t i = k % lam_nbins + 1;
+    Int_t j = k / lam_nbins + 1;
+    preReflectanceMixed->SetBinContent(i, j, reflectance[k]);
+    preTransmittanceMixed->SetBinContent(i, j, transmittance[k]);
+  }
+
+  fPreCalculatedReflectanceMixed = preReflectanceMixed;
+  fPreCalculatedTransmittanceMixed = preTransmittanceMixed;
+}
+
+//__________________________________________________________________________________
+Bool_t AMultilayer::PrecomputeTables(Double_t lam_min, Double_t lam_max,
+                                     Double_t th_min, Double_t th_max,
+                                     Double_t tolerance) {
+  // Make the tables of the unpolarized reflectance and transmittance over
+  // [lam_min, lam_max]x[th_min, th_max], which are used by CoherentTMMMixed
+  // instead of the TMM calculation afterward. The uniform grids are refined
+  // until the bilinear interpolation deviates from the TMM by less than
+  // tolerance, or until ALookupTable::kMaxCells2D is reached. The points are
+  // calculated in parallel if SetNthreads is given two or more.
+  //
+  // The tables are stored together with this object, and can also be written
+  // separately (see GetReflectanceTable) and given by SetTables at startup.
+  ClearTables();
+
+  for (Int_t k = 0; k < 2; ++k) {
+    ALookupTable& table = k == 0 ? fReflectanceTable : fTransmittanceTable;
+    Bool_t ok = table.BakeBatch(
+        [this, k](std::size_t n, const Double_t* lam, const Double_t* th,
+                  Double_t* z) {
+          ForEachChunk(n, [&](std::size_t first, std::size_t last) {
+            Workspace ws;
+            for (std::size_t i = first; i < last; ++i) {
+              Double_t r, t;
+              CoherentTMMMixed(th[i], lam[i], r, t, ws);
+              z[i] = k == 0 ? r : t;
+            }
+          });
+        },
+        lam_min, lam_max, th_min, th_max, tolerance,
+        ALookupTable::kMaxCells2D, kFALSE);
+
+    if (not ok) {
+      Warning("PrecomputeTables", "Max deviation of the %s table is %g",
+              k == 0 ? "reflectance" : "transmittance",
+              table.GetMaxDeviation());
+      if (table.IsEmpty()) {
+        ClearTables();
+        return kFALSE;
+      }
+    }
+  }
+
+  return fReflectanceTable.GetMaxDeviation() <= tolerance and
+         fTransmittanceTable.GetMaxDeviation() <= tolerance;
+}
+
 //__________________________________________________________________________________
 void AMultilayer::PrintLayers(Double_t lambda) const {
   auto n = fRefractiveIndexList.size();
@@ -390,8 +721,14 @@ void AMultilayer::PrintLayers(Double_t lambda) const {
 
 //__________________________________________________________________________________
 void AMultilayer::SetNthreads(std::size_t n) {
-  // Note that having n larger than 1 frequently decreases the total
-  // performance. Use this method only when you feed a very long vector.
+  // Set the number of threads used by the vector versions of
+  // CoherentTMMMixed and PreCalculateTMM. The threads are kept alive and
+  // reused among calls. n = 0 means the number of hardware threads. With
+  // implicit multithreading of ROOT, n >= 2 enables the tasks in its pool.
+  std::lock_guard<std::mutex> lock(fPoolMutex);
+  delete fPool;
+  fPool = 0;
+
   if (n == 0) {
     fNthreads =
         std::thread::hardware_concurrency();  // can return 0 if n is unknown
@@ -400,3 +737,49 @@ void AMultilayer::SetNthreads(std::size_t n) {
     fNthreads = n;
   }
 }
+
+//______________________________________________________________________________
+void AMultilayer::Streamer(TBuffer& R__b) {
+  // The refractive indices may be shared with other layers and multilayers.
+  // The precomputed tables are kept so that they need not be computed again.
+  if (R__b.IsReading()) {
+    UInt_t R__s, R__c;
+    Version_t R__v = R__b.ReadVersion(&R__s, &R__c);
+    if (R__v < 3) {
+      R__b.ReadClassBuffer(AMultilayer::Class(), this, R__v, R__s, R__c);
+      return;
+    }
+    TObject::Streamer(R__b);
+    UInt_t n;
+    R__b >> n;
+    fRefractiveIndexList.resize(n);
+    for (UInt_t i = 0; i < n; ++i) {
+      AStreamerUtil::ReadShared(R__b, fRefractiveIndexList[i]);
+    }
+    fThicknessList.resize(n);
+    R__b.ReadFastArray(fThicknessList.data(), n);
+    UInt_t nthreads;
+    R__b >> nthreads;
+    SetNthreads(nthreads);
+    AStreamerUtil::ReadShared(R__b, fPreCalculatedReflectanceMixed);
+    AStreamerUtil::ReadShared(R__b, fPreCalculatedTransmittanceMixed);
+    AStreamerUtil::StreamTable(R__b, fReflectanceTable);
+    AStreamerUtil::StreamTable(R__b, fTransmittanceTable);
+    R__b.CheckByteCount(R__s, R__c, AMultilayer::IsA());
+  } else {
+    UInt_t R__c = R__b.WriteVersion(AMultilayer::IsA(), kTRUE);
+    TObject::Streamer(R__b);
+    UInt_t n = fRefractiveIndexList.size();
+    R__b << n;
+    for (UInt_t i = 0; i < n; ++i) {
+      AStreamerUtil::WriteShared(R__b, fRefractiveIndexList[i]);
+    }
+    R__b.WriteFastArray(fThicknessList.data(), n);
+    R__b << UInt_t(fNthreads);
+    AStreamerUtil::WriteShared(R__b, fPreCalculatedReflectanceMixed);
+    AStreamerUtil::WriteShared(R__b, fPreCalculatedTransmittanceMixed);
+    AStreamerUtil::StreamTable(R__b, fReflectanceTable);
+    AStreamerUtil::StreamTable(R__b, fTransmittanceTable);
+    R__b.SetByteCount(R__c, kTRUE);
+  }
+}
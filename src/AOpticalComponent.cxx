@@ -45,6 +45,37 @@ void AOpticalComponent::AddBorderSurfaceCondition(
   }
 
   fBorderSurfaceConditionArray->Add(condition);
+  if (fBorderSurfaceConditionMap.empty() and
+      fBorderSurfaceConditionArray->GetEntries() > 1) {
+    // The map has not been built yet after streaming
+    RebuildBorderSurfaceConditionMap();
+  } else if (condition) {
+    // The first condition registered for a pair is used, as in the past
+    fBorderSurfaceConditionMap.emplace(condition->GetComponent2(), condition);
+  }
+}
+
+//______________________________________________________________________________
+void AOpticalComponent::CountMemory(AMemoryUtil::Counter& counter) const {
+  // Add the bytes of the optical data of this component (border surface
+  // conditions, and the tables and materials of the derived classes) to
+  // counter. The TGeoVolume part is counted by GetMemoryUsage or by
+  // AOpticsManager::GetMemoryUsage as a part of the geometry.
+  if (fBorderSurfaceConditionArray) {
+    const TObjArray* array = fBorderSurfaceConditionArray;
+    counter.Add(array, AMemoryUtil::SizeOf(array) +
+                           array->GetSize() * sizeof(TObject*));
+    for (Int_t i = 0; i < array->GetEntriesFast(); i++) {
+      const ABorderSurfaceCondition* condition =
+          static_cast<const ABorderSurfaceCondition*>(array->At(i));
+      if (condition) condition->CountMemory(counter);
+    }
+  }
+
+  // buckets and nodes (a key, a value, a link and a hash) of the map
+  counter.Add(&fBorderSurfaceConditionMap,
+              fBorderSurfaceConditionMap.bucket_count() * sizeof(void*) +
+                  fBorderSurfaceConditionMap.size() * 4 * sizeof(void*));
 }
 
 //______________________________________________________________________________
@@ -54,14 +85,33 @@ ABorderSurfaceCondition* AOpticalComponent::FindBorderSurfaceCondition(
     return 0;
   }
 
-  for (Int_t i = 0; i < fBorderSurfaceConditionArray->GetEntries(); i++) {
-    if (((ABorderSurfaceCondition*)(*fBorderSurfaceConditionArray)[i])
-            ->GetComponent2() == component2) {
-      return (ABorderSurfaceCondition*)(*fBorderSurfaceConditionArray)[i];
+  if (fBorderSurfaceConditionMap.empty()) {
+    // The map is not streamed. Scan the array if it has not been rebuilt yet
+    // (e.g. after reading the geometry from a file).
+    for (Int_t i = 0; i < fBorderSurfaceConditionArray->GetEntries(); i++) {
+      if (((ABorderSurfaceCondition*)(*fBorderSurfaceConditionArray)[i])
+              ->GetComponent2() == component2) {
+        return (ABorderSurfaceCondition*)(*fBorderSurfaceConditionArray)[i];
+      }
     }
+
+    return 0;
   }
 
-  return 0;
+  auto it = fBorderSurfaceConditionMap.find(component2);
+
+  return it != fBorderSurfaceConditionMap.end() ? it->second : 0;
+}
+
+//______________________________________________________________________________
+ULong64_t AOpticalComponent::GetMemoryUsage() const {
+  // Bytes used by this component, i.e., the volume with its daughter nodes
+  // and the optical data. Shared materials and multilayers are included.
+  AMemoryUtil::Counter counter;
+  counter.AddBytes(AMemoryUtil::SizeOf(static_cast<const TGeoVolume*>(this)));
+  CountMemory(counter);
+
+  return counter.GetBytes();
 }
 
 //______________________________________________________________________________
@@ -109,6 +159,24 @@ TGeoMedium* AOpticalComponent::GetOpaqueVacuumMedium() const {
   return med;
 }
 
+//______________________________________________________________________________
+void AOpticalComponent::RebuildBorderSurfaceConditionMap() {
+  // Rebuild the hash map of the border surface conditions from the array.
+  // This is called by AOpticsManager::Compile.
+  fBorderSurfaceConditionMap.clear();
+  if (!fBorderSurfaceConditionArray) {
+    return;
+  }
+
+  for (Int_t i = 0; i < fBorderSurfaceConditionArray->GetEntries(); i++) {
+    ABorderSurfaceCondition* condition =
+        (ABorderSurfaceCondition*)(*fBorderSurfaceConditionArray)[i];
+    if (condition) {
+      fBorderSurfaceConditionMap.emplace(condition->GetComponent2(), condition);
+    }
+  }
+}
+
 //______________________________________________________________________________
 TGeoMedium* AOpticalComponent::GetTransparentVacuumMedium() const {
   if (!fGeoManager) {
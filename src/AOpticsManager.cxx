@@ -11,22 +11,774 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include "TGeoBBox.h"
+#include "TGeoMatrix.h"
+#include "TGeoShape.h"
+#include "TGeoShapeAssembly.h"
 #include "TRandom.h"
-#include "TThread.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include "ABorderSurfaceCondition.h"
+#include "ACounterRandom.h"
+#include "AFocalPlaneMonitor.h"
+#include "AGeoShapeProfiler.h"
+#include "AGeoUtil.h"
+#include "AMisalignmentEnsemble.h"
 #include "AOpticsManager.h"
+#include "ARayGenerator.h"
+#include "ARaySink.h"
+#include "ARayWriter.h"
+#include "ASurfaceKernels.h"
+#include "AThreadPool.h"
+#include "ATraceStatistics.h"
 static const Double_t kEpsilon =
     1e-6;  // Fixed in TGeoNavigator.cxx (equiv to 1e-6 cm)
 static const Double_t kInf = std::numeric_limits<Double_t>::infinity();
 
+static std::mutex gStatisticsMutex;  // guards merging of thread statistics
+
 ClassImp(AOpticsManager);
 
+namespace {
+
+// Photon carrying a packet of wavelengths (lanes) along a single geometric
+// path (see AOpticsManager::TracePackets). The wavelength-dependent
+// probabilities are multiplied into the lane weights instead of being drawn at
+// random, so that the path does not depend on the wavelength. A packet is
+// split, i.e., stopped and marked as chromatic, when it reaches a lens.
+class PhotonPacket : public APhoton {
+ private:
+  Int_t fNlanes;
+  const Double_t* fLambda;  // wavelengths of the lanes
+  Double_t* fWeight;        // weights of the lanes
+  Bool_t fChromatic;
+
+ public:
+  PhotonPacket(APhotonBuffer* buffer, Int_t i, Int_t nlanes,
+               const Double_t* lambda, Double_t* weight)
+      : APhoton(buffer, i),
+        fNlanes(nlanes),
+        fLambda(lambda),
+        fWeight(weight),
+        fChromatic(kFALSE) {}
+
+  Bool_t IsChromatic() const { return fChromatic; }
+  void Split() {
+    fChromatic = kTRUE;
+    Stop();
+  }
+  template <typename F>
+  void WeightLanes(const F& probability) {
+    for (Int_t i = 0; i < fNlanes; i++) fWeight[i] *= probability(fLambda[i]);
+  }
+  template <typename F>
+  void ForEachLane(const F& func) const {
+    for (Int_t i = 0; i < fNlanes; i++) func(fLambda[i], fWeight[i]);
+  }
+};
+
+// Overloads selecting the packet physics at compile time. The generic
+// versions do nothing and return kFALSE for ARay and APhoton.
+template <typename T>
+Bool_t SplitPacket(T&) {
+  return kFALSE;
+}
+inline Bool_t SplitPacket(PhotonPacket& packet) {
+  packet.Split();
+  return kTRUE;
+}
+
+template <typename T, typename F>
+Bool_t WeightLanes(T&, const F&) {
+  return kFALSE;
+}
+template <typename F>
+Bool_t WeightLanes(PhotonPacket& packet, const F& probability) {
+  packet.WeightLanes(probability);
+  return kTRUE;
+}
+
+template <typename T>
+void FillMonitor(AFocalPlaneMonitor* monitor, const Double_t* x,
+                 Double_t lambda, const T& ray) {
+  monitor->Fill(x, lambda, ray.GetWeight());
+}
+inline void FillMonitor(AFocalPlaneMonitor* monitor, const Double_t* x,
+                        Double_t, const PhotonPacket& packet) {
+  packet.ForEachLane([monitor, x](Double_t lambda, Double_t weight) {
+    monitor->Fill(x, lambda, weight);
+  });
+}
+
+ULong64_t SpreadBits(UInt_t x) {
+  // Put the lower 24 bits of x at the even bits of the result
+  ULong64_t v = x & 0xffffff;
+  v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+  v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+  v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  v = (v | (v << 2)) & 0x3333333333333333ULL;
+  v = (v | (v << 1)) & 0x5555555555555555ULL;
+  return v;
+}
+
+void CoherentOrder(
+    Int_t n, const std::function<void(Int_t, Double_t*, Double_t*)>& get,
+    std::vector<Int_t>& order) {
+  // Order of n rays (get(i, x, d) gives the start point and the direction of
+  // ray i) in which consecutive rays start close to each other and travel in
+  // similar directions, and therefore hit the same facets and pixels. The
+  // start points are projected onto the plane perpendicular to the mean
+  // direction, i.e., onto the aperture seen by the rays, and the rays are
+  // sorted by coarse bins of their directions and then by the Morton code
+  // (Z-order curve) of the projected coordinates.
+  order.resize(n);
+  if (n <= 0) return;
+
+  Double_t x[3], d[3], m[3] = {0, 0, 0};
+  for (Int_t i = 0; i < n; i++) {
+    get(i, x, d);
+    for (Int_t k = 0; k < 3; k++) m[k] += d[k];
+  }
+  Double_t norm = TMath::Sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+  if (norm > 0) {
+    for (Int_t k = 0; k < 3; k++) m[k] /= norm;
+  } else {
+    m[0] = m[1] = 0;
+    m[2] = 1;
+  }
+
+  // orthonormal axes e1 and e2 of the aperture plane
+  Int_t axis = TMath::Abs(m[0]) < TMath::Abs(m[1])
+                   ? (TMath::Abs(m[0]) < TMath::Abs(m[2]) ? 0 : 2)
+                   : (TMath::Abs(m[1]) < TMath::Abs(m[2]) ? 1 : 2);
+  Double_t a[3] = {0, 0, 0};
+  a[axis] = 1;
+  Double_t e1[3] = {m[1] * a[2] - m[2] * a[1], m[2] * a[0] - m[0] * a[2],
+                    m[0] * a[1] - m[1] * a[0]};
+  norm = TMath::Sqrt(e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2]);
+  for (Int_t k = 0; k < 3; k++) e1[k] /= norm;
+  Double_t e2[3] = {m[1] * e1[2] - m[2] * e1[1], m[2] * e1[0] - m[0] * e1[2],
+                    m[0] * e1[1] - m[1] * e1[0]};
+
+  // projected positions (u, v) and directions (p, q) of the rays
+  std::vector<Float_t> coord(4 * std::size_t(n));
+  Double_t lo[4], hi[4];
+  for (Int_t j = 0; j < 4; j++) {
+    lo[j] = TMath::Infinity();
+    hi[j] = -TMath::Infinity();
+  }
+  for (Int_t i = 0; i < n; i++) {
+    get(i, x, d);
+    Float_t* c = &coord[4 * std::size_t(i)];
+    c[0] = x[0] * e1[0] + x[1] * e1[1] + x[2] * e1[2];
+    c[1] = x[0] * e2[0] + x[1] * e2[1] + x[2] * e2[2];
+    c[2] = d[0] * e1[0] + d[1] * e1[1] + d[2] * e1[2];
+    c[3] = d[0] * e2[0] + d[1] * e2[1] + d[2] * e2[2];
+    for (Int_t j = 0; j < 4; j++) {
+      lo[j] = TMath::Min(lo[j], Double_t(c[j]));
+      hi[j] = TMath::Max(hi[j], Double_t(c[j]));
+    }
+  }
+
+  // 4 bits for each direction component and 24 for each position component
+  const UInt_t kBins[4] = {0xffffff, 0xffffff, 0xf, 0xf};
+  std::vector<std::pair<ULong64_t, Int_t> > keys(n);
+  for (Int_t i = 0; i < n; i++) {
+    const Float_t* c = &coord[4 * std::size_t(i)];
+    UInt_t bin[4];
+    for (Int_t j = 0; j < 4; j++) {
+      Double_t w = hi[j] - lo[j];
+      bin[j] = w > 0 ? UInt_t((c[j] - lo[j]) / w * kBins[j]) : 0;
+    }
+    ULong64_t key = (SpreadBits(bin[2]) | (SpreadBits(bin[3]) << 1)) << 48;
+    key |= SpreadBits(bin[0]) | (SpreadBits(bin[1]) << 1);
+    keys[i] = std::make_pair(key, i);
+  }
+  std::sort(keys.begin(), keys.end());
+  for (Int_t i = 0; i < n; i++) order[i] = keys[i].second;
+}
+
+void CoherentOrder(const TObjArray& array, std::vector<Int_t>& order) {
+  // Empty slots are taken as rays at the origin, and are skipped later
+  CoherentOrder(array.GetLast() + 1,
+                [&array](Int_t i, Double_t* x, Double_t* d) {
+                  const ARay* ray = (const ARay*)array.UncheckedAt(i);
+                  Double_t x4[4] = {0, 0, 0, 0};
+                  d[0] = d[1] = d[2] = 0;
+                  if (ray) {
+                    ray->GetLastPoint(x4);
+                    ray->GetDirection(d);
+                  }
+                  for (Int_t k = 0; k < 3; k++) x[k] = x4[k];
+                },
+                order);
+}
+
+void CoherentOrder(const APhotonBuffer& buffer, std::vector<Int_t>& order) {
+  CoherentOrder(buffer.GetN(),
+                [&buffer](Int_t i, Double_t* x, Double_t* d) {
+                  x[0] = buffer.GetX(i);
+                  x[1] = buffer.GetY(i);
+                  x[2] = buffer.GetZ(i);
+                  d[0] = buffer.GetDx(i);
+                  d[1] = buffer.GetDy(i);
+                  d[2] = buffer.GetDz(i);
+                },
+                order);
+}
+
+Int_t GeometryThreads(Int_t nthreads) {
+  // Number of threads for which the geometry must have its thread data. With
+  // implicit multithreading of ROOT, the tasks may run on any thread of its
+  // pool and on the thread waiting for them.
+  if (AThreadPool::IsImplicitMTEnabled()) {
+    Int_t npool = AThreadPool::GetImplicitMTPoolSize();
+    return TMath::Max(nthreads, npool + 1);
+  }
+
+  return nthreads;
+}
+
+Double_t EvalBound(const TGraph* bound, Double_t lambda) {
+  // Value of a survival bound clipped to [0, 1], or 1 if not given
+  if (!bound) return 1;
+  return TMath::Min(TMath::Max(bound->Eval(lambda), 0.), 1.);
+}
+
+}  // namespace
+
+// Refractive index, extinction coefficient and absorption length of the lenses
+// seen by the rays traced in one chunk. A ray keeps its wavelength during its
+// life, so the lens properties are evaluated only once per lens, instead of at
+// every entrance, exit and absorption check. The cache is reset when a ray
+// with another wavelength comes, so rays sorted or generated by wavelength
+// also share the values among them.
+struct AOpticsManager::MaterialCache {
+  struct Entry {
+    const ALens* fLens;
+    Double_t fN;    // refractive index
+    Double_t fK;    // extinction coefficient
+    Double_t fAbs;  // absorption length
+  };
+  static const Int_t kSize = 16;
+
+  Double_t fLambda;
+  Int_t fN;     // number of filled entries
+  Int_t fNext;  // entry to be overwritten next when all are filled
+  Entry fEntry[kSize];
+
+  // Parts of the survival bound of the current ray not divided out yet (see
+  // SetSurvivalBound)
+  Double_t fMirrorBound;
+  Int_t fNmirrorBounds;
+  Double_t fFocalBound;
+
+  MaterialCache()
+      : fLambda(-1),
+        fN(0),
+        fNext(0),
+        fMirrorBound(1),
+        fNmirrorBounds(0),
+        fFocalBound(1) {}
+
+  Entry Get(const ALens* lens, Double_t lambda) {
+    if (lambda != fLambda) {
+      fLambda = lambda;
+      fN = 0;
+      fNext = 0;
+    }
+
+    for (Int_t i = 0; i < fN; i++) {
+      if (fEntry[i].fLens == lens) return fEntry[i];
+    }
+
+    Entry entry = {lens, lens->GetRefractiveIndex(lambda),
+                   lens->GetExtinctionCoefficient(lambda),
+                   lens->GetAbsorptionLength(lambda)};
+    if (fN < kSize) {
+      fEntry[fN++] = entry;
+    } else {
+      fEntry[fNext] = entry;
+      fNext = (fNext + 1) % kSize;
+    }
+
+    return entry;
+  }
+  static const Entry& GetVacuum() {
+    static const Entry vacuum = {0, 1., 0., kInf};
+    return vacuum;
+  }
+};
+
+// Locations of the start points of the rays traced in one chunk. Rays of a
+// shooter or of a CORSIKA event usually start on a plane above the telescope,
+// i.e., in the same few volumes, but TGeoNavigator::InitTrack searches the
+// geometry tree for each of them. The node path of a located start point is
+// kept together with its safety, the distance to the nearest boundary of the
+// volume and its daughters, and a later start point within the safety is
+// located by going down the same path without any search. Anchors are no
+// longer added once the rays turn out to be too scattered to hit them.
+struct AOpticsManager::StartCache {
+  struct Anchor {
+    Double_t fPoint[3];
+    Double_t fSafety;
+    std::vector<Int_t> fPath;  // daughter indices from the top node
+  };
+  static const Int_t kSize = 8;
+
+  Int_t fN;     // number of filled anchors
+  Int_t fNext;  // anchor to be overwritten next when all are filled
+  Int_t fHits;
+  Int_t fMisses;
+  Anchor fAnchor[kSize];
+
+  StartCache() : fN(0), fNext(0), fHits(0), fMisses(0) {}
+
+  template <typename N>
+  void InitTrack(N* nav, const Double_t* point, const Double_t* dir) {
+    nav->InitTrack(point, dir);  // FlatNavigator has nothing to search
+  }
+  void InitTrack(TGeoNavigator* nav, const Double_t* point,
+                 const Double_t* dir) {
+    for (Int_t i = 0; i < fN; i++) {
+      const Anchor& anchor = fAnchor[i];
+      Double_t d2 = 0;
+      for (Int_t k = 0; k < 3; k++) {
+        Double_t d = point[k] - anchor.fPoint[k];
+        d2 += d * d;
+      }
+      if (d2 >= anchor.fSafety * anchor.fSafety) continue;
+
+      nav->ResetState();
+      nav->CdTop();
+      for (std::size_t j = 0; j < anchor.fPath.size(); j++) {
+        nav->CdDown(anchor.fPath[j]);
+      }
+      nav->SetCurrentPoint(point);
+      nav->SetCurrentDirection(dir);
+      nav->SetLastSafetyForPoint(anchor.fSafety - TMath::Sqrt(d2), point);
+      fHits++;
+      return;
+    }
+
+    nav->InitTrack(point, dir);
+    fMisses++;
+    if (fMisses > 2 * kSize and fHits < fMisses) return;
+    // overlapping (MANY) nodes are not cached as their safety is not exact
+    if (nav->IsOutside() or nav->GetNmany() > 0) return;
+
+    Double_t safety = nav->Safety();
+    if (safety <= 0) return;
+
+    Int_t i = fNext;
+    if (fN < kSize) {
+      i = fN++;
+    } else {
+      fNext = (fNext + 1) % kSize;
+    }
+    Anchor& anchor = fAnchor[i];
+    for (Int_t k = 0; k < 3; k++) anchor.fPoint[k] = point[k];
+    anchor.fSafety = safety;
+    Int_t level = nav->GetLevel();
+    anchor.fPath.resize(level);
+    for (Int_t up = 0; up < level; up++) {
+      const TGeoNode* node = nav->GetMother(up);
+      anchor.fPath[level - 1 - up] =
+          nav->GetMother(up + 1)->GetVolume()->GetIndex(node);
+    }
+  }
+};
+
+// Surfaces of an optical train in the order in which rays cross them. The
+// global matrix of each node and its mother, the medium in which the ray
+// travels before entering the node, are resolved only once per tracing call.
+struct AOpticsManager::SequentialTrain {
+  struct Surface {
+    TGeoNode* fNode;
+    TGeoNode* fMother;
+    TGeoHMatrix fMatrix;  // local-to-master matrix of fNode
+  };
+
+  std::vector<Surface> fSurfaces;
+  Bool_t fFallback;  // trace non-sequentially when the order is violated
+};
+
+// Minimal navigator which moves a ray onto the next surface of a sequential
+// train by asking only the shape of that surface. It provides the subset of
+// the TGeoNavigator interface used by DoFresnel, DoReflection and
+// GetFacetNormal, so that both modes share the same physics.
+class AOpticsManager::SurfaceNavigator {
+ private:
+  Double_t fPoint[3];
+  Double_t fDirection[3];
+  Double_t fNormal[3];
+  Double_t fStep;
+
+ public:
+  SurfaceNavigator() : fStep(0) {}
+
+  Bool_t FindNextBoundaryAndStep(const SequentialTrain::Surface& surface,
+                                 Bool_t& inside) {
+    // Move to the boundary of surface. Returns kFALSE if the ray misses it.
+    // inside is set to kTRUE if the ray is leaving the surface volume.
+    inside = IsInside(surface);
+    Double_t local[3], ldir[3];
+    surface.fMatrix.MasterToLocal(fPoint, local);
+    surface.fMatrix.MasterToLocalVect(fDirection, ldir);
+    TGeoShape* shape = surface.fNode->GetVolume()->GetShape();
+    Double_t step = inside ? shape->DistFromInside(local, ldir, 3)
+                           : shape->DistFromOutside(local, ldir, 3);
+    if (step >= TGeoShape::Big()) return kFALSE;
+
+    Double_t lnorm[3];
+    for (Int_t i = 0; i < 3; i++) {
+      local[i] += step * ldir[i];
+      fPoint[i] += step * fDirection[i];
+    }
+    shape->ComputeNormal(local, ldir, lnorm);
+    surface.fMatrix.LocalToMasterVect(lnorm, fNormal);
+    // Same convention as TGeoNavigator::FindNormal
+    if (fNormal[0] * fDirection[0] + fNormal[1] * fDirection[1] +
+            fNormal[2] * fDirection[2] <
+        0) {
+      for (Int_t i = 0; i < 3; i++) fNormal[i] = -fNormal[i];
+    }
+    fStep = step;
+    return kTRUE;
+  }
+  Double_t* FindNormal() { return fNormal; }
+  const Double_t* GetCurrentDirection() const { return fDirection; }
+  const Double_t* GetCurrentPoint() const { return fPoint; }
+  Double_t GetStep() const { return fStep; }
+  void InitTrack(const Double_t* point, const Double_t* dir) {
+    for (Int_t i = 0; i < 3; i++) {
+      fPoint[i] = point[i];
+      fDirection[i] = dir[i];
+    }
+  }
+  Bool_t IsInside(const SequentialTrain::Surface& surface) const {
+    // Tell the side of the boundary toward which the ray is heading, as the
+    // ray is often exactly on a surface
+    Double_t probe[3], local[3];
+    for (Int_t i = 0; i < 3; i++) {
+      probe[i] = fPoint[i] + kEpsilon * fDirection[i];
+    }
+    surface.fMatrix.MasterToLocal(probe, local);
+    return surface.fNode->GetVolume()->GetShape()->Contains(local);
+  }
+  void SetCurrentDirection(const Double_t* dir) {
+    for (Int_t i = 0; i < 3; i++) fDirection[i] = dir[i];
+  }
+  void SetCurrentDirection(Double_t x, Double_t y, Double_t z) {
+    fDirection[0] = x;
+    fDirection[1] = y;
+    fDirection[2] = z;
+  }
+  void SetStep(Double_t step) { fStep = step; }
+  void Step() {
+    for (Int_t i = 0; i < 3; i++) fPoint[i] += fStep * fDirection[i];
+  }
+};
+
+// Flattened copy of a geometry in which all the optical components are
+// placed in the top volume, directly or through assemblies, and have no
+// daughters, e.g. a telescope made of mirror facets, a camera window, a focal
+// plane and obscurations. The global matrix and bounding sphere of each node
+// are resolved at compile time, so that FlatNavigator needs neither the voxel
+// structure nor the state stack of TGeoNavigator.
+struct AOpticsManager::FlatGeometry {
+  struct Surface {
+    TGeoNode* fNode;
+    TGeoShape* fShape;
+    TGeoHMatrix fMatrix;  // local-to-master matrix of fNode
+    Double_t fCenter[3];  // center of the bounding sphere in the master frame
+    Double_t fRadius2;    // squared radius of the bounding sphere
+  };
+
+  TGeoNode* fTop;
+  TGeoShape* fWorld;  // shape of the top volume
+  std::vector<Surface> fSurfaces;
+};
+
+// Navigator which finds the next boundary by intersecting the ray with the
+// surfaces of a FlatGeometry one by one. Surfaces whose bounding sphere is
+// missed or farther than the nearest hit found so far are skipped without
+// calling the shape. It provides the subset of the TGeoNavigator interface
+// used by TraceRay and the physics, so the results are identical to the ones
+// obtained with TGeoNavigator.
+class AOpticsManager::FlatNavigator {
+ private:
+  enum { kUnknown = -3, kOutside = -2, kWorld = -1 };
+
+  const FlatGeometry* fGeometry;
+  Double_t fPoint[3];
+  Double_t fDirection[3];
+  Double_t fNormal[3];
+  Double_t fStep;
+  Int_t fCurrent;  // surface index in which the ray is, or kWorld etc.
+  Int_t fCrossed;  // surface index crossed by the last step, or kWorld
+  const std::vector<Int_t>* fCandidates;  // surfaces left by a RayPacket
+
+  Int_t Current() {
+    if (fCurrent == kUnknown) fCurrent = Locate();
+    return fCurrent;
+  }
+  Int_t Locate() const {
+    // Tell the volume toward which the ray is heading, as the ray is often
+    // exactly on a surface
+    Double_t probe[3], local[3];
+    for (Int_t i = 0; i < 3; i++) {
+      probe[i] = fPoint[i] + kEpsilon * fDirection[i];
+    }
+    if (not fGeometry->fWorld->Contains(probe)) return kOutside;
+
+    for (std::size_t j = 0; j < fGeometry->fSurfaces.size(); j++) {
+      const FlatGeometry::Surface& surface = fGeometry->fSurfaces[j];
+      Double_t r2 = 0;
+      for (Int_t i = 0; i < 3; i++) {
+        Double_t d = probe[i] - surface.fCenter[i];
+        r2 += d * d;
+      }
+      if (r2 > surface.fRadius2) continue;
+      surface.fMatrix.MasterToLocal(probe, local);
+      if (surface.fShape->Contains(local)) return j;
+    }
+
+    return kWorld;
+  }
+  TGeoNode* GetNode(Int_t index) const {
+    if (index == kOutside) return 0;
+    return index == kWorld ? fGeometry->fTop : fGeometry->fSurfaces[index].fNode;
+  }
+  void Move(Double_t step) {
+    fStep = step;
+    for (Int_t i = 0; i < 3; i++) fPoint[i] += step * fDirection[i];
+    fCurrent = kUnknown;
+  }
+
+ public:
+  FlatNavigator(const FlatGeometry* geometry)
+      : fGeometry(geometry),
+        fStep(0),
+        fCurrent(kUnknown),
+        fCrossed(kWorld),
+        fCandidates(0) {}
+
+  TGeoNode* FindNextBoundaryAndStep() {
+    // Move to the next boundary and return the node into which the ray is
+    // entering (0 if it is leaving the world)
+    const std::vector<Int_t>* candidates = fCandidates;
+    fCandidates = 0;  // valid only for the first step from the start point
+    Int_t current = Current();
+    if (current == kOutside) {  // entering the world, as TGeoNavigator does
+      fCrossed = kWorld;
+      Double_t step = fGeometry->fWorld->DistFromOutside(fPoint, fDirection, 3);
+      if (step >= TGeoShape::Big()) {
+        fStep = 0;
+        return 0;
+      }
+      Move(step);
+      fCurrent = kWorld;
+      return fGeometry->fTop;
+    }
+
+    Double_t local[3], ldir[3];
+    if (current >= 0) {  // leaving a component
+      const FlatGeometry::Surface& surface = fGeometry->fSurfaces[current];
+      surface.fMatrix.MasterToLocal(fPoint, local);
+      surface.fMatrix.MasterToLocalVect(fDirection, ldir);
+      fCrossed = current;
+      Move(surface.fShape->DistFromInside(local, ldir, 3));
+      return GetNode(Current());
+    }
+
+    Double_t best = fGeometry->fWorld->DistFromInside(fPoint, fDirection, 3);
+    Int_t hit = kWorld;
+    std::size_t n =
+        candidates ? candidates->size() : fGeometry->fSurfaces.size();
+    for (std::size_t k = 0; k < n; k++) {
+      std::size_t j = candidates ? (*candidates)[k] : k;
+      const FlatGeometry::Surface& surface = fGeometry->fSurfaces[j];
+      Double_t oc[3], oc2 = 0, tca = 0;
+      for (Int_t i = 0; i < 3; i++) {
+        oc[i] = surface.fCenter[i] - fPoint[i];
+        oc2 += oc[i] * oc[i];
+        tca += oc[i] * fDirection[i];
+      }
+      Double_t d2 = oc2 - tca * tca;  // squared distance between ray and center
+      if (d2 > surface.fRadius2) continue;
+      if (oc2 > surface.fRadius2 and
+          (tca < 0 or tca - TMath::Sqrt(surface.fRadius2 - d2) > best)) {
+        continue;
+      }
+      surface.fMatrix.MasterToLocal(fPoint, local);
+      surface.fMatrix.MasterToLocalVect(fDirection, ldir);
+      Double_t step = surface.fShape->DistFromOutside(local, ldir, 2, best);
+      if (step < best) {
+        best = step;
+        hit = j;
+      }
+    }
+
+    fCrossed = hit;
+    Move(best);
+    fCurrent = hit == kWorld ? kOutside : hit;
+
+    return GetNode(fCurrent);
+  }
+  Double_t* FindNormal() {
+    // Normal of the surface crossed by the last step. Same convention as
+    // TGeoNavigator::FindNormal, i.e., the dot product with the direction is
+    // positive.
+    if (fCrossed == kWorld) {
+      fGeometry->fWorld->ComputeNormal(fPoint, fDirection, fNormal);
+    } else {
+      const FlatGeometry::Surface& surface = fGeometry->fSurfaces[fCrossed];
+      Double_t local[3], ldir[3], lnorm[3];
+      surface.fMatrix.MasterToLocal(fPoint, local);
+      surface.fMatrix.MasterToLocalVect(fDirection, ldir);
+      surface.fShape->ComputeNormal(local, ldir, lnorm);
+      surface.fMatrix.LocalToMasterVect(lnorm, fNormal);
+    }
+    if (fNormal[0] * fDirection[0] + fNormal[1] * fDirection[1] +
+            fNormal[2] * fDirection[2] <
+        0) {
+      for (Int_t i = 0; i < 3; i++) fNormal[i] = -fNormal[i];
+    }
+    return fNormal;
+  }
+  const Double_t* GetCurrentDirection() const { return fDirection; }
+  TGeoNode* GetCurrentNode() { return GetNode(Current()); }
+  const Double_t* GetCurrentPoint() const { return fPoint; }
+  Double_t GetStep() const { return fStep; }
+  void InitTrack(const Double_t* point, const Double_t* dir) {
+    for (Int_t i = 0; i < 3; i++) {
+      fPoint[i] = point[i];
+      fDirection[i] = dir[i];
+    }
+    fCurrent = kUnknown;
+  }
+  Bool_t IsOutside() { return Current() == kOutside; }
+  void SetCandidates(const std::vector<Int_t>* candidates) {
+    // Surfaces that may be hit by the first step of the next ray, which are
+    // still tested one by one in the same order
+    fCandidates = candidates;
+  }
+  void SetCurrentDirection(const Double_t* dir) {
+    for (Int_t i = 0; i < 3; i++) fDirection[i] = dir[i];
+    fCurrent = kUnknown;
+  }
+  void SetCurrentDirection(Double_t x, Double_t y, Double_t z) {
+    fDirection[0] = x;
+    fDirection[1] = y;
+    fDirection[2] = z;
+    fCurrent = kUnknown;
+  }
+  void SetStep(Double_t step) { fStep = step; }
+  void Step() { Move(fStep); }
+};
+
+// Start points and directions of up to 16 consecutive rays, which are tested
+// at once against the bounding spheres of all the surfaces of a FlatGeometry
+// (see EnableRayPackets). Each ray then takes only the surfaces left for its
+// lane to FlatNavigator for its first step, and is traced alone afterward.
+struct AOpticsManager::RayPacket {
+  enum { kMaxSize = 16 };
+
+  Int_t fN;
+  Bool_t fEmpty;         // no lane has been set yet
+  Double_t fOrigin[3];   // start point of the first ray
+  Double_t fRay[6][kMaxSize];   // points relative to fOrigin and directions
+  Float_t fRayF[6][kMaxSize];   // the same in single precision
+  UChar_t fHit[kMaxSize];
+  std::vector<Int_t> fCandidates[kMaxSize];
+
+  const std::vector<Int_t>* GetCandidates(Int_t lane) const {
+    return &fCandidates[lane];
+  }
+  template <typename F>
+  void Load(Int_t n, const F& get) {
+    // get(lane, x, d) fills the start point and direction of a lane, and
+    // returns kFALSE if the ray is not running
+    fN = n;
+    fEmpty = kTRUE;
+    for (Int_t k = 0; k < n; k++) {
+      Double_t x[4], d[3];
+      if (not get(k, x, d)) {
+        for (Int_t i = 0; i < 6; i++) fRay[i][k] = 0;
+        continue;
+      }
+      if (fEmpty) {
+        for (Int_t i = 0; i < 3; i++) fOrigin[i] = x[i];
+        fEmpty = kFALSE;
+      }
+      for (Int_t i = 0; i < 3; i++) {
+        fRay[i][k] = x[i] - fOrigin[i];
+        fRay[i + 3][k] = d[i];
+      }
+    }
+  }
+  void Intersect(const FlatGeometry& geometry, Bool_t single) {
+    if (fEmpty) return;
+    if (single) {
+      for (Int_t i = 0; i < 6; i++) {
+        for (Int_t k = 0; k < fN; k++) fRayF[i][k] = fRay[i][k];
+      }
+      Intersect(geometry, fRayF);
+    } else {
+      Intersect(geometry, fRay);
+    }
+  }
+  template <typename T>
+  void Intersect(const FlatGeometry& geometry, const T (*ray)[kMaxSize]) {
+    const T* lanes[6];
+    for (Int_t i = 0; i < 6; i++) lanes[i] = ray[i];
+    for (Int_t k = 0; k < fN; k++) fCandidates[k].clear();
+    for (std::size_t j = 0; j < geometry.fSurfaces.size(); j++) {
+      const FlatGeometry::Surface& surface = geometry.fSurfaces[j];
+      T center[3];
+      for (Int_t i = 0; i < 3; i++) {
+        center[i] = surface.fCenter[i] - fOrigin[i];
+      }
+      ASurfaceKernels::HitBoundingSphere<T>(fN, lanes, center,
+                                            surface.fRadius2, fHit);
+      for (Int_t k = 0; k < fN; k++) {
+        if (fHit[k]) fCandidates[k].push_back(j);
+      }
+    }
+  }
+};
+
 //_____________________________________________________________________________
 AOpticsManager::AOpticsManager()
-    : TGeoManager(), fDisableFresnelReflection(kFALSE) {
+    : TGeoManager(),
+      fDisableFresnelReflection(kFALSE),
+      fWorkerPool(0),
+      fRecordNavigators(kFALSE),
+      fStatistics(0),
+      fWriter(0),
+      fFlatGeometry(0) {
   fLimit = 100;
+  fWeightedTracing = kFALSE;
+  fAttenuationWeighting = kFALSE;
+  fFlatNavigation = kFALSE;
+  fCompactHistory = kFALSE;
+  fCoherentOrdering = kFALSE;
+  fPacketSize = 0;
+  fPacketFloat = kFALSE;
+  fHistoryPolicy = kHistoryFull;
+  fHistorySampling = 1;
+  fRouletteThreshold = 0.1;
+  fRouletteSurvival = 0.5;
+  fNmirrorBounds = 0;
+  fChunkSize = 64;
+  fRandomSeed = 0;
+  fNcalls = 0;
   fClassList[kLens] = ALens::Class();
   fClassList[kFocus] = AFocalSurface::Class();
   fClassList[kMirror] = AMirror::Class();
@@ -36,8 +788,29 @@ AOpticsManager::AOpticsManager()
 
 //_____________________________________________________________________________
 AOpticsManager::AOpticsManager(const char* name, const char* title)
-    : TGeoManager(name, title), fDisableFresnelReflection(kFALSE) {
+    : TGeoManager(name, title),
+      fDisableFresnelReflection(kFALSE),
+      fWorkerPool(0),
+      fRecordNavigators(kFALSE),
+      fStatistics(0),
+      fWriter(0),
+      fFlatGeometry(0) {
   fLimit = 100;
+  fWeightedTracing = kFALSE;
+  fAttenuationWeighting = kFALSE;
+  fFlatNavigation = kFALSE;
+  fCompactHistory = kFALSE;
+  fCoherentOrdering = kFALSE;
+  fPacketSize = 0;
+  fPacketFloat = kFALSE;
+  fHistoryPolicy = kHistoryFull;
+  fHistorySampling = 1;
+  fRouletteThreshold = 0.1;
+  fRouletteSurvival = 0.5;
+  fNmirrorBounds = 0;
+  fChunkSize = 64;
+  fRandomSeed = 0;
+  fNcalls = 0;
   fClassList[kLens] = ALens::Class();
   fClassList[kFocus] = AFocalSurface::Class();
   fClassList[kMirror] = AMirror::Class();
@@ -46,12 +819,322 @@ AOpticsManager::AOpticsManager(const char* name, const char* title)
 }
 
 //_____________________________________________________________________________
-AOpticsManager::~AOpticsManager() {}
+AOpticsManager::~AOpticsManager() {
+  // The worker threads must release their navigators before TGeoManager
+  // deletes them
+  StopWorkers();
+  SafeDelete(fStatistics);
+  SafeDelete(fFlatGeometry);
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::BeginHistory(ARay& ray) const {
+  // Set the points kept by ray while it is traced (see SetHistoryPolicy)
+  Int_t mode = ARay::kFullHistory;
+  switch (fHistoryPolicy) {
+    case kHistoryNone:
+      mode = ARay::kLastPointHistory;
+      break;
+    case kHistoryEndpoints:
+      mode = ARay::kEndpointHistory;
+      break;
+    case kHistorySampled:
+      if (ray.GetId() % fHistorySampling != 0) mode = ARay::kEndpointHistory;
+      break;
+    default:
+      break;
+  }
+  ray.SetHistoryMode(mode);
+  ray.ThinHistory();
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::BuildFlatGeometry() {
+  // Build the surface table used by FlatNavigator. If any component placed in
+  // the top volume or in its assemblies has daughters, the table is not built
+  // and TGeoNavigator is used instead.
+  SafeDelete(fFlatGeometry);
+  if (not fFlatNavigation) return;
+
+  TGeoNode* nested = 0;
+  fFlatGeometry = MakeFlatGeometry(&nested);
+  if (nested) {
+    Warning("BuildFlatGeometry",
+            "%s has daughters. Flat navigation is disabled.",
+            nested->GetName());
+  }
+}
+
+//_____________________________________________________________________________
+AOpticsManager::FlatGeometry* AOpticsManager::MakeFlatGeometry(
+    TGeoNode** nested) const {
+  // Make a surface table of the closed geometry. Returns 0 if a component
+  // placed in the top volume (or in an assembly in it) has daughters, which
+  // is then given in nested.
+  TGeoVolume* top = GetTopVolume();
+  if (!top) return 0;
+
+  FlatGeometry* geometry = new FlatGeometry;
+  geometry->fTop = GetTopNode();
+  geometry->fWorld = top->GetShape();
+
+  // Assemblies (e.g. made by AGeoUtil::MakeAssemblies) are transparent to
+  // the rays, so their daughters are added with the global matrices
+  std::function<Bool_t(TGeoVolume*, const TGeoHMatrix&)> add =
+      [geometry, nested, &add](TGeoVolume* volume, const TGeoHMatrix& parent) {
+        for (Int_t i = 0; i < volume->GetNdaughters(); i++) {
+          TGeoNode* node = volume->GetNode(i);
+          TGeoHMatrix matrix = parent;
+          matrix.Multiply(node->GetMatrix());
+          if (node->GetVolume()->IsAssembly()) {
+            if (not add(node->GetVolume(), matrix)) return kFALSE;
+            continue;
+          }
+          if (node->GetVolume()->GetNdaughters() > 0) {
+            if (nested) *nested = node;
+            return kFALSE;
+          }
+
+          FlatGeometry::Surface surface;
+          surface.fNode = node;
+          surface.fShape = node->GetVolume()->GetShape();
+          surface.fMatrix = matrix;
+          TGeoBBox* box = (TGeoBBox*)surface.fShape;
+          surface.fMatrix.LocalToMaster(box->GetOrigin(), surface.fCenter);
+          // Slightly enlarged so that points on the box corners are not
+          // rejected
+          surface.fRadius2 = (box->GetDX() * box->GetDX() +
+                              box->GetDY() * box->GetDY() +
+                              box->GetDZ() * box->GetDZ()) *
+                                 (1 + 1e-6) +
+                             kEpsilon;
+          geometry->fSurfaces.push_back(surface);
+        }
+        return kTRUE;
+      };
+
+  if (not add(top, TGeoHMatrix())) {
+    delete geometry;
+    return 0;
+  }
+
+  return geometry;
+}
+
+//_____________________________________________________________________________
+Int_t AOpticsManager::ClassifyVolume(const TGeoVolume* volume) const {
+  // Return the component type of a volume
+  if (!volume) return kNull;
+
+  TClass* cl = volume->IsA();
+  if (cl == fClassList[kLens])
+    return kLens;
+  else if (cl == fClassList[kObs])
+    return kObs;
+  else if (cl == fClassList[kMirror])
+    return kMirror;
+  else if (cl == fClassList[kFocus])
+    return kFocus;
+  else if (cl == fClassList[kOpt])
+    return kOpt;
+
+  return kOther;
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::CloseGeometry(Option_t* option) {
+  TGeoManager::CloseGeometry(option);
+  Compile();
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::Compile() {
+  // Build the table of component types indexed by the unique volume ID, so
+  // that the tracer needs only one lookup at each boundary instead of a
+  // chain of IsA() comparisons. This is called by CloseGeometry, and again
+  // by TraceNonSequential if volumes have been added since then.
+  TObjArray* volumes = GetListOfVolumes();
+  Int_t n = volumes ? volumes->GetEntriesFast() : 0;
+  fVolumeType.assign(n, kOther);
+  fVolumeComponent.assign(n, 0);
+
+  for (Int_t i = 0; i < n; i++) {
+    TGeoVolume* volume = (TGeoVolume*)volumes->UncheckedAt(i);
+    if (!volume) continue;
+    Int_t id = volume->GetNumber();
+    if (id < 0) continue;
+    if (id >= Int_t(fVolumeType.size())) {
+      fVolumeType.resize(id + 1, kOther);
+      fVolumeComponent.resize(id + 1, 0);
+    }
+    fVolumeType[id] = ClassifyVolume(volume);
+
+    AOpticalComponent* component = dynamic_cast<AOpticalComponent*>(volume);
+    if (component) {
+      component->RebuildBorderSurfaceConditionMap();
+      fVolumeComponent[id] = component;
+    }
+  }
+
+  // Intern the node names for the compact node history. IDs are given in the
+  // order of the names so that nodes with a common prefix have a range of IDs.
+  std::vector<std::pair<std::string, const TGeoNode*> > nodes;
+  TGeoNode* topNode = GetTopNode();
+  if (topNode) nodes.push_back(std::make_pair(topNode->GetName(), topNode));
+  for (Int_t i = 0; i < n; i++) {
+    TGeoVolume* volume = (TGeoVolume*)volumes->UncheckedAt(i);
+    if (!volume) continue;
+    for (Int_t j = 0; j < volume->GetNdaughters(); j++) {
+      TGeoNode* node = volume->GetNode(j);
+      nodes.push_back(std::make_pair(node->GetName(), node));
+    }
+  }
+  std::sort(nodes.begin(), nodes.end());
+
+  fNodeNames.clear();
+  fNodeIDs.clear();
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    if (fNodeNames.empty() or fNodeNames.back() != nodes[i].first) {
+      fNodeNames.push_back(nodes[i].first);
+    }
+    fNodeIDs[nodes[i].second] = fNodeNames.size() - 1;
+  }
+
+  BuildFlatGeometry();
+}
+
+//_____________________________________________________________________________
+ULong64_t AOpticsManager::GetMemoryUsage(ULong64_t* geometry,
+                                         ULong64_t* optics) const {
+  // Return the bytes used by the geometry and the optical data. If given,
+  // geometry is filled with the bytes of the volumes, nodes, shapes, matrices
+  // and the tables made by CloseGeometry, and optics with those of the border
+  // surface conditions, refractive indices, multilayers, reflectance and QE
+  // data. Data shared by many components are counted only once. Shapes are
+  // counted by the sizes of their classes, and rays are not included.
+  ULong64_t geo = sizeof(*this);
+
+  const TObjArray* lists[3] = {GetListOfVolumes(), GetListOfShapes(),
+                               GetListOfMatrices()};
+  for (Int_t j = 0; j < 3; j++) {
+    if (!lists[j]) continue;
+    geo += AMemoryUtil::SizeOf(lists[j]) +
+           lists[j]->GetSize() * sizeof(TObject*);
+    for (Int_t i = 0; i < lists[j]->GetEntriesFast(); i++) {
+      const TObject* obj = lists[j]->At(i);
+      geo += j == 0 ? AMemoryUtil::SizeOf(static_cast<const TGeoVolume*>(obj))
+                    : AMemoryUtil::SizeOf(obj);
+    }
+  }
+
+  if (fFlatGeometry) {
+    geo += sizeof(FlatGeometry) +
+           AMemoryUtil::Capacity(fFlatGeometry->fSurfaces);
+  }
+  geo += AMemoryUtil::Capacity(fVolumeType) +
+         AMemoryUtil::Capacity(fVolumeComponent) +
+         AMemoryUtil::Capacity(fNodeNames);
+  for (std::size_t i = 0; i < fNodeNames.size(); i++) {
+    geo += AMemoryUtil::Capacity(fNodeNames[i]);
+  }
+  // buckets and nodes (a key, a value, a link and a hash) of the map
+  geo += fNodeIDs.bucket_count() * sizeof(void*) +
+         fNodeIDs.size() * 4 * sizeof(void*);
+
+  AMemoryUtil::Counter counter;
+  const TObjArray* volumes = GetListOfVolumes();
+  for (Int_t i = 0; volumes and i < volumes->GetEntriesFast(); i++) {
+    const AOpticalComponent* component =
+        dynamic_cast<const AOpticalComponent*>(volumes->At(i));
+    if (component) component->CountMemory(counter);
+  }
+
+  if (geometry) *geometry = geo;
+  if (optics) *optics = counter.GetBytes();
+
+  return geo + counter.GetBytes();
+}
+
+//_____________________________________________________________________________
+Int_t AOpticsManager::GetNodeID(const char* name) const {
+  // Return the ID of a node name recorded in the compact node history (see
+  // EnableCompactHistory), or -1 if no node has the name. Nodes with the same
+  // name in different volumes share an ID.
+  if (!name) return -1;
+
+  auto it = std::lower_bound(fNodeNames.begin(), fNodeNames.end(),
+                             std::string(name));
+  return it != fNodeNames.end() and *it == name ? it - fNodeNames.begin()
+                                                : -1;
+}
+
+//_____________________________________________________________________________
+Bool_t AOpticsManager::GetNodeIDRangeStartWith(const char* name, Int_t& first,
+                                               Int_t& last) const {
+  // Get the range [first, last] of the IDs of the node names starting with
+  // name, to be used with ARay::FindNodeIDInRange. Returns kFALSE if there is
+  // no such node.
+  if (!name) return kFALSE;
+
+  std::size_t len = strlen(name);
+  auto begin = std::lower_bound(fNodeNames.begin(), fNodeNames.end(),
+                                std::string(name));
+  auto end = begin;
+  while (end != fNodeNames.end() and end->compare(0, len, name) == 0) ++end;
+  if (begin == end) return kFALSE;
+
+  first = begin - fNodeNames.begin();
+  last = end - fNodeNames.begin() - 1;
+
+  return kTRUE;
+}
+
+//_____________________________________________________________________________
+ABorderSurfaceCondition* AOpticsManager::FindBorderSurfaceCondition(
+    TGeoNode* currentNode, TGeoNode* nextNode) const {
+  // Return the border surface condition between the two nodes if any
+  if (!currentNode) return 0;
+
+  TGeoVolume* volume1 = currentNode->GetVolume();
+  Int_t id = volume1->GetNumber();
+  AOpticalComponent* component1 =
+      id >= 0 and id < Int_t(fVolumeComponent.size())
+          ? fVolumeComponent[id]
+          : dynamic_cast<AOpticalComponent*>(volume1);
+  if (!component1 or not component1->HasBorderSurfaceCondition()) return 0;
+
+  AOpticalComponent* component2 =
+      nextNode ? dynamic_cast<AOpticalComponent*>(nextNode->GetVolume()) : 0;
+
+  return component1->FindBorderSurfaceCondition(component2);
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::CompileIfNeeded() {
+  TObjArray* volumes = GetListOfVolumes();
+  Int_t n = volumes ? volumes->GetEntriesFast() : 0;
+  if (Int_t(fVolumeType.size()) < n) Compile();
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::EndHistory(ARay& ray) const {
+  // Drop the intermediate points of a ray not chosen by the selector
+  if (fHistoryPolicy != kHistorySelected) return;
+
+  if (not fHistorySelector or not fHistorySelector(ray)) {
+    ray.SetHistoryMode(ARay::kEndpointHistory);
+    ray.ThinHistory();
+  }
+}
 
 //_____________________________________________________________________________
-void AOpticsManager::DoFresnel(Double_t n1, Double_t n2, Double_t k2, ARay& ray,
-                               TGeoNavigator* nav, TGeoNode* currentNode,
-                               TGeoNode* nextNode) {
+template <typename T, typename N>
+Int_t AOpticsManager::DoFresnel(Double_t n1, Double_t n2, Double_t k2, T& ray,
+                                N* nav, TGeoNode* currentNode,
+                                TGeoNode* nextNode,
+                                ABorderSurfaceCondition* condition,
+                                ACounterRandom& rng) {
+  // Returns ATraceStatistics::kReflection, kRefraction or kAbsorption
   Double_t step = nav->GetStep();
 
   // Calculation taken from
@@ -59,8 +1142,8 @@ void AOpticsManager::DoFresnel(Double_t n1, Double_t n2, Double_t k2, ARay& ray,
   // See Eq. (2-75) - (2-84)
   // theta1 = incident angle
   // theta2 = transmission angle
-  TVector3 n = GetFacetNormal(
-      nav, currentNode, nextNode);  // normal vect perpendicular to the surface
+  Double_t n[3];  // normal vect perpendicular to the surface
+  GetFacetNormal(nav, condition, rng, n);
   Double_t d1[3];
   ray.GetDirection(d1);
   Double_t cos1 = d1[0] * n[0] + d1[1] * n[1] + d1[2] * n[2];  // cos(theta1)
@@ -68,12 +1151,6 @@ void AOpticsManager::DoFresnel(Double_t n1, Double_t n2, Double_t k2, ARay& ray,
   Double_t sin2 = n1 * sin1 / n2;  // Snell's law
   Double_t cos2 = TMath::Sqrt(1 - sin2 * sin2);
 
-  AOpticalComponent* component1 = (AOpticalComponent*)currentNode->GetVolume();
-  AOpticalComponent* component2 =
-      nextNode ? (AOpticalComponent*)nextNode->GetVolume() : 0;
-  ABorderSurfaceCondition* condition =
-      component1 ? component1->FindBorderSurfaceCondition(component2) : 0;
-
   Bool_t absorbed = kFALSE;
 
   if (condition and condition->GetMultilayer()) {
@@ -83,10 +1160,16 @@ void AOpticsManager::DoFresnel(Double_t n1, Double_t n2, Double_t k2, ARay& ray,
     // polarization is ignored in this version
     condition->GetMultilayer()->CoherentTMMMixed(angle, lambda, reflectance,
                                                  transmittance);
-    auto rnd = gRandom->Uniform(1);
+    auto rnd = rng.Uniform(1);
+    if (fWeightedTracing) {
+      // The absorbed fraction is taken into the weight, and the ray is either
+      // reflected or transmitted
+      ray.SetWeight(ray.GetWeight() * (reflectance + transmittance));
+      rnd *= reflectance + transmittance;
+    }
     if (rnd < reflectance) {  // reflection at the boundary
-      DoReflection(n1, ray, nav, currentNode, nextNode, &n);
-      return;
+      return DoReflection(n1, ray, nav, currentNode, nextNode, condition, rng,
+                          n);
     } else if (rnd < reflectance + transmittance) {
       goto transmission_process;
     } else {  // absorption
@@ -96,8 +1179,8 @@ void AOpticsManager::DoFresnel(Double_t n1, Double_t n2, Double_t k2, ARay& ray,
   }
 
   if (sin2 > 1.) {  // total internal reflection
-    DoReflection(n1, ray, nav, currentNode, nextNode, &n);
-    return;
+    return DoReflection(n1, ray, nav, currentNode, nextNode, condition, rng,
+                        n);
   }
 
   if (fDisableFresnelReflection == kFALSE) {
@@ -135,9 +1218,9 @@ void AOpticsManager::DoFresnel(Double_t n1, Double_t n2, Double_t k2, ARay& ray,
     }
     Double_t R = (Rs + Rp) / 2.;  // We assume that polarization is random
 
-    if (gRandom->Uniform(1) < R) {  // reflection at the boundary
-      DoReflection(n1, ray, nav, currentNode, nextNode, &n);
-      return;
+    if (rng.Uniform(1) < R) {  // reflection at the boundary
+      return DoReflection(n1, ray, nav, currentNode, nextNode, condition, rng,
+                          n);
     }
   }
 
@@ -157,49 +1240,65 @@ transmission_process:
   Double_t speed = TMath::C() * m() / n1;
   Double_t t = x1[3] + step / speed;
   ray.AddPoint(x2[0], x2[1], x2[2], t);
-  ray.AddNode(nextNode);
+  RecordNode(ray, nextNode);
   if (absorbed) {
     ray.Absorb();
-  } else {
-    ray.SetDirection(d2);
-    nav->SetCurrentDirection(d2);
+    return ATraceStatistics::kAbsorption;
   }
+
+  ray.SetDirection(d2);
+  nav->SetCurrentDirection(d2);
+  return ATraceStatistics::kRefraction;
 }
 
 //_____________________________________________________________________________
-void AOpticsManager::DoReflection(Double_t n1, ARay& ray, TGeoNavigator* nav,
-                                  TGeoNode* currentNode, TGeoNode* nextNode,
-                                  TVector3* normal) {
+template <typename T, typename N>
+Int_t AOpticsManager::DoReflection(Double_t n1, T& ray, N* nav,
+                                   TGeoNode* currentNode, TGeoNode* nextNode,
+                                   ABorderSurfaceCondition* condition,
+                                   ACounterRandom& rng,
+                                   const Double_t* normal, Double_t bound) {
+  // Returns ATraceStatistics::kReflection or kAbsorption. A mirror reflects
+  // the ray with the probability of its reflectance divided by bound, which
+  // has already been applied by ApplySurvivalBound.
   Double_t step = nav->GetStep();
 
   // normal vect perpendicular to the surface
   // if it is not calculated yet, call GetFacetNormal
-  TVector3 n = normal ? *normal : GetFacetNormal(nav, currentNode, nextNode);
+  Double_t n[3];
+  if (normal) {
+    n[0] = normal[0];
+    n[1] = normal[1];
+    n[2] = normal[2];
+  } else {
+    GetFacetNormal(nav, condition, rng, n);
+  }
   Double_t d1[3];
   ray.GetDirection(d1);
   Double_t cos1 = d1[0] * n[0] + d1[1] * n[1] + d1[2] * n[2]; // should be positive
 
-  AOpticalComponent* component1 = (AOpticalComponent*)currentNode->GetVolume();
-  AOpticalComponent* component2 =
-      nextNode ? (AOpticalComponent*)nextNode->GetVolume() : 0;
-  ABorderSurfaceCondition* condition =
-      component1 ? component1->FindBorderSurfaceCondition(component2) : 0;
-
   Bool_t absorbed = kFALSE;
 
-  if (IsMirror(nextNode)) {
+  if (GetNodeType(nextNode) == kMirror) {
     Double_t angle = TMath::ACos(cos1);
-    Double_t lambda = ray.GetLambda();
-    Double_t ref;
-    if (condition and condition->GetMultilayer()) {
-      Double_t transmittance;
-      // ignore polarization in the current version
-      condition->GetMultilayer()->CoherentTMMMixed(angle, lambda, ref,
-                                                   transmittance);
-    } else {
-      ref = ((AMirror*)nextNode->GetVolume())->GetReflectance(lambda, angle);
-    }
-    if (ref < gRandom->Uniform(1)) {
+    AMirror* mirror = (AMirror*)nextNode->GetVolume();
+    auto reflectance = [angle, mirror, condition](Double_t lambda) {
+      Double_t ref;
+      if (condition and condition->GetMultilayer()) {
+        Double_t transmittance;
+        // ignore polarization in the current version
+        condition->GetMultilayer()->CoherentTMMMixed(angle, lambda, ref,
+                                                     transmittance);
+      } else {
+        ref = mirror->GetReflectance(lambda, angle);
+      }
+      return ref;
+    };
+    if (WeightLanes(ray, reflectance)) {
+      // all the lanes of a packet are reflected
+    } else if (fWeightedTracing) {
+      ray.SetWeight(ray.GetWeight() * reflectance(ray.GetLambda()));
+    } else if (reflectance(ray.GetLambda()) < rng.Uniform(bound)) {
       absorbed = kTRUE;
       ray.Absorb();
     }
@@ -207,26 +1306,9 @@ void AOpticsManager::DoReflection(Double_t n1, ARay& ray, TGeoNavigator* nav,
 
   Double_t d2[3];
   if (condition and condition->IsLambertian()) {
-    // theta distribution must be weighted by sin(theta) * cos(theta)
-    // y (\theta) = \int _0 ^\theta \sin\theta' \cos\theta' d\theta'
-    //            = \frac{1}{2} \sin^2 \theta
-    // \theta (y) = \asin \sqrt{2y}
-    Double_t y = gRandom->Uniform(0, 0.5);
-    Double_t theta = TMath::ASin(TMath::Sqrt(2 * y)); // [0, pi/2]
-    Double_t phi = gRandom->Uniform(0., TMath::TwoPi());
-
-    Double_t theta_n = n.Theta() * TMath::RadToDeg();
-    Double_t phi_n = n.Phi() * TMath::RadToDeg();
-    TGeoRotation rot("", phi_n + 90, theta_n + 180, 0);
-    TVector3 v;
-    v.SetMagThetaPhi(1, theta, phi);
-    Double_t dir[3] = {v[0], v[1], v[2]};
-    rot.LocalToMaster(dir, d2);
+    ASurfaceKernels::SampleLambertian(n, rng, d2);
   } else {
-    // specular reflection
-    for (Int_t i = 0; i < 3; i++) {  // d2 = d1 - 2n*(d1*n)
-      d2[i] = d1[i] - 2 * n[i] * cos1;
-    }
+    ASurfaceKernels::Reflect(d1, n, cos1, d2);  // specular reflection
   }
 
   if (not absorbed) {
@@ -243,84 +1325,117 @@ void AOpticsManager::DoReflection(Double_t n1, ARay& ray, TGeoNavigator* nav,
   nav->Step();
   nav->SetCurrentDirection(d2);
   ray.AddPoint(x2[0], x2[1], x2[2], t);
-  ray.AddNode(nextNode);
+  RecordNode(ray, nextNode);
+
+  return absorbed ? ATraceStatistics::kAbsorption
+                  : ATraceStatistics::kReflection;
 }
 
 //_____________________________________________________________________________
-TVector3 AOpticsManager::GetFacetNormal(TGeoNavigator* nav,
-                                        TGeoNode* currentNode,
-                                        TGeoNode* nextNode) {
-  AOpticalComponent* component1 = (AOpticalComponent*)currentNode->GetVolume();
-  AOpticalComponent* component2 =
-      nextNode ? (AOpticalComponent*)nextNode->GetVolume() : 0;
-
-  TVector3 normal(nav->FindNormal());
-  TVector3 momentum(nav->GetCurrentDirection());
-
-  ABorderSurfaceCondition* condition =
-      component1 ? component1->FindBorderSurfaceCondition(component2) : 0;
-
-  if (condition and condition->IsLambertian()) {
-    // Lambertian distribution should be calculated in another place
-    return normal;
-  } else if (condition and condition->GetGaussianRoughness() != 0) {
-    // The following method is based on G4OpBoundaryProcess::GetFacetNormal in
-    // Geant4 optics
-    TVector3 facetNormal;
-    Double_t alpha;
-    Double_t sigma_alpha = condition->GetGaussianRoughness();
-    Double_t f_max = TMath::Min(1., 4. * sigma_alpha);
-
-    do {
-      do {
-        alpha = gRandom->Gaus(0, sigma_alpha);
-      } while (gRandom->Uniform(f_max) > TMath::Sin(alpha) ||
-               alpha >= TMath::PiOver2());
-
-      Double_t phi = gRandom->Uniform(TMath::TwoPi());
-
-      Double_t SinAlpha = TMath::Sin(alpha);
-      Double_t CosAlpha = TMath::Cos(alpha);
-      Double_t SinPhi = TMath::Sin(phi);
-      Double_t CosPhi = TMath::Cos(phi);
-
-      Double_t unit_x = SinAlpha * CosPhi;
-      Double_t unit_y = SinAlpha * SinPhi;
-      Double_t unit_z = CosAlpha;
-
-      facetNormal.SetXYZ(unit_x, unit_y, unit_z);
+template <typename N>
+void AOpticsManager::GetFacetNormal(N* nav, ABorderSurfaceCondition* condition,
+                                    ACounterRandom& rng, Double_t* facet) {
+  const Double_t* normal = nav->FindNormal();
+
+  // Lambertian distribution is calculated in DoReflection
+  if (condition and not condition->IsLambertian() and
+      condition->GetGaussianRoughness() != 0) {
+    ASurfaceKernels::SampleFacetNormal(normal, nav->GetCurrentDirection(),
+                                       condition->GetGaussianRoughness(), rng,
+                                       facet);
+    return;
+  }
 
-      TVector3 tmpNormal = normal;
+  facet[0] = normal[0];
+  facet[1] = normal[1];
+  facet[2] = normal[2];
+}
 
-      facetNormal.RotateUz(tmpNormal);
-    } while (momentum * facetNormal <= 0.0);
-    normal = facetNormal;
+//_____________________________________________________________________________
+TGeoNavigator* AOpticsManager::GetThreadNavigator() {
+  // Return the navigator of the calling thread. A new one is created if the
+  // thread does not have it yet, and is recorded for ReleaseNavigators if
+  // the thread does not release it by itself.
+  TGeoNavigator* nav = GetCurrentNavigator();
+  if (!nav) {
+#if ROOT_VERSION(6, 9, 2) <= ROOT_VERSION_CODE && \
+    ROOT_VERSION_CODE <= ROOT_VERSION(6, 10, 2)
+    // This line is missing in TGeoManager::AddNavigator
+    if (IsMultiThread()) TGeoManager::ThreadId();
+#endif
+    nav = AddNavigator();
+    if (fRecordNavigators) {
+      std::lock_guard<std::mutex> lock(fNavigatorMutex);
+      fRecordedNavigators.push_back(nav);
+    }
   }
 
-  return normal;
+  return nav;
 }
 
 //_____________________________________________________________________________
-void* AOpticsManager::Thread(void* args) {
-  AOpticsManager* manager = (AOpticsManager*)((TObject**)args)[0];
-  ARayArray* array = (ARayArray*)((TObject**)args)[1];
-
-  TObjArray* running = array->GetRunning();
-  manager->TraceNonSequential(running);
+AThreadPool* AOpticsManager::GetWorkerPool(Int_t nthreads) {
+  // Return the persistent worker pool. The threads and their navigators are
+  // kept alive between calls of TraceNonSequential, and are restarted only
+  // when the number of threads has been changed.
+  //
+  // If ROOT::EnableImplicitMT has been called, the tracing tasks run in the
+  // thread pool of ROOT instead (see AThreadPool), and nthreads is ignored.
+  // The geometry must then have the thread data for all the threads of that
+  // pool, which may run the tasks, and for the thread waiting for them. As
+  // the threads of the pool outlive the tasks, the navigators made for them
+  // are recorded and deleted by StopWorkers.
+  Bool_t imt = AThreadPool::IsImplicitMTEnabled();
+  if (fWorkerPool and
+      (fWorkerPool->UsesImplicitMT() != imt or
+       (not imt and Int_t(fWorkerPool->GetNthreads()) != nthreads))) {
+    StopWorkers();
+  }
 
-  Int_t n = running->GetLast();
+  if (imt) {
+    Int_t n = GeometryThreads(nthreads);
+    if (GetMaxThreads() < n) SetMaxThreads(n);
+  }
 
-  for (Int_t i = 0; i <= n; i++) {
-    ARay* ray = (ARay*)(running->RemoveAt(i));
-    if (!ray) continue;
-    array->Add(ray);
+  if (!fWorkerPool and imt) {
+    fRecordNavigators = kTRUE;  // the tasks of IMT have no fini
+    fWorkerPool = new AThreadPool(nthreads, [this]() { GetThreadNavigator(); });
+  } else if (!fWorkerPool) {
+    fWorkerPool = new AThreadPool(
+        nthreads, [this]() { GetThreadNavigator(); },
+        [this]() {
+          TGeoNavigator* nav = GetCurrentNavigator();
+          if (nav) RemoveNavigator(nav);
+        });
   }
 
-  running->Expand(0);
+  return fWorkerPool;
+}
 
-  manager->RemoveNavigator(manager->GetCurrentNavigator());
+//_____________________________________________________________________________
+void AOpticsManager::ReleaseNavigators() {
+  // Delete the navigators recorded by GetThreadNavigator. Their threads, i.e.,
+  // those of the thread pool of ROOT or of the pool of another manager in
+  // TraceBatch, outlive the tracing and never release them by themselves.
+  std::lock_guard<std::mutex> lock(fNavigatorMutex);
+  for (std::size_t i = 0; i < fRecordedNavigators.size(); i++) {
+    RemoveNavigator(fRecordedNavigators[i]);
+  }
+  fRecordedNavigators.clear();
+}
 
-  return 0;
+//_____________________________________________________________________________
+void AOpticsManager::StopWorkers() {
+  // Join the persistent tracing threads and delete their navigators. This is
+  // called in the destructor, but can be called explicitly to release the
+  // threads earlier. They will be restarted by the next multithreaded call of
+  // TraceNonSequential.
+  if (!fWorkerPool) return;
+
+  SafeDelete(fWorkerPool);
+  ReleaseNavigators();
+  fRecordNavigators = kFALSE;
+  ClearThreadsMap();
 }
 
 //_____________________________________________________________________________
@@ -333,257 +1448,1372 @@ void AOpticsManager::TraceNonSequential(ARay& ray) {
 
 //_____________________________________________________________________________
 void AOpticsManager::TraceNonSequential(TObjArray* array) {
-  TGeoNavigator* nav = GetCurrentNavigator();
-  if (!nav) {
-#if ROOT_VERSION(6, 9, 2) <= ROOT_VERSION_CODE && \
-    ROOT_VERSION_CODE <= ROOT_VERSION(6, 10, 2)
-    // This line is missing in TGeoManager::AddNavigator
-    if (IsMultiThread()) TGeoManager::ThreadId();
-#endif
-    nav = AddNavigator();
-  }
+  if (!array) return;
+  CompileIfNeeded();
+  std::vector<Int_t> order;
+  if (fCoherentOrdering) CoherentOrder(*array, order);
+  TraceRange(array, 0, array->GetLast(), NextRandomKey(), 0, 0,
+             order.empty() ? 0 : order.data());
+}
 
-  Int_t n = array->GetLast();
-  for (Int_t j = 0; j <= n; j++) {
-    ARay* ray = (ARay*)array->At(j);
-    if (not ray or not ray->IsRunning()) {
-      continue;
+//_____________________________________________________________________________
+void AOpticsManager::TraceRange(TObjArray* array, Int_t first, Int_t last,
+                                ULong64_t key, const SequentialTrain* train,
+                                Char_t* status, const Int_t* order,
+                                const FlatGeometry* flat) {
+  // Trace rays stored in array[first] to array[last], or array[order[first]]
+  // to array[order[last]] if order is given. The index of a ray in the array
+  // is used as the number of its random number stream, so the order does not
+  // change the results. Rays are traced sequentially if train is given. If
+  // status is given, the final status of array[j] is stored in status[j]
+  // while the ray is still in the cache of this thread. If flat is given, it
+  // is navigated instead of the geometry itself (see TraceEnsemble).
+  TGeoNavigator* nav = GetThreadNavigator();
+  const FlatGeometry* geometry = flat ? flat : fFlatGeometry;
+  FlatNavigator fnav(geometry);
+  MaterialCache cache;
+  StartCache location;
+  ATraceStatistics local;
+  ATraceStatistics* stats = fStatistics ? &local : 0;
+  Bool_t packets = geometry and not train and fPacketSize > 0;
+  RayPacket packet;
+
+  for (Int_t i = first; i <= last; i++) {
+    if (packets and (i - first) % fPacketSize == 0) {
+      Int_t base = i;
+      packet.Load(TMath::Min(fPacketSize, last - i + 1),
+                  [array, order, base](Int_t k, Double_t* x, Double_t* d) {
+                    Int_t jk = order ? order[base + k] : base + k;
+                    ARay* r = (ARay*)array->At(jk);
+                    if (!r or not r->IsRunning()) return kFALSE;
+                    r->GetLastPoint(x);
+                    r->GetDirection(d);
+                    return kTRUE;
+                  });
+      packet.Intersect(*geometry, fPacketFloat);
     }
 
-    Double_t lambda = ray->GetLambda();
-    Double_t x1[4], d1[3];
-    ray->GetLastPoint(x1);
-    ray->GetDirection(d1);
-    nav->InitTrack(x1, d1);
-
-    while (ray->IsRunning()) {
-      ray->GetLastPoint(x1);
-      ray->GetDirection(d1);
-
-      TGeoNode* currentNode = nav->GetCurrentNode();
-      if (nav->IsOutside()) {  // if the current position is outside of top
-                               // volume
-        currentNode = 0;
+    Int_t j = order ? order[i] : i;
+    ARay* ray = (ARay*)array->At(j);
+    if (!ray) continue;
+    ACounterRandom rng(key, j);
+    BeginHistory(*ray);
+    ApplySurvivalBound(*ray, cache, rng);
+    if (train) {
+      TraceSequentialRay(*ray, *train, nav, cache, location, rng, stats);
+    } else if (geometry) {
+      if (packets) {
+        fnav.SetCandidates(packet.GetCandidates((i - first) % fPacketSize));
       }
+      TraceRay(*ray, &fnav, cache, location, rng, stats);
+    } else {
+      TraceRay(*ray, nav, cache, location, rng, stats);
+    }
+    if (ray->IsSuspended()) {
+      // kept for TraceSuspended, including the rays traced without bounds
+      ray->SetPendingBounds(cache.fMirrorBound, cache.fNmirrorBounds,
+                            cache.fFocalBound);
+    }
+    EndHistory(*ray);
+    if (status) status[j] = ray->GetStatus();
+    if (fWriter) fWriter->Fill(*ray);
+  }
 
-      TGeoNode* nextNode = nav->FindNextBoundaryAndStep();
-      Double_t step = nav->GetStep();  // distance to the next boundary
-
-      // Check type of start node
-      Int_t typeCurrent = kOther;
-      Int_t typeNext = kOther;
-
-      if (!currentNode)
-        typeCurrent = kNull;
-      else if (IsLens(currentNode))
-        typeCurrent = kLens;
-      else if (IsObscuration(currentNode))
-        typeCurrent = kObs;
-      else if (IsMirror(currentNode))
-        typeCurrent = kMirror;
-      else if (IsFocalSurface(currentNode))
-        typeCurrent = kFocus;
-      else if (IsOpticalComponent(currentNode))
-        typeCurrent = kOpt;
-
-      // Check type of next node
-      if (!nextNode)
-        typeNext = kNull;
-      else if (IsLens(nextNode))
-        typeNext = kLens;
-      else if (IsObscuration(nextNode))
-        typeNext = kObs;
-      else if (IsMirror(nextNode))
-        typeNext = kMirror;
-      else if (IsFocalSurface(nextNode))
-        typeNext = kFocus;
-      else if (IsOpticalComponent(nextNode))
-        typeNext = kOpt;
-
-      if (typeCurrent == kLens) {
-        Double_t abs =
-            ((ALens*)currentNode->GetVolume())->GetAbsorptionLength(lambda);
-        if (abs > 0 && abs != kInf) {
-          Double_t abs_step = gRandom->Exp(abs);
-          if (abs_step < step) {
-            Double_t n1 =
-                ((ALens*)currentNode->GetVolume())->GetRefractiveIndex(lambda);
-            Double_t speed = TMath::C() * m() / n1;
-            Double_t x2[3];
-            for (Int_t i = 0; i < 3; i++) {
-              x2[i] = x1[i] + abs_step * d1[i];
-            }
-            Double_t t = x1[3] + abs_step / speed;
-            ray->AddPoint(x2[0], x2[1], x2[2], t);
-            ray->AddNode(nextNode);
-            ray->Absorb();
-            continue;
-          }
-        }
-      }
+  AFocalPlaneMonitor::FlushThreadBuffers();
+  ARayWriter::FlushThreadBuffers();
+  if (stats) MergeStatistics(local);
+}
+
+//_____________________________________________________________________________
+template <typename T>
+void AOpticsManager::ApplySurvivalBound(T& ray, MaterialCache& cache,
+                                        ACounterRandom& rng) const {
+  // Drop a ray not traced yet with the probability 1 - B(lambda) of the
+  // survival bound, and keep its mirror and focal parts in cache so that
+  // DoInteraction divides them out of the reflectance and the QE. A ray
+  // resumed by TraceSuspended continues with the parts it had left when it
+  // was suspended (see ARay::SetPendingBounds), without being dropped again.
+  cache.fMirrorBound = 1;
+  cache.fNmirrorBounds = 0;
+  cache.fFocalBound = 1;
+  if (not ray.IsRunning()) return;
+  if (ray.GetPendingBounds(cache.fMirrorBound, cache.fNmirrorBounds,
+                           cache.fFocalBound)) {
+    return;
+  }
+  if (fWeightedTracing or not HasSurvivalBound()) return;
+
+  Double_t lambda = ray.GetLambda();
+  Double_t mirror = EvalBound(fMirrorBound.get(), lambda);
+  Double_t focal = EvalBound(fFocalBound.get(), lambda);
+  Double_t bound = TMath::Power(mirror, fNmirrorBounds) * focal *
+                   EvalBound(fTransmission.get(), lambda);
+  if (bound < 1 and not(rng.Uniform(1) < bound)) {
+    ray.Absorb();
+    return;
+  }
+
+  cache.fMirrorBound = mirror;
+  cache.fNmirrorBounds = fNmirrorBounds;
+  cache.fFocalBound = focal;
+  ray.SetPendingBounds(mirror, fNmirrorBounds, focal);
+}
+
+//_____________________________________________________________________________
+template <typename T, typename N>
+void AOpticsManager::TraceRay(T& ray, N* nav, MaterialCache& cache,
+                              StartCache& location, ACounterRandom& rng,
+                              ATraceStatistics* stats) {
+  // Trace a single ray until it stops running. T is either ARay or APhoton,
+  // and N is either TGeoNavigator or FlatNavigator.
+  if (not ray.IsRunning()) return;
+
+  Double_t x1[4], d1[3];
+  ray.GetLastPoint(x1);
+  ray.GetDirection(d1);
+  location.InitTrack(nav, x1, d1);
+
+  while (ray.IsRunning()) {
+    TGeoNode* currentNode = nav->GetCurrentNode();
+    if (nav->IsOutside()) {  // if the current position is outside of top
+                             // volume
+      currentNode = 0;
+    }
+
+    Double_t start = stats ? ATraceStatistics::Now() : 0;
+    TGeoNode* nextNode = nav->FindNextBoundaryAndStep();
+    if (stats) {
+      Int_t type = GetNodeType(nextNode);
+      stats->Count(nextNode, type, ATraceStatistics::kStep);
+      stats->AddTime(nextNode, type, ATraceStatistics::kNavigation,
+                     ATraceStatistics::Now() - start);
+    }
+
+    DoInteraction(ray, nav, currentNode, nextNode, cache, rng, stats);
+  }
+}
+
+//_____________________________________________________________________________
+template <typename T, typename N>
+void AOpticsManager::DoInteraction(T& ray, N* nav, TGeoNode* currentNode,
+                                   TGeoNode* nextNode, MaterialCache& cache,
+                                   ACounterRandom& rng,
+                                   ATraceStatistics* stats) {
+  // Apply the physics at the boundary between currentNode and nextNode, to
+  // which nav has just moved. N is either TGeoNavigator (non-sequential mode)
+  // or SurfaceNavigator (sequential mode). The outcome is counted in stats if
+  // given.
+  Double_t start = stats ? ATraceStatistics::Now() : 0;
+  Double_t lambda = ray.GetLambda();
+  Double_t x1[4], d1[3];
+  ray.GetLastPoint(x1);
+  ray.GetDirection(d1);
+  Double_t step = nav->GetStep();  // distance to the next boundary
+
+  Int_t typeCurrent = GetNodeType(currentNode);
+  Int_t typeNext = GetNodeType(nextNode);
+
+  // The path of a packet of wavelengths is no longer common to its lanes
+  if ((typeCurrent == kLens or typeNext == kLens) and SplitPacket(ray)) {
+    return;
+  }
 
-      if ((typeCurrent == kNull or typeCurrent == kOpt or
-           typeCurrent == kLens or typeCurrent == kOther) and
-          typeNext == kMirror) {
-        Double_t n1 =
-            typeCurrent == kLens
-                ? ((ALens*)currentNode->GetVolume())->GetRefractiveIndex(lambda)
-                : 1.;
-        DoReflection(n1, *ray, nav, currentNode, nextNode);
-      } else if ((typeCurrent == kNull or typeCurrent == kOpt or
-                  typeCurrent == kOther) and
-                 typeNext == kLens) {
-        Double_t n1 = 1;  // Assume refractive index equals 1 (= vacuum)
-        Double_t n2 =
-            ((ALens*)nextNode->GetVolume())->GetRefractiveIndex(lambda);
-        Double_t k2 =
-            ((ALens*)nextNode->GetVolume())->GetExtinctionCoefficient(lambda);
-        DoFresnel(n1, n2, k2, *ray, nav, currentNode, nextNode);
-      } else if ((typeCurrent == kNull or typeCurrent == kLens or
-                  typeCurrent == kOpt or typeCurrent == kOther) and
-                 (typeNext == kObs or typeNext == kFocus)) {
-        const Double_t* x2 = nav->GetCurrentPoint();
-        Double_t t;
-        if (typeCurrent == kLens) {
-          Double_t n1 =
-              ((ALens*)currentNode->GetVolume())->GetRefractiveIndex(lambda);
+  // Looked up only once per interaction and shared by DoFresnel,
+  // DoReflection and GetFacetNormal
+  ABorderSurfaceCondition* condition =
+      FindBorderSurfaceCondition(currentNode, nextNode);
+
+  // Optical properties of lenses are evaluated only once per wavelength
+  const MaterialCache::Entry mat1 =
+      typeCurrent == kLens ? cache.Get((ALens*)currentNode->GetVolume(), lambda)
+                           : cache.GetVacuum();
+  const MaterialCache::Entry mat2 =
+      typeNext == kLens ? cache.Get((ALens*)nextNode->GetVolume(), lambda)
+                        : cache.GetVacuum();
+
+  if (typeCurrent == kLens) {
+    Double_t abs = mat1.fAbs;
+    if (abs > 0 && abs != kInf) {
+      if (fWeightedTracing or fAttenuationWeighting) {
+        // Beer-Lambert attenuation along the segment instead of a random
+        // absorption point
+        ray.SetWeight(ray.GetWeight() * TMath::Exp(-step / abs));
+      } else {
+        Double_t abs_step = rng.Exp(abs);
+        if (abs_step < step) {
+          Double_t n1 = mat1.fN;
           Double_t speed = TMath::C() * m() / n1;
-          t = x1[3] + step / speed;
-        } else {
-          Double_t speed = TMath::C() * m();
-          t = x1[3] + step / speed;
+          Double_t x2[3];
+          for (Int_t i = 0; i < 3; i++) {
+            x2[i] = x1[i] + abs_step * d1[i];
+          }
+          Double_t t = x1[3] + abs_step / speed;
+          ray.AddPoint(x2[0], x2[1], x2[2], t);
+          RecordNode(ray, nextNode);
+          ray.Absorb();
+          if (stats) {
+            stats->Count(currentNode, typeCurrent,
+                         ATraceStatistics::kAbsorption);
+            stats->AddTime(currentNode, typeCurrent,
+                           ATraceStatistics::kInteraction,
+                           ATraceStatistics::Now() - start);
+          }
+          return;
         }
-        ray->AddPoint(x2[0], x2[1], x2[2], t);
-        ray->AddNode(nextNode);
-      } else if ((typeCurrent == kNull or typeCurrent == kOpt or
-                  typeCurrent == kOther) and
-                 (typeNext == kOther or typeNext == kOpt)) {
-        const Double_t* x2 = nav->GetCurrentPoint();
-
-        Double_t speed = TMath::C() * m();
-        Double_t t = x1[3] + step / speed;
-        ray->AddPoint(x2[0], x2[1], x2[2], t);
-        ray->AddNode(nextNode);
-      } else if (typeCurrent == kLens and typeNext == kLens) {
-        Double_t n1 =
-            ((ALens*)currentNode->GetVolume())->GetRefractiveIndex(lambda);
-        Double_t n2 =
-            ((ALens*)nextNode->GetVolume())->GetRefractiveIndex(lambda);
-        Double_t k2 =
-            ((ALens*)nextNode->GetVolume())->GetExtinctionCoefficient(lambda);
-        DoFresnel(n1, n2, k2, *ray, nav, currentNode, nextNode);
-      } else if (typeCurrent == kLens and
-                 (typeNext == kNull or typeNext == kOpt or
-                  typeNext == kOther)) {
-        Double_t n1 =
-            ((ALens*)currentNode->GetVolume())->GetRefractiveIndex(lambda);
-        Double_t n2 = 1;  // Assume refractive index equals 1 (= vacuum)
-        Double_t k2 = 0;  // No extinction (= vacuum)
-        DoFresnel(n1, n2, k2, *ray, nav, currentNode, nextNode);
       }
+    }
+  }
 
-      if (typeNext == kNull) {
-        const Double_t* x2 = nav->GetCurrentPoint();
-        Double_t speed = TMath::C() * m();
-        Double_t t = x1[3] + step / speed;
-        ray->AddPoint(x2[0], x2[1], x2[2], t);
-        ray->AddNode(nextNode);
-        ray->Exit();
-      } else if (typeCurrent == kFocus or typeCurrent == kObs or
-                 typeCurrent == kMirror or typeNext == kObs) {
-        ray->Stop();
-      } else if (typeNext == kFocus) {
-        AFocalSurface* focal = (AFocalSurface*)nextNode->GetVolume();
-        Double_t angle = 0.;
-        if (focal->HasQEAngle()) {
-          TVector3 n = GetFacetNormal(
-              nav, currentNode,
-              nextNode);  // normal vect perpendicular to the surface
-          Double_t d1[3];
-          ray->GetDirection(d1);
-          Double_t cos1 = d1[0] * n[0] + d1[1] * n[1] + d1[2] * n[2];
-          angle = TMath::ACos(cos1);
-        }
-        Double_t qe = focal->GetQuantumEfficiency(lambda, angle);
-        if (qe == 1 or gRandom->Uniform(0, 1) < qe) {
-          ray->Focus();
-        } else {
-          ray->Stop();
-        }
-      }
+  Int_t outcome = ATraceStatistics::kCrossing;
+  Int_t final = -1;  // counter of the final status if the ray stops
+
+  if ((typeCurrent == kNull or typeCurrent == kOpt or
+       typeCurrent == kLens or typeCurrent == kOther) and
+      typeNext == kMirror) {
+    Double_t n1 = mat1.fN;  // 1 if the current node is not a lens
+    Double_t bound = 1;
+    if (cache.fNmirrorBounds > 0) {
+      bound = cache.fMirrorBound;
+      --cache.fNmirrorBounds;
+    }
+    outcome = DoReflection(n1, ray, nav, currentNode, nextNode, condition, rng,
+                           0, bound);
+  } else if ((typeCurrent == kNull or typeCurrent == kOpt or
+              typeCurrent == kOther) and
+             typeNext == kLens) {
+    Double_t n1 = 1;  // Assume refractive index equals 1 (= vacuum)
+    Double_t n2 = mat2.fN;
+    Double_t k2 = mat2.fK;
+    outcome = DoFresnel(n1, n2, k2, ray, nav, currentNode, nextNode,
+                        condition, rng);
+  } else if ((typeCurrent == kNull or typeCurrent == kLens or
+              typeCurrent == kOpt or typeCurrent == kOther) and
+             (typeNext == kObs or typeNext == kFocus)) {
+    const Double_t* x2 = nav->GetCurrentPoint();
+    Double_t t;
+    if (typeCurrent == kLens) {
+      Double_t n1 = mat1.fN;
+      Double_t speed = TMath::C() * m() / n1;
+      t = x1[3] + step / speed;
+    } else {
+      Double_t speed = TMath::C() * m();
+      t = x1[3] + step / speed;
+    }
+    ray.AddPoint(x2[0], x2[1], x2[2], t);
+    RecordNode(ray, nextNode);
+  } else if ((typeCurrent == kNull or typeCurrent == kOpt or
+              typeCurrent == kOther) and
+             (typeNext == kOther or typeNext == kOpt)) {
+    const Double_t* x2 = nav->GetCurrentPoint();
+
+    Double_t speed = TMath::C() * m();
+    Double_t t = x1[3] + step / speed;
+    ray.AddPoint(x2[0], x2[1], x2[2], t);
+    RecordNode(ray, nextNode);
+  } else if (typeCurrent == kLens and typeNext == kLens) {
+    Double_t n1 = mat1.fN;
+    Double_t n2 = mat2.fN;
+    Double_t k2 = mat2.fK;
+    outcome = DoFresnel(n1, n2, k2, ray, nav, currentNode, nextNode,
+                        condition, rng);
+  } else if (typeCurrent == kLens and
+             (typeNext == kNull or typeNext == kOpt or
+              typeNext == kOther)) {
+    Double_t n1 = mat1.fN;
+    Double_t n2 = 1;  // Assume refractive index equals 1 (= vacuum)
+    Double_t k2 = 0;  // No extinction (= vacuum)
+    outcome = DoFresnel(n1, n2, k2, ray, nav, currentNode, nextNode,
+                        condition, rng);
+  }
 
-      if (ray->IsRunning() and ray->GetNpoints() >= fLimit) {
-        ray->Suspend();
+  if (typeNext == kNull) {
+    const Double_t* x2 = nav->GetCurrentPoint();
+    Double_t speed = TMath::C() * m();
+    Double_t t = x1[3] + step / speed;
+    ray.AddPoint(x2[0], x2[1], x2[2], t);
+    RecordNode(ray, nextNode);
+    ray.Exit();
+    final = ATraceStatistics::kExit;
+  } else if (typeCurrent == kFocus or typeCurrent == kObs or
+             typeCurrent == kMirror or typeNext == kObs) {
+    ray.Stop();
+    final = ATraceStatistics::kStop;
+  } else if (typeNext == kFocus) {
+    AFocalSurface* focal = (AFocalSurface*)nextNode->GetVolume();
+    Double_t angle = 0.;
+    if (focal->HasQEAngle()) {
+      Double_t n[3];  // normal vect perpendicular to the surface
+      GetFacetNormal(nav, condition, rng, n);
+      Double_t d1[3];
+      ray.GetDirection(d1);
+      Double_t cos1 = d1[0] * n[0] + d1[1] * n[1] + d1[2] * n[2];
+      angle = TMath::ACos(cos1);
+    }
+    auto efficiency = [focal, angle](Double_t lambda) {
+      return focal->GetQuantumEfficiency(lambda, angle);
+    };
+    if (WeightLanes(ray, efficiency)) {
+      ray.Focus();
+      final = ATraceStatistics::kFocus;
+    } else {
+      Double_t qe = efficiency(lambda);
+      if (fWeightedTracing) {
+        ray.SetWeight(ray.GetWeight() * qe);
+        ray.Focus();
+        final = ATraceStatistics::kFocus;
+      } else if (qe >= cache.fFocalBound or
+                 rng.Uniform(0, cache.fFocalBound) < qe) {
+        ray.Focus();
+        final = ATraceStatistics::kFocus;
+      } else {
+        ray.Stop();
+        final = ATraceStatistics::kStop;
       }
     }
+
+    AFocalPlaneMonitor* monitor = focal->GetMonitor();
+    if (monitor and final == ATraceStatistics::kFocus) {
+      Double_t x2[4];
+      ray.GetLastPoint(x2);
+      FillMonitor(monitor, x2, lambda, ray);
+    }
+  }
+
+  if ((fWeightedTracing or fAttenuationWeighting) and ray.IsRunning() and
+      ray.GetWeight() < fRouletteThreshold) {
+    // Russian roulette keeps the expectation value of the weight unchanged
+    if (rng.Uniform(1) < fRouletteSurvival) {
+      ray.SetWeight(ray.GetWeight() / fRouletteSurvival);
+    } else {
+      ray.Absorb();
+      final = ATraceStatistics::kAbsorption;
+    }
+  }
+
+  if (ray.IsRunning() and ray.GetNpointsAdded() >= fLimit) {
+    ray.Suspend();
+    final = ATraceStatistics::kSuspension;
+  }
+
+  if (stats) {
+    stats->Count(nextNode, typeNext, outcome);
+    if (final >= 0) stats->Count(nextNode, typeNext, final);
+    Int_t phase = condition and condition->GetMultilayer()
+                      ? ATraceStatistics::kMultilayer
+                      : ATraceStatistics::kInteraction;
+    stats->AddTime(nextNode, typeNext, phase, ATraceStatistics::Now() - start);
+  }
+}
+
+//_____________________________________________________________________________
+template <typename T>
+void AOpticsManager::TraceSequentialRay(T& ray, const SequentialTrain& train,
+                                        TGeoNavigator* nav,
+                                        MaterialCache& cache,
+                                        StartCache& location,
+                                        ACounterRandom& rng,
+                                        ATraceStatistics* stats) {
+  // Trace a single ray through the surfaces of train in the listed order.
+  // The medium between two surfaces is taken from the mother volume of the
+  // next surface, and volumes not in the list are ignored. A lens is entered
+  // and left before the next surface is examined. When the ray misses the
+  // next surface or is reflected back by a lens, it is traced
+  // non-sequentially from there, or suspended if fallback is disabled. The
+  // remaining running rays after the last surface are also traced
+  // non-sequentially so that they end up with a proper status.
+  SurfaceNavigator snav;
+  std::size_t i = 0;
+
+  while (ray.IsRunning() and i < train.fSurfaces.size()) {
+    const SequentialTrain::Surface& surface = train.fSurfaces[i];
+    Double_t x1[4], d1[3];
+    ray.GetLastPoint(x1);
+    ray.GetDirection(d1);
+    snav.InitTrack(x1, d1);
+
+    Bool_t inside;
+    Double_t start = stats ? ATraceStatistics::Now() : 0;
+    if (not snav.FindNextBoundaryAndStep(surface, inside)) break;
+    if (stats) {
+      Int_t type = GetNodeType(surface.fNode);
+      stats->Count(surface.fNode, type, ATraceStatistics::kStep);
+      stats->AddTime(surface.fNode, type, ATraceStatistics::kNavigation,
+                     ATraceStatistics::Now() - start);
+    }
+
+    TGeoNode* currentNode = inside ? surface.fNode : surface.fMother;
+    TGeoNode* nextNode = inside ? surface.fMother : surface.fNode;
+    Bool_t isLens = GetNodeType(surface.fNode) == kLens;
+    if (inside and not isLens) break;  // started in a non-transparent volume
+
+    DoInteraction(ray, &snav, currentNode, nextNode, cache, rng, stats);
+    if (not ray.IsRunning()) return;
+
+    if (snav.IsInside(surface)) {
+      if (not isLens) i++;  // passed into a dummy volume
+    } else if (inside or not isLens) {
+      i++;  // left a lens, or reflected by a mirror
+    } else {
+      break;  // reflected at the entrance of a lens
+    }
+  }
+
+  if (not ray.IsRunning()) return;
+
+  if (i < train.fSurfaces.size() and not train.fFallback) {
+    ray.Suspend();
+    return;
   }
+
+  TraceRay(ray, nav, cache, location, rng, stats);
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::TraceRunning(const std::vector<ARayArray*>& arrays,
+                                  const SequentialTrain* train) {
+  // Trace all the running rays in arrays, and sort them again by status
+  //
+  // The rays of all the arrays are traced together, and the threads are not
+  // left idle between small arrays.
+  ATraceFuture::State state;
+  state.Take(arrays);
+
+  Char_t* pstatus = state.fStatus.data();
+  if (fCoherentOrdering) CoherentOrder(state.fRays, state.fOrder);
+  const Int_t* porder = state.fOrder.empty() ? 0 : state.fOrder.data();
+  TObjArray* rays = &state.fRays;
+  ULong64_t key = NextRandomKey();
+  TraceInChunks(state.GetNrays(), [this, rays, key, train, pstatus, porder](
+                                      Int_t first, Int_t last) {
+    TraceRange(rays, first, last, key, train, pstatus, porder);
+  });
+
+  state.Return();
 }
 
 //_____________________________________________________________________________
 void AOpticsManager::TraceNonSequential(ARayArray& array) {
-  TObjArray* running = array.GetRunning();
+  CompileIfNeeded();
+  TraceRunning(std::vector<ARayArray*>(1, &array), 0);
+}
 
-  Int_t n = running->GetLast();
+//_____________________________________________________________________________
+void AOpticsManager::TraceNonSequential(const std::vector<ARayArray*>& arrays) {
+  // Trace the running rays of several arrays (e.g. those of the telescopes of
+  // an air shower) in one pass over the worker threads. Each array then gets
+  // back its own rays, and its sink receives them as usual.
+  CompileIfNeeded();
+  TraceRunning(arrays, 0);
+}
+
+//_____________________________________________________________________________
+ATraceFuture AOpticsManager::TraceAsync(ARayArray& array) {
+  return TraceAsync(std::vector<ARayArray*>(1, &array));
+}
+
+//_____________________________________________________________________________
+ATraceFuture AOpticsManager::TraceAsync(const std::vector<ARayArray*>& arrays) {
+  // Start tracing the running rays of arrays on the persistent worker threads
+  // and return immediately. The returned ATraceFuture tells how many rays
+  // have been finished, and its Wait gives the rays back to the arrays in the
+  // calling thread as TraceNonSequential does. The results are identical to
+  // those of TraceNonSequential with the same random seed.
+  //
+  // The arrays must not be touched, and the geometry must not be modified,
+  // until Wait has returned. Synchronous tracing calls of this manager may be
+  // made meanwhile, but they wait for the queued asynchronous jobs to finish
+  // as they share the worker queue. In single-thread mode, the rays are traced
+  // before returning, and the future is already done.
+  CompileIfNeeded();
+
+  std::shared_ptr<ATraceFuture::State> state =
+      std::make_shared<ATraceFuture::State>();
+  state->Take(arrays);
+  if (fCoherentOrdering) CoherentOrder(state->fRays, state->fOrder);
+  ULong64_t key = NextRandomKey();
+
+  Int_t n = state->GetNrays();
   Int_t nthreads = GetMaxThreads();
+  if (n == 0) return ATraceFuture(state);
 
-  if (IsMultiThread() and nthreads >= 2) {
-    TThread** threads = new TThread*[nthreads];
-    ARayArray** dividedArray = new ARayArray*[nthreads];
-
-    for (Int_t i = 0; i < nthreads; i++) {
-      dividedArray[i] = new ARayArray();
-      for (Int_t j = ((n + 1) / nthreads) * i;
-           (i == (nthreads - 1)) ? j <= n : j < ((n + 1) / nthreads) * (i + 1);
-           j++) {
-        ARay* ray = (ARay*)running->RemoveAt(j);
-        dividedArray[i]->Add(ray);
+  if (not IsMultiThread() or nthreads < 2) {
+    TraceRange(&state->fRays, 0, n - 1, key, 0, state->fStatus.data(),
+               state->fOrder.empty() ? 0 : state->fOrder.data());
+    state->fNtraced = n;
+    return ATraceFuture(state);
+  }
+
+  AThreadPool* pool = GetWorkerPool(nthreads);
+  Int_t chunk = fChunkSize;
+  Int_t ntasks = TMath::Min(Int_t(pool->GetNthreads()), (n - 1) / chunk + 1);
+  state->fNtasks = ntasks;
+  for (Int_t i = 0; i < ntasks; i++) {
+    // Each task holds a reference to the state so that the rays outlive a
+    // future destroyed before the tasks finish
+    pool->Push([this, state, key, chunk, n]() {
+      std::exception_ptr exception;
+      try {
+        Char_t* status = state->fStatus.data();
+        const Int_t* order = state->fOrder.empty() ? 0 : state->fOrder.data();
+        while (kTRUE) {
+          Int_t first = state->fNext.fetch_add(chunk);
+          if (first >= n) break;
+          Int_t last = TMath::Min(first + chunk, n) - 1;
+          TraceRange(&state->fRays, first, last, key, 0, status, order);
+          state->fNtraced += last - first + 1;
+        }
+      } catch (...) {
+        exception = std::current_exception();
       }
+      state->Finish(exception);
+    });
+  }
+
+  return ATraceFuture(state);
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::TraceBatch(const std::vector<AOpticsManager*>& managers,
+                                const std::vector<ARayArray*>& arrays) {
+  // Trace the running rays of arrays[i] in the geometry of managers[i] for
+  // all i at once, e.g. several field angles of several perturbed geometries
+  // in an optimization loop. A manager may appear more than once. All the
+  // jobs share the worker pool of managers[0] so that the threads are not
+  // left idle between small jobs.
+  //
+  // The jobs use common random numbers: the j-th running ray of every array
+  // gets the same random number stream. If the arrays start from the same
+  // rays (e.g. ARayShooter::Circle, or a random shooter after resetting the
+  // seed of gRandom), the differences in the results between geometry
+  // variants are then not buried in the statistical noise, which makes
+  // finite-difference gradients much smoother.
+  //
+  // The geometry of each manager must be built and closed while it is
+  // gGeoManager, and must not be modified during the call. Several
+  // TGeoManagers can be traced at once, as each thread navigates each
+  // geometry with its own navigator of that manager and gGeoManager is not
+  // used while tracing. The other managers are switched to the multithread
+  // mode of managers[0] only during the call: their settings are restored,
+  // and the navigators made for the threads of the pool are deleted, before
+  // returning.
+  if (managers.size() != arrays.size()) {
+    ::Error("AOpticsManager::TraceBatch",
+            "Numbers of managers (%d) and arrays (%d) differ",
+            Int_t(managers.size()), Int_t(arrays.size()));
+    return;
+  }
+  for (std::size_t i = 0; i < managers.size(); i++) {
+    if (!managers[i] or !arrays[i]) {
+      ::Error("AOpticsManager::TraceBatch", "Job %d is empty", Int_t(i));
+      return;
+    }
+  }
+  if (managers.empty()) return;
+
+  // All the managers must have their own navigator for each thread of the
+  // shared pool. The others keep their settings to be restored.
+  struct Saved {
+    AOpticsManager* fManager;
+    Bool_t fMultiThread;
+    Int_t fMaxThreads;
+    Bool_t fRecordNavigators;
+  };
+  AOpticsManager* pool = managers[0];
+  Int_t nthreads = GeometryThreads(pool->GetMaxThreads());
+  Bool_t multi = pool->IsMultiThread() and pool->GetMaxThreads() >= 2;
+  std::vector<Saved> saved;
+  for (std::size_t i = 0; i < managers.size(); i++) {
+    AOpticsManager* manager = managers[i];
+    manager->CompileIfNeeded();
+    if (not multi or manager == pool) continue;
+
+    Bool_t found = kFALSE;
+    for (std::size_t j = 0; not found and j < saved.size(); j++) {
+      found = saved[j].fManager == manager;
+    }
+    if (found) continue;
+
+    Saved s = {manager, manager->IsMultiThread(), manager->GetMaxThreads(),
+               manager->fRecordNavigators};
+    saved.push_back(s);
+    if (not manager->IsMultiThread() or manager->GetMaxThreads() < nthreads) {
+      manager->SetMultiThread(kTRUE);
+      manager->SetMaxThreads(nthreads);
     }
+    manager->fRecordNavigators = kTRUE;
+  }
 
-    TObject*** args = new TObject**[nthreads];
-    for (Int_t i = 0; i < nthreads; i++) {
-      args[i] = new TObject*[2];
-      args[i][0] = this;
-      args[i][1] = dividedArray[i];
-      threads[i] = new TThread(Form("thread%d", i), AOpticsManager::Thread,
-                               (void*)args[i]);
-      threads[i]->Run();
+  // Move the running rays to compact arrays as TraceRunning does. Job i has
+  // the rays [offset[i], offset[i + 1]) of the combined index.
+  std::size_t njobs = arrays.size();
+  std::vector<TObjArray> rays(njobs);
+  std::vector<std::vector<Char_t> > status(njobs);
+  std::vector<Int_t> offset(1, 0);
+  for (std::size_t i = 0; i < njobs; i++) {
+    TObjArray* running = arrays[i]->GetRunning();
+    Int_t last = running->GetLast();
+    for (Int_t j = 0; j <= last; j++) {
+      ARay* ray = (ARay*)running->RemoveAt(j);
+      if (ray) rays[i].Add(ray);
     }
+    running->Expand(0);
+    status[i].resize(rays[i].GetLast() + 1);
+    offset.push_back(offset.back() + rays[i].GetLast() + 1);
+  }
+
+  // the order of each job is that of its own manager
+  std::vector<std::vector<Int_t> > order(njobs);
+  for (std::size_t i = 0; i < njobs; i++) {
+    if (managers[i]->IsCoherentOrdering()) CoherentOrder(rays[i], order[i]);
+  }
 
-    for (Int_t i = 0; i < nthreads; i++) {
-      threads[i]->Join();
+  ULong64_t key = pool->NextRandomKey();
+  const std::vector<AOpticsManager*>* pmanagers = &managers;
+  std::vector<TObjArray>* prays = &rays;
+  std::vector<std::vector<Char_t> >* pstatus = &status;
+  const std::vector<std::vector<Int_t> >* porder = &order;
+  const std::vector<Int_t>* poffset = &offset;
+  pool->TraceInChunks(offset.back(), [pmanagers, prays, pstatus, porder,
+                                      poffset, key](Int_t first, Int_t last) {
+    // a chunk may span several jobs
+    const std::vector<Int_t>& off = *poffset;
+    std::size_t i =
+        std::upper_bound(off.begin(), off.end(), first) - off.begin() - 1;
+    for (; i + 1 < off.size() and off[i] <= last; i++) {
+      Int_t lo = TMath::Max(first, off[i]) - off[i];
+      Int_t hi = TMath::Min(last, off[i + 1] - 1) - off[i];
+      if (lo > hi) continue;
+      const std::vector<Int_t>& o = (*porder)[i];
+      (*pmanagers)[i]->TraceRange(&(*prays)[i], lo, hi, key, 0,
+                                  (*pstatus)[i].data(),
+                                  o.empty() ? 0 : o.data());
     }
+  });
 
-    ClearThreadsMap();
+  for (std::size_t i = 0; i < njobs; i++) arrays[i]->Add(rays[i], &status[i]);
 
-    for (Int_t i = 0; i < nthreads; i++) {
-      delete[] args[i];
-      array.Merge(dividedArray[i]);
-      SafeDelete(dividedArray[i]);
-      SafeDelete(threads[i]);
+  for (std::size_t i = 0; i < saved.size(); i++) {
+    AOpticsManager* manager = saved[i].fManager;
+    manager->ReleaseNavigators();
+    manager->fRecordNavigators = saved[i].fRecordNavigators;
+    if (manager->GetMaxThreads() != saved[i].fMaxThreads) {
+      manager->ClearThreadsMap();
+      manager->SetMaxThreads(saved[i].fMaxThreads);
     }
+    manager->SetMultiThread(saved[i].fMultiThread);
+  }
+}
 
-    delete[] args;
-    delete[] threads;
-    delete[] dividedArray;
-  } else {  // single thread
-    TObjArray* objarray = new TObjArray;
-    for (Int_t i = 0; i <= n; i++) {
-      ARay* ray = (ARay*)running->RemoveAt(i);
-      if (!ray) continue;
-      objarray->Add(ray);
+//_____________________________________________________________________________
+void AOpticsManager::TraceEnsemble(const AMisalignmentEnsemble& ensemble,
+                                   const std::vector<ARayArray*>& arrays) {
+  // Trace the running rays of arrays[i] in realisation i of ensemble, for all
+  // the realisations at once. The geometry is built only once. Each
+  // realisation is a copy of the surface table of flat navigation (see
+  // EnableFlatNavigation) in which the matrices of the misaligned nodes are
+  // multiplied by their misalignments. The nodes themselves are not moved,
+  // so the geometry can be shared with other tracing calls afterward.
+  //
+  // As in TraceBatch, the j-th running ray of every array gets the same
+  // random number stream, so that the scatter between realisations is that
+  // of the misalignments only when the arrays start from the same rays. All
+  // the components must be placed in the top volume, directly or through
+  // assemblies, without daughters, whether flat navigation is enabled or not.
+  if (Int_t(arrays.size()) != ensemble.GetN()) {
+    Error("TraceEnsemble",
+          "Numbers of realisations (%d) and arrays (%d) differ",
+          ensemble.GetN(), Int_t(arrays.size()));
+    return;
+  }
+  for (std::size_t i = 0; i < arrays.size(); i++) {
+    if (!arrays[i]) {
+      Error("TraceEnsemble", "Array %d is null", Int_t(i));
+      return;
+    }
+  }
+
+  CompileIfNeeded();
+  TGeoNode* nested = 0;
+  std::unique_ptr<FlatGeometry> base(MakeFlatGeometry(&nested));
+  if (!base) {
+    Error("TraceEnsemble", "%s has daughters", nested ? nested->GetName() : "");
+    return;
+  }
+
+  // surface index of each misaligned node
+  std::vector<Int_t> index(ensemble.GetNnodes(), -1);
+  for (Int_t k = 0; k < ensemble.GetNnodes(); k++) {
+    for (std::size_t j = 0; j < base->fSurfaces.size(); j++) {
+      if (base->fSurfaces[j].fNode == ensemble.GetNode(k)) index[k] = j;
+    }
+    if (index[k] < 0) {
+      Error("TraceEnsemble", "Node %d is not a component of the geometry", k);
+      return;
+    }
+  }
+
+  std::size_t njobs = arrays.size();
+  std::vector<FlatGeometry> geometries(njobs, *base);
+  for (std::size_t i = 0; i < njobs; i++) {
+    for (Int_t k = 0; k < ensemble.GetNnodes(); k++) {
+      FlatGeometry::Surface& surface = geometries[i].fSurfaces[index[k]];
+      TGeoHMatrix delta;
+      ensemble.GetMatrix(i, k, delta);
+      surface.fMatrix.Multiply(&delta);
+      TGeoBBox* box = (TGeoBBox*)surface.fShape;
+      surface.fMatrix.LocalToMaster(box->GetOrigin(), surface.fCenter);
     }
-    TraceNonSequential(objarray);
-    n = objarray->GetLast();
-    for (Int_t i = 0; i <= n; i++) {
-      ARay* ray = (ARay*)objarray->RemoveAt(i);
-      if (!ray) continue;
-      array.Add(ray);
+  }
+
+  // Move the running rays to compact arrays as TraceBatch does
+  std::vector<TObjArray> rays(njobs);
+  std::vector<std::vector<Char_t> > status(njobs);
+  std::vector<std::vector<Int_t> > order(njobs);
+  std::vector<Int_t> offset(1, 0);
+  for (std::size_t i = 0; i < njobs; i++) {
+    TObjArray* running = arrays[i]->GetRunning();
+    Int_t last = running->GetLast();
+    for (Int_t j = 0; j <= last; j++) {
+      ARay* ray = (ARay*)running->RemoveAt(j);
+      if (ray) rays[i].Add(ray);
+    }
+    running->Expand(0);
+    status[i].resize(rays[i].GetLast() + 1);
+    offset.push_back(offset.back() + rays[i].GetLast() + 1);
+    if (fCoherentOrdering) CoherentOrder(rays[i], order[i]);
+  }
+
+  ULong64_t key = NextRandomKey();
+  std::vector<TObjArray>* prays = &rays;
+  std::vector<std::vector<Char_t> >* pstatus = &status;
+  const std::vector<std::vector<Int_t> >* porder = &order;
+  const std::vector<Int_t>* poffset = &offset;
+  const std::vector<FlatGeometry>* pgeometries = &geometries;
+  TraceInChunks(offset.back(), [this, prays, pstatus, porder, poffset,
+                                pgeometries, key](Int_t first, Int_t last) {
+    // a chunk may span several realisations
+    const std::vector<Int_t>& off = *poffset;
+    std::size_t i =
+        std::upper_bound(off.begin(), off.end(), first) - off.begin() - 1;
+    for (; i + 1 < off.size() and off[i] <= last; i++) {
+      Int_t lo = TMath::Max(first, off[i]) - off[i];
+      Int_t hi = TMath::Min(last, off[i + 1] - 1) - off[i];
+      if (lo > hi) continue;
+      const std::vector<Int_t>& o = (*porder)[i];
+      TraceRange(&(*prays)[i], lo, hi, key, 0, (*pstatus)[i].data(),
+                 o.empty() ? 0 : o.data(), &(*pgeometries)[i]);
+    }
+  });
+
+  for (std::size_t i = 0; i < njobs; i++) arrays[i]->Add(rays[i], &status[i]);
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::TraceSequential(ARayArray& array,
+                                     const std::vector<TGeoNode*>& order,
+                                     Bool_t fallback) {
+  // Trace the running rays in array through the nodes in the given order,
+  // e.g. {primary, secondary, focal}. Only the next listed node is intersected
+  // at each step instead of searching the whole geometry, which is much
+  // faster for simple lens and mirror trains. Each node must be placed only
+  // once in the geometry, and the listed nodes must neither overlap nor
+  // contain one another. Rays which violate the order (i.e. miss the next
+  // listed node or are reflected at a lens entrance) are traced
+  // non-sequentially from there if fallback is kTRUE (default), or are
+  // suspended otherwise.
+  CompileIfNeeded();
+
+  SequentialTrain train;
+  train.fFallback = fallback;
+  TGeoNode* top = GetTopNode();
+  for (std::size_t i = 0; i < order.size(); i++) {
+    SequentialTrain::Surface surface;
+    surface.fNode = order[i];
+    surface.fMother = 0;
+    if (not AGeoUtil::FindGlobalMatrix(top, order[i], surface.fMatrix,
+                                       &surface.fMother)) {
+      Error("TraceSequential", "Node %s is not placed in the geometry",
+            order[i] ? order[i]->GetName() : "(null)");
+      return;
     }
-    delete objarray;
+    train.fSurfaces.push_back(surface);
   }
 
-  running->Expand(0);  // shrink the array
+  TraceRunning(std::vector<ARayArray*>(1, &array), &train);
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::TraceSuspended(ARayArray& array, Int_t nrounds,
+                                    Int_t keep) {
+  // Resume the suspended rays in array and trace them non-sequentially again.
+  // The ray histories are trimmed to the last keep points before each round,
+  // so the memory per ray stays bounded by the limit (see SetLimit) while
+  // long-lived rays are traced to completion. This is repeated until no ray
+  // is suspended, or up to nrounds times so that rays trapped forever (e.g. by
+  // total internal reflection in a lossless light guide) do not hang the
+  // program. If nrounds <= 0, no limit is applied.
+  for (Int_t i = 0; nrounds <= 0 or i < nrounds; i++) {
+    if (array.Resume(keep) == 0) break;
+    TraceNonSequential(array);
+  }
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::TraceNonSequential(APhotonBuffer& buffer) {
+  // History-free tracing. The same physics as TraceNonSequential(ARayArray&)
+  // is applied, but only the final position, direction and status of each
+  // photon are stored in the buffer.
+  CompileIfNeeded();
+
+  APhotonBuffer* pbuffer = &buffer;
+  std::vector<Int_t> order;
+  if (fCoherentOrdering) CoherentOrder(buffer, order);
+  const Int_t* porder = order.empty() ? 0 : order.data();
+  ULong64_t key = NextRandomKey();
+  TraceInChunks(buffer.GetN(), [this, pbuffer, porder, key](Int_t first,
+                                                            Int_t last) {
+    TGeoNavigator* nav = GetThreadNavigator();
+    FlatNavigator fnav(fFlatGeometry);
+    MaterialCache cache;
+    StartCache location;
+    ATraceStatistics local;
+    ATraceStatistics* stats = fStatistics ? &local : 0;
+    Bool_t packets = fFlatGeometry and fPacketSize > 0;
+    RayPacket packet;
+    for (Int_t k = first; k <= last; k++) {
+      if (packets and (k - first) % fPacketSize == 0) {
+        Int_t base = k;
+        packet.Load(TMath::Min(fPacketSize, last - k + 1),
+                    [pbuffer, porder, base](Int_t l, Double_t* x,
+                                            Double_t* d) {
+                      Int_t il = porder ? porder[base + l] : base + l;
+                      if (not pbuffer->IsRunning(il)) return kFALSE;
+                      x[0] = pbuffer->GetX(il);
+                      x[1] = pbuffer->GetY(il);
+                      x[2] = pbuffer->GetZ(il);
+                      d[0] = pbuffer->GetDx(il);
+                      d[1] = pbuffer->GetDy(il);
+                      d[2] = pbuffer->GetDz(il);
+                      return kTRUE;
+                    });
+        packet.Intersect(*fFlatGeometry, fPacketFloat);
+      }
+
+      Int_t i = porder ? porder[k] : k;
+      APhoton photon(pbuffer, i);
+      ACounterRandom rng(key, i);
+      ApplySurvivalBound(photon, cache, rng);
+      if (fFlatGeometry) {
+        if (packets) {
+          fnav.SetCandidates(packet.GetCandidates((k - first) % fPacketSize));
+        }
+        TraceRay(photon, &fnav, cache, location, rng, stats);
+      } else {
+        TraceRay(photon, nav, cache, location, rng, stats);
+      }
+      if (fWriter) fWriter->Fill(*pbuffer, i);
+    }
+    AFocalPlaneMonitor::FlushThreadBuffers();
+    ARayWriter::FlushThreadBuffers();
+    if (stats) MergeStatistics(local);
+  });
+}
+
+//_____________________________________________________________________________
+Int_t AOpticsManager::TracePackets(APhotonBuffer& buffer,
+                                   const std::vector<Double_t>& lambda,
+                                   std::vector<Double_t>& weight) {
+  // Trace each photon of buffer as a packet of the wavelengths lambda. In a
+  // system made of mirrors, focal surfaces and obscurations the path of a ray
+  // does not depend on the wavelength, so the geometry is traced only once
+  // per photon. The mirror reflectance (or the multilayer reflectance) and
+  // the QE are multiplied into the weights of the lanes instead of killing
+  // the photon at random. Only the position (not the wavelength) of the
+  // photons in buffer is used.
+  //
+  // On return, weight[i * lambda.size() + j] is the weight of the wavelength
+  // lambda[j] of photon i if the photon is focused, or 0 otherwise. The
+  // weights start from the weight of the photon, and buffer holds the common
+  // final state of the packets. AFocalPlaneMonitor is filled once per lane.
+  //
+  // A packet is split when its path reaches a lens, and its lanes are then
+  // traced one by one from the start. The photon in buffer is left stopped
+  // at the lens. Returns the number of the split packets, which should be 0
+  // for an achromatic system. Rays are not written to ARayWriter.
+  CompileIfNeeded();
+
+  Int_t n = buffer.GetN();
+  Int_t nlanes = Int_t(lambda.size());
+  weight.assign(std::size_t(n) * nlanes, 0.);
+  if (nlanes == 0) return 0;
+
+  APhotonBuffer* pbuffer = &buffer;
+  const Double_t* plambda = lambda.data();
+  Double_t* pweight = weight.data();
+  ULong64_t key = NextRandomKey();
+  std::atomic<Int_t> nsplit(0);
+  TraceInChunks(n, [this, pbuffer, plambda, pweight, nlanes, key, &nsplit](
+                       Int_t first, Int_t last) {
+    TGeoNavigator* nav = GetThreadNavigator();
+    FlatNavigator fnav(fFlatGeometry);
+    MaterialCache cache;
+    StartCache location;
+    ATraceStatistics local;
+    ATraceStatistics* stats = fStatistics ? &local : 0;
+    APhotonBuffer lanes;  // lanes of a split packet
+    for (Int_t i = first; i <= last; i++) {
+      Double_t* w = pweight + std::size_t(i) * nlanes;
+      Double_t w0 = pbuffer->GetWeight(i);
+      for (Int_t j = 0; j < nlanes; j++) w[j] = w0;
+      Double_t x[4] = {pbuffer->GetX(i), pbuffer->GetY(i), pbuffer->GetZ(i),
+                       pbuffer->GetT(i)};
+      Double_t d[3] = {pbuffer->GetDx(i), pbuffer->GetDy(i),
+                       pbuffer->GetDz(i)};
+
+      PhotonPacket packet(pbuffer, i, nlanes, plambda, w);
+      ACounterRandom rng(key, i);
+      if (fFlatGeometry) {
+        TraceRay(packet, &fnav, cache, location, rng, stats);
+      } else {
+        TraceRay(packet, nav, cache, location, rng, stats);
+      }
+
+      if (packet.IsChromatic()) {
+        ++nsplit;
+        lanes.Clear();
+        for (Int_t j = 0; j < nlanes; j++) {
+          lanes.Add(plambda[j], x[0], x[1], x[2], x[3], d[0], d[1], d[2]);
+          APhoton photon(&lanes, j);
+          photon.SetWeight(w0);
+          // streams of their own, different from those of the packets
+          ACounterRandom lrng(key, (ULong64_t(j + 1) << 32) | UInt_t(i));
+          if (fFlatGeometry) {
+            TraceRay(photon, &fnav, cache, location, lrng, stats);
+          } else {
+            TraceRay(photon, nav, cache, location, lrng, stats);
+          }
+          w[j] = lanes.GetStatus(j) == APhotonBuffer::kFocus
+                     ? lanes.GetWeight(j)
+                     : 0.;
+        }
+      } else if (pbuffer->GetStatus(i) != APhotonBuffer::kFocus) {
+        for (Int_t j = 0; j < nlanes; j++) w[j] = 0.;
+      }
+    }
+    AFocalPlaneMonitor::FlushThreadBuffers();
+    if (stats) MergeStatistics(local);
+  });
+
+  return nsplit;
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::TraceNonSequential(const ARayGenerator& generator,
+                                        ARaySink* sink) {
+  // Generate the rays of generator chunk by chunk in the tracing threads and
+  // trace them without building an ARayArray of all the rays. If sink is
+  // given, each ray is traced with its history and then handed to the sink;
+  // the calls are serialized, but the order of the rays is not preserved.
+  // Otherwise the rays are traced history-free as APhoton, and the results
+  // are available only through AFocalPlaneMonitor and ATraceStatistics.
+  // As there is no array to resume them from, the rays suspended by the
+  // limit (see SetLimit) are not handed to the sink but discarded with a
+  // warning giving their number.
+  CompileIfNeeded();
+
+  const ARayGenerator* gen = &generator;
+  ULong64_t key = NextRandomKey();
+  ULong64_t genkey = ACounterRandom::Hash(key);  // streams for generation
+  std::mutex mutex;
+  std::mutex* pmutex = &mutex;
+  Int_t nsuspended = 0;
+  Int_t* psuspended = &nsuspended;
+  TraceInChunks(generator.GetN(), [this, gen, sink, key, genkey, pmutex,
+                                   psuspended](Int_t first, Int_t last) {
+    TGeoNavigator* nav = GetThreadNavigator();
+    FlatNavigator fnav(fFlatGeometry);
+    MaterialCache cache;
+    StartCache location;
+    ATraceStatistics local;
+    ATraceStatistics* stats = fStatistics ? &local : 0;
+    Double_t lambda = gen->GetLambda();
+    Double_t x[3], d[3];
+    Int_t nlost = 0;
+
+    if (sink) {
+      std::vector<ARay*> rays;
+      rays.reserve(last - first + 1);
+      for (Int_t i = first; i <= last; i++) {
+        ACounterRandom grng(genkey, i);
+        gen->GetRay(i, grng, x, d);
+        ARay* ray = new ARay(i, lambda, x[0], x[1], x[2], 0, d[0], d[1], d[2]);
+        ACounterRandom rng(key, i);
+        BeginHistory(*ray);
+        ApplySurvivalBound(*ray, cache, rng);
+        if (fFlatGeometry) {
+          TraceRay(*ray, &fnav, cache, location, rng, stats);
+        } else {
+          TraceRay(*ray, nav, cache, location, rng, stats);
+        }
+        EndHistory(*ray);
+        if (fWriter) fWriter->Fill(*ray);
+        rays.push_back(ray);
+      }
+      {
+        std::lock_guard<std::mutex> lock(*pmutex);
+        for (std::size_t j = 0; j < rays.size(); j++) {
+          if (not rays[j]->IsRunning() and not rays[j]->IsSuspended()) {
+            sink->Fill(*rays[j]);
+          } else {
+            nlost++;
+          }
+        }
+      }
+      for (std::size_t j = 0; j < rays.size(); j++) delete rays[j];
+    } else {
+      APhotonBuffer buffer;
+      for (Int_t i = first; i <= last; i++) {
+        ACounterRandom grng(genkey, i);
+        gen->GetRay(i, grng, x, d);
+        buffer.Add(lambda, x[0], x[1], x[2], 0, d[0], d[1], d[2]);
+      }
+      for (Int_t i = first; i <= last; i++) {
+        APhoton photon(&buffer, i - first);
+        ACounterRandom rng(key, i);
+        ApplySurvivalBound(photon, cache, rng);
+        if (fFlatGeometry) {
+          TraceRay(photon, &fnav, cache, location, rng, stats);
+        } else {
+          TraceRay(photon, nav, cache, location, rng, stats);
+        }
+        if (fWriter) fWriter->Fill(buffer, i - first);
+        if (photon.IsRunning() or buffer.IsSuspended(i - first)) nlost++;
+      }
+    }
+
+    AFocalPlaneMonitor::FlushThreadBuffers();
+    ARayWriter::FlushThreadBuffers();
+    if (stats) MergeStatistics(local);
+    if (nlost > 0) {
+      std::lock_guard<std::mutex> lock(*pmutex);
+      *psuspended += nlost;
+    }
+  });
+
+  if (nsuspended > 0) {
+    Warning("TraceNonSequential",
+            "%d rays were suspended by the limit (%d) and discarded",
+            nsuspended, fLimit);
+  }
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::TraceInChunks(
+    Int_t n, const std::function<void(Int_t, Int_t)>& trace) {
+  // Call trace(first, last) for all the chunks of [0, n). In multithread mode,
+  // each task repeatedly takes the next fChunkSize rays by incrementing the
+  // shared counter, so that threads finishing short rays early keep
+  // themselves busy with the remaining ones instead of waiting for others.
+  if (n <= 0) return;
+
+  Int_t nthreads = GetMaxThreads();
+
+  if (IsMultiThread() and nthreads >= 2) {
+    AThreadPool* pool = GetWorkerPool(nthreads);
+    std::atomic<Int_t> next(0);
+    Int_t chunk = fChunkSize;
+    Int_t ntasks = TMath::Min(Int_t(pool->GetNthreads()), (n - 1) / chunk + 1);
+    for (Int_t i = 0; i < ntasks; i++) {
+      pool->Push([&trace, &next, chunk, n]() {
+        while (kTRUE) {
+          Int_t first = next.fetch_add(chunk);
+          if (first >= n) break;
+          trace(first, TMath::Min(first + chunk, n) - 1);
+        }
+      });
+    }
+    pool->Wait();
+  } else {  // single thread
+    trace(0, n - 1);
+  }
+}
+
+//_____________________________________________________________________________
+ULong64_t AOpticsManager::NextRandomKey() {
+  // Return the key of the random number streams used in the next tracing
+  // call. Each ray then gets its own stream numbered by its index in the call.
+  if (fRandomSeed == 0) {
+    // Follow gRandom when no seed is given
+    ULong64_t hi = gRandom->Integer(0xFFFFFFFFu);
+    ULong64_t lo = gRandom->Integer(0xFFFFFFFFu);
+    return (hi << 32) | lo;
+  }
+
+  return ACounterRandom::Hash(fRandomSeed ^ ACounterRandom::Hash(fNcalls++));
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::SetRandomSeed(ULong64_t seed, ULong64_t ncalls) {
+  // Give a fixed seed to the random number streams of the tracer. Every ray
+  // draws random numbers from its own counter-based stream, which is
+  // determined by the seed, the number of tracing calls since this method was
+  // called, and the index of the ray in the call. Results are thus
+  // reproducible and do not depend on the number of threads or the ray
+  // scheduling. If seed is 0 (default), the stream keys are taken from gRandom
+  // at each call. ncalls continues the streams after the given number of
+  // calls, e.g. GetNcalls saved in an ATraceCheckpoint.
+  fRandomSeed = seed;
+  fNcalls = ncalls;
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::EnableAttenuationWeighting(Bool_t enable) {
+  // Multiply the ray weight by the Beer-Lambert attenuation exp(-step/abs) in
+  // each lens segment, where abs is ALens::GetAbsorptionLength, instead of
+  // drawing an absorption point at random. Other processes (e.g. mirror
+  // reflectance) still kill rays at random unless EnableWeightedTracing(kTRUE)
+  // is also called. This saves a random number per segment and keeps the
+  // rays traced through thick, weakly absorbing glass, which would otherwise
+  // be lost one by one. Rays whose weight falls below the threshold of
+  // SetRussianRoulette are thinned out by Russian roulette.
+  fAttenuationWeighting = enable;
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::EnableCoherentOrdering(Bool_t enable) {
+  // Trace the rays of an ARayArray, a TObjArray or an APhotonBuffer in the
+  // order of their start points and directions instead of the order in which
+  // they were generated (e.g. CORSIKA bunch order). The rays are sorted by
+  // the Morton code of their positions projected onto the aperture plane
+  // before they are split into the chunks of the threads, so that
+  // consecutive rays hit the same facets and pixels and reuse the data in
+  // the CPU caches. The random number stream of a ray is still given by its
+  // original index, so the results do not change. Rays are handed to
+  // ARayWriter in the new order.
+  fCoherentOrdering = enable;
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::EnableCompactHistory(Bool_t enable) {
+  // Record the integer IDs of the nodes hit by each ray (see
+  // ARay::GetNodeIDHistory) instead of the node pointers in a TObjArray. The
+  // IDs are given to the node names when the geometry is compiled, and can be
+  // looked up by GetNodeID or GetNodeIDRangeStartWith. Queries such as
+  // ARay::HasNodeID then need only integer comparisons instead of string
+  // comparisons of node names.
+  fCompactHistory = enable;
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::EnableFlatNavigation(Bool_t enable) {
+  // Use FlatNavigator instead of TGeoNavigator in non-sequential tracing.
+  // This is faster for telescopes made of a moderate number of components
+  // all placed in the top volume (directly or through assemblies) without
+  // daughters, because the next boundary is found with a few bounding-sphere
+  // tests followed by distance calculations of the shapes, skipping the
+  // navigation state management. The physics, including reflectance and QE
+  // tables, is shared. If the geometry has nested volumes, a warning is shown
+  // and TGeoNavigator is used.
+  fFlatNavigation = enable;
+  if (IsClosed()) BuildFlatGeometry();
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::EnableInstrumentation(Bool_t enable) {
+  // Count the steps, crossings, reflections, refractions, absorptions and
+  // final statuses of rays for each node and node type, and measure the wall
+  // time spent in navigation and interactions. Each thread fills its own
+  // counters, which are added to the report returned by GetStatistics at the
+  // end of every chunk of rays. The report is accumulated over tracing calls
+  // until it is cleared by GetStatistics()->Clear(). Disabling it deletes the
+  // report. The overhead is negligible when disabled.
+  if (enable and !fStatistics) {
+    fStatistics = new ATraceStatistics;
+  } else if (not enable) {
+    SafeDelete(fStatistics);
+  }
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::EnableRayPackets(Int_t size, Bool_t single) {
+  // Test packets of size (4, 8 or 16) consecutive rays at once against the
+  // bounding spheres of all the facets, focal planes and obscurations in
+  // flat navigation (see EnableFlatNavigation), instead of one ray at a time.
+  // The test is written as branch-free loops over the lanes, which the
+  // compiler turns into SSE/AVX/AVX-512/NEON instructions. It is most
+  // effective for telescopes made of many mirror facets, and with coherent
+  // ordering (see EnableCoherentOrdering), where the rays of a packet are
+  // close to each other.
+  //
+  // Each ray then computes the exact distances of its first step only for
+  // the surfaces left for its lane, through the usual shapes in double
+  // precision, and continues alone after that step. The results are
+  // therefore identical to those without packets. If single is kTRUE, the
+  // packet test is done in single precision with a tolerance that keeps it
+  // conservative, so that twice as many lanes fit in a SIMD register.
+  // size = 0 disables the packets.
+  if (size != 0 and size != 4 and size != 8 and size != 16) {
+    Error("EnableRayPackets", "Packet size must be 0, 4, 8 or 16 (%d given)",
+          size);
+    return;
+  }
+  fPacketSize = size;
+  fPacketFloat = single;
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::EnableShapeProfiling(Bool_t enable, Bool_t customOnly) {
+  // Wrap the shapes of the volumes with AGeoShapeProfiler, which counts and
+  // times the navigation calls of each shape and the iterations of their
+  // solvers. Only ROBAST shapes (AGeoAsphericDisk, AGeoWinstonCone2D etc.)
+  // are profiled unless customOnly is kFALSE. The ranking of the shapes is
+  // printed by AGeoShapeProfiler::PrintReport(manager). Disabling it gives
+  // back the original shapes to the volumes.
+  if (enable) {
+    AGeoShapeProfiler::Attach(this, customOnly);
+  } else {
+    AGeoShapeProfiler::Detach(this);
+  }
+  if (IsClosed()) BuildFlatGeometry();
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::MergeStatistics(const ATraceStatistics& stats) {
+  std::lock_guard<std::mutex> lock(gStatisticsMutex);
+  if (fStatistics) fStatistics->Add(stats);
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::SetChunkSize(Int_t n) {
+  // Set the number of rays that a thread takes from the queue at once. Smaller
+  // chunks balance the load better when the numbers of interactions differ
+  // largely ray by ray, while larger chunks reduce the scheduling overhead.
+  if (n > 0) {
+    fChunkSize = n;
+  }
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::SetHistoryPolicy(Int_t policy, Int_t sampling) {
+  // Choose the points kept in the history of each ARay while it is traced
+  //   kHistoryFull      : all the points and nodes (default)
+  //   kHistoryNone      : only the last point and node, as in the history-free
+  //                       tracing of APhotonBuffer
+  //   kHistoryEndpoints : the first and the last points
+  //   kHistorySampled   : all the points of 1 in sampling rays (ray ID %
+  //                       sampling == 0), and the endpoints of the others
+  //   kHistorySelected  : all the points of the rays chosen by the selector
+  //                       of SetHistorySelector, and the endpoints of the
+  //                       others
+  // The dropped points are removed at each step, so the memory and the time
+  // spent on the history do not grow with the number of interactions, while
+  // the full tracks of a few rays are available for MakePolyLine3D. The node
+  // history is thinned together with the points; kHistorySelected keeps all
+  // of them until the selector has been called on the finished ray.
+  if (policy < kHistoryFull or policy > kHistorySelected) {
+    Error("SetHistoryPolicy", "Unknown policy: %d", policy);
+    return;
+  }
+  if (policy == kHistorySampled and sampling < 1) {
+    Error("SetHistoryPolicy", "The sampling must be positive: %d", sampling);
+    return;
+  }
+  fHistoryPolicy = policy;
+  fHistorySampling = sampling;
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::SetHistorySelector(
+    std::function<Bool_t(const ARay&)> selector) {
+  // Keep all the points of the rays for which selector returns kTRUE after
+  // they have been traced, e.g., the rays which hit a given node.
+  //
+  //   Int_t id = manager->GetNodeID("mirror_1");  // with compact history
+  //   manager->SetHistorySelector(
+  //       [id](const ARay& ray) { return ray.HasNodeID(id); });
+  //
+  // The selector is called from the tracing threads and must be thread safe.
+  // This also sets the policy to kHistorySelected.
+  fHistorySelector = selector;
+  fHistoryPolicy = kHistorySelected;
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::SetRussianRoulette(Double_t threshold, Double_t survival) {
+  // Set the parameters of Russian roulette used in weighted tracing. When
+  // weighted tracing is enabled by EnableWeightedTracing(kTRUE), mirror
+  // reflectance, absorption in multilayers and lenses, and the quantum
+  // efficiency of focal surfaces multiply the ray weight (see ARay::GetWeight)
+  // instead of killing rays at random. A ray whose weight falls below
+  // threshold (0.1 by default) then survives with the probability survival
+  // (0.5 by default) and its weight is divided by survival, or is absorbed
+  // otherwise. Fresnel reflection is still chosen at random as both of the
+  // reflected and transmitted rays survive. The same roulette is played when
+  // only the lens absorption is weighted by EnableAttenuationWeighting(kTRUE).
+  if (threshold < 0 or survival <= 0 or survival > 1) {
+    Error("SetRussianRoulette", "Invalid parameters: %g, %g", threshold,
+          survival);
+    return;
+  }
+  fRouletteThreshold = threshold;
+  fRouletteSurvival = survival;
+}
+
+//_____________________________________________________________________________
+Double_t AOpticsManager::GetSurvivalBound(Double_t lambda) const {
+  // Probability that a ray of lambda is traced at all (see SetSurvivalBound)
+  return TMath::Power(EvalBound(fMirrorBound.get(), lambda), fNmirrorBounds) *
+         EvalBound(fFocalBound.get(), lambda) *
+         EvalBound(fTransmission.get(), lambda);
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::SetSurvivalBound(const TGraph* mirror, Int_t nmirrors,
+                                      const TGraph* focal,
+                                      const TGraph* transmission) {
+  // Drop rays before tracing by the wavelength-only part of their survival
+  // probability. Cherenkov photons of CORSIKA are mostly killed by the mirror
+  // reflectance and the QE, e.g., two thirds of them at a camera with a peak
+  // QE of ~30%, after being traced through the whole optics. Given upper
+  // bounds of the reflectance of the mirrors (mirror) and of the QE of the
+  // focal surfaces (focal), both as functions of wavelength, a ray that has
+  // not been traced yet survives only with the probability
+  //
+  //   B = mirror(lambda)^nmirrors * focal(lambda) * transmission(lambda)
+  //
+  // and is absorbed otherwise. The first nmirrors mirror reflections of a
+  // surviving ray then reflect it with the probability R / mirror(lambda),
+  // and its focusing is accepted with the probability QE / focal(lambda),
+  // instead of R and QE. transmission is an optional survival probability
+  // applied before the optics only (e.g. the atmospheric transmission or a
+  // filter not modelled in the geometry). The focused rays are thus the same
+  // in distribution as without the bounds, while far fewer rays are traced.
+  //
+  //   // a Davies-Cotton telescope with its mirror and QE curves
+  //   manager->SetSurvivalBound(reflectance, 1, qe);
+  //   ARayArray* array = file.GetRayArray(0, 0, z, n);
+  //   manager->TraceNonSequential(*array);
+  //
+  // This is unbiased only if the bounds are not below the actual reflectance
+  // and QE at any angle, and if every focused ray is reflected by mirrors at
+  // least nmirrors times (e.g. nmirrors = 2 for a Schwarzschild-Couder
+  // telescope, and 0 if some rays can reach the camera directly). Rays
+  // stopped by other causes are fewer than without the bounds, so only the
+  // focused rays should be counted. The bounds are not applied in weighted
+  // tracing or by TracePackets. A ray suspended by the limit (see SetLimit)
+  // keeps its remaining bounds and continues with them when resumed by
+  // TraceSuspended.
+  // Null graphs are taken as 1, and SetSurvivalBound(0, 0, 0) disables the
+  // bounds. The graphs are copied.
+  if (nmirrors < 0) {
+    Error("SetSurvivalBound", "Invalid number of mirrors: %d", nmirrors);
+    return;
+  }
+
+  fMirrorBound.reset(mirror ? new TGraph(*mirror) : 0);
+  fNmirrorBounds = mirror ? nmirrors : 0;
+  fFocalBound.reset(focal ? new TGraph(*focal) : 0);
+  fTransmission.reset(transmission ? new TGraph(*transmission) : 0);
 }
 
 //_____________________________________________________________________________
@@ -592,3 +2822,126 @@ void AOpticsManager::SetLimit(Int_t n) {
     fLimit = n;
   }
 }
+
+//_____________________________________________________________________________
+void AOpticsManager::SetNodeMatrix(TGeoNode* node, const TGeoMatrix& matrix) {
+  // Move a node placed in the closed geometry, e.g. to tilt a mirror facet or
+  // to shift a lens during an optimization. A copy of matrix replaces the
+  // matrix of the node, which may be shared with other nodes and is left
+  // intact. Only the voxels of the mother volume (and of the volumes above
+  // it if it is an assembly) are rebuilt, so that tracing can be resumed
+  // without closing the geometry again.
+  TGeoNodeMatrix* placed = dynamic_cast<TGeoNodeMatrix*>(node);
+  if (!placed) {
+    Error("SetNodeMatrix", "%s is not a node placed with a matrix",
+          node ? node->GetName() : "(null)");
+    return;
+  }
+
+  TGeoHMatrix* copy = new TGeoHMatrix(matrix);
+  copy->RegisterYourself();  // deleted by TGeoManager
+  placed->SetMatrix(copy);
+
+  TGeoVolume* mother = node->GetMotherVolume();
+  if (mother) VoxelizeMothers(mother);
+  BuildFlatGeometry();
+}
+
+//_____________________________________________________________________________
+AOpticsManager* AOpticsManager::LoadSnapshot(const char* fname) {
+  // Load a geometry saved by SaveSnapshot. The voxels, the baked tables and
+  // the precomputed multilayer coatings are read from the file, so that
+  // worker processes can start tracing without closing the geometry and
+  // baking the tables again. The returned manager becomes gGeoManager.
+  TGeoManager* manager = TGeoManager::Import(fname);
+  AOpticsManager* optics = dynamic_cast<AOpticsManager*>(manager);
+  if (!optics) {
+    ::Error("AOpticsManager::LoadSnapshot", "No AOpticsManager found in %s",
+            fname);
+    return 0;
+  }
+
+  optics->Compile();
+
+  return optics;
+}
+
+//_____________________________________________________________________________
+Bool_t AOpticsManager::SaveSnapshot(const char* fname) {
+  // Save the closed geometry together with its voxels, optical properties,
+  // baked lookup tables and border surface conditions into a ROOT file.
+  // Bake the tables (e.g. ARefractiveIndex::BakeTable,
+  // AMirror::BakeReflectance and AMultilayer::PrecomputeTables) before
+  // saving, so that LoadSnapshot need not bake them again. Data shared among
+  // components (refractive indices, coatings) is written only once.
+  if (!IsClosed()) {
+    Error("SaveSnapshot", "The geometry must be closed first");
+    return kFALSE;
+  }
+
+  return Export(fname, GetName(), "v") != 0;
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::UpdateShape(TGeoShape* shape) {
+  // Apply new parameters of a shape in the closed geometry, e.g. after
+  // AGeoAsphericDisk::SetAsphDimensions or AGeoSegmentedMirror::SetFacet.
+  // The bounding box of the shape is recomputed, and only the voxels of the
+  // volumes which contain the shape, or are made of it, are rebuilt (and of
+  // the volumes above them through assemblies).
+  if (!shape) return;
+  CompileIfNeeded();
+  shape->ComputeBBox();
+
+  TObjArray* volumes = GetListOfVolumes();
+  Int_t n = volumes ? volumes->GetEntriesFast() : 0;
+  for (Int_t i = 0; i < n; i++) {
+    // profilers wrapping the shape must copy its new bounding box
+    TGeoVolume* volume = (TGeoVolume*)volumes->UncheckedAt(i);
+    AGeoShapeProfiler* profiler =
+        volume ? AGeoShapeProfiler::GetProfiler(volume->GetShape()) : 0;
+    if (profiler and profiler->GetShape() == shape) profiler->ComputeBBox();
+  }
+
+  for (Int_t i = 0; i < n; i++) {
+    TGeoVolume* volume = (TGeoVolume*)volumes->UncheckedAt(i);
+    if (!volume or volume->GetNdaughters() == 0) continue;
+
+    Bool_t affected = AGeoShapeProfiler::Unwrap(volume->GetShape()) == shape;
+    for (Int_t j = 0; not affected and j < volume->GetNdaughters(); j++) {
+      TGeoShape* daughter = volume->GetNode(j)->GetVolume()->GetShape();
+      affected = AGeoShapeProfiler::Unwrap(daughter) == shape;
+    }
+    if (affected) VoxelizeMothers(volume);
+  }
+
+  BuildFlatGeometry();
+}
+
+//_____________________________________________________________________________
+void AOpticsManager::VoxelizeMothers(TGeoVolume* volume) {
+  // Rebuild the voxels of volume after one of its daughters has changed. The
+  // bounding box of an assembly (e.g. made by AGeoUtil::MakeAssemblies)
+  // follows its daughters, so it is recomputed and the volumes in which the
+  // assembly is placed are rebuilt too, up to the first real volumes.
+  if (volume->IsAssembly()) {
+    TGeoShapeAssembly* shape = (TGeoShapeAssembly*)volume->GetShape();
+    shape->NeedsBBoxRecompute();  // ComputeBBox does nothing otherwise
+    shape->ComputeBBox();
+  }
+  volume->Voxelize("");
+  if (not volume->IsAssembly()) return;
+
+  TObjArray* volumes = GetListOfVolumes();
+  Int_t n = volumes ? volumes->GetEntriesFast() : 0;
+  for (Int_t i = 0; i < n; i++) {
+    TGeoVolume* mother = (TGeoVolume*)volumes->UncheckedAt(i);
+    if (!mother) continue;
+    for (Int_t j = 0; j < mother->GetNdaughters(); j++) {
+      if (mother->GetNode(j)->GetVolume() == volume) {
+        VoxelizeMothers(mother);
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,142 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// APhotonBuffer
+//
+// Struct-of-arrays photon buffer for history-free tracing. Only the final
+// position, direction, time, wavelength and status of each photon are kept,
+// so that a large number of photons can be traced by
+// AOpticsManager::TraceNonSequential(APhotonBuffer&) without allocating an
+// ARay (TGeoTrack) and its point and node histories per photon.
+//
+// The photons are stored column by column, and each column is available as
+// a contiguous array. Python users can wrap them as NumPy arrays without any
+// per-photon call, also for the results of ARay tracing after copying the
+// final states with AddResults:
+//
+//   buffer = ROOT.APhotonBuffer()
+//   buffer.AddResults(rays.GetFocused())
+//   n = buffer.GetN()
+//   x = numpy.frombuffer(buffer.GetXArray(), dtype=numpy.float64, count=n)
+//   status = numpy.frombuffer(buffer.GetStatusArray(), dtype=numpy.int32,
+//                             count=n)
+//
+// The NumPy arrays share the memory of the buffer, which must be kept alive
+// and must not be modified while they are in use.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TObjArray.h"
+
+#include "AMemoryUtil.h"
+#include "APhotonBuffer.h"
+#include "ARay.h"
+
+ClassImp(APhotonBuffer);
+
+//_____________________________________________________________________________
+APhotonBuffer::APhotonBuffer() : TObject() {}
+
+//_____________________________________________________________________________
+APhotonBuffer::~APhotonBuffer() {}
+
+//_____________________________________________________________________________
+void APhotonBuffer::Add(Double_t lambda, Double_t x, Double_t y, Double_t z,
+                        Double_t t, Double_t dx, Double_t dy, Double_t dz) {
+  Double_t mag = TMath::Sqrt(dx * dx + dy * dy + dz * dz);
+  if (mag > 0) {
+    dx /= mag;
+    dy /= mag;
+    dz /= mag;
+  }
+
+  fX.push_back(x);
+  fY.push_back(y);
+  fZ.push_back(z);
+  fT.push_back(t);
+  fDx.push_back(dx);
+  fDy.push_back(dy);
+  fDz.push_back(dz);
+  fLambda.push_back(lambda);
+  fStatus.push_back(kRun);
+  fNpoints.push_back(1);
+  fWeight.push_back(1);
+}
+
+//_____________________________________________________________________________
+void APhotonBuffer::Add(const ARay& ray) {
+  // Copy the latest point, direction and weight of a running ray
+  Double_t x[4], d[3];
+  ray.GetLastPoint(x);
+  ray.GetDirection(d);
+  Add(ray.GetLambda(), x[0], x[1], x[2], x[3], d[0], d[1], d[2]);
+  fWeight.back() = ray.GetWeight();
+}
+
+//_____________________________________________________________________________
+Int_t APhotonBuffer::AddResults(const TObjArray& rays) {
+  // Copy the final states of traced rays, e.g. ARayArray::GetFocused(),
+  // including their statuses and numbers of points. Return the number of
+  // rays copied.
+  Int_t last = rays.GetLast();
+  Reserve(GetN() + last + 1);
+
+  Int_t n = 0;
+  for (Int_t i = 0; i <= last; i++) {
+    const ARay* ray = (const ARay*)rays.UncheckedAt(i);
+    if (!ray) continue;
+    Add(*ray);
+    fStatus.back() = ray->GetStatus();
+    fNpoints.back() = ray->GetNpoints();
+    n++;
+  }
+
+  return n;
+}
+
+//_____________________________________________________________________________
+void APhotonBuffer::Clear(Option_t*) {
+  fX.clear();
+  fY.clear();
+  fZ.clear();
+  fT.clear();
+  fDx.clear();
+  fDy.clear();
+  fDz.clear();
+  fLambda.clear();
+  fStatus.clear();
+  fNpoints.clear();
+  fWeight.clear();
+}
+
+//_____________________________________________________________________________
+ULong64_t APhotonBuffer::GetMemoryUsage() const {
+  // Bytes of this buffer including the reserved capacities of the columns
+  return sizeof(*this) + AMemoryUtil::Capacity(fX) +
+         AMemoryUtil::Capacity(fY) + AMemoryUtil::Capacity(fZ) +
+         AMemoryUtil::Capacity(fT) + AMemoryUtil::Capacity(fDx) +
+         AMemoryUtil::Capacity(fDy) + AMemoryUtil::Capacity(fDz) +
+         AMemoryUtil::Capacity(fLambda) + AMemoryUtil::Capacity(fStatus) +
+         AMemoryUtil::Capacity(fNpoints) + AMemoryUtil::Capacity(fWeight);
+}
+
+//_____________________________________________________________________________
+void APhotonBuffer::Reserve(Int_t n) {
+  if (n <= 0) return;
+
+  fX.reserve(n);
+  fY.reserve(n);
+  fZ.reserve(n);
+  fT.reserve(n);
+  fDx.reserve(n);
+  fDy.reserve(n);
+  fDz.reserve(n);
+  fLambda.reserve(n);
+  fStatus.reserve(n);
+  fNpoints.reserve(n);
+  fWeight.reserve(n);
+}
@@ -11,32 +11,103 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <atomic>
+#include <cstring>
+
 #include "ARay.h"
 #include "AOpticsManager.h"
 #include "TMath.h"
 
 ClassImp(ARay);
 
+namespace {
+
+std::atomic<ULong64_t> gLiveMemory(0);  // see ARay::GetLiveMemory
+
+}  // namespace
+
 ARay::ARay() {
   // Default constructor
   fLambda = 0;
   fDirection = TVector3(1, 0, 0);
   fStatus = kRun;
+  fWeight = 1;
+  fHistoryMode = kFullHistory;
+  fNdropped = 0;
+  fAccounted = 0;
+  fBoundsDrawn = kFALSE;
+  fMirrorBound = 1;
+  fNmirrorBounds = 0;
+  fFocalBound = 1;
+  Account();
 }
 
 //_____________________________________________________________________________
 ARay::ARay(Int_t id, Double_t lambda, Double_t x, Double_t y, Double_t z,
            Double_t t, Double_t nx, Double_t ny, Double_t nz)
-    : TGeoTrack(id, 22 /*photon*/, 0, 0) {
+    : TGeoTrack(id, 22 /*photon*/, 0, 0), fAccounted(0) {
   // Constructor
   AddPoint(x, y, z, t);
   fLambda = lambda;
   SetDirection(nx, ny, nz);
   fStatus = kRun;
+  fWeight = 1;
+  fHistoryMode = kFullHistory;
+  fNdropped = 0;
+  fBoundsDrawn = kFALSE;
+  fMirrorBound = 1;
+  fNmirrorBounds = 0;
+  fFocalBound = 1;
+  Account();  // the node array allocated before the first point
+}
+
+//_____________________________________________________________________________
+ARay::~ARay() { gLiveMemory -= fAccounted; }
+
+//_____________________________________________________________________________
+void ARay::Account() {
+  // Add the change of GetMemoryUsage to the live memory counter. This is
+  // called only when a buffer of the history grows.
+  ULong64_t bytes = GetMemoryUsage();
+  gLiveMemory += bytes - fAccounted;  // modulo 2^64 if it shrinks
+  fAccounted = bytes;
+}
+
+//_____________________________________________________________________________
+TVirtualGeoTrack* ARay::AddPoint(Double_t x, Double_t y, Double_t z,
+                                 Double_t t) {
+  Int_t size = fPointsSize;
+  TVirtualGeoTrack* track = TGeoTrack::AddPoint(x, y, z, t);
+  if (fPointsSize != size) Account();
+
+  return track;
+}
+
+//_____________________________________________________________________________
+Int_t ARay::FindNodeID(Int_t id) const {
+  // Return the index of the first occurrence of a node ID in the compact
+  // history (see AOpticsManager::EnableCompactHistory), or -1 if not found
+  for (std::size_t i = 0; i < fNodeIDHistory.size(); i++) {
+    if (fNodeIDHistory[i] == id) return i;
+  }
+
+  return -1;
 }
 
 //_____________________________________________________________________________
-ARay::~ARay() {}
+Int_t ARay::FindNodeIDInRange(Int_t first, Int_t last) const {
+  // Return the index of the first node ID within [first, last] in the compact
+  // history, or -1 if not found. Node IDs are sorted by node names, so the
+  // nodes starting with a given name share a range (see
+  // AOpticsManager::GetNodeIDRangeStartWith). This replaces
+  // FindNodeNumberStartWith with integer comparisons.
+  for (std::size_t i = 0; i < fNodeIDHistory.size(); i++) {
+    Int_t id = fNodeIDHistory[i];
+    if (first <= id and id <= last) return i;
+  }
+
+  return -1;
+}
 
 //_____________________________________________________________________________
 TGeoNode* ARay::FindNodeStartWith(const char* name) const {
@@ -125,11 +196,12 @@ Bool_t ARay::IsSuspended() const {
 }
 
 //_____________________________________________________________________________
-#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 7, 7)
-TColor* ARay::MakeColor() const {
+void ARay::GetSpectralColor(Double_t lambda, Float_t& r, Float_t& g,
+                            Float_t& b) {
+  // Give the RGB (0-1) of the visible color of lambda
   // The origianl code in FORTRAN was written by Dan Bruton
   // See http://www.physics.sfasu.edu/astro/color/spectra.html
-  Double_t wl = fLambda / AOpticsManager::nm();
+  Double_t wl = lambda / AOpticsManager::nm();
   Double_t R, G, B;
 
   if (300. <= wl && wl < 380.) {
@@ -188,8 +260,19 @@ TColor* ARay::MakeColor() const {
   G = G > 0. ? TMath::Power(G * sss, gamma) : 0.;
   B = B > 0. ? TMath::Power(B * sss, gamma) : 0.;
 
+  r = R;
+  g = G;
+  b = B;
+}
+
+//_____________________________________________________________________________
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 7, 7)
+TColor* ARay::MakeColor() const {
+  // Make a new color of the wavelength (see GetSpectralColor)
+  Float_t r, g, b;
+  GetSpectralColor(fLambda, r, g, b);
   Int_t ci = TColor::GetFreeColorIndex();
-  return new TColor(ci, R, G, B);
+  return new TColor(ci, r, g, b);
 }
 #endif
 
@@ -221,3 +304,100 @@ void ARay::SetDirection(Double_t dx, Double_t dy, Double_t dz) {
     fDirection.SetXYZ(dx / mag, dy / mag, dz / mag);
   }
 }
+
+//_____________________________________________________________________________
+Bool_t ARay::GetPendingBounds(Double_t& mirror, Int_t& nmirrors,
+                              Double_t& focal) const {
+  // Give the parts of the survival bound of AOpticsManager::SetSurvivalBound
+  // which have not been divided out yet. Returns kFALSE if the ray has not
+  // been traced with the bound.
+  mirror = fMirrorBound;
+  nmirrors = fNmirrorBounds;
+  focal = fFocalBound;
+  return fBoundsDrawn;
+}
+
+//_____________________________________________________________________________
+void ARay::SetPendingBounds(Double_t mirror, Int_t nmirrors, Double_t focal) {
+  // Keep the remaining parts of the survival bound while the ray is
+  // suspended, so that it is not dropped again when resumed
+  fBoundsDrawn = kTRUE;
+  fMirrorBound = mirror;
+  fNmirrorBounds = nmirrors;
+  fFocalBound = focal;
+}
+
+//_____________________________________________________________________________
+ULong64_t ARay::GetLiveMemory() {
+  // Return the bytes used by all the ARay objects alive, including their
+  // points and node histories. This is updated while rays are being traced,
+  // so that the threads creating rays can throttle the batch sizes before the
+  // memory runs out. Rays read from files are counted without the points.
+  return gLiveMemory.load(std::memory_order_relaxed);
+}
+
+//_____________________________________________________________________________
+ULong64_t ARay::GetNodeHistoryMemory() const {
+  // Return the bytes allocated for the node history and the compact history
+  return fNodeHisotry.GetSize() * sizeof(TObject*) +
+         fNodeIDHistory.capacity() * sizeof(Int_t);
+}
+
+//_____________________________________________________________________________
+void ARay::RemovePoints(Int_t first, Int_t n) {
+  // Remove n points from the first-th point, and the nodes on which they were
+  // made. The i-th node was added together with the (i + 1)-th point.
+  if (n <= 0) return;
+
+  Int_t npoints = GetNpoints();
+  memmove(fPoints + 4 * first, fPoints + 4 * (first + n),
+          4 * (npoints - first - n) * sizeof(Double_t));
+  fNpoints -= 4 * n;
+
+  Int_t firstNode = TMath::Max(first, 1) - 1;
+  Int_t lastNode = first + n - 1;  // not removed
+  Int_t end = TMath::Min(lastNode, fNodeHisotry.GetEntriesFast());
+  for (Int_t i = firstNode; i < end; i++) {
+    fNodeHisotry.RemoveAt(i);
+  }
+  fNodeHisotry.Compress();
+
+  end = TMath::Min(lastNode, Int_t(fNodeIDHistory.size()));
+  if (end > firstNode) {
+    fNodeIDHistory.erase(fNodeIDHistory.begin() + firstNode,
+                         fNodeIDHistory.begin() + end);
+  }
+}
+
+//_____________________________________________________________________________
+void ARay::ThinHistory() {
+  // Drop the points not kept by the history mode. kEndpointHistory keeps the
+  // first and the last points, and kLastPointHistory keeps only the last
+  // point. This is called by AOpticsManager at each step of tracing, so that
+  // the memory of rays does not grow with the number of interactions.
+  Int_t n = GetNpoints();
+  Int_t nremove = 0;
+  if (fHistoryMode == kEndpointHistory and n > 2) {
+    nremove = n - 2;
+    RemovePoints(1, nremove);
+  } else if (fHistoryMode == kLastPointHistory and n > 1) {
+    nremove = n - 1;
+    RemovePoints(0, nremove);
+  }
+  fNdropped += nremove;
+}
+
+//_____________________________________________________________________________
+void ARay::TrimHistory(Int_t keep) {
+  // Remove the old points from the history and leave only the last keep
+  // points (1 by default), so that the ray can be traced further without
+  // growing its memory. The nodes on which the removed points were made are
+  // also removed from the node history.
+  if (keep < 1) keep = 1;
+
+  fNdropped = 0;  // the limit of steps starts again
+  Int_t n = GetNpoints();
+  if (n <= keep) return;
+
+  RemovePoints(0, n - keep);
+}
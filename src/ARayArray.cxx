@@ -12,11 +12,13 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "ARayArray.h"
+#include "ARayPool.h"
+#include "ARaySink.h"
 
 ClassImp(ARayArray);
 
 //_____________________________________________________________________________
-ARayArray::ARayArray() : TObject() {
+ARayArray::ARayArray() : TObject(), fSink(0), fPool(0) {
   // Constructor
   fAbsorbed.SetOwner(kTRUE);
   fExited.SetOwner(kTRUE);
@@ -29,45 +31,235 @@ ARayArray::ARayArray() : TObject() {
 //_____________________________________________________________________________
 ARayArray::~ARayArray() {
   // Destructor
-  fAbsorbed.Clear();
-  fExited.Clear();
-  fFocused.Clear();
-  fRunning.Clear();
-  fStopped.Clear();
-  fSuspended.Clear();
+  Clear();
+  delete fPool;
 }
 
 //_____________________________________________________________________________
 void ARayArray::Add(ARay* ray) {
+  // Add a ray to the array of its status. If a sink is set, the ray is handed
+  // to the sink and deleted instead when it is neither running nor suspended.
   if (!ray) return;
 
-  if (ray->IsAbsorbed())
-    fAbsorbed.Add(ray);
-  else if (ray->IsExited())
-    fExited.Add(ray);
-  else if (ray->IsFocused())
-    fFocused.Add(ray);
-  else if (ray->IsRunning())
-    fRunning.Add(ray);
-  else if (ray->IsStopped())
-    fStopped.Add(ray);
-  else if (ray->IsSuspended())
-    fSuspended.Add(ray);
+  if (fSink and not ray->IsRunning() and not ray->IsSuspended()) {
+    fSink->Fill(*ray);
+    DeleteRay(ray);
+    return;
+  }
+
+  TObjArray* array = GetArray(ray->GetStatus());
+  if (array) array->Add(ray);
 }
 
 //_____________________________________________________________________________
-void ARayArray::Merge(ARayArray* array) {
-  if (!array) return;
+void ARayArray::Add(const TObjArray& rays, const std::vector<Char_t>* status) {
+  // Add all the rays in rays. Each array of a status is expanded only once,
+  // and then the rays are appended without further reallocation. If status is
+  // given, status->at(i) is used as the status of the i-th ray so that the
+  // rays need not be dereferenced twice (see AOpticsManager::TraceRunning).
+  Int_t n = rays.GetLast() + 1;
+
+  if (fSink) {
+    for (Int_t i = 0; i < n; i++) Add((ARay*)rays.UncheckedAt(i));
+    return;
+  }
+
+  Int_t count[ARay::kNstatus] = {0};
+  for (Int_t i = 0; i < n; i++) {
+    ARay* ray = (ARay*)rays.UncheckedAt(i);
+    if (!ray) continue;
+    Int_t s = status ? (*status)[i] : ray->GetStatus();
+    if (0 <= s and s < ARay::kNstatus) count[s]++;
+  }
+
+  for (Int_t s = 0; s < ARay::kNstatus; s++) {
+    TObjArray* array = GetArray(s);
+    if (!array or count[s] == 0) continue;
+    Int_t size = array->GetLast() + 1 + count[s];
+    if (size > array->GetSize()) array->Expand(size);
+  }
+
+  for (Int_t i = 0; i < n; i++) {
+    ARay* ray = (ARay*)rays.UncheckedAt(i);
+    if (!ray) continue;
+    TObjArray* array = GetArray(status ? (*status)[i] : ray->GetStatus());
+    if (array) array->AddLast(ray);
+  }
+}
+
+//_____________________________________________________________________________
+void ARayArray::Append(TObjArray& array, TObjArray& rays) {
+  // Move all the rays in rays to the end of array with one reallocation
+  Int_t n = rays.GetLast() + 1;
+  if (n == 0) return;
+
+  Int_t size = array.GetLast() + 1 + n;
+  if (size > array.GetSize()) array.Expand(size);
+  for (Int_t i = 0; i < n; i++) {
+    TObject* ray = rays.UncheckedAt(i);
+    if (ray) array.AddLast(ray);
+  }
+
+  Bool_t owner = rays.IsOwner();
+  rays.SetOwner(kFALSE);
+  rays.Clear();
+  rays.SetOwner(owner);
+}
+
+//_____________________________________________________________________________
+void ARayArray::Clear(Option_t*) {
+  // Delete all the rays. The blocks of the pool are kept to be reused by the
+  // next rays, so a whole event is released in one call without returning
+  // memory to the system.
+  ClearArray(fAbsorbed);
+  ClearArray(fExited);
+  ClearArray(fFocused);
+  ClearArray(fRunning);
+  ClearArray(fStopped);
+  ClearArray(fSuspended);
+  if (fPool) fPool->Reset();
+}
+
+//_____________________________________________________________________________
+void ARayArray::ClearArray(TObjArray& array) {
+  if (fPool) {
+    for (Int_t i = 0; i <= array.GetLast(); i++) {
+      DeleteRay((ARay*)array.UncheckedAt(i));
+    }
+  }
+  array.Clear();  // deletes the rays if not pooled
+}
+
+//_____________________________________________________________________________
+void ARayArray::DeleteRay(ARay* ray) {
+  if (!ray) return;
 
-  TObjArray* objs[6] = {array->GetAbsorbed(), array->GetExited(),
-                        array->GetFocused(),  array->GetRunning(),
-                        array->GetStopped(),  array->GetSuspended()};
+  if (fPool and fPool->Owns(ray)) {
+    ray->~ARay();
+  } else {
+    delete ray;
+  }
+}
 
-  for (Int_t j = 0; j < 6; j++) {
-    for (Int_t i = 0; i <= objs[j]->GetLast(); i++) {
-      ARay* ray = (ARay*)objs[j]->RemoveAt(i);
+//_____________________________________________________________________________
+TObjArray* ARayArray::GetArray(Int_t status) {
+  // Return the array of rays of a status (ARay::kFocus etc.)
+  switch (status) {
+    case ARay::kAbsorb:
+      return GetAbsorbed();
+    case ARay::kExit:
+      return GetExited();
+    case ARay::kFocus:
+      return GetFocused();
+    case ARay::kRun:
+      return GetRunning();
+    case ARay::kStop:
+      return GetStopped();
+    case ARay::kSuspend:
+      return GetSuspended();
+    default:
+      return 0;
+  }
+}
+
+//_____________________________________________________________________________
+ULong64_t ARayArray::GetMemoryUsage(ULong64_t* points, ULong64_t* nodes,
+                                    ULong64_t* objects) const {
+  // Return the bytes used by the array and its rays. The breakdown into the
+  // TGeoTrack points, the node histories and the objects themselves (ARay,
+  // the pool blocks and the arrays of pointers) is returned if requested.
+  const TObjArray* arrays[] = {&fAbsorbed, &fExited,  &fFocused,
+                               &fRunning,  &fStopped, &fSuspended};
+  ULong64_t p = 0, n = 0, o = sizeof(*this);
+  for (Int_t i = 0; i < 6; i++) {
+    o += arrays[i]->GetSize() * sizeof(TObject*);
+    for (Int_t j = 0; j <= arrays[i]->GetLast(); j++) {
+      const ARay* ray = (const ARay*)arrays[i]->UncheckedAt(j);
       if (!ray) continue;
-      Add(ray);
+      p += ray->GetPointsMemory();
+      n += ray->GetNodeHistoryMemory();
+      if (!fPool) o += sizeof(ARay);
     }
   }
+  if (fPool) o += fPool->GetMemoryUsage();
+
+  if (points) *points = p;
+  if (nodes) *nodes = n;
+  if (objects) *objects = o;
+
+  return p + n + o;
+}
+
+//_____________________________________________________________________________
+void ARayArray::EnablePool(Int_t blockSize) {
+  // Allocate the rays created by NewRay in blocks of blockSize rays. This
+  // must be called while the array is empty. Pooled rays are owned by the
+  // array and must not be deleted by the user, nor be removed from the array
+  // to outlive it. The arrays of rays (GetFocused etc.) are no longer owners
+  // of the rays because they cannot delete pooled rays.
+  if (fPool) return;
+
+  fPool = new ARayPool(blockSize);
+  TObjArray* arrays[6] = {&fAbsorbed, &fExited,  &fFocused,
+                          &fRunning,  &fStopped, &fSuspended};
+  for (Int_t i = 0; i < 6; i++) arrays[i]->SetOwner(kFALSE);
+}
+
+//_____________________________________________________________________________
+void ARayArray::Merge(ARayArray* array) {
+  // Move all the rays of array into this. The arrays of each status are
+  // spliced in bulk. If array is pooled, the blocks of its pool are moved too.
+  if (!array or array == this) return;
+
+  if (array->fPool) {
+    if (!fPool) EnablePool(array->fPool->GetBlockSize());
+    fPool->Adopt(*array->fPool);
+  }
+
+  for (Int_t s = 0; s < ARay::kNstatus; s++) {
+    TObjArray* rays = array->GetArray(s);
+    if (fSink and s != ARay::kRun and s != ARay::kSuspend) {
+      // Finished rays are handed to the sink one by one
+      for (Int_t i = 0; i <= rays->GetLast(); i++) {
+        Add((ARay*)rays->RemoveAt(i));
+      }
+      rays->Clear();
+    } else {
+      Append(*GetArray(s), *rays);
+    }
+  }
+}
+
+//_____________________________________________________________________________
+ARay* ARayArray::NewRay(Int_t id, Double_t lambda, Double_t x, Double_t y,
+                        Double_t z, Double_t t, Double_t dx, Double_t dy,
+                        Double_t dz) {
+  // Create a ray in the pool (see EnablePool), or on the heap if the pool is
+  // disabled, and add it to the array
+  ARay* ray = fPool ? new (fPool->Allocate())
+                          ARay(id, lambda, x, y, z, t, dx, dy, dz)
+                    : new ARay(id, lambda, x, y, z, t, dx, dy, dz);
+  Add(ray);
+
+  return ray;
+}
+
+//_____________________________________________________________________________
+Int_t ARayArray::Resume(Int_t keep) {
+  // Move the suspended rays back to the running array so that they can be
+  // traced further. Their histories are trimmed to the last keep points (see
+  // ARay::TrimHistory). Returns the number of resumed rays.
+  Int_t n = 0;
+  for (Int_t i = 0; i <= fSuspended.GetLast(); i++) {
+    ARay* ray = (ARay*)fSuspended.RemoveAt(i);
+    if (!ray) continue;
+    ray->TrimHistory(keep);
+    ray->Resume();
+    fRunning.Add(ray);
+    n++;
+  }
+
+  fSuspended.Expand(0);  // shrink the array
+
+  return n;
 }
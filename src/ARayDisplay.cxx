@@ -0,0 +1,168 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARayDisplay
+//
+// Paths of many rays packed into one buffer and drawn as a single object.
+// Drawing thousands of rays made by ARay::MakePolyLine3D adds as many objects
+// to the pad, and each of them leaks a new color if colored by MakeColor.
+// ARayDisplay keeps the points of all the rays in one float array, is the only
+// primitive of the pad, and shares the colors among the rays. The rays are
+// painted one by one through a single TPolyLine3D, so that only the points of
+// the ray being painted are copied. The rays can be colored by their status
+// (kColorStatus, default) or by their wavelength (kColorWavelength, see
+// ARay::GetSpectralColor), or drawn with the line attributes of the display
+// itself (kColorLine).
+//
+//   ARayDisplay* display = new ARayDisplay(ARayDisplay::kColorWavelength);
+//   display->SetDecimation(10, 3000);  // 1 in 10 rays, up to 3000 rays
+//   display->Add(array->GetFocused());
+//   display->Add(array->GetStopped());
+//   manager->GetTopVolume()->Draw("ogl");
+//   display->Draw();
+//
+// As ARayDisplay is also an ARaySink, a few of the rays of a long run can be
+// collected while the others are only histogrammed, e.g., by
+// AOpticsManager::TraceNonSequential(generator, display). Such rays must
+// keep their points (see AOpticsManager::SetHistoryPolicy).
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TColor.h"
+#include "TMath.h"
+#include "TObjArray.h"
+#include "TPolyLine3D.h"
+
+#include "AOpticsManager.h"
+#include "ARayDisplay.h"
+
+ClassImp(ARayDisplay);
+
+//_____________________________________________________________________________
+ARayDisplay::ARayDisplay(Int_t mode)
+    : fColorMode(kColorStatus), fEvery(1), fMaxRays(0), fNadded(0), fLine(0) {
+  fStatusColor[ARay::kRun] = kGray;
+  fStatusColor[ARay::kStop] = kBlack;
+  fStatusColor[ARay::kExit] = kBlue;
+  fStatusColor[ARay::kFocus] = kRed;
+  fStatusColor[ARay::kSuspend] = kMagenta;
+  fStatusColor[ARay::kAbsorb] = kGreen + 2;
+  SetColorMode(mode);
+}
+
+//_____________________________________________________________________________
+ARayDisplay::~ARayDisplay() { delete fLine; }
+
+//_____________________________________________________________________________
+void ARayDisplay::Add(const ARay& ray) {
+  // Copy the points of ray. Only 1 in every rays added so far is kept, and
+  // nothing is kept after maxRays rays (see SetDecimation).
+  Long64_t n = fNadded++;
+  if (n % fEvery != 0) return;
+  if (fMaxRays > 0 and GetN() >= fMaxRays) return;
+  if (ray.GetNpoints() < 2) return;  // no path to draw
+
+  if (fOffsets.empty()) fOffsets.push_back(0);
+  for (Int_t i = 0; i < ray.GetNpoints(); i++) {
+    Double_t x, y, z, t;
+    ray.GetPoint(i, x, y, z, t);
+    fPoints.push_back(x);
+    fPoints.push_back(y);
+    fPoints.push_back(z);
+  }
+  fOffsets.push_back(GetNpoints());
+  fLambda.push_back(ray.GetLambda());
+  fStatus.push_back(ray.GetStatus());
+}
+
+//_____________________________________________________________________________
+void ARayDisplay::Add(const TObjArray* rays) {
+  // Add the rays in rays (e.g. ARayArray::GetFocused())
+  if (!rays) return;
+
+  for (Int_t i = 0; i <= rays->GetLast(); i++) {
+    ARay* ray = (ARay*)rays->At(i);
+    if (ray) Add(*ray);
+  }
+}
+
+//_____________________________________________________________________________
+void ARayDisplay::Clear(Option_t*) {
+  // Remove all the rays. The decimation starts over.
+  fPoints.clear();
+  fOffsets.clear();
+  fLambda.clear();
+  fStatus.clear();
+  fNadded = 0;
+}
+
+//_____________________________________________________________________________
+Color_t ARayDisplay::GetRayColor(Int_t i) {
+  if (fColorMode == kColorStatus) {
+    Int_t status = fStatus[i];
+    return 0 <= status and status < ARay::kNstatus ? fStatusColor[status]
+                                                   : GetLineColor();
+  } else if (fColorMode == kColorWavelength) {
+    Int_t bin = TMath::Nint(fLambda[i] / AOpticsManager::nm());
+    auto it = fPalette.find(bin);
+    if (it != fPalette.end()) return it->second;
+
+    Float_t r, g, b;
+    ARay::GetSpectralColor(bin * AOpticsManager::nm(), r, g, b);
+    Color_t color = TColor::GetColor(r, g, b);  // reused if already defined
+    fPalette[bin] = color;
+    return color;
+  }
+
+  return GetLineColor();
+}
+
+//_____________________________________________________________________________
+void ARayDisplay::Paint(Option_t* option) {
+  // Paint all the rays through fLine, which is not added to the pad
+  if (!fLine) fLine = new TPolyLine3D;
+  fLine->SetLineStyle(GetLineStyle());
+  fLine->SetLineWidth(GetLineWidth());
+
+  for (Int_t i = 0; i < GetN(); i++) {
+    Int_t first = fOffsets[i];
+    fLine->SetPolyLine(fOffsets[i + 1] - first, &fPoints[first * 3]);
+    fLine->SetLineColor(GetRayColor(i));
+    fLine->Paint(option);
+  }
+}
+
+//_____________________________________________________________________________
+void ARayDisplay::SetColorMode(Int_t mode) {
+  if (mode < kColorLine or mode > kColorWavelength) {
+    Error("SetColorMode", "Invalid color mode: %d", mode);
+    return;
+  }
+  fColorMode = mode;
+}
+
+//_____________________________________________________________________________
+void ARayDisplay::SetDecimation(Int_t every, Int_t maxRays) {
+  // Keep only 1 in every added rays, and at most maxRays rays in total (no
+  // limit if 0). Without decimation, all the rays are kept.
+  if (every < 1 or maxRays < 0) {
+    Error("SetDecimation", "Invalid parameters: %d, %d", every, maxRays);
+    return;
+  }
+  fEvery = every;
+  fMaxRays = maxRays;
+}
+
+//_____________________________________________________________________________
+void ARayDisplay::SetStatusColor(Int_t status, Color_t color) {
+  // Set the color of the rays of status (e.g. ARay::kFocus) in kColorStatus
+  if (status < 0 or status >= ARay::kNstatus) {
+    Error("SetStatusColor", "Invalid status: %d", status);
+    return;
+  }
+  fStatusColor[status] = color;
+}
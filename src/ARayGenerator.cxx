@@ -0,0 +1,294 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARayGenerator
+//
+// Lazy version of ARayShooter. A generator keeps only the parameters of a
+// distribution, and GetRay computes the i-th ray from them with a given
+// random number stream. AOpticsManager::TraceNonSequential(generator, sink)
+// generates the rays chunk by chunk in the tracing threads, traces them and
+// hands them to the sink (or to the AFocalPlaneMonitor of the focal
+// surfaces), so that the memory usage is proportional to the chunk size
+// instead of the number of rays.
+//
+//   ARayGenerator gen = ARayGenerator::RandomCircle(400 * nm, 1 * m, 10000000);
+//   manager->TraceNonSequential(gen, &sink);
+//
+// The distributions are the same as those of ARayShooter, but the random
+// numbers are drawn from ACounterRandom instead of gRandom. RandomFootprint
+// is not available because its area must be known before tracing.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+
+#include "TMath.h"
+
+#include "ARayGenerator.h"
+
+ClassImp(ARayGenerator);
+
+//_____________________________________________________________________________
+ARayGenerator::ARayGenerator()
+    : fType(kNone), fN(0), fNa(0), fNb(0), fLambda(0), fA(0), fB(0) {
+  // Default constructor, which generates no ray
+  for (Int_t i = 0; i < 9; i++) fRotation[i] = i % 4 == 0 ? 1 : 0;
+  for (Int_t i = 0; i < 3; i++) fTranslation[i] = 0;
+  fDirection[0] = fDirection[1] = 0;
+  fDirection[2] = 1;
+}
+
+//_____________________________________________________________________________
+ARayGenerator::ARayGenerator(Int_t type, Double_t lambda, TGeoRotation* rot,
+                             TGeoTranslation* tr, TVector3* v)
+    : ARayGenerator() {
+  // The rotation and the translation are copied, so that they need not be
+  // kept alive while tracing
+  fType = type;
+  fLambda = lambda;
+  if (rot) memcpy(fRotation, rot->GetRotationMatrix(), 9 * sizeof(Double_t));
+  if (tr) memcpy(fTranslation, tr->GetTranslation(), 3 * sizeof(Double_t));
+  if (v) {
+    fDirection[0] = v->X();
+    fDirection[1] = v->Y();
+    fDirection[2] = v->Z();
+  }
+}
+
+//_____________________________________________________________________________
+ARayGenerator ARayGenerator::Circle(Double_t lambda, Double_t rmax, Int_t nr,
+                                    Int_t nphi, TGeoRotation* rot,
+                                    TGeoTranslation* tr, TVector3* v) {
+  // Rays aligned in concentric circles (see ARayShooter::Circle)
+  ARayGenerator gen(kCircle, lambda, rot, tr, v);
+  if (0 > rmax or nr < 1 or nphi < 1) return gen;
+
+  gen.fA = rmax;
+  gen.fNa = nr;
+  gen.fNb = nphi;
+  gen.fN = 1 + nphi * nr * (nr + 1) / 2;
+
+  return gen;
+}
+
+//_____________________________________________________________________________
+void ARayGenerator::GetRay(Int_t i, ACounterRandom& rng, Double_t* x,
+                           Double_t* d) const {
+  // Compute the start point x and the direction d of the i-th ray. Random
+  // numbers are drawn from rng, which should be a stream of its own for each
+  // ray to make the rays independent of the order of generation.
+  Double_t local[3] = {0, 0, 0};
+  Rotate(fDirection, d);
+
+  if (fType == kCircle) {
+    if (i > 0) {
+      // ring k (1 to nr) has nphi * k rays after the center
+      Int_t k = Int_t((1 + TMath::Sqrt(1 + 8. * (i - 1) / fNb)) / 2);
+      while (k > 1 and 1 + fNb * k * (k - 1) / 2 > i) k--;
+      while (1 + fNb * k * (k + 1) / 2 <= i) k++;
+      Int_t j = i - 1 - fNb * k * (k - 1) / 2;
+      Double_t r = fA * k / fNa;
+      Double_t phi = 2 * TMath::Pi() / fNb / k * j;
+      local[0] = r * TMath::Cos(phi);
+      local[1] = r * TMath::Sin(phi);
+    }
+    ToMaster(local, x);
+  } else if (fType == kRandomCircle) {
+    do {
+      local[0] = rng.Uniform(-fA, fA);
+      local[1] = rng.Uniform(-fA, fA);
+    } while (local[0] * local[0] + local[1] * local[1] > fA * fA);
+    ToMaster(local, x);
+  } else if (fType == kRandomCone) {
+    // from the origin to a random point in the circle of radius fA at z = fB
+    Double_t goal[3] = {0, 0, fB}, master[3];
+    do {
+      goal[0] = rng.Uniform(-fA, fA);
+      goal[1] = rng.Uniform(-fA, fA);
+    } while (goal[0] * goal[0] + goal[1] * goal[1] > fA * fA);
+    ToMaster(local, x);
+    ToMaster(goal, master);
+    for (Int_t j = 0; j < 3; j++) d[j] = master[j] - x[j];
+  } else if (fType == kRandomRectangle) {
+    local[0] = rng.Uniform(-fA / 2., fA / 2.);
+    local[1] = rng.Uniform(-fB / 2., fB / 2.);
+    ToMaster(local, x);
+  } else if (fType == kRandomSector) {
+    // uniform in the sector 0 <= phi < 2pi/order of the circle
+    Double_t r = fA * TMath::Sqrt(rng.Uniform(1));
+    Double_t phi = rng.Uniform(fB);
+    local[0] = r * TMath::Cos(phi);
+    local[1] = r * TMath::Sin(phi);
+    ToMaster(local, x);
+  } else if (fType == kRandomSphere) {
+    Double_t cost = rng.Uniform(-1, 1);
+    Double_t sint = TMath::Sqrt(TMath::Max(0., 1 - cost * cost));
+    Double_t phi = rng.Uniform(0, TMath::TwoPi());
+    d[0] = sint * TMath::Cos(phi);
+    d[1] = sint * TMath::Sin(phi);
+    d[2] = cost;
+    ToMaster(local, x);
+  } else if (fType == kRandomSphericalCone) {
+    Double_t cost = rng.Uniform(TMath::Cos(fA * TMath::DegToRad()), 1);
+    Double_t sint = TMath::Sqrt(TMath::Max(0., 1 - cost * cost));
+    Double_t phi = rng.Uniform(0, TMath::TwoPi());
+    Double_t dir[3] = {sint * TMath::Cos(phi), sint * TMath::Sin(phi), cost};
+    Rotate(dir, d);
+    ToMaster(local, x);
+  } else if (fType == kRectangle) {
+    Double_t deltax = fNa == 1 ? fA / 2 : fA / (fNa - 1);
+    Double_t deltay = fNb == 1 ? fB / 2 : fB / (fNb - 1);
+    local[0] = (i / fNb) * deltax - fA / 2;
+    local[1] = (i % fNb) * deltay - fB / 2;
+    ToMaster(local, x);
+  } else {
+    ToMaster(local, x);
+  }
+}
+
+//_____________________________________________________________________________
+ARayGenerator ARayGenerator::RandomCircle(Double_t lambda, Double_t rmax,
+                                          Int_t n, TGeoRotation* rot,
+                                          TGeoTranslation* tr, TVector3* v) {
+  // Rays randomly distributed in a circle (see ARayShooter::RandomCircle)
+  ARayGenerator gen(kRandomCircle, lambda, rot, tr, v);
+  if (0 > rmax or n < 1) return gen;
+
+  gen.fA = rmax;
+  gen.fN = n;
+
+  return gen;
+}
+
+//_____________________________________________________________________________
+ARayGenerator ARayGenerator::RandomCone(Double_t lambda, Double_t r,
+                                        Double_t d, Int_t n, TGeoRotation* rot,
+                                        TGeoTranslation* tr) {
+  // Rays from the origin toward a circle (see ARayShooter::RandomCone)
+  ARayGenerator gen(kRandomCone, lambda, rot, tr, 0);
+  if (0 > r or n < 1) return gen;
+
+  gen.fA = r;
+  gen.fB = d;
+  gen.fN = n;
+
+  return gen;
+}
+
+//_____________________________________________________________________________
+ARayGenerator ARayGenerator::RandomRectangle(Double_t lambda, Double_t dx,
+                                             Double_t dy, Int_t n,
+                                             TGeoRotation* rot,
+                                             TGeoTranslation* tr,
+                                             TVector3* v) {
+  // Rays randomly distributed in a rectangle (see
+  // ARayShooter::RandomRectangle)
+  ARayGenerator gen(kRandomRectangle, lambda, rot, tr, v);
+  if (dx < 0 or dy < 0 or n < 1) return gen;
+
+  gen.fA = dx;
+  gen.fB = dy;
+  gen.fN = n;
+
+  return gen;
+}
+
+//_____________________________________________________________________________
+ARayGenerator ARayGenerator::RandomSector(Double_t lambda, Double_t rmax,
+                                          Int_t order, Int_t n,
+                                          TGeoRotation* rot,
+                                          TGeoTranslation* tr, TVector3* v) {
+  // Rays randomly distributed in the fundamental sector (0 <= phi <
+  // 2pi/order) of a circle. A system with the rotational symmetry of order
+  // needs only 1/order of the rays of RandomCircle, which are unfolded to the
+  // full circle by ARaySymmetrySink with the same rot and tr. The density of
+  // n rays in the sector is that of n * order rays in the circle.
+  ARayGenerator gen(kRandomSector, lambda, rot, tr, v);
+  if (0 > rmax or order < 1 or n < 1) return gen;
+
+  gen.fA = rmax;
+  gen.fB = TMath::TwoPi() / order;
+  gen.fN = n;
+
+  return gen;
+}
+
+//_____________________________________________________________________________
+ARayGenerator ARayGenerator::RandomSphere(Double_t lambda, Int_t n,
+                                          TGeoTranslation* tr) {
+  // Rays emitted isotropically (see ARayShooter::RandomSphere)
+  ARayGenerator gen(kRandomSphere, lambda, 0, tr, 0);
+  if (n < 1) return gen;
+
+  gen.fN = n;
+
+  return gen;
+}
+
+//_____________________________________________________________________________
+ARayGenerator ARayGenerator::RandomSphericalCone(Double_t lambda, Int_t n,
+                                                 Double_t theta,
+                                                 TGeoRotation* rot,
+                                                 TGeoTranslation* tr) {
+  // Rays emitted isotropically within theta (deg) of the Z axis (see
+  // ARayShooter::RandomSphericalCone)
+  ARayGenerator gen(kRandomSphericalCone, lambda, rot, tr, 0);
+  if (n < 1) return gen;
+
+  gen.fA = theta;
+  gen.fN = n;
+
+  return gen;
+}
+
+//_____________________________________________________________________________
+ARayGenerator ARayGenerator::RandomSquare(Double_t lambda, Double_t d,
+                                          Int_t n, TGeoRotation* rot,
+                                          TGeoTranslation* tr, TVector3* v) {
+  return RandomRectangle(lambda, d, d, n, rot, tr, v);
+}
+
+//_____________________________________________________________________________
+ARayGenerator ARayGenerator::Rectangle(Double_t lambda, Double_t dx,
+                                       Double_t dy, Int_t nx, Int_t ny,
+                                       TGeoRotation* rot, TGeoTranslation* tr,
+                                       TVector3* v) {
+  // Rays aligned in a rectangle (see ARayShooter::Rectangle)
+  ARayGenerator gen(kRectangle, lambda, rot, tr, v);
+  if (dx < 0 or dy < 0 or nx < 1 or ny < 1) return gen;
+
+  gen.fA = dx;
+  gen.fB = dy;
+  gen.fNa = nx;
+  gen.fNb = ny;
+  gen.fN = nx * ny;
+
+  return gen;
+}
+
+//_____________________________________________________________________________
+void ARayGenerator::Rotate(const Double_t* local, Double_t* master) const {
+  for (Int_t i = 0; i < 3; i++) {
+    master[i] = fRotation[3 * i] * local[0] + fRotation[3 * i + 1] * local[1] +
+                fRotation[3 * i + 2] * local[2];
+  }
+}
+
+//_____________________________________________________________________________
+ARayGenerator ARayGenerator::Square(Double_t lambda, Double_t d, Int_t n,
+                                    TGeoRotation* rot, TGeoTranslation* tr,
+                                    TVector3* v) {
+  // Rays aligned in a square (see ARayShooter::Square)
+  return Rectangle(lambda, d, d, n, n, rot, tr, v);
+}
+
+//_____________________________________________________________________________
+void ARayGenerator::ToMaster(const Double_t* local, Double_t* master) const {
+  // Rotate and then translate a point as ARayShooter does
+  Rotate(local, master);
+  for (Int_t i = 0; i < 3; i++) master[i] += fTranslation[i];
+}
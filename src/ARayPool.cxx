@@ -0,0 +1,98 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARayPool
+//
+// Storage of ARay objects allocated in blocks of fBlockSize rays, so that
+// bursty events of many photons need only a few memory allocations. The pool
+// does not call the destructors of the rays; the owner (ARayArray) destroys
+// them and then calls Reset, after which the blocks are reused by the next
+// event without being returned to the system. Blocks are freed only when the
+// pool is deleted.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TMath.h"
+
+#include "ARayPool.h"
+
+//_____________________________________________________________________________
+ARayPool::ARayPool(std::size_t blockSize)
+    : fBlockSize(blockSize > 0 ? blockSize : 1), fCurrent(0), fNused(0) {}
+
+//_____________________________________________________________________________
+ARayPool::~ARayPool() {
+  for (std::size_t i = 0; i < fBlocks.size(); i++) delete[] fBlocks[i].fSlots;
+}
+
+//_____________________________________________________________________________
+void* ARayPool::Allocate() {
+  // Return uninitialized memory for one ARay, to be used with placement new
+  if (fCurrent < fBlocks.size() and fNused == fBlocks[fCurrent].fSize) {
+    fCurrent++;
+    fNused = 0;
+  }
+  if (fCurrent == fBlocks.size()) {
+    Block block = {new Slot[fBlockSize], fBlockSize};
+    fBlocks.push_back(block);
+    fNused = 0;
+  }
+
+  return &fBlocks[fCurrent].fSlots[fNused++];
+}
+
+//_____________________________________________________________________________
+void ARayPool::Adopt(ARayPool& other) {
+  // Take over the blocks used by other, e.g. when the rays of another
+  // ARayArray are merged. The adopted blocks are inserted before the block
+  // being filled.
+  if (other.fBlocks.empty()) return;
+
+  std::size_t nadopt = TMath::Min(other.fCurrent + 1, other.fBlocks.size());
+  std::size_t pos = TMath::Min(fCurrent, fBlocks.size());
+  fBlocks.insert(fBlocks.begin() + pos, other.fBlocks.begin(),
+                 other.fBlocks.begin() + nadopt);
+  if (fCurrent < fBlocks.size() - nadopt) {
+    fCurrent += nadopt;
+  } else {  // no block was being filled
+    fCurrent = fBlocks.size() - 1;
+    fNused = fBlocks[fCurrent].fSize;
+  }
+
+  other.fBlocks.erase(other.fBlocks.begin(), other.fBlocks.begin() + nadopt);
+  other.fCurrent = 0;
+  other.fNused = 0;
+}
+
+//_____________________________________________________________________________
+ULong64_t ARayPool::GetMemoryUsage() const {
+  // Return the bytes allocated for all the blocks including the spare ones
+  ULong64_t bytes = sizeof(*this) + fBlocks.capacity() * sizeof(Block);
+  for (std::size_t i = 0; i < fBlocks.size(); i++) {
+    bytes += fBlocks[i].fSize * sizeof(Slot);
+  }
+
+  return bytes;
+}
+
+//_____________________________________________________________________________
+Bool_t ARayPool::Owns(const ARay* ray) const {
+  const Slot* p = (const Slot*)ray;
+  for (std::size_t i = 0; i < fBlocks.size(); i++) {
+    const Block& block = fBlocks[i];
+    if (block.fSlots <= p and p < block.fSlots + block.fSize) return kTRUE;
+  }
+
+  return kFALSE;
+}
+
+//_____________________________________________________________________________
+void ARayPool::Reset() {
+  // Mark all the slots free. The rays must have been destroyed beforehand.
+  fCurrent = 0;
+  fNused = 0;
+}
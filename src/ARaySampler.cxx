@@ -0,0 +1,176 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARaySampler
+//
+// Sampling policy of the random shooters of ARayShooter. Pseudo-random
+// sampling of an aperture converges as 1/sqrt(N), while the grids of
+// ARayShooter::Circle and Square alias with segmented mirrors. A
+// low-discrepancy sequence covers the aperture evenly without a regular
+// pattern, so the PSF size and the effective area converge almost as 1/N.
+//
+//   ARaySampler sampler(ARaySampler::kSobol, 1234);
+//   sampler.SetWavelengthRange(300 * nm, 600 * nm);  // optional
+//   ARayShooter::SetSampler(&sampler);
+//   ARayArray* rays = ARayShooter::RandomCircle(400 * nm, 1 * m, 1000);
+//
+// Each sample has three coordinates. The first two are used for the position
+// or direction, and the third one for the wavelength when a wavelength range
+// is given, which stratifies the wavelengths as well. The shooters map the
+// samples directly (e.g. polar coordinates for a circle) instead of the
+// rejection sampling used with gRandom, which would spoil the
+// low-discrepancy property.
+//
+// kSobol    : Sobol sequence (Joe-Kuo direction numbers) with a random
+//             digital shift
+// kHalton   : Halton sequence in bases 2, 3 and 5 with random digit
+//             permutations
+// kPseudoRandom : gRandom, but with the same mappings as above
+//
+// The scrambling is determined by the seed, so different seeds give
+// statistically independent estimates for error bars. The index of the next
+// sample continues over successive shooter calls until Reset is called.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TRandom.h"
+
+#include "ACounterRandom.h"
+#include "ARaySampler.h"
+
+ClassImp(ARaySampler);
+
+namespace {
+
+const Int_t kHaltonBase[ARaySampler::kDimensions] = {2, 3, 5};
+
+// direction numbers of the first 3 dimensions of Sobol (v[dim][bit])
+struct SobolDirections {
+  UInt_t v[ARaySampler::kDimensions][32];
+
+  SobolDirections() {
+    // (degree s, coefficients a, initial m) from new-joe-kuo-6.21201
+    const Int_t s[ARaySampler::kDimensions] = {0, 1, 2};
+    const UInt_t a[ARaySampler::kDimensions] = {0, 0, 1};
+    const UInt_t m[ARaySampler::kDimensions][2] = {{0, 0}, {1, 0}, {1, 3}};
+
+    for (Int_t k = 0; k < 32; k++) v[0][k] = 1u << (31 - k);
+
+    for (Int_t d = 1; d < ARaySampler::kDimensions; d++) {
+      for (Int_t k = 0; k < s[d]; k++) v[d][k] = m[d][k] << (31 - k);
+      for (Int_t k = s[d]; k < 32; k++) {
+        v[d][k] = v[d][k - s[d]] ^ (v[d][k - s[d]] >> s[d]);
+        for (Int_t l = 1; l < s[d]; l++) {
+          if ((a[d] >> (s[d] - 1 - l)) & 1) v[d][k] ^= v[d][k - l];
+        }
+      }
+    }
+  }
+};
+
+const SobolDirections kSobolDirections;
+
+}  // namespace
+
+//_____________________________________________________________________________
+ARaySampler::ARaySampler(Int_t type, ULong64_t seed)
+    : fType(type), fSeed(seed), fIndex(0), fLambdaMin(0), fLambdaMax(0) {
+  if (fType != kHalton and fType != kSobol) fType = kPseudoRandom;
+  SetSeed(seed);
+}
+
+//_____________________________________________________________________________
+void ARaySampler::Get(Long64_t i, Double_t* u) const {
+  // Fill u[0] to u[kDimensions - 1] with the i-th sample in [0, 1). Samples
+  // of kPseudoRandom are drawn from gRandom and do not depend on i.
+  for (Int_t d = 0; d < kDimensions; d++) {
+    if (fType == kSobol) {
+      u[d] = Sobol(i, d);
+    } else if (fType == kHalton) {
+      u[d] = Halton(i, d);
+    } else {
+      u[d] = gRandom->Rndm();
+    }
+  }
+}
+
+//_____________________________________________________________________________
+Double_t ARaySampler::GetLambda(Double_t lambda, const Double_t* u) const {
+  // Return the wavelength of a sample, or lambda if no range is given
+  if (not HasWavelengthRange()) return lambda;
+  return fLambdaMin + u[kDimensions - 1] * (fLambdaMax - fLambdaMin);
+}
+
+//_____________________________________________________________________________
+Double_t ARaySampler::Halton(Long64_t i, Int_t dim) const {
+  // Radical inverse of i with permuted digits. Digits are computed beyond the
+  // last non-zero one of i as well (up to double precision), so that the
+  // permutation of 0 does not leave the points on a coarse lattice.
+  Int_t b = kHaltonBase[dim];
+  const UChar_t* perm = fPermutation[dim];
+  Double_t inv = 1. / b;
+  Double_t f = inv;
+  Double_t x = 0;
+  ULong64_t n = i;
+  while (f > 1e-16) {
+    x += perm[n % b] * f;
+    n /= b;
+    f *= inv;
+  }
+
+  return x < 1 ? x : 1 - 1e-16;
+}
+
+//_____________________________________________________________________________
+void ARaySampler::Next(Double_t* u) {
+  // Fill u with the next sample
+  Get(fIndex++, u);
+}
+
+//_____________________________________________________________________________
+void ARaySampler::SetSeed(ULong64_t seed) {
+  // Set the seed of the scrambling. The digital shifts and the digit
+  // permutations are derived from it with ACounterRandom.
+  fSeed = seed;
+  ACounterRandom rng(ACounterRandom::Hash(seed), 0);
+  for (Int_t d = 0; d < kDimensions; d++) {
+    fShift[d] = seed == 0 ? 0 : rng.Integer32();
+
+    // Fisher-Yates shuffle of the digits. The identity is kept for seed = 0,
+    // which gives the plain Halton sequence.
+    Int_t b = kHaltonBase[d];
+    for (Int_t j = 0; j < b; j++) fPermutation[d][j] = j;
+    if (seed == 0) continue;
+    for (Int_t j = b - 1; j > 0; j--) {
+      Int_t k = rng.Integer32() % (j + 1);
+      UChar_t tmp = fPermutation[d][j];
+      fPermutation[d][j] = fPermutation[d][k];
+      fPermutation[d][k] = tmp;
+    }
+  }
+}
+
+//_____________________________________________________________________________
+void ARaySampler::SetWavelengthRange(Double_t min, Double_t max) {
+  // Sample wavelengths uniformly in [min, max) with the last coordinate of
+  // the samples instead of using the wavelength given to the shooters. Give
+  // min >= max to disable it.
+  fLambdaMin = min;
+  fLambdaMax = max;
+}
+
+//_____________________________________________________________________________
+Double_t ARaySampler::Sobol(Long64_t i, Int_t dim) const {
+  UInt_t x = fShift[dim];
+  const UInt_t* v = kSobolDirections.v[dim];
+  ULong64_t n = i;
+  for (Int_t k = 0; n != 0 and k < 32; k++, n >>= 1) {
+    if (n & 1) x ^= v[k];
+  }
+
+  return x * (1. / 4294967296.);
+}
@@ -3,12 +3,24 @@
  * All rights reserved.                                                       *
  *****************************************************************************/
 
+#include <algorithm>
+
+#include "TGeoBBox.h"
+#include "TGeoManager.h"
 #include "TRandom.h"
 
+#include "AGeoUtil.h"
+#include "ARaySampler.h"
 #include "ARayShooter.h"
 
 ClassImp(ARayShooter);
 
+namespace {
+
+ARaySampler* gSampler = 0;  // sampling policy of the random shooters
+
+}  // namespace
+
 //_____________________________________________________________________________
 /*
 Begin_Html
@@ -182,6 +194,9 @@ ARayArray* ARayShooter::Circle(Double_t lambda, Double_t rmax, Int_t nr,
   return array;
 }
 
+//_____________________________________________________________________________
+ARaySampler* ARayShooter::GetSampler() { return gSampler; }
+
 //_____________________________________________________________________________
 ARayArray* ARayShooter::RandomCircle(Double_t lambda, Double_t rmax, Int_t n,
                                      TGeoRotation* rot, TGeoTranslation* tr,
@@ -209,10 +224,18 @@ ARayArray* ARayShooter::RandomCircle(Double_t lambda, Double_t rmax, Int_t n,
 
   for (Int_t i = 0; i < n; i++) {
     Double_t randx, randy;
-    do {
-      randx = gRandom->Uniform(-rmax, rmax);
-      randy = gRandom->Uniform(-rmax, rmax);
-    } while (TMath::Sqrt(randx * randx + randy * randy) > rmax);
+    Double_t u[ARaySampler::kDimensions];
+    if (gSampler) {
+      gSampler->Next(u);
+      Double_t r = rmax * TMath::Sqrt(u[0]);
+      randx = r * TMath::Cos(TMath::TwoPi() * u[1]);
+      randy = r * TMath::Sin(TMath::TwoPi() * u[1]);
+    } else {
+      do {
+        randx = gRandom->Uniform(-rmax, rmax);
+        randy = gRandom->Uniform(-rmax, rmax);
+      } while (TMath::Sqrt(randx * randx + randy * randy) > rmax);
+    }
 
     Double_t x[3] = {randx, randy, 0};
 
@@ -228,7 +251,8 @@ ARayArray* ARayShooter::RandomCircle(Double_t lambda, Double_t rmax, Int_t n,
       memcpy(x, new_pos, 3 * sizeof(Double_t));
     }
 
-    ARay* ray = new ARay(0, lambda, x[0], x[1], x[2], 0, new_dir[0], new_dir[1],
+    Double_t l = gSampler ? gSampler->GetLambda(lambda, u) : lambda;
+    ARay* ray = new ARay(0, l, x[0], x[1], x[2], 0, new_dir[0], new_dir[1],
                          new_dir[2]);
     array->Add(ray);
   }
@@ -247,11 +271,19 @@ ARayArray* ARayShooter::RandomCone(Double_t lambda, Double_t r, Double_t d,
 
   for (Int_t i = 0; i < n; i++) {
     // random (x, y) inside a circle
-    Double_t x = gRandom->Uniform(-r, r);
-    Double_t y = gRandom->Uniform(-r, r);
-    if (x * x + y * y > r * r) {
-      i--;
-      continue;
+    Double_t x, y;
+    Double_t u[ARaySampler::kDimensions];
+    if (gSampler) {
+      gSampler->Next(u);
+      x = r * TMath::Sqrt(u[0]) * TMath::Cos(TMath::TwoPi() * u[1]);
+      y = r * TMath::Sqrt(u[0]) * TMath::Sin(TMath::TwoPi() * u[1]);
+    } else {
+      x = gRandom->Uniform(-r, r);
+      y = gRandom->Uniform(-r, r);
+      if (x * x + y * y > r * r) {
+        i--;
+        continue;
+      }
     }
 
     Double_t goal_pos[3] = {x, y, d};
@@ -276,7 +308,8 @@ ARayArray* ARayShooter::RandomCone(Double_t lambda, Double_t r, Double_t d,
     TVector3 goal(goal_pos);
     TVector3 dir = goal - start;
 
-    ARay* ray = new ARay(0, lambda, start.X(), start.Y(), start.Z(), 0, dir.X(),
+    Double_t l = gSampler ? gSampler->GetLambda(lambda, u) : lambda;
+    ARay* ray = new ARay(0, l, start.X(), start.Y(), start.Z(), 0, dir.X(),
                          dir.Y(), dir.Z());
     array->Add(ray);
   }
@@ -284,6 +317,153 @@ ARayArray* ARayShooter::RandomCone(Double_t lambda, Double_t r, Double_t d,
   return array;
 }
 
+//_____________________________________________________________________________
+ARayArray* ARayShooter::RandomFootprint(Double_t lambda,
+                                        const std::vector<TGeoNode*>& targets,
+                                        Int_t n, Double_t& area,
+                                        TGeoRotation* rot, TGeoTranslation* tr,
+                                        TVector3* v) {
+  // Create initial photons randomly distributed only over the footprints of
+  // the target nodes (e.g. mirror facets) in gGeoManager. As in
+  // RandomRectangle, the photons start from the XY plane moved by rot and tr,
+  // and fly along v (default is the Z axis). The footprint of a target is the
+  // bounding rectangle of its bounding box projected onto the start plane
+  // along v. Overlapping footprints are sampled by rejection so that the
+  // photon density is uniform in their union.
+  //
+  // area is set to the area of the union, which is the geometric acceptance
+  // factor of the sampled photons, e.g. effective area = area * (number of
+  // focused photons) / n.
+  ARayArray* array = new ARayArray;
+  area = 0;
+
+  if (n < 1 or targets.empty() or !gGeoManager) {
+    return array;
+  }
+
+  Double_t dir[3] = {0, 0, 1};
+  if (v) {
+    dir[0] = v->X();
+    dir[1] = v->Y();
+    dir[2] = v->Z();
+  }
+  if (dir[2] == 0) {
+    ::Error("ARayShooter::RandomFootprint",
+            "Direction must not be parallel to the start plane");
+    return array;
+  }
+  Double_t new_dir[3];
+
+  if (rot) {
+    rot->LocalToMaster(dir, new_dir);
+  } else {
+    memcpy(new_dir, dir, 3 * sizeof(Double_t));
+  }
+
+  // Footprints in the local coordinate of the start plane
+  std::vector<Double_t> xmin, xmax, ymin, ymax, cumulative;
+  Double_t total = 0;
+  for (std::size_t i = 0; i < targets.size(); i++) {
+    TGeoHMatrix matrix;
+    if (not AGeoUtil::FindGlobalMatrix(gGeoManager->GetTopNode(), targets[i],
+                                       matrix)) {
+      ::Error("ARayShooter::RandomFootprint",
+              "Target %s is not placed in the geometry",
+              targets[i] ? targets[i]->GetName() : "(null)");
+      continue;
+    }
+    TGeoBBox* box =
+        dynamic_cast<TGeoBBox*>(targets[i]->GetVolume()->GetShape());
+    if (!box) continue;
+
+    const Double_t* origin = box->GetOrigin();
+    Double_t x1 = TMath::Infinity(), x2 = -TMath::Infinity();
+    Double_t y1 = TMath::Infinity(), y2 = -TMath::Infinity();
+    for (Int_t j = 0; j < 8; j++) {
+      Double_t corner[3] = {origin[0] + (j & 1 ? 1 : -1) * box->GetDX(),
+                            origin[1] + (j & 2 ? 1 : -1) * box->GetDY(),
+                            origin[2] + (j & 4 ? 1 : -1) * box->GetDZ()};
+      Double_t master[3], tmp[3], local[3];
+      matrix.LocalToMaster(corner, master);
+      if (tr) {
+        tr->MasterToLocal(master, tmp);
+      } else {
+        memcpy(tmp, master, 3 * sizeof(Double_t));
+      }
+      if (rot) {
+        rot->MasterToLocal(tmp, local);
+      } else {
+        memcpy(local, tmp, 3 * sizeof(Double_t));
+      }
+      // projection onto z = 0 along the photon direction
+      Double_t t = local[2] / dir[2];
+      Double_t px = local[0] - t * dir[0];
+      Double_t py = local[1] - t * dir[1];
+      x1 = TMath::Min(x1, px);
+      x2 = TMath::Max(x2, px);
+      y1 = TMath::Min(y1, py);
+      y2 = TMath::Max(y2, py);
+    }
+
+    xmin.push_back(x1);
+    xmax.push_back(x2);
+    ymin.push_back(y1);
+    ymax.push_back(y2);
+    total += (x2 - x1) * (y2 - y1);
+    cumulative.push_back(total);
+  }
+
+  if (total <= 0) {
+    return array;
+  }
+
+  Long64_t ntrials = 0;
+  Int_t nfootprints = Int_t(cumulative.size());
+  for (Int_t i = 0; i < n;) {
+    ntrials++;
+    // choose a footprint with the probability proportional to its area
+    Int_t k = Int_t(std::upper_bound(cumulative.begin(), cumulative.end(),
+                                     gRandom->Uniform(total)) -
+                    cumulative.begin());
+    k = TMath::Min(k, nfootprints - 1);
+    Double_t x[3] = {gRandom->Uniform(xmin[k], xmax[k]),
+                     gRandom->Uniform(ymin[k], ymax[k]), 0};
+
+    // accept the point with the probability of 1 / (number of overlapping
+    // footprints) to make the density uniform
+    Int_t noverlap = 0;
+    for (Int_t j = 0; j < nfootprints; j++) {
+      if (xmin[j] <= x[0] and x[0] <= xmax[j] and ymin[j] <= x[1] and
+          x[1] <= ymax[j]) {
+        noverlap++;
+      }
+    }
+    if (noverlap > 1 and gRandom->Uniform(noverlap) >= 1) continue;
+
+    Double_t new_pos[3];
+    if (rot) {
+      rot->LocalToMaster(x, new_pos);
+    } else {
+      memcpy(new_pos, x, 3 * sizeof(Double_t));
+    }
+
+    if (tr) {
+      tr->LocalToMaster(new_pos, x);
+    } else {
+      memcpy(x, new_pos, 3 * sizeof(Double_t));
+    }
+
+    ARay* ray = new ARay(0, lambda, x[0], x[1], x[2], 0, new_dir[0], new_dir[1],
+                         new_dir[2]);
+    array->Add(ray);
+    i++;
+  }
+
+  area = total * n / ntrials;
+
+  return array;
+}
+
 //_____________________________________________________________________________
 ARayArray* ARayShooter::RandomRectangle(Double_t lambda, Double_t dx,
                                         Double_t dy, Int_t n, TGeoRotation* rot,
@@ -311,8 +491,14 @@ ARayArray* ARayShooter::RandomRectangle(Double_t lambda, Double_t dx,
 
   for (Int_t i = 0; i < n; i++) {
     Double_t new_pos[3];
-    Double_t x[3] = {gRandom->Uniform(-dx / 2., dx / 2.),
-                     gRandom->Uniform(-dy / 2., dy / 2.), 0};
+    Double_t u[ARaySampler::kDimensions];
+    if (gSampler) {
+      gSampler->Next(u);
+    } else {
+      u[0] = gRandom->Uniform(1);
+      u[1] = gRandom->Uniform(1);
+    }
+    Double_t x[3] = {(u[0] - 0.5) * dx, (u[1] - 0.5) * dy, 0};
 
     if (rot) {
       rot->LocalToMaster(x, new_pos);
@@ -326,7 +512,8 @@ ARayArray* ARayShooter::RandomRectangle(Double_t lambda, Double_t dx,
       memcpy(x, new_pos, 3 * sizeof(Double_t));
     }
 
-    ARay* ray = new ARay(0, lambda, x[0], x[1], x[2], 0, new_dir[0], new_dir[1],
+    Double_t l = gSampler ? gSampler->GetLambda(lambda, u) : lambda;
+    ARay* ray = new ARay(0, l, x[0], x[1], x[2], 0, new_dir[0], new_dir[1],
                          new_dir[2]);
     array->Add(ray);
   }
@@ -340,15 +527,26 @@ ARayArray* ARayShooter::RandomSphere(Double_t lambda, Int_t n,
   ARayArray* array = new ARayArray;
   for (Int_t i = 0; i < n; i++) {
     Double_t dir[3];
-    gRandom->Sphere(dir[0], dir[1], dir[2], 1);
+    Double_t u[ARaySampler::kDimensions];
+    if (gSampler) {
+      gSampler->Next(u);
+      Double_t cost = 2 * u[0] - 1;
+      Double_t sint = TMath::Sqrt(TMath::Max(0., 1 - cost * cost));
+      dir[0] = sint * TMath::Cos(TMath::TwoPi() * u[1]);
+      dir[1] = sint * TMath::Sin(TMath::TwoPi() * u[1]);
+      dir[2] = cost;
+    } else {
+      gRandom->Sphere(dir[0], dir[1], dir[2], 1);
+    }
 
     Double_t p[3] = {0, 0, 0};
     Double_t new_pos[3] = {0, 0, 0};
     if (tr) {
       tr->LocalToMaster(p, new_pos);
     }
-    ARay* ray = new ARay(0, lambda, new_pos[0], new_pos[1], new_pos[2], 0,
-                         dir[0], dir[1], dir[2]);
+    Double_t l = gSampler ? gSampler->GetLambda(lambda, u) : lambda;
+    ARay* ray = new ARay(0, l, new_pos[0], new_pos[1], new_pos[2], 0, dir[0],
+                         dir[1], dir[2]);
     array->Add(ray);
   }
 
@@ -362,9 +560,17 @@ ARayArray* ARayShooter::RandomSphericalCone(Double_t lambda, Int_t n,
   ARayArray* array = new ARayArray;
   for (Int_t i = 0; i < n; i++) {
     Double_t dir[3];
-    Double_t ran = gRandom->Uniform(TMath::Cos(theta * TMath::DegToRad()), 1);
+    Double_t u[ARaySampler::kDimensions];
+    if (gSampler) {
+      gSampler->Next(u);
+    } else {
+      u[0] = gRandom->Uniform(1);
+      u[1] = gRandom->Uniform(1);
+    }
+    Double_t cost = TMath::Cos(theta * TMath::DegToRad());
+    Double_t ran = cost + (1 - cost) * u[0];
     Double_t theta_ = TMath::ACos(ran);
-    Double_t phi = gRandom->Uniform(0, TMath::TwoPi());
+    Double_t phi = TMath::TwoPi() * u[1];
     dir[0] = TMath::Sin(theta_) * TMath::Cos(phi);
     dir[1] = TMath::Sin(theta_) * TMath::Sin(phi);
     dir[2] = TMath::Cos(theta_);
@@ -382,7 +588,8 @@ ARayArray* ARayShooter::RandomSphericalCone(Double_t lambda, Int_t n,
       tr->LocalToMaster(p, new_pos);
     }
 
-    ARay* ray = new ARay(0, lambda, new_pos[0], new_pos[1], new_pos[2], 0,
+    Double_t l = gSampler ? gSampler->GetLambda(lambda, u) : lambda;
+    ARay* ray = new ARay(0, l, new_pos[0], new_pos[1], new_pos[2], 0,
                          new_dir[0], new_dir[1], new_dir[2]);
     array->Add(ray);
   }
@@ -451,6 +658,15 @@ ARayArray* ARayShooter::Rectangle(Double_t lambda, Double_t dx, Double_t dy,
   return array;
 }
 
+//_____________________________________________________________________________
+void ARayShooter::SetSampler(ARaySampler* sampler) {
+  // Set the sampling policy of RandomCircle, RandomCone, RandomRectangle,
+  // RandomSphere, RandomSphericalCone and RandomSquare (not owned). The
+  // shooters use gRandom as before if sampler is 0 (default). See ARaySampler
+  // for the low-discrepancy sequences.
+  gSampler = sampler;
+}
+
 //_____________________________________________________________________________
 ARayArray* ARayShooter::Square(Double_t lambda, Double_t d, Int_t n,
                                TGeoRotation* rot, TGeoTranslation* tr,
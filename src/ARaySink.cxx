@@ -0,0 +1,168 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARaySink
+//
+// Receiver of finished rays. When a sink is set to ARayArray by SetSink, the
+// rays which are no longer running or suspended are handed to the sink and
+// deleted as soon as they are sorted by AOpticsManager, instead of being kept
+// in the arrays of focused, exited, stopped and absorbed rays. The memory
+// usage of long runs stays flat because only the results are accumulated.
+//
+// ARayFunctionSink calls any function or lambda, ARayHistogramSink fills the
+// hit positions of focused rays into a TH2 with their weights, and
+// ARayTreeSink appends the last points and directions of rays to a TTree.
+//
+// ARaySymmetrySink unfolds the rays of a system with n-fold rotational
+// symmetry (e.g. a hexagonal dish, n = 6) before handing them to another
+// sink. Only the rays in the fundamental sector need to be traced, e.g. by
+// ARayGenerator::RandomSector, and each finished ray is rotated by 2pi k/n
+// (k = 0, ..., n - 1) around the symmetry axis. A rotationally symmetric
+// system can be traced with a thin sector and a large n (e.g. 360). The n
+// images have the same weight as the traced ray, so that the sink receives
+// the same distribution as that of the full aperture.
+//
+//   TH2D* h = new TH2D("h", ";X (mm);Y (mm)", 100, -50, 50, 100, -50, 50);
+//   ARayHistogramSink sink(h, AOpticsManager::mm());
+//   for (Int_t i = 0; i < 1000; i++) {
+//     ARayArray* array = ARayShooter::RandomCircle(...);
+//     array->SetSink(&sink);
+//     manager->TraceNonSequential(array);
+//     delete array;
+//   }
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TGeoMatrix.h"
+#include "TH2.h"
+#include "TMath.h"
+#include "TTree.h"
+
+#include "ARay.h"
+#include "ARaySink.h"
+
+ClassImp(ARaySink);
+ClassImp(ARayFunctionSink);
+ClassImp(ARayHistogramSink);
+ClassImp(ARaySymmetrySink);
+ClassImp(ARayTreeSink);
+
+//_____________________________________________________________________________
+void ARayHistogramSink::Fill(const ARay& ray) {
+  if (!fHist or not ray.IsFocused()) return;
+
+  Double_t p[4];
+  ray.GetLastPoint(p);
+  fHist->Fill(p[0] / fUnit, p[1] / fUnit, ray.GetWeight());
+}
+
+//_____________________________________________________________________________
+ARaySymmetrySink::ARaySymmetrySink(ARaySink* sink, Int_t order,
+                                   TGeoRotation* rot, TGeoTranslation* tr)
+    : fSink(sink), fOrder(order < 1 ? 1 : order) {
+  // The symmetry axis is the Z axis rotated by rot and then translated by tr,
+  // as the rays of ARayGenerator and ARayShooter are
+  const Double_t* r = rot ? rot->GetRotationMatrix() : 0;
+  for (Int_t i = 0; i < 3; i++) {
+    fTranslation[i] = tr ? tr->GetTranslation()[i] : 0;
+  }
+
+  // image k = R * Rz(2pi k/n) * R^-1
+  fImage.resize(9 * fOrder);
+  for (Int_t k = 0; k < fOrder; k++) {
+    Double_t phi = TMath::TwoPi() * k / fOrder;
+    Double_t c = TMath::Cos(phi), s = TMath::Sin(phi);
+    Double_t rz[9] = {c, -s, 0, s, c, 0, 0, 0, 1};
+    for (Int_t i = 0; i < 3; i++) {
+      for (Int_t j = 0; j < 3; j++) {
+        Double_t sum = 0;
+        for (Int_t a = 0; a < 3; a++) {
+          for (Int_t b = 0; b < 3; b++) {
+            Double_t ria = r ? r[3 * i + a] : (i == a ? 1 : 0);
+            Double_t rjb = r ? r[3 * j + b] : (j == b ? 1 : 0);
+            sum += ria * rz[3 * a + b] * rjb;
+          }
+        }
+        fImage[9 * k + 3 * i + j] = sum;
+      }
+    }
+  }
+}
+
+//_____________________________________________________________________________
+void ARaySymmetrySink::Fill(const ARay& ray) {
+  if (!fSink) return;
+  if (fOrder == 1) {
+    fSink->Fill(ray);
+    return;
+  }
+
+  Double_t p[4], d[3];
+  ray.GetLastPoint(p);
+  ray.GetDirection(d);
+  Double_t local[3];
+  for (Int_t i = 0; i < 3; i++) local[i] = p[i] - fTranslation[i];
+
+  for (Int_t k = 0; k < fOrder; k++) {
+    const Double_t* m = &fImage[9 * k];
+    Double_t x[3], v[3];
+    for (Int_t i = 0; i < 3; i++) {
+      x[i] = fTranslation[i] + m[3 * i] * local[0] + m[3 * i + 1] * local[1] +
+             m[3 * i + 2] * local[2];
+      v[i] = m[3 * i] * d[0] + m[3 * i + 1] * d[1] + m[3 * i + 2] * d[2];
+    }
+    // Only the last point and the direction are unfolded
+    ARay image(ray.GetId(), ray.GetLambda(), x[0], x[1], x[2], p[3], v[0],
+               v[1], v[2]);
+    image.SetWeight(ray.GetWeight());
+    if (ray.IsFocused()) {
+      image.Focus();
+    } else if (ray.IsExited()) {
+      image.Exit();
+    } else if (ray.IsStopped()) {
+      image.Stop();
+    } else if (ray.IsAbsorbed()) {
+      image.Absorb();
+    } else if (ray.IsSuspended()) {
+      image.Suspend();
+    }
+    fSink->Fill(image);
+  }
+}
+
+//_____________________________________________________________________________
+ARayTreeSink::ARayTreeSink(TTree* tree, Bool_t focusedOnly)
+    : fTree(tree), fFocusedOnly(focusedOnly) {
+  // Create the branches x, y, z, t, dx, dy, dz, lambda and weight in tree.
+  // The branch focused is also created unless focusedOnly is kTRUE.
+  if (!fTree) return;
+
+  fTree->Branch("x", &fPoint[0], "x/D");
+  fTree->Branch("y", &fPoint[1], "y/D");
+  fTree->Branch("z", &fPoint[2], "z/D");
+  fTree->Branch("t", &fPoint[3], "t/D");
+  fTree->Branch("dx", &fDirection[0], "dx/D");
+  fTree->Branch("dy", &fDirection[1], "dy/D");
+  fTree->Branch("dz", &fDirection[2], "dz/D");
+  fTree->Branch("lambda", &fLambda, "lambda/D");
+  fTree->Branch("weight", &fWeight, "weight/D");
+  if (not fFocusedOnly) fTree->Branch("focused", &fFocused, "focused/O");
+}
+
+//_____________________________________________________________________________
+void ARayTreeSink::Fill(const ARay& ray) {
+  if (!fTree) return;
+
+  fFocused = ray.IsFocused();
+  if (fFocusedOnly and not fFocused) return;
+
+  ray.GetLastPoint(fPoint);
+  ray.GetDirection(fDirection);
+  fLambda = ray.GetLambda();
+  fWeight = ray.GetWeight();
+  fTree->Fill();
+}
@@ -0,0 +1,227 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ARayWriter
+//
+// Writer of the final states of traced photons. When a writer is given to
+// AOpticsManager::SetWriter, each photon finished by TraceNonSequential
+// (ARayArray, APhotonBuffer and ARayGenerator alike) is written while the
+// tracing threads are running, so that no result has to be kept in memory or
+// looped over afterward.
+//
+// The tree is columnar: an entry holds a block of up to blockSize photons
+// with the branches
+//
+//   n                   number of photons in the block
+//   x, y, z, t          [n] final point and time
+//   dx, dy, dz          [n] final direction
+//   lambda, weight      [n] wavelength and statistical weight
+//   status, npoints     [n] final status (ARay::kFocus etc.) and number of
+//                       points
+//   nnodes              [n] length of the compact node history of each photon
+//   nhistory, nodes     concatenated node IDs of the photons (see
+//                       AOpticsManager::GetNodeName)
+//
+// where the last three are created only if history is kTRUE, and are filled
+// only for ARay traced with AOpticsManager::EnableCompactHistory(kTRUE). The
+// baskets are compressed by the file of the tree as usual.
+//
+// Tracing threads fill blocks of their own, and take the lock of the tree
+// only to write a block when it is full or at the end of each chunk of rays
+// (see AOpticsManager::SetChunkSize). Call ROOT::EnableThreadSafety() before
+// tracing in multithread mode, since the tree is then filled from the
+// worker threads.
+//
+//   TFile file("result.root", "recreate");
+//   TTree tree("photons", "photons");
+//   ARayWriter writer(&tree);
+//   manager->SetWriter(&writer);
+//   manager->TraceNonSequential(buffer);
+//   manager->SetWriter(0);
+//   tree.Write();
+//
+// The columns can be read back, e.g. as arrays by RDataFrame.
+//
+// This uses TTree rather than RNTuple, whose writer API is not stable over
+// the ROOT versions supported by ROBAST.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TString.h"
+#include "TTree.h"
+
+#include "APhotonBuffer.h"
+#include "ARay.h"
+#include "ARayWriter.h"
+
+ClassImp(ARayWriter);
+
+//_____________________________________________________________________________
+void ARayWriter::Block::Clear() {
+  fX.clear();
+  fY.clear();
+  fZ.clear();
+  fT.clear();
+  fDx.clear();
+  fDy.clear();
+  fDz.clear();
+  fLambda.clear();
+  fWeight.clear();
+  fStatus.clear();
+  fNpoints.clear();
+  fNnodes.clear();
+  fNodes.clear();
+}
+
+//_____________________________________________________________________________
+ARayWriter::ARayWriter(TTree* tree, Bool_t focusedOnly, Bool_t history,
+                       Int_t blockSize)
+    : fTree(tree),
+      fFocusedOnly(focusedOnly),
+      fHistory(history),
+      fBlockSize(blockSize > 0 ? blockSize : 4096),
+      fN(0),
+      fNhistory(0),
+      fNwritten(0) {
+  // Create the branches in tree. The addresses of the arrays are given block
+  // by block in Write.
+  if (!fTree) return;
+
+  fTree->Branch("n", &fN, "n/I");
+  const char* doubles[] = {"x",  "y",  "z",      "t",     "dx",
+                           "dy", "dz", "lambda", "weight"};
+  for (Int_t i = 0; i < 9; i++) {
+    fTree->Branch(doubles[i], (void*)&fN, Form("%s[n]/D", doubles[i]));
+  }
+  fTree->Branch("status", (void*)&fN, "status[n]/I");
+  fTree->Branch("npoints", (void*)&fN, "npoints[n]/I");
+  if (fHistory) {
+    fTree->Branch("nnodes", (void*)&fN, "nnodes[n]/I");
+    fTree->Branch("nhistory", &fNhistory, "nhistory/I");
+    fTree->Branch("nodes", (void*)&fN, "nodes[nhistory]/I");
+  }
+}
+
+//_____________________________________________________________________________
+void ARayWriter::Fill(const ARay& ray) {
+  // Add a finished ray to the block of the calling thread
+  if (not ray.IsFocused() and (fFocusedOnly or ray.IsRunning() or
+                               ray.IsSuspended())) {
+    return;
+  }
+
+  Block& block = GetBlock();
+  Double_t x[4], d[3];
+  ray.GetLastPoint(x);
+  ray.GetDirection(d);
+  block.fX.push_back(x[0]);
+  block.fY.push_back(x[1]);
+  block.fZ.push_back(x[2]);
+  block.fT.push_back(x[3]);
+  block.fDx.push_back(d[0]);
+  block.fDy.push_back(d[1]);
+  block.fDz.push_back(d[2]);
+  block.fLambda.push_back(ray.GetLambda());
+  block.fWeight.push_back(ray.GetWeight());
+  block.fStatus.push_back(ray.GetStatus());
+  block.fNpoints.push_back(ray.GetNpoints());
+  if (fHistory) {
+    const std::vector<Int_t>& nodes = ray.GetNodeIDHistory();
+    block.fNnodes.push_back(nodes.size());
+    block.fNodes.insert(block.fNodes.end(), nodes.begin(), nodes.end());
+  }
+
+  if (block.GetN() >= fBlockSize) Write(block);
+}
+
+//_____________________________________________________________________________
+void ARayWriter::Fill(const APhotonBuffer& buffer, Int_t i) {
+  // Add the i-th photon of buffer to the block of the calling thread if it
+  // has finished
+  if (not buffer.IsFocused(i) and (fFocusedOnly or buffer.IsRunning(i) or
+                                   buffer.IsSuspended(i))) {
+    return;
+  }
+
+  Block& block = GetBlock();
+  block.fX.push_back(buffer.GetX(i));
+  block.fY.push_back(buffer.GetY(i));
+  block.fZ.push_back(buffer.GetZ(i));
+  block.fT.push_back(buffer.GetT(i));
+  block.fDx.push_back(buffer.GetDx(i));
+  block.fDy.push_back(buffer.GetDy(i));
+  block.fDz.push_back(buffer.GetDz(i));
+  block.fLambda.push_back(buffer.GetLambda(i));
+  block.fWeight.push_back(buffer.GetWeight(i));
+  block.fStatus.push_back(buffer.GetStatus(i));
+  block.fNpoints.push_back(buffer.GetNpoints(i));
+  if (fHistory) block.fNnodes.push_back(0);
+
+  if (block.GetN() >= fBlockSize) Write(block);
+}
+
+//_____________________________________________________________________________
+void ARayWriter::FlushThreadBuffers() {
+  // Write the blocks of the calling thread even if they are not full. This is
+  // called by AOpticsManager at the end of each tracing task.
+  std::vector<std::pair<ARayWriter*, Block>>& buffers = GetThreadBuffers();
+  for (std::size_t i = 0; i < buffers.size(); i++) {
+    if (buffers[i].second.GetN() > 0) buffers[i].first->Write(buffers[i].second);
+  }
+  buffers.clear();
+}
+
+//_____________________________________________________________________________
+ARayWriter::Block& ARayWriter::GetBlock() {
+  std::vector<std::pair<ARayWriter*, Block>>& buffers = GetThreadBuffers();
+  for (std::size_t i = 0; i < buffers.size(); i++) {
+    if (buffers[i].first == this) return buffers[i].second;
+  }
+
+  buffers.push_back(std::make_pair(this, Block()));
+  return buffers.back().second;
+}
+
+//_____________________________________________________________________________
+std::vector<std::pair<ARayWriter*, ARayWriter::Block>>&
+ARayWriter::GetThreadBuffers() {
+  // Buffers are empty between tracing calls, so that no buffer refers to a
+  // deleted writer
+  thread_local std::vector<std::pair<ARayWriter*, Block>> buffers;
+
+  return buffers;
+}
+
+//_____________________________________________________________________________
+void ARayWriter::Write(Block& block) {
+  // Write a block as an entry of the tree, and clear it
+  if (fTree) {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fN = block.GetN();
+    fNhistory = block.fNodes.size();
+    fTree->SetBranchAddress("x", block.fX.data());
+    fTree->SetBranchAddress("y", block.fY.data());
+    fTree->SetBranchAddress("z", block.fZ.data());
+    fTree->SetBranchAddress("t", block.fT.data());
+    fTree->SetBranchAddress("dx", block.fDx.data());
+    fTree->SetBranchAddress("dy", block.fDy.data());
+    fTree->SetBranchAddress("dz", block.fDz.data());
+    fTree->SetBranchAddress("lambda", block.fLambda.data());
+    fTree->SetBranchAddress("weight", block.fWeight.data());
+    fTree->SetBranchAddress("status", block.fStatus.data());
+    fTree->SetBranchAddress("npoints", block.fNpoints.data());
+    if (fHistory) {
+      fTree->SetBranchAddress("nnodes", block.fNnodes.data());
+      // nodes may be empty, whose data() can be null
+      fTree->SetBranchAddress("nodes", fNhistory > 0 ? block.fNodes.data()
+                                                     : (Int_t*)&fNhistory);
+    }
+    fTree->Fill();
+    fNwritten += fN;
+  }
+  block.Clear();
+}
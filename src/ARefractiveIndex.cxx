@@ -9,10 +9,47 @@
 //
 // Abstract class for refractive index
 //
+// The refractive index and the extinction coefficient can be baked into
+// tables on a uniform wavelength grid by BakeTable, which are used by ALens
+// during ray tracing instead of TGraph::Eval or the dispersion formulae.
+// The tables must be baked again after the parameters are changed.
+//
+// The array versions of GetRefractiveIndex and GetExtinctionCoefficient
+// evaluate many wavelengths (e.g., all the photons of a CORSIKA bunch) in
+// one virtual call. The analytic formulae override them with plain loops
+// that the compiler can vectorize.
+//
+// Tables read from data files (see ARefractiveIndexDotInfo and
+// AFilmetrixDotCom) are parsed only once per process. Materials made from the
+// same file share the same TGraph objects, which must not be modified. Use
+// SetRefractiveIndex or SetExtinctionCoefficient to replace them instead.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "TSystem.h"
+
 #include "ARefractiveIndex.h"
 #include "AOpticsManager.h"
+#include "AStreamerUtil.h"
+
+namespace {
+
+struct SharedTables {
+  Long64_t fSize;  // size and modification time of the file when parsed
+  Long_t fMtime;
+  std::shared_ptr<TGraph> fN;
+  std::shared_ptr<TGraph> fK;  // 0 if the file has no extinction coefficient
+};
+
+std::mutex gSharedTablesMutex;
+std::map<std::pair<std::string, void*>, SharedTables> gSharedTables;
+
+}  // namespace
 
 ClassImp(ARefractiveIndex);
 
@@ -26,6 +63,55 @@ ARefractiveIndex::ARefractiveIndex(Double_t n, Double_t k) {
   }
 }
 
+//______________________________________________________________________________
+Bool_t ARefractiveIndex::BakeTable(Double_t lambdaMin, Double_t lambdaMax,
+                                   Double_t tolerance) {
+  // Resample the refractive index and the extinction coefficient over
+  // [lambdaMin, lambdaMax] until they deviate from the original values by
+  // less than tolerance. The tables are discarded if it fails.
+  auto knots = [](const std::shared_ptr<TGraph>& graph) {
+    return graph ? std::vector<Double_t>(graph->GetX(),
+                                         graph->GetX() + graph->GetN())
+                 : std::vector<Double_t>();
+  };
+  Bool_t ok =
+      fTableN.Bake([this](Double_t x) { return GetRefractiveIndex(x); },
+                   lambdaMin, lambdaMax, tolerance, knots(fRefractiveIndex)) and
+      fTableK.Bake([this](Double_t x) { return GetExtinctionCoefficient(x); },
+                   lambdaMin, lambdaMax, tolerance,
+                   knots(fExtinctionCoefficient));
+  if (not ok) {
+    Warning("BakeTable", "Failed to reach the tolerance (%g)", tolerance);
+    ClearTable();
+  }
+
+  return ok;
+}
+
+//______________________________________________________________________________
+void ARefractiveIndex::ClearSharedTables() {
+  // Forget the tables parsed so far. Materials already made keep theirs.
+  std::lock_guard<std::mutex> lock(gSharedTablesMutex);
+  gSharedTables.clear();
+}
+
+//______________________________________________________________________________
+Bool_t ARefractiveIndex::CountMemory(AMemoryUtil::Counter& counter) const {
+  // Add the bytes of this object, its TGraphs and baked tables to counter.
+  // Returns kFALSE if this has already been counted. TGraphs shared with
+  // other materials (e.g. by LoadSharedTables) are counted only once.
+  ULong64_t bytes = AMemoryUtil::SizeOf(this) + fTableN.GetMemoryUsage() +
+                    fTableK.GetMemoryUsage();
+  if (not counter.Add(this, bytes)) return kFALSE;
+
+  counter.Add(fRefractiveIndex.get(),
+              AMemoryUtil::SizeOf(fRefractiveIndex.get()));
+  counter.Add(fExtinctionCoefficient.get(),
+              AMemoryUtil::SizeOf(fExtinctionCoefficient.get()));
+
+  return kTRUE;
+}
+
 //______________________________________________________________________________
 Double_t ARefractiveIndex::GetAbbeNumber() const {
   static Double_t nm = AOpticsManager::nm();
@@ -36,3 +122,110 @@ Double_t ARefractiveIndex::GetAbbeNumber() const {
 
   return (nD - 1.) / (nF - nC);
 }
+
+//______________________________________________________________________________
+void ARefractiveIndex::GetExtinctionCoefficient(const Double_t* lambda,
+                                                Double_t* k,
+                                                std::size_t count) const {
+  // Calculate the extinction coefficients at count wavelengths
+  for (std::size_t i = 0; i < count; i++) {
+    k[i] = GetExtinctionCoefficient(lambda[i]);
+  }
+}
+
+//______________________________________________________________________________
+void ARefractiveIndex::GetRefractiveIndex(const Double_t* lambda, Double_t* n,
+                                          std::size_t count) const {
+  // Calculate the refractive indices at count wavelengths
+  for (std::size_t i = 0; i < count; i++) {
+    n[i] = GetRefractiveIndex(lambda[i]);
+  }
+}
+
+//______________________________________________________________________________
+Bool_t ARefractiveIndex::LoadSharedTables(const char* fname,
+                                          TableParser parser) {
+  // Set the tables of a data file parsed by parser. The file is read in one
+  // go and parsed only at the first call, or again after it was modified.
+  TString path = fname;
+  gSystem->ExpandPathName(path);
+  FileStat_t st;
+  if (gSystem->GetPathInfo(path, st) != 0) {
+    Error(ClassName(), "Cannot open %s", fname);
+    return kFALSE;
+  }
+
+  std::pair<std::string, void*> key(path.Data(), (void*)parser);
+  {
+    std::lock_guard<std::mutex> lock(gSharedTablesMutex);
+    auto it = gSharedTables.find(key);
+    if (it != gSharedTables.end() and it->second.fSize == st.fSize and
+        it->second.fMtime == st.fMtime) {
+      fRefractiveIndex = it->second.fN;
+      fExtinctionCoefficient = it->second.fK;
+      ClearTable();
+      return kTRUE;
+    }
+  }
+
+  std::ifstream fin(path.Data(), std::ios::binary);
+  if (!fin.is_open()) {
+    Error(ClassName(), "Cannot open %s", fname);
+    return kFALSE;
+  }
+  std::string text;
+  fin.seekg(0, std::ios::end);
+  text.resize(std::size_t(fin.tellg()));
+  fin.seekg(0, std::ios::beg);
+  fin.read(&text[0], text.size());
+
+  SharedTables tables;
+  tables.fSize = st.fSize;
+  tables.fMtime = st.fMtime;
+  tables.fN = std::make_shared<TGraph>();
+  tables.fK = std::make_shared<TGraph>();
+  if (not parser(text, *tables.fN, *tables.fK)) {
+    Error(ClassName(), "Invalid data format");
+    return kFALSE;
+  }
+  if (tables.fK->GetN() == 0) tables.fK.reset();
+
+  {
+    // Another thread may have parsed the same file meanwhile, which is fine
+    std::lock_guard<std::mutex> lock(gSharedTablesMutex);
+    gSharedTables[key] = tables;
+  }
+  fRefractiveIndex = tables.fN;
+  fExtinctionCoefficient = tables.fK;
+  ClearTable();
+
+  return kTRUE;
+}
+
+//______________________________________________________________________________
+void ARefractiveIndex::Streamer(TBuffer& R__b) {
+  // The data graphs shared with other materials are written once, and the
+  // baked tables are kept so that they need not be baked again
+  if (R__b.IsReading()) {
+    UInt_t R__s, R__c;
+    Version_t R__v = R__b.ReadVersion(&R__s, &R__c);
+    if (R__v < 2) {
+      R__b.ReadClassBuffer(ARefractiveIndex::Class(), this, R__v, R__s, R__c);
+      return;
+    }
+    TObject::Streamer(R__b);
+    AStreamerUtil::ReadShared(R__b, fRefractiveIndex);
+    AStreamerUtil::ReadShared(R__b, fExtinctionCoefficient);
+    AStreamerUtil::StreamTable(R__b, fTableN);
+    AStreamerUtil::StreamTable(R__b, fTableK);
+    R__b.CheckByteCount(R__s, R__c, ARefractiveIndex::IsA());
+  } else {
+    UInt_t R__c = R__b.WriteVersion(ARefractiveIndex::IsA(), kTRUE);
+    TObject::Streamer(R__b);
+    AStreamerUtil::WriteShared(R__b, fRefractiveIndex);
+    AStreamerUtil::WriteShared(R__b, fExtinctionCoefficient);
+    AStreamerUtil::StreamTable(R__b, fTableN);
+    AStreamerUtil::StreamTable(R__b, fTableK);
+    R__b.SetByteCount(R__c, kTRUE);
+  }
+}
@@ -11,95 +11,77 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
-#include <fstream>
-#include <iostream>
-
-#include "TSystem.h"
+#include <cstdlib>
+#include <cstring>
 
 #include "AOpticsManager.h"
 #include "ARefractiveIndexDotInfo.h"
 
 ClassImp(ARefractiveIndexDotInfo);
 
-ARefractiveIndexDotInfo::ARefractiveIndexDotInfo(const char* fname)
-    : ARefractiveIndex() {
-  std::ifstream fin;
-  fin.open(gSystem->ExpandPathName(fname));
-
-  if (!fin.is_open()) {
-    Error("ARefractiveIndexDotInfo", "Cannot open %s", fname);
-    return;
-  }
-
-  char buf[50];
-  fin.getline(buf, 50);
-
-  bool CSV;      // comma separated values
-  bool CRLF;     // delimiter \r\n
-  char S = ',';  // separator
-  if (strcmp(buf, "wl,n\r") == 0) {
-    CSV = true;
-    CRLF = true;
-  } else if (strcmp(buf, "wl,n") == 0) {
-    CSV = true;
-    CRLF = false;  // \n
-  } else if (strcmp(buf, "wl\tn\r") == 0) {
-    CSV = false;  // TSV, tab separated values
-    S = '\t';
-    CRLF = true;
-  } else if (strcmp(buf, "wl\tn") == 0) {
-    CSV = false;  // TSV, tab separated values
-    S = '\t';
-    CRLF = false;
+namespace {
+
+Bool_t ParseDotInfo(const std::string& text, TGraph& n, TGraph& k) {
+  // Read the columns of wavelength (um) and n, optionally followed by those of
+  // wavelength and k, separated by commas (CSV) or tabs (TSV). Lines end with
+  // either \n or \r\n.
+  const char* p = text.c_str();
+  const char* end = p + text.size();
+
+  // Return the next line without the line break
+  auto next_line = [&p, end](std::string& line) {
+    if (p >= end) return kFALSE;
+    const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (!eol) eol = end;
+    const char* last = eol;
+    if (last > p and last[-1] == '\r') last--;
+    line.assign(p, last);
+    p = eol + 1;
+    return kTRUE;
+  };
+
+  std::string line;
+  if (not next_line(line)) return kFALSE;
+
+  char S;  // separator
+  if (line == "wl,n") {
+    S = ',';  // comma separated values
+  } else if (line == "wl\tn") {
+    S = '\t';  // TSV, tab separated values
   } else {
-    Error("ARefractiveIndexDotInfo", "Invalid data format");
-    return;
+    return kFALSE;
   }
+  std::string kheader = std::string("wl") + S + "k";
 
-  fRefractiveIndex = std::make_shared<TGraph>();
+  TGraph* graph = &n;
+  while (next_line(line)) {
+    if (graph == &n and line == kheader) {
+      graph = &k;
+      continue;
+    }
 
-  while (1) {
-    double wl, n;
     char* endptr;
-    fin.getline(buf, 50, S);
-    wl = strtod(buf, &endptr);
-    if (*endptr != '\0') {  // cannot convert to double
+    Double_t wl = strtod(line.c_str(), &endptr);
+    if (endptr == line.c_str() or *endptr != S) {  // cannot convert to double
       break;
     }
-    fin.getline(buf, 50, CRLF ? '\r' : '\n');
-    n = strtod(buf, &endptr);
-    if (*endptr != '\0') {  // cannot convert to double
+    const char* value = endptr + 1;
+    Double_t v = strtod(value, &endptr);
+    if (endptr == value or *endptr != '\0') {  // cannot convert to double
       break;
     }
 
-    fRefractiveIndex->SetPoint(fRefractiveIndex->GetN(),
-                               wl * AOpticsManager::um(), n);
-  }
-
-  // Check if extinction coefficient data exists
-  fin.getline(buf, 50, CRLF ? '\r' : '\n');
-  // "wl," or "wl\t" should have been alread read in the previous while loop
-  if (strcmp(buf, "k") != 0) {
-    return;
+    graph->SetPoint(graph->GetN(), wl * AOpticsManager::um(), v);
   }
 
-  fExtinctionCoefficient = std::make_shared<TGraph>();
+  return kTRUE;
+}
 
-  while (1) {
-    double wl, k;
-    char* endptr;
-    fin.getline(buf, 50, S);
-    wl = strtod(buf, &endptr);
-    if (*endptr != '\0') {  // cannot convert to double
-      break;
-    }
-    fin.getline(buf, 50, CRLF ? '\r' : '\n');
-    k = strtod(buf, &endptr);
-    if (*endptr != '\0') {  // cannot convert to double
-      break;
-    }
+}  // namespace
 
-    fExtinctionCoefficient->SetPoint(fExtinctionCoefficient->GetN(),
-                                     wl * AOpticsManager::um(), k);
-  }
+ARefractiveIndexDotInfo::ARefractiveIndexDotInfo(const char* fname)
+    : ARefractiveIndex() {
+  // The file is parsed once per process, and the tables are shared by all the
+  // materials made from it (see ARefractiveIndex::LoadSharedTables)
+  LoadSharedTables(fname, ParseDotInfo);
 }
@@ -16,6 +16,8 @@
 #include "AOpticsManager.h"
 #include "TMath.h"
 
+#include <cmath>
+
 ClassImp(ASchottFormula);
 
 ASchottFormula::ASchottFormula() : ARefractiveIndex() {}
@@ -47,9 +49,24 @@ Double_t ASchottFormula::GetRefractiveIndex(Double_t lambda) const {
   // n(lambda)^2 = A0 + A1*lamda^2 + A2*lamda^-2 + A3*lamda^-4 + A4*lamda^-6 +
   // A5*lamda^-8 where lambda is measured in (um)
   lambda /= AOpticsManager::um();  // Convert (nm) to (um)
-  return TMath::Sqrt(fPar[0] + fPar[1] * TMath::Power(lambda, 2.) +
-                     fPar[2] * TMath::Power(lambda, -2.) +
-                     fPar[3] * TMath::Power(lambda, -4.) +
-                     fPar[4] * TMath::Power(lambda, -6.) +
-                     fPar[5] * TMath::Power(lambda, -8.));
+  Double_t x = lambda * lambda;
+  Double_t y = 1. / x;
+  return TMath::Sqrt(fPar[0] + fPar[1] * x +
+                     y * (fPar[2] +
+                          y * (fPar[3] + y * (fPar[4] + y * fPar[5]))));
+}
+
+//_____________________________________________________________________________
+void ASchottFormula::GetRefractiveIndex(const Double_t* lambda, Double_t* n,
+                                        std::size_t count) const {
+  // Calculate the refractive indices at count wavelengths
+  const Double_t um = AOpticsManager::um();
+  const Double_t A0 = fPar[0], A1 = fPar[1], A2 = fPar[2];
+  const Double_t A3 = fPar[3], A4 = fPar[4], A5 = fPar[5];
+  for (std::size_t i = 0; i < count; i++) {
+    Double_t l = lambda[i] / um;
+    Double_t x = l * l;
+    Double_t y = 1. / x;
+    n[i] = std::sqrt(A0 + A1 * x + y * (A2 + y * (A3 + y * (A4 + y * A5))));
+  }
 }
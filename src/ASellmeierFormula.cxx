@@ -17,6 +17,8 @@
 #include "TMath.h"
 #include "TROOT.h"
 
+#include <cmath>
+
 ClassImp(ASellmeierFormula);
 
 ASellmeierFormula::ASellmeierFormula() : ARefractiveIndex() {}
@@ -53,6 +55,22 @@ Double_t ASellmeierFormula::GetRefractiveIndex(Double_t lambda) const {
                      fPar[2] * lambda2 / (lambda2 - fPar[5]));
 }
 
+//______________________________________________________________________________
+void ASellmeierFormula::GetRefractiveIndex(const Double_t* lambda, Double_t* n,
+                                           std::size_t count) const {
+  // Calculate the refractive indices at count wavelengths. The parameters are
+  // copied to locals so that the loop has no loads other than lambda.
+  const Double_t um = AOpticsManager::um();
+  const Double_t B1 = fPar[0], B2 = fPar[1], B3 = fPar[2];
+  const Double_t C1 = fPar[3], C2 = fPar[4], C3 = fPar[5];
+  for (std::size_t i = 0; i < count; i++) {
+    Double_t l = lambda[i] / um;
+    Double_t l2 = l * l;
+    n[i] = std::sqrt(1 + B1 * l2 / (l2 - C1) + B2 * l2 / (l2 - C2) +
+                     B3 * l2 / (l2 - C3));
+  }
+}
+
 //______________________________________________________________________________
 TF1* ASellmeierFormula::FitData(TGraph* graph, const char* tf1name,
                                 Option_t* option) {
@@ -0,0 +1,61 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// AStreamerUtil                                                              //
+//                                                                            //
+// Helpers of the custom streamers for std::shared_ptr members and tables     //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <mutex>
+#include <unordered_map>
+
+#include "ALookupTable.h"
+#include "AStreamerUtil.h"
+
+namespace {
+
+// Objects read by ReadShared and their owners. ROOT returns the same address
+// for each reference to an object in a buffer, which must then share the
+// control block of the first reference.
+std::mutex gSharedMutex;
+std::unordered_map<const void*, std::weak_ptr<void>> gShared;
+
+}  // namespace
+
+namespace AStreamerUtil {
+
+//_____________________________________________________________________________
+std::shared_ptr<void> FindShared(const void* ptr) {
+  std::lock_guard<std::mutex> lock(gSharedMutex);
+  auto it = gShared.find(ptr);
+  if (it == gShared.end()) return std::shared_ptr<void>();
+
+  std::shared_ptr<void> shared = it->second.lock();
+  if (not shared) gShared.erase(it);  // deleted, the address may be reused
+
+  return shared;
+}
+
+//_____________________________________________________________________________
+void RegisterShared(const std::shared_ptr<void>& ptr) {
+  std::lock_guard<std::mutex> lock(gSharedMutex);
+  if (gShared.size() > 1024) {
+    // forget the objects already deleted
+    for (auto it = gShared.begin(); it != gShared.end();) {
+      it = it->second.expired() ? gShared.erase(it) : std::next(it);
+    }
+  }
+  gShared[ptr.get()] = ptr;
+}
+
+//_____________________________________________________________________________
+void StreamTable(TBuffer& b, ALookupTable& table) {
+  // Read or write a baked table, so that it need not be baked again
+  b.StreamObject(&table, TClass::GetClass(typeid(ALookupTable)));
+}
+
+}  // namespace AStreamerUtil
@@ -0,0 +1,190 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AThreadPool
+//
+// Fixed number of worker threads processing a queue of tasks. The threads are
+// started in the constructor and kept alive until the pool is deleted, so that
+// per-thread resources (e.g. TGeoNavigator) can be prepared only once by the
+// init function and released by the fini function.
+//
+// If ROOT is built with TBB and implicit multithreading has been enabled by
+// ROOT::EnableImplicitMT when the pool is created, no threads are started.
+// The tasks are instead run in a ROOT::Experimental::TTaskGroup, i.e., in the
+// process-wide task arena of ROOT shared with RDataFrame, parallel TTree I/O
+// and so on, so that ROBAST does not oversubscribe the cores. init is then
+// called before each task, as the tasks may run on any thread of the arena
+// (including the one calling Wait), and fini is not called. The owner must
+// release what init made after deleting the pool, as the threads of the arena
+// outlive it (see AOpticsManager::StopWorkers). This can be turned off by
+// SetUseImplicitMT(kFALSE).
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RConfigure.h"
+#include "RVersion.h"
+
+#include "AThreadPool.h"
+
+#if defined(R__USE_IMT) && ROOT_VERSION_CODE >= ROOT_VERSION(6, 14, 0)
+#define A_THREAD_POOL_IMT
+#include "ROOT/TTaskGroup.hxx"
+#include "TROOT.h"
+#endif
+
+Bool_t AThreadPool::fgUseImplicitMT = kTRUE;
+
+//_____________________________________________________________________________
+AThreadPool::AThreadPool(std::size_t nthreads, std::function<void()> init,
+                         std::function<void()> fini)
+    : fNbusy(0), fStop(kFALSE) {
+  // init and fini are called in each worker thread when it starts and stops
+#ifdef A_THREAD_POOL_IMT
+  if (IsImplicitMTEnabled()) {
+    fInit = init;
+    fGroup.reset(new ROOT::Experimental::TTaskGroup);
+    return;
+  }
+#endif
+
+  if (nthreads == 0) nthreads = 1;
+  for (std::size_t i = 0; i < nthreads; ++i) {
+    fThreads.emplace_back(&AThreadPool::Work, this, init, fini);
+  }
+}
+
+//_____________________________________________________________________________
+AThreadPool::~AThreadPool() {
+  // Remaining tasks are processed before the threads are joined
+#ifdef A_THREAD_POOL_IMT
+  if (fGroup) {
+    fGroup->Wait();
+    return;
+  }
+#endif
+
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fStop = kTRUE;
+  }
+  fTaskCondition.notify_all();
+  for (auto& thread : fThreads) {
+    thread.join();
+  }
+}
+
+//_____________________________________________________________________________
+std::size_t AThreadPool::GetImplicitMTPoolSize() {
+  // Number of threads of the task arena of ROOT, or 0 if implicit
+  // multithreading is not available
+#ifdef A_THREAD_POOL_IMT
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 22, 0)
+  return ROOT::GetThreadPoolSize();
+#else
+  return ROOT::GetImplicitMTPoolSize();
+#endif
+#else
+  return 0;
+#endif
+}
+
+//_____________________________________________________________________________
+Bool_t AThreadPool::IsImplicitMTEnabled() {
+  // Return kTRUE if the pools created now run their tasks in the task arena
+  // of ROOT
+#ifdef A_THREAD_POOL_IMT
+  return fgUseImplicitMT and ROOT::IsImplicitMTEnabled();
+#else
+  return kFALSE;
+#endif
+}
+
+//_____________________________________________________________________________
+void AThreadPool::Push(std::function<void()> task) {
+#ifdef A_THREAD_POOL_IMT
+  if (fGroup) {
+    fGroup->Run([this, task]() { Run(task); });
+    return;
+  }
+#endif
+
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fTasks.push_back(std::move(task));
+  }
+  fTaskCondition.notify_one();
+}
+
+//_____________________________________________________________________________
+void AThreadPool::Run(const std::function<void()>& task) {
+  // Run task in a thread of the arena, keeping its exception for Wait
+  try {
+    if (fInit) fInit();
+    task();
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(fMutex);
+    if (not fException) fException = std::current_exception();
+  }
+}
+
+//_____________________________________________________________________________
+void AThreadPool::Wait() {
+  // Block until all the queued tasks are finished. If a task has thrown an
+  // exception, it is rethrown here.
+#ifdef A_THREAD_POOL_IMT
+  if (fGroup) {
+    fGroup->Wait();  // the calling thread also runs tasks meanwhile
+    std::lock_guard<std::mutex> lock(fMutex);
+    if (fException) {
+      std::exception_ptr e = fException;
+      fException = nullptr;
+      std::rethrow_exception(e);
+    }
+    return;
+  }
+#endif
+
+  std::unique_lock<std::mutex> lock(fMutex);
+  fIdleCondition.wait(lock, [this] { return fTasks.empty() and fNbusy == 0; });
+  if (fException) {
+    std::exception_ptr e = fException;
+    fException = nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+//_____________________________________________________________________________
+void AThreadPool::Work(std::function<void()> init, std::function<void()> fini) {
+  if (init) init();
+
+  while (kTRUE) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(fMutex);
+      fTaskCondition.wait(lock, [this] { return fStop or not fTasks.empty(); });
+      if (fTasks.empty()) break;  // stopped and nothing left to do
+      task = std::move(fTasks.front());
+      fTasks.pop_front();
+      ++fNbusy;
+    }
+
+    try {
+      task();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(fMutex);
+      if (not fException) fException = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      --fNbusy;
+      if (fTasks.empty() and fNbusy == 0) fIdleCondition.notify_all();
+    }
+  }
+
+  if (fini) fini();
+}
@@ -0,0 +1,135 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ATraceCheckpoint
+//
+// Snapshot of the progress of a long tracing campaign, written next to its
+// output so that a job killed on a preemptible node can continue from the
+// last checkpoint instead of repeating hours of work. It records
+//   - the position in the input (file index, last finished event, number of
+//     work units processed) and the number of output entries,
+//   - the states of the random number streams, i.e., the seeds and the call
+//     counters of AOpticsManager (see SetRandomSeed) and a copy of gRandom,
+//   - copies of partially filled histograms (e.g. those of
+//     AFocalPlaneMonitor or ARayHistogramSink).
+// Checkpoints are taken between events, when no rays are being traced, so the
+// running and suspended rays of an event are never part of the state.
+//
+// ACorsikaIACTDriver uses it as follows, and other event loops can do the
+// same.
+//
+//   ATraceCheckpoint checkpoint;
+//   checkpoint.SetPosition(file, event, unit);
+//   checkpoint.SetEntries(tree->GetEntries());
+//   checkpoint.SaveRandom(0, *manager);
+//   checkpoint.SaveGlobalRandom();
+//   checkpoint.AddAccumulator(*hist);
+//   output.WriteTObject(&checkpoint, "checkpoint", "WriteDelete");
+//
+//   // after the restart
+//   ATraceCheckpoint* checkpoint = (ATraceCheckpoint*)input.Get("checkpoint");
+//   checkpoint->RestoreRandom(0, *manager);
+//   checkpoint->RestoreGlobalRandom();
+//   checkpoint->RestoreAccumulator(*hist);
+//   // continue from event checkpoint->GetEvent() + 1
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TH1.h"
+#include "TRandom.h"
+
+#include "AOpticsManager.h"
+#include "ATraceCheckpoint.h"
+
+ClassImp(ATraceCheckpoint);
+
+//_____________________________________________________________________________
+ATraceCheckpoint::ATraceCheckpoint()
+    : fFile(0), fEvent(0), fUnit(0), fNtraced(0), fEntries(0), fRandom(0) {
+  fAccumulators.SetOwner(kTRUE);
+}
+
+//_____________________________________________________________________________
+ATraceCheckpoint::~ATraceCheckpoint() {
+  SafeDelete(fRandom);
+  fAccumulators.Delete();
+}
+
+//_____________________________________________________________________________
+void ATraceCheckpoint::AddAccumulator(const TH1& hist) {
+  // Add a copy of hist, which is restored by RestoreAccumulator of the
+  // histogram of the same name
+  TH1* copy = static_cast<TH1*>(hist.Clone());
+  copy->SetDirectory(0);
+  fAccumulators.Add(copy);
+}
+
+//_____________________________________________________________________________
+Bool_t ATraceCheckpoint::RestoreAccumulator(TH1& hist) const {
+  // Replace the contents of hist with those of the saved copy of the same
+  // name. Returns kFALSE if there is no such copy.
+  const TH1* copy = dynamic_cast<const TH1*>(
+      fAccumulators.FindObject(hist.GetName()));
+  if (!copy) return kFALSE;
+
+  hist.Reset();
+  hist.Add(copy);
+
+  return kTRUE;
+}
+
+//_____________________________________________________________________________
+Bool_t ATraceCheckpoint::RestoreGlobalRandom() const {
+  // Replace gRandom with the saved copy. Pointers to the old gRandom held by
+  // users become invalid. Returns kFALSE if no copy was saved.
+  if (!fRandom) return kFALSE;
+
+  delete gRandom;
+  gRandom = static_cast<TRandom*>(fRandom->Clone());
+
+  return kTRUE;
+}
+
+//_____________________________________________________________________________
+Bool_t ATraceCheckpoint::RestoreRandom(Int_t key,
+                                       AOpticsManager& manager) const {
+  // Put the random number streams of manager back to the state saved with
+  // key. Returns kFALSE if nothing has been saved with key.
+  for (std::size_t i = 0; i < fKeys.size(); i++) {
+    if (fKeys[i] == key) {
+      manager.SetRandomSeed(fSeeds[i], fNcalls[i]);
+      return kTRUE;
+    }
+  }
+
+  return kFALSE;
+}
+
+//_____________________________________________________________________________
+void ATraceCheckpoint::SaveGlobalRandom() {
+  // Save a copy of gRandom, which is used by AOpticsManager without a seed
+  // and by ACorsikaIACTFile::SamplePhotonCount
+  SafeDelete(fRandom);
+  if (gRandom) fRandom = static_cast<TRandom*>(gRandom->Clone());
+}
+
+//_____________________________________________________________________________
+void ATraceCheckpoint::SaveRandom(Int_t key, const AOpticsManager& manager) {
+  // Save the state of the random number streams of manager with key, e.g. a
+  // telescope number. A manager shared by several keys may be saved once.
+  for (std::size_t i = 0; i < fKeys.size(); i++) {
+    if (fKeys[i] == key) {
+      fSeeds[i] = manager.GetRandomSeed();
+      fNcalls[i] = manager.GetNcalls();
+      return;
+    }
+  }
+
+  fKeys.push_back(key);
+  fSeeds.push_back(manager.GetRandomSeed());
+  fNcalls.push_back(manager.GetNcalls());
+}
@@ -0,0 +1,157 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ATraceFuture
+//
+// Handle of the rays traced in the background by AOpticsManager::TraceAsync.
+// The caller can read the next CORSIKA event, generate the next rays or
+// analyse the previous batch while the tracing threads work, and then call
+// Wait, which gives the rays back to their ARayArray (and its sink) in the
+// calling thread.
+//
+//   ATraceFuture future = manager->TraceAsync(*array);
+//   while (not future.IsDone()) {
+//     // read the next event
+//     std::cout << future.GetProgress() * 100 << "%" << std::endl;
+//   }
+//   future.Wait();  // array->GetFocused() etc. are now filled
+//
+// The arrays must not be touched or deleted, and the geometry must not be
+// modified, until Wait has returned kTRUE. A future destroyed without Wait
+// deletes its rays once the tracing threads have finished.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+
+#include "ARayArray.h"
+#include "ATraceFuture.h"
+
+ClassImp(ATraceFuture);
+
+//_____________________________________________________________________________
+ATraceFuture::State::State()
+    : fNext(0), fNtraced(0), fNtasks(0), fReturned(kFALSE) {
+  fRays.SetOwner(kFALSE);
+}
+
+//_____________________________________________________________________________
+ATraceFuture::State::~State() {
+  // The rays have nowhere to go if they have not been returned
+  if (not fReturned) {
+    for (Int_t i = 0; i <= fRays.GetLast(); i++) delete fRays.UncheckedAt(i);
+  }
+}
+
+//_____________________________________________________________________________
+void ATraceFuture::State::Finish(std::exception_ptr exception) {
+  // Called by each tracing task when it ends
+  std::lock_guard<std::mutex> lock(fMutex);
+  if (exception and not fException) fException = exception;
+  if (--fNtasks == 0) fDone.notify_all();
+}
+
+//_____________________________________________________________________________
+void ATraceFuture::State::Return() {
+  // Sort the traced rays into their arrays again by status. Each array gets
+  // back only its own rays, and its sink receives them as usual.
+  if (fReturned) return;
+  fReturned = kTRUE;
+
+  if (fArrays.size() == 1) {
+    fArrays[0]->Add(fRays, &fStatus);
+    return;
+  }
+
+  for (std::size_t j = 0; j < fArrays.size(); j++) {
+    TObjArray subset(fOffset[j + 1] - fOffset[j]);
+    for (Int_t i = fOffset[j]; i < fOffset[j + 1]; i++) {
+      subset.Add(fRays.UncheckedAt(i));
+    }
+    std::vector<Char_t> substatus(fStatus.begin() + fOffset[j],
+                                  fStatus.begin() + fOffset[j + 1]);
+    fArrays[j]->Add(subset, &substatus);
+  }
+}
+
+//_____________________________________________________________________________
+void ATraceFuture::State::Take(const std::vector<ARayArray*>& arrays) {
+  // Move the running rays of arrays to a compact array so that they can be
+  // handed out to the threads by index. The threads record the final statuses
+  // so that Return can sort the rays in one pass with a single reallocation of
+  // each array of ARayArray.
+  fArrays = arrays;
+  fOffset.assign(1, 0);
+  for (std::size_t j = 0; j < arrays.size(); j++) {
+    TObjArray* running = arrays[j]->GetRunning();
+    Int_t last = running->GetLast();
+    for (Int_t i = 0; i <= last; i++) {
+      ARay* ray = (ARay*)running->RemoveAt(i);
+      if (!ray) continue;
+      fRays.Add(ray);
+    }
+    running->Expand(0);  // shrink the array
+    fOffset.push_back(fRays.GetLast() + 1);
+  }
+  fStatus.resize(GetNrays());
+}
+
+//_____________________________________________________________________________
+Int_t ATraceFuture::GetNrays() const {
+  // Number of the rays being traced
+  return fState ? fState->GetNrays() : 0;
+}
+
+//_____________________________________________________________________________
+Int_t ATraceFuture::GetNtraced() const {
+  // Number of the rays already finished, which can be polled during tracing
+  return fState ? fState->fNtraced.load() : 0;
+}
+
+//_____________________________________________________________________________
+Double_t ATraceFuture::GetProgress() const {
+  // Fraction of the rays already finished
+  Int_t n = GetNrays();
+  return n > 0 ? Double_t(GetNtraced()) / n : 1.;
+}
+
+//_____________________________________________________________________________
+Bool_t ATraceFuture::IsDone() const {
+  // Return kTRUE if all the tracing tasks have finished, i.e., Wait does not
+  // block
+  if (!fState) return kTRUE;
+  std::lock_guard<std::mutex> lock(fState->fMutex);
+  return fState->fNtasks == 0;
+}
+
+//_____________________________________________________________________________
+Bool_t ATraceFuture::Wait(Double_t timeout) {
+  // Block until all the rays are traced, or for at most timeout seconds if
+  // timeout >= 0, and then give the rays back to their arrays. Returns kFALSE
+  // if the timeout has expired first, in which case Wait can be called again.
+  // An exception thrown in a tracing thread is rethrown here once.
+  if (!fState) return kTRUE;
+
+  State& state = *fState;
+  std::exception_ptr exception;
+  {
+    std::unique_lock<std::mutex> lock(state.fMutex);
+    auto done = [&state] { return state.fNtasks == 0; };
+    if (timeout < 0) {
+      state.fDone.wait(lock, done);
+    } else if (not state.fDone.wait_for(
+                   lock, std::chrono::duration<Double_t>(timeout), done)) {
+      return kFALSE;
+    }
+    std::swap(exception, state.fException);
+  }
+
+  state.Return();
+  if (exception) std::rethrow_exception(exception);
+
+  return kTRUE;
+}
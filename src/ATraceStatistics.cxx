@@ -0,0 +1,189 @@
+/******************************************************************************
+ * Copyright (C) 2006-, Akira Okumura                                         *
+ * All rights reserved.                                                       *
+ *****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ATraceStatistics
+//
+// Counters and timers of ray tracing filled by AOpticsManager when the
+// instrumentation is enabled (see AOpticsManager::EnableInstrumentation).
+// Navigation steps, boundary crossings, reflections, refractions, absorptions
+// and the final ray statuses are counted for each node and each node type,
+// together with the wall time spent in the navigation (including the
+// distance calculation of shapes), in the interaction physics and in the
+// interaction at multilayer boundaries. The time is attributed to the node
+// toward which the ray travels.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "TGeoNode.h"
+#include "TH1D.h"
+#include "TMath.h"
+#include "TString.h"
+
+#include "ATraceStatistics.h"
+
+ClassImp(ATraceStatistics);
+
+static const char* kTypeName[ATraceStatistics::kNtypes] = {
+    "Lens", "Obscuration", "Mirror", "FocalSurface",
+    "OpticalComponent", "Other", "Outside"};
+static const char* kCounterName[ATraceStatistics::kNcounters] = {
+    "Step", "Crossing", "Reflection", "Refraction", "Absorption",
+    "Suspension", "Exit", "Stop", "Focus"};
+static const char* kPhaseName[ATraceStatistics::kNphases] = {
+    "Navigation", "Interaction", "Multilayer"};
+
+//_____________________________________________________________________________
+ATraceStatistics::ATraceStatistics() : TObject() {}
+
+//_____________________________________________________________________________
+ATraceStatistics::~ATraceStatistics() {}
+
+//_____________________________________________________________________________
+void ATraceStatistics::Add(const ATraceStatistics& other) {
+  // Add the counters and timers of other, e.g. those filled by another thread
+  for (auto it = other.fNodeRecord.begin(); it != other.fNodeRecord.end();
+       ++it) {
+    Record& record = fNodeRecord[it->first];
+    for (Int_t i = 0; i < kNcounters; i++)
+      record.fCount[i] += it->second.fCount[i];
+    for (Int_t i = 0; i < kNphases; i++) record.fTime[i] += it->second.fTime[i];
+  }
+
+  for (Int_t j = 0; j < kNtypes; j++) {
+    for (Int_t i = 0; i < kNcounters; i++)
+      fTypeRecord[j].fCount[i] += other.fTypeRecord[j].fCount[i];
+    for (Int_t i = 0; i < kNphases; i++)
+      fTypeRecord[j].fTime[i] += other.fTypeRecord[j].fTime[i];
+  }
+}
+
+//_____________________________________________________________________________
+void ATraceStatistics::Clear(Option_t*) {
+  fNodeRecord.clear();
+  for (Int_t j = 0; j < kNtypes; j++) fTypeRecord[j] = Record();
+}
+
+//_____________________________________________________________________________
+ULong64_t ATraceStatistics::GetCount(Int_t counter) const {
+  // Return the total count of all the nodes
+  if (counter < 0 or counter >= kNcounters) return 0;
+
+  ULong64_t n = 0;
+  for (Int_t j = 0; j < kNtypes; j++) n += fTypeRecord[j].fCount[counter];
+
+  return n;
+}
+
+//_____________________________________________________________________________
+ULong64_t ATraceStatistics::GetNodeCount(const TGeoNode* node,
+                                         Int_t counter) const {
+  if (counter < 0 or counter >= kNcounters) return 0;
+
+  auto it = fNodeRecord.find(node);
+  return it != fNodeRecord.end() ? it->second.fCount[counter] : 0;
+}
+
+//_____________________________________________________________________________
+Double_t ATraceStatistics::GetNodeTime(const TGeoNode* node,
+                                       Int_t phase) const {
+  if (phase < 0 or phase >= kNphases) return 0;
+
+  auto it = fNodeRecord.find(node);
+  return it != fNodeRecord.end() ? it->second.fTime[phase] : 0;
+}
+
+//_____________________________________________________________________________
+Double_t ATraceStatistics::GetTime(Int_t phase) const {
+  // Return the total wall time (s) of a phase summed over all the threads
+  if (phase < 0 or phase >= kNphases) return 0;
+
+  Double_t t = 0;
+  for (Int_t j = 0; j < kNtypes; j++) t += fTypeRecord[j].fTime[phase];
+
+  return t;
+}
+
+//_____________________________________________________________________________
+ULong64_t ATraceStatistics::GetTypeCount(Int_t type, Int_t counter) const {
+  // Return the count of a node type (AOpticsManager::kLens etc.)
+  if (type < 0 or type >= kNtypes or counter < 0 or counter >= kNcounters)
+    return 0;
+
+  return fTypeRecord[type].fCount[counter];
+}
+
+//_____________________________________________________________________________
+Double_t ATraceStatistics::GetTypeTime(Int_t type, Int_t phase) const {
+  if (type < 0 or type >= kNtypes or phase < 0 or phase >= kNphases) return 0;
+
+  return fTypeRecord[type].fTime[phase];
+}
+
+//_____________________________________________________________________________
+TH1D* ATraceStatistics::MakeNodeHistogram(Int_t counter) const {
+  // Make a histogram of a counter with one bin per node labeled by the node
+  // name. The histogram must be deleted by the user.
+  if (counter < 0 or counter >= kNcounters) return 0;
+
+  std::vector<std::pair<std::string, ULong64_t> > entries;
+  for (auto it = fNodeRecord.begin(); it != fNodeRecord.end(); ++it) {
+    std::string name = it->first ? it->first->GetName() : "(outside)";
+    entries.push_back(std::make_pair(name, it->second.fCount[counter]));
+  }
+  std::sort(entries.begin(), entries.end());
+
+  Int_t n = TMath::Max(Int_t(entries.size()), 1);
+  TH1D* h = new TH1D(Form("h%s", kCounterName[counter]),
+                     Form("%s;Node;Entries", kCounterName[counter]), n, 0, n);
+  h->SetDirectory(0);
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    h->GetXaxis()->SetBinLabel(i + 1, entries[i].first.c_str());
+    h->SetBinContent(i + 1, entries[i].second);
+  }
+
+  return h;
+}
+
+//_____________________________________________________________________________
+void ATraceStatistics::Print(Option_t*) const {
+  // Print the counters and timers of each node type and each node
+  printf("%-24s", "Type/Node");
+  for (Int_t i = 0; i < kNcounters; i++) printf(" %11s", kCounterName[i]);
+  for (Int_t i = 0; i < kNphases; i++) printf(" %11s", kPhaseName[i]);
+  printf("\n");
+
+  for (Int_t j = 0; j < kNtypes; j++) {
+    printf("%-24s", kTypeName[j]);
+    for (Int_t i = 0; i < kNcounters; i++)
+      printf(" %11llu", (unsigned long long)fTypeRecord[j].fCount[i]);
+    for (Int_t i = 0; i < kNphases; i++)
+      printf(" %10.3es", fTypeRecord[j].fTime[i]);
+    printf("\n");
+  }
+
+  std::vector<std::pair<std::string, const Record*> > nodes;
+  for (auto it = fNodeRecord.begin(); it != fNodeRecord.end(); ++it) {
+    std::string name = it->first ? it->first->GetName() : "(outside)";
+    nodes.push_back(std::make_pair(name, &it->second));
+  }
+  std::sort(nodes.begin(), nodes.end());
+
+  for (std::size_t j = 0; j < nodes.size(); j++) {
+    printf("  %-22s", nodes[j].first.c_str());
+    for (Int_t i = 0; i < kNcounters; i++)
+      printf(" %11llu", (unsigned long long)nodes[j].second->fCount[i]);
+    for (Int_t i = 0; i < kNphases; i++)
+      printf(" %10.3es", nodes[j].second->fTime[i]);
+    printf("\n");
+  }
+}
@@ -5,6 +5,10 @@ import ROOT
 import array
 import time
 import ctypes
+import gc
+import json
+import os
+import sys
 
 cm = ROOT.AOpticsManager.cm()
 mm = ROOT.AOpticsManager.mm()
@@ -247,168 +251,2399 @@ class TestROBAST(unittest.TestCase):
 
         cleanupGeo()
 
+    def testPhotonBuffer(self):
+        manager = makeTheWorld()
+
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 0.5*m, 0.5*m, 0.5*m)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+        registerGeo((mirrorbox, mirror))
+
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.CloseGeometry()
+
+        if ROOT.gInterpreter.ProcessLine('ROOT_VERSION_CODE;') < \
+           ROOT.gInterpreter.ProcessLine('ROOT_VERSION(6, 2, 0);'):
+            manager.SetMultiThread(True)
+        manager.SetMaxThreads(4)
+
+        mirror.SetReflectance(0.25)
+
+        N = 10000
+
+        # history-free tracing must give the same statistics as ARayArray
+        buf = ROOT.APhotonBuffer()
+        buf.Reserve(N)
+        for i in range(N):
+            buf.Add(400*nm, 0, 0, 0.8*m, 0, 0, 0, -1)
+
+        manager.TraceNonSequential(buf)
+
+        n = 0
+        for i in range(N):
+            self.assertFalse(buf.IsRunning(i))
+            if buf.IsExited(i):
+                n += 1
+                self.assertAlmostEqual(buf.GetDz(i), 1)
+                self.assertEqual(buf.GetNpoints(i), 3)
+
+        ref = 0.25
+        self.assertGreater(ref, (n - n**0.5*3)/N)
+        self.assertLess(ref, (n + n**0.5*3)/N)
+
+        cleanupGeo()
+
+    def testWeightedTracing(self):
+        manager = makeTheWorld()
+
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 0.5*m, 0.5*m, 0.5*m)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+        registerGeo((mirrorbox, mirror))
+
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.CloseGeometry()
+
+        ref = 0.05
+        mirror.SetReflectance(ref)
+        manager.EnableWeightedTracing(True)
+        manager.SetRussianRoulette(0.1, 0.5)
+
+        N = 10000
+        buf = ROOT.APhotonBuffer()
+        for i in range(N):
+            buf.Add(400*nm, 0, 0, 0.8*m, 0, 0, 0, -1)
+
+        manager.TraceNonSequential(buf)
+
+        # the reflected rays carry the reflectance as their weight, and half
+        # of them survive Russian roulette with the doubled weight
+        w = 0.
+        n = 0
+        for i in range(N):
+            if buf.IsExited(i):
+                n += 1
+                w += buf.GetWeight(i)
+                self.assertAlmostEqual(buf.GetWeight(i), ref*2)
+            else:
+                self.assertTrue(buf.IsAbsorbed(i))
+
+        self.assertGreater(n, N/2 - N**0.5*3/2)
+        self.assertLess(n, N/2 + N**0.5*3/2)
+        self.assertAlmostEqual(w/N, ref, delta=ref/N**0.5*3)
+
+        cleanupGeo()
+
+    def testPhotonPackets(self):
+        manager = makeTheWorld()
+
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 10*cm, 10*cm, 1*cm)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("trfocal", 0, 0, 50*cm)
+        registerGeo((mirrorbox, mirror, focalbox, focal, tr))
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.GetTopVolume().AddNode(focal, 1, tr)
+        manager.CloseGeometry()
+
+        # linear reflectance and QE in wavelength
+        ROOT.gROOT.ProcessLine('graph = std::make_shared<TGraph>();')
+        ROOT.graph.SetPoint(0, 300*nm, 0.5)
+        ROOT.graph.SetPoint(1, 600*nm, 0.9)
+        mirror.SetReflectance(ROOT.graph)
+        qe = ROOT.TGraph()
+        qe.SetPoint(0, 300*nm, 0.2)
+        qe.SetPoint(1, 600*nm, 0.4)
+        focal.SetQuantumEfficiency(qe)
+        registerGeo((qe,))
+
+        N = 100
+        buf = ROOT.APhotonBuffer()
+        for i in range(N):
+            buf.Add(400*nm, (i % 10)*cm - 5*cm, 0, 20*cm, 0, 0, 0, -1)
+        lambdas = ROOT.std.vector('double')()
+        for wl in (300, 400, 500, 600):
+            lambdas.push_back(wl*nm)
+        weights = ROOT.std.vector('double')()
+
+        # the path is traced once, and each lane gets R(lambda)*QE(lambda)
+        self.assertEqual(manager.TracePackets(buf, lambdas, weights), 0)
+        self.assertEqual(weights.size(), N*4)
+        for i in range(N):
+            self.assertTrue(buf.IsFocused(i))
+            for j in range(4):
+                wl = lambdas[j]
+                expected = mirror.GetReflectance(wl, 0) * \
+                           focal.GetQuantumEfficiency(wl, 0)
+                self.assertAlmostEqual(weights[i*4 + j], expected)
+
+        cleanupGeo()
+
+    def testSurvivalBound(self):
+        manager = makeTheWorld()
+
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 10*cm, 10*cm, 1*cm)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("trfocal", 0, 0, 50*cm)
+        registerGeo((mirrorbox, mirror, focalbox, focal, tr))
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.GetTopVolume().AddNode(focal, 1, tr)
+        manager.CloseGeometry()
+
+        mirror.SetReflectance(0.8)
+        qe = ROOT.TGraph()
+        qe.SetPoint(0, 300*nm, 0.3)
+        qe.SetPoint(1, 600*nm, 0.3)
+        focal.SetQuantumEfficiency(qe)
+
+        def constant(value):
+            graph = ROOT.TGraph()
+            graph.SetPoint(0, 300*nm, value)
+            graph.SetPoint(1, 600*nm, value)
+            return graph
+        refbound, qebound, atm = constant(0.9), constant(0.4), constant(0.5)
+        registerGeo((qe, refbound, qebound, atm))
+
+        N = 20000
+        def trace():
+            buf = ROOT.APhotonBuffer()
+            buf.Reserve(N)
+            for i in range(N):
+                buf.Add(400*nm, (i % 10)*cm - 5*cm, 0, 20*cm, 0, 0, 0, -1)
+            manager.TraceNonSequential(buf)
+            nfocused = sum(1 for i in range(N) if buf.IsFocused(i))
+            ndropped = sum(1 for i in range(N) if buf.GetNpoints(i) == 1)
+            return nfocused, ndropped
+
+        def assertFraction(n, p):
+            sigma = (N*p*(1 - p))**0.5
+            self.assertLess(abs(n - N*p), 5*sigma)
+
+        nfocused, ndropped = trace()
+        self.assertEqual(ndropped, 0)
+        assertFraction(nfocused, 0.8*0.3)
+
+        # 18% of the rays are traced, and the focused ones are unbiased
+        manager.SetSurvivalBound(refbound, 1, qebound, atm)
+        self.assertTrue(manager.HasSurvivalBound())
+        self.assertAlmostEqual(manager.GetSurvivalBound(400*nm), 0.18)
+        nfocused, ndropped = trace()
+        assertFraction(ndropped, 1 - 0.18)
+        assertFraction(nfocused, 0.5*0.8*0.3)
+
+        # suspended rays are not dropped again and keep their bounds, so that
+        # a resumed run gives the same result as an uninterrupted one
+        def traceArray(limit):
+            manager.SetLimit(limit)
+            rays = ROOT.ARayArray()
+            for i in range(N):
+                rays.Add(ROOT.ARay(i, 400*nm, (i % 10)*cm - 5*cm, 0, 20*cm,
+                                   0, 0, 0, -1))
+            manager.TraceNonSequential(rays)
+            nsuspended = rays.GetSuspended().GetLast() + 1
+            manager.TraceSuspended(rays)
+            self.assertEqual(rays.GetSuspended().GetLast() + 1, 0)
+            return rays.GetFocused().GetLast() + 1, nsuspended
+
+        nfocused, nsuspended = traceArray(1000)
+        self.assertEqual(nsuspended, 0)
+        assertFraction(nfocused, 0.5*0.8*0.3)
+        nresumed, nsuspended = traceArray(2)
+        self.assertGreater(nsuspended, 0)
+        assertFraction(nresumed, 0.5*0.8*0.3)
+        sigma = (2*N*0.12*(1 - 0.12))**0.5
+        self.assertLess(abs(nresumed - nfocused), 5*sigma)
+        manager.SetLimit(100)
+
+        manager.SetSurvivalBound(ROOT.nullptr, 0, ROOT.nullptr)
+        self.assertFalse(manager.HasSurvivalBound())
+
+        cleanupGeo()
+
+    def testAttenuationWeighting(self):
+        manager = makeTheWorld()
+
+        lensbox = ROOT.TGeoBBox("lensbox", 0.5*m, 0.5*m, 0.5*m)
+        lens = ROOT.ALens("lens", lensbox)
+        registerGeo((lensbox, lens))
+
+        manager.GetTopVolume().AddNode(lens, 1)
+        manager.CloseGeometry()
+
+        wl = 400 * nm
+        absl = 1 * m
+        ROOT.gROOT.ProcessLine('refidx = std::make_shared<ARefractiveIndex>();')
+        ROOT.gROOT.ProcessLine('graph = std::make_shared<TGraph>();')
+        ROOT.graph.SetPoint(0, wl, 1)
+        ROOT.refidx.SetRefractiveIndex(ROOT.graph)
+        ROOT.gROOT.ProcessLine('graph = std::make_shared<TGraph>();')
+        k = ROOT.ARefractiveIndex.AbsorptionLengthToExtinctionCoefficient(absl, wl)
+        ROOT.graph.SetPoint(0, wl, k)
+        ROOT.refidx.SetExtinctionCoefficient(ROOT.graph)
+        lens.SetRefractiveIndex(ROOT.refidx)
+
+        manager.EnableAttenuationWeighting(True)
+        self.assertTrue(manager.IsAttenuationWeighting())
+        self.assertFalse(manager.IsWeightedTracing())
+
+        # every ray leaves the lens with the Beer-Lambert weight
+        N = 1000
+        buf = ROOT.APhotonBuffer()
+        for i in range(N):
+            buf.Add(wl, 0, 0, 0, 0, 0, 0, 1)
+        manager.TraceNonSequential(buf)
+        for i in range(N):
+            self.assertTrue(buf.IsExited(i))
+            self.assertAlmostEqual(buf.GetWeight(i), ROOT.TMath.Exp(-0.5), 6)
+
+        manager.EnableAttenuationWeighting(False)
+        cleanupGeo()
+
+    def testInstrumentation(self):
+        manager = makeTheWorld()
+
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 0.5*m, 0.5*m, 0.5*m)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+        registerGeo((mirrorbox, mirror))
+
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.CloseGeometry()
+        if ROOT.gInterpreter.ProcessLine('ROOT_VERSION_CODE;') < \
+           ROOT.gInterpreter.ProcessLine('ROOT_VERSION(6, 2, 0);'):
+            manager.SetMultiThread(True)
+        manager.SetMaxThreads(4)
+
+        mirror.SetReflectance(0.25)
+        manager.EnableInstrumentation(True)
+
+        N = 1000
+        buf = ROOT.APhotonBuffer()
+        for i in range(N):
+            buf.Add(400*nm, 0, 0, 0.8*m, 0, 0, 0, -1)
+        manager.TraceNonSequential(buf)
+
+        stats = manager.GetStatistics()
+        S = ROOT.ATraceStatistics
+        node = manager.GetTopVolume().GetNode(0)
+        nexit = sum(1 for i in range(N) if buf.IsExited(i))
+        self.assertEqual(stats.GetNodeCount(node, S.kReflection) +
+                         stats.GetNodeCount(node, S.kAbsorption), N)
+        self.assertEqual(stats.GetNodeCount(node, S.kReflection), nexit)
+        self.assertEqual(stats.GetCount(S.kExit), nexit)
+        self.assertEqual(stats.GetCount(S.kStep), N + nexit)
+        self.assertEqual(stats.GetTypeCount(ROOT.AOpticsManager.kMirror,
+                                            S.kStep), N)
+        self.assertGreater(stats.GetTime(S.kNavigation), 0)
+
+        manager.EnableInstrumentation(False)
+
+        cleanupGeo()
+
+    def testCompactHistory(self):
+        manager = makeTheWorld()
+
+        pixelbox = ROOT.TGeoBBox("pixelbox", 1*cm, 1*cm, 1*mm)
+        pixel = ROOT.AFocalSurface("pixel", pixelbox)
+        registerGeo((pixelbox, pixel))
+        top = manager.GetTopVolume()
+        for i in range(3):
+            tr = ROOT.TGeoTranslation("tr%d" % i, (i - 1) * 3*cm, 0, 0)
+            registerGeo((tr,))
+            top.AddNode(pixel, i + 1, tr)
+        manager.CloseGeometry()
+        manager.EnableCompactHistory(True)
+
+        id2 = manager.GetNodeID("pixel_2")
+        self.assertGreaterEqual(id2, 0)
+        self.assertEqual(manager.GetNodeName(id2), "pixel_2")
+        self.assertEqual(manager.GetNodeID("nonexistent"), -1)
+
+        first = ctypes.c_int()
+        last = ctypes.c_int()
+        self.assertTrue(manager.GetNodeIDRangeStartWith("pixel_", first, last))
+        self.assertEqual(last.value - first.value, 2)
+
+        rays = ROOT.ARayArray()
+        for x in (-3*cm, 0, 3*cm, 10*cm):
+            rays.Add(ROOT.ARay(0, 400*nm, x, 0, 1*cm, 0, 0, 0, -1))
+        manager.TraceNonSequential(rays)
+
+        focused = rays.GetFocused()
+        self.assertEqual(focused.GetLast() + 1, 3)
+        for i in range(3):
+            ray = focused.At(i)
+            self.assertEqual(ray.GetNodeHistory().GetEntries(), 0)
+            self.assertGreaterEqual(ray.FindNodeIDInRange(first.value, last.value), 0)
+        self.assertTrue(focused.At(1).HasNodeID(id2))
+        self.assertFalse(focused.At(0).HasNodeID(id2))
+
+        exited = rays.GetExited().At(0)
+        self.assertEqual(exited.FindNodeIDInRange(first.value, last.value), -1)
+
+        cleanupGeo()
+
+    def testHistoryPolicy(self):
+        manager = makeTheWorld()
+
+        # transparent slab without reflection above a focal surface
+        lensbox = ROOT.TGeoBBox("lensbox", 10*cm, 10*cm, 0.5*cm)
+        lens = ROOT.ALens("lens", lensbox)
+        lens.SetRefractiveIndex(ROOT.air)
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("trfocal", 0, 0, -5*cm)
+        registerGeo((lensbox, lens, focalbox, focal, tr))
+        manager.GetTopVolume().AddNode(lens, 1)
+        manager.GetTopVolume().AddNode(focal, 1, tr)
+        manager.CloseGeometry()
+        self.assertEqual(manager.GetHistoryPolicy(),
+                         ROOT.AOpticsManager.kHistoryFull)
+
+        def trace():
+            rays = ROOT.ARayArray()
+            for i in range(10):
+                x = (i - 4.5)*cm
+                rays.Add(ROOT.ARay(i, 400*nm, x, 0, 5*cm, 0, 0, 0, -1))
+            manager.TraceNonSequential(rays)
+            focused = rays.GetFocused()
+            self.assertEqual(focused.GetLast() + 1, 10)
+            return sorted([focused.At(i) for i in range(10)],
+                          key=lambda ray: ray.GetId())
+
+        # start, lens entrance, lens exit and focal surface
+        for ray in trace():
+            self.assertEqual(ray.GetNpoints(), 4)
+            self.assertEqual(ray.GetNodeHistory().GetEntries(), 3)
+
+        p = array.array("d", [0, 0, 0, 0])
+        manager.SetHistoryPolicy(ROOT.AOpticsManager.kHistoryNone)
+        for ray in trace():
+            self.assertEqual(ray.GetNpoints(), 1)
+            self.assertEqual(ray.GetNodeHistory().GetEntries(), 1)
+            ray.GetLastPoint(p)
+            self.assertAlmostEqual(p[2], -4.9*cm, delta=1e-6*cm)
+
+        manager.SetHistoryPolicy(ROOT.AOpticsManager.kHistoryEndpoints)
+        for ray in trace():
+            self.assertEqual(ray.GetNpoints(), 2)
+            self.assertEqual(ray.GetNodeHistory().GetEntries(), 1)
+            self.assertEqual(ray.GetNodeHistory().At(0).GetName(), "focal_1")
+            x, y, z, t = (ctypes.c_double() for i in range(4))
+            ray.GetPoint(0, x, y, z, t)
+            self.assertAlmostEqual(z.value, 5*cm)
+
+        manager.SetHistoryPolicy(ROOT.AOpticsManager.kHistorySampled, 3)
+        for ray in trace():
+            n = 4 if ray.GetId() % 3 == 0 else 2
+            self.assertEqual(ray.GetNpoints(), n)
+
+        ROOT.gInterpreter.Declare("""
+        bool robastSelectPositiveX(const ARay& ray) {
+          Double_t p[4];
+          ray.GetLastPoint(p);
+          return p[0] > 0;
+        }""")
+        manager.SetHistorySelector(ROOT.robastSelectPositiveX)
+        self.assertEqual(manager.GetHistoryPolicy(),
+                         ROOT.AOpticsManager.kHistorySelected)
+        for ray in trace():
+            n = 4 if ray.GetId() >= 5 else 2
+            self.assertEqual(ray.GetNpoints(), n)
+
+        # the limit counts the dropped points too
+        manager.SetHistoryPolicy(ROOT.AOpticsManager.kHistoryNone)
+        manager.SetLimit(3)
+        rays = ROOT.ARayArray()
+        rays.Add(ROOT.ARay(0, 400*nm, 0, 0, 5*cm, 0, 0, 0, -1))
+        manager.TraceNonSequential(rays)
+        self.assertEqual(rays.GetSuspended().GetLast() + 1, 1)
+        self.assertEqual(rays.GetSuspended().At(0).GetNpoints(), 1)
+
+        cleanupGeo()
+
+    def testRandomSeed(self):
+        manager = makeTheWorld()
+
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 0.5*m, 0.5*m, 0.5*m)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+        condition = ROOT.ABorderSurfaceCondition(manager.GetTopVolume(), mirror)
+        registerGeo((mirrorbox, mirror, condition))
+        condition.SetGaussianRoughness(1 * deg)
+        mirror.SetReflectance(0.5)
+
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.CloseGeometry()
+
+        if ROOT.gInterpreter.ProcessLine('ROOT_VERSION_CODE;') < \
+           ROOT.gInterpreter.ProcessLine('ROOT_VERSION(6, 2, 0);'):
+            manager.SetMultiThread(True)
+
+        N = 10000
+
+        # results with a fixed seed must not depend on the number of threads
+        results = []
+        for nthreads in (4, 2):
+            manager.SetMaxThreads(nthreads)
+            manager.SetRandomSeed(12345)
+            buf = ROOT.APhotonBuffer()
+            for i in range(N):
+                buf.Add(400*nm, 0, 0, 0.8*m, 0, 0, 0, -1)
+            manager.TraceNonSequential(buf)
+            results.append([(buf.GetStatus(i), buf.GetDx(i)) for i in range(N)])
+
+        self.assertEqual(results[0], results[1])
+
+        cleanupGeo()
+
+    def testTraceSequential(self):
+        manager = makeTheWorld()
+        manager.DisableFresnelReflection(False)
+
+        lensbox = ROOT.TGeoBBox("lensbox", 0.5*m, 0.5*m, 1*mm)
+        lens = ROOT.ALens("lens", lensbox)
+        ROOT.gROOT.ProcessLine('refidx = std::make_shared<ARefractiveIndex>(1.5);')
+        lens.SetRefractiveIndex(ROOT.refidx)
+
+        focalbox = ROOT.TGeoBBox("focalbox", 0.5*m, 0.5*m, 0.1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("tr", 0, 0, -5*cm)
+        registerGeo((lensbox, lens, focalbox, focal, tr))
+
+        top = manager.GetTopVolume()
+        top.AddNode(lens, 1)
+        top.AddNode(focal, 1, tr)
+        manager.CloseGeometry()
+
+        order = ROOT.std.vector('TGeoNode*')()
+        order.push_back(top.GetNode(0))
+        order.push_back(top.GetNode(1))
+
+        # sequential tracing must reproduce non-sequential tracing including
+        # the rays reflected back at the lens entrance
+        N = 1000
+        theta = 30 * deg
+        results = []
+        for sequential in (False, True):
+            rays = ROOT.ARayArray()
+            for i in range(N):
+                ray = ROOT.ARay(i, 400*nm, 0, 0, 1*cm, 0,
+                                ROOT.TMath.Sin(theta), 0, -ROOT.TMath.Cos(theta))
+                rays.Add(ray)
+
+            manager.SetRandomSeed(1)
+            if sequential:
+                manager.TraceSequential(rays, order)
+            else:
+                manager.TraceNonSequential(rays)
+
+            focused = rays.GetFocused()
+            self.assertEqual(rays.GetExited().GetLast() + 1 +
+                             focused.GetLast() + 1, N)
+            p = array.array("d", [0, 0, 0, 0])
+            points = []
+            for i in range(focused.GetLast() + 1):
+                focused.At(i).GetLastPoint(p)
+                points.append((p[0], p[2]))
+            results.append(points)
+
+        self.assertEqual(len(results[0]), len(results[1]))
+        for p0, p1 in zip(results[0], results[1]):
+            self.assertAlmostEqual(p0[0], p1[0])
+            self.assertAlmostEqual(p0[1], p1[1])
+
+        cleanupGeo()
+
+    def testStartLocation(self):
+        manager = makeTheWorld()
+        manager.DisableFresnelReflection(True)
+
+        # a lens placed in a container, in which some of the rays start
+        containerbox = ROOT.TGeoBBox("containerbox", 10*cm, 10*cm, 3*cm)
+        container = ROOT.AOpticalComponent("container", containerbox)
+        lensbox = ROOT.TGeoBBox("lensbox", 5*cm, 5*cm, 1*cm)
+        lens = ROOT.ALens("lens", lensbox)
+        ROOT.gROOT.ProcessLine('refidx = std::make_shared<ARefractiveIndex>(1.5);')
+        lens.SetRefractiveIndex(ROOT.refidx)
+        focalbox = ROOT.TGeoBBox("focalbox", 20*cm, 20*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr1 = ROOT.TGeoTranslation("tr1", 0, 0, 5*cm)
+        tr2 = ROOT.TGeoTranslation("tr2", 0, 0, -5*cm)
+        registerGeo((containerbox, container, lensbox, lens, focalbox, focal,
+                     tr1, tr2))
+
+        container.AddNode(lens, 1)
+        top = manager.GetTopVolume()
+        top.AddNode(container, 1, tr1)
+        top.AddNode(focal, 1, tr2)
+        manager.CloseGeometry()
+
+        # rays starting on one plane at z = 5 cm in the world, the container
+        # and the lens must end up where they do when traced one by one
+        dx, dz = ROOT.TMath.Sin(5 * deg), -ROOT.TMath.Cos(5 * deg)
+        def makeRay(i, j):
+            return ROOT.ARay(0, 400*nm, i*cm, j*cm, 5*cm, 0, dx, 0, dz)
+
+        def lastPoint(ray):
+            p = array.array("d", [0, 0, 0, 0])
+            ray.GetLastPoint(p)
+            return tuple(round(v, 9) for v in p)
+
+        batch = ROOT.ARayArray()
+        single = []
+        for i in range(-14, 15):
+            for j in range(-14, 15):
+                batch.Add(makeRay(i, j))
+                single.append(makeRay(i, j))
+        manager.TraceNonSequential(batch)
+        for ray in single:
+            manager.TraceNonSequential(ray)
+
+        focused = batch.GetFocused()
+        self.assertEqual(focused.GetLast() + 1, 29 * 29)
+        self.assertTrue(all(ray.IsFocused() for ray in single))
+        self.assertEqual(
+            sorted(lastPoint(focused.At(i)) for i in range(29 * 29)),
+            sorted(lastPoint(ray) for ray in single))
+
+        cleanupGeo()
+
+    def testCoherentOrdering(self):
+        manager = makeTheWorld()
+        manager.DisableFresnelReflection(False)
+
+        lensbox = ROOT.TGeoBBox("lensbox", 0.5*m, 0.5*m, 1*mm)
+        lens = ROOT.ALens("lens", lensbox)
+        ROOT.gROOT.ProcessLine('refidx = std::make_shared<ARefractiveIndex>(1.5);')
+        lens.SetRefractiveIndex(ROOT.refidx)
+        focalbox = ROOT.TGeoBBox("focalbox", 0.5*m, 0.5*m, 0.1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("tr", 0, 0, -5*cm)
+        registerGeo((lensbox, lens, focalbox, focal, tr))
+        top = manager.GetTopVolume()
+        top.AddNode(lens, 1)
+        top.AddNode(focal, 1, tr)
+        manager.CloseGeometry()
+
+        # reordering must not change the fate of any ray, as each ray keeps
+        # the random number stream of its original index
+        results = []
+        for coherent in (False, True):
+            manager.EnableCoherentOrdering(coherent)
+            self.assertEqual(manager.IsCoherentOrdering(), coherent)
+            rays = ROOT.ARayArray()
+            for i in range(1000):
+                # scrambled positions on the aperture
+                x = ((i * 7919) % 1000 - 500) * 0.8*mm
+                y = ((i * 104729) % 997 - 498) * 0.8*mm
+                rays.Add(ROOT.ARay(i, 400*nm, x, y, 1*cm, 0, 0.6, 0, -0.8))
+            manager.SetRandomSeed(1)
+            manager.TraceNonSequential(rays)
+
+            p = array.array("d", [0, 0, 0, 0])
+            result = []
+            for status in (rays.GetFocused(), rays.GetExited(),
+                           rays.GetStopped()):
+                for i in range(status.GetLast() + 1):
+                    status.At(i).GetLastPoint(p)
+                    result.append((status.At(i).GetId(), p[0], p[1]))
+            results.append(sorted(result))
+
+        self.assertEqual(len(results[0]), 1000)
+        self.assertEqual(results[0], results[1])
+
+        cleanupGeo()
+
+    def testTraceAsync(self):
+        manager = makeTheWorld()
+        manager.DisableFresnelReflection(False)
+
+        lensbox = ROOT.TGeoBBox("lensbox", 0.5*m, 0.5*m, 1*mm)
+        lens = ROOT.ALens("lens", lensbox)
+        ROOT.gROOT.ProcessLine('refidx = std::make_shared<ARefractiveIndex>(1.5);')
+        lens.SetRefractiveIndex(ROOT.refidx)
+        focalbox = ROOT.TGeoBBox("focalbox", 0.5*m, 0.5*m, 0.1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("tr", 0, 0, -5*cm)
+        registerGeo((lensbox, lens, focalbox, focal, tr))
+        top = manager.GetTopVolume()
+        top.AddNode(lens, 1)
+        top.AddNode(focal, 1, tr)
+        manager.CloseGeometry()
+
+        if ROOT.gInterpreter.ProcessLine('ROOT_VERSION_CODE;') < \
+           ROOT.gInterpreter.ProcessLine('ROOT_VERSION(6, 2, 0);'):
+            manager.SetMultiThread(True)
+        manager.SetMaxThreads(4)
+
+        def makeRays():
+            rays = ROOT.ARayArray()
+            for i in range(2000):
+                x = ((i * 7919) % 1000 - 500) * 0.8*mm
+                rays.Add(ROOT.ARay(i, 400*nm, x, 0, 1*cm, 0, 0.6, 0, -0.8))
+            return rays
+
+        def getResult(rays):
+            p = array.array("d", [0, 0, 0, 0])
+            result = []
+            for status in (rays.GetFocused(), rays.GetExited(),
+                           rays.GetStopped()):
+                for i in range(status.GetLast() + 1):
+                    status.At(i).GetLastPoint(p)
+                    result.append((status.At(i).GetId(), p[0], p[1]))
+            return sorted(result)
+
+        rays = makeRays()
+        manager.SetRandomSeed(1)
+        manager.TraceNonSequential(rays)
+        expected = getResult(rays)
+
+        rays = makeRays()
+        manager.SetRandomSeed(1)
+        future = manager.TraceAsync(rays)
+        self.assertTrue(future.IsValid())
+        self.assertEqual(future.GetNrays(), 2000)
+        self.assertEqual(rays.GetRunning().GetLast(), -1)
+        while not future.IsDone():
+            progress = future.GetProgress()
+            self.assertTrue(0 <= progress <= 1)
+        self.assertTrue(future.Wait())
+        self.assertEqual(future.GetNtraced(), 2000)
+        self.assertEqual(future.GetProgress(), 1)
+        self.assertEqual(getResult(rays), expected)
+
+        # the rays are given back only once
+        self.assertTrue(future.Wait())
+        self.assertEqual(len(getResult(rays)), 2000)
+
+        cleanupGeo()
+
+    def testImplicitMT(self):
+        if not hasattr(ROOT, 'EnableImplicitMT'):
+            return
+
+        manager = makeTheWorld()
+        manager.DisableFresnelReflection(False)
+
+        lensbox = ROOT.TGeoBBox("lensbox", 0.5*m, 0.5*m, 1*mm)
+        lens = ROOT.ALens("lens", lensbox)
+        ROOT.gROOT.ProcessLine('refidx = std::make_shared<ARefractiveIndex>(1.5);')
+        lens.SetRefractiveIndex(ROOT.refidx)
+        focalbox = ROOT.TGeoBBox("focalbox", 0.5*m, 0.5*m, 0.1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("tr", 0, 0, -5*cm)
+        registerGeo((lensbox, lens, focalbox, focal, tr))
+        top = manager.GetTopVolume()
+        top.AddNode(lens, 1)
+        top.AddNode(focal, 1, tr)
+        manager.CloseGeometry()
+
+        if ROOT.gInterpreter.ProcessLine('ROOT_VERSION_CODE;') < \
+           ROOT.gInterpreter.ProcessLine('ROOT_VERSION(6, 2, 0);'):
+            manager.SetMultiThread(True)
+        manager.SetMaxThreads(4)
+
+        # the tasks in the pool of ROOT must give the same results as the
+        # threads of ROBAST
+        results = []
+        for imt in (False, True):
+            if imt:
+                ROOT.EnableImplicitMT(3)
+            rays = ROOT.ARayArray()
+            for i in range(2000):
+                x = ((i * 7919) % 1000 - 500) * 0.8*mm
+                rays.Add(ROOT.ARay(i, 400*nm, x, 0, 1*cm, 0, 0.6, 0, -0.8))
+            manager.SetRandomSeed(1)
+            manager.TraceNonSequential(rays)
+
+            p = array.array("d", [0, 0, 0, 0])
+            result = []
+            for status in (rays.GetFocused(), rays.GetExited(),
+                           rays.GetStopped()):
+                for i in range(status.GetLast() + 1):
+                    status.At(i).GetLastPoint(p)
+                    result.append((status.At(i).GetId(), p[0], p[1]))
+            results.append(sorted(result))
+
+        ROOT.DisableImplicitMT()
+        manager.StopWorkers()
+
+        self.assertEqual(len(results[0]), 2000)
+        self.assertEqual(results[0], results[1])
+
+        cleanupGeo()
+
+    def testFlatNavigation(self):
+        manager = makeTheWorld()
+        manager.DisableFresnelReflection(False)
+
+        lensbox = ROOT.TGeoBBox("lensbox", 0.5*m, 0.5*m, 1*mm)
+        lens = ROOT.ALens("lens", lensbox)
+        ROOT.gROOT.ProcessLine('refidx = std::make_shared<ARefractiveIndex>(1.5);')
+        lens.SetRefractiveIndex(ROOT.refidx)
+
+        focalbox = ROOT.TGeoBBox("focalbox", 0.5*m, 0.5*m, 0.1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("tr", 0, 0, -5*cm)
+
+        mirrorsphere = ROOT.TGeoSphere("mirrorsphere", 10*cm, 10.1*cm, 0, 30)
+        mirror = ROOT.AMirror("mirror", mirrorsphere)
+        mirrortr = ROOT.TGeoTranslation("mirrortr", 0, 0, -15*cm)
+        registerGeo((lensbox, lens, focalbox, focal, tr,
+                     mirrorsphere, mirror, mirrortr))
+
+        top = manager.GetTopVolume()
+        top.AddNode(lens, 1)
+        top.AddNode(focal, 1, tr)
+        top.AddNode(mirror, 1, mirrortr)
+        manager.CloseGeometry()
+
+        # the flat navigator must reproduce TGeoNavigator
+        N = 1000
+        theta = 30 * deg
+        results = []
+        for flat in (False, True):
+            manager.EnableFlatNavigation(flat)
+            self.assertEqual(manager.IsFlatNavigation(), flat)
+            rays = ROOT.ARayArray()
+            for i in range(N):
+                phi = 360 * deg * i / N
+                ray = ROOT.ARay(i, 400*nm, 0, 0, 1*cm, 0,
+                                ROOT.TMath.Sin(theta) * ROOT.TMath.Cos(phi),
+                                ROOT.TMath.Sin(theta) * ROOT.TMath.Sin(phi),
+                                -ROOT.TMath.Cos(theta))
+                rays.Add(ray)
+
+            manager.SetRandomSeed(1)
+            manager.TraceNonSequential(rays)
+
+            points = []
+            p = array.array("d", [0, 0, 0, 0])
+            for status in (rays.GetFocused(), rays.GetExited(),
+                           rays.GetStopped(), rays.GetAbsorbed(),
+                           rays.GetSuspended()):
+                for i in range(status.GetLast() + 1):
+                    status.At(i).GetLastPoint(p)
+                    points.append((status.At(i).GetNpoints(), p[0], p[1], p[2]))
+            results.append(points)
+
+        self.assertEqual(len(results[0]), N)
+        self.assertEqual(len(results[0]), len(results[1]))
+        for p0, p1 in zip(results[0], results[1]):
+            self.assertEqual(p0[0], p1[0])
+            for j in range(1, 4):
+                self.assertAlmostEqual(p0[j], p1[j], 5)
+
+        cleanupGeo()
+
+    def testMakeAssemblies(self):
+        # pixels regrouped into assemblies must give the same results
+        N = 1000
+        results = []
+        for assemble in (False, True):
+            manager = makeTheWorld()
+            pixelbox = ROOT.TGeoBBox("pixelbox", 4*mm, 4*mm, 1*mm)
+            pixel = ROOT.AFocalSurface("pixel", pixelbox)
+            registerGeo((pixelbox, pixel))
+            top = manager.GetTopVolume()
+            for i in range(400):
+                tr = ROOT.TGeoTranslation("trpixel%d" % i,
+                                          (i % 20)*cm - 9.5*cm,
+                                          (i // 20)*cm - 9.5*cm, 0)
+                registerGeo((tr,))
+                top.AddNode(pixel, i + 1, tr)
+
+            if assemble:
+                n = ROOT.AGeoUtil.MakeAssemblies(top, 16, "pixels")
+                self.assertGreater(n, 0)
+                self.assertLessEqual(top.GetNdaughters(), 16)
+            manager.CloseGeometry()
+
+            for flat in (False, True):
+                manager.EnableFlatNavigation(flat)
+                self.assertEqual(manager.IsFlatNavigation(), flat)
+                rays = ROOT.ARayArray()
+                for i in range(N):
+                    x = (i % 40)*5*mm - 9.8*cm
+                    y = (i // 40)*8*mm - 9.8*cm
+                    rays.Add(ROOT.ARay(i, 400*nm, x, y, 5*cm, 0, 0, 0, -1))
+                manager.TraceNonSequential(rays)
+
+                points = []
+                p = array.array("d", [0, 0, 0, 0])
+                focused = rays.GetFocused()
+                for i in range(focused.GetLast() + 1):
+                    focused.At(i).GetLastPoint(p)
+                    points.append((round(p[0], 6), round(p[1], 6),
+                                   round(p[2], 6)))
+                results.append(sorted(points))
+
+            cleanupGeo()
+
+        self.assertGreater(len(results[0]), 0)
+        self.assertLess(len(results[0]), N)
+        for points in results[1:]:
+            self.assertEqual(points, results[0])
+
+    def testMakeAssembliesWithUnselected(self):
+        # the daughters left in the mother count toward nmax
+        manager = makeTheWorld()
+        pixelbox = ROOT.TGeoBBox("pixelbox", 4*mm, 4*mm, 1*mm)
+        pixel = ROOT.AFocalSurface("pixel", pixelbox)
+        obsbox = ROOT.TGeoBBox("obsbox", 1*cm, 1*cm, 1*cm)
+        obs = ROOT.AObscuration("obs", obsbox)
+        registerGeo((pixelbox, pixel, obsbox, obs))
+        top = manager.GetTopVolume()
+        for i in range(400):
+            tr = ROOT.TGeoTranslation("trpixel%d" % i, (i % 20)*cm - 9.5*cm,
+                                      (i // 20)*cm - 9.5*cm, 0)
+            registerGeo((tr,))
+            top.AddNode(pixel, i + 1, tr)
+        for i in range(10):
+            tr = ROOT.TGeoTranslation("trobs%d" % i, i*3*cm - 15*cm, 0, 50*cm)
+            registerGeo((tr,))
+            top.AddNode(obs, i + 1, tr)
+
+        select = lambda node: node.GetVolume().GetName() == "pixel"
+        n = ROOT.AGeoUtil.MakeAssemblies(top, 16, "pixels", select)
+        self.assertGreater(n, 0)
+        self.assertLessEqual(top.GetNdaughters(), 16)
+        nobs = sum(1 for i in range(top.GetNdaughters())
+                   if top.GetNode(i).GetVolume().GetName() == "obs")
+        self.assertEqual(nobs, 10)
+
+        cleanupGeo()
+
+    def testMoveNodeInAssembly(self):
+        manager = makeTheWorld()
+        pixelbox = ROOT.TGeoBBox("pixelbox", 4*mm, 4*mm, 1*mm)
+        pixel = ROOT.AFocalSurface("pixel", pixelbox)
+        registerGeo((pixelbox, pixel))
+        top = manager.GetTopVolume()
+        for i in range(400):
+            tr = ROOT.TGeoTranslation("trpixel%d" % i, (i % 20)*cm - 9.5*cm,
+                                      (i // 20)*cm - 9.5*cm, 0)
+            registerGeo((tr,))
+            top.AddNode(pixel, i + 1, tr)
+        ROOT.AGeoUtil.MakeAssemblies(top, 16, "pixels")
+        manager.CloseGeometry()
+
+        node = top.GetNode(0)
+        while node.GetVolume().IsAssembly():
+            node = node.GetVolume().GetNode(0)
+        self.assertTrue(node.GetMotherVolume().IsAssembly())
+
+        # moved out of the bounding boxes of all the assemblies above it
+        manager.SetNodeMatrix(node, ROOT.TGeoTranslation(30*cm, 30*cm, 0))
+        for flat in (False, True):
+            manager.EnableFlatNavigation(flat)
+            ray = ROOT.ARay(0, 400*nm, 30*cm, 30*cm, 5*cm, 0, 0, 0, -1)
+            manager.TraceNonSequential(ray)
+            self.assertTrue(ray.IsFocused())
+            p = array.array("d", [0, 0, 0, 0])
+            ray.GetLastPoint(p)
+            self.assertAlmostEqual(p[0], 30*cm, 6)
+            self.assertAlmostEqual(p[2], 1*mm, 6)
+
+        cleanupGeo()
+
+    def testRayPackets(self):
+        manager = makeTheWorld()
+
+        # a dish of 5x5 spherical facets and a focal plane
+        facetsphere = ROOT.TGeoSphere("facetsphere", 1*m, 1.01*m, 0, 3)
+        facet = ROOT.AMirror("facet", facetsphere)
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 0.1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("tr", 0, 0, 50*cm)
+        objs = [facetsphere, facet, focalbox, focal, tr]
+        top = manager.GetTopVolume()
+        top.AddNode(focal, 1, tr)
+        for i in range(25):
+            ftr = ROOT.TGeoTranslation("ftr%d" % i, (i % 5 - 2) * 6*cm,
+                                       (i // 5 - 2) * 6*cm, 1*m)
+            objs.append(ftr)
+            top.AddNode(facet, i + 1, ftr)
+        registerGeo(objs)
+        manager.CloseGeometry()
+        manager.EnableFlatNavigation(True)
+        self.assertTrue(manager.IsFlatNavigation())
+
+        # the packet test only skips surfaces, so the results must not change
+        results = []
+        for size, single in ((0, False), (8, False), (16, True), (4, True)):
+            manager.EnableRayPackets(size, single)
+            self.assertEqual(manager.GetPacketSize(), size)
+            rays = ROOT.ARayArray()
+            for i in range(1000):
+                x = ((i * 7919) % 1000 - 500) * 0.3*mm
+                y = ((i * 104729) % 997 - 498) * 0.3*mm
+                rays.Add(ROOT.ARay(i, 400*nm, x, y, 60*cm, 0, 0, 0, 1))
+            manager.SetRandomSeed(1)
+            manager.TraceNonSequential(rays)
+
+            p = array.array("d", [0, 0, 0, 0])
+            result = []
+            for status in (rays.GetFocused(), rays.GetExited(),
+                           rays.GetStopped(), rays.GetAbsorbed()):
+                for i in range(status.GetLast() + 1):
+                    status.At(i).GetLastPoint(p)
+                    result.append((status.At(i).GetId(),
+                                   status.At(i).GetNpoints(), p[0], p[1]))
+            results.append(sorted(result))
+
+        self.assertEqual(len(results[0]), 1000)
+        for result in results[1:]:
+            self.assertEqual(result, results[0])
+
+        # invalid sizes are rejected
+        manager.EnableRayPackets(5)
+        self.assertEqual(manager.GetPacketSize(), 4)
+
+        cleanupGeo()
+
+    def testMisalignmentEnsemble(self):
+        manager = makeTheWorld()
+
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 10*cm, 10*cm, 1*mm)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+        registerGeo((mirrorbox, mirror))
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.CloseGeometry()
+
+        ensemble = ROOT.AMisalignmentEnsemble(3)
+        node = manager.GetTopVolume().GetNode(0)
+        self.assertEqual(ensemble.AddNode(node), 0)
+        self.assertEqual(ensemble.GetNnodes(), 1)
+        tilt = 0.01
+        ensemble.SetMisalignment(1, 0, 0, tilt, 0, 0, 0, 0)
+        ensemble.SetMisalignment(2, 0, 0, 0, 0, 0, 0, -1*mm)
+
+        def makeRays():
+            rays = ROOT.ARayArray()
+            for i in range(10):
+                rays.Add(ROOT.ARay(i, 400*nm, (i - 5)*cm, 0, 5*cm,
+                                   0, 0, 0, -1))
+            return rays
+
+        arrays = ROOT.std.vector('ARayArray*')()
+        for i in range(3):
+            arrays.push_back(makeRays())
+        manager.TraceEnsemble(ensemble, arrays)
+
+        d = array.array("d", [0, 0, 0])
+        for i in range(3):
+            exited = arrays[i].GetExited()
+            self.assertEqual(exited.GetLast() + 1, 10)
+            for j in range(10):
+                ray = exited.At(j)
+                ray.GetDirection(d)
+                if i == 1:  # the reflection is tilted by twice the tilt
+                    self.assertAlmostEqual(abs(d[0]), ROOT.TMath.Sin(2*tilt))
+                else:
+                    self.assertAlmostEqual(d[0], 0)
+                z = ray.GetPoint(1)[2]  # reflection point
+                if i == 0:
+                    self.assertAlmostEqual(z, 1*mm)
+                elif i == 2:
+                    self.assertAlmostEqual(z, 0)
+
+        # the geometry itself is not moved
+        rays = makeRays()
+        manager.TraceNonSequential(rays)
+        rays.GetExited().At(0).GetDirection(d)
+        self.assertAlmostEqual(d[0], 0)
+
+        cleanupGeo()
+
     def testMirrorBoundaryMultilayer(self):
         manager = makeTheWorld()
 
-        mirrorbox = ROOT.TGeoBBox("mirrorbox", 0.5*m, 0.5*m, 0.5*m)
-        mirror = ROOT.AMirror("mirror", mirrorbox)
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 0.5*m, 0.5*m, 0.5*m)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+
+        condition = ROOT.ABorderSurfaceCondition(manager.GetTopVolume(), mirror)
+        registerGeo((mirrorbox, mirror, condition))
+
+        ROOT.gROOT.ProcessLine('auto mirror_layer = std::make_shared<AMultilayer>(air, Al)');
+        ROOT.mirror_layer.InsertLayer(ROOT.SiO2, 25.4*nm)
+
+        condition.SetMultilayer(ROOT.mirror_layer)
+
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.CloseGeometry()
+
+        N = 100000
+
+        for wl in range(300, 1100, 100):
+            rays = ROOT.ARayArray()
+            for i in range(N):
+                ray = ROOT.ARay(i, wl * nm, 0, 0, 0.51*m, 0, 1, 0, -1)
+                rays.Add(ray)
+                manager.TraceNonSequential(rays)
+
+            n_exited = rays.GetExited().GetEntries()
+            n_absorbed = rays.GetAbsorbed().GetEntries()
+            self.assertEqual(n_exited + n_absorbed, N)
+
+            reflectance = ctypes.c_double()
+            transmittance = ctypes.c_double()
+            ROOT.mirror_layer.CoherentTMMMixed(ROOT.std.complex(ROOT.double)(45 * deg), wl * nm, reflectance, transmittance)
+
+            expected = N * reflectance.value
+            e = expected**0.5
+            self.assertGreater(n_exited,  expected - 3*e)
+            self.assertLess(n_exited, expected + 3*e)
+
+        cleanupGeo()
+
+    def testLensBoundaryMultilayer(self):
+        manager = makeTheWorld()
+
+        lensbox = ROOT.TGeoBBox("lensbox", 0.5*m, 0.5*m, 0.5*m)
+        lens = ROOT.AMirror("lens", lensbox)
+
+        condition = ROOT.ABorderSurfaceCondition(manager.GetTopVolume(), lens)
+        registerGeo((lensbox, lens, condition))
+
+        ROOT.gROOT.ProcessLine('auto lens_layer = std::make_shared<AMultilayer>(air, Si)');
+        ROOT.lens_layer.InsertLayer(ROOT.SiO2, 2000 * nm)
+        ROOT.lens_layer.InsertLayer(ROOT.Si3N4, 33 * nm)
+
+        condition.SetMultilayer(ROOT.lens_layer)
+
+        manager.GetTopVolume().AddNode(lens, 1)
+        manager.CloseGeometry()
+
+        N = 100000
+
+        for wl in range(300, 600, 50):
+            rays = ROOT.ARayArray()
+            for i in range(N):
+                ray = ROOT.ARay(i, wl * nm, 0, 0, 0.51*m, 0, 1, 0, -1)
+                rays.Add(ray)
+                manager.TraceNonSequential(rays)
+
+            n_exited = rays.GetExited().GetEntries()
+            n_absorbed = rays.GetAbsorbed().GetEntries()
+            self.assertEqual(n_exited + n_absorbed, N)
+
+            reflectance = ctypes.c_double()
+            transmittance = ctypes.c_double()
+            ROOT.lens_layer.CoherentTMMMixed(ROOT.std.complex(ROOT.double)(45 * deg), wl * nm, reflectance, transmittance)
+
+            expected = N * reflectance.value
+            e = expected**0.5
+            self.assertGreater(n_exited,  expected - 3*e)
+            self.assertLess(n_exited, expected + 3*e)
+
+        cleanupGeo()
+
+    def testMirrorScattaring(self):
+        manager = makeTheWorld()
+
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 0.5*m, 0.5*m, 0.5*m)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+
+        condition = ROOT.ABorderSurfaceCondition(manager.GetTopVolume(), mirror)
+        registerGeo((mirrorbox, mirror, condition))
+
+        sigma = 1
+        condition.SetGaussianRoughness(sigma * deg)
+
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.CloseGeometry()
+
+        if ROOT.gInterpreter.ProcessLine('ROOT_VERSION_CODE;') < \
+           ROOT.gInterpreter.ProcessLine('ROOT_VERSION(6, 2, 0);'):
+            manager.SetMultiThread(True)
+        manager.SetMaxThreads(4)
+
+        N = 10000
+
+        rays = ROOT.ARayArray()
+        for i in range(N):
+            ray = ROOT.ARay(i, 400*nm, 0, 0, 0.8*m, 0, 0, 0, -1)
+            rays.Add(ray)
+
+        manager.TraceNonSequential(rays)
+
+        exited = rays.GetExited()
+
+        h2 = ROOT.TH2D("h2", "h2", 40, -10*sigma, 10*sigma, 40, -10*sigma, 10*sigma)
+
+        for i in range(N):
+            ray = exited.At(i)
+            p = array.array("d", [0, 0, 0, 0])
+            ray.GetDirection(p)
+            px = p[0]
+            py = p[1]
+            pz = p[2]
+            h2.Fill(px * rad / deg, py * rad / deg)
+
+        f2 = ROOT.TF2("f2", "[0]*exp(-(x*x + y*y)/(2*[1]*[1]))", -10*sigma, 10*sigma, -10*sigma, 10*sigma)
+        f2.SetParameter(0, 1000)
+        f2.SetParLimits(1, 0, 10)
+        f2.SetParameter(1, sigma)
+        h2.Draw("lego")
+        ROOT.gPad.Update()
+        h2.Fit("f2", "l")
+        p = f2.GetParameter(1)
+        e = f2.GetParError(1)
+
+        self.assertGreater(2*sigma, p - 3*e) # reflected angle is 2 times larger
+        self.assertLess(2*sigma, p + 3*e)
+
+        cleanupGeo()
+
+    def testLimitForSuspended(self):
+        manager = makeTheWorld()
+        manager.SetLimit(1000)
+
+        mirrorsphere = ROOT.TGeoSphere("mirrorsphere", 0.1*m, 0.2*m)
+        mirror = ROOT.AMirror("mirror", mirrorsphere)
+        registerGeo((mirrorsphere, mirror))
+
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.CloseGeometry()
+
+        if ROOT.gInterpreter.ProcessLine('ROOT_VERSION_CODE;') < \
+           ROOT.gInterpreter.ProcessLine('ROOT_VERSION(6, 2, 0);'):
+            manager.SetMultiThread(True)
+        manager.SetMaxThreads(4)
+
+        ray = ROOT.ARay(0, 400*nm, 0, 0, 0, 0, 0, 0, -1)
+
+        manager.TraceNonSequential(ray)
+
+        n = ray.GetNpoints()
+        self.assertEqual(n, 1000)
+
+        # suspended rays are resumed with trimmed histories until absorbed
+        manager.SetLimit(10)
+        mirror.SetReflectance(0.9)
+        N = 100
+        rays = ROOT.ARayArray()
+        for i in range(N):
+            rays.Add(ROOT.ARay(i, 400*nm, 0, 0, 0, 0, 0, 0, -1))
+
+        manager.TraceNonSequential(rays)
+        self.assertGreater(rays.GetSuspended().GetLast() + 1, 0)
+
+        manager.TraceSuspended(rays, 0)
+        self.assertEqual(rays.GetSuspended().GetLast() + 1, 0)
+        absorbed = rays.GetAbsorbed()
+        self.assertEqual(absorbed.GetLast() + 1, N)
+        for i in range(N):
+            self.assertLessEqual(absorbed.At(i).GetNpoints(), 10)
+
+        cleanupGeo()
+
+    def testRandomFootprint(self):
+        manager = makeTheWorld()
+
+        facetbox = ROOT.TGeoBBox("facetbox", 10*cm, 20*cm, 1*cm)
+        facet = ROOT.AMirror("facet", facetbox)
+        tr1 = ROOT.TGeoTranslation("tr1", -1*m, 0, 1*m)
+        tr2 = ROOT.TGeoTranslation("tr2", 1*m, 0, 1*m)
+        registerGeo((facetbox, facet, tr1, tr2))
+
+        top = manager.GetTopVolume()
+        top.AddNode(facet, 1, tr1)
+        top.AddNode(facet, 2, tr2)
+        manager.CloseGeometry()
+
+        targets = ROOT.std.vector('TGeoNode*')()
+        targets.push_back(top.GetNode(0))
+        targets.push_back(top.GetNode(1))
+
+        N = 1000
+        area = ctypes.c_double()
+        rays = ROOT.ARayShooter.RandomFootprint(400*nm, targets, N, area)
+        self.assertAlmostEqual(area.value, 2*(20*cm)*(40*cm))
+
+        manager.TraceNonSequential(rays)
+
+        # every ray must be reflected by either of the facets
+        exited = rays.GetExited()
+        self.assertEqual(exited.GetLast() + 1, N)
+        for i in range(N):
+            self.assertEqual(exited.At(i).GetNpoints(), 3)
+
+        cleanupGeo()
+
+    def testRaySink(self):
+        manager = makeTheWorld()
+
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
+
+        # finished rays must be handed to the sink instead of being stored
+        h = ROOT.TH2D("hsink", "", 20, -20, 20, 20, -20, 20)
+        sink = ROOT.ARayHistogramSink(h, cm)
+        N = 1000
+        nbatches = 3
+        for i in range(nbatches):
+            rays = ROOT.ARayArray()
+            rays.SetSink(sink)
+            for j in range(N):
+                x = -15*cm + 30*cm * j / N
+                ray = ROOT.ARay(j, 400*nm, x, 0, 5*cm, 0, 0, 0, -1)
+                rays.Add(ray)
+            manager.TraceNonSequential(rays)
+
+            self.assertEqual(rays.GetFocused().GetEntries(), 0)
+            self.assertEqual(rays.GetExited().GetEntries(), 0)
+            self.assertEqual(rays.GetRunning().GetEntries(), 0)
+
+        # rays at |x| < 10 cm hit the focal surface
+        self.assertAlmostEqual(h.GetEntries(), nbatches * N * 2 / 3., delta=nbatches*2)
+        self.assertAlmostEqual(h.GetMean(1), 0, delta=0.1)
+
+        cleanupGeo()
+
+    def testRayDisplay(self):
+        manager = makeTheWorld()
+
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
+
+        # the display collects 1 in 10 rays up to 60 rays as a sink
+        display = ROOT.ARayDisplay(ROOT.ARayDisplay.kColorWavelength)
+        display.SetDecimation(10, 60)
+        rays = ROOT.ARayArray()
+        rays.SetSink(display)
+        N = 1000
+        for j in range(N):
+            x = -15*cm + 30*cm * j / N
+            rays.Add(ROOT.ARay(j, 400*nm, x, 0, 5*cm, 0, 0, 0, -1))
+        manager.TraceNonSequential(rays)
+
+        self.assertEqual(display.GetNadded(), N)
+        self.assertEqual(display.GetN(), 60)
+        self.assertEqual(display.GetNpoints(), 60*2)  # start and end points
+
+        display.Clear()
+        self.assertEqual(display.GetN(), 0)
+        self.assertEqual(display.GetNpoints(), 0)
+
+        cleanupGeo()
+
+    def testRayPool(self):
+        manager = makeTheWorld()
+
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
+
+        # rays allocated in small blocks must behave as those on the heap
+        N = 100
+        rays = ROOT.ARayArray()
+        rays.EnablePool(16)
+        self.assertTrue(rays.IsPooled())
+        for event in range(3):
+            other = ROOT.ARayArray()
+            other.EnablePool(16)
+            for j in range(N):
+                x = -15*cm + 30*cm * j / N
+                rays.NewRay(j, 400*nm, x, 0, 5*cm, 0, 0, 0, -1)
+                other.NewRay(j, 400*nm, x, 0, 5*cm, 0, 0, 0, -1)
+            rays.Add(ROOT.ARay(0, 400*nm, 0, 0, 5*cm, 0, 0, 0, -1))  # on heap
+            rays.Merge(other)
+            del other
+
+            manager.TraceNonSequential(rays)
+            nfocused = rays.GetFocused().GetLast() + 1
+            nexited = rays.GetExited().GetLast() + 1
+            self.assertEqual(nfocused + nexited, 2 * N + 1)
+            self.assertAlmostEqual(nfocused, 2 * N * 2 / 3. + 1, delta=3)
+
+            rays.Clear()  # release the whole event at once
+            self.assertEqual(rays.GetFocused().GetEntries(), 0)
+
+        cleanupGeo()
+
+    def testMemoryUsage(self):
+        manager = makeTheWorld()
+        ns = ROOT.AOpticsManager.ns()
+
+        lensbox = ROOT.TGeoBBox("lensbox", 10*cm, 10*cm, 0.5*cm)
+        lens = ROOT.ALens("lens", lensbox)
+        lens.SetRefractiveIndex(ROOT.air)
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("trfocal", 0, 0, -5*cm)
+        registerGeo((lensbox, lens, focalbox, focal, tr))
+        manager.GetTopVolume().AddNode(lens, 1)
+        manager.GetTopVolume().AddNode(focal, 1, tr)
+        manager.CloseGeometry()
 
-        condition = ROOT.ABorderSurfaceCondition(manager.GetTopVolume(), mirror)
-        registerGeo((mirrorbox, mirror, condition))
+        # the points and the node history grow by chunks
+        ray = ROOT.ARay(0, 400*nm, 0, 0, 0, 0, 0, 0, -1)
+        points = ray.GetPointsMemory()
+        self.assertGreater(points, 0)
+        for i in range(100):
+            ray.AddPoint(0, 0, -i*cm, i*ns)
+        self.assertGreaterEqual(ray.GetPointsMemory(), 101 * 4 * 8)
+        self.assertEqual(ray.GetMemoryUsage(),
+                         ray.GetPointsMemory() + ray.GetNodeHistoryMemory() +
+                         ROOT.ARay.Class().Size())
+
+        # the live counter follows the rays being created and deleted
+        del ray
+        gc.collect()
+        before = ROOT.ARay.GetLiveMemory()
+        rays = [ROOT.ARay(i, 400*nm, 0, 0, 0, 0, 0, 0, -1) for i in range(10)]
+        for ray in rays:
+            for i in range(20):
+                ray.AddPoint(0, 0, -i*cm, i*ns)
+        self.assertEqual(ROOT.ARay.GetLiveMemory() - before,
+                         sum(ray.GetMemoryUsage() for ray in rays))
+        del ray, rays
+        gc.collect()
+        self.assertEqual(ROOT.ARay.GetLiveMemory(), before)
+
+        rayarray = ROOT.ARayArray()
+        for i in range(10):
+            rayarray.Add(ROOT.ARay(i, 400*nm, (i - 4.5)*cm, 0, 5*cm, 0, 0, 0, -1))
+        manager.TraceNonSequential(rayarray)
+        points, nodes, objects = (ctypes.c_ulonglong() for i in range(3))
+        total = rayarray.GetMemoryUsage(points, nodes, objects)
+        self.assertGreater(points.value, 0)
+        self.assertGreater(nodes.value, 0)
+        self.assertEqual(points.value + nodes.value + objects.value, total)
+
+        geometry, optics = ctypes.c_ulonglong(), ctypes.c_ulonglong()
+        total = manager.GetMemoryUsage(geometry, optics)
+        self.assertGreater(geometry.value, 0)
+        self.assertGreaterEqual(optics.value, ROOT.air.GetMemoryUsage())
+        self.assertEqual(geometry.value + optics.value, total)
+
+        # a material shared by the two components is counted once
+        ROOT.gROOT.ProcessLine('std::shared_ptr<ARefractiveIndex> memA(new ARefractiveIndex(1.5));')
+        ROOT.gROOT.ProcessLine('std::shared_ptr<ARefractiveIndex> memB(new ARefractiveIndex(1.6));')
+        mixedAB = ROOT.AMixedRefractiveIndex(ROOT.memA, ROOT.memB, 1, 1)
+        mixedAA = ROOT.AMixedRefractiveIndex(ROOT.memA, ROOT.memA, 1, 1)
+        self.assertEqual(mixedAB.GetMemoryUsage() - mixedAA.GetMemoryUsage(),
+                         ROOT.memB.GetMemoryUsage())
 
-        ROOT.gROOT.ProcessLine('auto mirror_layer = std::make_shared<AMultilayer>(air, Al)');
-        ROOT.mirror_layer.InsertLayer(ROOT.SiO2, 25.4*nm)
+        cleanupGeo()
 
-        condition.SetMultilayer(ROOT.mirror_layer)
+    def testCorsikaDriver(self):
+        manager = makeTheWorld()
 
-        manager.GetTopVolume().AddNode(mirror, 1)
+        focalbox = ROOT.TGeoBBox("focalbox", 15*m, 15*m, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
         manager.CloseGeometry()
 
-        N = 100000
+        # the merged output of two ranks must contain the same photons as the
+        # output of one rank
+        nranks = 2
+        entries = []
+        for n in (1, nranks):
+            output = "corsika_driver_%d.root" % n
+            for rank in range(n):
+                driver = ROOT.ACorsikaIACTDriver(manager, 10*m)
+                driver.AddFile("muon_ring4.corsika.gz")
+                driver.SetRank(rank, n)
+                self.assertGreaterEqual(driver.Run(output), 0)
+            self.assertTrue(ROOT.ACorsikaIACTDriver.Merge(output, n, True))
+
+            f = ROOT.TFile(output)
+            entries.append(f.Get("photons").GetEntries())
+            f.Close()
+            os.remove(output)
+
+        self.assertGreater(entries[0], 0)
+        self.assertEqual(entries[0], entries[1])
 
-        for wl in range(300, 1100, 100):
-            rays = ROOT.ARayArray()
-            for i in range(N):
-                ray = ROOT.ARay(i, wl * nm, 0, 0, 0.51*m, 0, 1, 0, -1)
-                rays.Add(ray)
-                manager.TraceNonSequential(rays)
+        cleanupGeo()
 
-            n_exited = rays.GetExited().GetEntries()
-            n_absorbed = rays.GetAbsorbed().GetEntries()
-            self.assertEqual(n_exited + n_absorbed, N)
+    def testCheckpoint(self):
+        manager = makeTheWorld()
 
-            reflectance = ctypes.c_double()
-            transmittance = ctypes.c_double()
-            ROOT.mirror_layer.CoherentTMMMixed(ROOT.std.complex(ROOT.double)(45 * deg), wl * nm, reflectance, transmittance)
+        focalbox = ROOT.TGeoBBox("focalbox", 15*m, 15*m, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
 
-            expected = N * reflectance.value
-            e = expected**0.5
-            self.assertGreater(n_exited,  expected - 3*e)
-            self.assertLess(n_exited, expected + 3*e)
+        hist = ROOT.TH1D("checkpoint_hist", "", 10, 0, 10)
+        hist.SetDirectory(0)
+
+        def run(output, steps):
+            # trace the file in steps as if the job were killed after each
+            manager.SetRandomSeed(1234)
+            ROOT.gRandom.SetSeed(5678)
+            hist.Reset()
+            hist.Fill(3)
+            driver = ROOT.ACorsikaIACTDriver(manager, 10*m)
+            driver.AddFile("muon_ring4.corsika.gz")
+            driver.SetBunchTracing(True)
+            driver.AddAccumulator(hist)
+            name = str(driver.GetRankFileName(output, 0))
+            for i, n in enumerate(steps):
+                if i > 0:
+                    # must be restored from the checkpoint
+                    manager.SetRandomSeed(1)
+                    ROOT.gRandom.SetSeed(1)
+                    hist.Reset()
+                self.assertGreaterEqual(driver.Run(output, i > 0, n), 0)
+                f = ROOT.TFile(name)
+                self.assertEqual(bool(f.Get("checkpoint")), n >= 0)
+                f.Close()
+            self.assertEqual(hist.GetBinContent(hist.FindBin(3)), 1)
+
+            f = ROOT.TFile(name)
+            photons = f.Get("photons")
+            result = (photons.GetEntries(), photons.GetMaximum("t"),
+                      photons.GetMinimum("x"))
+            f.Close()
+            os.remove(name)
+            return result
+
+        expected = run("checkpoint_full.root", (-1,))
+        self.assertGreater(expected[0], 0)
+        self.assertEqual(run("checkpoint_steps.root", (1, 0, 1, -1)), expected)
 
         cleanupGeo()
 
-    def testLensBoundaryMultilayer(self):
+    def testAsphericPolynomial(self):
+        k = array.array('d', [1e-3, -2e-5, 3e-7, -4e-9, 5e-11, -6e-13, 7e-15,
+                              -8e-17, 9e-19, -1e-20, 1e-22, -1e-24])
+        for n in (3, 10, 12):
+            disk = ROOT.AGeoAsphericDisk("disk", 0, 0.01, 5, -0.02, 20)
+            disk.SetPolynomials(n, k, n, k)
+
+            # the Horner evaluation must agree with the power series
+            r = array.array('d', [0.5 * i for i in range(40)])
+            z = array.array('d', [0] * len(r))
+            dzdr = array.array('d', [0] * len(r))
+            disk.CalcSag(2, len(r), r, z, dzdr)
+            for i in range(len(r)):
+                c = -0.02
+                s = 1 - r[i]**2 * c**2
+                f = 5 + r[i]**2 * c / (1 + s**0.5)
+                df = r[i] * c / s**0.5
+                for j in range(n):
+                    f += k[j] * r[i]**(2 * (j + 1))
+                    df += 2 * (j + 1) * k[j] * r[i]**(2 * j + 1)
+                self.assertAlmostEqual(z[i], f, delta=1e-9 * abs(f) + 1e-12)
+                self.assertAlmostEqual(dzdr[i], df,
+                                       delta=1e-9 * abs(df) + 1e-12)
+                self.assertAlmostEqual(disk.CalcF2(r[i]), z[i], places=12)
+                self.assertAlmostEqual(disk.CalcdF2dr(r[i]), dzdr[i],
+                                       places=12)
+
+    def testAsphericDomain(self):
+        # surface 1 (R = 10 cm) is not defined beyond 10 cm from the axis
+        disk = ROOT.AGeoAsphericDisk("disk", 0, 1/(10*cm), 5*cm, 0, 20*cm)
+        z = ctypes.c_double(-1)
+        dzdr = ctypes.c_double(-1)
+        self.assertTrue(disk.EvalSag(1, 6*cm, z, dzdr))
+        self.assertAlmostEqual(z.value, disk.CalcF1(6*cm))
+        self.assertAlmostEqual(dzdr.value, disk.CalcdF1dr(6*cm))
+        self.assertFalse(disk.EvalSag(1, 15*cm, z))
+        self.assertAlmostEqual(z.value, disk.CalcF1(6*cm))  # untouched
+
+        # the navigation methods do not raise outside the domain
+        point = array.array('d', [15*cm, 0, 3*cm])
+        self.assertFalse(disk.Contains(point))
+        self.assertGreaterEqual(disk.Safety(point, False), 0)
+        self.assertTrue(disk.Contains(array.array('d', [5*cm, 0, 3*cm])))
+        self.assertFalse(disk.Contains(array.array('d', [5*cm, 0, 1*mm])))
+
+    def testAsphereIntersection(self):
+        # a sphere of R = 50 cm whose center is at (0, 0, 50 cm)
+        R = 50*cm
+        disk = ROOT.AGeoAsphericDisk("disk", 0, 1/R, 10*cm, 0, 20*cm)
+        ROOT.AGeoAsphericDisk.ResetSolverStatistics()
+        ROOT.AGeoAsphericDisk.EnableSolverStatistics()
+
+        # steep rays which the spherical estimate used to miss
+        for deg_ in (0, 30, 60, 80, 89):
+            theta = deg_ * deg
+            x = array.array('d', [-5*cm, 0, -1*cm])
+            d = array.array('d', [ROOT.TMath.Sin(theta), 0,
+                                  ROOT.TMath.Cos(theta)])
+            dist = disk.DistToAsphere(1, x, d)
+
+            # analytic intersection with the sphere
+            c = [x[0], x[1], x[2] - R]
+            b = sum(c[i] * d[i] for i in range(3))
+            q = sum(c[i]**2 for i in range(3)) - R**2
+            t = -b - (b * b - q)**0.5
+            p = [x[i] + t * d[i] for i in range(3)]
+            if t > 0 and (p[0]**2 + p[1]**2)**0.5 <= 20*cm:
+                self.assertAlmostEqual(dist, t, places=8)
+            else:
+                self.assertGreater(dist, 1e10)
+
+        ROOT.AGeoAsphericDisk.EnableSolverStatistics(False)
+        calls = ctypes.c_ulonglong()
+        iterations = ctypes.c_ulonglong()
+        misses = ctypes.c_ulonglong()
+        ROOT.AGeoAsphericDisk.GetSolverStatistics(calls, iterations, misses)
+        self.assertEqual(calls.value, 5)
+        self.assertLess(iterations.value, 5 * 20)
+
+    def testBezierSections(self):
+        tolerance = 0.01*mm
+        for cls, args in ((ROOT.AGeoBezierPcon, (0, 360)),
+                          (ROOT.AGeoBezierPgon, (0, 360, 6))):
+            shape = cls("bezier", *(args + (200, 2*cm, 1*cm, 2*cm)))
+            shape.SetMaxDeviation(tolerance)
+            shape.SetControlPoints(0.39, 0.18, 0.87, 0.36)
+            n = shape.GetNz()
+            self.assertGreater(n, 2)
+            self.assertLess(n, 200)
+
+            # the polycone must follow the curve within the tolerance
+            r, z = ctypes.c_double(), ctypes.c_double()
+            for i in range(1001):
+                shape.Bezier(i / 1000., r, z)
+                j = max(k for k in range(n - 1) if shape.GetZ(k) <= z.value)
+                z0, z1 = shape.GetZ(j), shape.GetZ(j + 1)
+                r0, r1 = shape.GetRmax(j), shape.GetRmax(j + 1)
+                rlin = r0 + (r1 - r0) * (z.value - z0) / (z1 - z0)
+                self.assertLess(abs(r.value - rlin), 1.5 * tolerance)
+
+    def testWinstonConeSafety(self):
+        rnd = ROOT.TRandom3(1)
+        cones = (ROOT.AGeoWinstonCone2D("cone2d", 2*cm, 1*cm, 3*cm),
+                 ROOT.AGeoWinstonConePoly("conepoly", 2*cm, 1*cm, 6))
+        for cone in cones:
+            dz = cone.GetDZ()
+            for i in range(200):
+                x = array.array('d', [rnd.Uniform(-3*cm, 3*cm),
+                                      rnd.Uniform(-3*cm, 3*cm),
+                                      rnd.Uniform(-1.2 * dz, 1.2 * dz)])
+                inside = cone.Contains(x)
+                safe = cone.Safety(x, inside)
+                self.assertGreaterEqual(safe, 0)
+
+                # the safety must not exceed the distance along any direction
+                for j in range(20):
+                    dx, dy, dz_ = (ctypes.c_double(), ctypes.c_double(),
+                                   ctypes.c_double())
+                    rnd.Sphere(dx, dy, dz_, 1)
+                    d = array.array('d', [dx.value, dy.value, dz_.value])
+                    if inside:
+                        dist = cone.DistFromInside(x, d, 3)
+                    else:
+                        dist = cone.DistFromOutside(x, d, 3)
+                    self.assertLessEqual(safe, dist + 1e-9)
+
+    def testWinstonCone2DInsideSafety(self):
+        cone = ROOT.AGeoWinstonCone2D("cone2d", 2*cm, 1*cm, 3*cm)
+        dz = cone.GetDZ()
+        d = array.array('d', [0, 0, 1])
+        safe = ctypes.c_double()
+        for z in (dz - 1*mm, -dz + 1*mm):
+            # on the axis, the closest surface is the end face 1 mm away
+            x = array.array('d', [0, 0, z])
+            self.assertTrue(cone.Contains(x))
+            dist = cone.DistFromInside(x, d, 0, ROOT.TGeoShape.Big(), safe)
+            self.assertEqual(dist, ROOT.TGeoShape.Big())
+            self.assertAlmostEqual(safe.value, 1*mm, 9)
+            dist = cone.DistFromInside(x, d, 1, 0.5*mm, safe)
+            self.assertEqual(dist, ROOT.TGeoShape.Big())
+
+    def testWinstonConePolyInsideSafety(self):
+        cone = ROOT.AGeoWinstonConePoly("conepoly", 2*cm, 1*cm, 6)
+        dz = cone.GetDZ()
+        d = array.array('d', [0, 0, 1])
+        safe = ctypes.c_double()
+        for z in (dz - 1*mm, -dz + 1*mm):
+            # on the axis, the closest surface is the end face 1 mm away
+            x = array.array('d', [0, 0, z])
+            self.assertTrue(cone.Contains(x))
+            dist = cone.DistFromInside(x, d, 0, ROOT.TGeoShape.Big(), safe)
+            self.assertEqual(dist, ROOT.TGeoShape.Big())
+            self.assertAlmostEqual(safe.value, 1*mm, 9)
+            dist = cone.DistFromInside(x, d, 1, 0.5*mm, safe)
+            self.assertEqual(dist, ROOT.TGeoShape.Big())
+
+    def testSegmentedMirror(self):
         manager = makeTheWorld()
 
-        lensbox = ROOT.TGeoBBox("lensbox", 0.5*m, 0.5*m, 0.5*m)
-        lens = ROOT.AMirror("lens", lensbox)
+        # Davies-Cotton dish of 19 hexagonal facets
+        F = 1*m
+        a = 5*cm
+        dish = ROOT.AGeoSegmentedMirror("dish", 1*cm, 6)
+        centers = []
+        for i in range(-2, 3):
+            for j in range(-2, 3):
+                if abs(i + j) > 2:
+                    continue
+                x = (i + j / 2.) * 2.02 * a
+                y = j * 3**0.5 / 2 * 2.02 * a
+                z = F - (F**2 - x**2 - y**2)**0.5
+                n = (-x, -y, 2 * F - z)
+                dish.AddFacet(x, y, z, n[0], n[1], n[2], 2 * F, a)
+                centers.append((x, y, z))
+        self.assertEqual(dish.GetNfacets(), 19)
+
+        mirror = ROOT.AMirror("mirror", dish)
+        focalbox = ROOT.TGeoBBox("focalbox", 5*cm, 5*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        tr = ROOT.TGeoTranslation("tr", 0, 0, F + 1*mm)
+        registerGeo((dish, mirror, focalbox, focal, tr))
+        manager.GetTopVolume().AddNode(mirror, 1)
+        manager.GetTopVolume().AddNode(focal, 1, tr)
+        manager.CloseGeometry()
 
-        condition = ROOT.ABorderSurfaceCondition(manager.GetTopVolume(), lens)
-        registerGeo((lensbox, lens, condition))
+        for k, c in enumerate(centers):
+            p = array.array('d', [c[0], c[1], c[2] + 1*mm])
+            q = array.array('d', [c[0], c[1], c[2] - 1*mm])
+            self.assertEqual(dish.FindFacet(q), k)
+            self.assertTrue(dish.Contains(q))
+            self.assertFalse(dish.Contains(p))
 
-        ROOT.gROOT.ProcessLine('auto lens_layer = std::make_shared<AMultilayer>(air, Si)');
-        ROOT.lens_layer.InsertLayer(ROOT.SiO2, 2000 * nm)
-        ROOT.lens_layer.InsertLayer(ROOT.Si3N4, 33 * nm)
+        rays = ROOT.ARayArray()
+        for k, c in enumerate(centers):
+            rays.Add(ROOT.ARay(k, 400*nm, c[0], c[1], 0.5*m, 0, 0, 0, -1))
+        manager.TraceNonSequential(rays)
 
-        condition.SetMultilayer(ROOT.lens_layer)
+        focused = rays.GetFocused()
+        self.assertEqual(focused.GetLast() + 1, len(centers))
+        p = array.array('d', [0, 0, 0, 0])
+        for k in range(len(centers)):
+            focused.At(k).GetLastPoint(p)
+            self.assertAlmostEqual(p[0], 0, 6)
+            self.assertAlmostEqual(p[1], 0, 6)
 
-        manager.GetTopVolume().AddNode(lens, 1)
+        cleanupGeo()
+
+    def testBakedTables(self):
+        graph = ROOT.TGraph()
+        qe = ROOT.TGraph()
+        for i, wl in enumerate((300, 350, 420, 555, 700)):
+            graph.SetPoint(i, wl*nm, (0.8, 0.85, 0.92, 0.7, 0.6)[i])
+            qe.SetPoint(i, wl*nm, (0.1, 0.3, 0.25, 0.1, 0.)[i])
+        ROOT.SetOwnership(qe, False)
+
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 1*cm, 1*cm, 1*cm)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+        focal = ROOT.AFocalSurface("focal", mirrorbox)
+        registerGeo((mirrorbox, mirror, focal))
+        ROOT.gROOT.ProcessLine('graph = std::make_shared<TGraph>();')
+        for i in range(graph.GetN()):
+            ROOT.graph.SetPoint(i, graph.GetX()[i], graph.GetY()[i])
+        mirror.SetReflectance(ROOT.graph)
+        focal.SetQuantumEfficiency(qe)
+
+        index = ROOT.ASellmeierFormula(1.03961212, 0.231792344, 1.01046945,
+                                       0.00600069867, 0.0200179144,
+                                       103.560653)
+        expected = [index.GetRefractiveIndex(wl*nm) for wl in range(300, 701)]
+
+        self.assertTrue(mirror.BakeReflectance(1e-5))
+        self.assertTrue(focal.BakeQuantumEfficiency(1e-5))
+        self.assertTrue(index.BakeTable(300*nm, 700*nm, 1e-7))
+        self.assertTrue(index.IsBaked())
+
+        for i, wl in enumerate(range(300, 701)):
+            self.assertAlmostEqual(mirror.GetReflectance(wl*nm, 0),
+                                   graph.Eval(wl*nm), 5)
+            self.assertAlmostEqual(focal.GetQuantumEfficiency(wl*nm),
+                                   qe.Eval(wl*nm), 5)
+            self.assertAlmostEqual(index.GetTabulatedRefractiveIndex(wl*nm),
+                                   expected[i], 7)
+
+        # out of the range
+        self.assertAlmostEqual(index.GetTabulatedRefractiveIndex(800*nm),
+                               index.GetRefractiveIndex(800*nm), 12)
+
+        cleanupGeo()
+
+    def testReflectanceGrid(self):
+        mirrorbox = ROOT.TGeoBBox("mirrorbox", 1*cm, 1*cm, 1*cm)
+        mirror = ROOT.AMirror("mirror", mirrorbox)
+        registerGeo((mirrorbox, mirror))
+
+        ROOT.gROOT.ProcessLine('th2 = std::make_shared<TH2D>("th2", "", 20, 300e-9, 700e-9, 9, 0, 1.5707963);')
+        for i in range(1, 21):
+            for j in range(1, 10):
+                ROOT.th2.SetBinContent(i, j, 0.5 + 0.4 * ROOT.TMath.Sin(i * 0.3) * ROOT.TMath.Cos(j * 0.2))
+        mirror.SetReflectance(ROOT.th2)
+
+        rnd = ROOT.TRandom3(1)
+        xaxis = ROOT.th2.GetXaxis()
+        yaxis = ROOT.th2.GetYaxis()
+        for i in range(1000):
+            wl = rnd.Uniform(xaxis.GetBinCenter(1), xaxis.GetBinCenter(20))
+            angle = rnd.Uniform(yaxis.GetBinCenter(1), yaxis.GetBinCenter(9))
+            self.assertAlmostEqual(mirror.GetReflectance(wl, angle),
+                                   ROOT.th2.Interpolate(wl, angle), 3)
+
+        # clamped to the edges of the data
+        self.assertAlmostEqual(mirror.GetReflectance(200e-9, 0),
+                               ROOT.th2.GetBinContent(1, 1), 3)
+
+        cleanupGeo()
+
+    def testMultilayerTables(self):
+        layer = ROOT.AMultilayer(ROOT.air, ROOT.TiO2)
+        self.assertTrue(layer.PrecomputeTables(300 * nm, 700 * nm, 0, 60 * deg, 1e-3))
+
+        table = layer.GetReflectanceTable()
+        self.assertFalse(table.IsEmpty())
+        self.assertLess(table.GetMaxDeviation(), 1e-3)
+
+        direct = ROOT.AMultilayer(ROOT.air, ROOT.TiO2)
+        rnd = ROOT.TRandom3(1)
+        for i in range(200):
+            wl = rnd.Uniform(300 * nm, 700 * nm)
+            angle = ROOT.std.complex(ROOT.double)(rnd.Uniform(0, 60 * deg))
+            r1, t1 = ctypes.c_double(), ctypes.c_double()
+            r2, t2 = ctypes.c_double(), ctypes.c_double()
+            layer.CoherentTMMMixed(angle, wl, r1, t1)
+            direct.CoherentTMMMixed(angle, wl, r2, t2)
+            self.assertAlmostEqual(r1.value, r2.value, 2)
+            self.assertAlmostEqual(t1.value, t2.value, 2)
+
+        # the tables of the old layers must not be used any longer
+        layer.InsertLayer(ROOT.TiO2, 100 * nm)
+        self.assertTrue(layer.GetReflectanceTable().IsEmpty())
+        self.assertTrue(layer.PrecomputeTables(300 * nm, 700 * nm, 0, 60 * deg, 1e-3))
+        layer.ChangeThickness(1, 120 * nm)
+        self.assertTrue(layer.GetReflectanceTable().IsEmpty())
+        self.assertTrue(layer.PrecomputeTables(300 * nm, 700 * nm, 0, 60 * deg, 1e-3))
+
+        layer.ClearTables()
+        self.assertTrue(layer.GetReflectanceTable().IsEmpty())
+
+    def testBatchDispersion(self):
+        nbk7 = ROOT.ASellmeierFormula(1.03961212, 0.231792344, 1.01046945,
+                                      0.00600069867, 0.0200179144, 103.560653)
+        schott = ROOT.ASchottFormula(2.2718929, -1.0108077e-2, 1.0592509e-2,
+                                     2.0816965e-4, -7.6472538e-6, 4.9240991e-7)
+        cauchy = ROOT.ACauchyFormula(1.458, 0.00354)
+        ROOT.gROOT.ProcessLine('auto batch_bk7 = std::make_shared<ASellmeierFormula>(1.03961212, 0.231792344, 1.01046945, 0.00600069867, 0.0200179144, 103.560653);')
+        ROOT.gROOT.ProcessLine('auto batch_cauchy = std::make_shared<ACauchyFormula>(1.458, 0.00354);')
+        mixed = ROOT.AMixedRefractiveIndex(ROOT.batch_bk7, ROOT.batch_cauchy, 0.3, 0.7)
+
+        N = 1000
+        lam = array.array('d', [300 * nm + i * 0.7 * nm for i in range(N)])
+        n = array.array('d', [0.] * N)
+        for index in (nbk7, schott, cauchy, mixed):
+            index.GetRefractiveIndex(lam, n, N)
+            for i in range(0, N, 37):
+                self.assertAlmostEqual(n[i], index.GetRefractiveIndex(lam[i]), 12)
+
+    def testTraceArrays(self):
+        manager = makeTheWorld()
+
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
         manager.CloseGeometry()
 
+        # arrays traced together must get back only their own rays
+        arrays = ROOT.std.vector("ARayArray*")()
+        keep = []
+        for k in range(3):
+            rays = ROOT.ARayArray()
+            for j in range(100 * (k + 1)):
+                x = (k - 1) * 8*cm  # arrays at x = -8, 0, 8 cm
+                rays.NewRay(j, 400*nm, x, 0, 5*cm, 0, 0, 0, -1)
+            keep.append(rays)
+            arrays.push_back(rays)
+        manager.TraceNonSequential(arrays)
+
+        for k in range(3):
+            focused = keep[k].GetFocused()
+            self.assertEqual(focused.GetLast() + 1, 100 * (k + 1))
+            self.assertEqual(keep[k].GetRunning().GetEntries(), 0)
+            p = array.array("d", [0, 0, 0, 0])
+            for i in range(focused.GetLast() + 1):
+                focused.At(i).GetLastPoint(p)
+                self.assertAlmostEqual(p[0], (k - 1) * 8*cm)
+
+        cleanupGeo()
+
+    def testD80Unbinned(self):
+        x0 = 1
+        y0 = -1
+        r0 = 2
         N = 100000
+        xs = array.array('d', [0] * N)
+        ys = array.array('d', [0] * N)
+        x, y, r = ctypes.c_double(), ctypes.c_double(), ctypes.c_double()
+        for i in range(N):
+            ROOT.gRandom.Circle(x, y, r0)
+            scale = ROOT.gRandom.Uniform(0, 1)
+            xs[i] = x.value * scale + x0
+            ys[i] = y.value * scale + y0
 
-        for wl in range(300, 600, 50):
-            rays = ROOT.ARayArray()
-            for i in range(N):
-                ray = ROOT.ARay(i, wl * nm, 0, 0, 0.51*m, 0, 1, 0, -1)
-                rays.Add(ray)
-                manager.TraceNonSequential(rays)
+        # the same containment as that of the histogram in testD80
+        ROOT.AGeoUtil.ContainmentRadius(N, xs, ys, 0.8, r, x, y)
+        tor = 0.015
+        self.assertLessEqual(abs(x.value / x0 - 1.), tor)
+        self.assertLessEqual(abs(y.value / y0 - 1.), tor)
+        self.assertLessEqual(abs(r.value / r0 - 0.8)/0.8, tor)
 
-            n_exited = rays.GetExited().GetEntries()
-            n_absorbed = rays.GetAbsorbed().GetEntries()
-            self.assertEqual(n_exited + n_absorbed, N)
+    def testFocalPlaneMonitor(self):
+        manager = makeTheWorld()
+        manager.SetMultiThread(True)
+        manager.SetMaxThreads(4)
 
-            reflectance = ctypes.c_double()
-            transmittance = ctypes.c_double()
-            ROOT.lens_layer.CoherentTMMMixed(ROOT.std.complex(ROOT.double)(45 * deg), wl * nm, reflectance, transmittance)
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
 
-            expected = N * reflectance.value
-            e = expected**0.5
-            self.assertGreater(n_exited,  expected - 3*e)
-            self.assertLess(n_exited, expected + 3*e)
+        # the monitor must see the same hits as the focused rays
+        h = ROOT.TH2D("hmonitor", "", 40, -20, 20, 40, -20, 20)
+        ht = ROOT.TH1D("htmonitor", "", 100, 0, 1)
+        monitor = ROOT.AFocalPlaneMonitor(h, cm)
+        monitor.SetTimeHistogram(ht, ROOT.AOpticsManager.ns())
+        focal.SetMonitor(monitor)
+
+        N = 3000
+        rays = ROOT.ARayArray()
+        for j in range(N):
+            x = -15*cm + 30*cm * j / N
+            rays.NewRay(j, 400*nm, x + 2*cm, 1*cm, 5*cm, 0, 0, 0, -1)
+        manager.TraceNonSequential(rays)
+        focal.SetMonitor(0)
+
+        nfocused = rays.GetFocused().GetLast() + 1
+        self.assertEqual(monitor.GetEntries(), nfocused)
+        self.assertEqual(h.GetEntries(), nfocused)
+        self.assertEqual(ht.GetEntries(), nfocused)
+        self.assertAlmostEqual(monitor.GetMeanX(), 0.5*cm, delta=0.1*cm)
+        self.assertAlmostEqual(monitor.GetMeanY(), 1*cm, delta=1e-6*cm)
+        self.assertAlmostEqual(monitor.GetRMSY(), 0, delta=1e-6*cm)
 
         cleanupGeo()
 
-    def testMirrorScattaring(self):
+    def testCameraMap(self):
+        ns = ROOT.AOpticsManager.ns()
+        # square lattice of 4x3 pixels with 1-mm gaps
+        square = ROOT.ACameraMap()
+        square.SetSquareLattice(1*cm, 4, 3, 0.9*cm)
+        self.assertEqual(square.GetNpixels(), 12)
+        self.assertEqual(square.FindPixel(-1.5*cm, -1*cm), 0)
+        self.assertEqual(square.FindPixel(1.5*cm, 1*cm), 11)
+        self.assertEqual(square.FindPixel(0.01*cm, 0.01*cm), 6)
+        self.assertEqual(square.FindPixel(0.98*cm, 0), -1)  # in a gap
+        self.assertEqual(square.FindPixel(2.1*cm, 0), -1)
+
+        # every pixel center of a hexagonal lattice maps to its own ID
+        hexagon = ROOT.ACameraMap()
+        hexagon.SetHexagonalLattice(1*cm, 3)
+        self.assertEqual(hexagon.GetNpixels(), 37)
+        x, y = ctypes.c_double(), ctypes.c_double()
+        for i in range(hexagon.GetNpixels()):
+            hexagon.GetPixelCenter(i, x, y)
+            self.assertEqual(hexagon.FindPixel(x.value, y.value), i)
+            self.assertEqual(hexagon.FindPixel(x.value, y.value + 0.49*cm), i)
+        self.assertEqual(hexagon.FindPixel(0, 0), 0)
+        self.assertEqual(hexagon.FindPixel(0, 3.6*cm), -1)
+
+        # L-shaped polygon next to a square
+        poly = ROOT.ACameraMap()
+        lx = array.array('d', [0, 2, 2, 1, 1, 0])
+        ly = array.array('d', [0, 0, 1, 1, 2, 2])
+        sx = array.array('d', [1, 2, 2, 1])
+        sy = array.array('d', [1, 1, 2, 2])
+        self.assertEqual(poly.AddPolygon(6, lx, ly), 0)
+        self.assertEqual(poly.AddPolygon(4, sx, sy), 1)
+        self.assertEqual(poly.FindPixel(0.5, 1.5), 0)
+        self.assertEqual(poly.FindPixel(1.5, 0.5), 0)
+        self.assertEqual(poly.FindPixel(1.5, 1.5), 1)
+        self.assertEqual(poly.FindPixel(2.5, 1.5), -1)
+
+        # pixel counts accumulated by the monitor during tracing
         manager = makeTheWorld()
+        manager.SetMultiThread(True)
+        manager.SetMaxThreads(4)
 
-        mirrorbox = ROOT.TGeoBBox("mirrorbox", 0.5*m, 0.5*m, 0.5*m)
-        mirror = ROOT.AMirror("mirror", mirrorbox)
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
 
-        condition = ROOT.ABorderSurfaceCondition(manager.GetTopVolume(), mirror)
-        registerGeo((mirrorbox, mirror, condition))
+        monitor = ROOT.AFocalPlaneMonitor()
+        monitor.SetCameraMap(square)
+        focal.SetMonitor(monitor)
 
-        sigma = 1
-        condition.SetGaussianRoughness(sigma * deg)
+        rays = ROOT.ARayArray()
+        for j in range(100):
+            rays.NewRay(j, 400*nm, 0.5*cm, 0.2*cm, 5*cm, j*ns, 0, 0, -1)
+        manager.TraceNonSequential(rays)
+        focal.SetMonitor(0)
 
-        manager.GetTopVolume().AddNode(mirror, 1)
-        manager.CloseGeometry()
+        self.assertEqual(square.GetEntries(6), 100)
+        self.assertEqual(square.GetEntries(5), 0)
+        self.assertAlmostEqual(square.GetSumOfWeights(6), 100)
+        first = square.GetFirstTime(6)
+        self.assertGreater(first, 0)
+        self.assertAlmostEqual(square.GetMeanTime(6), first + 49.5*ns,
+                               delta=1e-3*ns)
 
-        if ROOT.gInterpreter.ProcessLine('ROOT_VERSION_CODE;') < \
-           ROOT.gInterpreter.ProcessLine('ROOT_VERSION(6, 2, 0);'):
-            manager.SetMultiThread(True)
+        monitor.Reset()
+        self.assertEqual(square.GetEntries(6), 0)
+
+        cleanupGeo()
+
+    def testRayGenerator(self):
+        manager = makeTheWorld()
+        manager.SetMultiThread(True)
         manager.SetMaxThreads(4)
 
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
+
+        tr = ROOT.TGeoTranslation(1*cm, 0, 5*cm)
+        v = ROOT.TVector3(0, 0, -1)
+
+        # 1 + 6*(1 + 2 + ... + 20) rays, all of them hit the focal surface
+        gen = ROOT.ARayGenerator.Circle(400*nm, 5*cm, 20, 6, 0, tr, v)
+        self.assertEqual(gen.GetN(), 1 + 6*20*21//2)
+        h = ROOT.TH2D("hgenerator", "", 40, -20, 20, 40, -20, 20)
+        sink = ROOT.ARayHistogramSink(h, cm)
+        manager.TraceNonSequential(gen, sink)
+        self.assertEqual(h.GetEntries(), gen.GetN())
+        self.assertAlmostEqual(h.GetMean(1), 1, delta=1e-6)
+        self.assertAlmostEqual(h.GetMean(2), 0, delta=1e-6)
+
+        # history-free tracing reports the hits through the monitor only
+        hm = ROOT.TH2D("hgenmonitor", "", 40, -20, 20, 40, -20, 20)
+        monitor = ROOT.AFocalPlaneMonitor(hm, cm)
+        focal.SetMonitor(monitor)
         N = 10000
+        gen = ROOT.ARayGenerator.RandomCircle(400*nm, 5*cm, N, 0, tr, v)
+        manager.TraceNonSequential(gen)
+        focal.SetMonitor(0)
+        self.assertEqual(monitor.GetEntries(), N)
+        self.assertAlmostEqual(monitor.GetMeanX(), 1*cm, delta=0.1*cm)
+        self.assertAlmostEqual(monitor.GetRMSX(), 2.5*cm, delta=0.1*cm)
+
+        # the same seed gives the same rays
+        mean = []
+        for i in range(2):
+            monitor.Reset()
+            focal.SetMonitor(monitor)
+            manager.SetRandomSeed(1234)
+            manager.TraceNonSequential(gen)
+            focal.SetMonitor(0)
+            mean.append(monitor.GetMeanX())
+        self.assertAlmostEqual(mean[0], mean[1], delta=1e-9*cm)
 
-        rays = ROOT.ARayArray()
-        for i in range(N):
-            ray = ROOT.ARay(i, 400*nm, 0, 0, 0.8*m, 0, 0, 0, -1)
-            rays.Add(ray)
+        cleanupGeo()
 
-        manager.TraceNonSequential(rays)
+    def testAdaptiveTracer(self):
+        manager = makeTheWorld()
+        manager.SetMultiThread(True)
+        manager.SetMaxThreads(4)
 
-        exited = rays.GetExited()
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
 
-        h2 = ROOT.TH2D("h2", "h2", 40, -10*sigma, 10*sigma, 40, -10*sigma, 10*sigma)
+        tr = ROOT.TGeoTranslation(0, 0, 5*cm)
+        v = ROOT.TVector3(0, 0, -1)
+        tracer = ROOT.AAdaptiveTracer(manager)
+        self.assertEqual(
+            tracer.AddObservable(ROOT.AAdaptiveTracer.kFocusedFraction, 0.02),
+            0)
+        # all the rays are focused, and partially focused
+        small = ROOT.ARayGenerator.RandomCircle(400*nm, 1*cm, 1000, 0, tr, v)
+        large = ROOT.ARayGenerator.RandomCircle(400*nm, 20*cm, 1000, 0, tr, v)
+        self.assertEqual(tracer.AddConfiguration(small), 0)
+        self.assertEqual(tracer.AddConfiguration(large), 1)
+        self.assertEqual(tracer.Run(), 2)
+
+        # the noisy configuration needs more rounds than the minimum
+        self.assertEqual(tracer.GetNrounds(0), 4)
+        self.assertEqual(tracer.GetNrays(0), 4000)
+        self.assertAlmostEqual(tracer.GetValue(0, 0), 1)
+        self.assertEqual(tracer.GetError(0, 0), 0)
+        self.assertGreater(tracer.GetNrounds(1), 4)
+        p = 400./(ROOT.TMath.Pi()*20**2)
+        self.assertLessEqual(tracer.GetError(1, 0),
+                             0.02*tracer.GetValue(1, 0))
+        self.assertAlmostEqual(tracer.GetValue(1, 0), p,
+                               delta=5*tracer.GetError(1, 0))
+
+        # give up at the maximum number of rays
+        tracer.Reset()
+        tracer.AddObservable(ROOT.AAdaptiveTracer.kContainmentRadius, 1e-6)
+        tracer.SetMaxRays(3000)
+        self.assertEqual(tracer.Run(), 0)
+        self.assertEqual(tracer.GetNrounds(1), 3)
+        self.assertFalse(tracer.IsConverged(1))
+        self.assertGreater(tracer.GetValue(1, 1), 0)
 
-        for i in range(N):
-            ray = exited.At(i)
-            p = array.array("d", [0, 0, 0, 0])
-            ray.GetDirection(p)
-            px = p[0]
-            py = p[1]
-            pz = p[2]
-            h2.Fill(px * rad / deg, py * rad / deg)
+        cleanupGeo()
 
-        f2 = ROOT.TF2("f2", "[0]*exp(-(x*x + y*y)/(2*[1]*[1]))", -10*sigma, 10*sigma, -10*sigma, 10*sigma)
-        f2.SetParameter(0, 1000)
-        f2.SetParLimits(1, 0, 10)
-        f2.SetParameter(1, sigma)
-        h2.Draw("lego")
-        ROOT.gPad.Update()
-        h2.Fit("f2", "l")
-        p = f2.GetParameter(1)
-        e = f2.GetParError(1)
+    def testRaySymmetry(self):
+        manager = makeTheWorld()
 
-        self.assertGreater(2*sigma, p - 3*e) # reflected angle is 2 times larger
-        self.assertLess(2*sigma, p + 3*e)
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
+
+        # only the sector of 60 deg is traced, and unfolded to the full circle
+        tr = ROOT.TGeoTranslation(0, 0, 5*cm)
+        v = ROOT.TVector3(0, 0, -1)
+        N = 2000
+        gen = ROOT.ARayGenerator.RandomSector(400*nm, 5*cm, 6, N, 0, tr, v)
+        h = ROOT.TH2D("hsymmetry", "", 40, -20, 20, 40, -20, 20)
+        hist = ROOT.ARayHistogramSink(h, cm)
+        sink = ROOT.ARaySymmetrySink(hist, 6, 0, tr)
+        manager.TraceNonSequential(gen, sink)
+
+        self.assertEqual(h.GetEntries(), 6*N)
+        self.assertAlmostEqual(h.GetMean(1), 0, delta=1e-6)
+        self.assertAlmostEqual(h.GetMean(2), 0, delta=1e-6)
+        self.assertAlmostEqual(h.GetRMS(1), 2.5, delta=0.1)
+        self.assertAlmostEqual(h.GetRMS(2), 2.5, delta=0.1)
 
         cleanupGeo()
 
-    def testLimitForSuspended(self):
+    def testRaySampler(self):
+        # low-discrepancy samples cover the aperture much more evenly than
+        # gRandom, whose centroid would fluctuate by ~0.5*r/sqrt(N)
+        r = 1*m
+        N = 1024
+        for policy in (ROOT.ARaySampler.kSobol, ROOT.ARaySampler.kHalton):
+            sampler = ROOT.ARaySampler(policy, 1234)
+            sampler.SetWavelengthRange(300*nm, 600*nm)
+            ROOT.ARayShooter.SetSampler(sampler)
+            rays = ROOT.ARayShooter.RandomCircle(400*nm, r, N)
+            ROOT.ARayShooter.SetSampler(0)
+            self.assertEqual(sampler.GetIndex(), N)
+
+            running = rays.GetRunning()
+            self.assertEqual(running.GetLast() + 1, N)
+            sumx, sumy, suml = 0., 0., 0.
+            for i in range(N):
+                ray = running.At(i)
+                p = array.array("d", [0, 0, 0, 0])
+                ray.GetLastPoint(p)
+                self.assertLessEqual(p[0]**2 + p[1]**2, r**2*(1 + 1e-12))
+                self.assertGreaterEqual(ray.GetLambda(), 300*nm)
+                self.assertLess(ray.GetLambda(), 600*nm)
+                sumx += p[0]
+                sumy += p[1]
+                suml += ray.GetLambda()
+            self.assertAlmostEqual(sumx/N, 0, delta=3e-3*r)
+            self.assertAlmostEqual(sumy/N, 0, delta=3e-3*r)
+            self.assertAlmostEqual(suml/N, 450*nm, delta=1*nm)
+
+    def testUpdateGeometry(self):
         manager = makeTheWorld()
-        manager.SetLimit(1000)
 
-        mirrorsphere = ROOT.TGeoSphere("mirrorsphere", 0.1*m, 0.2*m)
-        mirror = ROOT.AMirror("mirror", mirrorsphere)
-        registerGeo((mirrorsphere, mirror))
+        disk = ROOT.AGeoAsphericDisk("disk", 0, 0, 1*mm, 0, 5*cm)
+        focal = ROOT.AFocalSurface("focal", disk)
+        registerGeo((disk, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
+        node = manager.GetTopVolume().GetNode(0)
 
-        manager.GetTopVolume().AddNode(mirror, 1)
+        def trace():
+            rays = ROOT.ARayShooter.Circle(400*nm, 3*cm, 5, 6, 0,
+                                           ROOT.TGeoTranslation(0, 0, 10*cm),
+                                           ROOT.TVector3(0, 0, -1))
+            manager.TraceNonSequential(rays)
+            focused = rays.GetFocused()
+            z = []
+            for i in range(focused.GetLast() + 1):
+                p = array.array("d", [0, 0, 0, 0])
+                focused.At(i).GetLastPoint(p)
+                z.append(p[2])
+            return z
+
+        z = trace()
+        self.assertEqual(len(z), 1 + 6*5*6//2)
+        for zi in z:
+            self.assertAlmostEqual(zi, 1*mm, delta=1e-6*mm)
+
+        # thicker disk without closing the geometry again
+        disk.SetAsphDimensions(0, 0, 3*mm, 0, 5*cm)
+        manager.UpdateShape(disk)
+        self.assertAlmostEqual(disk.GetDZ(), 1.5*mm)
+        for zi in trace():
+            self.assertAlmostEqual(zi, 3*mm, delta=1e-6*mm)
+
+        # moved node
+        manager.SetNodeMatrix(node, ROOT.TGeoTranslation(0, 0, 2*cm))
+        for zi in trace():
+            self.assertAlmostEqual(zi, 2*cm + 3*mm, delta=1e-6*mm)
+
+        # a facet tilted in place
+        mirror = ROOT.AGeoSegmentedMirror(1*mm, 6)
+        mirror.AddFacet(0, 0, 0, 0, 0, 1, 10*m, 5*cm)
+        mirror.SetFacet(0, 1*cm, 0, 0, 0, 0, 1, 10*m, 5*cm)
+        center = array.array("d", [0, 0, 0])
+        mirror.GetFacetCenter(0, center)
+        self.assertAlmostEqual(center[0], 1*cm)
+        self.assertFalse(mirror.SetFacet(1, 0, 0, 0, 0, 0, 1, 10*m, 5*cm))
+
+        cleanupGeo()
+
+    def testTraceBatch(self):
+        # two geometry variants whose mirrors are shifted along Z
+        managers = []
+        for k in range(2):
+            manager = makeTheWorld()
+            mirrorbox = ROOT.TGeoBBox("mirrorbox%d" % k, 20*cm, 20*cm, 1*mm)
+            mirror = ROOT.AMirror("mirror%d" % k, mirrorbox)
+            mirror.SetReflectance(0.5)
+            tr = ROOT.TGeoTranslation("trmirror%d" % k, 0, 0, k*cm)
+            registerGeo((mirrorbox, mirror, tr))
+            manager.GetTopVolume().AddNode(mirror, 1, tr)
+            manager.CloseGeometry()
+            managers.append(manager)
+        managers[0].SetMultiThread(True)
+        managers[0].SetMaxThreads(4)
+
+        # two field angles for each variant
+        jobs = ROOT.std.vector('AOpticsManager*')()
+        arrays = ROOT.std.vector('ARayArray*')()
+        keep = []
+        for manager in managers:
+            for theta in (0, 5):
+                rot = ROOT.TGeoRotation("", 0, theta, 0)
+                tr = ROOT.TGeoTranslation(0, 0, 10*cm)
+                rays = ROOT.ARayShooter.Circle(400*nm, 10*cm, 10, 6, rot, tr,
+                                               ROOT.TVector3(0, 0, -1))
+                keep += [rot, tr, rays]
+                jobs.push_back(manager)
+                arrays.push_back(rays)
+        multi = managers[1].IsMultiThread()
+        nthreads = managers[1].GetMaxThreads()
+        ROOT.AOpticsManager.TraceBatch(jobs, arrays)
+
+        # the second manager is given back in its own thread mode
+        self.assertEqual(managers[1].IsMultiThread(), multi)
+        self.assertEqual(managers[1].GetMaxThreads(), nthreads)
+
+        N = 1 + 6*10*11//2
+        for k in range(arrays.size()):
+            exited = arrays[k].GetExited().GetLast() + 1
+            absorbed = arrays[k].GetAbsorbed().GetLast() + 1
+            self.assertEqual(exited + absorbed, N)
+            self.assertGreater(exited, N/4)
+            self.assertGreater(absorbed, N/4)
+
+        # common random numbers: the same rays are absorbed in both variants
+        for k in range(2):
+            a0 = arrays[k].GetAbsorbed()
+            a1 = arrays[k + 2].GetAbsorbed()
+            self.assertEqual(a0.GetLast(), a1.GetLast())
+            for i in range(a0.GetLast() + 1):
+                p0 = array.array("d", [0, 0, 0, 0])
+                p1 = array.array("d", [0, 0, 0, 0])
+                a0.At(i).GetLastPoint(p0)
+                a1.At(i).GetLastPoint(p1)
+                # hit points differ by tan(5 deg)*1 cm at most
+                self.assertAlmostEqual(p0[0], p1[0], delta=0.1*cm)
+                self.assertAlmostEqual(p0[1], p1[1], delta=0.1*cm)
+
+        cleanupGeo()
+
+    def testPhotonBufferColumns(self):
+        manager = makeTheWorld()
+        focalbox = ROOT.TGeoBBox("focalbox", 10*cm, 10*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
         manager.CloseGeometry()
 
-        if ROOT.gInterpreter.ProcessLine('ROOT_VERSION_CODE;') < \
-           ROOT.gInterpreter.ProcessLine('ROOT_VERSION(6, 2, 0);'):
-            manager.SetMultiThread(True)
-        manager.SetMaxThreads(4)
+        rays = ROOT.ARayShooter.Circle(400*nm, 5*cm, 5, 6, 0,
+                                       ROOT.TGeoTranslation(0, 0, 10*cm),
+                                       ROOT.TVector3(0, 0, -1))
+        manager.TraceNonSequential(rays)
+        focused = rays.GetFocused()
+
+        buffer = ROOT.APhotonBuffer()
+        n = buffer.AddResults(focused)
+        self.assertEqual(n, focused.GetLast() + 1)
+        self.assertEqual(buffer.GetN(), n)
+
+        try:
+            import numpy
+        except ImportError:
+            return
+        x = numpy.frombuffer(buffer.GetXArray(), dtype=numpy.float64, count=n)
+        z = numpy.frombuffer(buffer.GetZArray(), dtype=numpy.float64, count=n)
+        status = numpy.frombuffer(buffer.GetStatusArray(), dtype=numpy.int32,
+                                  count=n)
+        for i in range(n):
+            p = array.array("d", [0, 0, 0, 0])
+            focused.At(i).GetLastPoint(p)
+            self.assertEqual(x[i], p[0])
+        self.assertTrue(numpy.allclose(z, 1*mm))
+        self.assertTrue((status == ROOT.ARay.kFocus).all())
 
-        ray = ROOT.ARay(0, 400*nm, 0, 0, 0, 0, 0, 0, -1)
+        cleanupGeo()
 
-        manager.TraceNonSequential(ray)
+    def testRayWriter(self):
+        manager = makeTheWorld()
+        focalbox = ROOT.TGeoBBox("focalbox", 5*cm, 5*cm, 1*mm)
+        focal = ROOT.AFocalSurface("focal", focalbox)
+        registerGeo((focalbox, focal))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.CloseGeometry()
+        manager.EnableCompactHistory(True)
 
-        n = ray.GetNpoints()
-        self.assertEqual(n, 1000)
+        # rays out of the focal surface are not written by default
+        N = 1000
+        buffer = ROOT.APhotonBuffer()
+        for i in range(N):
+            x = -10*cm + 20*cm*i/N
+            buffer.Add(400*nm, x, 0, 10*cm, 0, 0, 0, -1)
+        tree = ROOT.TTree("photons", "photons")
+        writer = ROOT.ARayWriter(tree, True, False, 100)
+        manager.SetWriter(writer)
+        manager.TraceNonSequential(buffer)
+        manager.SetWriter(0)
+        nfocused = sum(1 for i in range(N) if buffer.IsFocused(i))
+        self.assertEqual(writer.GetNwritten(), nfocused)
+        total = 0
+        for entry in tree:
+            self.assertLessEqual(entry.n, 100)
+            for i in range(entry.n):
+                self.assertAlmostEqual(entry.z[i], 1*mm)
+                self.assertEqual(entry.status[i], ROOT.ARay.kFocus)
+            total += entry.n
+        self.assertEqual(total, nfocused)
+
+        # all the finished rays with their node histories
+        rays = ROOT.ARayShooter.Circle(400*nm, 8*cm, 8, 6, 0,
+                                       ROOT.TGeoTranslation(0, 0, 10*cm),
+                                       ROOT.TVector3(0, 0, -1))
+        tree2 = ROOT.TTree("photons2", "photons2")
+        writer2 = ROOT.ARayWriter(tree2, False, True)
+        manager.SetWriter(writer2)
+        manager.TraceNonSequential(rays)
+        manager.SetWriter(0)
+        n = rays.GetFocused().GetLast() + rays.GetExited().GetLast() + 2
+        self.assertEqual(writer2.GetNwritten(), n)
+        tree2.GetEntry(0)
+        self.assertEqual(tree2.nhistory, sum(tree2.nnodes[i]
+                                             for i in range(tree2.n)))
+
+        cleanupGeo()
+
+    def testShapeProfiler(self):
+        manager = makeTheWorld()
+
+        disk = ROOT.AGeoAsphericDisk("disk", 0, 0, 1*mm, 1/(1*m), 5*cm)
+        focal = ROOT.AFocalSurface("focal", disk)
+        box = ROOT.TGeoBBox("box", 10*cm, 10*cm, 1*mm)
+        obs = ROOT.AObscuration("obs", box)
+        tr = ROOT.TGeoTranslation("trobs", 0, 0, -5*cm)
+        registerGeo((disk, focal, box, obs, tr))
+        manager.GetTopVolume().AddNode(focal, 1)
+        manager.GetTopVolume().AddNode(obs, 1, tr)
+        manager.CloseGeometry()
+
+        def trace():
+            rays = ROOT.ARayShooter.Circle(400*nm, 3*cm, 5, 6, 0,
+                                           ROOT.TGeoTranslation(0, 0, 10*cm),
+                                           ROOT.TVector3(0, 0, -1))
+            manager.TraceNonSequential(rays)
+            return rays.GetFocused().GetLast() + 1
+
+        nfocused = trace()
+        manager.EnableShapeProfiling(True)
+        profiler = ROOT.AGeoShapeProfiler.GetProfiler(focal.GetShape())
+        self.assertTrue(profiler)
+        self.assertEqual(profiler.GetShape(), disk)
+        self.assertFalse(ROOT.AGeoShapeProfiler.GetProfiler(obs.GetShape()))
+        self.assertTrue(ROOT.AGeoShapeProfiler.IsEnabled())
+
+        # the same results with the profiled shape
+        self.assertEqual(trace(), nfocused)
+        self.assertGreater(profiler.GetCalls(profiler.kDistFromOutside), 0)
+        self.assertGreater(profiler.GetIterations(profiler.kDistFromOutside), 0)
+        self.assertGreater(profiler.GetTotalTime(), 0)
+        ROOT.AGeoShapeProfiler.PrintReport(manager)
+
+        manager.EnableShapeProfiling(False)
+        self.assertEqual(focal.GetShape(), disk)
+        self.assertFalse(ROOT.AGeoShapeProfiler.IsEnabled())
+        self.assertEqual(trace(), nfocused)
+
+        cleanupGeo()
+
+    def testSnapshot(self):
+        manager = makeTheWorld()
+
+        lensbox = ROOT.TGeoBBox("snaplensbox", 5*cm, 5*cm, 1*cm)
+        lens = ROOT.ALens("snaplens", lensbox)
+        mirrorbox = ROOT.TGeoBBox("snapmirrorbox", 5*cm, 5*cm, 1*cm)
+        mirror = ROOT.AMirror("snapmirror", mirrorbox)
+        condition = ROOT.ABorderSurfaceCondition(manager.GetTopVolume(),
+                                                 mirror)
+        tr1 = ROOT.TGeoTranslation("snaptr1", 0, 0, 10*cm)
+        tr2 = ROOT.TGeoTranslation("snaptr2", 0, 0, -10*cm)
+        registerGeo((lensbox, lens, mirrorbox, mirror, condition, tr1, tr2))
+
+        ROOT.gROOT.ProcessLine('auto snap_glass = std::make_shared<ARefractiveIndex>(1.5, 0.)')
+        self.assertTrue(ROOT.snap_glass.BakeTable(300*nm, 700*nm))
+        lens.SetRefractiveIndex(ROOT.snap_glass)
+        ROOT.gROOT.ProcessLine('auto snap_layer = std::make_shared<AMultilayer>(air, Al)')
+        ROOT.snap_layer.InsertLayer(ROOT.SiO2, 25.4*nm)
+        self.assertTrue(ROOT.snap_layer.PrecomputeTables(300*nm, 700*nm, 0, 40*deg, 1e-3))
+        condition.SetMultilayer(ROOT.snap_layer)
+
+        manager.GetTopVolume().AddNode(lens, 1, tr1)
+        manager.GetTopVolume().AddNode(mirror, 1, tr2)
+        manager.SetRandomSeed(1234)
+        manager.CloseGeometry()
+
+        def trace(optics):
+            rays = ROOT.ARayArray()
+            for i in range(1000):
+                rays.Add(ROOT.ARay(i, 400*nm, 1*mm*(i%10), 0, 20*cm, 0, 0, 0, -1))
+            optics.TraceNonSequential(rays)
+            return (rays.GetExited().GetLast() + 1,
+                    rays.GetAbsorbed().GetLast() + 1)
+
+        fname = "unittest_snapshot.root"
+        self.assertTrue(manager.SaveSnapshot(fname))
+        expected = trace(manager)
+
+        loaded = ROOT.AOpticsManager.LoadSnapshot(fname)
+        os.remove(fname)
+        self.assertTrue(loaded)
+        self.assertTrue(loaded.IsClosed())
+        loadedlens = loaded.GetVolume("snaplens")
+        loadedmirror = loaded.GetVolume("snapmirror")
+        self.assertAlmostEqual(loadedlens.GetRefractiveIndex(400*nm), 1.5)
+
+        # the coating is read with its precomputed tables
+        cond = loaded.GetTopVolume().FindBorderSurfaceCondition(loadedmirror)
+        self.assertTrue(cond)
+        self.assertFalse(cond.GetMultilayer().GetReflectanceTable().IsEmpty())
+        self.assertEqual(trace(loaded), expected)
 
         cleanupGeo()
 
@@ -527,6 +2762,18 @@ class TestROBAST(unittest.TestCase):
         self.assertAlmostEqual(r.GetRefractiveIndex(589.3 * nm) / 1.51680, 1., 4) # nD
         self.assertAlmostEqual(r.GetExtinctionCoefficient(2325 * nm), 4.2911e-6, 9)
 
+        # the binary cache must give the same glasses
+        self.assertTrue(schott.SaveCache())
+        cached = ROOT.AGlassCatalog('../misc/schottzemax-20180601.agf')
+        os.remove(cached.GetCacheFileName())
+        self.assertEqual(cached.GetGlassNames().size(),
+                         schott.GetGlassNames().size())
+        r2 = cached.GetRefractiveIndex('N-BK7')
+        self.assertEqual(r2.GetRefractiveIndex(589.3 * nm),
+                         r.GetRefractiveIndex(589.3 * nm))
+        self.assertEqual(r2.GetExtinctionCoefficient(2325 * nm),
+                         r.GetExtinctionCoefficient(2325 * nm))
+
     def testSellmeierFormula(self):
         # N-BK7 from a SCHOTT catalog
         nbk7 = ROOT.ASellmeierFormula(1.03961212, 0.231792344, 1.01046945,
@@ -767,7 +3014,162 @@ class TestROBAST(unittest.TestCase):
         h.Draw()
         h.Fit('pol0', '', '', 0, 50)
 
+def residentBytes():
+    '''
+    Resident memory of this process after returning the freed heap to the OS
+    '''
+    if sys.platform.startswith("linux"):
+        try:
+            ctypes.CDLL("libc.so.6").malloc_trim(0)
+        except OSError:
+            pass
+    info = ROOT.ProcInfo_t()
+    ROOT.gSystem.GetProcInfo(info)
+    return info.fMemResident*1024.
+
+@unittest.skipUnless(os.environ.get("ROBAST_PERF"),
+                     "set ROBAST_PERF=1 to run performance tests")
+class TestPerformance(unittest.TestCase):
+    """
+    Performance regression tests of ROBAST
+
+    Photons/s and bytes per ray of reference setups are measured at fixed
+    seeds and ray counts, and compared with the baselines stored in
+    performance_baseline.json (or $ROBAST_PERF_BASELINE). A test fails if the
+    throughput drops or the memory grows beyond the tolerances. Baselines
+    depend on the machine and are not distributed; the tests without a
+    baseline only print their results. Write (or refresh) them on the
+    reference machine by
+
+    $ make perfbaseline
+    or
+    $ cd tutorials
+    $ ROBAST_PERF=1 ROBAST_PERF_UPDATE=1 python unittest_robast.py
+
+    and run the comparison later with "make perf".
+    """
+    kThroughputTolerance = 0.3  # allowed fractional loss of photons/s
+    kMemoryTolerance = 0.3      # allowed fractional growth of bytes/ray
+    kMemorySlack = 64           # bytes/ray allowed for the noise of RSS
+    kRepeat = 3                 # the best of the repetitions is taken
+    kThreads = 4
+
+    @classmethod
+    def setUpClass(cls):
+        ROOT.gROOT.ProcessLine('.L benchmark.C') # the reference geometries
+        cls.baselineFile = os.environ.get("ROBAST_PERF_BASELINE",
+                                          "performance_baseline.json")
+        try:
+            with open(cls.baselineFile) as f:
+                cls.baseline = json.load(f)
+        except (IOError, ValueError):
+            cls.baseline = {}
+        cls.results = {}
+
+    @classmethod
+    def tearDownClass(cls):
+        for name in sorted(cls.results):
+            print("%-24s %12.4g photons/s %10.1f bytes/ray" %
+                  (name, cls.results[name]["photons_per_s"],
+                   cls.results[name]["bytes_per_ray"]))
+        if os.environ.get("ROBAST_PERF_UPDATE"):
+            cls.baseline.update(cls.results)
+            with open(cls.baselineFile, "w") as f:
+                json.dump(cls.baseline, f, indent=2, sort_keys=True)
+
+    def measure(self, name, run):
+        '''
+        run() must return the objects holding the rays, which are kept alive
+        while the memory is measured, and the number of photons
+        '''
+        run() # warm up the thread pool, navigators and caches
+
+        best = None
+        bytesPerRay = 0
+        for i in range(self.kRepeat):
+            rss = residentBytes()
+            start = time.time()
+            objs, n = run()
+            elapsed = time.time() - start
+            self.assertGreater(n, 0)
+            bytesPerRay = max(bytesPerRay, (residentBytes() - rss)/n)
+            rate = n/elapsed if elapsed > 0 else float("inf")
+            best = rate if best is None else max(best, rate)
+            del objs
+
+        self.results[name] = {"photons_per_s": best,
+                              "bytes_per_ray": bytesPerRay}
+        if os.environ.get("ROBAST_PERF_UPDATE") or name not in self.baseline:
+            return
+
+        reference = self.baseline[name]
+        self.assertGreaterEqual(
+            best, reference["photons_per_s"]*(1 - self.kThroughputTolerance),
+            "%s: %.4g photons/s is slower than the baseline %.4g" %
+            (name, best, reference["photons_per_s"]))
+        self.assertLessEqual(
+            bytesPerRay,
+            reference["bytes_per_ray"]*(1 + self.kMemoryTolerance) +
+            self.kMemorySlack,
+            "%s: %.1f bytes/ray exceeds the baseline %.1f" %
+            (name, bytesPerRay, reference["bytes_per_ray"]))
+
+    def measureGeometry(self, name, geometry, build, nphotons):
+        manager = ROOT.AOpticsManager("manager", name)
+        manager.SetLimit(1000)
+        build(manager)
+        manager.CloseGeometry()
+        manager.SetMaxThreads(self.kThreads)
+
+        def run():
+            ROOT.gRandom.SetSeed(1)
+            manager.SetRandomSeed(1)
+            rays = ROOT.MakeRays(geometry, nphotons)
+            ROOT.SetOwnership(rays, True)
+            manager.TraceNonSequential(rays)
+            return rays, nphotons
+
+        self.measure(name, run)
+
+    def testSpherePerformance(self):
+        self.measureGeometry("Sphere", ROOT.kSphere, ROOT.BuildSphere, 10000)
+
+    def testAsphericLensPerformance(self):
+        self.measureGeometry("AsphericLens", ROOT.kAsphericLens,
+                             ROOT.BuildAsphericLens, 100000)
+
+    def testMultilayerMirrorPerformance(self):
+        self.measureGeometry("MultilayerMirror", ROOT.kMultilayerMirror,
+                             ROOT.BuildMultilayerMirror, 1000)
+
+    def testWinstonConePerformance(self):
+        self.measureGeometry("WinstonConeArray", ROOT.kWinstonConeArray,
+                             ROOT.BuildWinstonConeArray, 100000)
+
+    def testCorsikaPerformance(self):
+        # reading and conversion of all the photons in the CORSIKA file
+        def run():
+            f = ROOT.ACorsikaIACTFile()
+            f.Open("muon_ring4.corsika.gz")
+            arrays = []
+            n = 0
+            event = 1
+            while f.ReadEvent(event) > 0:
+                for tel in range(f.GetNumberOfTelescopes()):
+                    rays = f.GetRayArray(tel, 0, 30*m, 1.)
+                    if not rays:
+                        continue
+                    ROOT.SetOwnership(rays, True)
+                    n += rays.GetRunning().GetLast() + 1
+                    arrays.append(rays)
+                event += 1
+            f.Close()
+            return arrays, n
+
+        self.measure("CorsikaIngestion", run)
+
 if __name__=="__main__":
     ROOT.gRandom.SetSeed(int(time.time()))
     suite = unittest.TestLoader().loadTestsFromTestCase(TestROBAST)
+    suite.addTests(unittest.TestLoader().loadTestsFromTestCase(TestPerformance))
     unittest.TextTestRunner(verbosity=2).run(suite)